@@ -17,12 +17,23 @@ typedef enum {
     DL_EVENT_FAULT,
 } http_download_event_id_t;
 
+/**
+ * @brief download event
+ *
+ * DL_EVENT_ON_FILESIZE: offset is where the download resumes from the checkpoint, the handler
+ * can set it to a smaller value, 0 to download the whole file again.
+ * DL_EVENT_ON_DATA: data at offset of the file, in order. remain_len is the bytes of the last
+ * data not consumed, they are at the head of data. The handler sets remain_len to the bytes at
+ * the tail not consumed, they are given again with the next data. The handler sets abort to stop
+ * the download, it ends with DL_EVENT_FAULT.
+ */
 typedef struct {
     void *data;
     size_t offset;
     size_t data_len;
     size_t file_size;
     uint32_t remain_len;
+    bool abort;
     void *user_data;
 } http_download_event_t;
 
@@ -37,6 +48,11 @@ typedef struct {
     size_t file_size;
     void *user_data;
     http_download_event_cb_t event_handler;
+    /** connections downloading ranges at the same time, 0 or 1 for one streamed request */
+    uint8_t conn_num;
+    /** kv key to save the progress, the download resumes from it after reboot, NULL to disable.
+     * the key must be unique for the file, the data consumed by DL_EVENT_ON_DATA is treated as saved. */
+    const char *checkpoint;
 } http_download_config_t;
 
 int http_file_download(http_download_config_t *config);
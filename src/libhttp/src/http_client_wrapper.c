@@ -4,6 +4,15 @@
 #include "core_http_client.h"
 #include "tuya_tls.h"
 #include "tal_log.h"
+#if defined(ENABLE_HTTP_CONN_POOL) && (ENABLE_HTTP_CONN_POOL == 1)
+#include <stddef.h>
+#include "tuya_list.h"
+#include "tal_mutex.h"
+#include "tal_semaphore.h"
+#include "tal_system.h"
+#include "tal_workq_service.h"
+#include "crc32i.h"
+#endif
 
 #define log_debug PR_DEBUG
 #define log_error PR_ERR
@@ -11,6 +20,52 @@
 #define HEADER_BUFFER_LENGTH (255)
 #define DEFAULT_HTTP_PORT    (80)
 #define DEFAULT_HTTPS_PORT   (443)
+
+#if defined(ENABLE_HTTP_CONN_POOL) && (ENABLE_HTTP_CONN_POOL == 1)
+#ifndef HTTP_CONN_POOL_MAX
+#define HTTP_CONN_POOL_MAX (2)
+#endif
+#ifndef HTTP_CONN_POOL_REQ_MAX
+#define HTTP_CONN_POOL_REQ_MAX (0)
+#endif
+#ifndef HTTP_CONN_POOL_IDLE_TIMEOUT
+#define HTTP_CONN_POOL_IDLE_TIMEOUT (30000)
+#endif
+#define HTTP_CONN_REQ_FLAGS HTTP_REQUEST_KEEP_ALIVE_FLAG
+#else
+#define HTTP_CONN_REQ_FLAGS 0
+#endif
+
+/* an opened connection, owned by one request or idle in the pool */
+typedef struct {
+#if defined(ENABLE_HTTP_CONN_POOL) && (ENABLE_HTTP_CONN_POOL == 1)
+    LIST_HEAD node;
+    uint32_t cacert_crc; // reused only by the requests with the same ca
+    size_t cacert_len;
+    SYS_TIME_T idle_time;
+    uint32_t tx_bytes; // request bytes written by the current request
+    uint32_t rx_bytes; // response bytes read by the current request
+    bool pooled;       // counted by the pool, false for a connection opened over HTTP_CONN_POOL_MAX
+#endif
+    NetworkContext_t network;
+    TUYA_TRANSPORT_TYPE_E type;
+    uint16_t port;
+    char host[0];
+} http_conn_t;
+
+#if defined(ENABLE_HTTP_CONN_POOL) && (ENABLE_HTTP_CONN_POOL == 1)
+typedef struct {
+    MUTEX_HANDLE mutex;
+    SEM_HANDLE slot;      // a request holds a slot while it owns a connection, NULL for no limit
+    LIST_HEAD idle_list;  // the most recently used first
+    uint8_t conn_cnt;     // idle and owned connections
+    bool purge_pending;
+    DELAYED_WORK_HANDLE purge_work;
+} http_conn_pool_t;
+
+static http_conn_pool_t s_http_pool;
+static volatile uint8_t s_http_pool_state; // 0: not inited, 1: initing, 2: ready
+#endif
 static http_client_status_t core_http_request_send(const TransportInterface_t *pTransportInterface,
                                                    const HTTPRequestInfo_t *requestInfo, http_client_header_t *headers,
                                                    uint8_t headers_count, const uint8_t *pRequestBodyBuf,
@@ -74,79 +129,427 @@ static http_client_status_t core_http_request_send(const TransportInterface_t *p
     return HTTP_CLIENT_SUCCESS;
 }
 
-http_client_status_t http_client_request(const http_client_request_t *request, http_client_response_t *response)
+static void http_conn_close(http_conn_t *conn)
+{
+    tuya_transporter_close(conn->network);
+    tuya_transporter_destroy(conn->network);
+    tal_free(conn);
+}
+
+static http_client_status_t http_conn_open(const http_client_request_t *request, http_conn_t **out)
 {
-    http_client_status_t rt = HTTP_CLIENT_SUCCESS;
     int ret = OPRT_OK;
+    size_t host_len = strlen(request->host);
+    http_conn_t *conn = NULL;
+
+    conn = tal_malloc(sizeof(http_conn_t) + host_len + 1);
+    if (NULL == conn) {
+        return HTTP_CLIENT_MALLOC_FAULT;
+    }
+    memset(conn, 0, sizeof(http_conn_t));
+    // the tls context keeps the hostname pointer, it must live as long as the connection
+    memcpy(conn->host, request->host, host_len + 1);
 
     /* TLS pre init */
-    NetworkContext_t network;
-    TUYA_TRANSPORT_TYPE_E transport_type = (request->cacert == NULL) ? TRANSPORT_TYPE_TCP : TRANSPORT_TYPE_TLS;
-    network = tuya_transporter_create(transport_type, NULL);
-    if (NULL == network) {
+    conn->type = (request->cacert == NULL) ? TRANSPORT_TYPE_TCP : TRANSPORT_TYPE_TLS;
+    conn->network = tuya_transporter_create(conn->type, NULL);
+    if (NULL == conn->network) {
+        tal_free(conn);
         return HTTP_CLIENT_MALLOC_FAULT;
     }
 
-    if (transport_type == TRANSPORT_TYPE_TLS) {
+    if (conn->type == TRANSPORT_TYPE_TLS) {
+        conn->port = (request->port == 0) ? DEFAULT_HTTPS_PORT : request->port;
         tuya_tls_config_t tls_config = {
             .ca_cert = (char *)request->cacert,
             .ca_cert_size = request->cacert_len,
-            .hostname = (char *)request->host,
-            .port = (request->port == 0) ? DEFAULT_HTTPS_PORT : request->port,
+            .hostname = conn->host,
+            .port = conn->port,
             .timeout = request->timeout_ms,
             .mode = TUYA_TLS_SERVER_CERT_MODE,
             .verify = true,
         };
 
-        ret = tuya_transporter_ctrl(network, TUYA_TRANSPORTER_SET_TLS_CONFIG, &tls_config);
+        ret = tuya_transporter_ctrl(conn->network, TUYA_TRANSPORTER_SET_TLS_CONFIG, &tls_config);
         if (OPRT_OK != ret) {
             log_error("network_tls_init fail:%d", ret);
-            return ret;
+            tuya_transporter_destroy(conn->network);
+            tal_free(conn);
+            return HTTP_CLIENT_SEND_FAULT;
         }
+    } else {
+        conn->port = (request->port == 0) ? DEFAULT_HTTP_PORT : request->port;
+    }
 
-        ret = tuya_transporter_connect(network, tls_config.hostname, tls_config.port, tls_config.timeout);
-        if (OPRT_OK != ret) {
-            tuya_transporter_close(network);
-            tuya_transporter_destroy(network);
-            return HTTP_CLIENT_SEND_FAULT;
+    ret = tuya_transporter_connect(conn->network, conn->host, conn->port, request->timeout_ms);
+    if (OPRT_OK != ret) {
+        http_conn_close(conn);
+        return HTTP_CLIENT_SEND_FAULT;
+    }
+    log_debug("http connected %s:%d", conn->host, conn->port);
+
+    *out = conn;
+    return HTTP_CLIENT_SUCCESS;
+}
+
+#if defined(ENABLE_HTTP_CONN_POOL) && (ENABLE_HTTP_CONN_POOL == 1)
+static void http_conn_pool_purge_cb(void *data)
+{
+    SYS_TIME_T now = tal_system_get_millisecond();
+    LIST_HEAD expired;
+    LIST_HEAD *pos = NULL, *next = NULL;
+    http_conn_t *conn = NULL;
+
+    INIT_LIST_HEAD(&expired);
+
+    tal_mutex_lock(s_http_pool.mutex);
+    s_http_pool.purge_pending = false;
+    tuya_list_for_each_safe(pos, next, &s_http_pool.idle_list)
+    {
+        conn = tuya_list_entry(pos, http_conn_t, node);
+        if (now - conn->idle_time >= HTTP_CONN_POOL_IDLE_TIMEOUT) {
+            tuya_list_del(&conn->node);
+            tuya_list_add(&conn->node, &expired);
+            s_http_pool.conn_cnt--;
         }
+    }
+    // check again when the oldest one expires
+    if (!tuya_list_empty(&s_http_pool.idle_list)) {
+        conn = tuya_list_entry(s_http_pool.idle_list.prev, http_conn_t, node);
+        if (OPRT_OK == tal_workq_start_delayed(s_http_pool.purge_work,
+                                               HTTP_CONN_POOL_IDLE_TIMEOUT - (now - conn->idle_time), LOOP_ONCE)) {
+            s_http_pool.purge_pending = true;
+        }
+    }
+    tal_mutex_unlock(s_http_pool.mutex);
 
-        log_debug("tls connencted!");
-    } else {
-        ret = tuya_transporter_connect(network, request->host, (request->port == 0) ? DEFAULT_HTTP_PORT : request->port,
-                                       request->timeout_ms);
-        if (OPRT_OK != ret) {
-            tuya_transporter_close(network);
-            tuya_transporter_destroy(network);
-            return HTTP_CLIENT_SEND_FAULT;
+    tuya_list_for_each_safe(pos, next, &expired)
+    {
+        conn = tuya_list_entry(pos, http_conn_t, node);
+        log_debug("http conn %s:%d idle timeout", conn->host, conn->port);
+        http_conn_close(conn);
+    }
+}
+
+static bool http_conn_pool_ready(void)
+{
+    uint8_t state = 0;
+
+    TAL_ENTER_CRITICAL();
+    state = s_http_pool_state;
+    if (0 == state) {
+        s_http_pool_state = 1;
+    }
+    TAL_EXIT_CRITICAL();
+
+    if (0 != state) {
+        // the requests go without the pool while it is being inited
+        return (2 == state);
+    }
+
+    memset(&s_http_pool, 0, sizeof(s_http_pool));
+    INIT_LIST_HEAD(&s_http_pool.idle_list);
+    if (OPRT_OK != tal_mutex_create_init(&s_http_pool.mutex)) {
+        goto __ERR;
+    }
+#if (HTTP_CONN_POOL_REQ_MAX > 0)
+    if (OPRT_OK != tal_semaphore_create_init(&s_http_pool.slot, HTTP_CONN_POOL_REQ_MAX, HTTP_CONN_POOL_REQ_MAX)) {
+        goto __ERR;
+    }
+#endif
+    if (OPRT_OK != tal_workq_init_delayed(WORKQ_SYSTEM, http_conn_pool_purge_cb, NULL, &s_http_pool.purge_work)) {
+        goto __ERR;
+    }
+
+    s_http_pool_state = 2;
+    return true;
+
+__ERR:
+    log_error("http conn pool init fail");
+    if (s_http_pool.slot) {
+        tal_semaphore_release(s_http_pool.slot);
+    }
+    if (s_http_pool.mutex) {
+        tal_mutex_release(s_http_pool.mutex);
+    }
+    s_http_pool_state = 0;
+    return false;
+}
+
+static http_conn_t *http_conn_of(NetworkContext_t *network)
+{
+    return (http_conn_t *)((uint8_t *)network - offsetof(http_conn_t, network));
+}
+
+static int32_t http_conn_send(NetworkContext_t *network, const void *buf, size_t len)
+{
+    int32_t rt = NetworkTransportSend(network, buf, len);
+    if (rt > 0) {
+        http_conn_of(network)->tx_bytes += rt;
+    }
+    return rt;
+}
+
+static int32_t http_conn_recv(NetworkContext_t *network, void *buf, size_t len)
+{
+    int32_t rt = NetworkTransportRecv(network, buf, len);
+    if (rt > 0) {
+        http_conn_of(network)->rx_bytes += rt;
+    }
+    return rt;
+}
+
+/**
+ * @brief check if a failed request on a reused connection can be sent again on a new one
+ *
+ * The server may close an idle connection just when it is reused. Nothing has reached
+ * the server if no request byte was written. Otherwise only the idempotent methods are
+ * sent again (RFC 7230 6.3.1), and only if no response byte was read, so a POST that
+ * may have been handled by the server is never repeated.
+ *
+ * @param[in] request: http request
+ * @param[in] conn: the connection the request failed on
+ *
+ * @return true if the request can be retried
+ */
+static bool http_conn_retryable(const http_client_request_t *request, const http_conn_t *conn)
+{
+    static const char *idempotent[] = {"GET", "HEAD", "PUT", "DELETE", "OPTIONS"};
+    uint8_t i = 0;
+
+    if (0 == conn->tx_bytes) {
+        return true;
+    }
+    if (0 != conn->rx_bytes) {
+        return false;
+    }
+    for (i = 0; i < sizeof(idempotent) / sizeof(idempotent[0]); i++) {
+        if (0 == strcmp(request->method, idempotent[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief get a connection to the host of the request, an idle one is reused if it
+ * matches the host, port and ca and is still alive, or a new one is opened
+ *
+ * @param[in] request: http request
+ * @param[in] reuse: false to open a new connection
+ * @param[out] out: the connection, give it back by http_conn_release
+ * @param[out] reused: true if the connection was reused
+ *
+ * @return HTTP_CLIENT_SUCCESS on success, others on failure
+ */
+static http_client_status_t http_conn_acquire(const http_client_request_t *request, bool reuse, http_conn_t **out,
+                                              bool *reused)
+{
+    http_client_status_t rt = HTTP_CLIENT_SUCCESS;
+    TUYA_TRANSPORT_TYPE_E type = (request->cacert == NULL) ? TRANSPORT_TYPE_TCP : TRANSPORT_TYPE_TLS;
+    uint16_t port = request->port;
+    uint32_t crc = 0;
+    LIST_HEAD *pos = NULL;
+    http_conn_t *conn = NULL;
+    http_conn_t *evict = NULL;
+    bool pooled = true;
+
+    *reused = false;
+    if (0 == port) {
+        port = (type == TRANSPORT_TYPE_TLS) ? DEFAULT_HTTPS_PORT : DEFAULT_HTTP_PORT;
+    }
+    if (request->cacert) {
+        crc = hash_crc32i_total(request->cacert, request->cacert_len);
+    }
+
+    if (s_http_pool.slot && OPRT_OK != tal_semaphore_wait(s_http_pool.slot, request->timeout_ms)) {
+        log_error("http conn pool busy");
+        return HTTP_CLIENT_SEND_FAULT;
+    }
+
+    tal_mutex_lock(s_http_pool.mutex);
+    tuya_list_for_each(pos, &s_http_pool.idle_list)
+    {
+        http_conn_t *idle = tuya_list_entry(pos, http_conn_t, node);
+        if (reuse && idle->type == type && idle->port == port && idle->cacert_crc == crc &&
+            idle->cacert_len == request->cacert_len && 0 == strcmp(idle->host, request->host)) {
+            tuya_list_del(&idle->node);
+            conn = idle;
+            conn->tx_bytes = 0;
+            conn->rx_bytes = 0;
+            break;
+        }
+    }
+    if (NULL == conn) {
+        if (s_http_pool.conn_cnt < HTTP_CONN_POOL_MAX) {
+            s_http_pool.conn_cnt++;
+        } else if (!tuya_list_empty(&s_http_pool.idle_list)) {
+            // the least recently used idle one is dropped to make room
+            evict = tuya_list_entry(s_http_pool.idle_list.prev, http_conn_t, node);
+            tuya_list_del(&evict->node);
+        } else {
+            // all of them are in use, this one is closed after the response
+            pooled = false;
+        }
+    }
+    tal_mutex_unlock(s_http_pool.mutex);
+
+    if (evict) {
+        http_conn_close(evict);
+    }
+
+    if (conn) {
+        // readable while idle means the peer closed it or sent something unexpected
+        if (tal_system_get_millisecond() - conn->idle_time < HTTP_CONN_POOL_IDLE_TIMEOUT &&
+            0 == tuya_transporter_poll_read(conn->network, 0)) {
+            if (conn->type == TRANSPORT_TYPE_TLS) {
+                tuya_tls_config_t *tls_config = NULL;
+                tuya_transporter_ctrl(conn->network, TUYA_TRANSPORTER_GET_TLS_CONFIG, &tls_config);
+                if (tls_config) {
+                    tls_config->timeout = request->timeout_ms;
+                }
+            }
+            log_debug("http conn %s:%d reused", conn->host, conn->port);
+            *reused = true;
+            *out = conn;
+            return HTTP_CLIENT_SUCCESS;
+        }
+        log_debug("http conn %s:%d broken", conn->host, conn->port);
+        http_conn_close(conn);
+        conn = NULL;
+    }
+
+    rt = http_conn_open(request, &conn);
+    if (HTTP_CLIENT_SUCCESS != rt) {
+        if (pooled) {
+            tal_mutex_lock(s_http_pool.mutex);
+            s_http_pool.conn_cnt--;
+            tal_mutex_unlock(s_http_pool.mutex);
+        }
+        if (s_http_pool.slot) {
+            tal_semaphore_post(s_http_pool.slot);
+        }
+        return rt;
+    }
+    conn->cacert_crc = crc;
+    conn->cacert_len = request->cacert_len;
+    conn->pooled = pooled;
+
+    *out = conn;
+    return HTTP_CLIENT_SUCCESS;
+}
+
+/**
+ * @brief give back the connection got by http_conn_acquire
+ *
+ * @param[in] conn: the connection
+ * @param[in] keep: keep it for the next request, false to close it
+ *
+ * @return none
+ */
+static void http_conn_release(http_conn_t *conn, bool keep)
+{
+    bool pooled = conn->pooled;
+
+    // a connection opened over HTTP_CONN_POOL_MAX is never kept
+    keep = keep && pooled;
+    if (!keep) {
+        http_conn_close(conn);
+    }
+
+    tal_mutex_lock(s_http_pool.mutex);
+    if (keep) {
+        conn->idle_time = tal_system_get_millisecond();
+        tuya_list_add(&conn->node, &s_http_pool.idle_list);
+        if (!s_http_pool.purge_pending &&
+            OPRT_OK == tal_workq_start_delayed(s_http_pool.purge_work, HTTP_CONN_POOL_IDLE_TIMEOUT, LOOP_ONCE)) {
+            s_http_pool.purge_pending = true;
+        }
+    } else if (pooled) {
+        s_http_pool.conn_cnt--;
+    }
+    tal_mutex_unlock(s_http_pool.mutex);
+
+    if (s_http_pool.slot) {
+        tal_semaphore_post(s_http_pool.slot);
+    }
+}
+#endif
+
+http_client_status_t http_client_request(const http_client_request_t *request, http_client_response_t *response)
+{
+    http_client_status_t rt = HTTP_CLIENT_SUCCESS;
+    http_conn_t *conn = NULL;
+    bool pooled = false;
+    bool reused = false;
+    HTTPResponse_t http_response;
+
+#if defined(ENABLE_HTTP_CONN_POOL) && (ENABLE_HTTP_CONN_POOL == 1)
+    pooled = http_conn_pool_ready();
+#endif
+
+    for (;;) {
+#if defined(ENABLE_HTTP_CONN_POOL) && (ENABLE_HTTP_CONN_POOL == 1)
+        if (pooled) {
+            // a broken reused connection is retried once with a new one
+            rt = http_conn_acquire(request, !reused, &conn, &reused);
+        } else
+#endif
+        {
+            rt = http_conn_open(request, &conn);
+        }
+        if (HTTP_CLIENT_SUCCESS != rt) {
+            return rt;
+        }
+
+        /* http client TransportInterface */
+        TransportInterface_t pTransportInterface = {.pNetworkContext = (NetworkContext_t *)&conn->network,
+                                                    .recv = (TransportRecv_t)NetworkTransportRecv,
+                                                    .send = (TransportSend_t)NetworkTransportSend};
+#if defined(ENABLE_HTTP_CONN_POOL) && (ENABLE_HTTP_CONN_POOL == 1)
+        if (pooled) {
+            // count the bytes on the wire to tell a stale connection from a failure after sending
+            pTransportInterface.recv = http_conn_recv;
+            pTransportInterface.send = http_conn_send;
+        }
+#endif
+
+        /* http client request object make */
+        HTTPRequestInfo_t requestInfo = {
+            .pMethod = request->method,
+            .methodLen = strlen(request->method),
+            .pHost = request->host,
+            .hostLen = strlen(request->host),
+            .pPath = request->path,
+            .pathLen = strlen(request->path),
+            .reqFlags = pooled ? HTTP_CONN_REQ_FLAGS : 0,
+        };
+
+        memset(&http_response, 0, sizeof(http_response));
+
+        /* HTTP request send */
+        log_debug("http request send!");
+        rt = core_http_request_send((const TransportInterface_t *)&pTransportInterface,
+                                    (const HTTPRequestInfo_t *)&requestInfo, request->headers, request->headers_count,
+                                    (const uint8_t *)request->body, request->body_length, &http_response);
+
+#if defined(ENABLE_HTTP_CONN_POOL) && (ENABLE_HTTP_CONN_POOL == 1)
+        if (pooled) {
+            bool retry = (HTTP_CLIENT_SEND_FAULT == rt) && reused && http_conn_retryable(request, conn);
+            http_conn_release(conn, (HTTP_CLIENT_SUCCESS == rt) &&
+                                        !(http_response.respFlags & HTTP_RESPONSE_CONNECTION_CLOSE_FLAG));
+            if (retry) {
+                log_debug("reused http conn fail, retry");
+                continue;
+            }
+        } else
+#endif
+        {
+            /* tls disconnect */
+            http_conn_close(conn);
         }
+        break;
     }
-    /* http client TransportInterface */
-    TransportInterface_t pTransportInterface = {.pNetworkContext = (NetworkContext_t *)&network,
-                                                .recv = (TransportRecv_t)NetworkTransportRecv,
-                                                .send = (TransportSend_t)NetworkTransportSend};
-
-    /* http client request object make */
-    HTTPRequestInfo_t requestInfo = {
-        .pMethod = request->method,
-        .methodLen = strlen(request->method),
-        .pHost = request->host,
-        .hostLen = strlen(request->host),
-        .pPath = request->path,
-        .pathLen = strlen(request->path),
-    };
-
-    HTTPResponse_t http_response = {0};
-
-    /* HTTP request send */
-    log_debug("http request send!");
-    rt = core_http_request_send((const TransportInterface_t *)&pTransportInterface,
-                                (const HTTPRequestInfo_t *)&requestInfo, request->headers, request->headers_count,
-                                (const uint8_t *)request->body, request->body_length, &http_response);
-
-    /* tls disconnect */
-    tuya_transporter_close(network);
-    tuya_transporter_destroy(network);
 
     if (OPRT_OK != rt) {
         log_error("http_request_send error:%d", rt);
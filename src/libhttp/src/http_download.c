@@ -17,13 +17,47 @@ typedef enum {
     DL_STATE_COMPLETE,
 } http_download_state_t;
 
+typedef enum {
+    DL_CONN_IDLE,     // no range
+    DL_CONN_FETCHING, // owned by the worker
+    DL_CONN_DONE,     // fetch returned, result is set
+    DL_CONN_READY,    // range received, waiting for the ranges before it to be delivered
+} http_download_conn_state_t;
+
+typedef struct http_download http_download_t;
+
+/* one connection to the server, fetches one range at a time */
 typedef struct {
-    http_download_config_t config;
-    http_download_event_t event;
+    http_download_t *dl;
+    NetworkContext_t network;
     TransportInterface_t transport;
     HTTPRequestHeaders_t requestHeaders;
-    HTTPRequestInfo_t requestInfo;
     HTTPResponse_t response;
+    bool connected;
+    bool failed; // the last fetch failed, wait before reconnecting
+    uint8_t state;
+    uint8_t *buffer;
+    size_t buffer_size;
+    size_t start; // range of the file
+    size_t len;
+    size_t got;
+    int result;
+    uint32_t cost_ms;
+    SEM_HANDLE go;
+    THREAD_HANDLE thread;
+    volatile bool exited;
+} http_download_conn_t;
+
+/* progress saved to kv */
+typedef struct {
+    uint32_t file_size;
+    uint32_t offset;
+} http_download_checkpoint_t;
+
+struct http_download {
+    http_download_config_t config;
+    http_download_event_t event;
+    HTTPRequestInfo_t requestInfo;
     char *host;
     char *path;
     uint16_t port;
@@ -33,7 +67,17 @@ typedef struct {
     size_t offset;
     uint8_t state;
     uint8_t *buffer;
-} http_download_t;
+    size_t buffer_size;
+    size_t resume_offset;
+    size_t checkpoint_offset;
+    size_t range_length; // adapted to the throughput by the parallel download
+    bool notified;       // DL_EVENT_ON_FILESIZE is sent
+    bool range_ignored;  // the server answered a range with the whole file
+    MUTEX_HANDLE mutex;
+    SEM_HANDLE done;
+    uint8_t conn_num;
+    http_download_conn_t conn[0];
+};
 
 #define MAX_RETRY_TIMES (8u)
 /*-----------------------------------------------------------*/
@@ -66,11 +110,49 @@ typedef struct {
  */
 #define HTTP_STATUS_CODE_PARTIAL_CONTENT 206
 
+/**
+ * @brief HTTP status code of the whole file, sent by a server that ignores Range.
+ */
+#define HTTP_STATUS_CODE_OK 200
+
 //! timeout sec
 #define HTTP_DOWNLOAD_TIMEOUT 180
 
+//! wait before reconnecting, ms
+#ifndef HTTP_DOWNLOAD_RETRY_DELAY
+#define HTTP_DOWNLOAD_RETRY_DELAY 3000
+#endif
+
+//! the progress is saved every step bytes
+#define HTTP_DOWNLOAD_CHECKPOINT_STEP (64 * 1024)
+
+/**
+ * @brief The range of one request of the parallel download is adapted between
+ * RANGE_REQUEST_LENGTH_MIN and (range_length << HTTP_DOWNLOAD_RANGE_SHIFT). It
+ * doubles when a request takes less than HTTP_DOWNLOAD_RANGE_FAST_MS, so the
+ * round trip of a request is small to its transfer time, and halves when one
+ * takes more than HTTP_DOWNLOAD_RANGE_SLOW_MS or fails, so less is fetched again.
+ */
+#define RANGE_REQUEST_LENGTH_MIN    (1024)
+#define HTTP_DOWNLOAD_RANGE_SHIFT   (3)
+#define HTTP_DOWNLOAD_RANGE_FAST_MS (1000)
+#define HTTP_DOWNLOAD_RANGE_SLOW_MS (4000)
+
+#define HTTP_DOWNLOAD_STACK_SIZE (4096)
+
 /*-----------------------------------------------------------*/
-static int http_download_filesize_get(http_download_t *ctx)
+static void http_download_response_free(http_download_conn_t *conn)
+{
+    if (conn->response.pBuffer) {
+        tal_free(conn->response.pBuffer);
+    }
+    if (conn->response.pBody) {
+        tal_free(conn->response.pBody);
+    }
+    memset(&conn->response, 0, sizeof(conn->response));
+}
+
+static int http_download_filesize_get(http_download_t *ctx, http_download_conn_t *conn)
 {
     int rt = 0;
     /* The location of the file size in contentRangeValStr. */
@@ -80,19 +162,20 @@ static int http_download_filesize_get(http_download_t *ctx)
     size_t contentRangeValStrLength = 0;
 
     PR_DEBUG("Getting file object size from host...");
-    TUYA_CALL_ERR_GOTO(HTTPClient_InitializeRequestHeaders(&ctx->requestHeaders, &ctx->requestInfo), __exit);
-    TUYA_CALL_ERR_GOTO(HTTPClient_AddRangeHeader(&ctx->requestHeaders, 0, 0), __exit);
-    TUYA_CALL_ERR_GOTO(HTTPClient_Request(&ctx->transport, &ctx->requestHeaders, NULL, 0, &ctx->response, 0), __exit);
+    TUYA_CALL_ERR_GOTO(HTTPClient_InitializeRequestHeaders(&conn->requestHeaders, &ctx->requestInfo), __exit);
+    TUYA_CALL_ERR_GOTO(HTTPClient_AddRangeHeader(&conn->requestHeaders, 0, 0), __exit);
+    TUYA_CALL_ERR_GOTO(HTTPClient_Request(&conn->transport, &conn->requestHeaders, NULL, 0, &conn->response, 0),
+                       __exit);
     PR_DEBUG("Received HTTP response from %s%s...", ctx->host, ctx->path);
-    PR_DEBUG("Response Headers:\n%.*s", (int32_t)ctx->response.headersLen, ctx->response.pHeaders);
-    if (ctx->response.statusCode != HTTP_STATUS_CODE_PARTIAL_CONTENT) {
+    PR_DEBUG("Response Headers:\n%.*s", (int32_t)conn->response.headersLen, conn->response.pHeaders);
+    if (conn->response.statusCode != HTTP_STATUS_CODE_PARTIAL_CONTENT) {
         PR_ERR("Received an invalid response from the server "
                "(Status Code: %u).",
-               ctx->response.statusCode);
+               conn->response.statusCode);
         rt = OPRT_NOT_SUPPORTED;
         goto __exit;
     }
-    TUYA_CALL_ERR_GOTO(HTTPClient_ReadHeader(&ctx->response, (char *)HTTP_CONTENT_RANGE_HEADER_FIELD,
+    TUYA_CALL_ERR_GOTO(HTTPClient_ReadHeader(&conn->response, (char *)HTTP_CONTENT_RANGE_HEADER_FIELD,
                                              (size_t)HTTP_CONTENT_RANGE_HEADER_FIELD_LENGTH,
                                              (const char **)&contentRangeValStr, &contentRangeValStrLength),
                        __exit);
@@ -105,31 +188,189 @@ static int http_download_filesize_get(http_download_t *ctx)
     pFileSizeStr += sizeof(char);
     ctx->file_size = (size_t)strtoul(pFileSizeStr, NULL, 10);
     PR_INFO("The file is %d bytes long.", (int32_t)ctx->file_size);
-    if (ctx->response.pBuffer) {
-        tal_free(ctx->response.pBuffer);
-    }
-    memset(&ctx->response, 0, sizeof(ctx->response));
 __exit:
+    http_download_response_free(conn);
     return rt;
 }
 
-static int http_download_range_request(http_download_t *ctx, uint32_t range_start, uint32_t range_end)
+static int http_download_range_request(http_download_t *ctx, http_download_conn_t *conn, uint32_t range_start,
+                                       uint32_t range_end)
 {
     int rt = OPRT_OK;
 
     PR_DEBUG("Downloading bytes %d-%d, from %s...: ", range_start, range_end, ctx->host);
-    TUYA_CALL_ERR_GOTO(HTTPClient_InitializeRequestHeaders(&ctx->requestHeaders, &ctx->requestInfo), __exit);
-    TUYA_CALL_ERR_GOTO(HTTPClient_AddRangeHeader(&ctx->requestHeaders, range_start, range_end), __exit);
-    PR_TRACE("Request Headers:\n%.*s", (int32_t)ctx->requestHeaders.headersLen, (char *)ctx->requestHeaders.pBuffer);
-    TUYA_CALL_ERR_GOTO(HTTPClient_Request(&ctx->transport, &ctx->requestHeaders, NULL, 0, &ctx->response,
+    http_download_response_free(conn);
+    TUYA_CALL_ERR_GOTO(HTTPClient_InitializeRequestHeaders(&conn->requestHeaders, &ctx->requestInfo), __exit);
+    TUYA_CALL_ERR_GOTO(HTTPClient_AddRangeHeader(&conn->requestHeaders, range_start, range_end), __exit);
+    PR_TRACE("Request Headers:\n%.*s", (int32_t)conn->requestHeaders.headersLen, (char *)conn->requestHeaders.pBuffer);
+    TUYA_CALL_ERR_GOTO(HTTPClient_Request(&conn->transport, &conn->requestHeaders, NULL, 0, &conn->response,
                                           HTTP_SEND_DISABLE_RECV_BODY_FLAG),
                        __exit);
     PR_TRACE("Received HTTP response from %s%s...", ctx->host, ctx->path);
-    PR_TRACE("Response Headers:\n%.*s", (int32_t)ctx->response.headersLen, ctx->response.pHeaders);
+    PR_TRACE("Response Headers:\n%.*s", (int32_t)conn->response.headersLen, conn->response.pHeaders);
+    if (conn->response.statusCode == HTTP_STATUS_CODE_OK && 0 == range_start &&
+        conn->response.contentLength == ctx->file_size) {
+        // the whole file from 0 is the range of the sequential download, but of no other one
+        if (range_end != ctx->file_size - 1) {
+            PR_WARN("range ignored by the server");
+            ctx->range_ignored = true;
+            rt = OPRT_NOT_SUPPORTED;
+        }
+    } else if (conn->response.statusCode != HTTP_STATUS_CODE_PARTIAL_CONTENT ||
+               conn->response.contentLength != range_end - range_start + 1) {
+        PR_ERR("range response invalid, status %u, length %d", conn->response.statusCode,
+               (int32_t)conn->response.contentLength);
+        rt = OPRT_COM_ERROR;
+    }
 __exit:
     return rt;
 }
 
+/*-----------------------------------------------------------*/
+static int http_download_conn_init(http_download_t *ctx, http_download_conn_t *conn)
+{
+    int rt = OPRT_OK;
+    TUYA_TRANSPORT_TYPE_E transport_type = (ctx->config.cacert == NULL) ? TRANSPORT_TYPE_TCP : TRANSPORT_TYPE_TLS;
+
+    conn->dl = ctx;
+    conn->requestHeaders.bufferLen = 512;
+    conn->requestHeaders.pBuffer = tal_malloc(conn->requestHeaders.bufferLen);
+    TUYA_CHECK_NULL_RETURN(conn->requestHeaders.pBuffer, OPRT_MALLOC_FAILED);
+
+    /* TLS pre init */
+    conn->network = tuya_transporter_create(transport_type, NULL);
+    TUYA_CHECK_NULL_RETURN(conn->network, OPRT_MALLOC_FAILED);
+    if (transport_type == TRANSPORT_TYPE_TLS) {
+        tuya_tls_config_t tls_config = {
+            .ca_cert = (char *)ctx->config.cacert,
+            .ca_cert_size = ctx->config.cacert_len,
+            .hostname = (char *)ctx->host,
+            .port = ctx->port,
+            .timeout = ctx->config.timeout_ms ? ctx->config.timeout_ms : 5000,
+            .mode = TUYA_TLS_SERVER_CERT_MODE,
+            .verify = true,
+        };
+
+        TUYA_CALL_ERR_RETURN(tuya_transporter_ctrl(conn->network, TUYA_TRANSPORTER_SET_TLS_CONFIG, &tls_config));
+    }
+    /* http client TransportInterface */
+    conn->transport.pNetworkContext = (NetworkContext_t *)&conn->network;
+    conn->transport.send = NetworkTransportSend;
+    conn->transport.recv = NetworkTransportRecv;
+
+    return rt;
+}
+
+static void http_download_conn_deinit(http_download_conn_t *conn)
+{
+    http_download_response_free(conn);
+    if (conn->network) {
+        tuya_transporter_close(conn->network);
+        tuya_transporter_destroy(conn->network);
+    }
+    if (conn->requestHeaders.pBuffer) {
+        tal_free(conn->requestHeaders.pBuffer);
+    }
+    if (conn->buffer) {
+        tal_free(conn->buffer);
+    }
+}
+
+/*-----------------------------------------------------------*/
+static void http_download_checkpoint_load(http_download_t *ctx)
+{
+    http_download_checkpoint_t *cp = NULL;
+    size_t len = 0;
+
+    if (NULL == ctx->config.checkpoint || OPRT_OK != tal_kv_get(ctx->config.checkpoint, (uint8_t **)&cp, &len)) {
+        return;
+    }
+    if (len == sizeof(http_download_checkpoint_t) && cp->file_size == ctx->file_size && cp->offset < ctx->file_size) {
+        PR_INFO("download resume from %d", cp->offset);
+        ctx->resume_offset = cp->offset;
+        ctx->checkpoint_offset = cp->offset;
+    }
+    tal_kv_free((uint8_t *)cp);
+}
+
+/* offset: the bytes consumed by the event handler */
+static void http_download_checkpoint_save(http_download_t *ctx, size_t offset, bool force)
+{
+    http_download_checkpoint_t cp;
+
+    if (NULL == ctx->config.checkpoint) {
+        return;
+    }
+    if (!force && offset < ctx->checkpoint_offset + HTTP_DOWNLOAD_CHECKPOINT_STEP) {
+        return;
+    }
+    cp.file_size = ctx->file_size;
+    cp.offset = offset;
+    if (OPRT_OK == tal_kv_set(ctx->config.checkpoint, (const uint8_t *)&cp, sizeof(cp))) {
+        ctx->checkpoint_offset = offset;
+    }
+}
+
+static void http_download_filesize_notify(http_download_t *ctx)
+{
+    http_download_checkpoint_load(ctx);
+    ctx->event.file_size = ctx->file_size;
+    ctx->event.offset = ctx->resume_offset;
+    if (ctx->config.event_handler) {
+        ctx->config.event_handler(DL_EVENT_ON_FILESIZE, &ctx->event);
+    }
+    // the handler can not resume from the checkpoint
+    if (ctx->event.offset < ctx->resume_offset) {
+        ctx->resume_offset = ctx->event.offset;
+    }
+}
+
+/* give data to the event handler, data is taken after the remain of last time */
+static int http_download_data_notify(http_download_t *ctx, uint8_t *data, size_t len)
+{
+    uint8_t *p = data;
+
+    if (ctx->remain_len) {
+        if (ctx->remain_len + len > ctx->buffer_size) {
+            uint8_t *buffer = tal_realloc(ctx->buffer, ctx->remain_len + len);
+            TUYA_CHECK_NULL_RETURN(buffer, OPRT_MALLOC_FAILED);
+            ctx->buffer = buffer;
+            ctx->buffer_size = ctx->remain_len + len;
+        }
+        memcpy(ctx->buffer + ctx->remain_len, data, len);
+        p = ctx->buffer;
+    }
+
+    ctx->event.data = p;
+    ctx->event.data_len = ctx->remain_len + len;
+    ctx->event.offset = ctx->received_size - ctx->remain_len;
+    ctx->event.remain_len = ctx->remain_len;
+    if (ctx->config.event_handler) {
+        ctx->config.event_handler(DL_EVENT_ON_DATA, &ctx->event);
+    } else {
+        ctx->event.remain_len = 0;
+    }
+    if (ctx->event.abort) {
+        PR_ERR("download aborted by the handler");
+        return OPRT_COM_ERROR;
+    }
+    ctx->received_size += len;
+    ctx->remain_len = ctx->event.remain_len;
+    if (ctx->remain_len > ctx->buffer_size) {
+        // kept from a range larger than the buffer
+        uint8_t *buffer = tal_realloc(ctx->buffer, ctx->remain_len);
+        TUYA_CHECK_NULL_RETURN(buffer, OPRT_MALLOC_FAILED);
+        ctx->buffer = buffer;
+        ctx->buffer_size = ctx->remain_len;
+    }
+    if (ctx->remain_len) {
+        memmove(ctx->buffer, p + (ctx->event.data_len - ctx->remain_len), ctx->remain_len);
+    }
+    http_download_checkpoint_save(ctx, ctx->received_size - ctx->remain_len, false);
+
+    return OPRT_OK;
+}
+
 /*-----------------------------------------------------------*/
 static int http_file_download_init(http_download_t *ctx, http_download_config_t *config)
 {
@@ -138,13 +379,13 @@ static int http_file_download_init(http_download_t *ctx, http_download_config_t
     if (NULL == ctx || NULL == config || NULL == config->url) {
         return OPRT_INVALID_PARM;
     }
-    memset(ctx, 0, sizeof(http_download_t));
     memcpy(&ctx->config, config, sizeof(http_download_config_t));
     ctx->file_size = ctx->config.file_size;
     ctx->config.range_length = config->range_length;
     if (config->range_length == 0) {
         ctx->config.range_length = RANGE_REQUEST_LENGTH_DEFAULT;
     }
+    ctx->range_length = ctx->config.range_length;
     ctx->event.user_data = ctx->config.user_data;
 
     /* url parse to host port path */
@@ -184,7 +425,8 @@ static int http_file_download_init(http_download_t *ctx, http_download_config_t
     memcpy(ctx->path, p_path, path_len);
     ctx->path[path_len] = 0;
 
-    ctx->buffer = tal_malloc(ctx->config.range_length + 1);
+    ctx->buffer_size = ctx->config.range_length + 1;
+    ctx->buffer = tal_malloc(ctx->buffer_size);
     TUYA_CHECK_NULL_RETURN(ctx->buffer, OPRT_MALLOC_FAILED);
 
     HTTPRequestInfo_t *requestInfo = &ctx->requestInfo;
@@ -195,61 +437,32 @@ static int http_file_download_init(http_download_t *ctx, http_download_config_t
     requestInfo->pPath = ctx->path;
     requestInfo->pathLen = strlen(ctx->path);
     requestInfo->reqFlags = HTTP_REQUEST_KEEP_ALIVE_FLAG;
-    /* Set the buffer used for storing request headers. */
 
-    HTTPRequestHeaders_t *requestHeaders = &ctx->requestHeaders;
-    requestHeaders->bufferLen = 512;
-    requestHeaders->pBuffer = tal_malloc(requestHeaders->bufferLen);
-    TUYA_CHECK_NULL_RETURN(requestHeaders->pBuffer, OPRT_MALLOC_FAILED);
+    int i;
+    for (i = 0; i < ctx->conn_num; i++) {
+        TUYA_CALL_ERR_RETURN(http_download_conn_init(ctx, &ctx->conn[i]));
+    }
 
     return rt;
 }
 
-int http_file_download(http_download_config_t *config)
+/* one streamed request of the whole file over one connection */
+static bool http_download_sequential(http_download_t *ctx)
 {
     int rt = OPRT_OK;
-
-    http_download_t *ctx = tal_calloc(1, sizeof(http_download_t));
-    TUYA_CHECK_NULL_GOTO(ctx, __exit);
-    TUYA_CALL_ERR_GOTO(http_file_download_init(ctx, config), __exit);
-    /* TLS pre init */
-    TUYA_TRANSPORT_TYPE_E transport_type = (config->cacert == NULL) ? TRANSPORT_TYPE_TCP : TRANSPORT_TYPE_TLS;
-    NetworkContext_t network;
-    TUYA_CHECK_NULL_GOTO(network = tuya_transporter_create(transport_type, NULL), __exit);
-    if (transport_type == TRANSPORT_TYPE_TLS) {
-        tuya_tls_config_t tls_config = {
-            .ca_cert = (char *)config->cacert,
-            .ca_cert_size = config->cacert_len,
-            .hostname = (char *)ctx->host,
-            .port = ctx->port,
-            .mode = TUYA_TLS_SERVER_CERT_MODE,
-            .verify = true,
-        };
-
-        TUYA_CALL_ERR_GOTO(tuya_transporter_ctrl(network, TUYA_TRANSPORTER_SET_TLS_CONFIG, &tls_config), __exit);
-    }
-    /* http client TransportInterface */
-    ctx->transport.pNetworkContext = (NetworkContext_t *)&network;
-    ctx->transport.send = NetworkTransportSend;
-    ctx->transport.recv = NetworkTransportRecv;
-
-    ctx->state = DL_STATE_NETWORK_CONNECT;
+    http_download_conn_t *conn = &ctx->conn[0];
     TIME_T download_time = tal_time_get_posix();
-
     bool is_completed = false;
-
     int32_t read_size = 0;
 
-    if (ctx->config.event_handler) {
-        ctx->config.event_handler(DL_EVENT_START, &ctx->event);
-    }
+    ctx->state = DL_STATE_NETWORK_CONNECT;
 
     do {
 
         switch (ctx->state) {
 
         case DL_STATE_NETWORK_CONNECT:
-            rt = tuya_transporter_connect(network, ctx->host, ctx->port, config->timeout_ms);
+            rt = tuya_transporter_connect(conn->network, ctx->host, ctx->port, ctx->config.timeout_ms);
             if (OPRT_OK == rt) {
                 ctx->state = DL_STATE_FILESIZE_GET;
             } else {
@@ -259,21 +472,23 @@ int http_file_download(http_download_config_t *config)
 
         case DL_STATE_FILESIZE_GET:
             if (0 == ctx->file_size) {
-                rt = http_download_filesize_get(ctx);
+                rt = http_download_filesize_get(ctx, conn);
             }
             if (OPRT_OK != rt) {
                 ctx->state = DL_STATE_NETWORK_RECONNECT;
                 break;
             }
-            if (ctx->config.event_handler) {
-                ctx->event.file_size = ctx->file_size;
-                ctx->config.event_handler(DL_EVENT_ON_FILESIZE, &ctx->event);
+            if (!ctx->notified) {
+                // notify once, the reconnection goes on from received_size
+                http_download_filesize_notify(ctx);
+                ctx->received_size = ctx->resume_offset;
+                ctx->notified = true;
             }
             ctx->state = DL_STATE_RANGE_REQUEST;
             break;
 
         case DL_STATE_RANGE_REQUEST:
-            rt = http_download_range_request(ctx, ctx->received_size, ctx->file_size);
+            rt = http_download_range_request(ctx, conn, ctx->received_size, ctx->file_size - 1);
             if (OPRT_OK != rt) {
                 ctx->state = DL_STATE_NETWORK_RECONNECT;
                 break;
@@ -281,27 +496,34 @@ int http_file_download(http_download_config_t *config)
             ctx->state = DL_STATE_DATE_GET;
 
         case DL_STATE_DATE_GET: {
-            read_size = HTTPClient_Recv(&ctx->transport, &ctx->response, ctx->buffer + ctx->remain_len,
+            read_size = HTTPClient_Recv(&conn->transport, &conn->response, ctx->buffer + ctx->remain_len,
                                         ctx->config.range_length - ctx->remain_len);
 
             if (read_size <= 0) {
-                PR_WARN("file download range get error:%d, goto retry", rt);
+                PR_WARN("file download range get error:%d, goto retry", read_size);
                 ctx->state = DL_STATE_NETWORK_RECONNECT;
                 break;
             }
+            ctx->event.data = (uint8_t *)ctx->buffer;
+            ctx->event.data_len = read_size + ctx->remain_len;
+            ctx->event.offset = ctx->received_size - ctx->remain_len;
+            ctx->event.remain_len = ctx->remain_len;
             if (ctx->config.event_handler) {
-                ctx->event.data = (uint8_t *)ctx->buffer;
-                ctx->event.data_len = read_size + ctx->remain_len;
-                ctx->event.offset = ctx->received_size - ctx->remain_len;
-                ctx->event.remain_len = ctx->remain_len;
                 ctx->config.event_handler(DL_EVENT_ON_DATA, &ctx->event);
-                if (ctx->event.remain_len) {
-                    memmove(ctx->buffer, ctx->buffer + (ctx->event.data_len - ctx->event.remain_len),
-                            ctx->event.remain_len);
-                }
-                ctx->remain_len = ctx->event.remain_len;
-                ctx->received_size += read_size;
+            } else {
+                ctx->event.remain_len = 0;
             }
+            if (ctx->event.abort) {
+                PR_ERR("download aborted by the handler");
+                return false;
+            }
+            if (ctx->event.remain_len) {
+                memmove(ctx->buffer, ctx->buffer + (ctx->event.data_len - ctx->event.remain_len),
+                        ctx->event.remain_len);
+            }
+            ctx->remain_len = ctx->event.remain_len;
+            ctx->received_size += read_size;
+            http_download_checkpoint_save(ctx, ctx->received_size - ctx->remain_len, false);
             //! reset time
             download_time = tal_time_get_posix();
             /* File download complete? */
@@ -312,25 +534,313 @@ int http_file_download(http_download_config_t *config)
         }
 
         case DL_STATE_NETWORK_RECONNECT:
-            tuya_transporter_close(network);
-            tal_system_sleep(3000);
+            http_download_response_free(conn);
+            tuya_transporter_close(conn->network);
+            http_download_checkpoint_save(ctx, ctx->received_size - ctx->remain_len, true);
+            tal_system_sleep(HTTP_DOWNLOAD_RETRY_DELAY);
             ctx->state = DL_STATE_NETWORK_CONNECT;
             break;
 
         case DL_STATE_COMPLETE:
-            PR_INFO("Download Complete!");
             is_completed = true;
-            if (ctx->config.event_handler) {
-                ctx->config.event_handler(DL_EVENT_FINISH, &ctx->event);
-            }
             break;
         }
     } while (((tal_time_get_posix() - download_time) < HTTP_DOWNLOAD_TIMEOUT) && !is_completed);
 
-    tuya_transporter_close(network);
-    tuya_transporter_destroy(network);
+    return is_completed;
+}
+
+/*-----------------------------------------------------------*/
+/* fetch the range of conn into its buffer, goes on from got after a failure */
+static int http_download_conn_fetch(http_download_conn_t *conn)
+{
+    int rt = OPRT_OK;
+    http_download_t *ctx = conn->dl;
+    int32_t read_size = 0;
+
+    if (conn->failed) {
+        tal_system_sleep(HTTP_DOWNLOAD_RETRY_DELAY);
+    }
+    if (!conn->connected) {
+        TUYA_CALL_ERR_GOTO(tuya_transporter_connect(conn->network, ctx->host, ctx->port, ctx->config.timeout_ms),
+                           __exit);
+        conn->connected = true;
+    }
+
+    TUYA_CALL_ERR_GOTO(
+        http_download_range_request(ctx, conn, conn->start + conn->got, conn->start + conn->len - 1), __exit);
+    while (conn->got < conn->len) {
+        read_size = HTTPClient_Recv(&conn->transport, &conn->response, conn->buffer + conn->got,
+                                    conn->len - conn->got);
+        if (read_size <= 0) {
+            PR_WARN("file download range %d get error:%d", (int32_t)conn->start, read_size);
+            rt = OPRT_RECV_ERR;
+            goto __exit;
+        }
+        conn->got += read_size;
+    }
+
+__exit:
+    http_download_response_free(conn);
+    conn->failed = (OPRT_OK != rt);
+    if (conn->failed && conn->connected) {
+        tuya_transporter_close(conn->network);
+        conn->connected = false;
+    }
+    return rt;
+}
+
+static void http_download_worker(void *arg)
+{
+    http_download_conn_t *conn = (http_download_conn_t *)arg;
+    http_download_t *ctx = conn->dl;
+    SYS_TIME_T start_ms = 0;
+
+    while (THREAD_STATE_RUNNING == tal_thread_get_state(conn->thread)) {
+        tal_semaphore_wait_forever(conn->go);
+        if (DL_CONN_FETCHING != conn->state) {
+            continue;
+        }
+        start_ms = tal_system_get_millisecond();
+        conn->result = http_download_conn_fetch(conn);
+        conn->cost_ms = tal_system_get_millisecond() - start_ms;
+
+        tal_mutex_lock(ctx->mutex);
+        conn->state = DL_CONN_DONE;
+        tal_mutex_unlock(ctx->mutex);
+        tal_semaphore_post(ctx->done);
+    }
+    conn->exited = true;
+}
+
+/* give the next range to the idle connection, caller holds ctx->mutex */
+static int http_download_conn_assign(http_download_t *ctx, http_download_conn_t *conn, size_t *next_offset)
+{
+    size_t len = ctx->range_length;
+
+    if (len > ctx->file_size - *next_offset) {
+        len = ctx->file_size - *next_offset;
+    }
+    if (len > conn->buffer_size) {
+        uint8_t *buffer = tal_realloc(conn->buffer, len);
+        if (NULL == buffer) {
+            // go on with the smaller range
+            len = conn->buffer_size;
+        } else {
+            conn->buffer = buffer;
+            conn->buffer_size = len;
+        }
+    }
+    if (0 == len) {
+        return OPRT_MALLOC_FAILED;
+    }
 
-    if (!is_completed) {
+    conn->start = *next_offset;
+    conn->len = len;
+    conn->got = 0;
+    conn->state = DL_CONN_FETCHING;
+    *next_offset += len;
+
+    return OPRT_OK;
+}
+
+static void http_download_range_adapt(http_download_t *ctx, http_download_conn_t *conn)
+{
+    size_t max = ctx->config.range_length << HTTP_DOWNLOAD_RANGE_SHIFT;
+    size_t min = RANGE_REQUEST_LENGTH_MIN;
+
+    if (OPRT_OK == conn->result && conn->cost_ms < HTTP_DOWNLOAD_RANGE_FAST_MS && conn->len == ctx->range_length) {
+        ctx->range_length = (ctx->range_length * 2 > max) ? max : ctx->range_length * 2;
+    } else if (OPRT_OK != conn->result || conn->cost_ms > HTTP_DOWNLOAD_RANGE_SLOW_MS) {
+        ctx->range_length = (ctx->range_length / 2 < min) ? min : ctx->range_length / 2;
+    } else {
+        return;
+    }
+    PR_DEBUG("download range %d, last %d bytes in %dms", (int32_t)ctx->range_length, (int32_t)conn->len,
+             conn->cost_ms);
+}
+
+/* ranges fetched by conn_num connections, delivered to the handler in order */
+static bool http_download_parallel(http_download_t *ctx)
+{
+    int rt = OPRT_OK;
+    http_download_conn_t *conn = &ctx->conn[0];
+    TIME_T download_time = tal_time_get_posix();
+    size_t next_offset = 0;
+    bool is_completed = false;
+    bool progress = false;
+    int i;
+
+    // the file size is got over the first connection
+    while (0 == ctx->file_size) {
+        rt = tuya_transporter_connect(conn->network, ctx->host, ctx->port, ctx->config.timeout_ms);
+        if (OPRT_OK == rt) {
+            conn->connected = true;
+            rt = http_download_filesize_get(ctx, conn);
+        }
+        if (OPRT_OK == rt) {
+            break;
+        }
+        tuya_transporter_close(conn->network);
+        conn->connected = false;
+        if ((tal_time_get_posix() - download_time) >= HTTP_DOWNLOAD_TIMEOUT) {
+            return false;
+        }
+        tal_system_sleep(HTTP_DOWNLOAD_RETRY_DELAY);
+    }
+    http_download_filesize_notify(ctx);
+    ctx->received_size = ctx->resume_offset;
+    ctx->notified = true;
+    next_offset = ctx->resume_offset;
+
+    THREAD_CFG_T thrd_param = {
+        .priority = THREAD_PRIO_3,
+        .stackDepth = HTTP_DOWNLOAD_STACK_SIZE,
+        .thrdname = "http_dl",
+    };
+    for (i = 0; i < ctx->conn_num; i++) {
+        conn = &ctx->conn[i];
+        if (OPRT_OK != tal_semaphore_create_init(&conn->go, 0, 1) ||
+            OPRT_OK != tal_thread_create_and_start(&conn->thread, NULL, NULL, http_download_worker, conn,
+                                                   &thrd_param)) {
+            PR_ERR("download worker %d start fail", i);
+            conn->exited = true;
+            break;
+        }
+    }
+    if (0 == i) {
+        return false;
+    }
+
+    while (ctx->received_size < ctx->file_size) {
+        progress = false;
+        tal_mutex_lock(ctx->mutex);
+        for (i = 0; i < ctx->conn_num; i++) {
+            conn = &ctx->conn[i];
+            if (DL_CONN_DONE == conn->state) {
+                http_download_range_adapt(ctx, conn);
+                if (ctx->range_ignored) {
+                    conn->state = DL_CONN_IDLE;
+                } else if (OPRT_OK == conn->result) {
+                    conn->state = DL_CONN_READY;
+                } else {
+                    // fetch the rest of the range again
+                    conn->state = DL_CONN_FETCHING;
+                    tal_semaphore_post(conn->go);
+                }
+            }
+        }
+        tal_mutex_unlock(ctx->mutex);
+        if (ctx->range_ignored) {
+            goto __exit;
+        }
+
+        // deliver in order, a ready range waits for the ranges before it
+        for (i = 0; i < ctx->conn_num; i++) {
+            conn = &ctx->conn[i];
+            if (DL_CONN_READY == conn->state && conn->start == ctx->received_size) {
+                if (OPRT_OK != http_download_data_notify(ctx, conn->buffer, conn->len)) {
+                    goto __exit;
+                }
+                conn->state = DL_CONN_IDLE;
+                progress = true;
+                i = -1;
+            }
+        }
+        if (progress) {
+            download_time = tal_time_get_posix();
+        }
+
+        tal_mutex_lock(ctx->mutex);
+        for (i = 0; i < ctx->conn_num && next_offset < ctx->file_size; i++) {
+            conn = &ctx->conn[i];
+            if (conn->thread && !conn->exited && DL_CONN_IDLE == conn->state &&
+                OPRT_OK == http_download_conn_assign(ctx, conn, &next_offset)) {
+                tal_semaphore_post(conn->go);
+            }
+        }
+        tal_mutex_unlock(ctx->mutex);
+
+        if (ctx->received_size >= ctx->file_size || (tal_time_get_posix() - download_time) >= HTTP_DOWNLOAD_TIMEOUT) {
+            break;
+        }
+        tal_semaphore_wait(ctx->done, 1000);
+    }
+    is_completed = (ctx->received_size >= ctx->file_size);
+
+__exit:
+    if (!is_completed && !ctx->event.abort && !ctx->range_ignored) {
+        http_download_checkpoint_save(ctx, ctx->received_size - ctx->remain_len, true);
+    }
+    for (i = 0; i < ctx->conn_num; i++) {
+        conn = &ctx->conn[i];
+        if (conn->thread && !conn->exited) {
+            tal_thread_delete(conn->thread);
+            tal_semaphore_post(conn->go);
+        }
+    }
+    // a worker in fetching quits after its network timeout
+    for (i = 0; i < ctx->conn_num; i++) {
+        conn = &ctx->conn[i];
+        while (conn->thread && !conn->exited) {
+            tal_system_sleep(10);
+        }
+        if (conn->go) {
+            tal_semaphore_release(conn->go);
+        }
+    }
+
+    return is_completed;
+}
+
+int http_file_download(http_download_config_t *config)
+{
+    int rt = OPRT_OK;
+    uint8_t conn_num = 1;
+    bool is_completed = false;
+
+    if (NULL == config) {
+        return OPRT_INVALID_PARM;
+    }
+    if (config->conn_num > 1) {
+        conn_num = config->conn_num;
+    }
+
+    http_download_t *ctx = tal_calloc(1, sizeof(http_download_t) + conn_num * sizeof(http_download_conn_t));
+    TUYA_CHECK_NULL_GOTO(ctx, __exit);
+    ctx->conn_num = conn_num;
+    TUYA_CALL_ERR_GOTO(http_file_download_init(ctx, config), __exit);
+    if (conn_num > 1) {
+        TUYA_CALL_ERR_GOTO(tal_mutex_create_init(&ctx->mutex), __exit);
+        TUYA_CALL_ERR_GOTO(tal_semaphore_create_init(&ctx->done, 0, conn_num), __exit);
+    }
+
+    if (ctx->config.event_handler) {
+        ctx->config.event_handler(DL_EVENT_START, &ctx->event);
+    }
+
+    if (conn_num > 1) {
+        is_completed = http_download_parallel(ctx);
+    }
+    if (1 == conn_num || ctx->range_ignored) {
+        // nothing is delivered yet, the whole file is streamed over the first connection
+        if (ctx->conn[0].connected) {
+            tuya_transporter_close(ctx->conn[0].network);
+            ctx->conn[0].connected = false;
+        }
+        is_completed = http_download_sequential(ctx);
+    }
+
+    if (is_completed) {
+        PR_INFO("Download Complete!");
+        if (ctx->config.checkpoint) {
+            tal_kv_del(ctx->config.checkpoint);
+        }
+        if (ctx->config.event_handler) {
+            ctx->config.event_handler(DL_EVENT_FINISH, &ctx->event);
+        }
+    } else {
+        rt = OPRT_TIMEOUT;
         if (ctx->config.event_handler) {
             ctx->config.event_handler(DL_EVENT_FAULT, &ctx->event);
         }
@@ -338,17 +848,24 @@ int http_file_download(http_download_config_t *config)
 
 __exit:
     if (ctx) {
+        int i;
+        for (i = 0; i < ctx->conn_num; i++) {
+            http_download_conn_deinit(&ctx->conn[i]);
+        }
         if (ctx->host) {
             tal_free(ctx->host);
         }
         if (ctx->path) {
             tal_free(ctx->path);
         }
-        if (ctx->requestHeaders.pBuffer) {
-            tal_free(ctx->requestHeaders.pBuffer);
+        if (ctx->buffer) {
+            tal_free(ctx->buffer);
+        }
+        if (ctx->done) {
+            tal_semaphore_release(ctx->done);
         }
-        if (ctx->response.pBuffer) {
-            tal_free(ctx->response.pBuffer);
+        if (ctx->mutex) {
+            tal_mutex_release(ctx->mutex);
         }
 
         tal_free(ctx);
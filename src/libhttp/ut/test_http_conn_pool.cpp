@@ -0,0 +1,292 @@
+/**
+ * @file test_http_conn_pool.cpp
+ * @brief UT of the http client connection pool.
+ *
+ * The transporter is replaced by a fake keep-alive server that answers every
+ * request with a small 200 response. The connects are counted as the handshakes
+ * paid by the requests. Built once without a request limit and once with
+ * HTTP_CONN_POOL_REQ_MAX 2, the benchmark prints the latency of concurrent
+ * requests to a slow server, compare the two builds for the time spent waiting
+ * for a slot.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <stdlib.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tuya_transporter.h"
+#include "http_client_interface.h"
+}
+
+#define FAKE_RESPONSE "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"
+#define BURST_NUM     4
+#define BENCH_ROUND   10
+
+#define TOSTR_(x)     #x
+#define TOSTR(x)      TOSTR_(x)
+
+#if defined(HTTP_CONN_POOL_REQ_MAX) && (HTTP_CONN_POOL_REQ_MAX > 0)
+#define POOL_MODE "request limit " TOSTR(HTTP_CONN_POOL_REQ_MAX)
+#else
+#define POOL_MODE "no request limit"
+#endif
+
+struct fake_conn_t {
+    struct tuya_transporter_inter_t base;
+    std::string host;
+    std::string req;  // request bytes not answered yet
+    std::string resp; // response bytes not read yet
+    int served;
+    bool peer_closed;
+    bool answering; // the latency of the current response is paid
+};
+
+static std::atomic<int> s_connects;
+static std::atomic<int> s_requests; // complete requests received by the server
+static int s_close_after;           // the server closes a connection silently after it served so many, 0: never
+static bool s_write_refused;        // a write on a closed connection fails before any byte is sent
+static int s_latency_ms;            // time the server takes to answer a request
+
+static void fake_server_feed(fake_conn_t *t)
+{
+    size_t hdr_end = t->req.find("\r\n\r\n");
+    if (std::string::npos == hdr_end) {
+        return;
+    }
+    size_t body_len = 0;
+    size_t pos = t->req.find("Content-Length: ");
+    if (pos != std::string::npos && pos < hdr_end) {
+        body_len = strtoul(t->req.c_str() + pos + strlen("Content-Length: "), NULL, 10);
+    }
+    if (t->req.size() < hdr_end + 4 + body_len) {
+        return;
+    }
+    t->req.erase(0, hdr_end + 4 + body_len);
+    s_requests++;
+    if (t->peer_closed) {
+        return;
+    }
+    t->resp += FAKE_RESPONSE;
+    t->served++;
+}
+
+extern "C" {
+tuya_transporter_t tuya_transporter_create(TUYA_TRANSPORT_TYPE_E transport_type, tuya_transporter_t dependency)
+{
+    return (tuya_transporter_t) new fake_conn_t();
+}
+
+OPERATE_RET tuya_transporter_destroy(tuya_transporter_t t)
+{
+    delete (fake_conn_t *)t;
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_connect(tuya_transporter_t t, const char *host, int port, int timeout_ms)
+{
+    ((fake_conn_t *)t)->host = host;
+    s_connects++;
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_close(tuya_transporter_t t)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_write(tuya_transporter_t transporter, uint8_t *buf, int len, int timeout_ms)
+{
+    fake_conn_t *t = (fake_conn_t *)transporter;
+
+    if (t->peer_closed && s_write_refused) {
+        return OPRT_SOCK_ERR;
+    }
+    t->req.append((const char *)buf, len);
+    fake_server_feed(t);
+    return len;
+}
+
+OPERATE_RET tuya_transporter_read(tuya_transporter_t transporter, uint8_t *buf, int len, int timeout_ms)
+{
+    fake_conn_t *t = (fake_conn_t *)transporter;
+
+    if (t->resp.empty()) {
+        // the reset arrives after the request was written
+        return t->peer_closed ? OPRT_SOCK_ERR : OPRT_RESOURCE_NOT_READY;
+    }
+    if (!t->answering && s_latency_ms) {
+        tal_system_sleep(s_latency_ms);
+    }
+    int n = (int)t->resp.size() < len ? (int)t->resp.size() : len;
+    memcpy(buf, t->resp.data(), n);
+    t->resp.erase(0, n);
+    t->answering = !t->resp.empty();
+    if (t->resp.empty() && s_close_after && t->served >= s_close_after) {
+        t->peer_closed = true;
+    }
+    return n;
+}
+
+OPERATE_RET tuya_transporter_poll_read(tuya_transporter_t t, int timeout_ms)
+{
+    // the close is not seen before the next request, as in the race with the server idle timeout
+    return 0;
+}
+
+OPERATE_RET tuya_transporter_ctrl(tuya_transporter_t t, uint32_t cmd, void *args)
+{
+    if (TUYA_TRANSPORTER_GET_TLS_CONFIG == cmd) {
+        *(void **)args = NULL;
+    }
+    return OPRT_OK;
+}
+}
+
+class HttpConnPoolTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        tal_sw_timer_init();
+        tal_workq_init();
+    }
+
+    void SetUp() override
+    {
+        s_connects = 0;
+        s_requests = 0;
+        s_close_after = 0;
+        s_write_refused = false;
+        s_latency_ms = 0;
+    }
+
+    http_client_status_t request(const char *host, const char *method)
+    {
+        static const uint8_t body[] = "{\"t\":1}";
+        http_client_request_t req;
+        http_client_response_t resp;
+
+        memset(&req, 0, sizeof(req));
+        memset(&resp, 0, sizeof(resp));
+        req.host = host;
+        req.path = "/d.json";
+        req.method = method;
+        req.timeout_ms = 1000;
+        if (0 == strcmp(method, "POST")) {
+            req.body = body;
+            req.body_length = sizeof(body) - 1;
+        }
+
+        http_client_status_t rt = http_client_request(&req, &resp);
+        if (HTTP_CLIENT_SUCCESS == rt) {
+            EXPECT_EQ(200, resp.status_code);
+            http_client_free(&resp);
+        }
+        return rt;
+    }
+
+    /* BURST_NUM requests at the same time, returns the mean latency in ms */
+    double request_burst(const char *host)
+    {
+        std::vector<std::thread> threads;
+        std::atomic<int> ok(0);
+        std::atomic<long long> total_us(0);
+
+        for (int i = 0; i < BURST_NUM; i++) {
+            threads.emplace_back([&]() {
+                auto begin = std::chrono::steady_clock::now();
+                if (HTTP_CLIENT_SUCCESS == request(host, "GET")) {
+                    ok++;
+                }
+                auto elapsed = std::chrono::steady_clock::now() - begin;
+                total_us += std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+            });
+        }
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        EXPECT_EQ(BURST_NUM, ok.load());
+        return total_us.load() / 1000.0 / BURST_NUM;
+    }
+};
+
+TEST_F(HttpConnPoolTest, RequestsToOneHostShareOneHandshake)
+{
+    for (int i = 0; i < 10; i++) {
+        ASSERT_EQ(HTTP_CLIENT_SUCCESS, request("keepalive.example.com", "POST"));
+    }
+    EXPECT_EQ(1, s_connects);
+    EXPECT_EQ(10, s_requests);
+}
+
+TEST_F(HttpConnPoolTest, StaleConnectionRetriesGet)
+{
+    s_close_after = 1;
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request("get.example.com", "GET"));
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request("get.example.com", "GET"));
+    EXPECT_EQ(2, s_connects);
+    // the lost request and its retry
+    EXPECT_EQ(3, s_requests);
+}
+
+TEST_F(HttpConnPoolTest, StaleConnectionDoesNotResendWrittenPost)
+{
+    s_close_after = 1;
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request("post.example.com", "POST"));
+    EXPECT_EQ(HTTP_CLIENT_SEND_FAULT, request("post.example.com", "POST"));
+    EXPECT_EQ(1, s_connects);
+    // the server may have handled the second one, it is not sent again
+    EXPECT_EQ(2, s_requests);
+}
+
+TEST_F(HttpConnPoolTest, StaleConnectionRetriesUnwrittenPost)
+{
+    s_close_after = 1;
+    s_write_refused = true;
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request("refused.example.com", "POST"));
+    ASSERT_EQ(HTTP_CLIENT_SUCCESS, request("refused.example.com", "POST"));
+    EXPECT_EQ(2, s_connects);
+    EXPECT_EQ(2, s_requests);
+}
+
+TEST_F(HttpConnPoolTest, ConcurrentRequestsOverThePool)
+{
+    s_latency_ms = 100;
+
+    double latency = request_burst("burst.example.com");
+#if defined(HTTP_CONN_POOL_REQ_MAX) && (HTTP_CONN_POOL_REQ_MAX > 0)
+    // the requests over the limit wait for a slot
+    EXPECT_EQ(HTTP_CONN_POOL_REQ_MAX, s_connects);
+    EXPECT_GT(latency, s_latency_ms * 1.2);
+#else
+    // none of them waits, the ones over HTTP_CONN_POOL_MAX open their own connection
+    EXPECT_EQ(BURST_NUM, s_connects);
+    EXPECT_LT(latency, s_latency_ms * 1.5);
+
+    // and close it after the response, the pool kept HTTP_CONN_POOL_MAX of them
+    request_burst("burst.example.com");
+    EXPECT_EQ(BURST_NUM + BURST_NUM - 2, s_connects);
+#endif
+}
+
+TEST_F(HttpConnPoolTest, Benchmark)
+{
+    double latency = 0;
+
+    s_latency_ms = 20;
+    for (int i = 0; i < BENCH_ROUND; i++) {
+        latency += request_burst("bench.example.com");
+    }
+    printf("[%s] %d concurrent requests, server latency %d ms: mean latency %.1f ms, %d connects\n", POOL_MODE,
+           BURST_NUM, s_latency_ms, latency / BENCH_ROUND, s_connects.load());
+}
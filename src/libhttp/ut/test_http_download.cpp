@@ -0,0 +1,497 @@
+/**
+ * @file test_http_download.cpp
+ * @brief UT of http_file_download over a fake range server.
+ *
+ * The transporter is replaced by a server that answers Range requests from a
+ * random file. It can cut every Nth response in the middle of the body and
+ * reset the connection, and let every Nth response stall until the read times
+ * out. The file is downloaded with 1 and 4 connections and has to arrive byte
+ * exact and in order. A download stopped half way, by the handler or by a
+ * server outage that lasts until the download times out, resumes from its kv
+ * checkpoint. A server that ignores Range and sends the whole file with a 200
+ * is streamed by the sequential download. The throughput with a round trip per
+ * response is printed.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tuya_transporter.h"
+#include "http_download.h"
+}
+
+#define DL_FILE_SIZE   (300 * 1024 + 77)
+#define DL_RANGE_LEN   (4 * 1024)
+#define DL_STALL_MS    20 // a read that gets nothing returns after its timeout
+#define DL_BENCH_RTT   5  // ms before the first byte of a response
+#define DL_BENCH_RATE  2  // MB/s of one connection, the window of one TCP stream over the round trip
+#define DL_BENCH_SIZE  (1024 * 1024)
+#define DL_CHECKPOINT  "dl_ut_cp"
+#define DL_CHECKPOINT_STEP (64 * 1024)
+
+static std::string s_file;
+static std::atomic<int> s_responses;
+static std::atomic<int> s_drop_every;  // cut every Nth response mid-body, 0: never
+static std::atomic<int> s_stall_every; // stall every Nth response, 0: never
+static std::atomic<int> s_rtt_ms;
+static std::atomic<int> s_rate_mbps; // 0: no limit
+static std::atomic<int> s_connects;
+static std::atomic<int> s_dropped;
+static std::atomic<int> s_stalled;
+static std::atomic<size_t> s_body_bytes; // body bytes served
+static std::atomic<size_t> s_down_after; // the server goes down when so many bytes are served, 0: never
+static std::atomic<bool> s_ignore_range; // answer every request with the whole file
+
+struct fake_conn_t {
+    struct tuya_transporter_inter_t base;
+    std::string req;
+    std::string resp;
+    size_t cut;  // bytes of resp until the response breaks, npos: never
+    bool stall;  // the read at cut times out, otherwise the connection resets there
+    bool wait;   // the next read waits for the round trip
+    bool reset;
+};
+
+static void fake_server_feed(fake_conn_t *t)
+{
+    size_t hdr_end = t->req.find("\r\n\r\n");
+    if (std::string::npos == hdr_end) {
+        return;
+    }
+    unsigned long start = 0, end = 0;
+    size_t pos = t->req.find("Range: bytes=");
+    ASSERT_NE(std::string::npos, pos);
+    ASSERT_EQ(2, sscanf(t->req.c_str() + pos, "Range: bytes=%lu-%lu", &start, &end));
+    t->req.erase(0, hdr_end + 4);
+    ASSERT_LE(start, end);
+    ASSERT_LT(end, s_file.size());
+
+    char head[256];
+    size_t len = end - start + 1;
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 206 Partial Content\r\nContent-Range: bytes %lu-%lu/%zu\r\nContent-Length: %zu\r\n\r\n", start,
+             end, s_file.size(), len);
+    if (s_ignore_range) {
+        start = 0;
+        len = s_file.size();
+        snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %zu\r\n\r\n", len);
+    }
+    int n = ++s_responses;
+    t->cut = std::string::npos;
+    if (s_drop_every && 0 == n % s_drop_every && len > 1) {
+        t->cut = t->resp.size() + strlen(head) + len / 2;
+        s_dropped++;
+    } else if (s_stall_every && 0 == n % s_stall_every && len > 1) {
+        // the headers and a few bytes of the body come, then nothing
+        t->cut = t->resp.size() + strlen(head) + (len < 10 ? 1 : 10);
+        t->stall = true;
+        s_stalled++;
+    }
+    t->resp += head;
+    t->resp.append(s_file, start, len);
+    t->wait = true;
+}
+
+extern "C" {
+tuya_transporter_t tuya_transporter_create(TUYA_TRANSPORT_TYPE_E transport_type, tuya_transporter_t dependency)
+{
+    return (tuya_transporter_t) new fake_conn_t();
+}
+
+OPERATE_RET tuya_transporter_destroy(tuya_transporter_t t)
+{
+    delete (fake_conn_t *)t;
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_connect(tuya_transporter_t transporter, const char *host, int port, int timeout_ms)
+{
+    fake_conn_t *t = (fake_conn_t *)transporter;
+
+    if (s_down_after && s_body_bytes >= s_down_after) {
+        // the outage lasts, every reconnection moves the clock on to the download timeout
+        tal_time_set_posix(tal_time_get_posix() + 60, 1);
+        return OPRT_SOCK_ERR;
+    }
+    t->req.clear();
+    t->resp.clear();
+    t->stall = false;
+    t->reset = false;
+    s_connects++;
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_close(tuya_transporter_t t)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_write(tuya_transporter_t transporter, uint8_t *buf, int len, int timeout_ms)
+{
+    fake_conn_t *t = (fake_conn_t *)transporter;
+
+    if (t->reset) {
+        return OPRT_SOCK_ERR;
+    }
+    t->req.append((const char *)buf, len);
+    fake_server_feed(t);
+    return len;
+}
+
+OPERATE_RET tuya_transporter_read(tuya_transporter_t transporter, uint8_t *buf, int len, int timeout_ms)
+{
+    fake_conn_t *t = (fake_conn_t *)transporter;
+
+    if (t->reset || (s_down_after && s_body_bytes >= s_down_after)) {
+        return OPRT_SOCK_ERR;
+    }
+    if (t->wait && s_rtt_ms) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(s_rtt_ms.load()));
+    }
+    t->wait = false;
+    if (t->resp.empty() || (0 == t->cut && t->stall)) {
+        // nothing comes, the read times out
+        t->stall = false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(DL_STALL_MS));
+        return OPRT_RESOURCE_NOT_READY;
+    }
+    if (0 == t->cut) {
+        // the rest of the response is lost with the connection
+        t->resp.clear();
+        t->reset = true;
+        return OPRT_SOCK_ERR;
+    }
+    size_t n = t->resp.size() < (size_t)len ? t->resp.size() : (size_t)len;
+    if (n > t->cut) {
+        n = t->cut;
+    }
+    if (s_rate_mbps) {
+        std::this_thread::sleep_for(std::chrono::microseconds(n / s_rate_mbps));
+    }
+    memcpy(buf, t->resp.data(), n);
+    t->resp.erase(0, n);
+    if (t->cut != std::string::npos) {
+        t->cut -= n;
+    }
+    s_body_bytes += n;
+    return (int)n;
+}
+
+OPERATE_RET tuya_transporter_ctrl(tuya_transporter_t t, uint32_t cmd, void *args)
+{
+    if (TUYA_TRANSPORTER_GET_TLS_CONFIG == cmd) {
+        *(void **)args = NULL;
+    }
+    return OPRT_OK;
+}
+
+/* kv in memory, survives the download like the flash */
+static std::mutex s_kv_mutex;
+static std::map<std::string, std::string> s_kv;
+
+OPERATE_RET tal_kv_set(const char *key, const uint8_t *value, size_t length)
+{
+    std::lock_guard<std::mutex> lock(s_kv_mutex);
+    s_kv[key] = std::string((const char *)value, length);
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_kv_get(const char *key, uint8_t **value, size_t *length)
+{
+    std::lock_guard<std::mutex> lock(s_kv_mutex);
+    auto it = s_kv.find(key);
+    if (it == s_kv.end()) {
+        return OPRT_NOT_FOUND;
+    }
+    *value = (uint8_t *)tal_malloc(it->second.size());
+    memcpy(*value, it->second.data(), it->second.size());
+    *length = it->second.size();
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_kv_free(uint8_t *value)
+{
+    tal_free(value);
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_kv_del(const char *key)
+{
+    std::lock_guard<std::mutex> lock(s_kv_mutex);
+    s_kv.erase(key);
+    return OPRT_OK;
+}
+}
+
+/* what the handler got */
+struct dl_sink_t {
+    std::string out;
+    size_t resume;       // offset of ON_FILESIZE
+    size_t first;        // offset of the first data
+    size_t next;         // where the next data has to start
+    size_t keep;         // bytes left unconsumed by every data
+    size_t abort_after;  // abort when so many bytes are consumed, 0: never
+    bool restart;        // download the whole file again on resume
+    bool finished;
+    bool fault;
+};
+
+static void dl_event_handler(http_download_event_id_t id, http_download_event_t *event)
+{
+    dl_sink_t *sink = (dl_sink_t *)event->user_data;
+
+    switch (id) {
+    case DL_EVENT_ON_FILESIZE:
+        EXPECT_EQ(s_file.size(), event->file_size);
+        if (sink->restart) {
+            event->offset = 0;
+        }
+        sink->resume = event->offset;
+        sink->first = event->offset;
+        sink->next = event->offset;
+        sink->out.assign(s_file.size(), '\0');
+        break;
+
+    case DL_EVENT_ON_DATA: {
+        EXPECT_EQ(sink->next, event->offset);
+        EXPECT_LE(event->offset + event->data_len, s_file.size());
+        size_t keep = sink->keep < event->data_len ? sink->keep : event->data_len;
+        if (event->offset + event->data_len == s_file.size()) {
+            keep = 0;
+        }
+        size_t used = event->data_len - keep;
+        memcpy(&sink->out[event->offset], event->data, used);
+        sink->next = event->offset + used;
+        event->remain_len = keep;
+        if (sink->abort_after && sink->next - sink->first >= sink->abort_after) {
+            event->abort = true;
+        }
+        break;
+    }
+
+    case DL_EVENT_FINISH:
+        sink->finished = true;
+        break;
+
+    case DL_EVENT_FAULT:
+        sink->fault = true;
+        break;
+
+    default:
+        break;
+    }
+}
+
+class HttpDownloadTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        tal_time_service_init();
+    }
+
+    void SetUp() override
+    {
+        make_file(DL_FILE_SIZE);
+        s_responses = 0;
+        s_drop_every = 0;
+        s_stall_every = 0;
+        s_rtt_ms = 0;
+        s_rate_mbps = 0;
+        s_connects = 0;
+        s_dropped = 0;
+        s_stalled = 0;
+        s_body_bytes = 0;
+        s_down_after = 0;
+        s_ignore_range = false;
+        s_kv.clear();
+    }
+
+    /* the server goes down when so many bytes more are served */
+    static void outage_after(size_t bytes)
+    {
+        s_body_bytes = 0;
+        s_down_after = bytes;
+    }
+
+    static void make_file(size_t size)
+    {
+        std::mt19937 rng(size);
+        s_file.resize(size);
+        for (auto &c : s_file) {
+            c = (char)rng();
+        }
+    }
+
+    /* size_known: the file size is given like by the ota message, no request gets it */
+    int download(uint8_t conn_num, dl_sink_t *sink, const char *checkpoint = NULL, bool size_known = false)
+    {
+        http_download_config_t config;
+
+        memset(&config, 0, sizeof(config));
+        config.url = (char *)"http://fw.example.com/ota/fw.bin";
+        config.timeout_ms = 1000;
+        config.range_length = DL_RANGE_LEN;
+        config.user_data = sink;
+        config.event_handler = dl_event_handler;
+        config.conn_num = conn_num;
+        config.checkpoint = checkpoint;
+        config.file_size = size_known ? s_file.size() : 0;
+        return http_file_download(&config);
+    }
+};
+
+TEST_F(HttpDownloadTest, DropsAndStallsAreFetchedAgain)
+{
+    for (uint8_t conn_num : {1, 4}) {
+        for (size_t keep : {0, 13}) {
+            dl_sink_t sink = {};
+            sink.keep = keep;
+            // the single streamed request has few responses, each one is broken but the last
+            s_drop_every = (1 == conn_num) ? 2 : 5;
+            s_stall_every = (1 == conn_num) ? 3 : 7;
+            s_responses = 0;
+            s_dropped = 0;
+            s_stalled = 0;
+            ASSERT_EQ(OPRT_OK, download(conn_num, &sink)) << "conn " << (int)conn_num << " keep " << keep;
+            EXPECT_TRUE(sink.finished);
+            EXPECT_FALSE(sink.fault);
+            EXPECT_EQ(s_file.size(), sink.next);
+            EXPECT_TRUE(s_file == sink.out) << "conn " << (int)conn_num << " keep " << keep;
+            EXPECT_GT(s_dropped.load(), 0);
+            EXPECT_GT(s_stalled.load(), 0);
+        }
+    }
+}
+
+TEST_F(HttpDownloadTest, ResumeFromCheckpoint)
+{
+    for (bool outage : {false, true}) {
+        for (uint8_t conn_num : {1, 4}) {
+            // an outage times out in the reconnection of the sequential download and at the exit of the parallel
+            // one, the checkpoint is saved there; an abort leaves the last periodic one
+            dl_sink_t first = {};
+            if (outage) {
+                outage_after(150 * 1024);
+            } else {
+                first.abort_after = 150 * 1024;
+            }
+            EXPECT_NE(OPRT_OK, download(conn_num, &first, DL_CHECKPOINT));
+            EXPECT_TRUE(first.fault);
+            ASSERT_EQ(1, (int)s_kv.count(DL_CHECKPOINT)) << "outage " << outage << " conn " << (int)conn_num;
+
+            /* the second download goes on from the saved offset, a step and a range behind at most */
+            dl_sink_t second = {};
+            outage_after(0);
+            ASSERT_EQ(OPRT_OK, download(conn_num, &second, DL_CHECKPOINT));
+            EXPECT_GT(second.resume, 0u);
+            EXPECT_LE(second.resume, first.next);
+            EXPECT_LE(first.next - second.resume, (size_t)DL_CHECKPOINT_STEP + (DL_RANGE_LEN << 3));
+            if (outage) {
+                // saved when it stopped, not a step before
+                EXPECT_EQ(first.next, second.resume) << "conn " << (int)conn_num;
+            }
+            EXPECT_EQ(0, memcmp(s_file.data() + second.resume, second.out.data() + second.resume,
+                                s_file.size() - second.resume));
+            memcpy(&second.out[0], first.out.data(), second.resume);
+            EXPECT_TRUE(s_file == second.out);
+            EXPECT_LT(s_body_bytes.load(), s_file.size());
+            EXPECT_EQ(0, (int)s_kv.count(DL_CHECKPOINT));
+        }
+    }
+}
+
+TEST_F(HttpDownloadTest, HandlerRestartsFromZero)
+{
+    for (bool outage : {false, true}) {
+        dl_sink_t first = {};
+        if (outage) {
+            outage_after(100 * 1024);
+        } else {
+            first.abort_after = 100 * 1024;
+        }
+        EXPECT_NE(OPRT_OK, download(4, &first, DL_CHECKPOINT));
+        ASSERT_EQ(1, (int)s_kv.count(DL_CHECKPOINT));
+
+        dl_sink_t second = {};
+        outage_after(0);
+        second.restart = true;
+        ASSERT_EQ(OPRT_OK, download(4, &second, DL_CHECKPOINT));
+        EXPECT_EQ(0u, second.resume);
+        EXPECT_TRUE(s_file == second.out);
+    }
+}
+
+TEST_F(HttpDownloadTest, CheckpointOfOtherFileIsIgnored)
+{
+    for (bool outage : {false, true}) {
+        make_file(DL_FILE_SIZE);
+        dl_sink_t first = {};
+        if (outage) {
+            outage_after(100 * 1024);
+        } else {
+            first.abort_after = 100 * 1024;
+        }
+        EXPECT_NE(OPRT_OK, download(1, &first, DL_CHECKPOINT));
+        ASSERT_EQ(1, (int)s_kv.count(DL_CHECKPOINT));
+
+        make_file(DL_FILE_SIZE + 1);
+        dl_sink_t second = {};
+        outage_after(0);
+        ASSERT_EQ(OPRT_OK, download(1, &second, DL_CHECKPOINT));
+        EXPECT_EQ(0u, second.resume);
+        EXPECT_TRUE(s_file == second.out);
+    }
+}
+
+TEST_F(HttpDownloadTest, IgnoredRangeFallsBackToSequential)
+{
+    s_ignore_range = true;
+    for (uint8_t conn_num : {1, 4}) {
+        dl_sink_t sink = {};
+        ASSERT_EQ(OPRT_OK, download(conn_num, &sink, DL_CHECKPOINT, true)) << "conn " << (int)conn_num;
+        EXPECT_TRUE(sink.finished);
+        EXPECT_EQ(0u, sink.resume);
+        EXPECT_TRUE(s_file == sink.out) << "conn " << (int)conn_num;
+        EXPECT_EQ(0, (int)s_kv.count(DL_CHECKPOINT));
+    }
+}
+
+TEST_F(HttpDownloadTest, ThroughputBenchmark)
+{
+    make_file(DL_BENCH_SIZE);
+    s_rtt_ms = DL_BENCH_RTT;
+    s_rate_mbps = DL_BENCH_RATE;
+    double mbps[2] = {0};
+    int connects[2] = {0};
+
+    for (int i = 0; i < 2; i++) {
+        dl_sink_t sink = {};
+        s_connects = 0;
+        auto begin = std::chrono::steady_clock::now();
+        ASSERT_EQ(OPRT_OK, download(i ? 4 : 1, &sink));
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        EXPECT_TRUE(s_file == sink.out);
+        mbps[i] = DL_BENCH_SIZE / seconds / (1024 * 1024);
+        connects[i] = s_connects;
+    }
+
+    printf("%d KB, %d ms round trip, %d MB/s per connection: 1 conn %.1f MB/s %d connects, 4 conns %.1f MB/s %d "
+           "connects\n",
+           DL_BENCH_SIZE / 1024, DL_BENCH_RTT, DL_BENCH_RATE, mbps[0], connects[0], mbps[1], connects[1]);
+    EXPECT_GT(mbps[1], mbps[0]);
+}
@@ -45,6 +45,20 @@ static int32_t sendPacket( MQTTContext_t * pContext,
                            const uint8_t * pBufferToSend,
                            size_t bytesToSend );
 
+/**
+ * @brief Sends the provided buffers to network using transport writev, as if
+ * they were one buffer.
+ *
+ * @brief param[in] pContext Initialized MQTT context.
+ * @brief param[in] pIoVec The buffers to be sent, updated on partial sends.
+ * @brief param[in] ioVecCount Number of buffers.
+ *
+ * @return Total number of bytes sent, or negative number on network error.
+ */
+static int32_t sendMessageVector( MQTTContext_t * pContext,
+                                  TransportOutVector_t * pIoVec,
+                                  size_t ioVecCount );
+
 /**
  * @brief Calculate the interval between two millisecond timestamps, including
  * when the later value has overflowed.
@@ -641,6 +655,80 @@ static int32_t sendPacket( MQTTContext_t * pContext,
 
 /*-----------------------------------------------------------*/
 
+static int32_t sendMessageVector( MQTTContext_t * pContext,
+                                  TransportOutVector_t * pIoVec,
+                                  size_t ioVecCount )
+{
+    TransportOutVector_t * pIoVecIterator = pIoVec;
+    size_t vectorsToBeSent = ioVecCount;
+    size_t bytesToSend = 0U, index = 0U;
+    int32_t totalBytesSent = 0, bytesSent;
+    uint32_t sendTime = 0U;
+
+    assert( pContext != NULL );
+    assert( pContext->getTime != NULL );
+    assert( pContext->transportInterface.writev != NULL );
+    assert( pIoVec != NULL );
+
+    for( index = 0U; index < ioVecCount; index++ )
+    {
+        bytesToSend += pIoVec[ index ].iov_len;
+    }
+
+    /* Record the time of transmission. */
+    sendTime = pContext->getTime();
+
+    /* Loop until the entire packet is sent, resuming a partial send inside
+     * the buffer it stopped in. */
+    while( ( totalBytesSent >= 0 ) && ( ( size_t ) totalBytesSent < bytesToSend ) )
+    {
+        bytesSent = pContext->transportInterface.writev( pContext->transportInterface.pNetworkContext,
+                                                         pIoVecIterator,
+                                                         vectorsToBeSent );
+
+        if( bytesSent < 0 )
+        {
+            LogError( ( "Transport writev failed. Error code=%d.", bytesSent ) );
+            totalBytesSent = bytesSent;
+        }
+        else
+        {
+            assert( ( size_t ) bytesSent <= ( bytesToSend - ( size_t ) totalBytesSent ) );
+
+            totalBytesSent += bytesSent;
+
+            while( ( vectorsToBeSent > 0U ) && ( ( size_t ) bytesSent >= pIoVecIterator->iov_len ) )
+            {
+                bytesSent -= ( int32_t ) pIoVecIterator->iov_len;
+                pIoVecIterator++;
+                vectorsToBeSent--;
+            }
+
+            if( bytesSent > 0 )
+            {
+                pIoVecIterator->iov_base = ( const uint8_t * ) pIoVecIterator->iov_base + bytesSent;
+                pIoVecIterator->iov_len -= ( size_t ) bytesSent;
+            }
+
+            LogDebug( ( "TotalBytesSent=%d, BytesToSend=%lu.",
+                        totalBytesSent,
+                        ( unsigned long ) bytesToSend ) );
+        }
+    }
+
+    /* Update time of last transmission if the entire packet is successfully sent. */
+    if( totalBytesSent > 0 )
+    {
+        pContext->lastPacketTime = sendTime;
+        LogDebug( ( "Successfully sent packet at time %u.",
+                    sendTime ) );
+    }
+
+    return totalBytesSent;
+}
+
+/*-----------------------------------------------------------*/
+
 static uint32_t calculateElapsedTime( uint32_t later,
                                       uint32_t start )
 {
@@ -1373,44 +1461,73 @@ static MQTTStatus_t sendPublish( MQTTContext_t * pContext,
     assert( pContext->networkBuffer.pBuffer != NULL );
     assert( !( pPublishInfo->payloadLength > 0 ) || ( pPublishInfo->pPayload != NULL ) );
 
-    /* Send header first. */
-    bytesSent = sendPacket( pContext,
-                            pContext->networkBuffer.pBuffer,
-                            headerSize );
-
-    if( bytesSent < 0 )
+    /* Send header and payload in one call when the transport can, so a short
+     * PUBLISH leaves in one segment and one TLS record. */
+    if( pContext->transportInterface.writev != NULL )
     {
-        LogError( ( "Transport send failed for PUBLISH header." ) );
-        status = MQTTSendFailed;
+        TransportOutVector_t ioVec[ 2 ];
+
+        ioVec[ 0 ].iov_base = pContext->networkBuffer.pBuffer;
+        ioVec[ 0 ].iov_len = headerSize;
+        ioVec[ 1 ].iov_base = pPublishInfo->pPayload;
+        ioVec[ 1 ].iov_len = pPublishInfo->payloadLength;
+
+        bytesSent = sendMessageVector( pContext,
+                                       ioVec,
+                                       ( pPublishInfo->payloadLength > 0U ) ? 2U : 1U );
+
+        if( bytesSent < 0 )
+        {
+            LogError( ( "Transport writev failed for PUBLISH." ) );
+            status = MQTTSendFailed;
+        }
+        else
+        {
+            LogDebug( ( "Sent %d bytes of PUBLISH.",
+                        bytesSent ) );
+        }
     }
     else
     {
-        LogDebug( ( "Sent %d bytes of PUBLISH header.",
-                    bytesSent ) );
+        /* Send header first. */
+        bytesSent = sendPacket( pContext,
+                                pContext->networkBuffer.pBuffer,
+                                headerSize );
 
-        /* Send Payload if there is one to send. It is valid for a PUBLISH
-         * Packet to contain a zero length payload.*/
-        if( pPublishInfo->payloadLength > 0U )
+        if( bytesSent < 0 )
         {
-            bytesSent = sendPacket( pContext,
-                                    pPublishInfo->pPayload,
-                                    pPublishInfo->payloadLength );
+            LogError( ( "Transport send failed for PUBLISH header." ) );
+            status = MQTTSendFailed;
+        }
+        else
+        {
+            LogDebug( ( "Sent %d bytes of PUBLISH header.",
+                        bytesSent ) );
 
-            if( bytesSent < 0 )
+            /* Send Payload if there is one to send. It is valid for a PUBLISH
+             * Packet to contain a zero length payload.*/
+            if( pPublishInfo->payloadLength > 0U )
             {
-                LogError( ( "Transport send failed for PUBLISH payload." ) );
-                status = MQTTSendFailed;
+                bytesSent = sendPacket( pContext,
+                                        pPublishInfo->pPayload,
+                                        pPublishInfo->payloadLength );
+
+                if( bytesSent < 0 )
+                {
+                    LogError( ( "Transport send failed for PUBLISH payload." ) );
+                    status = MQTTSendFailed;
+                }
+                else
+                {
+                    LogDebug( ( "Sent %d bytes of PUBLISH payload.",
+                                bytesSent ) );
+                }
             }
             else
             {
-                LogDebug( ( "Sent %d bytes of PUBLISH payload.",
-                            bytesSent ) );
+                LogDebug( ( "PUBLISH payload was not sent. Payload length was zero." ) );
             }
         }
-        else
-        {
-            LogDebug( ( "PUBLISH payload was not sent. Payload length was zero." ) );
-        }
     }
 
     return status;
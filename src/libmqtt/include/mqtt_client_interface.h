@@ -73,10 +73,19 @@ mqtt_client_status_t mqtt_client_disconnect(void *client);
 
 mqtt_client_status_t mqtt_client_yield(void *client);
 
+/* block on the socket until a packet is dispatched, the keep alive is due or timeout_ms passed */
+mqtt_client_status_t mqtt_client_yield_wait(void *client, uint32_t timeout_ms);
+
 uint16_t mqtt_client_subscribe(void *client, const char *topic, uint8_t qos);
 
 uint16_t mqtt_client_unsubscribe(void *client, const char *topic, uint8_t qos);
 
 uint16_t mqtt_client_publish(void *client, const char *topic, const uint8_t *payload, size_t length, uint8_t qos);
 
+/* take a packet id for mqtt_client_publish_msgid, so the caller can track it before the packet is sent */
+uint16_t mqtt_client_msgid_new(void *client);
+
+uint16_t mqtt_client_publish_msgid(void *client, uint16_t msgid, const char *topic, const uint8_t *payload,
+                                   size_t length, uint8_t qos);
+
 #endif /* ifndef MQTT_CLIENT_INTERFACE_H */
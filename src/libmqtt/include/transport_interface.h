@@ -217,6 +217,33 @@ typedef int32_t (*TransportRecv_t)(NetworkContext_t *pNetworkContext, void *pBuf
 typedef int32_t (*TransportSend_t)(NetworkContext_t *pNetworkContext, const void *pBuffer, size_t bytesToSend);
 /* @[define_transportsend] */
 
+/**
+ * @transportstruct
+ * @brief One buffer of a vectored send.
+ */
+/* @[define_transportoutvector] */
+typedef struct TransportOutVector {
+    const void *iov_base; /**< Base address of the data. */
+    size_t iov_len;       /**< Length of the data in bytes. */
+} TransportOutVector_t;
+/* @[define_transportoutvector] */
+
+/**
+ * @transportcallback
+ * @brief Transport interface for sending several buffers over the network as
+ * if they were one.
+ *
+ * @param[in] pNetworkContext Implementation-defined network context.
+ * @param[in] pIoVec The buffers to send, in order.
+ * @param[in] ioVecCount Number of buffers.
+ *
+ * @return The number of bytes sent or a negative error code.
+ */
+/* @[define_transportwritev] */
+typedef int32_t (*TransportWritev_t)(NetworkContext_t *pNetworkContext, TransportOutVector_t *pIoVec,
+                                     size_t ioVecCount);
+/* @[define_transportwritev] */
+
 /**
  * @transportstruct
  * @brief The transport layer interface.
@@ -225,6 +252,7 @@ typedef int32_t (*TransportSend_t)(NetworkContext_t *pNetworkContext, const void
 typedef struct TransportInterface {
     TransportRecv_t recv;              /**< Transport receive interface. */
     TransportSend_t send;              /**< Transport send interface. */
+    TransportWritev_t writev;          /**< Optional vectored send, NULL to send buffer by buffer. */
     NetworkContext_t *pNetworkContext; /**< Implementation-defined network context. */
 } TransportInterface_t;
 /* @[define_transportinterface] */
@@ -8,6 +8,7 @@
 #include "tuya_transporter.h"
 #include "tal_log.h"
 #include "tal_system.h"
+#include "tal_mutex.h"
 #include "tal_memory.h"
 
 #define log_debug PR_DEBUG
@@ -17,9 +18,17 @@ typedef struct {
     mqtt_client_config_t config;
     MQTTContext_t mqclient;
     tuya_transporter_t network;
+    MUTEX_HANDLE send_mutex; // one packet at a time is built in mqttbuffer and written, publishers run concurrently
+    uint32_t yield_deadline; // the first header byte is waited no later than this in mqtt_client_yield_wait
+    bool yielding;
+    bool yield_break; // a packet was dispatched or the deadline passed, leave the process loop at the next read
+    bool in_header;   // the packet type is read, the remaining length bytes are not all read yet
     uint8_t mqttbuffer[CORE_MQTT_BUFFER_SIZE];
 } mqtt_client_context_t;
 
+#define MQTT_CLIENT_CONTEXT_OF(pNetwork) \
+    ((mqtt_client_context_t *)((uint8_t *)(pNetwork) - offsetof(mqtt_client_context_t, network)))
+
 static void core_mqtt_library_callback(struct MQTTContext *pContext, struct MQTTPacketInfo *pPacketInfo,
                                        struct MQTTDeserializedInfo *pDeserializedInfo)
 {
@@ -79,6 +88,11 @@ static void core_mqtt_library_callback(struct MQTTContext *pContext, struct MQTT
             log_debug("type:0x%02x, id:%d", pPacketInfo->type, msgid);
         }
     }
+
+    // the packet is received completely, the next read is the header of the next one
+    if (context->yielding) {
+        context->yield_break = true;
+    }
 }
 
 void *mqtt_client_new(void)
@@ -98,8 +112,27 @@ static int network_write(NetworkContext_t *pNetwork, const unsigned char *pMsg,
     return tuya_transporter_write(transporter, (uint8_t *)pMsg, len, 0);
 }
 
+static int network_writev(NetworkContext_t *pNetwork, TransportOutVector_t *pIoVec, size_t ioVecCount)
+{
+    tuya_transporter_t transporter = *pNetwork;
+    tuya_transporter_iovec_t iov[2];
+    size_t i;
+
+    // coreMQTT sends a header and a payload, more buffers would go out in the next call as after a short write
+    if (ioVecCount > sizeof(iov) / sizeof(iov[0])) {
+        ioVecCount = sizeof(iov) / sizeof(iov[0]);
+    }
+    for (i = 0; i < ioVecCount; i++) {
+        iov[i].buf = (uint8_t *)pIoVec[i].iov_base;
+        iov[i].len = (int)pIoVec[i].iov_len;
+    }
+
+    return tuya_transporter_writev(transporter, iov, (int)ioVecCount, 0);
+}
+
 static int network_read(NetworkContext_t *pNetwork, unsigned char *pMsg, size_t len)
 {
+    mqtt_client_context_t *context = MQTT_CLIENT_CONTEXT_OF(pNetwork);
     tuya_transporter_t transporter = *pNetwork;
 
     tuya_tls_config_t *tls_config = NULL;
@@ -108,9 +141,39 @@ static int network_read(NetworkContext_t *pNetwork, unsigned char *pMsg, size_t
 
     int timeout = tls_config ? tls_config->timeout : 5000;
 
+    // coreMQTT reads the fixed header byte by byte into its own variables, the rest into the network buffer
+    bool header = (pMsg < context->mqttbuffer) || (pMsg >= context->mqttbuffer + sizeof(context->mqttbuffer));
+    bool first = header && !context->in_header;
+
+    // only the wait for a new packet is bounded by the deadline, a started one is read with the normal timeout
+    if (context->yielding && first) {
+        // fails the process loop, mqtt_client_yield_wait takes it as done
+        if (context->yield_break) {
+            return OPRT_COM_ERROR;
+        }
+        int32_t remain = (int32_t)(context->yield_deadline - tal_system_get_millisecond());
+        timeout = remain > 0 ? remain : 1;
+    }
+
     int result = tuya_transporter_read(transporter, (uint8_t *)pMsg, len, timeout);
 
+    if (header) {
+        if (result <= 0) {
+            context->in_header = false;
+        } else if (first) {
+            context->in_header = true;
+        } else if (0 == (pMsg[0] & 0x80)) {
+            // the last byte of the remaining length
+            context->in_header = false;
+        }
+    }
+
     if (result == OPRT_RESOURCE_NOT_READY) {
+        // keepalive is handled on this empty read, the loop ends at the next one
+        if (context->yielding && first &&
+            (int32_t)(context->yield_deadline - tal_system_get_millisecond()) <= 0) {
+            context->yield_break = true;
+        }
         return 0;
     }
 
@@ -153,9 +216,10 @@ mqtt_client_status_t mqtt_client_init(void *client, const mqtt_client_config_t *
     /* Fill in TransportInterface send and receive function pointers.
      * For this demo, TCP sockets are used to send and receive data
      * from network. Network context is SSL context for OpenSSL.*/
-    TransportInterface_t transport;
+    TransportInterface_t transport = {0};
     transport.pNetworkContext = &context->network;
     transport.send = (TransportSend_t)network_write;
+    transport.writev = (TransportWritev_t)network_writev;
     transport.recv = (TransportRecv_t)network_read;
 
     /* Fill the values for network buffer. */
@@ -174,6 +238,11 @@ mqtt_client_status_t mqtt_client_init(void *client, const mqtt_client_config_t *
         return OPRT_COM_ERROR;
     }
 
+    if (OPRT_OK != tal_mutex_create_init(&context->send_mutex)) {
+        tuya_transporter_destroy(context->network);
+        return MQTT_STATUS_NETWORK_INIT_FAILED;
+    }
+
     return MQTT_STATUS_SUCCESS;
 }
 
@@ -183,6 +252,7 @@ mqtt_client_status_t mqtt_client_deinit(void *client)
 
     tuya_transporter_close(context->network);
     tuya_transporter_destroy(context->network);
+    tal_mutex_release(context->send_mutex);
     return MQTT_STATUS_SUCCESS;
 }
 
@@ -199,6 +269,7 @@ mqtt_client_status_t mqtt_client_connect(void *client)
     }
 
     bool pSessionPresent = false;
+    context->in_header = false;
 
     /* Send MQTT CONNECT packet to broker. */
     mqtt_status = MQTT_Connect(&context->mqclient,
@@ -232,7 +303,9 @@ mqtt_client_status_t mqtt_client_disconnect(void *client)
     mqtt_client_context_t *context = (mqtt_client_context_t *)client;
     MQTTStatus_t mqtt_status;
 
+    tal_mutex_lock(context->send_mutex);
     mqtt_status = MQTT_Disconnect(&context->mqclient);
+    tal_mutex_unlock(context->send_mutex);
     if (MQTTSuccess != mqtt_status) {
         log_error("mqtt disconnect err: %s(%d)", MQTT_Status_strerror(mqtt_status), mqtt_status);
     }
@@ -251,11 +324,13 @@ uint16_t mqtt_client_subscribe(void *client, const char *topic, uint8_t qos)
     mqtt_client_context_t *context = (mqtt_client_context_t *)client;
     MQTTStatus_t mqtt_status;
 
+    tal_mutex_lock(context->send_mutex);
     uint16_t msgid = MQTT_GetPacketId(&context->mqclient);
 
     mqtt_status = MQTT_Subscribe(
         &context->mqclient,
         &(const MQTTSubscribeInfo_t){.qos = qos, .pTopicFilter = topic, .topicFilterLength = strlen(topic)}, 1, msgid);
+    tal_mutex_unlock(context->send_mutex);
 
     if (mqtt_status != MQTTSuccess) {
         log_error("Failed to send SUBSCRIBE packet to broker with error = %s.", MQTT_Status_strerror(mqtt_status));
@@ -270,11 +345,13 @@ uint16_t mqtt_client_unsubscribe(void *client, const char *topic, uint8_t qos)
     mqtt_client_context_t *context = (mqtt_client_context_t *)client;
     MQTTStatus_t mqtt_status;
 
+    tal_mutex_lock(context->send_mutex);
     uint16_t msgid = MQTT_GetPacketId(&context->mqclient);
 
     mqtt_status = MQTT_Unsubscribe(
         &context->mqclient,
         &(const MQTTSubscribeInfo_t){.qos = qos, .pTopicFilter = topic, .topicFilterLength = strlen(topic)}, 1, msgid);
+    tal_mutex_unlock(context->send_mutex);
 
     if (mqtt_status != MQTTSuccess) {
         log_error("Failed to send SUBSCRIBE packet to broker with error = %s.", MQTT_Status_strerror(mqtt_status));
@@ -285,12 +362,29 @@ uint16_t mqtt_client_unsubscribe(void *client, const char *topic, uint8_t qos)
 }
 
 uint16_t mqtt_client_publish(void *client, const char *topic, const uint8_t *payload, size_t length, uint8_t qos)
+{
+    return mqtt_client_publish_msgid(client, mqtt_client_msgid_new(client), topic, payload, length, qos);
+}
+
+uint16_t mqtt_client_msgid_new(void *client)
 {
     mqtt_client_context_t *context = (mqtt_client_context_t *)client;
-    MQTTStatus_t mqtt_status;
+    uint16_t msgid;
 
-    uint16_t msgid = MQTT_GetPacketId(&context->mqclient);
+    tal_mutex_lock(context->send_mutex);
+    msgid = MQTT_GetPacketId(&context->mqclient);
+    tal_mutex_unlock(context->send_mutex);
+
+    return msgid;
+}
 
+uint16_t mqtt_client_publish_msgid(void *client, uint16_t msgid, const char *topic, const uint8_t *payload,
+                                   size_t length, uint8_t qos)
+{
+    mqtt_client_context_t *context = (mqtt_client_context_t *)client;
+    MQTTStatus_t mqtt_status;
+
+    tal_mutex_lock(context->send_mutex);
     mqtt_status = MQTT_Publish(&context->mqclient,
                                &(const MQTTPublishInfo_t){.qos = qos,
                                                           .pTopicName = topic,
@@ -298,6 +392,7 @@ uint16_t mqtt_client_publish(void *client, const char *topic, const uint8_t *pay
                                                           .pPayload = payload,
                                                           .payloadLength = length},
                                msgid);
+    tal_mutex_unlock(context->send_mutex);
 
     if (MQTTSuccess != mqtt_status) {
         return 0;
@@ -311,6 +406,59 @@ mqtt_client_status_t mqtt_client_yield(void *client)
     MQTTStatus_t mqtt_status;
 
     mqtt_status = MQTT_ProcessLoop(&context->mqclient, context->config.timeout_ms);
+    if (mqtt_status != MQTTSuccess) {
+        log_error("MQTT_ProcessLoop returned with status = %s.", MQTT_Status_strerror(mqtt_status));
+        mqtt_client_disconnect(context);
+        return MQTT_STATUS_NETWORK_TIMEOUT;
+    }
+    return MQTT_STATUS_SUCCESS;
+}
+
+/* the time to wait before the keep alive needs the process loop, a PINGREQ or the PINGRESP timeout */
+static uint32_t mqtt_client_keepalive_wait(const MQTTContext_t *mqclient, uint32_t now)
+{
+    uint32_t keepalive = 1000U * (uint32_t)mqclient->keepAliveIntervalSec;
+    uint32_t deadline = mqclient->lastPacketTime + keepalive;
+
+    if (0 == keepalive) {
+        return UINT32_MAX;
+    }
+
+    if (mqclient->waitingForPingResp &&
+        (int32_t)(mqclient->pingReqSendTimeMs + MQTT_PINGRESP_TIMEOUT_MS - deadline) > 0) {
+        deadline = mqclient->pingReqSendTimeMs + MQTT_PINGRESP_TIMEOUT_MS;
+    }
+
+    // handleKeepAlive acts when the elapsed time is greater than the interval
+    if ((int32_t)(deadline - now) < 0) {
+        return 0;
+    }
+    return deadline - now + 1;
+}
+
+mqtt_client_status_t mqtt_client_yield_wait(void *client, uint32_t timeout_ms)
+{
+    mqtt_client_context_t *context = (mqtt_client_context_t *)client;
+    MQTTStatus_t mqtt_status;
+    uint32_t now = tal_system_get_millisecond();
+    uint32_t wait = mqtt_client_keepalive_wait(&context->mqclient, now);
+
+    if (wait > timeout_ms) {
+        wait = timeout_ms;
+    }
+
+    context->yield_deadline = now + wait;
+    context->yield_break = false;
+    context->yielding = true;
+    // network_read ends the loop at the deadline, the budget leaves a packet started then the normal timeout
+    mqtt_status = MQTT_ProcessLoop(&context->mqclient, wait + context->config.timeout_ms);
+    context->yielding = false;
+
+    if (mqtt_status == MQTTRecvFailed && context->yield_break) {
+        mqtt_status = MQTTSuccess;
+    }
+    context->yield_break = false;
+
     if (mqtt_status != MQTTSuccess) {
         log_error("MQTT_ProcessLoop returned with status = %s.", MQTT_Status_strerror(mqtt_status));
         mqtt_client_disconnect(context);
@@ -0,0 +1,210 @@
+/**
+ * @file test_mqtt_yield_wait.cpp
+ * @brief UT of mqtt_client_yield_wait.
+ *
+ * The transporter is replaced by a fake broker that delivers scripted bytes at
+ * given times after the connect. A read waits until the next bytes arrive or
+ * its timeout passes, like a socket read does.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <deque>
+#include <string.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tuya_transporter.h"
+#include "mqtt_client_interface.h"
+}
+
+#define CONNACK "\x20\x02\x00\x00"
+
+struct fake_chunk_t {
+    uint32_t at; // ms after the connect
+    std::string data;
+};
+
+struct fake_conn_t {
+    struct tuya_transporter_inter_t base;
+    uint32_t connected_at;
+    std::deque<fake_chunk_t> script;
+};
+
+static fake_conn_t *s_conn;
+static int s_messages;
+static std::string s_payload;
+
+static uint32_t fake_now(void)
+{
+    return tal_system_get_millisecond() - s_conn->connected_at;
+}
+
+extern "C" {
+tuya_transporter_t tuya_transporter_create(TUYA_TRANSPORT_TYPE_E transport_type, tuya_transporter_t dependency)
+{
+    s_conn = new fake_conn_t();
+    return (tuya_transporter_t)s_conn;
+}
+
+OPERATE_RET tuya_transporter_destroy(tuya_transporter_t t)
+{
+    delete (fake_conn_t *)t;
+    s_conn = NULL;
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_connect(tuya_transporter_t t, const char *host, int port, int timeout_ms)
+{
+    ((fake_conn_t *)t)->connected_at = tal_system_get_millisecond();
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_close(tuya_transporter_t t)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_write(tuya_transporter_t t, uint8_t *buf, int len, int timeout_ms)
+{
+    // CONNECT is answered at once
+    if (0x10 == buf[0]) {
+        ((fake_conn_t *)t)->script.push_front({0, std::string(CONNACK, 4)});
+    }
+    return len;
+}
+
+OPERATE_RET tuya_transporter_writev(tuya_transporter_t t, const tuya_transporter_iovec_t *iov, int iovcnt,
+                                    int timeout_ms)
+{
+    int len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].len;
+    }
+    return len;
+}
+
+OPERATE_RET tuya_transporter_read(tuya_transporter_t transporter, uint8_t *buf, int len, int timeout_ms)
+{
+    fake_conn_t *t = (fake_conn_t *)transporter;
+    uint32_t now = fake_now();
+
+    if (t->script.empty() || t->script.front().at > now + timeout_ms) {
+        tal_system_sleep(timeout_ms);
+        return OPRT_RESOURCE_NOT_READY;
+    }
+    if (t->script.front().at > now) {
+        tal_system_sleep(t->script.front().at - now);
+    }
+
+    std::string &data = t->script.front().data;
+    int n = (int)data.size() < len ? (int)data.size() : len;
+    memcpy(buf, data.data(), n);
+    data.erase(0, n);
+    if (data.empty()) {
+        t->script.pop_front();
+    }
+    return n;
+}
+
+OPERATE_RET tuya_transporter_ctrl(tuya_transporter_t t, uint32_t cmd, void *args)
+{
+    if (TUYA_TRANSPORTER_GET_TLS_CONFIG == cmd) {
+        *(void **)args = NULL;
+    }
+    return OPRT_OK;
+}
+}
+
+static void on_message(void *client, uint16_t msgid, const mqtt_client_message_t *msg, void *userdata)
+{
+    s_messages++;
+    s_payload.assign((const char *)msg->payload, msg->length);
+}
+
+class MqttYieldWaitTest : public testing::Test {
+  protected:
+    void *client;
+
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+    }
+
+    void SetUp() override
+    {
+        mqtt_client_config_t config;
+
+        memset(&config, 0, sizeof(config));
+        config.host = "broker.example.com";
+        config.port = 1883;
+        config.keepalive = 60;
+        config.timeout_ms = 1000;
+        config.clientid = "id";
+        config.username = "user";
+        config.password = "pass";
+        config.on_message = on_message;
+
+        s_messages = 0;
+        s_payload.clear();
+        client = mqtt_client_new();
+        ASSERT_EQ(MQTT_STATUS_SUCCESS, mqtt_client_init(client, &config));
+        ASSERT_EQ(MQTT_STATUS_SUCCESS, mqtt_client_connect(client));
+    }
+
+    void TearDown() override
+    {
+        mqtt_client_deinit(client);
+        mqtt_client_free(client);
+    }
+
+    // QoS 0 PUBLISH of topic "t", split after the first header byte
+    void publish_at(uint32_t header_at, uint32_t rest_at, const char *payload)
+    {
+        std::string rest;
+        rest += (char)(3 + strlen(payload));
+        rest += std::string("\x00\x01t", 3);
+        rest += payload;
+        s_conn->script.push_back({header_at, std::string("\x30", 1)});
+        s_conn->script.push_back({rest_at, rest});
+    }
+};
+
+TEST_F(MqttYieldWaitTest, IdleReturnsAtTheDeadline)
+{
+    uint32_t start = tal_system_get_millisecond();
+
+    EXPECT_EQ(MQTT_STATUS_SUCCESS, mqtt_client_yield_wait(client, 100));
+
+    uint32_t elapsed = tal_system_get_millisecond() - start;
+    EXPECT_GE(elapsed, 100u);
+    EXPECT_LT(elapsed, 300u);
+}
+
+TEST_F(MqttYieldWaitTest, PacketIsDispatchedAtOnce)
+{
+    publish_at(20, 20, "hello");
+    uint32_t start = tal_system_get_millisecond();
+
+    EXPECT_EQ(MQTT_STATUS_SUCCESS, mqtt_client_yield_wait(client, 1000));
+
+    EXPECT_LT(tal_system_get_millisecond() - start, 500u);
+    EXPECT_EQ(1, s_messages);
+    EXPECT_EQ("hello", s_payload);
+}
+
+TEST_F(MqttYieldWaitTest, PacketStartedAtTheDeadlineIsReadCompletely)
+{
+    // the header comes just before the deadline, the rest well after it
+    publish_at(90, 300, "late");
+
+    EXPECT_EQ(MQTT_STATUS_SUCCESS, mqtt_client_yield_wait(client, 100));
+    EXPECT_EQ(1, s_messages);
+    EXPECT_EQ("late", s_payload);
+
+    // still connected, the next wait runs as usual
+    EXPECT_EQ(MQTT_STATUS_SUCCESS, mqtt_client_yield_wait(client, 50));
+}
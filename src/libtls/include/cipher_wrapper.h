@@ -22,12 +22,61 @@ typedef struct {
     mbedtls_cipher_type_t cipher_type;
 } cipher_params_t;
 
+/**
+ * @brief AEAD (GCM, CCM, ChaCha20-Poly1305) cipher with its key scheduled, reused by the messages under the same key.
+ * A context is used by one thread at a time.
+ */
+typedef struct {
+    mbedtls_cipher_context_t cipher;
+    mbedtls_cipher_type_t cipher_type;
+    size_t key_len;
+    unsigned char key[32];
+} tal_cipher_aead_ctx_t;
+
 int mbedtls_cipher_auth_encrypt_wrapper(const cipher_params_t *input, unsigned char *output, size_t *olen,
                                         unsigned char *tag, size_t tag_len);
 
 int mbedtls_cipher_auth_decrypt_wrapper(const cipher_params_t *input, unsigned char *output, size_t *olen,
                                         unsigned char *tag, size_t tag_len);
 
+/**
+ * @brief init the context, no key is set
+ */
+void tal_cipher_aead_init(tal_cipher_aead_ctx_t *ctx);
+
+/**
+ * @brief set the cipher and key, nothing is done if they are the ones already set
+ *
+ * @return 0 on success
+ */
+int tal_cipher_aead_setkey(tal_cipher_aead_ctx_t *ctx, mbedtls_cipher_type_t cipher_type, const unsigned char *key,
+                           size_t key_len);
+
+/**
+ * @brief encrypt ilen bytes of input to output and write the tag after them,
+ * output must have ilen + tag_len bytes, it can be input to encrypt in place
+ *
+ * @return 0 on success
+ */
+int tal_cipher_aead_encrypt(tal_cipher_aead_ctx_t *ctx, const unsigned char *nonce, size_t nonce_len,
+                            const unsigned char *ad, size_t ad_len, const unsigned char *input, size_t ilen,
+                            unsigned char *output, size_t tag_len);
+
+/**
+ * @brief check the tag after ilen bytes of input and decrypt them to output,
+ * output must have ilen bytes, it can be input to decrypt in place
+ *
+ * @return 0 on success, MBEDTLS_ERR_CIPHER_AUTH_FAILED if the tag is wrong
+ */
+int tal_cipher_aead_decrypt(tal_cipher_aead_ctx_t *ctx, const unsigned char *nonce, size_t nonce_len,
+                            const unsigned char *ad, size_t ad_len, const unsigned char *input, size_t ilen,
+                            unsigned char *output, size_t tag_len);
+
+/**
+ * @brief free the cipher and clear the key
+ */
+void tal_cipher_aead_free(tal_cipher_aead_ctx_t *ctx);
+
 int mbedtls_message_digest(mbedtls_md_type_t md_type, const uint8_t *input, size_t ilen, uint8_t *digest);
 
 int mbedtls_message_digest_hmac(mbedtls_md_type_t md_type, const uint8_t *key, size_t keylen, const uint8_t *input,
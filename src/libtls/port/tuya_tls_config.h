@@ -1910,7 +1910,9 @@
 #undef MBEDTLS_SSL_SESSION_TICKETS
 #endif
 #else
-// #define MBEDTLS_SSL_SESSION_TICKETS
+#if defined(ENABLE_TLS_SESSION_RESUME) && (ENABLE_TLS_SESSION_RESUME == 1)
+#define MBEDTLS_SSL_SESSION_TICKETS
+#endif
 #endif
 /**
  * \def MBEDTLS_SSL_EXPORT_KEYS
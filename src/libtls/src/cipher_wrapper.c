@@ -1,5 +1,6 @@
 // https://tls.mbed.org/module-level-design-cipher
 #include "cipher_wrapper.h"
+#include "mbedtls/platform_util.h"
 #include "tal_log.h"
 #include "tal_memory.h"
 
@@ -136,6 +137,104 @@ EXIT:
     return (ret);
 }
 
+void tal_cipher_aead_init(tal_cipher_aead_ctx_t *ctx)
+{
+    memset(ctx, 0, sizeof(tal_cipher_aead_ctx_t));
+    mbedtls_cipher_init(&ctx->cipher);
+}
+
+int tal_cipher_aead_setkey(tal_cipher_aead_ctx_t *ctx, mbedtls_cipher_type_t cipher_type, const unsigned char *key,
+                           size_t key_len)
+{
+    const mbedtls_cipher_info_t *cipher_info = NULL;
+    int ret = OPRT_OK;
+
+    if (ctx == NULL || key == NULL || key_len > sizeof(ctx->key)) {
+        return OPRT_INVALID_PARM;
+    }
+
+    if (ctx->key_len && ctx->cipher_type == cipher_type && ctx->key_len == key_len &&
+        memcmp(ctx->key, key, key_len) == 0) {
+        return OPRT_OK;
+    }
+
+    // the cipher is set up again only for another type, a new key is scheduled in place
+    if (ctx->cipher_type != cipher_type) {
+        cipher_info = mbedtls_cipher_info_from_type(cipher_type);
+        if (cipher_info == NULL) {
+            PR_ERR("Cipher not found\n");
+            return OPRT_INVALID_PARM;
+        }
+        mbedtls_cipher_free(&ctx->cipher);
+        mbedtls_cipher_init(&ctx->cipher);
+        ctx->cipher_type = MBEDTLS_CIPHER_NONE;
+        if ((ret = mbedtls_cipher_setup(&ctx->cipher, cipher_info)) != 0) {
+            PR_ERR("mbedtls_cipher_setup failed\n");
+            goto EXIT;
+        }
+        ctx->cipher_type = cipher_type;
+    }
+
+    if ((key_len * 8) != mbedtls_cipher_get_key_bitlen(&ctx->cipher)) {
+        PR_ERR("key_len:%d mbedtls_key_bitlen:%d", key_len * 8, mbedtls_cipher_get_key_bitlen(&ctx->cipher));
+        ret = OPRT_INVALID_PARM;
+        goto EXIT;
+    }
+
+    // the AEAD modes use the encryption key schedule both ways
+    if ((ret = mbedtls_cipher_setkey(&ctx->cipher, key, key_len * 8, MBEDTLS_ENCRYPT)) != 0) {
+        PR_ERR("mbedtls_cipher_setkey() returned error\n");
+        goto EXIT;
+    }
+
+    ctx->key_len = key_len;
+    memcpy(ctx->key, key, key_len);
+    return OPRT_OK;
+
+EXIT:
+    ctx->key_len = 0;
+    return ret;
+}
+
+int tal_cipher_aead_encrypt(tal_cipher_aead_ctx_t *ctx, const unsigned char *nonce, size_t nonce_len,
+                            const unsigned char *ad, size_t ad_len, const unsigned char *input, size_t ilen,
+                            unsigned char *output, size_t tag_len)
+{
+    size_t olen = 0;
+
+    if (ctx == NULL || ctx->key_len == 0 || output == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+
+    return mbedtls_cipher_auth_encrypt_ext(&ctx->cipher, nonce, nonce_len, ad, ad_len, input, ilen, output,
+                                           ilen + tag_len, &olen, tag_len);
+}
+
+int tal_cipher_aead_decrypt(tal_cipher_aead_ctx_t *ctx, const unsigned char *nonce, size_t nonce_len,
+                            const unsigned char *ad, size_t ad_len, const unsigned char *input, size_t ilen,
+                            unsigned char *output, size_t tag_len)
+{
+    size_t olen = 0;
+
+    if (ctx == NULL || ctx->key_len == 0 || output == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+
+    return mbedtls_cipher_auth_decrypt_ext(&ctx->cipher, nonce, nonce_len, ad, ad_len, input, ilen + tag_len, output,
+                                           ilen, &olen, tag_len);
+}
+
+void tal_cipher_aead_free(tal_cipher_aead_ctx_t *ctx)
+{
+    if (ctx == NULL) {
+        return;
+    }
+    mbedtls_cipher_free(&ctx->cipher);
+    mbedtls_platform_zeroize(ctx->key, sizeof(ctx->key));
+    ctx->cipher_type = MBEDTLS_CIPHER_NONE;
+    ctx->key_len = 0;
+}
+
 int mbedtls_message_digest(mbedtls_md_type_t md_type, const uint8_t *input, size_t ilen, uint8_t *digest)
 {
     if (input == NULL || ilen == 0 || digest == NULL) {
@@ -25,9 +25,17 @@ extern "C" {
 #include <stdint.h>
 #include <stddef.h>
 
-#define local_storage_set posix_storage_set
-#define local_storage_get posix_storage_get
-#define local_storage_del posix_storage_del
+#define local_storage_init posix_storage_init
+#define local_storage_set  posix_storage_set
+#define local_storage_get  posix_storage_get
+#define local_storage_size posix_storage_size
+#define local_storage_del  posix_storage_del
+
+int posix_storage_init(void);
+int posix_storage_set(const char *key, const uint8_t *buffer, size_t length);
+int posix_storage_get(const char *key, uint8_t *buffer, size_t *length);
+int posix_storage_size(const char *key, size_t *length);
+int posix_storage_del(const char *key);
 
 #ifdef __cplusplus
 }
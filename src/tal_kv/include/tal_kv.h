@@ -3,8 +3,8 @@
  * @brief Provides key-value storage functionality for Tuya applications.
  *
  * This header file defines the interface for Tuya's key-value (KV) storage
- * system, which is designed to serialize and deserialize data to and from JSON
- * format for efficient storage and retrieval. It supports various data types
+ * system, which is designed to serialize and deserialize data to and from a
+ * compact binary format for efficient storage and retrieval. It supports various data types
  * including integers, booleans, strings, and raw binary data. The API
  * facilitates the initialization of the KV storage system, setting and getting
  * key-value pairs, deleting keys, and performing serialization and
@@ -23,27 +23,27 @@ extern "C" {
 #endif
 
 #include "tuya_cloud_types.h"
+#if !defined(ENABLE_KV_STORAGE_POSIX) || (ENABLE_KV_STORAGE_POSIX == 0)
 #include "lfs.h"
+#endif
 /**
  * @brief tuya key-value database type define, used for serialize/deserialize
- * data to json format
+ * data, every field takes key length + 4 bytes plus the value
  *
  */
 typedef uint8_t kv_tp_t;
-#define KV_CHAR   0 // char, same as int, need 11+6 byte
-#define KV_BYTE   1 // byte, same as int, need 11+6 byte
-#define KV_SHORT  2 // short, same as int, need 11+6 byte
-#define KV_USHORT 3 // unsigned short, same as int, need 11+6 byte
-#define KV_INT    4 // int, need 11+6 byte when serialize to json format
-#define KV_BOOL   5 // bool, need 6+6 byte when serialize to json format
-#define KV_STRING 6 // string, need len+6 byte when serialize to json format
-#define KV_RAW                                                                                                         \
-    7 // raw, need len/3*4+len%3?4:0+6 (base64 encode) when serialize to json
-      // format
+#define KV_CHAR   0 // char, 1 byte
+#define KV_BYTE   1 // byte, 1 byte
+#define KV_SHORT  2 // short, 2 byte
+#define KV_USHORT 3 // unsigned short, 2 byte
+#define KV_INT    4 // int, 4 byte
+#define KV_BOOL   5 // bool, 1 byte
+#define KV_STRING 6 // string, string length without the terminating zero
+#define KV_RAW    7 // raw, len byte, len is updated to the stored length after deserialize
 
 /**
- * @brief tuya key-value database, used for serialize/deserialize data to json
- * format
+ * @brief tuya key-value database, used for serialize/deserialize data, the
+ * key must be 1 to 255 bytes
  *
  */
 typedef struct {
@@ -60,6 +60,16 @@ typedef struct {
     char key[TAL_LV_KEY_LEN + 1];
 } tal_kv_cfg_t;
 
+/**
+ * @brief one key-value pair of tal_kv_set_batch
+ *
+ */
+typedef struct {
+    const char *key;
+    const uint8_t *value;
+    size_t length;
+} tal_kv_item_t;
+
 /**
  * @brief Initializes the TAL Key-Value (KV) module.
  *
@@ -125,6 +135,30 @@ int tal_kv_free(uint8_t *value);
  */
 int tal_kv_del(const char *key);
 
+/**
+ * @brief Writes the values kept by the cache to flash.
+ *
+ * With ENABLE_KV_CACHE the values are written in a delayed work after they are
+ * set and when tal_system_reset is called, call this function before the power
+ * is cut.
+ *
+ * @return 0 on success, or the error code of the first failed write.
+ */
+int tal_kv_flush(void);
+
+/**
+ * @brief Sets several key-value pairs as one transaction.
+ *
+ * After a power loss either all the keys or none of them have the new value,
+ * an interrupted batch is finished by tal_kv_init. On error some of the keys
+ * may have the new value.
+ *
+ * @param items The key-value pairs, the key length must be less than 256.
+ * @param cnt The number of pairs.
+ * @return 0 on success, or a negative error code if an error occurred.
+ */
+int tal_kv_set_batch(const tal_kv_item_t *items, size_t cnt);
+
 /**
  * @brief Serializes and sets the value of a key in the key-value database.
  *
@@ -164,12 +198,14 @@ int tal_kv_serialize_get(const char *key, kv_db_t *db, size_t dbcnt);
  */
 void tal_kv_cmd(int argc, char *argv[]);
 
+#if !defined(ENABLE_KV_STORAGE_POSIX) || (ENABLE_KV_STORAGE_POSIX == 0)
 /**
  * @brief Get the LFS handle, can be used for file system opeation
  *
  * @return lfs_t *
  */
 lfs_t *tal_lfs_get();
+#endif
 
 #ifdef __cplusplus
 }
@@ -1,19 +1,24 @@
 /**
  * @file kv_serialize.c
- * @brief Implements serialization of key-value pairs into a JSON string.
+ * @brief Implements serialization of key-value pairs into a compact binary
+ * record.
  *
  * This file contains the implementation of the kv_serialize function, which is
- * responsible for converting a database of key-value pairs into a JSON
- * formatted string. It supports various data types including integers,
- * booleans, strings, and raw binary data. The serialization process calculates
- * the necessary buffer size, iterates through the key-value pairs, and formats
- * them according to their type into a JSON string. This functionality is
- * crucial for storing configuration data in a human-readable and easily
- * transmittable format.
+ * responsible for converting a database of key-value pairs into a versioned
+ * TLV (type-length-value) record, and the kv_deserialize function, which
+ * parses such a record straight into the buffers of the caller's database
+ * without any heap allocation.
  *
- * The implementation utilizes the cJSON library for JSON serialization and
- * includes optimizations for memory usage and processing time, making it
- * suitable for resource-constrained environments.
+ * Record layout, all integers are little endian:
+ *   header : magic(1) version(1)
+ *   field  : key_len(1) key(key_len) type(1) val_len(2) val(val_len)
+ *
+ * Integers are stored with the width of their type, strings without the
+ * terminating zero (an empty string means null) and raw data as it is.
+ *
+ * Records written by older versions are JSON text, they start with '{' and
+ * are still parsed by the cJSON based decoder, the next write converts them
+ * to the binary format.
  *
  * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
  *
@@ -25,138 +30,187 @@
 #include "cJSON.h"
 #include "mix_method.h"
 
+#define KV_SERIAL_MAGIC    0xB5
+#define KV_SERIAL_VERSION  1
+#define KV_SERIAL_HEAD_LEN 2
+#define KV_SERIAL_TLV_LEN  4 // key_len(1) + type(1) + val_len(2)
+#define KV_SERIAL_VAL_MAX  0xFFFF
+
+/**
+ * @brief Get the length of the value of a field when serialized.
+ *
+ * @param db The field.
+ * @return The value length, or -1 if the type is invalid. The caller checks
+ * that it fits in val_len.
+ */
+static int __kv_serial_val_len(const kv_db_t *db)
+{
+    switch (db->tp) {
+    case KV_CHAR:
+    case KV_BYTE:
+    case KV_BOOL:
+        return 1;
+    case KV_SHORT:
+    case KV_USHORT:
+        return 2;
+    case KV_INT:
+        return 4;
+    case KV_STRING: {
+        const char *str = (const char *)db->val;
+        uint32_t len = 0;
+        while (len < db->len && str[len]) {
+            len++;
+        }
+        return len;
+    }
+    case KV_RAW:
+        return db->len;
+    default:
+        return -1;
+    }
+}
+
+/**
+ * @brief Read an integer field of the stored type.
+ *
+ * @param tp The stored type.
+ * @param p The stored value.
+ * @param len The stored value length.
+ * @param value The pointer to store the value.
+ * @return OPRT_OK if the field is an integer of valid length.
+ */
+static int __kv_serial_int_get(kv_tp_t tp, const uint8_t *p, uint16_t len, int32_t *value)
+{
+    switch (tp) {
+    case KV_CHAR:
+        if (1 != len) {
+            return OPRT_COM_ERROR;
+        }
+        *value = (int8_t)p[0];
+        break;
+    case KV_BYTE:
+        if (1 != len) {
+            return OPRT_COM_ERROR;
+        }
+        *value = p[0];
+        break;
+    case KV_SHORT:
+        if (2 != len) {
+            return OPRT_COM_ERROR;
+        }
+        *value = (int16_t)(p[0] | (p[1] << 8));
+        break;
+    case KV_USHORT:
+        if (2 != len) {
+            return OPRT_COM_ERROR;
+        }
+        *value = (uint16_t)(p[0] | (p[1] << 8));
+        break;
+    case KV_INT:
+        if (4 != len) {
+            return OPRT_COM_ERROR;
+        }
+        *value = (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+        break;
+    default:
+        return OPRT_COM_ERROR;
+    }
+
+    return OPRT_OK;
+}
+
 /**
- * Serializes the key-value pairs in the given database into a JSON-formatted
- * string.
+ * Serializes the key-value pairs in the given database into a binary record.
  *
  * @param db The pointer to the database containing the key-value pairs.
  * @param dbcnt The number of key-value pairs in the database.
- * @param out The pointer to store the serialized JSON string.
- * @param out_len The pointer to store the length of the serialized JSON string.
+ * @param out The pointer to store the serialized record, freed by tal_free.
+ * @param out_len The pointer to store the length of the serialized record.
  * @return Returns OPRT_OK if serialization is successful, otherwise returns an
  * error code.
  */
-int kv_serialize(const kv_db_t *db, const uint32_t dbcnt, char **out, uint32_t *out_len)
+int kv_serialize(const kv_db_t *db, const uint32_t dbcnt, uint8_t **out, uint32_t *out_len)
 {
-    int i = 0;
-    // conut need buf size
-    uint32_t len = 0;
-    for (i = 0; i < dbcnt; i++) {
-        // value len
-        if (db[i].tp <= KV_INT) {
-            len += 11 + 6;
-        } else if (db[i].tp == KV_BOOL) {
-            len += 6 + 6;
-        } else if (db[i].tp == KV_STRING) {
-            char *tmp = (char *)db[i].val;
-            if (0 == tmp[0]) {
-                len += db[i].len + 4 + 4; //"id":null,
-            } else {
-                len += db[i].len + 6; //"swv":"4.1.16",
-            }
+    uint32_t i = 0;
+    uint32_t len = KV_SERIAL_HEAD_LEN;
 
-        } else if (db[i].tp == KV_RAW) {
-            // len += (db[i].len / 3) * 4 + ((db[i].len % 3) ? 4 : 0) + 6;
-            len += (db[i].len / 3) * 4 + ((db[i].len % 3) ? 4 : 0);
-            len += (db[i].len ? 6 : 4 + 4);
+    // count need buf size
+    for (i = 0; i < dbcnt; i++) {
+        size_t key_len = strlen(db[i].key);
+        int val_len = __kv_serial_val_len(&db[i]);
+        if (val_len < 0) {
+            PR_ERR("type invalid %d", db[i].tp);
+            return OPRT_COM_ERROR;
         }
-
-        // key len
-        len += strlen(db[i].key) + 2; // 2 == ""
+        if (0 == key_len || key_len > 0xFF) {
+            PR_ERR("key invalid %s", db[i].key);
+            return OPRT_INVALID_PARM;
+        }
+        if (val_len > KV_SERIAL_VAL_MAX) {
+            PR_ERR("value too long %s %d", db[i].key, val_len);
+            return OPRT_INVALID_PARM;
+        }
+        len += KV_SERIAL_TLV_LEN + key_len + val_len;
     }
-    len += 3; // 3 == {}\0
 
-    uint32_t offset = 0;
-    char *buf = tal_malloc(len);
+    uint8_t *buf = tal_malloc(len);
     if (NULL == buf) {
         PR_ERR("maloc fails %d", len);
         return OPRT_MALLOC_FAILED;
     }
-    offset = sprintf(buf, "{");
 
-    for (i = 0; i < dbcnt; i++) {
-        // add key
-        offset += sprintf(buf + offset, "\"%s\":", db[i].key);
+    uint8_t *p = buf;
+    *p++ = KV_SERIAL_MAGIC;
+    *p++ = KV_SERIAL_VERSION;
 
-        // add value
-        switch (db[i].tp) {
-        case KV_CHAR: {
-            offset += sprintf(buf + offset, "%d", *((char *)(db[i].val)));
-        } break;
-        case KV_BYTE: {
-            offset += sprintf(buf + offset, "%d", *((uint8_t *)(db[i].val)));
-        } break;
-        case KV_SHORT: {
-            offset += sprintf(buf + offset, "%d", *((int16_t *)(db[i].val)));
-        } break;
-        case KV_USHORT: {
-            offset += sprintf(buf + offset, "%d", *((uint16_t *)(db[i].val)));
-        } break;
-        case KV_INT: {
-            offset += sprintf(buf + offset, "%d", *((int32_t *)(db[i].val)));
-        } break;
-        case KV_BOOL: {
-            if (FALSE == *((BOOL_T *)(db[i].val))) {
-                offset += sprintf(buf + offset, "false");
-            } else {
-                offset += sprintf(buf + offset, "true");
-            }
-        } break;
+    for (i = 0; i < dbcnt; i++) {
+        uint8_t key_len = (uint8_t)strlen(db[i].key);
+        uint16_t val_len = (uint16_t)__kv_serial_val_len(&db[i]);
+        uint32_t value = 0;
 
-        case KV_STRING: {
-            char *tmp = (char *)db[i].val;
-            if (0 == tmp[0]) {
-                offset += sprintf(buf + offset, "null");
-            } else {
-                offset += sprintf(buf + offset, "\"%s\"", (char *)db[i].val);
-            }
-        } break;
+        *p++ = key_len;
+        memcpy(p, db[i].key, key_len);
+        p += key_len;
+        *p++ = db[i].tp;
+        *p++ = val_len & 0xFF;
+        *p++ = val_len >> 8;
 
-        case KV_RAW: {
-            if (0 == db[i].len) {
-                offset += sprintf(buf + offset, "null");
-            } else {
-                offset += sprintf(buf + offset, "\"");
-                tuya_base64_encode((unsigned char *)db[i].val, (buf + offset), db[i].len);
-                offset += strlen((buf + offset));
-                buf[offset] = '\"';
-                offset++;
-            }
-        } break;
-
-        default: {
-            PR_ERR("type invalid %d", db[i].tp);
-            tal_free(buf);
-            return OPRT_COM_ERROR;
-        }
+        switch (db[i].tp) {
+        case KV_CHAR:
+        case KV_BYTE:
+            *p = *((uint8_t *)(db[i].val));
+            break;
+        case KV_BOOL:
+            *p = (FALSE == *((BOOL_T *)(db[i].val))) ? 0 : 1;
+            break;
+        case KV_SHORT:
+        case KV_USHORT:
+            value = *((uint16_t *)(db[i].val));
+            p[0] = value & 0xFF;
+            p[1] = (value >> 8) & 0xFF;
+            break;
+        case KV_INT:
+            value = *((uint32_t *)(db[i].val));
+            p[0] = value & 0xFF;
+            p[1] = (value >> 8) & 0xFF;
+            p[2] = (value >> 16) & 0xFF;
+            p[3] = (value >> 24) & 0xFF;
+            break;
+        default: // KV_STRING, KV_RAW
+            memcpy(p, db[i].val, val_len);
+            break;
         }
-
-        offset += sprintf(buf + offset, ",");
+        p += val_len;
     }
 
-    if (i != 0) {
-        /* When exiting the loop, an extra ',' will be added at the end, so
-         * reset it here */
-        buf[offset - 1] = ' ';
-    }
-
-    buf[offset++] = '}';
-    buf[offset] = 0;
-
     *out = buf;
-    *out_len = offset;
+    *out_len = len;
 
     return OPRT_OK;
 }
 
 /**
- * @brief Deserialize a JSON string and populate a key-value database.
- *
- * This function takes a JSON string, parses it using cJSON library, and
- * populates a key-value database with the values extracted from the JSON. The
- * key-value database is represented by the `kv_db_t` structure array. The
- * number of elements in the `kv_db_t` array is specified by the `dbcnt`
- * parameter.
+ * @brief Deserialize a legacy JSON record and populate a key-value database.
  *
  * @param[in] in The input JSON string to deserialize.
  * @param[in,out] db The key-value database to populate.
@@ -164,7 +218,7 @@ int kv_serialize(const kv_db_t *db, const uint32_t dbcnt, char **out, uint32_t *
  * @return Returns OPRT_OK if the deserialization is successful. Otherwise, it
  * returns an error code indicating the failure reason.
  */
-int kv_deserialize(const char *in, kv_db_t *db, const uint32_t dbcnt)
+static int __kv_deserialize_json(const char *in, kv_db_t *db, const uint32_t dbcnt)
 {
     cJSON *root = cJSON_Parse(in);
     if (NULL == root) {
@@ -253,7 +307,8 @@ int kv_deserialize(const char *in, kv_db_t *db, const uint32_t dbcnt)
             if (json->type == cJSON_NULL) {
                 db[i].len = 0;
             } else {
-                tuya_base64_decode(json->valuestring, db[i].val);
+                // keep the decoded length, so the record is migrated as it is
+                db[i].len = tuya_base64_decode(json->valuestring, db[i].val);
             }
         } break;
 
@@ -274,3 +329,193 @@ ERR_EXIT:
 
     return op_ret;
 }
+
+/**
+ * @brief Find a field in a binary record.
+ *
+ * @param in The record.
+ * @param in_len The record length.
+ * @param key The key of the field.
+ * @param tp The pointer to store the stored type.
+ * @param val The pointer to store the stored value.
+ * @param val_len The pointer to store the stored value length.
+ * @return OPRT_OK if found, OPRT_NOT_FOUND if not found, OPRT_COM_ERROR if the
+ * record is broken.
+ */
+static int __kv_serial_find(const uint8_t *in, uint32_t in_len, const char *key, kv_tp_t *tp, const uint8_t **val,
+                            uint16_t *val_len)
+{
+    size_t key_len = strlen(key);
+    uint32_t offset = KV_SERIAL_HEAD_LEN;
+
+    while (offset < in_len) {
+        const uint8_t *p = in + offset;
+        uint32_t field_len = 0;
+
+        if (in_len - offset < KV_SERIAL_TLV_LEN || in_len - offset < KV_SERIAL_TLV_LEN + p[0]) {
+            return OPRT_COM_ERROR;
+        }
+        uint16_t len = p[2 + p[0]] | (p[3 + p[0]] << 8);
+        field_len = KV_SERIAL_TLV_LEN + p[0] + len;
+        if (in_len - offset < field_len) {
+            return OPRT_COM_ERROR;
+        }
+
+        if (p[0] == key_len && 0 == memcmp(p + 1, key, key_len)) {
+            *tp = p[1 + p[0]];
+            *val = p + KV_SERIAL_TLV_LEN + p[0];
+            *val_len = len;
+            return OPRT_OK;
+        }
+        offset += field_len;
+    }
+
+    return OPRT_NOT_FOUND;
+}
+
+/**
+ * @brief Deserialize a binary record and populate a key-value database.
+ *
+ * The values are copied into the buffers of the database, no memory is
+ * allocated. Integer fields can be read as another integer type as long as the
+ * value fits, as the JSON format did.
+ *
+ * @param[in] in The input record.
+ * @param[in] in_len The length of the input record.
+ * @param[in,out] db The key-value database to populate.
+ * @param[in] dbcnt The number of elements in the key-value database.
+ * @return Returns OPRT_OK if the deserialization is successful. Otherwise, it
+ * returns an error code indicating the failure reason.
+ */
+static int __kv_deserialize_bin(const uint8_t *in, uint32_t in_len, kv_db_t *db, const uint32_t dbcnt)
+{
+    int op_ret = OPRT_OK;
+    uint32_t i = 0;
+
+    if (in[1] != KV_SERIAL_VERSION) {
+        PR_ERR("version invalid %d", in[1]);
+        return OPRT_NOT_SUPPORTED;
+    }
+
+    for (i = 0; i < dbcnt; i++) {
+        kv_tp_t tp = 0;
+        const uint8_t *val = NULL;
+        uint16_t len = 0;
+        int32_t value = 0;
+
+        op_ret = __kv_serial_find(in, in_len, db[i].key, &tp, &val, &len);
+        if (OPRT_NOT_FOUND == op_ret) { // default set zero
+            memset(db[i].val, 0, db[i].len);
+            continue;
+        } else if (OPRT_OK != op_ret) {
+            goto ERR_EXIT;
+        }
+
+        op_ret = OPRT_COM_ERROR;
+        switch (db[i].tp) {
+        case KV_CHAR:
+            if (OPRT_OK != __kv_serial_int_get(tp, val, len, &value) || value < -128 || value > 127) {
+                goto ERR_EXIT;
+            }
+            *((char *)db[i].val) = value;
+            break;
+
+        case KV_BYTE:
+            if (OPRT_OK != __kv_serial_int_get(tp, val, len, &value) || value < 0 || value > 255) {
+                goto ERR_EXIT;
+            }
+            *((uint8_t *)db[i].val) = value;
+            break;
+
+        case KV_SHORT:
+            if (OPRT_OK != __kv_serial_int_get(tp, val, len, &value) || value < -32768 || value > 32767) {
+                goto ERR_EXIT;
+            }
+            *((int16_t *)db[i].val) = value;
+            break;
+
+        case KV_USHORT:
+            if (OPRT_OK != __kv_serial_int_get(tp, val, len, &value) || value < 0 || value > 65535) {
+                goto ERR_EXIT;
+            }
+            *((uint16_t *)db[i].val) = value;
+            break;
+
+        case KV_INT:
+            if (OPRT_OK != __kv_serial_int_get(tp, val, len, &value)) {
+                goto ERR_EXIT;
+            }
+            *((int *)db[i].val) = value;
+            break;
+
+        case KV_BOOL:
+            if (KV_BOOL != tp || 1 != len) {
+                goto ERR_EXIT;
+            }
+            *((BOOL_T *)db[i].val) = val[0] ? 1 : 0;
+            break;
+
+        case KV_STRING:
+            if ((KV_STRING != tp && KV_RAW != tp) || db[i].len < len + 1) {
+                goto ERR_EXIT;
+            }
+            memcpy(db[i].val, val, len);
+            ((char *)db[i].val)[len] = 0;
+            break;
+
+        case KV_RAW:
+            if ((KV_STRING != tp && KV_RAW != tp) || db[i].len < len) {
+                goto ERR_EXIT;
+            }
+            memcpy(db[i].val, val, len);
+            db[i].len = len;
+            break;
+
+        default:
+            PR_ERR("type invalid %d", db[i].tp);
+            goto ERR_EXIT;
+        }
+    }
+
+    return OPRT_OK;
+
+ERR_EXIT:
+    PR_ERR("deserial fails %s %d", db[i].key, op_ret);
+
+    return op_ret;
+}
+
+/**
+ * @brief Deserialize a record and populate a key-value database.
+ *
+ * This function parses a record written by kv_serialize, or a JSON record
+ * written by older versions, and populates a key-value database with the
+ * values extracted from it. The key-value database is represented by the
+ * `kv_db_t` structure array. The number of elements in the `kv_db_t` array is
+ * specified by the `dbcnt` parameter. Keys not in the record are set to zero.
+ * The length of a KV_RAW element is updated to the length of the stored data.
+ *
+ * @param[in] in The input record, a JSON record must be zero terminated.
+ * @param[in] in_len The length of the input record.
+ * @param[in,out] db The key-value database to populate.
+ * @param[in] dbcnt The number of elements in the key-value database.
+ * @param[out] legacy Set to TRUE if the record is in the JSON format, can be
+ * NULL.
+ * @return Returns OPRT_OK if the deserialization is successful. Otherwise, it
+ * returns an error code indicating the failure reason.
+ */
+int kv_deserialize(const uint8_t *in, const uint32_t in_len, kv_db_t *db, const uint32_t dbcnt, BOOL_T *legacy)
+{
+    if (legacy) {
+        *legacy = FALSE;
+    }
+
+    if (in_len >= KV_SERIAL_HEAD_LEN && KV_SERIAL_MAGIC == in[0]) {
+        return __kv_deserialize_bin(in, in_len, db, dbcnt);
+    }
+
+    if (legacy) {
+        *legacy = TRUE;
+    }
+    return __kv_deserialize_json((const char *)in, db, dbcnt);
+}
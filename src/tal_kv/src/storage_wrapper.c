@@ -27,17 +27,42 @@
 extern "C" {
 #endif
 
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 #include "tuya_cloud_types.h"
 #include "storage_interface.h"
 #include "tal_log.h"
 
 #define tuya_db_path "./tuyadb"
 
+/**
+ * @brief Creates the storage directory if it does not exist yet.
+ *
+ * @return Returns OPRT_OK if the directory exists or is created, or
+ * OPRT_COM_ERROR if it can not be created.
+ */
+int posix_storage_init(void)
+{
+    struct stat st;
+
+    if (0 == stat(tuya_db_path, &st)) {
+        return S_ISDIR(st.st_mode) ? OPRT_OK : OPRT_COM_ERROR;
+    }
+    if (0 != mkdir(tuya_db_path, 0755)) {
+        PR_ERR("mkdir %s error", tuya_db_path);
+        return OPRT_COM_ERROR;
+    }
+
+    return OPRT_OK;
+}
+
 /**
  * @brief Sets the value of a key in the storage.
  *
  * This function sets the value of a key in the storage by writing the provided
- * buffer to a file.
+ * buffer to a temporary file, which is renamed over the file of the key. A
+ * power loss leaves either the old or the new value.
  *
  * @param key The key to set.
  * @param buffer The buffer containing the value to set.
@@ -55,11 +80,13 @@ int posix_storage_set(const char *key, const uint8_t *buffer, size_t length)
     FILE *fptr = NULL;
 
     char name[128];
-    sprintf(name, "%s/%s", tuya_db_path, key);
+    char tmp_name[132];
+    snprintf(name, sizeof(name), "%s/%s", tuya_db_path, key);
+    snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", name);
 
     PR_DEBUG("key:%s", name);
 
-    fptr = fopen(name, "wb+");
+    fptr = fopen(tmp_name, "wb+");
     if (NULL == fptr) {
         PR_ERR("open file error");
         return OPRT_COM_ERROR;
@@ -68,9 +95,14 @@ int posix_storage_set(const char *key, const uint8_t *buffer, size_t length)
     }
 
     int file_len = fwrite(buffer, 1, length, fptr);
-    fclose(fptr);
-    if (file_len != length) {
+    if (0 != fclose(fptr) || file_len != length) {
         PR_ERR("uf_kv_write fail %d", file_len);
+        remove(tmp_name);
+        return OPRT_COM_ERROR;
+    }
+    if (0 != rename(tmp_name, name)) {
+        PR_ERR("rename %s error", tmp_name);
+        remove(tmp_name);
         return OPRT_COM_ERROR;
     }
     return OPRT_OK;
@@ -126,6 +158,34 @@ int posix_storage_get(const char *key, uint8_t *buffer, size_t *length)
     return OPRT_OK;
 }
 
+/**
+ * @brief Gets the length of the value stored for a key.
+ *
+ * @param key The key to look up.
+ * @param length The length of the stored value.
+ *
+ * @return Returns OPRT_OK if a value is stored, or OPRT_NOT_FOUND if not.
+ */
+int posix_storage_size(const char *key, size_t *length)
+{
+    struct stat st;
+
+    if (NULL == key || NULL == length) {
+        return OPRT_INVALID_PARM;
+    }
+
+    char name[128];
+    snprintf(name, sizeof(name), "%s/%s", tuya_db_path, key);
+
+    if (0 != stat(name, &st) || !S_ISREG(st.st_mode)) {
+        *length = 0;
+        return OPRT_NOT_FOUND;
+    }
+
+    *length = (size_t)st.st_size;
+    return OPRT_OK;
+}
+
 /**
  * @brief Deletes a file from the storage.
  *
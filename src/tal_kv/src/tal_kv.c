@@ -16,6 +16,9 @@
  * layer (HAL) for flash operations. This ensures compatibility and optimal
  * performance across different Tuya devices and platforms.
  *
+ * With ENABLE_KV_STORAGE_POSIX the encrypted values are files of the POSIX
+ * storage wrapper instead, for hosts with a file system of their own.
+ *
  * @note This file is part of the Tuya SDK and is intended for use in Tuya-based
  * applications. It requires the LittleFS library and Tuya's hardware
  * abstraction libraries for proper functionality.
@@ -25,20 +28,61 @@
  */
 
 #include "tal_kv.h"
+#if defined(ENABLE_KV_STORAGE_POSIX) && (ENABLE_KV_STORAGE_POSIX == 1)
+#include "storage_interface.h"
+#else
 #include "lfs_config.h"
 #include "tkl_flash.h"
+#endif
 #include "tal_api.h"
 #include "tal_security.h"
 
 // variables used by the filesystem
+#if !defined(ENABLE_KV_STORAGE_POSIX) || (ENABLE_KV_STORAGE_POSIX == 0)
 static lfs_t lfs;
 static lfs_size_t lfs_flash_addr;
+#endif
 static tal_kv_cfg_t lfs_kv_cfg;
 static MUTEX_HANDLE lfs_mutex;
 
-extern int kv_serialize(const kv_db_t *db, const uint32_t dbcnt, char **out, uint32_t *out_len);
-extern int kv_deserialize(const char *in, kv_db_t *db, const uint32_t dbcnt);
+// file of the batch being committed, not a valid key
+#define KV_JOURNAL_NAME ".kv_journal"
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+#ifndef KV_CACHE_SIZE
+#define KV_CACHE_SIZE 4096
+#endif
+#ifndef KV_CACHE_FLUSH_DELAY
+#define KV_CACHE_FLUSH_DELAY 3000
+#endif
+
+/**
+ * @brief decrypted value kept in RAM, dirty until it is written to flash
+ *
+ */
+typedef struct {
+    LIST_HEAD node; // most recently used first
+    uint8_t *value; // terminated by 0 like the value read from flash
+    size_t length;
+    bool dirty;
+    char key[0];
+} kv_cache_node_t;
+
+static LIST_HEAD(kv_cache_list);
+static size_t kv_cache_bytes;
+static DELAYED_WORK_HANDLE kv_flush_work;
+static bool kv_flush_pending;
+
+static bool __kv_flush_schedule(void);
+#endif
+
+static void __kv_journal_replay(void);
 
+extern int kv_serialize(const kv_db_t *db, const uint32_t dbcnt, uint8_t **out, uint32_t *out_len);
+extern int kv_deserialize(const uint8_t *in, const uint32_t in_len, kv_db_t *db, const uint32_t dbcnt,
+                          BOOL_T *legacy);
+
+#if !defined(ENABLE_KV_STORAGE_POSIX) || (ENABLE_KV_STORAGE_POSIX == 0)
 /**
  * Reads data from a user-provided block device.
  *
@@ -126,28 +170,80 @@ int user_provided_block_device_sync(const struct lfs_config *c)
     return LFS_ERR_OK;
 }
 
-/**
- * @brief Initializes the TAL Key-Value (KV) module.
- *
- * This function initializes the TAL KV module with the provided configuration.
- *
- * @param kv_cfg A pointer to the TAL KV configuration structure.
- * @return An integer value indicating the status of the initialization process.
- *         Returns 0 on success, and a negative value on failure.
- */
-int tal_kv_init(tal_kv_cfg_t *kv_cfg)
+/* caller holds lfs_mutex, store the encrypted value of the key */
+static int __kv_store_write(const char *key, const uint8_t *data, uint32_t len)
 {
-    uint8_t sha256_ret[32];
+    int result;
+    lfs_file_t file;
 
-    //! init flash key
-    memset(&lfs_kv_cfg, 0, sizeof(lfs_kv_cfg));
-    tal_sha256_ret((const uint8_t *)kv_cfg->seed, TAL_LV_KEY_LEN, sha256_ret, 0);
-    memcpy(lfs_kv_cfg.seed, sha256_ret, TAL_LV_KEY_LEN);
-    tal_sha256_ret((const uint8_t *)kv_cfg->key, TAL_LV_KEY_LEN, sha256_ret, 0);
-    memcpy(lfs_kv_cfg.key, sha256_ret, TAL_LV_KEY_LEN);
+    result = lfs_file_open(&lfs, &file, key, LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC);
+    if (LFS_ERR_OK != result) {
+        PR_ERR("lfs open %s err", key);
+        return result;
+    }
+    result = lfs_file_write(&lfs, &file, data, len);
+    lfs_file_close(&lfs, &file);
+    if (result != len) {
+        PR_ERR("kv write fail %d", result);
+        return OPRT_KVS_WR_FAIL;
+    }
 
-    tal_mutex_create_init(&lfs_mutex);
+    return OPRT_OK;
+}
 
+/* caller holds lfs_mutex, the encrypted value is freed by tal_free */
+static int __kv_store_read(const char *key, uint8_t **data, uint32_t *len)
+{
+    int result;
+    lfs_file_t file;
+
+    result = lfs_file_open(&lfs, &file, key, LFS_O_RDONLY);
+    if (LFS_ERR_OK != result) {
+        PR_ERR("lfs open %s %d err", key, result);
+        return result;
+    }
+    uint32_t file_len = lfs_file_size(&lfs, &file);
+    uint8_t *buf = tal_malloc(file_len + 1);
+    if (NULL == buf) {
+        lfs_file_close(&lfs, &file);
+        return OPRT_MALLOC_FAILED;
+    }
+    result = lfs_file_read(&lfs, &file, buf, file_len);
+    lfs_file_close(&lfs, &file);
+    if (result <= 0) {
+        tal_free(buf);
+        PR_ERR("kv read error %d", result);
+        return OPRT_KVS_RD_FAIL;
+    }
+    *data = buf;
+    *len = file_len;
+
+    return OPRT_OK;
+}
+
+/* caller holds lfs_mutex, OPRT_NOT_FOUND if the key has no value stored */
+static int __kv_store_remove(const char *key)
+{
+    int result = lfs_remove(&lfs, key);
+
+    if (LFS_ERR_OK == result) {
+        return OPRT_OK;
+    }
+
+    return (LFS_ERR_NOENT == result) ? OPRT_NOT_FOUND : OPRT_COM_ERROR;
+}
+
+/* caller holds lfs_mutex */
+static bool __kv_store_exist(const char *key)
+{
+    struct lfs_info info;
+
+    return LFS_ERR_OK == lfs_stat(&lfs, key, &info);
+}
+
+/* mount the filesystem on the UF partition */
+static int __kv_store_init(void)
+{
     TUYA_FLASH_BASE_INFO_T info;
     tkl_flash_get_one_type_info(TUYA_FLASH_TYPE_UF, &info);
     lfs_flash_addr = info.partition[0].start_addr;
@@ -180,13 +276,304 @@ int tal_kv_init(tal_kv_cfg_t *kv_cfg)
 
     return err;
 }
+#else
+/* caller holds lfs_mutex, store the encrypted value of the key */
+static int __kv_store_write(const char *key, const uint8_t *data, uint32_t len)
+{
+    return local_storage_set(key, data, len);
+}
+
+/* caller holds lfs_mutex, the encrypted value is freed by tal_free */
+static int __kv_store_read(const char *key, uint8_t **data, uint32_t *len)
+{
+    size_t file_len = 0;
+    int result = local_storage_size(key, &file_len);
+
+    if (OPRT_OK != result || 0 == file_len) {
+        PR_ERR("kv %s not stored %d", key, result);
+        return OPRT_KVS_RD_FAIL;
+    }
+    uint8_t *buf = tal_malloc(file_len + 1);
+    if (NULL == buf) {
+        return OPRT_MALLOC_FAILED;
+    }
+    result = local_storage_get(key, buf, &file_len);
+    if (OPRT_OK != result) {
+        tal_free(buf);
+        PR_ERR("kv read error %d", result);
+        return OPRT_KVS_RD_FAIL;
+    }
+    *data = buf;
+    *len = (uint32_t)file_len;
+
+    return OPRT_OK;
+}
+
+/* caller holds lfs_mutex, OPRT_NOT_FOUND if the key has no value stored */
+static int __kv_store_remove(const char *key)
+{
+    size_t file_len = 0;
+
+    if (OPRT_OK != local_storage_size(key, &file_len)) {
+        return OPRT_NOT_FOUND;
+    }
+
+    return local_storage_del(key);
+}
+
+/* caller holds lfs_mutex */
+static bool __kv_store_exist(const char *key)
+{
+    size_t file_len = 0;
+
+    return OPRT_OK == local_storage_size(key, &file_len);
+}
+
+static int __kv_store_init(void)
+{
+    return local_storage_init();
+}
+#endif
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+/* the values not flushed yet would be lost by the reset */
+static int __kv_reset_cb(void *data)
+{
+    return tal_kv_flush();
+}
+#endif
+
+/**
+ * @brief Initializes the TAL Key-Value (KV) module.
+ *
+ * This function initializes the TAL KV module with the provided configuration.
+ *
+ * @param kv_cfg A pointer to the TAL KV configuration structure.
+ * @return An integer value indicating the status of the initialization process.
+ *         Returns 0 on success, and a negative value on failure.
+ */
+int tal_kv_init(tal_kv_cfg_t *kv_cfg)
+{
+    uint8_t sha256_ret[32];
+
+    //! init flash key
+    memset(&lfs_kv_cfg, 0, sizeof(lfs_kv_cfg));
+    tal_sha256_ret((const uint8_t *)kv_cfg->seed, TAL_LV_KEY_LEN, sha256_ret, 0);
+    memcpy(lfs_kv_cfg.seed, sha256_ret, TAL_LV_KEY_LEN);
+    tal_sha256_ret((const uint8_t *)kv_cfg->key, TAL_LV_KEY_LEN, sha256_ret, 0);
+    memcpy(lfs_kv_cfg.key, sha256_ret, TAL_LV_KEY_LEN);
+
+    tal_mutex_create_init(&lfs_mutex);
+
+    int err = __kv_store_init();
+    if (OPRT_OK == err) {
+        tal_mutex_lock(lfs_mutex);
+        __kv_journal_replay();
+        tal_mutex_unlock(lfs_mutex);
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+        tal_event_subscribe(EVENT_SYSTEM_RESET, "tal.kv", __kv_reset_cb, SUBSCRIBE_TYPE_EMERGENCY);
+#endif
+    }
+
+    return err;
+}
+
+/* caller holds lfs_mutex */
+static int __kv_file_write(const char *key, const uint8_t *value, size_t length)
+{
+    int result;
+    uint8_t *ec_data = NULL;
+    uint32_t ec_len = 0;
+    uint8_t iv[16];
+
+    memcpy(iv, lfs_kv_cfg.seed, 16);
+    result =
+        tal_aes128_cbc_encode((uint8_t *)value, length, (uint8_t *)lfs_kv_cfg.key, iv, &ec_data, (uint32_t *)&ec_len);
+    if (OPRT_OK != result) {
+        PR_DEBUG("key %s encrypt failed", key);
+        return result;
+    }
+    result = __kv_store_write(key, ec_data, ec_len);
+    tal_aes_free_data(ec_data);
+
+    return result;
+}
+
+/* caller holds lfs_mutex, the value is terminated by 0 and freed by tal_free */
+static int __kv_file_read(const char *key, uint8_t **value, size_t *length)
+{
+    int result;
+    uint8_t *ec_data = NULL;
+    uint32_t ec_len = 0;
+
+    result = __kv_store_read(key, &ec_data, &ec_len);
+    if (OPRT_OK != result) {
+        *length = 0;
+        return result;
+    }
+    PR_DEBUG("key:%s, len:%d", key, ec_len);
+    uint8_t *dec_data = NULL;
+    uint32_t dec_len = 0;
+    uint8_t iv[16];
+
+    memcpy(iv, lfs_kv_cfg.seed, 16);
+    result = tal_aes128_cbc_decode(ec_data, ec_len, (uint8_t *)lfs_kv_cfg.key, iv, &dec_data, (uint32_t *)&dec_len);
+    dec_len = tal_aes_get_actual_length(dec_data, dec_len);
+    tal_free(ec_data);
+    if (OPRT_OK != result || dec_len > ec_len) {
+        PR_ERR("key %s decrypt failed %d, %d-%d", key, result, dec_len, ec_len);
+        return OPRT_BUFFER_NOT_ENOUGH;
+    }
+    *value = dec_data;
+    *length = (size_t)dec_len;
+    dec_data[dec_len] = 0;
+
+    return OPRT_OK;
+}
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+static kv_cache_node_t *__kv_cache_find(const char *key)
+{
+    P_LIST_HEAD pos = NULL;
+
+    tuya_list_for_each(pos, &kv_cache_list)
+    {
+        kv_cache_node_t *node = tuya_list_entry(pos, kv_cache_node_t, node);
+        if (0 == strcmp(node->key, key)) {
+            // most recently used first
+            tuya_list_del(&node->node);
+            tuya_list_add(&node->node, &kv_cache_list);
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+static void __kv_cache_remove(kv_cache_node_t *node)
+{
+    tuya_list_del(&node->node);
+    kv_cache_bytes -= node->length;
+    tal_free(node->value);
+    tal_free(node);
+}
+
+/* evict the least recently used clean values until the cache fits, dirty values wait for the flush */
+static void __kv_cache_trim(void)
+{
+    P_LIST_HEAD pos = kv_cache_list.prev;
+
+    while (kv_cache_bytes > KV_CACHE_SIZE && pos != &kv_cache_list) {
+        kv_cache_node_t *node = tuya_list_entry(pos, kv_cache_node_t, node);
+        pos = pos->prev;
+        if (!node->dirty) {
+            __kv_cache_remove(node);
+        }
+    }
+}
+
+/* store a copy of the value, the old value of the key is replaced */
+static int __kv_cache_put(const char *key, const uint8_t *value, size_t length, bool dirty)
+{
+    kv_cache_node_t *node = __kv_cache_find(key);
+    uint8_t *copy = tal_malloc(length + 1);
+
+    if (NULL == copy) {
+        return OPRT_MALLOC_FAILED;
+    }
+    memcpy(copy, value, length);
+    copy[length] = 0;
+
+    if (NULL == node) {
+        node = tal_malloc(sizeof(kv_cache_node_t) + strlen(key) + 1);
+        if (NULL == node) {
+            tal_free(copy);
+            return OPRT_MALLOC_FAILED;
+        }
+        memset(node, 0, sizeof(kv_cache_node_t));
+        strcpy(node->key, key);
+        tuya_list_add(&node->node, &kv_cache_list);
+    } else {
+        kv_cache_bytes -= node->length;
+        tal_free(node->value);
+    }
+    node->value = copy;
+    node->length = length;
+    node->dirty = dirty || node->dirty;
+    kv_cache_bytes += length;
+
+    __kv_cache_trim();
+
+    return OPRT_OK;
+}
+
+/* caller holds lfs_mutex */
+static int __kv_cache_flush(void)
+{
+    int ret = OPRT_OK, result;
+    P_LIST_HEAD pos = NULL;
+
+    tuya_list_for_each(pos, &kv_cache_list)
+    {
+        kv_cache_node_t *node = tuya_list_entry(pos, kv_cache_node_t, node);
+        if (!node->dirty) {
+            continue;
+        }
+        result = __kv_file_write(node->key, node->value, node->length);
+        if (OPRT_OK == result) {
+            node->dirty = false;
+        } else if (OPRT_OK == ret) {
+            ret = result;
+        }
+    }
+    __kv_cache_trim();
+
+    return ret;
+}
+
+static void __kv_flush_work_cb(void *data)
+{
+    int ret;
+
+    tal_mutex_lock(lfs_mutex);
+    kv_flush_pending = false;
+    ret = __kv_cache_flush();
+    tal_mutex_unlock(lfs_mutex);
+
+    if (OPRT_OK != ret) {
+        PR_ERR("kv flush fail %d, retry later", ret);
+        tal_mutex_lock(lfs_mutex);
+        __kv_flush_schedule();
+        tal_mutex_unlock(lfs_mutex);
+    }
+}
+
+/* caller holds lfs_mutex, returns false if the flush can not be deferred */
+static bool __kv_flush_schedule(void)
+{
+    if (kv_flush_pending) {
+        return true;
+    }
+    if (NULL == kv_flush_work &&
+        OPRT_OK != tal_workq_init_delayed(WORKQ_SYSTEM, __kv_flush_work_cb, NULL, &kv_flush_work)) {
+        return false;
+    }
+    if (OPRT_OK != tal_workq_start_delayed(kv_flush_work, KV_CACHE_FLUSH_DELAY, LOOP_ONCE)) {
+        return false;
+    }
+    kv_flush_pending = true;
+
+    return true;
+}
+#endif
 
 /**
  * @brief Sets a key-value pair in the key-value store.
  *
  * This function sets a key-value pair in the key-value store. The key is a
  * string, the value is a byte array, and the length specifies the number of
- * bytes in the value.
+ * bytes in the value. With ENABLE_KV_CACHE the value is kept in RAM and written
+ * to flash later, repeated sets of the same key are written once.
  *
  * @param key The key to set in the key-value store.
  * @param value The value to associate with the key.
@@ -197,7 +584,6 @@ int tal_kv_init(tal_kv_cfg_t *kv_cfg)
 int tal_kv_set(const char *key, const uint8_t *value, size_t length)
 {
     int result;
-    lfs_file_t file;
 
     PR_DEBUG("key:%s, len %d", key, length);
 
@@ -206,36 +592,26 @@ int tal_kv_set(const char *key, const uint8_t *value, size_t length)
     }
 
     tal_mutex_lock(lfs_mutex);
-    result = lfs_file_open(&lfs, &file, key, LFS_O_RDWR | LFS_O_CREAT | LFS_O_TRUNC);
-    if (LFS_ERR_OK != result) {
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    // big values are written through, they would evict all the others
+    if (length <= KV_CACHE_SIZE / 4 && OPRT_OK == __kv_cache_put(key, value, length, true)) {
+        if (__kv_flush_schedule()) {
+            tal_mutex_unlock(lfs_mutex);
+            return OPRT_OK;
+        }
+        result = __kv_cache_flush();
         tal_mutex_unlock(lfs_mutex);
-        PR_ERR("lfs open %s err", key);
         return result;
     }
-    uint8_t *ec_data = NULL;
-    uint32_t ec_len = 0;
-    uint8_t iv[16];
-
-    memcpy(iv, lfs_kv_cfg.seed, 16);
-    result =
-        tal_aes128_cbc_encode((uint8_t *)value, length, (uint8_t *)lfs_kv_cfg.key, iv, &ec_data, (uint32_t *)&ec_len);
-    if (OPRT_OK != result) {
-        lfs_file_close(&lfs, &file);
-        tal_mutex_unlock(lfs_mutex);
-        PR_DEBUG("key %s encrypt failed", key);
-        return result;
+    kv_cache_node_t *node = __kv_cache_find(key);
+    if (node) {
+        __kv_cache_remove(node);
     }
-    lfs_file_rewind(&lfs, &file);
-    result = lfs_file_write(&lfs, &file, ec_data, ec_len);
-    lfs_file_close(&lfs, &file);
-    tal_aes_free_data(ec_data);
+#endif
+    result = __kv_file_write(key, value, length);
     tal_mutex_unlock(lfs_mutex);
-    if (result != ec_len) {
-        PR_ERR("kv write fail %d", result);
-        return OPRT_KVS_WR_FAIL;
-    }
 
-    return OPRT_OK;
+    return result;
 }
 
 /**
@@ -257,55 +633,36 @@ int tal_kv_set(const char *key, const uint8_t *value, size_t length)
 int tal_kv_get(const char *key, uint8_t **value, size_t *length)
 {
     int result;
-    lfs_file_t file;
 
     if (NULL == key || NULL == value || NULL == length) {
         return OPRT_INVALID_PARM;
     }
 
     tal_mutex_lock(lfs_mutex);
-    result = lfs_file_open(&lfs, &file, key, LFS_O_RDONLY);
-    if (LFS_ERR_OK != result) {
-        PR_ERR("lfs open %s %d err", key, result);
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    kv_cache_node_t *node = __kv_cache_find(key);
+    if (node) {
+        uint8_t *copy = tal_malloc(node->length + 1);
+        if (NULL == copy) {
+            tal_mutex_unlock(lfs_mutex);
+            return OPRT_MALLOC_FAILED;
+        }
+        memcpy(copy, node->value, node->length + 1);
+        *value = copy;
+        *length = node->length;
         tal_mutex_unlock(lfs_mutex);
-        return result;
+        return OPRT_OK;
     }
-    uint8_t *ec_data = NULL;
-    uint32_t ec_len = lfs_file_size(&lfs, &file);
-
-    ec_data = tal_malloc(ec_len + 1);
-    if (NULL == ec_data) {
-        result = OPRT_MALLOC_FAILED;
-        tal_mutex_unlock(lfs_mutex);
-        return result;
+#endif
+    result = __kv_file_read(key, value, length);
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    if (OPRT_OK == result && *length <= KV_CACHE_SIZE / 4) {
+        __kv_cache_put(key, *value, *length, false);
     }
-    PR_DEBUG("key:%s, len:%d", key, ec_len);
-    result = lfs_file_read(&lfs, &file, ec_data, ec_len);
-    lfs_file_close(&lfs, &file);
+#endif
     tal_mutex_unlock(lfs_mutex);
-    if (result <= 0) {
-        *length = 0;
-        tal_free(ec_data);
-        PR_ERR("kv read error %d", result);
-        return OPRT_KVS_RD_FAIL;
-    }
-    uint8_t *dec_data = NULL;
-    uint32_t dec_len = 0;
-    uint8_t iv[16];
 
-    memcpy(iv, lfs_kv_cfg.seed, 16);
-    result = tal_aes128_cbc_decode(ec_data, ec_len, (uint8_t *)lfs_kv_cfg.key, iv, &dec_data, (uint32_t *)&dec_len);
-    dec_len = tal_aes_get_actual_length(dec_data, dec_len);
-    tal_free(ec_data);
-    if (OPRT_OK != result || dec_len > ec_len) {
-        PR_ERR("key %s decrypt failed %d, %d-%d", key, result, dec_len, ec_len);
-        return OPRT_BUFFER_NOT_ENOUGH;
-    }
-    *value = dec_data;
-    *length = (size_t)dec_len;
-    dec_data[dec_len] = 0;
-
-    return OPRT_OK;
+    return result;
 }
 
 /**
@@ -319,12 +676,22 @@ int tal_kv_get(const char *key, uint8_t **value, size_t *length)
  */
 int tal_kv_del(const char *key)
 {
+    bool cached = false;
+
     PR_DEBUG("key:%s", key);
 
     tal_mutex_lock(lfs_mutex);
-    int result = lfs_remove(&lfs, key);
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    kv_cache_node_t *node = __kv_cache_find(key);
+    if (node) {
+        // a value not flushed yet may have no file
+        cached = node->dirty;
+        __kv_cache_remove(node);
+    }
+#endif
+    int result = __kv_store_remove(key);
     tal_mutex_unlock(lfs_mutex);
-    if (LFS_ERR_OK == result) {
+    if (OPRT_OK == result || (cached && OPRT_NOT_FOUND == result)) {
         PR_DEBUG("Deleted successfully");
         return OPRT_OK;
     }
@@ -334,6 +701,162 @@ int tal_kv_del(const char *key)
     return OPRT_COM_ERROR;
 }
 
+/**
+ * @brief Writes the values kept by the cache to flash.
+ *
+ * The values are flushed in a delayed work after they are set and when
+ * tal_system_reset is called, call this function before the power is cut.
+ *
+ * @return OPRT_OK on success, or the error code of the first failed write.
+ */
+int tal_kv_flush(void)
+{
+    int result = OPRT_OK;
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+    tal_mutex_lock(lfs_mutex);
+    result = __kv_cache_flush();
+    tal_mutex_unlock(lfs_mutex);
+#endif
+
+    return result;
+}
+
+/* record of the batch journal: key_len(1) key value_len(4, LE) value */
+static uint32_t __kv_journal_pack(const tal_kv_item_t *items, size_t cnt, uint8_t *buf)
+{
+    uint32_t offset = 0;
+    size_t i;
+
+    for (i = 0; i < cnt; i++) {
+        uint8_t key_len = (uint8_t)strlen(items[i].key);
+        uint32_t value_len = (uint32_t)items[i].length;
+        if (buf) {
+            buf[offset] = key_len;
+            memcpy(buf + offset + 1, items[i].key, key_len);
+            buf[offset + 1 + key_len] = value_len & 0xFF;
+            buf[offset + 2 + key_len] = (value_len >> 8) & 0xFF;
+            buf[offset + 3 + key_len] = (value_len >> 16) & 0xFF;
+            buf[offset + 4 + key_len] = (value_len >> 24) & 0xFF;
+            memcpy(buf + offset + 5 + key_len, items[i].value, value_len);
+        }
+        offset += 5 + key_len + value_len;
+    }
+
+    return offset;
+}
+
+/* caller holds lfs_mutex, write every record of the journal to its key */
+static int __kv_journal_apply(const uint8_t *buf, uint32_t len)
+{
+    char key[256];
+    uint32_t offset = 0;
+    int result;
+
+    while (offset < len) {
+        uint8_t key_len = buf[offset];
+        if (offset + 5 + key_len > len) {
+            return OPRT_COM_ERROR;
+        }
+        memcpy(key, buf + offset + 1, key_len);
+        key[key_len] = '\0';
+        uint32_t value_len = buf[offset + 1 + key_len] | (buf[offset + 2 + key_len] << 8) |
+                             (buf[offset + 3 + key_len] << 16) | ((uint32_t)buf[offset + 4 + key_len] << 24);
+        offset += 5 + key_len;
+        if (value_len > len - offset) {
+            return OPRT_COM_ERROR;
+        }
+        result = __kv_file_write(key, buf + offset, value_len);
+        if (OPRT_OK != result) {
+            return result;
+        }
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+        kv_cache_node_t *node = __kv_cache_find(key);
+        if (node) {
+            __kv_cache_remove(node);
+        }
+#endif
+        offset += value_len;
+    }
+
+    return OPRT_OK;
+}
+
+/* caller holds lfs_mutex, finish the batch interrupted by power loss */
+static void __kv_journal_replay(void)
+{
+    uint8_t *buf = NULL;
+    size_t len = 0;
+
+    if (!__kv_store_exist(KV_JOURNAL_NAME)) {
+        return;
+    }
+
+    PR_NOTICE("replay kv batch journal");
+    if (OPRT_OK == __kv_file_read(KV_JOURNAL_NAME, &buf, &len)) {
+        if (OPRT_OK != __kv_journal_apply(buf, len)) {
+            PR_ERR("kv journal apply fail");
+        }
+        tal_free(buf);
+    }
+    __kv_store_remove(KV_JOURNAL_NAME);
+}
+
+/**
+ * @brief Sets several key-value pairs as one transaction.
+ *
+ * The pairs are written to a journal file first, the journal is committed by
+ * littlefs, or by the rename of the POSIX storage, atomically, then every key is written and the journal is removed.
+ * A batch interrupted by power loss is finished by tal_kv_init, so after a
+ * reboot either all the keys or none of them have the new value. A batch that
+ * fails with an error is not finished later, some of the keys may have been
+ * written already, as with tal_kv_set called for each pair.
+ *
+ * @param items The key-value pairs, the key length must be less than 256.
+ * @param cnt The number of pairs.
+ * @return OPRT_OK on success, or an error code.
+ */
+int tal_kv_set_batch(const tal_kv_item_t *items, size_t cnt)
+{
+    uint8_t *buf = NULL;
+    uint32_t len = 0;
+    size_t i;
+    int result;
+
+    if (NULL == items || 0 == cnt) {
+        return OPRT_INVALID_PARM;
+    }
+    for (i = 0; i < cnt; i++) {
+        if (NULL == items[i].key || NULL == items[i].value || 0 == items[i].length || strlen(items[i].key) > 255) {
+            return OPRT_INVALID_PARM;
+        }
+    }
+
+    len = __kv_journal_pack(items, cnt, NULL);
+    buf = tal_malloc(len);
+    if (NULL == buf) {
+        return OPRT_MALLOC_FAILED;
+    }
+    __kv_journal_pack(items, cnt, buf);
+
+    tal_mutex_lock(lfs_mutex);
+    result = __kv_file_write(KV_JOURNAL_NAME, buf, len);
+    if (OPRT_OK == result) {
+        // once the journal is on flash the batch is committed
+        result = __kv_journal_apply(buf, len);
+    }
+    // a journal left by a failed batch would be replayed over the later sets
+    __kv_store_remove(KV_JOURNAL_NAME);
+    tal_mutex_unlock(lfs_mutex);
+    tal_free(buf);
+
+    if (OPRT_OK != result) {
+        PR_ERR("kv batch set fail %d", result);
+    }
+
+    return result;
+}
+
 /**
  * @brief Frees the memory allocated for a value in the TAL Key-Value store.
  *
@@ -380,7 +903,9 @@ void tal_kv_cmd(int argc, char *argv[])
         }
     } else if (0 == strcmp("del", argv[1])) {
         tal_kv_del(argv[2]);
-    } else if (0 == strcmp("list", argv[1])) {
+    }
+#if !defined(ENABLE_KV_STORAGE_POSIX) || (ENABLE_KV_STORAGE_POSIX == 0)
+    else if (0 == strcmp("list", argv[1])) {
         lfs_dir_t dir;
         lfs_dir_open(&lfs, &dir, argv[2]);
         struct lfs_info info;
@@ -390,6 +915,7 @@ void tal_kv_cmd(int argc, char *argv[])
         PR_DEBUG_RAW("\r\n", info.name);
         lfs_dir_close(&lfs, &dir);
     }
+#endif
 }
 
 /**
@@ -410,7 +936,7 @@ int tal_kv_serialize_set(const char *key, kv_db_t *db, size_t dbcnt)
         return OPRT_INVALID_PARM;
     }
 
-    char *buf = NULL;
+    uint8_t *buf = NULL;
     uint32_t len = 0;
     int ret = OPRT_OK;
 
@@ -419,8 +945,8 @@ int tal_kv_serialize_set(const char *key, kv_db_t *db, size_t dbcnt)
         PR_ERR("kv_serialize  fail. %d", ret);
         return ret;
     }
-    PR_TRACE("write buf:%s", buf);
-    ret = tal_kv_set(key, (const uint8_t *)buf, len);
+    PR_TRACE("write %s len:%d", key, len);
+    ret = tal_kv_set(key, buf, len);
     tal_free(buf);
     if (OPRT_OK != ret) {
         PR_ERR("kv_set fails %s %d", key, ret);
@@ -435,7 +961,8 @@ int tal_kv_serialize_set(const char *key, kv_db_t *db, size_t dbcnt)
  *
  * This function serializes the value associated with the specified key and
  * retrieves it from the key-value database. The serialized value is then
- * deserialized and stored in the provided `db` array.
+ * deserialized and stored in the provided `db` array. A record still in the
+ * legacy JSON format is written back in the binary format.
  *
  * @param key The key for which to retrieve the value.
  * @param db Pointer to the array where the deserialized value will be stored.
@@ -451,6 +978,7 @@ int tal_kv_serialize_get(const char *key, kv_db_t *db, size_t dbcnt)
 
     uint8_t *buf = NULL;
     size_t len = 0;
+    BOOL_T legacy = FALSE;
     int ret = OPRT_OK;
 
     ret = tal_kv_get(key, &buf, &len);
@@ -458,15 +986,22 @@ int tal_kv_serialize_get(const char *key, kv_db_t *db, size_t dbcnt)
         PR_ERR("kv_get fails %s %d", key, ret);
         return ret;
     }
-    ret = kv_deserialize((char *)buf, db, dbcnt);
+    ret = kv_deserialize(buf, len, db, dbcnt, &legacy);
     tal_free(buf);
     if (OPRT_OK != ret) {
         PR_ERR("kv_deserialize fail. %d", ret);
+        return ret;
+    }
+
+    if (legacy) {
+        PR_DEBUG("migrate %s to binary", key);
+        tal_kv_serialize_set(key, db, dbcnt);
     }
 
     return ret;
 }
 
+#if !defined(ENABLE_KV_STORAGE_POSIX) || (ENABLE_KV_STORAGE_POSIX == 0)
 /**
  * @brief Get the LFS handle, can be used for file system opeation
  *
@@ -475,4 +1010,5 @@ int tal_kv_serialize_get(const char *key, kv_db_t *db, size_t dbcnt)
 lfs_t *tal_lfs_get()
 {
     return &lfs;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,214 @@
+/**
+ * @file test_kv_serialize.cpp
+ * @brief UT and benchmark of the binary kv record of kv_serialize.
+ *
+ * Every type is written and read back, a JSON record as written by older
+ * versions must still be read, and every truncation and byte flip of a record
+ * must be rejected or read without going past the record. The size of a
+ * sample record and the cost of reading it are printed for both formats.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tal_kv.h"
+
+extern int kv_serialize(const kv_db_t *db, const uint32_t dbcnt, uint8_t **out, uint32_t *out_len);
+extern int kv_deserialize(const uint8_t *in, const uint32_t in_len, kv_db_t *db, const uint32_t dbcnt,
+                          BOOL_T *legacy);
+}
+
+#define KV_BENCH_LOOP 20000
+
+/* the fields of the sample record, like the activation info of a device */
+struct kv_sample_t {
+    char c;
+    uint8_t b;
+    int16_t s;
+    uint16_t us;
+    int32_t i;
+    BOOL_T on;
+    char str[32];
+    uint8_t raw[24];
+    kv_db_t db[8];
+
+    kv_sample_t()
+    {
+        memset(this, 0, sizeof(*this));
+        db[0] = {(char *)"c", KV_CHAR, &c, sizeof(c)};
+        db[1] = {(char *)"b", KV_BYTE, &b, sizeof(b)};
+        db[2] = {(char *)"s", KV_SHORT, &s, sizeof(s)};
+        db[3] = {(char *)"us", KV_USHORT, &us, sizeof(us)};
+        db[4] = {(char *)"i", KV_INT, &i, sizeof(i)};
+        db[5] = {(char *)"on", KV_BOOL, &on, sizeof(on)};
+        db[6] = {(char *)"swv", KV_STRING, str, sizeof(str)};
+        db[7] = {(char *)"key", KV_RAW, raw, sizeof(raw)};
+    }
+
+    void fill()
+    {
+        c = -128;
+        b = 255;
+        s = -32768;
+        us = 65535;
+        i = INT32_MIN;
+        on = TRUE;
+        strcpy(str, "4.1.16");
+        for (int n = 0; n < (int)sizeof(raw); n++) {
+            raw[n] = (uint8_t)(n * 37 + 1);
+        }
+    }
+
+    bool same(const kv_sample_t &o) const
+    {
+        return c == o.c && b == o.b && s == o.s && us == o.us && i == o.i && on == o.on && !strcmp(str, o.str) &&
+               db[7].len == o.db[7].len && !memcmp(raw, o.raw, db[7].len);
+    }
+};
+
+/* the JSON record the versions before the binary format wrote */
+static const char *s_legacy = "{\"c\":-128,\"b\":255,\"s\":-32768,\"us\":65535,\"i\":-2147483648,\"on\":true,"
+                              "\"swv\":\"4.1.16\",\"key\":\"ASZLcJW63wQpTnOYveIHLFF2m8DlCi9U\"}";
+
+static std::vector<uint8_t> serialize(const kv_sample_t &sample)
+{
+    uint8_t *out = NULL;
+    uint32_t out_len = 0;
+
+    EXPECT_EQ(OPRT_OK, kv_serialize(sample.db, 8, &out, &out_len));
+    std::vector<uint8_t> record(out, out + out_len);
+    tal_free(out);
+    return record;
+}
+
+class KvSerializeTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+    }
+};
+
+TEST_F(KvSerializeTest, RoundTripEveryType)
+{
+    kv_sample_t in, out;
+    BOOL_T legacy = TRUE;
+
+    in.fill();
+    std::vector<uint8_t> record = serialize(in);
+    ASSERT_EQ(OPRT_OK, kv_deserialize(record.data(), record.size(), out.db, 8, &legacy));
+    EXPECT_FALSE(legacy);
+    EXPECT_TRUE(in.same(out));
+
+    /* an empty string and an empty raw, and a key missing from the record */
+    kv_sample_t empty, back;
+    empty.db[7].len = 0;
+    record = serialize(empty);
+    back.fill();
+    kv_db_t extra[9];
+    memcpy(extra, back.db, sizeof(back.db));
+    int32_t missing = 7;
+    extra[8] = {(char *)"missing", KV_INT, &missing, sizeof(missing)};
+    ASSERT_EQ(OPRT_OK, kv_deserialize(record.data(), record.size(), extra, 9, NULL));
+    EXPECT_STREQ("", back.str);
+    EXPECT_EQ(0, extra[7].len);
+    EXPECT_EQ(0, missing);
+}
+
+TEST_F(KvSerializeTest, ReadsLegacyJsonRecord)
+{
+    kv_sample_t expect, out;
+    BOOL_T legacy = FALSE;
+
+    expect.fill();
+    ASSERT_EQ(OPRT_OK, kv_deserialize((const uint8_t *)s_legacy, strlen(s_legacy), out.db, 8, &legacy));
+    EXPECT_TRUE(legacy);
+    EXPECT_TRUE(expect.same(out));
+}
+
+TEST_F(KvSerializeTest, RejectsWhatDoesNotFit)
+{
+    kv_sample_t in, out;
+
+    /* an integer read into a narrower type has to fit */
+    in.fill();
+    std::vector<uint8_t> record = serialize(in);
+    kv_db_t narrow = {(char *)"i", KV_SHORT, &out.s, sizeof(out.s)};
+    EXPECT_NE(OPRT_OK, kv_deserialize(record.data(), record.size(), &narrow, 1, NULL));
+
+    /* a string longer than the buffer */
+    char small[4];
+    kv_db_t str = {(char *)"swv", KV_STRING, small, sizeof(small)};
+    EXPECT_NE(OPRT_OK, kv_deserialize(record.data(), record.size(), &str, 1, NULL));
+
+    /* the longest value the 16 bit length field holds */
+    std::vector<uint8_t> big(0xFFFF, 0xA5), back(0xFFFF);
+    kv_db_t raw = {(char *)"big", KV_RAW, big.data(), 0xFFFF};
+    kv_db_t raw_back = {(char *)"big", KV_RAW, back.data(), 0xFFFF};
+    uint8_t *buf = NULL;
+    uint32_t len = 0;
+    ASSERT_EQ(OPRT_OK, kv_serialize(&raw, 1, &buf, &len));
+    EXPECT_EQ(OPRT_OK, kv_deserialize(buf, len, &raw_back, 1, NULL));
+    EXPECT_EQ(big, back);
+    tal_free(buf);
+}
+
+TEST_F(KvSerializeTest, BrokenRecordsStayInBounds)
+{
+    kv_sample_t in;
+
+    in.fill();
+    std::vector<uint8_t> record = serialize(in);
+
+    /* every truncation, each copied to a buffer of its own length */
+    for (size_t len = 2; len < record.size(); len++) {
+        kv_sample_t out;
+        std::vector<uint8_t> cut(record.begin(), record.begin() + len);
+        kv_deserialize(cut.data(), cut.size(), out.db, 8, NULL);
+    }
+
+    /* every byte flipped to every value */
+    for (size_t pos = 1; pos < record.size(); pos++) {
+        for (int v = 0; v < 256; v++) {
+            kv_sample_t out;
+            std::vector<uint8_t> bad(record);
+            bad[pos] = (uint8_t)v;
+            kv_deserialize(bad.data(), bad.size(), out.db, 8, NULL);
+        }
+    }
+}
+
+TEST_F(KvSerializeTest, SizeAndReadBenchmark)
+{
+    kv_sample_t in, out;
+    volatile int sink = 0;
+
+    in.fill();
+    std::vector<uint8_t> record = serialize(in);
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int n = 0; n < KV_BENCH_LOOP; n++) {
+        sink += kv_deserialize(record.data(), record.size(), out.db, 8, NULL);
+    }
+    double bin_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+
+    begin = std::chrono::steady_clock::now();
+    for (int n = 0; n < KV_BENCH_LOOP; n++) {
+        sink += kv_deserialize((const uint8_t *)s_legacy, strlen(s_legacy), out.db, 8, NULL);
+    }
+    double json_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+
+    printf("8 fields: binary %zu bytes %.0f ns, json %zu bytes %.0f ns per read\n", record.size(),
+           bin_ns / KV_BENCH_LOOP, strlen(s_legacy), json_ns / KV_BENCH_LOOP);
+    EXPECT_LT(record.size(), strlen(s_legacy));
+    EXPECT_LT(bin_ns, json_ns);
+}
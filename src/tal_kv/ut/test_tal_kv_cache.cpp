@@ -0,0 +1,174 @@
+/**
+ * @file test_tal_kv_cache.cpp
+ * @brief UT of the tal_kv write-back cache and batch set.
+ *
+ * The flash is replaced by a small RAM partition that counts the bytes read and
+ * programmed, which are reported as the cost of the kv operations.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tal_kv.h"
+#include "tkl_flash.h"
+}
+
+#define FAKE_FLASH_BLOCK 4096
+#define FAKE_FLASH_SIZE  (10 * FAKE_FLASH_BLOCK)
+#define KV_BIG_VALUE     (5 * FAKE_FLASH_BLOCK) // the journal and the key do not fit together
+
+static std::vector<uint8_t> s_flash(FAKE_FLASH_SIZE, 0xFF);
+static uint32_t s_read_bytes;
+static uint32_t s_prog_bytes;
+
+extern "C" {
+OPERATE_RET tkl_flash_read(uint32_t addr, uint8_t *dst, uint32_t size)
+{
+    memcpy(dst, &s_flash[addr], size);
+    s_read_bytes += size;
+    return OPRT_OK;
+}
+
+OPERATE_RET tkl_flash_write(uint32_t addr, const uint8_t *src, uint32_t size)
+{
+    memcpy(&s_flash[addr], src, size);
+    s_prog_bytes += size;
+    return OPRT_OK;
+}
+
+OPERATE_RET tkl_flash_erase(uint32_t addr, uint32_t size)
+{
+    memset(&s_flash[addr], 0xFF, size);
+    return OPRT_OK;
+}
+
+OPERATE_RET tkl_flash_get_one_type_info(TUYA_FLASH_TYPE_E type, TUYA_FLASH_BASE_INFO_T *info)
+{
+    memset(info, 0, sizeof(TUYA_FLASH_BASE_INFO_T));
+    info->partition_num = 1;
+    info->partition[0].block_size = FAKE_FLASH_BLOCK;
+    info->partition[0].start_addr = 0;
+    info->partition[0].size = FAKE_FLASH_SIZE;
+    return OPRT_OK;
+}
+
+OPERATE_RET tkl_flash_lock(uint32_t addr, uint32_t size)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tkl_flash_unlock(uint32_t addr, uint32_t size)
+{
+    return OPRT_OK;
+}
+}
+
+static tal_kv_cfg_t s_kv_cfg = {"0123456789abcdef", "fedcba9876543210"};
+
+static std::string kv_get(const char *key)
+{
+    uint8_t *value = NULL;
+    size_t length = 0;
+
+    if (OPRT_OK != tal_kv_get(key, &value, &length)) {
+        return "";
+    }
+    std::string out((const char *)value, length);
+    tal_kv_free(value);
+    return out;
+}
+
+class TalKvCacheTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        tal_sw_timer_init();
+        tal_workq_init();
+        ASSERT_EQ(0, tal_kv_init(&s_kv_cfg));
+    }
+
+    void SetUp() override
+    {
+        ASSERT_EQ(OPRT_OK, tal_kv_flush());
+        s_read_bytes = 0;
+        s_prog_bytes = 0;
+    }
+};
+
+TEST_F(TalKvCacheTest, HotKeyIsProgrammedOnce)
+{
+    char value[32];
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("once", (const uint8_t *)"0", 1));
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+    uint32_t once = s_prog_bytes;
+
+    s_prog_bytes = 0;
+    for (int i = 0; i < 100; i++) {
+        snprintf(value, sizeof(value), "%d", i);
+        ASSERT_EQ(OPRT_OK, tal_kv_set("hot", (const uint8_t *)value, strlen(value)));
+    }
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+    printf("100 sets of one key: %u bytes programmed, 1 set: %u bytes\n", s_prog_bytes, once);
+
+    EXPECT_GT(once, 0u);
+    EXPECT_LE(s_prog_bytes, 2 * once);
+    EXPECT_EQ("99", kv_get("hot"));
+}
+
+TEST_F(TalKvCacheTest, CachedGetSkipsTheFlash)
+{
+    ASSERT_EQ(OPRT_OK, tal_kv_set("cached", (const uint8_t *)"value", 5));
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+
+    s_read_bytes = 0;
+    for (int i = 0; i < 100; i++) {
+        ASSERT_EQ("value", kv_get("cached"));
+    }
+    printf("100 gets of a cached key: %u bytes read\n", s_read_bytes);
+
+    EXPECT_EQ(0u, s_read_bytes);
+}
+
+TEST_F(TalKvCacheTest, SystemResetFlushesTheCache)
+{
+    ASSERT_EQ(OPRT_OK, tal_kv_set("reset", (const uint8_t *)"dirty", 5));
+    EXPECT_EQ(0u, s_prog_bytes);
+
+    // tal_system_reset publishes it before the reset
+    tal_event_publish(EVENT_SYSTEM_RESET, NULL);
+    EXPECT_GT(s_prog_bytes, 0u);
+
+    // nothing is left to write
+    s_prog_bytes = 0;
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+    EXPECT_EQ(0u, s_prog_bytes);
+}
+
+TEST_F(TalKvCacheTest, FailedBatchIsNotReplayedOverLaterSets)
+{
+    std::string big(KV_BIG_VALUE, 'b');
+    tal_kv_item_t items[2] = {
+        {"batch", (const uint8_t *)"old", 3},
+        {"big", (const uint8_t *)big.data(), big.size()},
+    };
+
+    // the journal is written, the big key runs out of space
+    ASSERT_NE(OPRT_OK, tal_kv_set_batch(items, 2));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("batch", (const uint8_t *)"new", 3));
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+
+    // the reboot replays a journal left on flash
+    ASSERT_EQ(0, tal_kv_init(&s_kv_cfg));
+    EXPECT_EQ("new", kv_get("batch"));
+}
@@ -0,0 +1,267 @@
+/**
+ * @file test_tal_kv_posix.cpp
+ * @brief UT and benchmark of tal_kv on the POSIX storage wrapper, built once
+ * without and once with ENABLE_KV_CACHE.
+ *
+ * The values are files in ./tuyadb like on a Linux host, no flash is faked.
+ * A file is looked at or removed behind tal_kv to tell whether a set reached
+ * the storage and whether a get read it. A journal left by a power loss is
+ * written by hand and has to be replayed by tal_kv_init. The benchmark prints
+ * the time of set, get and batch set, compare the two builds for the cost
+ * saved by the cache.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tal_kv.h"
+}
+
+#define KV_DB_PATH       "./tuyadb"
+#define KV_JOURNAL_NAME  ".kv_journal"
+#define KV_BENCH_LOOP    500
+#define KV_BENCH_VALUE   64 // a serialized dp state of a few fields
+#define KV_BENCH_BATCH   8
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+#define KV_MODE "cache"
+#else
+#define KV_MODE "no cache"
+#endif
+
+static tal_kv_cfg_t s_kv_cfg = {"0123456789abcdef", "fedcba9876543210"};
+
+static std::string kv_get(const char *key)
+{
+    uint8_t *value = NULL;
+    size_t length = 0;
+
+    if (OPRT_OK != tal_kv_get(key, &value, &length)) {
+        return "";
+    }
+    std::string out((const char *)value, length);
+    tal_kv_free(value);
+    return out;
+}
+
+static bool stored(const char *key)
+{
+    struct stat st;
+
+    return 0 == stat((std::string(KV_DB_PATH "/") + key).c_str(), &st);
+}
+
+static void unstore(const char *key)
+{
+    remove((std::string(KV_DB_PATH "/") + key).c_str());
+}
+
+static void clean_db(void)
+{
+    DIR *dir = opendir(KV_DB_PATH);
+    struct dirent *entry = NULL;
+
+    if (NULL == dir) {
+        return;
+    }
+    while (NULL != (entry = readdir(dir))) {
+        if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+            unstore(entry->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+/* record of the batch journal: key_len(1) key value_len(4, LE) value */
+static std::string journal_record(const std::string &key, const std::string &value)
+{
+    std::string rec(1, (char)key.size());
+    uint32_t len = value.size();
+
+    rec += key;
+    for (int i = 0; i < 4; i++) {
+        rec += (char)(len >> (i * 8));
+    }
+    return rec + value;
+}
+
+static double elapsed_us(std::chrono::steady_clock::time_point begin, int loop)
+{
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    return std::chrono::duration<double, std::micro>(elapsed).count() / loop;
+}
+
+class TalKvPosixTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        tal_sw_timer_init();
+        tal_workq_init();
+        clean_db();
+        ASSERT_EQ(OPRT_OK, tal_kv_init(&s_kv_cfg));
+    }
+
+    static void TearDownTestCase()
+    {
+        tal_kv_flush();
+        clean_db();
+    }
+
+    void SetUp() override
+    {
+        ASSERT_EQ(OPRT_OK, tal_kv_flush());
+    }
+};
+
+TEST_F(TalKvPosixTest, SetGetDel)
+{
+    ASSERT_EQ(OPRT_OK, tal_kv_set("plain", (const uint8_t *)"value", 5));
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+    EXPECT_TRUE(stored("plain"));
+    EXPECT_FALSE(stored("plain.tmp"));
+    EXPECT_EQ("value", kv_get("plain"));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_del("plain"));
+    EXPECT_FALSE(stored("plain"));
+    EXPECT_EQ("", kv_get("plain"));
+    EXPECT_NE(OPRT_OK, tal_kv_del("plain"));
+}
+
+TEST_F(TalKvPosixTest, BatchSetsAllKeys)
+{
+    tal_kv_item_t items[3] = {
+        {"batch.a", (const uint8_t *)"1", 1},
+        {"batch.b", (const uint8_t *)"22", 2},
+        {"batch.c", (const uint8_t *)"333", 3},
+    };
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set_batch(items, 3));
+    EXPECT_FALSE(stored(KV_JOURNAL_NAME));
+    EXPECT_TRUE(stored("batch.a") && stored("batch.b") && stored("batch.c"));
+    EXPECT_EQ("1", kv_get("batch.a"));
+    EXPECT_EQ("22", kv_get("batch.b"));
+    EXPECT_EQ("333", kv_get("batch.c"));
+}
+
+TEST_F(TalKvPosixTest, JournalLeftByPowerLossIsReplayed)
+{
+    std::string journal = journal_record("replay.a", "new a") + journal_record("replay.b", "new b");
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("replay.a", (const uint8_t *)"old a", 5));
+    // the journal is on the storage, the power was cut before the keys were written
+    ASSERT_EQ(OPRT_OK, tal_kv_set(KV_JOURNAL_NAME, (const uint8_t *)journal.data(), journal.size()));
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+
+    ASSERT_EQ(OPRT_OK, tal_kv_init(&s_kv_cfg));
+    EXPECT_FALSE(stored(KV_JOURNAL_NAME));
+    EXPECT_EQ("new a", kv_get("replay.a"));
+    EXPECT_EQ("new b", kv_get("replay.b"));
+}
+
+TEST_F(TalKvPosixTest, FailedBatchIsNotReplayedOverLaterSets)
+{
+    tal_kv_item_t items[2] = {
+        {"batch", (const uint8_t *)"old", 3},
+        {"nodir/key", (const uint8_t *)"x", 1},
+    };
+
+    // the journal is written, the key in a missing directory can not be
+    ASSERT_NE(OPRT_OK, tal_kv_set_batch(items, 2));
+    EXPECT_FALSE(stored(KV_JOURNAL_NAME));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_set("batch", (const uint8_t *)"new", 3));
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+
+    ASSERT_EQ(OPRT_OK, tal_kv_init(&s_kv_cfg));
+    EXPECT_EQ("new", kv_get("batch"));
+}
+
+#if defined(ENABLE_KV_CACHE) && (ENABLE_KV_CACHE == 1)
+TEST_F(TalKvPosixTest, HotKeyIsWrittenByTheFlush)
+{
+    char value[32];
+
+    unstore("hot");
+    for (int i = 0; i < 100; i++) {
+        snprintf(value, sizeof(value), "%d", i);
+        ASSERT_EQ(OPRT_OK, tal_kv_set("hot", (const uint8_t *)value, strlen(value)));
+    }
+    EXPECT_FALSE(stored("hot"));
+    EXPECT_EQ("99", kv_get("hot"));
+
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+    EXPECT_TRUE(stored("hot"));
+}
+
+TEST_F(TalKvPosixTest, CachedGetSkipsTheStorage)
+{
+    ASSERT_EQ(OPRT_OK, tal_kv_set("cached", (const uint8_t *)"value", 5));
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+
+    // the file is gone, only the cache can answer
+    unstore("cached");
+    EXPECT_EQ("value", kv_get("cached"));
+}
+
+TEST_F(TalKvPosixTest, SystemResetFlushesTheCache)
+{
+    unstore("reset");
+    ASSERT_EQ(OPRT_OK, tal_kv_set("reset", (const uint8_t *)"dirty", 5));
+    EXPECT_FALSE(stored("reset"));
+
+    // tal_system_reset publishes it before the reset
+    tal_event_publish(EVENT_SYSTEM_RESET, NULL);
+    EXPECT_TRUE(stored("reset"));
+}
+#endif
+
+TEST_F(TalKvPosixTest, Benchmark)
+{
+    std::string value(KV_BENCH_VALUE, 'v');
+    std::vector<std::string> keys;
+    std::vector<tal_kv_item_t> items;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < KV_BENCH_LOOP; i++) {
+        value[0] = (char)('a' + i % 26);
+        ASSERT_EQ(OPRT_OK, tal_kv_set("bench", (const uint8_t *)value.data(), value.size()));
+    }
+    double set_us = elapsed_us(begin, KV_BENCH_LOOP);
+
+    begin = std::chrono::steady_clock::now();
+    ASSERT_EQ(OPRT_OK, tal_kv_flush());
+    double flush_us = elapsed_us(begin, 1);
+
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < KV_BENCH_LOOP; i++) {
+        ASSERT_EQ(KV_BENCH_VALUE, kv_get("bench").size());
+    }
+    double get_us = elapsed_us(begin, KV_BENCH_LOOP);
+
+    for (int i = 0; i < KV_BENCH_BATCH; i++) {
+        keys.push_back("bench." + std::to_string(i));
+    }
+    for (auto &key : keys) {
+        items.push_back({key.c_str(), (const uint8_t *)value.data(), value.size()});
+    }
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < KV_BENCH_LOOP / 10; i++) {
+        ASSERT_EQ(OPRT_OK, tal_kv_set_batch(items.data(), items.size()));
+    }
+    double batch_us = elapsed_us(begin, KV_BENCH_LOOP / 10);
+
+    printf("[%s] %d byte value on %s: set %.1f us, flush %.1f us, get %.1f us, batch of %d keys %.1f us\n",
+           KV_MODE, KV_BENCH_VALUE, KV_DB_PATH, set_us, flush_us, get_us, KV_BENCH_BATCH, batch_us);
+}
@@ -37,6 +37,17 @@ extern "C" {
 /* tuya sdk definition of 255.255.255.255 */
 #define TY_IPADDR_BROADCAST ((uint32_t)0xffffffffUL)
 
+/* buffers sent by one tal_net_sendv at most */
+#ifndef TAL_NET_SENDV_MAX
+#define TAL_NET_SENDV_MAX 8
+#endif
+
+/* one buffer of tal_net_sendv */
+typedef struct {
+    const void *buf;
+    uint32_t len;
+} TUYA_NET_IOVEC_T;
+
 /**
  * @brief Get error code of network
  *
@@ -240,6 +251,23 @@ TUYA_ERRNO tal_net_listen(const int fd, const int backlog);
  */
 TUYA_ERRNO tal_net_send(const int fd, const void *buf, const uint32_t nbytes);
 
+/**
+ * @brief Send several buffers to network as one send
+ *
+ * @param[in] fd: file descriptor
+ * @param[in] iov: the buffers
+ * @param[in] iovcnt: number of buffers
+ *
+ * @note This API is used for sending a header and a payload kept apart in one
+ * segment. It maps to sendmsg on posix and lwip, other systems send buffer by
+ * buffer. At most TAL_NET_SENDV_MAX buffers are sent in one call, the number of
+ * bytes sent tells the caller where to go on.
+ *
+ * @return >0 on num of send, <0 please refer to the error no of the target
+ * system
+ */
+TUYA_ERRNO tal_net_sendv(const int fd, const TUYA_NET_IOVEC_T *iov, const int iovcnt);
+
 /**
  * @brief Send data to specified server
  *
@@ -424,6 +452,20 @@ OPERATE_RET tal_net_set_keepalive(int fd, const BOOL_T alive, const uint32_t idl
  */
 OPERATE_RET tal_net_get_socket_ip(int fd, TUYA_IP_ADDR_T *addr);
 
+/**
+ * @brief Get the local address and port of the socket
+ *
+ * @param[in] fd: file descriptor
+ * @param[out] addr: ip address
+ * @param[out] port: port information
+ *
+ * @note This API is used for getting the port a socket bound to port 0 got.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_net_getsockname(int fd, TUYA_IP_ADDR_T *addr, uint16_t *port);
+
 /**
  * @brief Change ip string to address
  *
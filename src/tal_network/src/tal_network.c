@@ -31,6 +31,7 @@
  */
 #include "tuya_iot_config.h"
 #include "tal_api.h"
+#include "tal_network.h"
 
 #if 100 == OPERATING_SYSTEM
 #include <unistd.h>
@@ -646,6 +647,66 @@ TUYA_ERRNO tal_net_send(const int fd, const void *buf, const uint32_t nbytes)
     return ret;
 }
 
+/**
+ * @brief Send several buffers to network as one send
+ *
+ * @param[in] fd: file descriptor
+ * @param[in] iov: the buffers
+ * @param[in] iovcnt: number of buffers, only the first TAL_NET_SENDV_MAX are sent
+ *
+ * @note This API is used for sending a header and a payload kept apart in one
+ * segment without copying them together
+ *
+ * @return >0 on num of send, <0 please refer to the error no of the target
+ * system
+ */
+TUYA_ERRNO tal_net_sendv(const int fd, const TUYA_NET_IOVEC_T *iov, const int iovcnt)
+{
+    int ret = -1;
+    int i = 0, cnt = iovcnt;
+
+    if ((fd < 0) || (iov == NULL) || (iovcnt <= 0)) {
+        return -3000 + fd;
+    }
+    if (cnt > TAL_NET_SENDV_MAX) {
+        cnt = TAL_NET_SENDV_MAX;
+    }
+
+#if NET_USING_POSIX
+    struct iovec vec[TAL_NET_SENDV_MAX];
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    for (i = 0; i < cnt; i++) {
+        vec[i].iov_base = (void *)iov[i].buf;
+        vec[i].iov_len = iov[i].len;
+    }
+    msg.msg_iov = vec;
+    msg.msg_iovlen = cnt;
+    ret = sendmsg(fd, &msg, 0);
+#else
+    int sent = 0;
+
+    // no scatter-gather send in tkl, stop at the first short send like sendmsg
+    for (i = 0; i < cnt; i++) {
+        if (0 == iov[i].len) {
+            continue;
+        }
+        ret = tkl_net_send(fd, iov[i].buf, iov[i].len);
+        if (ret < 0) {
+            return sent ? sent : ret;
+        }
+        sent += ret;
+        if ((uint32_t)ret < iov[i].len) {
+            break;
+        }
+    }
+    ret = sent;
+#endif
+
+    return ret;
+}
+
 /**
  * @brief Send data to specified server
  *
@@ -1121,6 +1182,39 @@ OPERATE_RET tal_net_get_socket_ip(int fd, TUYA_IP_ADDR_T *addr)
     return ret;
 }
 
+/**
+ * @brief Get the local address and port of the socket
+ *
+ * @param[in] fd: file descriptor
+ * @param[out] addr: ip address
+ * @param[out] port: port information
+ *
+ * @note This API is used for getting the port a socket bound to port 0 got.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_net_getsockname(int fd, TUYA_IP_ADDR_T *addr, uint16_t *port)
+{
+    int ret = -1;
+
+#if NET_USING_POSIX
+    struct sockaddr_in sock_addr;
+    memset(&sock_addr, 0, sizeof(sock_addr));
+    socklen_t len = sizeof(sock_addr);
+
+    if (0 == getsockname(fd, (struct sockaddr *)&sock_addr, &len)) {
+        *addr = ntohl(sock_addr.sin_addr.s_addr);
+        *port = ntohs(sock_addr.sin_port);
+        ret = OPRT_OK;
+    }
+#else
+    ret = tkl_net_getsockname(fd, addr, port);
+#endif
+
+    return ret;
+}
+
 /**
  * @brief Change ip string to address
  *
@@ -31,6 +31,8 @@
 #include "tuya_list.h"
 #include "tal_event_info.h"
 #include "tal_mutex.h"
+#include "tal_semaphore.h"
+#include "tkl_thread.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -50,6 +52,14 @@ extern "C" {
  */
 #define EVENT_DESC_MAX_LEN (32)
 
+/**
+ * @brief bucket number of the event name hash index, must be power of 2
+ *
+ */
+#ifndef EVENT_HASH_BUCKET_NUM
+#define EVENT_HASH_BUCKET_NUM (32)
+#endif
+
 /**
  * @brief subscriber type
  *
@@ -90,17 +100,55 @@ typedef struct {
 } SUBSCRIBE_NODE_T;
 
 /**
- * @brief the event node
+ * @brief the read-only subscriber snapshot used by dispatch
  *
  */
 typedef struct {
+    uint32_t gen;             // generation, snapshots replaced earlier have smaller one
+    uint16_t ref;             // publishers which are dispatching with this snapshot
+    uint8_t retired;          // replaced by a newer snapshot, free when ref drops to 0
+    uint8_t has_onetime;      // one-time subscriber exists, need remove at next publish
+    uint16_t cap;             // max callbacks of the snapshot
+    uint16_t cnt;             // current callbacks of the snapshot
+    EVENT_SUBSCRIBE_CB cb[0]; // callbacks in dispatch order
+} SUBSCRIBE_SNAPSHOT_T;
+
+/**
+ * @brief a publisher dispatching the event, lives on the stack of the publisher
+ *
+ */
+typedef struct event_dispatch {
+    struct event_dispatch *next;    // next publisher dispatching the same event
+    SUBSCRIBE_SNAPSHOT_T *snapshot; // the snapshot the publisher is using
+    TKL_THREAD_HANDLE thread;       // the thread of the publisher
+    BOOL_T unsubscribing;           // a callback of the publisher is waiting in unsubscribe
+} EVENT_DISPATCH_T;
+
+/**
+ * @brief the event node
+ *
+ */
+typedef struct event_node {
     MUTEX_HANDLE mutex; // mutex, protection the event publish and subscribe
 
     char name[EVENT_NAME_MAX_LEN + 1];    // name, the event name
+    uint32_t hash;                        // hash of the name, used to find by name
+    struct event_node *hash_next;         // next event node in the same hash bucket
     struct tuya_list_head node;           // list node, used to attach to the event manage module
     struct tuya_list_head subscribe_root; // subscibe root, used to manage the subscriber
+    SUBSCRIBE_SNAPSHOT_T *snapshot;       // copy of subscribe_root, dispatch without holding mutex
+    uint32_t snapshot_gen;                // generation of the latest snapshot
+    EVENT_DISPATCH_T *dispatching;        // publishers which are running the callbacks
+    uint16_t release_waiters;             // unsubscribers waiting for old snapshots to be released
+    SEM_HANDLE release_sem;               // posted when a retired snapshot is released
 } EVENT_NODE_T;
 
+/**
+ * @brief the event handle, got from tal_event_handle_get, valid forever
+ *
+ */
+typedef void *EVENT_HANDLE;
+
 /**
  * @brief the event manage node
  *
@@ -112,6 +160,7 @@ typedef struct {
     struct tuya_list_head event_root;          // event root, used to manage the event
     struct tuya_list_head free_subscribe_root; // free subscriber list, used to manage the
                                                // subscribe which not found the event
+    EVENT_NODE_T *hash_bucket[EVENT_HASH_BUCKET_NUM]; // event name hash index
 } EVENT_MANAGE_T;
 
 /**
@@ -132,6 +181,26 @@ OPERATE_RET tal_event_init(void);
  */
 OPERATE_RET tal_event_publish(const char *name, void *data);
 
+/**
+ * @brief: get the handle of event, the event will be created if not exist
+ *
+ * @param[in] name: event name
+ * @param[out] handle: event handle
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_event_handle_get(const char *name, EVENT_HANDLE *handle);
+
+/**
+ * @brief: publish event by handle, no name lookup
+ *
+ * @param[in] handle: event handle got from tal_event_handle_get
+ * @param[in] data: event data
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_event_publish_by_handle(EVENT_HANDLE handle, void *data);
+
 /**
  * @brief: subscribe event
  *
@@ -46,6 +46,7 @@ extern "C" {
 #define EVENT_MQTT_CONNECTED    "mqtt.con"      // mqtt connect
 #define EVENT_MQTT_DISCONNECTED "mqtt.disc"     // mqtt disconnect
 #define EVENT_LINK_ACTIVATE     "link.activate" // linkage got activate info
+#define EVENT_SYSTEM_RESET      "sys.reset"     // published by tal_system_reset right before the reset
 
 #ifdef __cplusplus
 }
@@ -288,6 +288,57 @@ OPERATE_RET tal_log_print_raw(const char *pFmt, ...);
  */
 void tal_log_release(void);
 
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+/**
+ * @brief start asynchronous log output
+ *
+ * @param[in] buf_size, size of the ring buffer which holds the pending records
+ *
+ * @note The caller only formats the message into the ring buffer, a low
+ * priority thread adds the prefix and writes it to the output terminals.
+ * Records are dropped and counted when the ring buffer is full. It is called
+ * by tal_log_init with LOG_ASYNC_BUF_SIZE.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_log_async_start(const int buf_size);
+
+/**
+ * @brief get the number of records dropped by asynchronous log
+ *
+ * @return the dropped record count
+ */
+uint32_t tal_log_async_get_dropped(void);
+#endif
+
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+/**
+ * @brief length of the binary frame passed to binary terminals
+ *
+ * frame: magic(0xA5) len(1) payload(len) xor checksum of payload(1)
+ * payload: level|flags(1) fmt_id(4, LE) file_id(2, LE) line(varint) time(varint) args...
+ */
+#define TAL_LOG_BINARY_FRAME_LEN(frame) (((const uint8_t *)(frame))[1] + 3)
+
+/**
+ * @brief add one binary output terminal.
+ *
+ * @param[in] name , terminal name
+ * @param[in] term , output function pointer, receive binary frame instead of
+ * text, use TAL_LOG_BINARY_FRAME_LEN to get the frame length
+ *
+ * @note The text is rebuilt on host by tools/log_decoder with the format
+ * string table generated at build time. Text formatting is skipped when only
+ * binary terminals exist. With the async log started, the frame is encoded
+ * into the ring and the terminal is called by the log thread.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_log_add_binary_term(const char *name, const TAL_LOG_OUTPUT_CB term);
+#endif
+
 /**
  * @brief print a buffer in hex format
  *
@@ -62,7 +62,95 @@ BOOL_T _event_desc_is_valid(const char *desc)
     return TRUE;
 }
 
-EVENT_NODE_T *_event_node_create_init(const char *name)
+static uint32_t _event_name_hash(const char *name)
+{
+    // BKDR hash
+    uint32_t hash = 0;
+    while (*name) {
+        hash = hash * 131 + (uint8_t)(*name++);
+    }
+
+    return hash;
+}
+
+EVENT_NODE_T *_event_node_find(const char *name, uint32_t hash)
+{
+    // try to get event from hash index, the caller holds the manager lock
+    EVENT_NODE_T *entry = g_event_manager.hash_bucket[hash & (EVENT_HASH_BUCKET_NUM - 1)];
+    while (entry) {
+        if (entry->hash == hash && 0 == strcmp(entry->name, name)) {
+            return entry;
+        }
+        entry = entry->hash_next;
+    }
+
+    return NULL;
+}
+
+EVENT_NODE_T *_event_node_get(const char *name)
+{
+    return _event_node_find(name, _event_name_hash(name));
+}
+
+OPERATE_RET _event_node_snapshot_update(EVENT_NODE_T *event)
+{
+    uint16_t cnt = 0;
+    BOOL_T has_onetime = FALSE;
+    struct tuya_list_head *pos = NULL;
+    SUBSCRIBE_NODE_T *entry = NULL;
+    SUBSCRIBE_SNAPSHOT_T *snapshot = event->snapshot;
+    SUBSCRIBE_SNAPSHOT_T *new_snapshot = NULL;
+
+    tuya_list_for_each(pos, &event->subscribe_root)
+    {
+        cnt++;
+    }
+
+    // the snapshot is used by publisher or too small, replace it, the old one
+    // will be freed by the last publisher who is using it
+    if (NULL == snapshot || snapshot->ref || snapshot->cap < cnt) {
+        if (cnt) {
+            new_snapshot = tal_malloc(sizeof(SUBSCRIBE_SNAPSHOT_T) + cnt * sizeof(EVENT_SUBSCRIBE_CB));
+            TUYA_CHECK_NULL_RETURN(new_snapshot, OPRT_MALLOC_FAILED);
+            memset(new_snapshot, 0, sizeof(SUBSCRIBE_SNAPSHOT_T));
+            new_snapshot->cap = cnt;
+        }
+        // the generation moves on even without a new snapshot, unsubscribe waits for the older ones
+        event->snapshot_gen++;
+        if (new_snapshot) {
+            new_snapshot->gen = event->snapshot_gen;
+        }
+
+        if (snapshot) {
+            if (snapshot->ref) {
+                snapshot->retired = TRUE;
+            } else {
+                tal_free(snapshot);
+            }
+        }
+        event->snapshot = snapshot = new_snapshot;
+    }
+
+    if (NULL == snapshot) {
+        return OPRT_OK;
+    }
+
+    cnt = 0;
+    tuya_list_for_each(pos, &event->subscribe_root)
+    {
+        entry = tuya_list_entry(pos, SUBSCRIBE_NODE_T, node);
+        snapshot->cb[cnt++] = entry->cb;
+        if (entry->type == SUBSCRIBE_TYPE_ONETIME) {
+            has_onetime = TRUE;
+        }
+    }
+    snapshot->cnt = cnt;
+    snapshot->has_onetime = has_onetime;
+
+    return OPRT_OK;
+}
+
+EVENT_NODE_T *_event_node_create_init(const char *name, uint32_t hash)
 {
     // allocate memory
     EVENT_NODE_T *event = tal_malloc(sizeof(EVENT_NODE_T));
@@ -72,11 +160,10 @@ EVENT_NODE_T *_event_node_create_init(const char *name)
     // initialze the event node
     memcpy(event->name, name, strlen(name));
     event->name[strlen(name)] = '\0';
+    event->hash = hash;
     INIT_LIST_HEAD(&event->subscribe_root);
-    tal_mutex_create_init(&event->mutex);
-
-    tal_mutex_lock(g_event_manager.mutex);
 
+    // the caller holds the manager lock and has checked the event does not exist
     // need check if there have free subscriber which subscribe this event
     struct tuya_list_head *free_pos = NULL;
     struct tuya_list_head *free_next = NULL;
@@ -98,32 +185,29 @@ EVENT_NODE_T *_event_node_create_init(const char *name)
         }
     }
 
-    // at last, need add this event to event manage root
+    // no memory for snapshot, give the subscriber back to free list
+    if (OPRT_OK != _event_node_snapshot_update(event)) {
+        tuya_list_for_each_safe(free_pos, free_next, &event->subscribe_root)
+        {
+            free_entry = tuya_list_entry(free_pos, SUBSCRIBE_NODE_T, node);
+            tuya_list_del(&free_entry->node);
+            tuya_list_add_tail(&free_entry->node, &g_event_manager.free_subscribe_root);
+        }
+        tal_free(event);
+        return NULL;
+    }
+    tal_mutex_create_init(&event->mutex);
+    tal_semaphore_create_init(&event->release_sem, 0, 1);
+
+    // at last, need add this event to event manage root and hash index
     tuya_list_add_tail(&event->node, &g_event_manager.event_root);
+    event->hash_next = g_event_manager.hash_bucket[hash & (EVENT_HASH_BUCKET_NUM - 1)];
+    g_event_manager.hash_bucket[hash & (EVENT_HASH_BUCKET_NUM - 1)] = event;
     g_event_manager.event_cnt++;
 
-    tal_mutex_unlock(g_event_manager.mutex);
-
     return event;
 }
 
-EVENT_NODE_T *_event_node_get(const char *name)
-{
-    // try to get event from event root
-    EVENT_NODE_T *entry = NULL;
-    struct tuya_list_head *pos = NULL;
-    tuya_list_for_each(pos, &g_event_manager.event_root)
-    {
-        // find by name
-        entry = tuya_list_entry(pos, EVENT_NODE_T, node);
-        if (0 == strcmp(entry->name, name)) {
-            return entry;
-        }
-    }
-
-    return NULL;
-}
-
 SUBSCRIBE_NODE_T *_event_node_get_free_subscribe(SUBSCRIBE_NODE_T *subscribe)
 {
     struct tuya_list_head *pos = NULL;
@@ -157,30 +241,136 @@ SUBSCRIBE_NODE_T *_event_node_get_subscribe(EVENT_NODE_T *event, SUBSCRIBE_NODE_
     return NULL;
 }
 
-OPERATE_RET _event_node_dispatch(EVENT_NODE_T *event, void *data)
+void _event_node_del_onetime_subscribe(EVENT_NODE_T *event)
 {
-    OPERATE_RET rt = OPRT_OK;
-
-    // dispatch in order
     struct tuya_list_head *p = NULL;
     struct tuya_list_head *n = NULL;
     SUBSCRIBE_NODE_T *entry = NULL;
+    LIST_HEAD(onetime_list);
+
     tuya_list_for_each_safe(p, n, &event->subscribe_root)
     {
-        // find and call cb one by one
         entry = tuya_list_entry(p, SUBSCRIBE_NODE_T, node);
-        if (entry->cb) {
-            TUYA_CALL_ERR_LOG(entry->cb(data));
-        }
-
-        // one-time event should be removed after dispatch
         if (entry->type == SUBSCRIBE_TYPE_ONETIME) {
             tuya_list_del(&entry->node);
-            tal_free(entry);
-            entry = NULL;
+            tuya_list_add_tail(&entry->node, &onetime_list);
+        }
+    }
+
+    // keep them in snapshot if no memory, they will be removed next time
+    if (OPRT_OK != _event_node_snapshot_update(event)) {
+        tuya_list_splice(&onetime_list, &event->subscribe_root);
+        return;
+    }
+
+    tuya_list_for_each_safe(p, n, &onetime_list)
+    {
+        entry = tuya_list_entry(p, SUBSCRIBE_NODE_T, node);
+        tal_free(entry);
+    }
+}
+
+BOOL_T _event_node_old_snapshot_in_use(EVENT_NODE_T *event, uint32_t gen, TKL_THREAD_HANDLE self)
+{
+    EVENT_DISPATCH_T *dispatch = event->dispatching;
+
+    // the snapshots of the calling thread are skipped, a callback may unsubscribe itself,
+    // so are the publishers waiting in unsubscribe themselves, they would wait for each other
+    while (dispatch) {
+        if (dispatch->snapshot->gen < gen && dispatch->thread != self && !dispatch->unsubscribing) {
+            return TRUE;
+        }
+        dispatch = dispatch->next;
+    }
+
+    return FALSE;
+}
+
+void _event_node_mark_unsubscribing(EVENT_NODE_T *event, TKL_THREAD_HANDLE self, BOOL_T unsubscribing)
+{
+    EVENT_DISPATCH_T *dispatch = event->dispatching;
+
+    while (dispatch) {
+        if (dispatch->thread == self) {
+            dispatch->unsubscribing = unsubscribing;
+        }
+        dispatch = dispatch->next;
+    }
+}
+
+void _event_node_wait_old_snapshot(EVENT_NODE_T *event)
+{
+    TKL_THREAD_HANDLE self = NULL;
+    uint32_t gen = event->snapshot_gen;
+
+    // called with the event lock held, wait until other publishers are done
+    // with the snapshots made before the subscriber was removed
+    tkl_thread_get_id(&self);
+    _event_node_mark_unsubscribing(event, self, TRUE);
+    if (event->release_waiters) {
+        // a waiter may be waiting for the snapshot of this thread
+        tal_semaphore_post(event->release_sem);
+    }
+    while (_event_node_old_snapshot_in_use(event, gen, self)) {
+        event->release_waiters++;
+        tal_mutex_unlock(event->mutex);
+        // the semaphore is binary, more waiters recheck after the timeout
+        tal_semaphore_wait(event->release_sem, 10);
+        tal_mutex_lock(event->mutex);
+        event->release_waiters--;
+    }
+    _event_node_mark_unsubscribing(event, self, FALSE);
+}
+
+OPERATE_RET _event_node_dispatch(EVENT_NODE_T *event, void *data)
+{
+    OPERATE_RET rt = OPRT_OK;
+    SUBSCRIBE_SNAPSHOT_T *snapshot = NULL;
+    EVENT_DISPATCH_T dispatch = {0};
+    EVENT_DISPATCH_T **pp = NULL;
+    uint16_t i = 0;
+
+    // hold the snapshot, one-time subscriber should be removed before dispatch,
+    // so other publishers will not see it again
+    tal_mutex_lock(event->mutex);
+    snapshot = event->snapshot;
+    if (snapshot) {
+        snapshot->ref++;
+        if (snapshot->has_onetime) {
+            _event_node_del_onetime_subscribe(event);
+        }
+        dispatch.snapshot = snapshot;
+        tkl_thread_get_id(&dispatch.thread);
+        dispatch.next = event->dispatching;
+        event->dispatching = &dispatch;
+    }
+    tal_mutex_unlock(event->mutex);
+
+    if (NULL == snapshot) {
+        return OPRT_OK;
+    }
+
+    // dispatch in order without lock, slow subscriber will not block other publishers
+    for (i = 0; i < snapshot->cnt; i++) {
+        if (snapshot->cb[i]) {
+            TUYA_CALL_ERR_LOG(snapshot->cb[i](data));
         }
     }
 
+    // release the snapshot, free it if it has been replaced
+    tal_mutex_lock(event->mutex);
+    for (pp = &event->dispatching; *pp != &dispatch; pp = &(*pp)->next) {
+    }
+    *pp = dispatch.next;
+    snapshot->ref--;
+    if (snapshot->retired && event->release_waiters) {
+        tal_semaphore_post(event->release_sem);
+    }
+    if (0 == snapshot->ref && snapshot->retired) {
+        tal_free(snapshot);
+    }
+    tal_mutex_unlock(event->mutex);
+
     return rt;
 }
 
@@ -225,6 +415,13 @@ OPERATE_RET _event_node_add_subscribe(EVENT_NODE_T *event, SUBSCRIBE_NODE_T *sub
         tuya_list_add_tail(&new_entry->node, &event->subscribe_root);
     }
 
+    // publish to dispatch snapshot
+    rt = _event_node_snapshot_update(event);
+    if (OPRT_OK != rt) {
+        tuya_list_del(&new_entry->node);
+        tal_free(new_entry);
+    }
+
     return rt;
 }
 
@@ -245,20 +442,29 @@ OPERATE_RET _event_node_del_free_subscribe(SUBSCRIBE_NODE_T *subscribe)
     return rt;
 }
 
-OPERATE_RET _event_node_del_subscribe(EVENT_NODE_T *event, SUBSCRIBE_NODE_T *subscribe)
+OPERATE_RET _event_node_del_subscribe(EVENT_NODE_T *event, SUBSCRIBE_NODE_T *subscribe, BOOL_T *removed)
 {
     OPERATE_RET rt = OPRT_OK;
     SUBSCRIBE_NODE_T *new_entry = NULL;
+
+    *removed = FALSE;
     // not existed, return ok, dont care, pretend to success
     new_entry = _event_node_get_subscribe(event, subscribe);
     if (new_entry == NULL) {
         return OPRT_OK;
     }
 
-    // dont forget remove and free
+    // remove from dispatch snapshot first, dont forget free
+    struct tuya_list_head *prev = new_entry->node.prev;
     tuya_list_del(&new_entry->node);
+    rt = _event_node_snapshot_update(event);
+    if (OPRT_OK != rt) {
+        tuya_list_add(&new_entry->node, prev);
+        return rt;
+    }
     tal_free(new_entry);
     new_entry = NULL;
+    *removed = TRUE;
     return rt;
 }
 
@@ -349,51 +555,104 @@ OPERATE_RET tal_event_init(void)
 }
 
 /**
- * @brief Publishes an event with the given name and data.
+ * @brief Gets the handle of the event with the given name.
  *
- * This function publishes an event with the specified name and data. It first
- * checks if the event manager has been initialized, and if not, it initializes
- * it. Then, it validates the event name. If the name is not valid, it returns
- * an error code. If the event does not exist, it creates and initializes a new
- * event node. The event is then dispatched to all subscribers. If any of the
- * subscribers fail, the function continues dispatching the event but returns a
- * failed status to record the execution status.
+ * This function looks up the event in the name hash index and creates it if it
+ * does not exist. Events are never destroyed, so the handle can be saved and
+ * used by tal_event_publish_by_handle to skip the name lookup on hot paths.
  *
- * @param[in] name The name of the event to publish.
- * @param[in] data The data associated with the event.
+ * @param[in] name The name of the event.
+ * @param[out] handle The handle of the event.
  * @return The operation result. Returns OPRT_OK on success, or an error code on
  * failure.
  */
-OPERATE_RET tal_event_publish(const char *name, void *data)
+OPERATE_RET tal_event_handle_get(const char *name, EVENT_HANDLE *handle)
 {
     if (g_event_manager.inited != TRUE) {
         tal_event_init();
     }
 
+    if (NULL == handle) {
+        return OPRT_INVALID_PARM;
+    }
+
     if (!_event_name_is_valid(name)) {
         return OPRT_BASE_EVENT_INVALID_EVENT_NAME;
     }
 
-    OPERATE_RET rt = OPRT_OK;
     // try to get event, if not exist, create and init.
-    EVENT_NODE_T *event = _event_node_get(name);
+    uint32_t hash = _event_name_hash(name);
+    tal_mutex_lock(g_event_manager.mutex);
+    EVENT_NODE_T *event = _event_node_find(name, hash);
     if (!event) {
-        event = _event_node_create_init(name);
-        TUYA_CHECK_NULL_RETURN(event, OPRT_MALLOC_FAILED);
+        event = _event_node_create_init(name, hash);
     }
+    tal_mutex_unlock(g_event_manager.mutex);
+    TUYA_CHECK_NULL_RETURN(event, OPRT_MALLOC_FAILED);
 
-    // to keep the consistency, dispatch will done in mutex lock
-    tal_mutex_lock(event->mutex);
+    *handle = event;
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief Publishes an event by the handle got from tal_event_handle_get.
+ *
+ * The subscribers are dispatched from a read-only snapshot, the event mutex is
+ * only held to take and release the snapshot, so a slow subscriber will not
+ * block other publishers of the same event. If any of the subscribers fail,
+ * the function continues dispatching the event but returns a failed status to
+ * record the execution status.
+ *
+ * @param[in] handle The handle of the event to publish.
+ * @param[in] data The data associated with the event.
+ * @return The operation result. Returns OPRT_OK on success, or an error code on
+ * failure.
+ */
+OPERATE_RET tal_event_publish_by_handle(EVENT_HANDLE handle, void *data)
+{
+    if (NULL == handle) {
+        return OPRT_INVALID_PARM;
+    }
+
+    OPERATE_RET rt = OPRT_OK;
     // try to dispatch event to all subscribe
     // if one of the subscribe failed, it will continue but will return failed
     // to record the execute status
-    TUYA_CALL_ERR_LOG(_event_node_dispatch(event, data));
-
-    tal_mutex_unlock(event->mutex);
+    TUYA_CALL_ERR_LOG(_event_node_dispatch((EVENT_NODE_T *)handle, data));
 
     return rt;
 }
 
+/**
+ * @brief Publishes an event with the given name and data.
+ *
+ * This function publishes an event with the specified name and data. It first
+ * checks if the event manager has been initialized, and if not, it initializes
+ * it. Then, it validates the event name. If the name is not valid, it returns
+ * an error code. If the event does not exist, it creates and initializes a new
+ * event node. The event is then dispatched to all subscribers. If any of the
+ * subscribers fail, the function continues dispatching the event but returns a
+ * failed status to record the execution status.
+ *
+ * @param[in] name The name of the event to publish.
+ * @param[in] data The data associated with the event.
+ * @return The operation result. Returns OPRT_OK on success, or an error code on
+ * failure.
+ */
+OPERATE_RET tal_event_publish(const char *name, void *data)
+{
+    OPERATE_RET rt = OPRT_OK;
+    EVENT_HANDLE handle = NULL;
+
+    rt = tal_event_handle_get(name, &handle);
+    if (OPRT_OK != rt) {
+        return rt;
+    }
+
+    return tal_event_publish_by_handle(handle, data);
+}
+
 /**
  * @brief Subscribes to an event.
  *
@@ -432,13 +691,15 @@ OPERATE_RET tal_event_subscribe(const char *name, const char *desc, const EVENT_
     memcpy(subscribe.desc, desc, strlen(desc));
     subscribe.desc[strlen(desc)] = '\0';
 
+    // look up in manager lock, in case the event is created at the same time
+    tal_mutex_lock(g_event_manager.mutex);
     EVENT_NODE_T *event = _event_node_get(name);
     if (!event) {
         // if not found the event, add to the free list
-        tal_mutex_lock(g_event_manager.mutex);
         TUYA_CALL_ERR_LOG(_event_node_add_free_subscribe(&subscribe));
         tal_mutex_unlock(g_event_manager.mutex);
     } else {
+        tal_mutex_unlock(g_event_manager.mutex);
         // if found the event, add to the subscribe list
         tal_mutex_lock(event->mutex);
         TUYA_CALL_ERR_LOG(_event_node_add_subscribe(event, &subscribe));
@@ -457,6 +718,10 @@ OPERATE_RET tal_event_subscribe(const char *name, const char *desc, const EVENT_
  * description and name are valid before proceeding with the unsubscribe
  * operation. If the event is found, it is removed from the subscribe list. If
  * the event is not found, the subscription is removed from the free list.
+ * When it returns, the callback is no longer running in other publishers, so
+ * its context can be freed. A callback may unsubscribe itself. A publisher
+ * whose callback is itself waiting in unsubscribe is not waited for, so two
+ * publishers unsubscribing from their callbacks do not wait for each other.
  *
  * @param[in] name The name of the event to unsubscribe from.
  * @param[in] desc The description of the event to unsubscribe from.
@@ -480,6 +745,7 @@ OPERATE_RET tal_event_unsubscribe(const char *name, const char *desc, EVENT_SUBS
     }
 
     OPERATE_RET rt = OPRT_OK;
+    BOOL_T removed = FALSE;
     SUBSCRIBE_NODE_T subscribe = {0};
     subscribe.cb = cb;
     memcpy(subscribe.name, name, strlen(name));
@@ -487,16 +753,22 @@ OPERATE_RET tal_event_unsubscribe(const char *name, const char *desc, EVENT_SUBS
     memcpy(subscribe.desc, desc, strlen(desc));
     subscribe.desc[strlen(desc)] = '\0';
 
+    // look up in manager lock, in case the event is created at the same time
+    tal_mutex_lock(g_event_manager.mutex);
     EVENT_NODE_T *event = _event_node_get(name);
     if (!event) {
         // if not found the event, del from the free list
-        tal_mutex_lock(g_event_manager.mutex);
         TUYA_CALL_ERR_LOG(_event_node_del_free_subscribe(&subscribe));
         tal_mutex_unlock(g_event_manager.mutex);
     } else {
-        // if found the event, del from the subscribe list
+        tal_mutex_unlock(g_event_manager.mutex);
+        // if found the event, del from the subscribe list, and wait for the
+        // publishers which may still call it from an old snapshot
         tal_mutex_lock(event->mutex);
-        TUYA_CALL_ERR_LOG(_event_node_del_subscribe(event, &subscribe));
+        TUYA_CALL_ERR_LOG(_event_node_del_subscribe(event, &subscribe, &removed));
+        if (removed) {
+            _event_node_wait_old_snapshot(event);
+        }
         tal_mutex_unlock(event->mutex);
     }
 
@@ -20,9 +20,12 @@
  *
  */
 #include "tal_fs.h"
-#include "lfs.h"
 #include "tal_api.h"
 
+// tal_fs wraps littlefs, it is not built when tal_kv stores to the host file system
+#if !defined(ENABLE_KV_STORAGE_POSIX) || (ENABLE_KV_STORAGE_POSIX == 0)
+#include "lfs.h"
+
 int __lfs_get_cfg(const char *mode)
 {
     int flag = 0;
@@ -556,3 +559,5 @@ int tal_ftruncate(int fd, uint64_t length)
 {
     return OPRT_NOT_SUPPORTED;
 }
+
+#endif
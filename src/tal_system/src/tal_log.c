@@ -37,6 +37,14 @@
 #include "tal_system.h"
 #include "tal_time_service.h"
 #include "tal_memory.h"
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+#include "tal_thread.h"
+#include "tal_semaphore.h"
+#endif
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+#include <stddef.h>
+#include <stdint.h>
+#endif
 
 /***********************************************************
 *************************micro define***********************
@@ -44,10 +52,37 @@
 #define LOG_LEVEL_MIN 0
 #define LOG_LEVEL_MAX 5
 
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+#ifndef LOG_ASYNC_BUF_SIZE
+#define LOG_ASYNC_BUF_SIZE (8 * 1024)
+#endif
+
+#ifndef STACK_SIZE_LOG_ASYNC
+#define STACK_SIZE_LOG_ASYNC (3 * 1024)
+#endif
+
+#define LOG_ASYNC_ALIGN(x)  (((x) + 7) & ~7)
+#define LOG_ASYNC_WRAP      0xFFFFFFFF // record size of wrap marker, reader skip to the ring start
+#define LOG_ASYNC_MIN_SPACE 128        // wrap to the ring start if tail room is less than it
+#endif
+
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+#define LOG_BIN_MAGIC         0xA5
+#define LOG_BIN_PAYLOAD_MAX   255
+#define LOG_BIN_STR_MAX       127  // string argument is cut to it, length fits in 1 byte varint
+#define LOG_BIN_FLAG_TIME_ABS 0x08 // time is posix ms, otherwise ms since the previous record
+#define LOG_BIN_FLAG_TRUNC    0x10 // arguments are truncated
+#define LOG_BIN_SYNC_INTERVAL 64   // send absolute time every N records, decoder can join any time
+#define LOG_BIN_FRAME_MAX     (LOG_BIN_PAYLOAD_MAX + 3) // magic + len + payload + checksum
+#endif
+
 typedef struct {
     LIST_HEAD node;
     char *name;
     TAL_LOG_OUTPUT_CB out_term;
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+    BOOL_T binary; // receive binary record instead of text
+#endif
 } LOG_OUT_NODE_S;
 
 typedef struct {
@@ -61,6 +96,37 @@ typedef struct {
     LOG_TEXT_STYLE_S style[LOG_LEVEL_MAX + 1];
 } LOG_COLOR_S;
 
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+typedef struct {
+    uint32_t size; // record size include header, LOG_ASYNC_WRAP means skip to ring start
+    uint32_t line;
+    const char *file;
+    SYS_TICK_T time_ms;
+    uint8_t level;
+    uint8_t raw; // raw print, no prefix and suffix
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+    uint8_t binary; // msg is a binary frame for binary terminals
+#endif
+    char msg[0];
+} LOG_ASYNC_REC_S;
+
+typedef struct {
+    MUTEX_HANDLE mutex; // only protect the ring, never held during output
+    SEM_HANDLE sem;
+    THREAD_HANDLE thread;
+    volatile BOOL_T exited;
+
+    uint32_t dropped;  // records dropped because ring is full
+    uint32_t reported; // dropped records which have been reported
+
+    uint32_t size;
+    uint32_t rd;
+    uint32_t wr;
+    uint32_t used;
+    uint8_t *buf;
+} LOG_ASYNC_S;
+#endif
+
 typedef struct {
     LOG_LEVEL curLogLevel;
     LIST_HEAD listHead;
@@ -72,6 +138,16 @@ typedef struct {
     int log_buf_len;
     BOOL_T ms_level;
     char *log_buf;
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    LOG_ASYNC_S *async;
+#endif
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+    uint16_t text_term_cnt;
+    uint16_t bin_term_cnt;
+    uint32_t bin_seq;
+    SYS_TICK_T bin_last_ms;
+    uint8_t bin_frame[LOG_BIN_FRAME_MAX];
+#endif
 } LOG_MANAGE, *P_LOG_MANAGE;
 
 #define DEF_OUTPUT_NAME "def_output"
@@ -134,6 +210,15 @@ OPERATE_RET tal_log_init(const TAL_LOG_LEVEL_E level, const int buf_len, const T
         INIT_LIST_HEAD(&(tmp_log_mng->log_list));
         tmp_log_mng->curLogLevel = level;
         tmp_log_mng->ms_level = FALSE;
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+        tmp_log_mng->async = NULL;
+#endif
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+        tmp_log_mng->text_term_cnt = 0;
+        tmp_log_mng->bin_term_cnt = 0;
+        tmp_log_mng->bin_seq = 0;
+        tmp_log_mng->bin_last_ms = 0;
+#endif
         pLogManage = tmp_log_mng;
 
         // set default log style
@@ -146,6 +231,13 @@ OPERATE_RET tal_log_init(const TAL_LOG_LEVEL_E level, const int buf_len, const T
             tal_free(tmp_log_mng);
             return op_ret;
         }
+
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+        // keep output synchronously if async log start failed
+        if (OPRT_OK != tal_log_async_start(LOG_ASYNC_BUF_SIZE)) {
+            PR_ERR("async log start failed");
+        }
+#endif
     } else {
         pLogManage->curLogLevel = level;
     }
@@ -160,12 +252,37 @@ void __output_logManage_buf(void)
     tuya_list_for_each(pPos, &(pLogManage->log_list))
     {
         output_node = tuya_list_entry(pPos, LOG_OUT_NODE_S, node);
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+        if (output_node->binary) {
+            continue;
+        }
+#endif
         if (output_node->out_term) {
             output_node->out_term(pLogManage->log_buf);
         }
     }
 }
 
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+static void __log_term_count_refresh(void)
+{
+    P_LIST_HEAD pPos;
+    LOG_OUT_NODE_S *output_node;
+
+    pLogManage->text_term_cnt = 0;
+    pLogManage->bin_term_cnt = 0;
+    tuya_list_for_each(pPos, &(pLogManage->log_list))
+    {
+        output_node = tuya_list_entry(pPos, LOG_OUT_NODE_S, node);
+        if (output_node->binary) {
+            pLogManage->bin_term_cnt++;
+        } else {
+            pLogManage->text_term_cnt++;
+        }
+    }
+}
+#endif
+
 OPERATE_RET __find_out_term_node(const char *name, LOG_OUT_NODE_S **node)
 {
     P_LIST_HEAD pPos;
@@ -183,21 +300,8 @@ OPERATE_RET __find_out_term_node(const char *name, LOG_OUT_NODE_S **node)
     return OPRT_COM_ERROR;
 }
 
-/**
- * @brief Adds an output terminal for logging.
- *
- * This function adds an output terminal for logging with the specified name and
- * callback function.
- *
- * @param[in] name The name of the output terminal.
- * @param[in] term The callback function for the output terminal.
- *
- * @return The result of the operation.
- *     - OPRT_OK: Operation successful.
- *     - OPRT_INVALID_PARM: Invalid parameter.
- *     - OPRT_MALLOC_FAILED: Memory allocation failed.
- */
-OPERATE_RET tal_log_add_output_term(const char *name, const TAL_LOG_OUTPUT_CB term)
+/* add or update the terminal, binary terminals receive binary record */
+static OPERATE_RET __log_add_term(const char *name, const TAL_LOG_OUTPUT_CB term, BOOL_T binary)
 {
     if (NULL == name || NULL == term || NULL == pLogManage) {
         return OPRT_INVALID_PARM;
@@ -207,6 +311,10 @@ OPERATE_RET tal_log_add_output_term(const char *name, const TAL_LOG_OUTPUT_CB te
     OPERATE_RET ret = __find_out_term_node(name, &output_node);
     if (ret == OPRT_OK) {
         output_node->out_term = term;
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+        output_node->binary = binary;
+        __log_term_count_refresh();
+#endif
         return OPRT_OK;
     }
 
@@ -221,11 +329,58 @@ OPERATE_RET tal_log_add_output_term(const char *name, const TAL_LOG_OUTPUT_CB te
     }
     strcpy(output_node->name, name);
     output_node->out_term = term;
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+    output_node->binary = binary;
+#endif
     tuya_list_add(&(output_node->node), &(pLogManage->log_list));
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+    __log_term_count_refresh();
+#endif
 
     return OPRT_OK;
 }
 
+/**
+ * @brief Adds an output terminal for logging.
+ *
+ * This function adds an output terminal for logging with the specified name and
+ * callback function.
+ *
+ * @param[in] name The name of the output terminal.
+ * @param[in] term The callback function for the output terminal.
+ *
+ * @return The result of the operation.
+ *     - OPRT_OK: Operation successful.
+ *     - OPRT_INVALID_PARM: Invalid parameter.
+ *     - OPRT_MALLOC_FAILED: Memory allocation failed.
+ */
+OPERATE_RET tal_log_add_output_term(const char *name, const TAL_LOG_OUTPUT_CB term)
+{
+    return __log_add_term(name, term, FALSE);
+}
+
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+/**
+ * @brief Adds a binary output terminal for logging.
+ *
+ * The terminal receives one binary frame per log record instead of the text,
+ * the frame length is got by TAL_LOG_BINARY_FRAME_LEN. Raw prints are not
+ * sent to binary terminals.
+ *
+ * @param[in] name The name of the output terminal.
+ * @param[in] term The callback function for the output terminal.
+ *
+ * @return The result of the operation.
+ *     - OPRT_OK: Operation successful.
+ *     - OPRT_INVALID_PARM: Invalid parameter.
+ *     - OPRT_MALLOC_FAILED: Memory allocation failed.
+ */
+OPERATE_RET tal_log_add_binary_term(const char *name, const TAL_LOG_OUTPUT_CB term)
+{
+    return __log_add_term(name, term, TRUE);
+}
+#endif
+
 static int tal_log_strrchr(char *str, char ch)
 {
     char *ta;
@@ -263,6 +418,9 @@ void tal_log_del_output_term(const char *name)
         tuya_list_del(&(output_node->node));
         tal_free(output_node->name);
         tal_free(output_node);
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+        __log_term_count_refresh();
+#endif
     }
     tal_mutex_unlock(pLogManage->mutex);
     return;
@@ -336,67 +494,31 @@ OPERATE_RET tal_log_get_level(TAL_LOG_LEVEL_E *level)
     return OPRT_OK;
 }
 
-/**
- * @brief Prints a log message with the specified log level, file name, line
- * number, and format string.
- *
- * This function is used to print log messages with different log levels. It
- * takes the log level, file name, line number, format string, and a variable
- * argument list as parameters. The log level determines the severity of the log
- * message. The file name and line number indicate the location where the log
- * message is printed. The format string specifies the format of the log
- * message, and the variable argument list contains the values to be formatted
- * and printed.
- *
- * @param logLevel The log level of the message.
- * @param pFile The name of the source file where the log message is printed.
- * @param line The line number in the source file where the log message is
- * printed.
- * @param pFmt The format string for the log message.
- * @param ap The variable argument list for the format string.
- * @return The result of the log printing operation.
- *     - OPRT_OK if the log message was printed successfully.
- *     - OPRT_INVALID_PARM if the log level is invalid or the log manager is not
- * initialized.
- *     - OPRT_BASE_LOG_MNG_PRINT_LOG_LEVEL_HIGHER if the log level is higher
- * than the current log level.
- *     - OPRT_BASE_LOG_MNG_FORMAT_STRING_FAILED if there was an error formatting
- * the log message.
- */
-OPERATE_RET PrintLogV(LOG_LEVEL logLevel, char *pFile, uint32_t line, char *pFmt, va_list ap)
+static const char *__log_file_name(const char *pFile)
 {
-    int len = 0;
-    int cnt = 0;
+    int pos = 0;
 
-    if (!pLogManage) {
-        return OPRT_INVALID_PARM;
-    }
-    if (logLevel < LOG_LEVEL_MIN || logLevel > LOG_LEVEL_MAX) {
-        return OPRT_INVALID_PARM;
-    }
-    LOG_LEVEL tmpLogLevel = pLogManage->curLogLevel;
-    if (logLevel > tmpLogLevel) {
-        return OPRT_BASE_LOG_MNG_PRINT_LOG_LEVEL_HIGHER;
+    if (NULL == pFile) {
+        return "Null";
     }
-    const char *pTmpModuleName = "ty";
-    const char *pTmpFilename = NULL;
 
-    if (NULL == pFile) {
-        pTmpFilename = "Null";
-    } else {
-        int pos = 0;
-        pTmpFilename = pFile;
-        pos = tal_log_strrchr((char *)pFile, '/');
-        if (pos < 0) {
-            pos = tal_log_strrchr((char *)pFile, '\\');
-            if (pos >= 0) {
-                pTmpFilename = pFile + pos + 1;
-            }
-        } else {
-            pTmpFilename = pFile + pos + 1;
-        }
+    pos = tal_log_strrchr((char *)pFile, '/');
+    if (pos < 0) {
+        pos = tal_log_strrchr((char *)pFile, '\\');
     }
-    tal_mutex_lock(pLogManage->mutex);
+
+    return (pos >= 0) ? (pFile + pos + 1) : pFile;
+}
+
+/* format prefix and message into log_buf and output, need hold pLogManage->mutex.
+ * time_ms 0 means current time */
+static OPERATE_RET __log_output_v(LOG_LEVEL logLevel, const char *pFile, uint32_t line, SYS_TICK_T time_ms,
+                                  const char *pFmt, va_list ap)
+{
+    int len = 0;
+    int cnt = 0;
+    const char *pTmpModuleName = "ty";
+    const char *pTmpFilename = __log_file_name(pFile);
 
     // color prefix
     if (pLogManage->log_color.enable_color) {
@@ -405,7 +527,7 @@ OPERATE_RET PrintLogV(LOG_LEVEL logLevel, char *pFile, uint32_t line, char *pFmt
                        pLogManage->log_color.style[logLevel].font_color,
                        pLogManage->log_color.style[logLevel].background_color);
         if (cnt <= 0) {
-            goto ERR_EXIT;
+            return OPRT_BASE_LOG_MNG_FORMAT_STRING_FAILED;
         }
         len += cnt;
     }
@@ -414,26 +536,28 @@ OPERATE_RET PrintLogV(LOG_LEVEL logLevel, char *pFile, uint32_t line, char *pFmt
     memset(&tm, 0, sizeof(tm));
 
     if (pLogManage->ms_level == FALSE) {
-        tal_time_get_local_time_custom(0, &tm);
+        tal_time_get_local_time_custom((TIME_T)(time_ms / 1000), &tm);
         cnt = snprintf(pLogManage->log_buf + len, pLogManage->log_buf_len - len,
                        "[%02d-%02d %02d:%02d:%02d %s %s][%s:%d] ", tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
                        tm.tm_sec, pTmpModuleName, sLevelStr[logLevel], pTmpFilename, line);
     } else {
-        SYS_TICK_T time_ms = tal_time_get_posix_ms();
+        if (0 == time_ms) {
+            time_ms = tal_time_get_posix_ms();
+        }
         TIME_T sec = (TIME_T)(time_ms / 1000);
         uint32_t ms = (uint32_t)(time_ms % 1000);
         tal_time_get_local_time_custom(sec, &tm);
-        cnt = snprintf(pLogManage->log_buf + len, pLogManage->log_buf_len + len,
+        cnt = snprintf(pLogManage->log_buf + len, pLogManage->log_buf_len - len,
                        "[%02d-%02d %02d:%02d:%02d:%d %s %s][%s:%d] ", tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
                        tm.tm_sec, ms, pTmpModuleName, sLevelStr[logLevel], pTmpFilename, line);
     }
     if (cnt <= 0) {
-        goto ERR_EXIT;
+        return OPRT_BASE_LOG_MNG_FORMAT_STRING_FAILED;
     }
     len += cnt;
     cnt = vsnprintf(pLogManage->log_buf + len, pLogManage->log_buf_len - len, pFmt, ap);
     if (cnt <= 0) {
-        goto ERR_EXIT;
+        return OPRT_BASE_LOG_MNG_FORMAT_STRING_FAILED;
     }
     len += cnt;
 
@@ -443,19 +567,771 @@ OPERATE_RET PrintLogV(LOG_LEVEL logLevel, char *pFile, uint32_t line, char *pFmt
     }
     cnt = snprintf(pLogManage->log_buf + len, pLogManage->log_buf_len - len, "%s", p_suffix);
     if (cnt <= 0) {
-        goto ERR_EXIT;
+        return OPRT_BASE_LOG_MNG_FORMAT_STRING_FAILED;
     }
     len += cnt;
     pLogManage->log_buf[len] = '\0';
 
     __output_logManage_buf();
-    tal_mutex_unlock(pLogManage->mutex);
+
+    return OPRT_OK;
+}
+
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+typedef struct {
+    uint8_t *buf;
+    uint32_t len;
+    uint32_t size;
+    BOOL_T trunc;
+} LOG_BIN_WRITER_S;
+
+typedef enum {
+    LOG_BIN_LEN_INT,
+    LOG_BIN_LEN_LONG,
+    LOG_BIN_LEN_LLONG,
+    LOG_BIN_LEN_SIZE,
+    LOG_BIN_LEN_INTMAX,
+    LOG_BIN_LEN_PTRDIFF,
+    LOG_BIN_LEN_LDOUBLE,
+} LOG_BIN_LEN_E;
+
+/* FNV-1a of the format string, same as tools/log_decoder/log_fmt_table.py */
+static uint32_t __log_fmt_id(const char *pFmt)
+{
+    uint32_t hash = 0x811C9DC5;
+
+    while (*pFmt) {
+        hash ^= (uint8_t)*pFmt++;
+        hash *= 0x01000193;
+    }
+
+    return hash;
+}
+
+/* same format may be used in many files, the record carries the file too,
+ * FNV-1a of the file base name folded to 16 bits */
+static uint16_t __log_file_id(const char *pFile)
+{
+    uint32_t hash = __log_fmt_id(__log_file_name(pFile));
+
+    return (uint16_t)((hash >> 16) ^ hash);
+}
+
+static BOOL_T __log_bin_put(LOG_BIN_WRITER_S *w, const uint8_t *data, uint32_t len)
+{
+    if (w->trunc || w->len + len > w->size) {
+        w->trunc = TRUE;
+        return FALSE;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+
+    return TRUE;
+}
+
+static BOOL_T __log_bin_put_varint(LOG_BIN_WRITER_S *w, uint64_t value)
+{
+    uint8_t tmp[10];
+    uint32_t len = 0;
+
+    do {
+        tmp[len] = value & 0x7F;
+        value >>= 7;
+        if (value) {
+            tmp[len] |= 0x80;
+        }
+        len++;
+    } while (value);
+
+    return __log_bin_put(w, tmp, len);
+}
+
+/* zigzag, small negative numbers keep short */
+static BOOL_T __log_bin_put_sint(LOG_BIN_WRITER_S *w, int64_t value)
+{
+    return __log_bin_put_varint(w, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static BOOL_T __log_bin_put_double(LOG_BIN_WRITER_S *w, double value)
+{
+    uint8_t tmp[8];
+    uint64_t bits = 0;
+    uint32_t i = 0;
+
+    memcpy(&bits, &value, sizeof(bits));
+    for (i = 0; i < sizeof(tmp); i++) {
+        tmp[i] = (uint8_t)(bits >> (i * 8));
+    }
+
+    return __log_bin_put(w, tmp, sizeof(tmp));
+}
+
+static BOOL_T __log_bin_put_str(LOG_BIN_WRITER_S *w, const char *str)
+{
+    uint32_t len = 0;
+
+    if (NULL == str) {
+        str = "(null)";
+    }
+    len = strlen(str);
+    if (len > LOG_BIN_STR_MAX) {
+        len = LOG_BIN_STR_MAX;
+    }
+    // keep the head of a long string rather than dropping it
+    if (w->len + 1 + len > w->size && w->len + 1 < w->size) {
+        len = w->size - w->len - 1;
+        __log_bin_put_varint(w, len);
+        __log_bin_put(w, (const uint8_t *)str, len);
+        w->trunc = TRUE;
+        return FALSE;
+    }
+
+    return __log_bin_put_varint(w, len) && __log_bin_put(w, (const uint8_t *)str, len);
+}
+
+/* pack the arguments in the order of the conversions, stop at the first
+ * unknown conversion since the argument types after it are unknown */
+static void __log_bin_put_args(LOG_BIN_WRITER_S *w, const char *pFmt, va_list ap)
+{
+    const char *p = pFmt;
+    LOG_BIN_LEN_E len_mod = LOG_BIN_LEN_INT;
+    int64_t sval = 0;
+    uint64_t uval = 0;
+    va_list aq;
+
+    va_copy(aq, ap);
+    while (*p && !w->trunc) {
+        if (*p++ != '%') {
+            continue;
+        }
+        if (*p == '%') {
+            p++;
+            continue;
+        }
+
+        while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+            p++;
+        }
+        if (*p == '*') {
+            __log_bin_put_sint(w, va_arg(aq, int));
+            p++;
+        }
+        while (*p >= '0' && *p <= '9') {
+            p++;
+        }
+        if (*p == '.') {
+            p++;
+            if (*p == '*') {
+                __log_bin_put_sint(w, va_arg(aq, int));
+                p++;
+            }
+            while (*p >= '0' && *p <= '9') {
+                p++;
+            }
+        }
+
+        len_mod = LOG_BIN_LEN_INT;
+        switch (*p) {
+        case 'h':
+            p += (p[1] == 'h') ? 2 : 1; // promoted to int
+            break;
+        case 'l':
+            len_mod = (p[1] == 'l') ? LOG_BIN_LEN_LLONG : LOG_BIN_LEN_LONG;
+            p += (p[1] == 'l') ? 2 : 1;
+            break;
+        case 'z':
+            len_mod = LOG_BIN_LEN_SIZE;
+            p++;
+            break;
+        case 'j':
+            len_mod = LOG_BIN_LEN_INTMAX;
+            p++;
+            break;
+        case 't':
+            len_mod = LOG_BIN_LEN_PTRDIFF;
+            p++;
+            break;
+        case 'L':
+            len_mod = LOG_BIN_LEN_LDOUBLE;
+            p++;
+            break;
+        default:
+            break;
+        }
+
+        switch (*p++) {
+        case 'd':
+        case 'i':
+            switch (len_mod) {
+            case LOG_BIN_LEN_LONG:
+                sval = va_arg(aq, long);
+                break;
+            case LOG_BIN_LEN_LLONG:
+                sval = va_arg(aq, long long);
+                break;
+            case LOG_BIN_LEN_SIZE:
+                sval = (int64_t)va_arg(aq, size_t);
+                break;
+            case LOG_BIN_LEN_INTMAX:
+                sval = va_arg(aq, intmax_t);
+                break;
+            case LOG_BIN_LEN_PTRDIFF:
+                sval = va_arg(aq, ptrdiff_t);
+                break;
+            default:
+                sval = va_arg(aq, int);
+                break;
+            }
+            __log_bin_put_sint(w, sval);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+        case 'c':
+            switch (len_mod) {
+            case LOG_BIN_LEN_LONG:
+                uval = va_arg(aq, unsigned long);
+                break;
+            case LOG_BIN_LEN_LLONG:
+                uval = va_arg(aq, unsigned long long);
+                break;
+            case LOG_BIN_LEN_SIZE:
+                uval = va_arg(aq, size_t);
+                break;
+            case LOG_BIN_LEN_INTMAX:
+                uval = va_arg(aq, uintmax_t);
+                break;
+            case LOG_BIN_LEN_PTRDIFF:
+                uval = (uint64_t)va_arg(aq, ptrdiff_t);
+                break;
+            default:
+                uval = va_arg(aq, unsigned int);
+                break;
+            }
+            __log_bin_put_varint(w, uval);
+            break;
+        case 'p':
+            __log_bin_put_varint(w, (uintptr_t)va_arg(aq, void *));
+            break;
+        case 's':
+            __log_bin_put_str(w, va_arg(aq, const char *));
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            if (LOG_BIN_LEN_LDOUBLE == len_mod) {
+                __log_bin_put_double(w, (double)va_arg(aq, long double));
+            } else {
+                __log_bin_put_double(w, va_arg(aq, double));
+            }
+            break;
+        case 'n':
+            (void)va_arg(aq, void *);
+            break;
+        default:
+            w->trunc = TRUE;
+            break;
+        }
+    }
+    va_end(aq);
+}
+
+/* encode one record into frame of LOG_BIN_FRAME_MAX bytes, return the frame length. The time
+ * delta is kept in pLogManage, need hold pLogManage->mutex, or async->mutex in async mode
+ * frame: magic(1) len(1) payload(len) xor of payload(1)
+ * payload: level|flags(1) fmt_id(4, LE) file_id(2, LE) line(varint) time(varint) args... */
+static uint32_t __log_binary_encode(uint8_t *frame, LOG_LEVEL logLevel, const char *pFile, uint32_t line,
+                                    const char *pFmt, va_list ap)
+{
+    LOG_BIN_WRITER_S w = {.buf = frame + 2, .len = 0, .size = LOG_BIN_PAYLOAD_MAX, .trunc = FALSE};
+    SYS_TICK_T now = tal_time_get_posix_ms();
+    uint32_t fmt_id = __log_fmt_id(pFmt);
+    uint16_t file_id = __log_file_id(pFile);
+    uint8_t head[7];
+    uint8_t checksum = 0;
+    uint32_t i = 0;
+
+    head[0] = (uint8_t)logLevel;
+    if (0 == (pLogManage->bin_seq++ % LOG_BIN_SYNC_INTERVAL) || now < pLogManage->bin_last_ms) {
+        head[0] |= LOG_BIN_FLAG_TIME_ABS;
+    }
+    for (i = 0; i < 4; i++) {
+        head[i + 1] = (uint8_t)(fmt_id >> (i * 8));
+    }
+    head[5] = (uint8_t)file_id;
+    head[6] = (uint8_t)(file_id >> 8);
+    __log_bin_put(&w, head, sizeof(head));
+    __log_bin_put_varint(&w, line);
+    __log_bin_put_varint(&w, (head[0] & LOG_BIN_FLAG_TIME_ABS) ? now : (now - pLogManage->bin_last_ms));
+    pLogManage->bin_last_ms = now;
+
+    __log_bin_put_args(&w, pFmt, ap);
+    if (w.trunc) {
+        w.buf[0] |= LOG_BIN_FLAG_TRUNC;
+    }
+
+    for (i = 0; i < w.len; i++) {
+        checksum ^= w.buf[i];
+    }
+    frame[0] = LOG_BIN_MAGIC;
+    frame[1] = (uint8_t)w.len;
+    frame[2 + w.len] = checksum;
+
+    return w.len + 3;
+}
+
+/* output the frame to binary terminals, need hold pLogManage->mutex */
+static void __log_binary_term_output(const uint8_t *frame)
+{
+    P_LIST_HEAD pPos;
+    LOG_OUT_NODE_S *output_node;
+
+    tuya_list_for_each(pPos, &(pLogManage->log_list))
+    {
+        output_node = tuya_list_entry(pPos, LOG_OUT_NODE_S, node);
+        if (output_node->binary && output_node->out_term) {
+            output_node->out_term((const char *)frame);
+        }
+    }
+}
+#endif
+
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+static OPERATE_RET __log_output(LOG_LEVEL logLevel, const char *pFile, uint32_t line, SYS_TICK_T time_ms,
+                                const char *pFmt, ...)
+{
+    OPERATE_RET opRet = OPRT_OK;
+    va_list ap;
+
+    va_start(ap, pFmt);
+    opRet = __log_output_v(logLevel, pFile, line, time_ms, pFmt, ap);
+    va_end(ap);
+
+    return opRet;
+}
+
+/* free room is [wr, size) and [0, rd), wrap is worth if the ring start is larger */
+static BOOL_T __log_async_can_wrap(LOG_ASYNC_S *async)
+{
+    return (async->wr >= async->rd && async->used < async->size && async->rd > async->size - async->wr);
+}
+
+/* skip the tail room and wrap to the ring start, need hold async->mutex */
+static void __log_async_wrap(LOG_ASYNC_S *async)
+{
+    uint32_t tail_room = async->size - async->wr;
+
+    if (tail_room >= sizeof(LOG_ASYNC_REC_S)) {
+        ((LOG_ASYNC_REC_S *)(async->buf + async->wr))->size = LOG_ASYNC_WRAP;
+    }
+    async->used += tail_room;
+    async->wr = 0;
+}
+
+/* get contiguous free room from the ring, need hold async->mutex */
+static LOG_ASYNC_REC_S *__log_async_reserve(LOG_ASYNC_S *async, uint32_t *room)
+{
+    if (0 == async->used) {
+        async->rd = async->wr = 0;
+    }
+
+    if (__log_async_can_wrap(async) && async->size - async->wr < LOG_ASYNC_MIN_SPACE) {
+        __log_async_wrap(async);
+    }
+
+    if (async->wr >= async->rd && async->used < async->size) {
+        *room = async->size - async->wr;
+    } else {
+        *room = async->rd - async->wr;
+    }
+
+    if (*room < sizeof(LOG_ASYNC_REC_S) + 2) { // at least 1 char and "\0"
+        return NULL;
+    }
+
+    return (LOG_ASYNC_REC_S *)(async->buf + async->wr);
+}
+
+/* get the oldest record, need hold async->mutex */
+static LOG_ASYNC_REC_S *__log_async_peek(LOG_ASYNC_S *async)
+{
+    LOG_ASYNC_REC_S *rec = NULL;
+
+    while (async->used) {
+        rec = (LOG_ASYNC_REC_S *)(async->buf + async->rd);
+        if ((async->size - async->rd) >= sizeof(LOG_ASYNC_REC_S) && rec->size != LOG_ASYNC_WRAP) {
+            return rec;
+        }
+
+        // skipped by producer, wrap to the ring start
+        async->used -= async->size - async->rd;
+        async->rd = 0;
+    }
+
+    return NULL;
+}
+
+/* the record is written, hand it to the log thread, need hold async->mutex */
+static void __log_async_commit(LOG_ASYNC_S *async, LOG_ASYNC_REC_S *rec)
+{
+    async->wr += rec->size;
+    async->used += rec->size;
+    if (async->wr >= async->size) {
+        async->wr = 0;
+    }
+}
+
+/* copy the message into ring, never block on output */
+static OPERATE_RET __log_async_push(LOG_LEVEL logLevel, const char *pFile, uint32_t line, BOOL_T raw,
+                                    const char *pFmt, va_list ap)
+{
+    LOG_ASYNC_S *async = pLogManage->async;
+    LOG_ASYNC_REC_S *rec = NULL;
+    SYS_TICK_T time_ms = raw ? 0 : tal_time_get_posix_ms();
+    uint32_t room = 0;
+    int cnt = 0;
+    va_list aq;
+
+    tal_mutex_lock(async->mutex);
+
+    rec = __log_async_reserve(async, &room);
+    if (NULL == rec) {
+        async->dropped++;
+        tal_mutex_unlock(async->mutex);
+        return OPRT_EXCEED_UPPER_LIMIT;
+    }
+
+    room -= sizeof(LOG_ASYNC_REC_S);
+    if (room > (uint32_t)pLogManage->log_buf_len) {
+        room = pLogManage->log_buf_len;
+    }
+    va_copy(aq, ap);
+    cnt = vsnprintf(rec->msg, room, pFmt, aq);
+    va_end(aq);
+    if (cnt > 0 && (uint32_t)cnt >= room && __log_async_can_wrap(async)) {
+        // not fit in the tail room, format again at the ring start
+        __log_async_wrap(async);
+        rec = __log_async_reserve(async, &room);
+        room -= sizeof(LOG_ASYNC_REC_S);
+        if (room > (uint32_t)pLogManage->log_buf_len) {
+            room = pLogManage->log_buf_len;
+        }
+        cnt = vsnprintf(rec->msg, room, pFmt, ap);
+    }
+    if (cnt <= 0) {
+        tal_mutex_unlock(async->mutex);
+        return OPRT_BASE_LOG_MNG_FORMAT_STRING_FAILED;
+    }
+    if ((uint32_t)cnt >= room) {
+        if (room < (uint32_t)pLogManage->log_buf_len) {
+            // ring is short of room, drop it rather than output a truncated record
+            async->dropped++;
+            tal_mutex_unlock(async->mutex);
+            return OPRT_EXCEED_UPPER_LIMIT;
+        }
+        cnt = room - 1; // truncated to log buffer length like synchronous output
+    }
+
+    rec->size = LOG_ASYNC_ALIGN(sizeof(LOG_ASYNC_REC_S) + cnt + 1);
+    rec->line = line;
+    rec->file = pFile;
+    rec->time_ms = time_ms;
+    rec->level = logLevel;
+    rec->raw = raw;
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+    rec->binary = FALSE;
+#endif
+    __log_async_commit(async, rec);
+
+    tal_mutex_unlock(async->mutex);
+    tal_semaphore_post(async->sem);
+
+    return OPRT_OK;
+}
+
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+/* encode the binary frame into ring, the binary terminals are called by the log thread too */
+static OPERATE_RET __log_async_push_binary(LOG_LEVEL logLevel, const char *pFile, uint32_t line,
+                                           const char *pFmt, va_list ap)
+{
+    LOG_ASYNC_S *async = pLogManage->async;
+    LOG_ASYNC_REC_S *rec = NULL;
+    uint32_t room = 0;
+    uint32_t len = 0;
+
+    tal_mutex_lock(async->mutex);
+
+    rec = __log_async_reserve(async, &room);
+    if (rec && room < sizeof(LOG_ASYNC_REC_S) + LOG_BIN_FRAME_MAX && __log_async_can_wrap(async)) {
+        __log_async_wrap(async);
+        rec = __log_async_reserve(async, &room);
+    }
+    if (NULL == rec || room < sizeof(LOG_ASYNC_REC_S) + LOG_BIN_FRAME_MAX) {
+        async->dropped++;
+        tal_mutex_unlock(async->mutex);
+        return OPRT_EXCEED_UPPER_LIMIT;
+    }
+
+    len = __log_binary_encode((uint8_t *)rec->msg, logLevel, pFile, line, pFmt, ap);
+    rec->size = LOG_ASYNC_ALIGN(sizeof(LOG_ASYNC_REC_S) + len);
+    rec->line = line;
+    rec->file = pFile;
+    rec->time_ms = 0;
+    rec->level = logLevel;
+    rec->raw = FALSE;
+    rec->binary = TRUE;
+    __log_async_commit(async, rec);
+
+    tal_mutex_unlock(async->mutex);
+    tal_semaphore_post(async->sem);
+
+    return OPRT_OK;
+}
+#endif
+
+static void __log_async_thread_cb(void *args)
+{
+    LOG_ASYNC_S *async = (LOG_ASYNC_S *)args;
+    LOG_ASYNC_REC_S *rec = NULL;
+    uint32_t dropped = 0;
+
+    while (THREAD_STATE_RUNNING == tal_thread_get_state(async->thread)) {
+        tal_semaphore_wait(async->sem, SEM_WAIT_FOREVER);
+
+        for (;;) {
+            tal_mutex_lock(async->mutex);
+            rec = __log_async_peek(async);
+            tal_mutex_unlock(async->mutex);
+            if (NULL == rec) {
+                break;
+            }
+
+            // producers never touch the record before it is released
+            tal_mutex_lock(pLogManage->mutex);
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+            if (rec->binary) {
+                __log_binary_term_output((const uint8_t *)rec->msg);
+            } else
+#endif
+            if (rec->raw) {
+                snprintf(pLogManage->log_buf, pLogManage->log_buf_len, "%s", rec->msg);
+                __output_logManage_buf();
+            } else {
+                __log_output(rec->level, rec->file, rec->line, rec->time_ms, "%s", rec->msg);
+            }
+            tal_mutex_unlock(pLogManage->mutex);
+
+            tal_mutex_lock(async->mutex);
+            async->rd += rec->size;
+            async->used -= rec->size;
+            if (async->rd >= async->size) {
+                async->rd = 0;
+            }
+            dropped = async->dropped;
+            tal_mutex_unlock(async->mutex);
+        }
+
+        if (dropped != async->reported) {
+            tal_mutex_lock(pLogManage->mutex);
+            __log_output(TAL_LOG_LEVEL_WARN, __FILE__, __LINE__, 0, "async log dropped %u records",
+                         dropped - async->reported);
+            tal_mutex_unlock(pLogManage->mutex);
+            async->reported = dropped;
+        }
+    }
+
+    async->exited = TRUE;
+}
+
+/**
+ * @brief Starts the asynchronous log output.
+ *
+ * After started, log callers only format the message into a ring buffer and
+ * return, a low priority thread adds the prefix and writes it to the output
+ * terminals. Records are dropped and counted when the ring buffer is full.
+ *
+ * @param[in] buf_size The size of the ring buffer.
+ *
+ * @return OPRT_OK on success. Others on error, please refer to
+ * tuya_error_code.h
+ */
+OPERATE_RET tal_log_async_start(const int buf_size)
+{
+    OPERATE_RET op_ret = OPRT_OK;
+    LOG_ASYNC_S *async = NULL;
+
+    if (NULL == pLogManage || buf_size < LOG_ASYNC_MIN_SPACE) {
+        return OPRT_INVALID_PARM;
+    }
+
+    if (pLogManage->async) {
+        return OPRT_OK;
+    }
+
+    async = (LOG_ASYNC_S *)tal_malloc(sizeof(LOG_ASYNC_S) + buf_size);
+    if (NULL == async) {
+        return OPRT_MALLOC_FAILED;
+    }
+    memset(async, 0, sizeof(LOG_ASYNC_S));
+    async->size = buf_size & ~7;
+    async->buf = (uint8_t *)LOG_ASYNC_ALIGN((uintptr_t)(async + 1));
+    if (async->buf + async->size > (uint8_t *)(async + 1) + buf_size) {
+        async->size -= 8;
+    }
+
+    op_ret = tal_mutex_create_init(&async->mutex);
+    if (OPRT_OK != op_ret) {
+        goto __EXIT;
+    }
+    op_ret = tal_semaphore_create_init(&async->sem, 0, 0xFFFF);
+    if (OPRT_OK != op_ret) {
+        goto __EXIT;
+    }
+
+    THREAD_CFG_T thread_cfg = {.stackDepth = STACK_SIZE_LOG_ASYNC, .priority = THREAD_PRIO_6, .thrdname = "log_async"};
+    op_ret = tal_thread_create_and_start(&async->thread, NULL, NULL, __log_async_thread_cb, async, &thread_cfg);
+    if (OPRT_OK != op_ret) {
+        goto __EXIT;
+    }
+
+    pLogManage->async = async;
 
     return OPRT_OK;
 
-ERR_EXIT:
+__EXIT:
+    if (async->sem) {
+        tal_semaphore_release(async->sem);
+    }
+    if (async->mutex) {
+        tal_mutex_release(async->mutex);
+    }
+    tal_free(async);
+
+    return op_ret;
+}
+
+/**
+ * @brief Gets the number of log records dropped by the asynchronous log.
+ *
+ * @return the dropped record count.
+ */
+uint32_t tal_log_async_get_dropped(void)
+{
+    if (NULL == pLogManage || NULL == pLogManage->async) {
+        return 0;
+    }
+
+    return pLogManage->async->dropped;
+}
+
+static void __log_async_stop(void)
+{
+    LOG_ASYNC_S *async = pLogManage->async;
+
+    if (NULL == async) {
+        return;
+    }
+
+    tal_thread_delete(async->thread);
+    tal_semaphore_post(async->sem);
+    while (!async->exited) {
+        tal_system_sleep(10);
+    }
+
+    pLogManage->async = NULL;
+    tal_semaphore_release(async->sem);
+    tal_mutex_release(async->mutex);
+    tal_free(async);
+}
+#endif
+
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+/* binary record of the log, in the ring like the text in async mode */
+static void __log_binary_print(LOG_LEVEL logLevel, const char *pFile, uint32_t line, const char *pFmt, va_list ap)
+{
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    if (pLogManage->async) {
+        __log_async_push_binary(logLevel, pFile, line, pFmt, ap);
+        return;
+    }
+#endif
+    tal_mutex_lock(pLogManage->mutex);
+    __log_binary_encode(pLogManage->bin_frame, logLevel, pFile, line, pFmt, ap);
+    __log_binary_term_output(pLogManage->bin_frame);
     tal_mutex_unlock(pLogManage->mutex);
-    return OPRT_BASE_LOG_MNG_FORMAT_STRING_FAILED;
+}
+#endif
+
+/**
+ * @brief Prints a log message with the specified log level, file name, line
+ * number, and format string.
+ *
+ * This function is used to print log messages with different log levels. It
+ * takes the log level, file name, line number, format string, and a variable
+ * argument list as parameters. The log level determines the severity of the log
+ * message. The file name and line number indicate the location where the log
+ * message is printed. The format string specifies the format of the log
+ * message, and the variable argument list contains the values to be formatted
+ * and printed.
+ *
+ * @param logLevel The log level of the message.
+ * @param pFile The name of the source file where the log message is printed.
+ * @param line The line number in the source file where the log message is
+ * printed.
+ * @param pFmt The format string for the log message.
+ * @param ap The variable argument list for the format string.
+ * @return The result of the log printing operation.
+ *     - OPRT_OK if the log message was printed successfully.
+ *     - OPRT_INVALID_PARM if the log level is invalid or the log manager is not
+ * initialized.
+ *     - OPRT_BASE_LOG_MNG_PRINT_LOG_LEVEL_HIGHER if the log level is higher
+ * than the current log level.
+ *     - OPRT_BASE_LOG_MNG_FORMAT_STRING_FAILED if there was an error formatting
+ * the log message.
+ *     - OPRT_EXCEED_UPPER_LIMIT if the record is dropped by asynchronous log.
+ */
+OPERATE_RET PrintLogV(LOG_LEVEL logLevel, char *pFile, uint32_t line, char *pFmt, va_list ap)
+{
+    OPERATE_RET opRet = OPRT_OK;
+
+    if (!pLogManage) {
+        return OPRT_INVALID_PARM;
+    }
+    if (logLevel < LOG_LEVEL_MIN || logLevel > LOG_LEVEL_MAX) {
+        return OPRT_INVALID_PARM;
+    }
+    LOG_LEVEL tmpLogLevel = pLogManage->curLogLevel;
+    if (logLevel > tmpLogLevel) {
+        return OPRT_BASE_LOG_MNG_PRINT_LOG_LEVEL_HIGHER;
+    }
+
+#if defined(ENABLE_LOG_BINARY) && (ENABLE_LOG_BINARY == 1)
+    if (pLogManage->bin_term_cnt) {
+        __log_binary_print(logLevel, pFile, line, pFmt, ap);
+    }
+    // skip the text formatting if only binary terminals exist
+    if (0 == pLogManage->text_term_cnt) {
+        return OPRT_OK;
+    }
+#endif
+
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    if (pLogManage->async) {
+        return __log_async_push(logLevel, pFile, line, FALSE, pFmt, ap);
+    }
+#endif
+
+    tal_mutex_lock(pLogManage->mutex);
+    opRet = __log_output_v(logLevel, pFile, line, 0, pFmt, ap);
+    tal_mutex_unlock(pLogManage->mutex);
+
+    return opRet;
 }
 
 /**
@@ -522,6 +1398,15 @@ OPERATE_RET tal_log_print_raw(const char *pFmt, ...)
     OPERATE_RET opRet = 0;
     va_list ap;
 
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    if (pLogManage->async) {
+        va_start(ap, pFmt);
+        opRet = __log_async_push(TAL_LOG_LEVEL_ERR, NULL, 0, TRUE, pFmt, ap);
+        va_end(ap);
+        return opRet;
+    }
+#endif
+
     tal_mutex_lock(pLogManage->mutex);
     va_start(ap, pFmt);
     opRet = __PrintLogVRaw(pFmt, ap);
@@ -545,9 +1430,13 @@ void tal_log_release(void)
         return;
     }
 
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    __log_async_stop();
+#endif
+
     while (!tuya_list_empty(&(pLogManage->log_list))) {
         LOG_OUT_NODE_S *log_out_nd = NULL;
-        log_out_nd = tuya_list_entry(&(pLogManage->log_list.next), LOG_OUT_NODE_S, node);
+        log_out_nd = tuya_list_entry(pLogManage->log_list.next, LOG_OUT_NODE_S, node);
         tuya_list_del(&(log_out_nd->node));
         if (log_out_nd->name) {
             tal_free(log_out_nd->name);
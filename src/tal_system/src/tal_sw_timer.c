@@ -12,6 +12,22 @@
 #define STACK_SIZE_TIMERQ (4 * 1024)
 #endif
 
+#if defined(ENABLE_SW_TIMER_WHEEL) && (ENABLE_SW_TIMER_WHEEL == 1)
+/*
+ * hierarchical timing wheel, 1ms per tick on level 0.
+ * level n slot covers (1 << (n * WHEEL_SLOT_BITS)) ms, the total range is
+ * (1 << (WHEEL_LEVEL_NUM * WHEEL_SLOT_BITS)) ms, longer timers are parked on
+ * the last level and re-cascaded until they fall into range.
+ */
+#define WHEEL_SLOT_BITS  6
+#define WHEEL_SLOT_NUM   (1 << WHEEL_SLOT_BITS)
+#define WHEEL_SLOT_MASK  (WHEEL_SLOT_NUM - 1)
+#define WHEEL_LEVEL_NUM  5
+#define WHEEL_MAX_DELTA  ((1ULL << (WHEEL_LEVEL_NUM * WHEEL_SLOT_BITS)) - 1)
+#define WHEEL_SLOT_NONE  0xFFFF
+#define WHEEL_LEVEL_SHIFT(level) ((level) * WHEEL_SLOT_BITS)
+#endif
+
 typedef struct {
     LIST_HEAD node;
 
@@ -23,10 +39,26 @@ typedef struct {
     BOOL_T is_running;
     TIMER_ID timer_id;
     TIMER_TYPE type;
+#if defined(ENABLE_SW_TIMER_WHEEL) && (ENABLE_SW_TIMER_WHEEL == 1)
+    uint16_t wheel_slot; // level * WHEEL_SLOT_NUM + slot, WHEEL_SLOT_NONE if not in wheel
+#endif
 } TIMER_T;
 
+#if defined(ENABLE_SW_TIMER_WHEEL) && (ENABLE_SW_TIMER_WHEEL == 1)
+typedef struct {
+    uint64_t clk;                                      // next tick to be processed
+    uint64_t bitmap[WHEEL_LEVEL_NUM];                  // non-empty slot bitmap of each level
+    LIST_HEAD slot[WHEEL_LEVEL_NUM * WHEEL_SLOT_NUM];
+    LIST_HEAD list_expired;                            // expired timers waiting for dispatch
+} TIMER_WHEEL_T;
+#endif
+
 typedef struct {
+#if defined(ENABLE_SW_TIMER_WHEEL) && (ENABLE_SW_TIMER_WHEEL == 1)
+    TIMER_WHEEL_T wheel;
+#else
     LIST_HEAD list_active;
+#endif
     LIST_HEAD list_standby;
     MUTEX_HANDLE mutex;
     uint16_t total_cnt;
@@ -40,9 +72,228 @@ typedef struct {
 
 static SW_TIMER_MGR_T s_timer_mgr;
 
+static void __timer_node_dump(TIMER_T *timer)
+{
+    TAL_TIMER_CB *cb = &(timer->cb);
+    TIMER_ID *timer_id = NULL;
+
+    if (timer->data) {
+        timer_id = timer->data;
+        if (*timer_id == timer->timer_id) {
+            cb = (TAL_TIMER_CB *)((char *)timer->data + sizeof(TIMER_ID));
+        }
+    }
+    PR_NOTICE("%08x %d %d %p", timer->timer_id, timer->type, timer->interval, *cb);
+}
+
+#if defined(ENABLE_SW_TIMER_WHEEL) && (ENABLE_SW_TIMER_WHEEL == 1)
+static uint64_t __timer_now_ms(void)
+{
+    TIME_S secTime = 0;
+    TIME_MS msTime = 0;
+
+    tal_time_get_system_time(&secTime, &msTime);
+
+    return (uint64_t)secTime * 1000 + (uint64_t)msTime;
+}
+
+/* first set bit at or after start, search cyclically, -1 if bitmap is empty */
+static int __wheel_bitmap_next(uint64_t bitmap, uint32_t start)
+{
+    uint64_t rotated = 0;
+
+    if (0 == bitmap) {
+        return -1;
+    }
+
+    rotated = (bitmap >> start) | ((start) ? (bitmap << (WHEEL_SLOT_NUM - start)) : 0);
+
+    return (start + __builtin_ctzll(rotated)) & WHEEL_SLOT_MASK;
+}
+
+static void __timer_detach(TIMER_T *timer)
+{
+    uint16_t level = 0, slot = 0;
+
+    tuya_list_del(&(timer->node));
+
+    if (WHEEL_SLOT_NONE == timer->wheel_slot) {
+        return;
+    }
+
+    level = timer->wheel_slot / WHEEL_SLOT_NUM;
+    slot = timer->wheel_slot % WHEEL_SLOT_NUM;
+    if (tuya_list_empty(&(s_timer_mgr.wheel.slot[timer->wheel_slot]))) {
+        s_timer_mgr.wheel.bitmap[level] &= ~(1ULL << slot);
+    }
+    timer->wheel_slot = WHEEL_SLOT_NONE;
+}
+
 static void __timer_attach(TIMER_T *timer)
+{
+    TIMER_WHEEL_T *wheel = &(s_timer_mgr.wheel);
+    uint64_t expire = timer->expire_time;
+    uint64_t delta = 0;
+    uint16_t level = 0, slot = 0;
+
+    __timer_detach(timer);
+
+    // already due, hand it to the dispatcher directly
+    if (expire < wheel->clk) {
+        tuya_list_add_tail(&(timer->node), &(wheel->list_expired));
+        return;
+    }
+
+    delta = expire - wheel->clk;
+    if (delta > WHEEL_MAX_DELTA) {
+        delta = WHEEL_MAX_DELTA;
+        expire = wheel->clk + delta;
+    }
+
+    for (level = 0; level < WHEEL_LEVEL_NUM - 1; level++) {
+        if (delta < (1ULL << WHEEL_LEVEL_SHIFT(level + 1))) {
+            break;
+        }
+    }
+    slot = (expire >> WHEEL_LEVEL_SHIFT(level)) & WHEEL_SLOT_MASK;
+
+    timer->wheel_slot = level * WHEEL_SLOT_NUM + slot;
+    tuya_list_add_tail(&(timer->node), &(wheel->slot[timer->wheel_slot]));
+    wheel->bitmap[level] |= (1ULL << slot);
+}
+
+/* earliest tick which has to be processed, the exact expire time for level 0
+ * and the cascade time for the upper levels. return FALSE if wheel is empty */
+static BOOL_T __wheel_next_tick(uint64_t *next_tick)
+{
+    TIMER_WHEEL_T *wheel = &(s_timer_mgr.wheel);
+    BOOL_T found = FALSE;
+    uint64_t align = 0, tick = 0;
+    uint32_t level = 0, cur = 0;
+    int slot = 0;
+
+    for (level = 0; level < WHEEL_LEVEL_NUM; level++) {
+        if (0 == wheel->bitmap[level]) {
+            continue;
+        }
+
+        align = (1ULL << WHEEL_LEVEL_SHIFT(level)) - 1;
+        tick = (wheel->clk + align) & ~align;
+        cur = (tick >> WHEEL_LEVEL_SHIFT(level)) & WHEEL_SLOT_MASK;
+        slot = __wheel_bitmap_next(wheel->bitmap[level], cur);
+        tick += (uint64_t)((slot - cur) & WHEEL_SLOT_MASK) << WHEEL_LEVEL_SHIFT(level);
+
+        if (!found || tick < *next_tick) {
+            *next_tick = tick;
+            found = TRUE;
+        }
+    }
+
+    return found;
+}
+
+static void __wheel_cascade(uint32_t level, uint32_t slot)
+{
+    TIMER_WHEEL_T *wheel = &(s_timer_mgr.wheel);
+    LIST_HEAD list;
+    TIMER_T *timer = NULL;
+    struct tuya_list_head *p = NULL, *n = NULL;
+
+    INIT_LIST_HEAD(&list);
+    tuya_list_splice(&(wheel->slot[level * WHEEL_SLOT_NUM + slot]), &list);
+    INIT_LIST_HEAD(&(wheel->slot[level * WHEEL_SLOT_NUM + slot]));
+    wheel->bitmap[level] &= ~(1ULL << slot);
+
+    tuya_list_for_each_safe(p, n, &list)
+    {
+        timer = tuya_list_entry(p, TIMER_T, node);
+        timer->wheel_slot = WHEEL_SLOT_NONE;
+        __timer_attach(timer);
+    }
+}
+
+/* move all timers expired before now into list_expired */
+static void __wheel_advance(uint64_t now)
+{
+    TIMER_WHEEL_T *wheel = &(s_timer_mgr.wheel);
+    uint64_t tick = 0;
+    uint32_t level = 0;
+
+    while (__wheel_next_tick(&tick) && tick <= now) {
+        wheel->clk = tick;
+
+        // cascade from the lowest level, upper level stops at the first unaligned one
+        for (level = 1; level < WHEEL_LEVEL_NUM; level++) {
+            if (tick & ((1ULL << WHEEL_LEVEL_SHIFT(level)) - 1)) {
+                break;
+            }
+            __wheel_cascade(level, (tick >> WHEEL_LEVEL_SHIFT(level)) & WHEEL_SLOT_MASK);
+        }
+
+        // level 0 slot of this tick is due, attach makes it expired after clk moves on
+        wheel->clk = tick + 1;
+        __wheel_cascade(0, tick & WHEEL_SLOT_MASK);
+    }
+
+    if (wheel->clk <= now) {
+        wheel->clk = now + 1;
+    }
+}
+
+/* get the first expired timer, or the time to the next expiration */
+static TIMER_T *__timer_expired_get(uint64_t nowMS, SYS_TIME_T *next_expired)
+{
+    uint64_t tick = 0;
+
+    __wheel_advance(nowMS);
+
+    if (!tuya_list_empty(&(s_timer_mgr.wheel.list_expired))) {
+        return tuya_list_entry(s_timer_mgr.wheel.list_expired.next, TIMER_T, node);
+    }
+
+    if (__wheel_next_tick(&tick)) {
+        *next_expired = tick - nowMS;
+    }
+
+    return NULL;
+}
+
+static void __timer_list_init(void)
+{
+    uint32_t i = 0;
+
+    for (i = 0; i < WHEEL_LEVEL_NUM * WHEEL_SLOT_NUM; i++) {
+        INIT_LIST_HEAD(&(s_timer_mgr.wheel.slot[i]));
+    }
+    INIT_LIST_HEAD(&(s_timer_mgr.wheel.list_expired));
+    s_timer_mgr.wheel.clk = __timer_now_ms();
+}
+
+static void __timer_active_dump(void)
+{
+    uint32_t i = 0;
+    TIMER_T *timer = NULL;
+    struct tuya_list_head *p = NULL;
+
+    for (i = 0; i <= WHEEL_LEVEL_NUM * WHEEL_SLOT_NUM; i++) {
+        LIST_HEAD *list = (i < WHEEL_LEVEL_NUM * WHEEL_SLOT_NUM) ? &(s_timer_mgr.wheel.slot[i])
+                                                                 : &(s_timer_mgr.wheel.list_expired);
+        tuya_list_for_each(p, list)
+        {
+            timer = tuya_list_entry(p, TIMER_T, node);
+            __timer_node_dump(timer);
+        }
+    }
+}
+#else
+static void __timer_detach(TIMER_T *timer)
 {
     tuya_list_del(&(timer->node));
+}
+
+static void __timer_attach(TIMER_T *timer)
+{
+    __timer_detach(timer);
 
     if (tuya_list_empty(&(s_timer_mgr.list_active))) {
         tuya_list_add_tail(&(timer->node), &(s_timer_mgr.list_active));
@@ -65,12 +316,46 @@ static void __timer_attach(TIMER_T *timer)
     }
 }
 
+/* get the first expired timer, or the time to the next expiration */
+static TIMER_T *__timer_expired_get(uint64_t nowMS, SYS_TIME_T *next_expired)
+{
+    TIMER_T *timer = NULL;
+
+    if (tuya_list_empty(&(s_timer_mgr.list_active))) {
+        return NULL;
+    }
+
+    timer = tuya_list_entry(s_timer_mgr.list_active.next, TIMER_T, node);
+    if (timer->expire_time > nowMS) {
+        *next_expired = timer->expire_time - nowMS;
+        return NULL;
+    }
+
+    return timer;
+}
+
+static void __timer_list_init(void)
+{
+    INIT_LIST_HEAD(&(s_timer_mgr.list_active));
+}
+
+static void __timer_active_dump(void)
+{
+    TIMER_T *timer = NULL;
+    struct tuya_list_head *p = NULL;
+
+    tuya_list_for_each(p, &(s_timer_mgr.list_active))
+    {
+        timer = tuya_list_entry(p, TIMER_T, node);
+        __timer_node_dump(timer);
+    }
+}
+#endif
+
 static void __timer_dump(void)
 {
     struct tuya_list_head *p = NULL;
     TIMER_T *timer = NULL;
-    TAL_TIMER_CB *cb = NULL;
-    TIMER_ID *timer_id = NULL;
 
     TIME_S nowSecTime = 0;
     TIME_MS nowMsTime = 0;
@@ -86,31 +371,13 @@ static void __timer_dump(void)
     tal_mutex_lock(s_timer_mgr.mutex);
 
     PR_NOTICE("running timers count:%d", s_timer_mgr.running_cnt);
-    tuya_list_for_each(p, &(s_timer_mgr.list_active))
-    {
-        timer = tuya_list_entry(p, TIMER_T, node);
-        cb = &(timer->cb);
-        if (timer->data) {
-            timer_id = timer->data;
-            if (*timer_id == timer->timer_id) {
-                cb = (TAL_TIMER_CB *)((char *)timer->data + sizeof(TIMER_ID));
-            }
-        }
-        PR_NOTICE("%08x %d %d %p", timer->timer_id, timer->type, timer->interval, *cb);
-    }
+    __timer_active_dump();
 
     PR_NOTICE("standby timers count:%d", s_timer_mgr.total_cnt - s_timer_mgr.running_cnt);
     tuya_list_for_each(p, &(s_timer_mgr.list_standby))
     {
         timer = tuya_list_entry(p, TIMER_T, node);
-        cb = &(timer->cb);
-        if (timer->data) {
-            timer_id = timer->data;
-            if (*timer_id == timer->timer_id) {
-                cb = (TAL_TIMER_CB *)((char *)timer->data + sizeof(TIMER_ID));
-            }
-        }
-        PR_NOTICE("%08x %d %d %p", timer->timer_id, timer->type, timer->interval, *cb);
+        __timer_node_dump(timer);
     }
 
     tal_mutex_unlock(s_timer_mgr.mutex);
@@ -123,7 +390,6 @@ static void __timer_dispatch(SYS_TIME_T *next_expired)
     uint64_t nowMS = 0;
     TIMER_T *timer = NULL;
     TAL_TIMER_CB timer_cb = NULL;
-    struct tuya_list_head *p = NULL;
 
     *next_expired = SEM_WAIT_FOREVER;
 
@@ -134,28 +400,19 @@ static void __timer_dispatch(SYS_TIME_T *next_expired)
         tal_mutex_lock(s_timer_mgr.mutex);
 
         timer_cb = NULL;
-        tuya_list_for_each(p, &(s_timer_mgr.list_active))
-        {
-            timer = tuya_list_entry(p, TIMER_T, node);
-
-            if (timer->expire_time > nowMS) {
-                p = &(s_timer_mgr.list_active);
-                *next_expired = timer->expire_time - nowMS;
+        timer = __timer_expired_get(nowMS, next_expired);
+        if (timer) {
+            timer_cb = timer->cb;
+
+            if (TAL_TIMER_ONCE == timer->type) {
+                timer->is_running = FALSE;
+                s_timer_mgr.running_cnt--;
+                __timer_detach(timer);
+                tuya_list_add_tail(&(timer->node), &(s_timer_mgr.list_standby));
             } else {
-                timer_cb = timer->cb;
-
-                if (TAL_TIMER_ONCE == timer->type) {
-                    timer->is_running = FALSE;
-                    s_timer_mgr.running_cnt--;
-                    tuya_list_del(&(timer->node));
-                    tuya_list_add_tail(&(timer->node), &(s_timer_mgr.list_standby));
-                } else {
-                    timer->expire_time = nowMS + timer->interval;
-                    __timer_attach(timer);
-                }
+                timer->expire_time = nowMS + timer->interval;
+                __timer_attach(timer);
             }
-
-            break;
         }
 
         tal_mutex_unlock(s_timer_mgr.mutex);
@@ -166,7 +423,7 @@ static void __timer_dispatch(SYS_TIME_T *next_expired)
             timer_cb = NULL;
             s_timer_mgr.last_cb = NULL;
         }
-    } while (p != &(s_timer_mgr.list_active));
+    } while (timer);
 }
 
 static void __timer_thread_cb(void *data)
@@ -201,7 +458,7 @@ OPERATE_RET tal_sw_timer_init(void)
     tal_mutex_create_init(&s_timer_mgr.mutex);
     tal_semaphore_create_init(&s_timer_mgr.sem, 0, 2);
 
-    INIT_LIST_HEAD(&(s_timer_mgr.list_active));
+    __timer_list_init();
     INIT_LIST_HEAD(&(s_timer_mgr.list_standby));
 
     THREAD_CFG_T thread_cfg = {.stackDepth = STACK_SIZE_TIMERQ, .priority = THREAD_PRIO_0, .thrdname = "sys_timer"};
@@ -240,6 +497,9 @@ OPERATE_RET tal_sw_timer_create(TAL_TIMER_CB func, void *arg, TIMER_ID *timer_id
     timer->cb = func;
     timer->data = arg;
     timer->timer_id = (TIMER_ID)timer;
+#if defined(ENABLE_SW_TIMER_WHEEL) && (ENABLE_SW_TIMER_WHEEL == 1)
+    timer->wheel_slot = WHEEL_SLOT_NONE;
+#endif
 
     tal_mutex_lock(s_timer_mgr.mutex);
     s_timer_mgr.total_cnt++;
@@ -270,7 +530,7 @@ OPERATE_RET tal_sw_timer_delete(TIMER_ID timer_id)
     TIMER_T *timer = (TIMER_T *)timer_id;
 
     tal_mutex_lock(s_timer_mgr.mutex);
-    tuya_list_del(&(timer->node));
+    __timer_detach(timer);
     s_timer_mgr.total_cnt--;
     if (timer->is_running) {
         s_timer_mgr.running_cnt--;
@@ -305,7 +565,7 @@ OPERATE_RET tal_sw_timer_stop(TIMER_ID timer_id)
         timer->is_running = FALSE;
 
         s_timer_mgr.running_cnt--;
-        tuya_list_del(&(timer->node));
+        __timer_detach(timer);
         tuya_list_add_tail(&(timer->node), &(s_timer_mgr.list_standby));
     }
     tal_mutex_unlock(s_timer_mgr.mutex);
@@ -442,8 +702,7 @@ OPERATE_RET tal_sw_timer_trigger(TIMER_ID timer_id)
     tal_mutex_lock(s_timer_mgr.mutex);
     timer->expire_time = 0;
     if (timer->is_running) {
-        tuya_list_del(&(timer->node));
-        tuya_list_add(&(timer->node), &(s_timer_mgr.list_active));
+        __timer_attach(timer);
     }
     tal_mutex_unlock(s_timer_mgr.mutex);
     tal_semaphore_post(s_timer_mgr.sem);
@@ -33,6 +33,7 @@
 #include "tal_sleep.h"
 #include "tal_log.h"
 #include "tal_memory.h"
+#include "tal_event.h"
 
 /**
  * @brief Allocates a block of memory of the specified size.
@@ -120,13 +121,15 @@ void tal_system_sleep(uint32_t time_ms)
 /**
  * @brief Resets the TAL system.
  *
- * This function calls the `tkl_system_reset()` function to reset the TAL
- * system.
+ * This function publishes EVENT_SYSTEM_RESET, so the modules keeping data in
+ * RAM can save it, then calls the `tkl_system_reset()` function to reset the
+ * TAL system.
  *
  * @note This function should be called when a system reset is required.
  */
 void tal_system_reset(void)
 {
+    tal_event_publish(EVENT_SYSTEM_RESET, NULL);
     tkl_system_reset();
 }
 
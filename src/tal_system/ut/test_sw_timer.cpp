@@ -0,0 +1,152 @@
+/**
+ * @file test_sw_timer.cpp
+ * @brief UT and benchmark of the sw timer, built once with the sorted list and
+ * once with the timing wheel (ENABLE_SW_TIMER_WHEEL).
+ *
+ * 10k timers are armed, re-armed and stopped and the cost per call is printed,
+ * then a few hundred short timers check that both backends fire on time.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <stdio.h>
+
+extern "C" {
+#include "tal_api.h"
+}
+
+#define TIMER_BENCH_NUM  10000
+#define TIMER_BENCH_BASE 600000 // far in the future, none of them fires during the bench
+#define TIMER_FIRE_NUM   200
+#define TIMER_FIRE_SLACK 50 // ms a timer may fire late on a loaded host
+
+#if defined(ENABLE_SW_TIMER_WHEEL) && (ENABLE_SW_TIMER_WHEEL == 1)
+#define TIMER_BACKEND "wheel"
+#else
+#define TIMER_BACKEND "list"
+#endif
+
+static double ns_per_op(std::chrono::steady_clock::time_point begin, int ops)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+    return (double)ns.count() / ops;
+}
+
+static void timer_nop_cb(TIMER_ID timer_id, void *arg)
+{
+}
+
+typedef struct {
+    uint32_t start_ms;
+    uint32_t interval;
+    std::atomic<uint32_t> fired_ms;
+    std::atomic<int> fired;
+} timer_fire_t;
+
+static void timer_fire_cb(TIMER_ID timer_id, void *arg)
+{
+    timer_fire_t *fire = (timer_fire_t *)arg;
+
+    if (0 == fire->fired++) {
+        fire->fired_ms = tal_system_get_millisecond();
+    }
+}
+
+class SwTimerTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        tal_sw_timer_init();
+    }
+};
+
+TEST_F(SwTimerTest, Arm10kTimers)
+{
+    std::vector<TIMER_ID> timers(TIMER_BENCH_NUM);
+
+    for (int i = 0; i < TIMER_BENCH_NUM; i++) {
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_create(timer_nop_cb, NULL, &timers[i]));
+    }
+
+    /* intervals spread over a few seconds, the list has to insert in the middle */
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < TIMER_BENCH_NUM; i++) {
+        tal_sw_timer_start(timers[i], TIMER_BENCH_BASE + (i * 7919) % 5000, TAL_TIMER_CYCLE);
+    }
+    double start_ns = ns_per_op(begin, TIMER_BENCH_NUM);
+
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < TIMER_BENCH_NUM; i++) {
+        tal_sw_timer_start(timers[i], TIMER_BENCH_BASE + (i * 104729) % 5000, TAL_TIMER_CYCLE);
+    }
+    double restart_ns = ns_per_op(begin, TIMER_BENCH_NUM);
+
+    for (int i = 0; i < TIMER_BENCH_NUM; i++) {
+        EXPECT_TRUE(tal_sw_timer_is_running(timers[i]));
+    }
+
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < TIMER_BENCH_NUM; i++) {
+        tal_sw_timer_stop(timers[i]);
+    }
+    double stop_ns = ns_per_op(begin, TIMER_BENCH_NUM);
+
+    for (int i = 0; i < TIMER_BENCH_NUM; i++) {
+        EXPECT_FALSE(tal_sw_timer_is_running(timers[i]));
+        EXPECT_EQ(OPRT_OK, tal_sw_timer_delete(timers[i]));
+    }
+
+    printf("%s, %d timers: start %.0f ns, restart %.0f ns, stop %.0f ns per call\n", TIMER_BACKEND,
+           TIMER_BENCH_NUM, start_ns, restart_ns, stop_ns);
+}
+
+TEST_F(SwTimerTest, TimersFireOnTime)
+{
+    std::vector<timer_fire_t> fires(TIMER_FIRE_NUM);
+    std::vector<TIMER_ID> timers(TIMER_FIRE_NUM);
+    uint32_t now = tal_system_get_millisecond();
+
+    for (int i = 0; i < TIMER_FIRE_NUM; i++) {
+        fires[i].start_ms = now;
+        fires[i].interval = 10 + (i * 37) % 300;
+        fires[i].fired = 0;
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_create(timer_fire_cb, &fires[i], &timers[i]));
+        ASSERT_EQ(OPRT_OK, tal_sw_timer_start(timers[i], fires[i].interval, TAL_TIMER_ONCE));
+    }
+
+    tal_system_sleep(300 + 2 * TIMER_FIRE_SLACK);
+
+    for (int i = 0; i < TIMER_FIRE_NUM; i++) {
+        EXPECT_EQ(1, fires[i].fired.load()) << "timer " << i;
+        uint32_t late = fires[i].fired_ms - fires[i].start_ms;
+        EXPECT_GE(late, fires[i].interval) << "timer " << i;
+        EXPECT_LE(late, fires[i].interval + TIMER_FIRE_SLACK) << "timer " << i;
+        tal_sw_timer_delete(timers[i]);
+    }
+}
+
+TEST_F(SwTimerTest, CycleTimerKeepsFiring)
+{
+    timer_fire_t fire;
+    TIMER_ID timer = NULL;
+
+    fire.fired = 0;
+    ASSERT_EQ(OPRT_OK, tal_sw_timer_create(timer_fire_cb, &fire, &timer));
+    ASSERT_EQ(OPRT_OK, tal_sw_timer_start(timer, 20, TAL_TIMER_CYCLE));
+    tal_system_sleep(210);
+    tal_sw_timer_stop(timer);
+
+    int fired = fire.fired;
+    EXPECT_GE(fired, 8);
+    EXPECT_LE(fired, 11);
+
+    tal_system_sleep(60);
+    EXPECT_EQ(fired, fire.fired.load());
+    tal_sw_timer_delete(timer);
+}
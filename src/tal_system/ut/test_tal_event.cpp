@@ -0,0 +1,229 @@
+/**
+ * @file test_tal_event.cpp
+ * @brief UT and benchmark of tal_event.
+ *
+ * Publishes per second are measured with 64 events of 8 subscribers each, by
+ * name and by handle. Unsubscribe has to wait for a publisher which is still
+ * running the callback from an old snapshot, but two publishers unsubscribing
+ * from their callbacks must not wait for each other.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+
+extern "C" {
+#include "tal_api.h"
+}
+
+#define EVENT_BENCH_NUM     64
+#define EVENT_BENCH_SUB_NUM 8
+#define EVENT_BENCH_ROUNDS  2000
+
+static std::atomic<int> s_calls;
+
+static int count_cb(void *data)
+{
+    s_calls++;
+    return OPRT_OK;
+}
+
+/* 8 distinct callbacks, a subscriber is keyed by desc and callback */
+template <int N> static int sub_cb(void *data)
+{
+    s_calls++;
+    return OPRT_OK;
+}
+
+static const EVENT_SUBSCRIBE_CB s_sub_cbs[EVENT_BENCH_SUB_NUM] = {sub_cb<0>, sub_cb<1>, sub_cb<2>, sub_cb<3>,
+                                                                   sub_cb<4>, sub_cb<5>, sub_cb<6>, sub_cb<7>};
+
+class TalEventTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        tal_event_init();
+    }
+
+    void SetUp() override
+    {
+        s_calls = 0;
+    }
+};
+
+TEST_F(TalEventTest, Publish64Events8Subscribers)
+{
+    char names[EVENT_BENCH_NUM][EVENT_NAME_MAX_LEN + 1];
+    EVENT_HANDLE handles[EVENT_BENCH_NUM];
+
+    for (int i = 0; i < EVENT_BENCH_NUM; i++) {
+        snprintf(names[i], sizeof(names[i]), "bench.%d", i);
+        for (int j = 0; j < EVENT_BENCH_SUB_NUM; j++) {
+            char desc[EVENT_DESC_MAX_LEN + 1];
+            snprintf(desc, sizeof(desc), "bench.sub.%d", j);
+            ASSERT_EQ(OPRT_OK, tal_event_subscribe(names[i], desc, s_sub_cbs[j], SUBSCRIBE_TYPE_NORMAL));
+        }
+        ASSERT_EQ(OPRT_OK, tal_event_handle_get(names[i], &handles[i]));
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int r = 0; r < EVENT_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < EVENT_BENCH_NUM; i++) {
+            tal_event_publish(names[i], NULL);
+        }
+    }
+    auto by_name = std::chrono::steady_clock::now() - begin;
+
+    begin = std::chrono::steady_clock::now();
+    for (int r = 0; r < EVENT_BENCH_ROUNDS; r++) {
+        for (int i = 0; i < EVENT_BENCH_NUM; i++) {
+            tal_event_publish_by_handle(handles[i], NULL);
+        }
+    }
+    auto by_handle = std::chrono::steady_clock::now() - begin;
+
+    EXPECT_EQ(2 * EVENT_BENCH_ROUNDS * EVENT_BENCH_NUM * EVENT_BENCH_SUB_NUM, s_calls.load());
+
+    double publishes = (double)EVENT_BENCH_ROUNDS * EVENT_BENCH_NUM;
+    printf("%d events x %d subscribers: %.0f publishes/s by name, %.0f publishes/s by handle\n", EVENT_BENCH_NUM,
+           EVENT_BENCH_SUB_NUM, publishes / std::chrono::duration<double>(by_name).count(),
+           publishes / std::chrono::duration<double>(by_handle).count());
+}
+
+static std::atomic<bool> s_slow_running;
+static std::atomic<bool> s_slow_done;
+
+static int slow_cb(void *data)
+{
+    s_slow_running = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    s_slow_done = true;
+    return OPRT_OK;
+}
+
+TEST_F(TalEventTest, UnsubscribeWaitsForRunningCallback)
+{
+    s_slow_running = false;
+    s_slow_done = false;
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.slow", "ut.slow", slow_cb, SUBSCRIBE_TYPE_NORMAL));
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.slow", "ut.count", count_cb, SUBSCRIBE_TYPE_NORMAL));
+
+    std::thread publisher([] { tal_event_publish("ut.slow", NULL); });
+    while (!s_slow_running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    /* another publisher is not blocked by the slow callback of the first one */
+    auto begin = std::chrono::steady_clock::now();
+    ASSERT_EQ(OPRT_OK, tal_event_unsubscribe("ut.slow", "ut.slow", slow_cb));
+    EXPECT_TRUE(s_slow_done.load());
+    EXPECT_GE(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(100));
+
+    publisher.join();
+    EXPECT_EQ(1, s_calls.load());
+
+    /* the slow callback is gone for the next publish */
+    s_slow_done = false;
+    tal_event_publish("ut.slow", NULL);
+    EXPECT_FALSE(s_slow_done.load());
+    EXPECT_EQ(2, s_calls.load());
+    tal_event_unsubscribe("ut.slow", "ut.count", count_cb);
+}
+
+TEST_F(TalEventTest, PublisherIsNotBlockedBySlowCallback)
+{
+    s_slow_running = false;
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.block", "ut.slow", slow_cb, SUBSCRIBE_TYPE_NORMAL));
+
+    std::thread publisher([] { tal_event_publish("ut.block", NULL); });
+    while (!s_slow_running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.block", "ut.count", count_cb, SUBSCRIBE_TYPE_NORMAL));
+    EXPECT_FALSE(s_slow_done.load());
+    publisher.join();
+
+    tal_event_unsubscribe("ut.block", "ut.slow", slow_cb);
+    tal_event_unsubscribe("ut.block", "ut.count", count_cb);
+}
+
+static int self_unsubscribe_cb(void *data)
+{
+    s_calls++;
+    return tal_event_unsubscribe("ut.self", "ut.self", self_unsubscribe_cb);
+}
+
+TEST_F(TalEventTest, CallbackUnsubscribesItself)
+{
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.self", "ut.self", self_unsubscribe_cb, SUBSCRIBE_TYPE_NORMAL));
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.self", "ut.count", count_cb, SUBSCRIBE_TYPE_NORMAL));
+
+    tal_event_publish("ut.self", NULL);
+    EXPECT_EQ(2, s_calls.load());
+    tal_event_publish("ut.self", NULL);
+    EXPECT_EQ(3, s_calls.load());
+    tal_event_unsubscribe("ut.self", "ut.count", count_cb);
+}
+
+static std::atomic<int> s_pair_in;
+static thread_local int s_pair_target;
+
+static int pair_unsubscribe_cb(void *data)
+{
+    static const char *descs[] = {"ut.pair.0", "ut.pair.1"};
+
+    /* both publishers are in the callback with the same snapshot, then each removes a subscriber */
+    s_pair_in++;
+    for (int i = 0; i < 1000 && s_pair_in < 2; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return tal_event_unsubscribe("ut.pair", descs[s_pair_target], count_cb);
+}
+
+TEST_F(TalEventTest, PublishersUnsubscribeFromCallbacks)
+{
+    std::atomic<int> done(0);
+
+    s_pair_in = 0;
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.pair", "ut.pair", pair_unsubscribe_cb, SUBSCRIBE_TYPE_NORMAL));
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.pair", "ut.pair.0", count_cb, SUBSCRIBE_TYPE_NORMAL));
+    ASSERT_EQ(OPRT_OK, tal_event_subscribe("ut.pair", "ut.pair.1", count_cb, SUBSCRIBE_TYPE_NORMAL));
+
+    std::thread publishers[2];
+    for (int i = 0; i < 2; i++) {
+        publishers[i] = std::thread([i, &done] {
+            s_pair_target = i;
+            tal_event_publish("ut.pair", NULL);
+            done++;
+        });
+    }
+
+    /* neither waits for the snapshot of the other */
+    for (int i = 0; i < 2000 && done < 2; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (done < 2) {
+        for (auto &publisher : publishers) {
+            publisher.detach();
+        }
+        FAIL() << "publishers unsubscribing from their callbacks wait for each other";
+    }
+    for (auto &publisher : publishers) {
+        publisher.join();
+    }
+    EXPECT_EQ(2, s_pair_in.load());
+
+    /* both are removed, the next publish calls the callback only */
+    s_calls = 0;
+    s_pair_in = 2;
+    tal_event_publish("ut.pair", NULL);
+    EXPECT_EQ(0, s_calls.load());
+    tal_event_unsubscribe("ut.pair", "ut.pair", pair_unsubscribe_cb);
+}
@@ -0,0 +1,104 @@
+/**
+ * @file test_tal_log.cpp
+ * @brief UT and benchmark of tal_log, built once synchronous and once with
+ * ENABLE_LOG_ASYNC.
+ *
+ * 4 producers log at the same time into a terminal as slow as a UART, the
+ * latency of every log call is measured and the percentiles are printed.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+
+extern "C" {
+#include "tal_api.h"
+}
+
+#define LOG_PRODUCER_NUM    4
+#define LOG_PER_PRODUCER    500
+#define LOG_TERM_COST_US    100 // about 100 bytes on a 921600 baud UART
+#define LOG_PRODUCER_GAP_US 1000 // the 4 producers together stay below what the terminal drains
+
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+#define LOG_MODE "async"
+#else
+#define LOG_MODE "sync"
+#endif
+
+static std::atomic<int> s_outputs;
+
+static void slow_term(const char *str)
+{
+    if (strstr(str, "ut.log")) {
+        s_outputs++;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(LOG_TERM_COST_US));
+}
+
+static uint32_t log_dropped(void)
+{
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    return tal_log_async_get_dropped();
+#else
+    return 0;
+#endif
+}
+
+TEST(TalLogTest, LatencyWith4Producers)
+{
+    std::vector<std::thread> producers;
+    std::vector<uint32_t> latency[LOG_PRODUCER_NUM];
+    int total = LOG_PRODUCER_NUM * LOG_PER_PRODUCER;
+
+    ASSERT_EQ(OPRT_OK, tal_log_init(TAL_LOG_LEVEL_DEBUG, 1024, slow_term));
+
+    for (int p = 0; p < LOG_PRODUCER_NUM; p++) {
+        producers.emplace_back([p, &latency] {
+            latency[p].reserve(LOG_PER_PRODUCER);
+            for (int i = 0; i < LOG_PER_PRODUCER; i++) {
+                auto begin = std::chrono::steady_clock::now();
+                PR_NOTICE("ut.log producer %d record %d value %s", p, i, "payload");
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+                latency[p].push_back((uint32_t)ns.count());
+                /* a producer does some work between two logs */
+                std::this_thread::sleep_for(std::chrono::microseconds(LOG_PRODUCER_GAP_US));
+            }
+        });
+    }
+    for (auto &t : producers) {
+        t.join();
+    }
+
+    /* every record is written or counted as dropped */
+    for (int i = 0; i < 1000 && s_outputs + (int)log_dropped() < total; i++) {
+        tal_system_sleep(10);
+    }
+    EXPECT_EQ(total, s_outputs + (int)log_dropped());
+
+    std::vector<uint32_t> all;
+    for (int p = 0; p < LOG_PRODUCER_NUM; p++) {
+        all.insert(all.end(), latency[p].begin(), latency[p].end());
+    }
+    std::sort(all.begin(), all.end());
+    printf("%s, %d producers: p50 %u ns, p90 %u ns, p99 %u ns, max %u ns, %u of %d dropped\n", LOG_MODE,
+           LOG_PRODUCER_NUM, all[all.size() / 2], all[all.size() * 9 / 10], all[all.size() * 99 / 100], all.back(),
+           log_dropped(), total);
+
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+    /* the caller never waits for the terminal */
+    EXPECT_LT(all[all.size() / 2], LOG_TERM_COST_US * 1000);
+#else
+    EXPECT_EQ(0u, log_dropped());
+#endif
+
+    tal_log_release();
+}
@@ -0,0 +1,224 @@
+/**
+ * @file test_tal_log_binary.cpp
+ * @brief UT of the binary log terminal, built once synchronous and once with
+ * ENABLE_LOG_ASYNC.
+ *
+ * Every record goes to a text terminal and to a binary terminal. The frames
+ * are checked for magic, length, checksum, format id and file id, then the
+ * stream is decoded by tools/log_decoder with the table scanned from this
+ * file and has to give the same text. In async mode the binary terminal is
+ * called by the log thread, never by the caller.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "tal_api.h"
+}
+
+#define LOG_STREAM_FILE "./ut_tal_log_binary.bin"
+#define LOG_TABLE_FILE  "./ut_tal_log_fmt.json"
+
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+#define LOG_MODE "async"
+#else
+#define LOG_MODE "sync"
+#endif
+
+static std::mutex s_mutex;
+static std::vector<std::string> s_texts;
+static std::vector<std::string> s_frames;
+static std::vector<std::thread::id> s_frame_threads;
+
+static void text_term(const char *str)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (strstr(str, "ut.bin")) {
+        s_texts.push_back(str);
+    }
+}
+
+static uint32_t fnv1a(const char *str)
+{
+    uint32_t hash = 0x811C9DC5;
+
+    while (*str) {
+        hash ^= (uint8_t)*str++;
+        hash *= 0x01000193;
+    }
+    return hash;
+}
+
+static uint16_t file_id(const char *name)
+{
+    uint32_t hash = fnv1a(name);
+
+    return (uint16_t)((hash >> 16) ^ hash);
+}
+
+static void binary_term(const char *frame)
+{
+    const uint8_t *p = (const uint8_t *)frame;
+
+    // the log thread and tal_thread log too, keep the frames of this file only
+    if ((p[7] | p[8] << 8) != file_id("test_tal_log_binary.cpp")) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_frames.push_back(std::string(frame, TAL_LOG_BINARY_FRAME_LEN(frame)));
+    s_frame_threads.push_back(std::this_thread::get_id());
+}
+
+/* " ty L][file:line] msg" of a text or decoded line, the time is local to each side */
+static std::string record_tail(const std::string &line)
+{
+    size_t begin = line.find(" ty ");
+    size_t end = line.find_first_of("\033\r\n", begin);
+
+    if (std::string::npos == begin) {
+        return line;
+    }
+    return line.substr(begin, std::string::npos == end ? std::string::npos : end - begin);
+}
+
+static size_t wait_frames(size_t num)
+{
+    for (int i = 0; i < 200; i++) {
+        {
+            std::lock_guard<std::mutex> lock(s_mutex);
+            if (s_frames.size() >= num && s_texts.size() >= num) {
+                break;
+            }
+        }
+        tal_system_sleep(10);
+    }
+    std::lock_guard<std::mutex> lock(s_mutex);
+    return s_frames.size();
+}
+
+class TalLogBinaryTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        ASSERT_EQ(OPRT_OK, tal_log_init(TAL_LOG_LEVEL_DEBUG, 1024, text_term));
+        ASSERT_EQ(OPRT_OK, tal_log_add_binary_term("ut_bin", binary_term));
+    }
+
+    static void TearDownTestCase()
+    {
+        tal_log_release();
+        remove(LOG_STREAM_FILE);
+        remove(LOG_TABLE_FILE);
+    }
+
+    void SetUp() override
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        s_texts.clear();
+        s_frames.clear();
+        s_frame_threads.clear();
+    }
+};
+
+TEST_F(TalLogBinaryTest, FrameDecodesToText)
+{
+    static const char *fmts[] = {"ut.bin int %d %i %u %x %08X %o", "ut.bin long %ld %lld %llu %zu %c%c",
+                                 "ut.bin str [%s] [%-8s] [%.3s] %d%%", "ut.bin float %f %.2f %e %g",
+                                 "ut.bin star [%*d] [%.*s] %p"}; // the formats below, in order
+    size_t num = 5;
+    int local = 0;
+
+    PR_ERR("ut.bin int %d %i %u %x %08X %o", -1, 123456, 4000000000u, 0xbeef, 0x1a2b, 8);
+    PR_WARN("ut.bin long %ld %lld %llu %zu %c%c", -7L, -5000000000LL, 12345678901234567890ULL, sizeof(int), 'o', 'k');
+    PR_NOTICE("ut.bin str [%s] [%-8s] [%.3s] %d%%", "hello", "pad", "truncate", 100);
+    PR_INFO("ut.bin float %f %.2f %e %g", 3.5, -0.125, 12345.678, 0.0001);
+    PR_DEBUG("ut.bin star [%*d] [%.*s] %p", 6, -42, 2, "abc", (void *)&local);
+
+    ASSERT_EQ(num, wait_frames(num));
+    ASSERT_EQ(num, s_texts.size());
+
+    FILE *fp = fopen(LOG_STREAM_FILE, "wb");
+    ASSERT_NE(nullptr, fp);
+    for (size_t i = 0; i < num; i++) {
+        const std::string &frame = s_frames[i];
+        const uint8_t *p = (const uint8_t *)frame.data();
+        uint8_t checksum = 0;
+
+        ASSERT_EQ(0xA5, p[0]);
+        ASSERT_EQ(frame.size(), (size_t)p[1] + 3);
+        for (size_t n = 2; n < frame.size() - 1; n++) {
+            checksum ^= p[n];
+        }
+        EXPECT_EQ(checksum, p[frame.size() - 1]) << "frame " << i;
+        EXPECT_EQ(i, (size_t)(p[2] & 0x07)) << "frame " << i; // the level
+        EXPECT_EQ(0, p[2] & 0x10) << "frame " << i;            // not truncated
+        EXPECT_EQ(fnv1a(fmts[i]), p[3] | p[4] << 8 | p[5] << 16 | (uint32_t)p[6] << 24) << "frame " << i;
+        EXPECT_EQ(file_id("test_tal_log_binary.cpp"), p[7] | p[8] << 8) << "frame " << i;
+        fwrite(p, 1, frame.size(), fp);
+        /* text between the frames is passed through by the decoder */
+        fputs("boot text\n", fp);
+    }
+    fclose(fp);
+
+    if (0 != system("python3 --version > /dev/null 2>&1")) {
+        GTEST_SKIP() << "python3 is needed to run tools/log_decoder";
+    }
+    std::string tools = LOG_DECODER_DIR;
+    std::string cmd = "python3 " + tools + "/log_fmt_table.py -s " + __FILE__ + " -o " LOG_TABLE_FILE " > /dev/null";
+    ASSERT_EQ(0, system(cmd.c_str()));
+    cmd = "python3 " + tools + "/log_decoder.py -t " LOG_TABLE_FILE " -i " LOG_STREAM_FILE;
+    FILE *pp = popen(cmd.c_str(), "r");
+    ASSERT_NE(nullptr, pp);
+    std::vector<std::string> decoded;
+    char line[512];
+    while (fgets(line, sizeof(line), pp)) {
+        if (strcmp(line, "boot text\n")) {
+            decoded.push_back(line);
+        }
+    }
+    ASSERT_EQ(0, pclose(pp));
+
+    ASSERT_EQ(num, decoded.size());
+    for (size_t i = 0; i < num; i++) {
+        EXPECT_EQ(record_tail(s_texts[i]), record_tail(decoded[i])) << "record " << i;
+    }
+}
+
+TEST_F(TalLogBinaryTest, LongStringIsTruncated)
+{
+    std::string longstr(400, 'x');
+
+    // a string is cut to 127 bytes on its own, three of them overflow the frame
+    PR_NOTICE("ut.bin long string %s %s %s %d", longstr.c_str(), longstr.c_str(), longstr.c_str(), 7);
+    ASSERT_EQ(1u, wait_frames(1));
+
+    const uint8_t *p = (const uint8_t *)s_frames[0].data();
+    EXPECT_EQ(0x10, p[2] & 0x10);
+    EXPECT_LE(s_frames[0].size(), 255u + 3);
+}
+
+TEST_F(TalLogBinaryTest, TerminalIsCalledByLogThread)
+{
+    for (int i = 0; i < 10; i++) {
+        PR_NOTICE("ut.bin record %d", i);
+    }
+    ASSERT_EQ(10u, wait_frames(10));
+
+    for (auto &id : s_frame_threads) {
+#if defined(ENABLE_LOG_ASYNC) && (ENABLE_LOG_ASYNC == 1)
+        EXPECT_NE(std::this_thread::get_id(), id) << LOG_MODE;
+#else
+        EXPECT_EQ(std::this_thread::get_id(), id) << LOG_MODE;
+#endif
+    }
+}
@@ -45,6 +45,7 @@
 #define AI_ATOP_THING_CONFIG_INFO "thing.aigc.basic.server.config.info"
 #define AI_ADD_PKT_LEN            128
 #define AI_DEFAULT_BIZ_TAG        0
+#define AI_SEND_BUF_ALIGN         1024
 
 #ifndef AI_READ_SOCKET_BUF_SIZE
 #define AI_READ_SOCKET_BUF_SIZE 0
@@ -90,6 +91,12 @@ typedef struct {
     AI_RECV_FRAG_MNG_T recv_frag_mng;
     AI_SEND_FRAG_MNG_T send_frag_mng[2]; // 0:image,1:file
     bool frag_flag;
+    char *send_buf;                     // reused by every packet, grows to the longest one
+    uint32_t send_buf_len;
+    tal_hash_mac_context_t send_sign;   // sign context of the send path
+    tal_hash_mac_context_t recv_sign;   // sign context of the read path, read is not under mutex
+    tal_cipher_aead_ctx_t send_aead;        // SL4 key scheduled once, rekeyed when the crypt key changes
+    tal_cipher_aead_ctx_t recv_aead;
     char recv_buf[AI_MAX_FRAGMENT_LENGTH + AI_ADD_PKT_LEN];
 } AI_BASIC_PROTO_T;
 
@@ -207,6 +214,14 @@ static void __ai_basic_proto_deinit(void)
             Free(ai_basic_proto->connection_id);
             ai_basic_proto->connection_id = NULL;
         }
+        if (ai_basic_proto->send_buf) {
+            Free(ai_basic_proto->send_buf);
+            ai_basic_proto->send_buf = NULL;
+        }
+        tal_sha256_mac_free(&ai_basic_proto->send_sign);
+        tal_sha256_mac_free(&ai_basic_proto->recv_sign);
+        tal_cipher_aead_free(&ai_basic_proto->send_aead);
+        tal_cipher_aead_free(&ai_basic_proto->recv_aead);
         Free(ai_basic_proto);
         ai_basic_proto = NULL;
     }
@@ -254,6 +269,10 @@ static OPERATE_RET __ai_basic_proto_init(void)
         TUYA_CALL_ERR_GOTO(__ai_generate_crypt_key(), EXIT);
         TUYA_CALL_ERR_GOTO(__ai_generate_sign_key(), EXIT);
         TUYA_CALL_ERR_GOTO(tal_mutex_create_init(&ai_basic_proto->mutex), EXIT);
+        TUYA_CALL_ERR_GOTO(tal_sha256_mac_create_init(&ai_basic_proto->send_sign), EXIT);
+        TUYA_CALL_ERR_GOTO(tal_sha256_mac_create_init(&ai_basic_proto->recv_sign), EXIT);
+        tal_cipher_aead_init(&ai_basic_proto->send_aead);
+        tal_cipher_aead_init(&ai_basic_proto->recv_aead);
         ai_basic_proto->sequence_out = 1;
         uni_random_string(ai_basic_proto->encrypt_iv, AI_IV_LEN);
         ai_basic_proto->sl = AI_PACKET_SECURITY_LEVEL;
@@ -414,9 +433,10 @@ static uint32_t __ai_get_payload_len(char *buf)
     return __ai_get_packet_len(buf) - AI_SIGN_LEN;
 }
 
-static OPERATE_RET __ai_packet_sign(char *buf, uint8_t *signature)
+static OPERATE_RET __ai_packet_sign(tal_hash_mac_context_t *ctx, char *buf, uint8_t *signature)
 {
     OPERATE_RET rt = OPRT_OK;
+    static const uint8_t zero_pad[32] = {0};
     char *sign_key = __ai_get_sign_key();
     TUYA_CHECK_NULL_RETURN(sign_key, OPRT_COM_ERROR);
 
@@ -424,26 +444,26 @@ static OPERATE_RET __ai_packet_sign(char *buf, uint8_t *signature)
     uint32_t payload_len = __ai_get_payload_len(buf);
 
     // transport first 32 byte and packet last 32 byte, if less than 64 byte,use all packet
-    uint8_t sign_data[64] = {0};
-    uint32_t sign_len = 0;
-
+    // the parts are fed to the mac directly, the tail is zero padded to 32 byte
     AI_PROTO_D("start sign head_len:%d, payload_len:%d", head_len, payload_len);
-    if (head_len + payload_len <= sizeof(sign_data)) {
-        memcpy(sign_data, buf, head_len + payload_len);
-        sign_len = head_len + payload_len;
+    TUYA_CALL_ERR_GOTO(tal_sha256_mac_starts(ctx, (uint8_t *)sign_key, AI_KEY_LEN), EXIT);
+    if (head_len + payload_len <= 64) {
+        TUYA_CALL_ERR_GOTO(tal_sha256_mac_update(ctx, (uint8_t *)buf, head_len + payload_len), EXIT);
     } else {
-        memcpy(sign_data, buf, 32);
         char *payload = buf + head_len;
         uint32_t offset = (payload_len > 32) ? payload_len - 32 : 0;
         uint32_t copy_len = (payload_len > 32) ? 32 : payload_len;
-        memcpy(sign_data + 32, payload + offset, copy_len);
-        sign_len = sizeof(sign_data);
+        TUYA_CALL_ERR_GOTO(tal_sha256_mac_update(ctx, (uint8_t *)buf, 32), EXIT);
+        TUYA_CALL_ERR_GOTO(tal_sha256_mac_update(ctx, (uint8_t *)payload + offset, copy_len), EXIT);
+        if (copy_len < 32) {
+            TUYA_CALL_ERR_GOTO(tal_sha256_mac_update(ctx, zero_pad, 32 - copy_len), EXIT);
+        }
     }
+    TUYA_CALL_ERR_GOTO(tal_sha256_mac_finish(ctx, signature), EXIT);
+    return rt;
 
-    rt = tal_sha256_mac((uint8_t *)sign_key, AI_KEY_LEN, (uint8_t *)sign_data, sign_len, signature);
-    if (OPRT_OK != rt) {
-        PR_ERR("sign packet failed, rt:%d", rt);
-    }
+EXIT:
+    PR_ERR("sign packet failed, rt:%d", rt);
     return rt;
 }
 
@@ -527,7 +547,8 @@ static int __ai_encrypt_add_pkcs(char *p, uint32_t len)
     return (len + cz);
 }
 
-static OPERATE_RET __ai_encrypt_packet(AI_PACKET_PT type, char *data, uint32_t len, char *output, uint32_t *en_len)
+/* encrypt in place, buf must have AI_ADD_PKT_LEN room after len for padding and tag */
+static OPERATE_RET __ai_encrypt_packet(AI_PACKET_PT type, char *buf, uint32_t len, uint32_t *en_len)
 {
     OPERATE_RET rt = OPRT_OK;
     int data_out_len = 0;
@@ -537,11 +558,10 @@ static OPERATE_RET __ai_encrypt_packet(AI_PACKET_PT type, char *data, uint32_t l
     AI_PACKET_SL sl = __ai_get_sl(type, false);
     if (sl == AI_PACKET_SL2) {
 #if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL2)
-        memcpy(output, data, len);
-        data_out_len = __ai_encrypt_add_pkcs(output, len);
+        data_out_len = __ai_encrypt_add_pkcs(buf, len);
         char nonce[12] = {0};
         memcpy(nonce, ai_basic_proto->encrypt_iv, sizeof(nonce));
-        rt = mbedtls_chacha20_crypt((uint8_t *)key, (uint8_t *)nonce, 0, len, (uint8_t *)data, (uint8_t *)output);
+        rt = mbedtls_chacha20_crypt((uint8_t *)key, (uint8_t *)nonce, 0, len, (uint8_t *)buf, (uint8_t *)buf);
         if (OPRT_OK != rt) {
             PR_ERR("chacha20_crypt error:%d", rt);
             return rt;
@@ -550,10 +570,9 @@ static OPERATE_RET __ai_encrypt_packet(AI_PACKET_PT type, char *data, uint32_t l
 #endif
     } else if (sl == AI_PACKET_SL3) {
 #if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL3)
-        memcpy(output, data, len);
-        data_out_len = tal_pkcs7padding_buffer((uint8_t *)output, len);
-        rt = tal_aes256_cbc_encode_raw((uint8_t *)output, data_out_len, (uint8_t *)key,
-                                       (uint8_t *)ai_basic_proto->encrypt_iv, (uint8_t *)output);
+        data_out_len = tal_pkcs7padding_buffer((uint8_t *)buf, len);
+        rt = tal_aes256_cbc_encode_raw((uint8_t *)buf, data_out_len, (uint8_t *)key,
+                                       (uint8_t *)ai_basic_proto->encrypt_iv, (uint8_t *)buf);
         if (OPRT_OK != rt) {
             PR_ERR("aes128_cbc_encode error:%d", rt);
             return rt;
@@ -562,32 +581,23 @@ static OPERATE_RET __ai_encrypt_packet(AI_PACKET_PT type, char *data, uint32_t l
 #endif
     } else if (sl == AI_PACKET_SL4) {
 #if (AI_PACKET_SECURITY_LEVEL == AI_PACKET_SL4)
-        uint8_t tag[AI_GCM_TAG_LEN] = {0};
-        memcpy(output, data, len);
-        data_out_len = __ai_encrypt_add_pkcs(output, len);
-
-        const cipher_params_t en_input = {
-            .cipher_type = MBEDTLS_CIPHER_AES_256_GCM,
-            .key = (unsigned char *)key,
-            .key_len = AI_KEY_LEN,
-            .nonce = (uint8_t *)ai_basic_proto->encrypt_iv,
-            .nonce_len = AI_IV_LEN,
-            .ad = NULL,
-            .ad_len = 0,
-            .data = (uint8_t *)output,
-            .data_len = data_out_len,
-        };
-        rt = mbedtls_cipher_auth_encrypt_wrapper(&en_input, (uint8_t *)output, (size_t *)en_len, tag, sizeof(tag));
+        tal_cipher_aead_ctx_t *aead = &ai_basic_proto->send_aead;
+        data_out_len = __ai_encrypt_add_pkcs(buf, len);
+
+        // in place, the tag is written after the data
+        rt = tal_cipher_aead_setkey(aead, MBEDTLS_CIPHER_AES_256_GCM, (uint8_t *)key, AI_KEY_LEN);
+        if (rt == OPRT_OK) {
+            rt = tal_cipher_aead_encrypt(aead, (uint8_t *)ai_basic_proto->encrypt_iv, AI_IV_LEN, NULL, 0,
+                                         (uint8_t *)buf, data_out_len, (uint8_t *)buf, AI_GCM_TAG_LEN);
+        }
         if (rt != OPRT_OK) {
             PR_ERR("aes128_gcm_encode error:%x", rt);
         }
-        memcpy(output + *en_len, tag, sizeof(tag));
-        *en_len += sizeof(tag);
+        *en_len = data_out_len + AI_GCM_TAG_LEN;
         // tuya_debug_hex_dump("encrypt_data", 64, (uint8_t *)output, *en_len);
 #endif
     } else if (sl == AI_PACKET_SL0) {
         AI_PROTO_D("sl:%d do not need crypt", sl);
-        memcpy(output, data, len);
         *en_len = len;
     } else {
         PR_ERR("sl:%d err", sl);
@@ -631,24 +641,19 @@ static OPERATE_RET __ai_decrypt_packet(char *data, uint32_t len, char *output, u
         // tuya_debug_hex_dump("decrypt_key", 64, (uint8_t *)key, AI_KEY_LEN);
         // tuya_debug_hex_dump("decrypt_iv", 64, (uint8_t *)ai_basic_proto->decrypt_iv, AI_IV_LEN);
         // tuya_debug_hex_dump("decrypt_tag", 64, (uint8_t *)(data + len - AI_GCM_TAG_LEN), AI_GCM_TAG_LEN);
-        const cipher_params_t de_input = {
-            .cipher_type = MBEDTLS_CIPHER_AES_256_GCM,
-            .key = (unsigned char *)key,
-            .key_len = AI_KEY_LEN,
-            .nonce = (uint8_t *)ai_basic_proto->decrypt_iv,
-            .nonce_len = AI_IV_LEN,
-            .ad = NULL,
-            .ad_len = 0,
-            .data = (uint8_t *)data,
-            .data_len = len - AI_GCM_TAG_LEN,
-        };
-
-        rt = mbedtls_cipher_auth_decrypt_wrapper(&de_input, (uint8_t *)output, (size_t *)de_len,
-                                                 (uint8_t *)(data + len - AI_GCM_TAG_LEN), AI_GCM_TAG_LEN);
+        tal_cipher_aead_ctx_t *aead = &ai_basic_proto->recv_aead;
+
+        // the tag is after the data
+        rt = tal_cipher_aead_setkey(aead, MBEDTLS_CIPHER_AES_256_GCM, (uint8_t *)key, AI_KEY_LEN);
+        if (rt == OPRT_OK) {
+            rt = tal_cipher_aead_decrypt(aead, (uint8_t *)ai_basic_proto->decrypt_iv, AI_IV_LEN, NULL, 0,
+                                         (uint8_t *)data, len - AI_GCM_TAG_LEN, (uint8_t *)output, AI_GCM_TAG_LEN);
+        }
         if (rt != OPRT_OK) {
             PR_ERR("aes128_gcm_decode error:%x", rt);
             return rt;
         }
+        *de_len = len - AI_GCM_TAG_LEN;
         *de_len = *de_len - output[*de_len - 1];
 #endif
     } else if (sl == AI_PACKET_SL0) {
@@ -672,9 +677,8 @@ static OPERATE_RET __ai_pack_payload(AI_SEND_PACKET_T *info, char *payload_buf,
     TUYA_CHECK_NULL_RETURN(info, OPRT_INVALID_PARM);
     packet_len = __ai_get_send_payload_len(info, frag);
 
-    char *buf = Malloc(packet_len);
-    TUYA_CHECK_NULL_RETURN(buf, OPRT_MALLOC_FAILED);
-    memset(buf, 0, packet_len);
+    // build the plain payload at its place in the packet and encrypt it there
+    char *buf = payload_buf;
 
     if (tuya_ai_is_need_attr(frag)) {
         AI_PAYLOAD_HEAD_T payload_head = {0};
@@ -715,7 +719,6 @@ static OPERATE_RET __ai_pack_payload(AI_SEND_PACKET_T *info, char *payload_buf,
                     memcpy(buf + offset, info->attrs[idx]->value.str, attr_idx_len);
                 } else {
                     PR_ERR("unknow payload type:%d", payload_type);
-                    Free(buf);
                     return OPRT_COM_ERROR;
                 }
                 offset += attr_idx_len;
@@ -734,12 +737,11 @@ static OPERATE_RET __ai_pack_payload(AI_SEND_PACKET_T *info, char *payload_buf,
     AI_PROTO_D("payload len:%d, offset:%d", packet_len, offset);
 
     // tuya_debug_hex_dump("payload_uncrypt", 64, (uint8_t *)buf, packet_len);
-    rt = __ai_encrypt_packet(info->type, buf, packet_len, payload_buf, payload_len);
+    rt = __ai_encrypt_packet(info->type, buf, packet_len, payload_len);
     if (OPRT_OK != rt) {
         PR_ERR("encrypt packet failed, rt:%d", rt);
     }
 
-    Free(buf);
     return rt;
 }
 
@@ -848,6 +850,25 @@ OPERATE_RET tuya_ai_get_attr_value(char *de_buf, uint32_t *offset, AI_ATTRIBUTE_
     return rt;
 }
 
+static char *__ai_send_buf_reserve(uint32_t len)
+{
+    if (ai_basic_proto->send_buf_len >= len) {
+        return ai_basic_proto->send_buf;
+    }
+
+    uint32_t buf_len = (len + AI_SEND_BUF_ALIGN - 1) / AI_SEND_BUF_ALIGN * AI_SEND_BUF_ALIGN;
+    char *buf = Malloc(buf_len);
+    if (NULL == buf) {
+        return NULL;
+    }
+    if (ai_basic_proto->send_buf) {
+        Free(ai_basic_proto->send_buf);
+    }
+    ai_basic_proto->send_buf = buf;
+    ai_basic_proto->send_buf_len = buf_len;
+    return buf;
+}
+
 static OPERATE_RET __ai_packet_write(AI_SEND_PACKET_T *info, AI_FRAG_FLAG frag, uint32_t origin_len)
 {
     OPERATE_RET rt = OPRT_OK;
@@ -865,9 +886,9 @@ static OPERATE_RET __ai_packet_write(AI_SEND_PACKET_T *info, AI_FRAG_FLAG frag,
         PR_ERR("send packet too long, len: %d", uncrypt_len);
         return OPRT_COM_ERROR;
     }
-    char *send_pkt_buf = Malloc(uncrypt_len);
+    // the payload is packed and encrypted in place, the buffer is kept for the next packet
+    char *send_pkt_buf = __ai_send_buf_reserve(uncrypt_len);
     TUYA_CHECK_NULL_RETURN(send_pkt_buf, OPRT_MALLOC_FAILED);
-    memset(send_pkt_buf, 0, uncrypt_len);
 
     uint32_t head_len = sizeof(AI_PACKET_HEAD_T);
     // AI_PROTO_D("head len:%d", head_len);
@@ -892,7 +913,7 @@ static OPERATE_RET __ai_packet_write(AI_SEND_PACKET_T *info, AI_FRAG_FLAG frag,
 
     rt = __ai_pack_payload(info, send_pkt_buf + offset, &payload_len, frag, origin_len);
     if (OPRT_OK != rt) {
-        goto EXIT;
+        return rt;
     }
     length = UNI_HTONL(payload_len + AI_SIGN_LEN);
 
@@ -902,9 +923,9 @@ static OPERATE_RET __ai_packet_write(AI_SEND_PACKET_T *info, AI_FRAG_FLAG frag,
         memcpy(send_pkt_buf + head_len, &length, sizeof(length));
     }
 
-    rt = __ai_packet_sign(send_pkt_buf, signature);
+    rt = __ai_packet_sign(&ai_basic_proto->send_sign, send_pkt_buf, signature);
     if (OPRT_OK != rt) {
-        goto EXIT;
+        return rt;
     }
     offset += payload_len;
     memcpy(send_pkt_buf + offset, signature, AI_SIGN_LEN);
@@ -924,8 +945,6 @@ static OPERATE_RET __ai_packet_write(AI_SEND_PACKET_T *info, AI_FRAG_FLAG frag,
         rt = OPRT_OK;
     }
 
-EXIT:
-    Free(send_pkt_buf);
     return rt;
 }
 
@@ -1513,7 +1532,7 @@ OPERATE_RET tuya_ai_basic_pkt_read(char **out, uint32_t *out_len, AI_FRAG_FLAG *
         offset += recv_len;
     }
 
-    rt = __ai_packet_sign(recv_buf, calc_sign);
+    rt = __ai_packet_sign(&ai_basic_proto->recv_sign, recv_buf, calc_sign);
     if (OPRT_OK != rt) {
         PR_ERR("packet sign failed, rt:%d", rt);
         goto EXIT;
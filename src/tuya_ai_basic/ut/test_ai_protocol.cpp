@@ -0,0 +1,243 @@
+/**
+ * @file test_ai_protocol.cpp
+ * @brief UT and benchmark of the packet send path of tuya_ai_protocol.
+ *
+ * The atop config request and the transporter are faked, what is written is
+ * read back by tuya_ai_basic_pkt_read, so every packet is checked for its
+ * signature and decrypted. 20 ms audio frames are sent in a loop and the cost
+ * and the heap allocations per frame are printed.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tuya_iot.h"
+#include "atop_base.h"
+#include "tuya_transporter.h"
+#include "tuya_ai_protocol.h"
+}
+
+#define AUDIO_FRAME_LEN   640 // 20 ms of 16 kHz 16 bit mono PCM
+#define AUDIO_BENCH_FRAME 20000
+#define AUDIO_FRAME_ALLOC 0
+
+/* heap allocations of the benchmark thread */
+static thread_local bool s_count_alloc;
+static thread_local int s_alloc_cnt;
+
+extern "C" {
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    if (s_count_alloc) {
+        s_alloc_cnt++;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (s_count_alloc) {
+        s_alloc_cnt++;
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (s_count_alloc) {
+        s_alloc_cnt++;
+    }
+    return __libc_realloc(ptr, size);
+}
+}
+
+/* fake cloud: the atop config and a loopback transporter */
+static tuya_iot_client_t s_client;
+static std::string s_wire;
+static size_t s_wire_pos;
+static bool s_wire_drop;
+static int s_transporter;
+
+extern "C" {
+tuya_iot_client_t *tuya_iot_client_get(void)
+{
+    return &s_client;
+}
+
+int atop_base_request(const atop_base_request_t *request, atop_base_response_t *response)
+{
+    response->success = true;
+    response->result =
+        cJSON_Parse("{\"tcpport\":443,\"username\":\"user\",\"credential\":\"pwd\",\"hosts\":[\"127.0.0.1\"],"
+                    "\"expire\":3600,\"bizCode\":1,\"clientId\":\"client\",\"derivedAlgorithm\":\"hkdf\","
+                    "\"derivedIv\":\"0123456789ab\"}");
+    return OPRT_OK;
+}
+
+void atop_base_response_free(atop_base_response_t *response)
+{
+    if (response->result) {
+        cJSON_Delete(response->result);
+        response->result = NULL;
+    }
+}
+
+tuya_transporter_t tuya_transporter_create(TUYA_TRANSPORT_TYPE_E transport_type, tuya_transporter_t dependency)
+{
+    return (tuya_transporter_t)&s_transporter;
+}
+
+OPERATE_RET tuya_transporter_destroy(tuya_transporter_t transporter)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_connect(tuya_transporter_t transporter, const char *host, int port, int timeout_ms)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_close(tuya_transporter_t transporter)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_transporter_write(tuya_transporter_t transporter, uint8_t *buf, int len, int timeout_ms)
+{
+    if (!s_wire_drop) {
+        s_wire.append((const char *)buf, len);
+    }
+    return len;
+}
+
+OPERATE_RET tuya_transporter_read(tuya_transporter_t transporter, uint8_t *buf, int len, int timeout_ms)
+{
+    size_t n = s_wire.size() - s_wire_pos;
+    if (0 == n) {
+        return 0;
+    }
+    n = n < (size_t)len ? n : (size_t)len;
+    memcpy(buf, s_wire.data() + s_wire_pos, n);
+    s_wire_pos += n;
+    return (int)n;
+}
+}
+
+class AiProtocolTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        strcpy(s_client.activate.localkey, "0123456789abcdef");
+        ASSERT_EQ(OPRT_OK, tuya_ai_basic_atop_req());
+        ASSERT_EQ(OPRT_OK, tuya_ai_basic_connect());
+    }
+
+    void SetUp() override
+    {
+        s_wire.clear();
+        s_wire_pos = 0;
+        s_wire_drop = false;
+    }
+
+    /* read back one message, the payload head and the data length are skipped */
+    std::string read_back(bool has_attr)
+    {
+        char *out = NULL;
+        uint32_t out_len = 0;
+        AI_FRAG_FLAG frag = AI_PACKET_NO_FRAG;
+
+        EXPECT_EQ(OPRT_OK, tuya_ai_basic_pkt_read(&out, &out_len, &frag));
+        if (NULL == out) {
+            return "";
+        }
+        EXPECT_EQ(AI_PT_AUDIO, tuya_ai_basic_get_pkt_type(out));
+
+        uint32_t offset = sizeof(AI_PAYLOAD_HEAD_T);
+        if (has_attr) {
+            uint32_t attr_len = 0;
+            memcpy(&attr_len, out + offset, sizeof(attr_len));
+            offset += sizeof(attr_len) + UNI_NTOHL(attr_len);
+        }
+        offset += sizeof(uint32_t);
+        std::string data(out + offset, out_len - offset);
+        tuya_ai_basic_pkt_free(out);
+        return data;
+    }
+};
+
+static std::string audio_frame(uint32_t len, int seed)
+{
+    std::string frame(len, '\0');
+    for (uint32_t i = 0; i < len; i++) {
+        frame[i] = (char)(i * 31 + seed);
+    }
+    return frame;
+}
+
+TEST_F(AiProtocolTest, AudioFrameLoopback)
+{
+    AI_AUDIO_ATTR_T attr = {0};
+    attr.base.codec_type = AUDIO_CODEC_PCM;
+    attr.base.sample_rate = 16000;
+    attr.base.channels = AUDIO_CHANNELS_MONO;
+    attr.base.bit_depth = 16;
+
+    /* the first frame carries the attributes */
+    std::string frame = audio_frame(AUDIO_FRAME_LEN, 1);
+    ASSERT_EQ(OPRT_OK, tuya_ai_basic_audio(&attr, (char *)frame.data(), frame.size()));
+    EXPECT_EQ(frame, read_back(true));
+
+    /* short frames, every padding length of the cipher */
+    for (uint32_t len = 1; len <= 48; len++) {
+        frame = audio_frame(len, len);
+        ASSERT_EQ(OPRT_OK, tuya_ai_basic_audio(NULL, (char *)frame.data(), frame.size()));
+        EXPECT_EQ(frame, read_back(false)) << "len " << len;
+    }
+    EXPECT_EQ(s_wire.size(), s_wire_pos);
+}
+
+TEST_F(AiProtocolTest, FragmentedLoopback)
+{
+    /* longer than a fragment, sent in 4 packets and put together by the reader */
+    std::string frame = audio_frame(3 * AI_MAX_FRAGMENT_LENGTH + 123, 7);
+    ASSERT_EQ(OPRT_OK, tuya_ai_basic_audio(NULL, (char *)frame.data(), frame.size()));
+    EXPECT_EQ(frame, read_back(false));
+    EXPECT_EQ(s_wire.size(), s_wire_pos);
+}
+
+TEST_F(AiProtocolTest, AudioFrameBenchmark)
+{
+    std::string frame = audio_frame(AUDIO_FRAME_LEN, 3);
+
+    /* the first packet sizes the send buffer */
+    s_wire_drop = true;
+    ASSERT_EQ(OPRT_OK, tuya_ai_basic_audio(NULL, (char *)frame.data(), frame.size()));
+
+    s_alloc_cnt = 0;
+    s_count_alloc = true;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < AUDIO_BENCH_FRAME; i++) {
+        tuya_ai_basic_audio(NULL, (char *)frame.data(), frame.size());
+    }
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    s_count_alloc = false;
+
+    double ns = std::chrono::duration<double, std::nano>(elapsed).count() / AUDIO_BENCH_FRAME;
+    double allocs = (double)s_alloc_cnt / AUDIO_BENCH_FRAME;
+    printf("%d byte audio frame, sl %d: %.0f ns, %.1f MB/s, %.2f heap allocations per frame\n", AUDIO_FRAME_LEN,
+           AI_PACKET_SECURITY_LEVEL, ns, AUDIO_FRAME_LEN * 1e3 / ns, allocs);
+    EXPECT_LE(allocs, AUDIO_FRAME_ALLOC);
+}
@@ -35,7 +35,12 @@
 #define SPEEX_QUALITY_DEF           5 // Set the quality to 5(16k rate: 8-->27.8kbps 5-->16.8kbps)
 #define MODE_1_QUALITY_5_FRAME_SIZE 42
 #define MODE_1_QUALITY_8_FRAME_SIZE 70
-#define SPEEX_ENCODE_BUFFER_LEN     (MODE_1_QUALITY_5_FRAME_SIZE * 5)
+#if defined(SPEAKER_UPLOAD_SPEEX_BATCH_FRAMES)
+#define SPEEX_ENCODE_BATCH_FRAMES   SPEAKER_UPLOAD_SPEEX_BATCH_FRAMES
+#else
+#define SPEEX_ENCODE_BATCH_FRAMES   5
+#endif
+#define SPEEX_ENCODE_BUFFER_LEN     (MODE_1_QUALITY_5_FRAME_SIZE * SPEEX_ENCODE_BATCH_FRAMES) // frames per upload message
 
 /**
  * TY_MEDIA_HEAD_S for speex encode
@@ -101,9 +106,8 @@ static unsigned int speex_data_encode(SPEAKER_MEDIA_ENCODER_S *p_encoder, void *
     SPEEX_ENCODE_S *p_speex = NULL;
     OPERATE_RET ret = OPRT_OK;
     unsigned int encode_len = 0, cp_len = 0;
-    float input[SPEEX_FRAME_SIZE] = {0x0};
     char cbits[SPEEX_MAX_FRAME_BYTES] = {0x0};
-    int nbBytes = 0, i = 0;
+    int nbBytes = 0;
 
     if (NULL == p_encoder || NULL == buffer || NULL == p_encoder->p_encode_info ||
         NULL == p_encoder->encoder_data_callback) {
@@ -125,12 +129,9 @@ static unsigned int speex_data_encode(SPEAKER_MEDIA_ENCODER_S *p_encoder, void *
             return encode_len;
 
         } else {
-            for (i = 0; i < SPEEX_FRAME_SIZE; i++) {
-                input[i] = p_speex->buffer[i];
-            }
-
+            // the frame may be used as scratch by the encoder, it is refilled anyway
             speex_bits_reset(&p_speex->bits);
-            speex_encode(p_speex->state, input, &p_speex->bits); // dump
+            speex_encode_int(p_speex->state, p_speex->buffer, &p_speex->bits);
             nbBytes = speex_bits_write(&p_speex->bits, cbits, SPEEX_MAX_FRAME_BYTES);
 
             /** FIXME: do write data to upload, but impl inside! */
@@ -31,8 +31,10 @@
 /* Compile as fixed-point */
 /* #undef FIXED_POINT */
 
-/* Compile as floating-point */
+/* Compile as floating-point, FIXED_POINT is defined by the build with ENABLE_SPEEX_FIXED_POINT */
+#ifndef FIXED_POINT
 #define FLOATING_POINT /**/
+#endif
 
 /* Define to 1 if you have the <alloca.h> header file. */
 #define HAVE_ALLOCA_H 1
@@ -300,6 +300,13 @@ OPERATE_RET tuya_speaker_ws_send_bin(uint8_t *data, uint32_t len)
     return websocket_client_send_bin(s_ws_hdl, (uint8_t *)data, len);
 }
 
+OPERATE_RET tuya_speaker_ws_send_bin_ext(uint8_t *head, uint32_t head_len, uint8_t *data, uint32_t len)
+{
+    if (!tuya_speaker_ws_is_online())
+        return OPRT_COM_ERROR;
+    return websocket_client_send_bin_ext(s_ws_hdl, head, head_len, data, len);
+}
+
 OPERATE_RET tuya_speaker_ws_send_text(uint8_t *data, uint32_t len)
 {
     if (!tuya_speaker_ws_is_online())
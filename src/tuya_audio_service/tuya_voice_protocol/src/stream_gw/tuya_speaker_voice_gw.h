@@ -24,6 +24,7 @@ OPERATE_RET tuya_speaker_ws_client_start(void);
 OPERATE_RET tuya_speaker_ws_client_stop(void);
 
 OPERATE_RET tuya_speaker_ws_send_bin(uint8_t *data, uint32_t len);
+OPERATE_RET tuya_speaker_ws_send_bin_ext(uint8_t *head, uint32_t head_len, uint8_t *data, uint32_t len);
 OPERATE_RET tuya_speaker_ws_send_text(uint8_t *data, uint32_t len);
 
 BOOL_T tuya_speaker_ws_is_online(void);
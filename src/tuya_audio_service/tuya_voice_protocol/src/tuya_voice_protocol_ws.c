@@ -30,6 +30,8 @@
 #include "tuya_iot.h"
 
 #define TUYA_WS_REQUEST_ID_MAX_LEN (64)
+#define TUYA_WS_UPLOAD_HEAD_MAX_LEN (TUYA_WS_REQUEST_ID_MAX_LEN + 32)
+#define TUYA_WS_REQUEST_BLOCK_FIELD (5) // field number of Speech__Request.block
 #define ENABLE_VOICE_DEBUG
 
 typedef enum {
@@ -51,6 +53,8 @@ typedef enum {
 typedef struct {
     uint32_t data_len;
     char request_id[TUYA_WS_REQUEST_ID_MAX_LEN];
+    uint8_t mid_head[TUYA_WS_UPLOAD_HEAD_MAX_LEN]; // packed ASR_MID request up to the block data
+    uint32_t mid_fixed_len;                        // length of the fields before block, same for every chunk
 } TY_VOICE_WS_UPLOAD_CTX_S;
 
 typedef struct {
@@ -68,6 +72,39 @@ static OPERATE_RET __format_upload_speex(Speech__Request *req, TUYA_VOICE_WS_STA
 static OPERATE_RET __format_upload_wav(Speech__Request *req, TUYA_VOICE_WS_START_PARAMS_S *head);
 static OPERATE_RET __format_upload_ulaw(Speech__Request *req, TUYA_VOICE_WS_START_PARAMS_S *head);
 
+static uint32_t __voice_ws_varint_pack(uint32_t value, uint8_t *out)
+{
+    uint32_t len = 0;
+
+    while (value >= 0x80) {
+        out[len++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[len++] = (uint8_t)value;
+
+    return len;
+}
+
+static OPERATE_RET __voice_ws_upload_head_init(TY_VOICE_WS_UPLOAD_CTX_S *p_upload_ctx)
+{
+    Speech__Request device_req;
+    size_t enc_len = 0;
+
+    // block is the last field packed, the ones before it are packed once for the whole upload
+    speech__request__init(&device_req);
+    device_req.requestid = p_upload_ctx->request_id;
+    device_req.type = "ASR_MID";
+
+    enc_len = speech__request__get_packed_size(&device_req);
+    if (enc_len + 1 + 5 > sizeof(p_upload_ctx->mid_head)) {
+        PR_ERR("upload head is too long, %d", enc_len);
+        return OPRT_COM_ERROR;
+    }
+    p_upload_ctx->mid_fixed_len = speech__request__pack(&device_req, p_upload_ctx->mid_head);
+
+    return OPRT_OK;
+}
+
 static OPERATE_RET __save_current_request_id(char *request_id)
 {
     tal_mutex_lock(g_protocol_ws.id_mutex);
@@ -406,6 +443,10 @@ OPERATE_RET tuya_voice_proto_ws_upload_start(TUYA_VOICE_UPLOAD_T *uploader, TUYA
     SAFE_MALLOC_ERR_RET(p_upload_ctx, sizeof(TY_VOICE_WS_UPLOAD_CTX_S));
     __voice_ws_generate_request_id(p_upload_ctx->request_id, sizeof(p_upload_ctx->request_id));
     __save_current_request_id(p_upload_ctx->request_id);
+    if (OPRT_OK != (rt = __voice_ws_upload_head_init(p_upload_ctx))) {
+        Free(p_upload_ctx);
+        return rt;
+    }
 
     Speech__Request device_req;
     speech__request__init(&device_req);
@@ -442,7 +483,9 @@ OPERATE_RET tuya_voice_proto_ws_upload_start(TUYA_VOICE_UPLOAD_T *uploader, TUYA
  * @brief Send voice data in an active upload session
  *
  * @details This function sends voice data chunks through the websocket connection.
- *          It encodes the data using protobuf and sends it as binary data.
+ *          The chunk goes out as an ASR_MID protobuf request: the fields packed at start
+ *          are followed by the block tag and length, and the chunk itself, in one websocket
+ *          frame without packing the request again.
  *          The function maintains an internal counter for the total amount of data sent.
  *
  * @param[in] uploader  The upload context created by tuya_voice_proto_ws_upload_start
@@ -453,13 +496,11 @@ OPERATE_RET tuya_voice_proto_ws_upload_start(TUYA_VOICE_UPLOAD_T *uploader, TUYA
  * - OPRT_OK: Success
  * - OPRT_INVALID_PARM: Invalid parameter
  * - OPRT_COM_ERROR: Communication error
- * - OPRT_MALLOC_FAILED: Memory allocation failed
  */
 OPERATE_RET tuya_voice_proto_ws_upload_send(TUYA_VOICE_UPLOAD_T uploader, uint8_t *buf, uint32_t len)
 {
     OPERATE_RET rt = OPRT_OK;
-    size_t enc_len = 0;
-    uint8_t *enc_buf = NULL;
+    uint32_t head_len = 0;
 
     if (NULL == uploader || (len && !buf)) {
         PR_ERR("param is invalid");
@@ -473,40 +514,19 @@ OPERATE_RET tuya_voice_proto_ws_upload_send(TUYA_VOICE_UPLOAD_T uploader, uint8_
         return OPRT_COM_ERROR;
     }
 
-    Speech__Request device_req;
-    speech__request__init(&device_req);
-    device_req.requestid = p_upload_ctx->request_id;
-    device_req.type = "ASR_MID";
-    device_req.block.len = len;
-    device_req.block.data = (uint8_t *)buf;
+    // same bytes as speech__request__pack, empty block is not packed
+    head_len = p_upload_ctx->mid_fixed_len;
+    if (len) {
+        p_upload_ctx->mid_head[head_len++] = (TUYA_WS_REQUEST_BLOCK_FIELD << 3) | PROTOBUF_C_WIRE_TYPE_LENGTH_PREFIXED;
+        head_len += __voice_ws_varint_pack(len, p_upload_ctx->mid_head + head_len);
+    }
 
-    do {
-        if ((enc_len = speech__request__get_packed_size(&device_req)) <= 0) {
-            PR_ERR("protobuf get encoded data len is invalid, enc_lan[%d]", enc_len);
-            rt = OPRT_COM_ERROR;
-            break;
-        }
-        if ((enc_buf = (uint8_t *)Malloc(enc_len)) == NULL) {
-            PR_ERR("Malloc enc_buf failed");
-            rt = OPRT_MALLOC_FAILED;
-            break;
-        }
-        if ((enc_len = speech__request__pack(&device_req, enc_buf)) <= 0) {
-            PR_ERR("protobuf encode data len is invalid, enc_lan[%d]", enc_len);
-            Free(enc_buf);
-            rt = OPRT_COM_ERROR;
-            break;
-        }
-        if ((rt = tuya_speaker_ws_send_bin(enc_buf, enc_len)) != OPRT_OK) {
-            PR_ERR("tuya_speaker_ws_send_bin failed");
-            Free(enc_buf);
-            rt = OPRT_COM_ERROR;
-            break;
-        }
-        Free(enc_buf);
-    } while (0);
+    if ((rt = tuya_speaker_ws_send_bin_ext(p_upload_ctx->mid_head, head_len, buf, len)) != OPRT_OK) {
+        PR_ERR("tuya_speaker_ws_send_bin_ext failed");
+        rt = OPRT_COM_ERROR;
+    }
 
-    p_upload_ctx->data_len += enc_len;
+    p_upload_ctx->data_len += head_len + len;
 
     return rt;
 }
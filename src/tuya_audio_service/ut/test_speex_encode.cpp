@@ -0,0 +1,146 @@
+/**
+ * @file test_speex_encode.cpp
+ * @brief UT and benchmark of the speex wideband encoder used by codec_speex.
+ *
+ * The bundled libspeex is built into the test, once as fixed-point and once as
+ * floating-point. A voiced test signal is encoded from int16 frames like
+ * speex_encode.c does, every frame has to be the size the upload expects and
+ * has to decode back to a signal of the same energy. The encode time and the
+ * bytes per frame are printed for the build under test.
+ *
+ * @copyright Copyright (c) 2021-2025 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include <speex/speex.h>
+}
+
+#define SPEEX_FRAME_SIZE            320 // 20 ms at 16 kHz
+#define SPEEX_QUALITY_DEF           5
+#define SPEEX_MAX_FRAME_BYTES       200
+#define MODE_1_QUALITY_5_FRAME_SIZE 42
+#define SPEEX_TEST_FRAMES           250 // 5 s
+#define SPEEX_BENCH_LOOP            4
+
+#if defined(FIXED_POINT)
+#define SPEEX_BUILD "fixed-point"
+#else
+#define SPEEX_BUILD "floating-point"
+#endif
+
+/* a voiced signal: harmonics of a gliding pitch, syllable envelope and some noise */
+static std::vector<short> voice(int frames)
+{
+    std::vector<short> pcm(frames * SPEEX_FRAME_SIZE);
+    std::mt19937 rng(SPEEX_FRAME_SIZE);
+    std::normal_distribution<double> noise(0, 200);
+    double phase = 0;
+
+    for (size_t n = 0; n < pcm.size(); n++) {
+        double t = n / 16000.0;
+        double f0 = 140 + 30 * sin(2 * M_PI * 0.7 * t);
+        double env = 0.55 + 0.45 * sin(2 * M_PI * 4 * t);
+        double s = 0;
+
+        phase += 2 * M_PI * f0 / 16000;
+        for (int h = 1; h <= 12; h++) {
+            s += sin(h * phase) / h;
+        }
+        pcm[n] = (short)std::max(-32768.0, std::min(32767.0, 6000 * env * s + noise(rng)));
+    }
+    return pcm;
+}
+
+class SpeexEncodeTest : public testing::Test {
+  protected:
+    void *enc = NULL;
+    SpeexBits bits;
+
+    void SetUp() override
+    {
+        int quality = SPEEX_QUALITY_DEF;
+
+        enc = speex_encoder_init(speex_lib_get_mode(SPEEX_MODEID_WB));
+        ASSERT_NE(nullptr, enc);
+        speex_encoder_ctl(enc, SPEEX_SET_QUALITY, &quality);
+        speex_bits_init(&bits);
+    }
+
+    void TearDown() override
+    {
+        speex_bits_destroy(&bits);
+        speex_encoder_destroy(enc);
+    }
+
+    /* one frame the way speex_data_encode does it, the frame is scratch for the encoder */
+    int encode(const short *pcm, char *out)
+    {
+        short frame[SPEEX_FRAME_SIZE];
+
+        memcpy(frame, pcm, sizeof(frame));
+        speex_bits_reset(&bits);
+        speex_encode_int(enc, frame, &bits);
+        return speex_bits_write(&bits, out, SPEEX_MAX_FRAME_BYTES);
+    }
+};
+
+TEST_F(SpeexEncodeTest, FramesDecodeToSameEnergy)
+{
+    std::vector<short> pcm = voice(SPEEX_TEST_FRAMES);
+    std::vector<short> out(pcm.size());
+    void *dec = speex_decoder_init(speex_lib_get_mode(SPEEX_MODEID_WB));
+    SpeexBits dec_bits;
+    char cbits[SPEEX_MAX_FRAME_BYTES];
+
+    ASSERT_NE(nullptr, dec);
+    speex_bits_init(&dec_bits);
+    for (int f = 0; f < SPEEX_TEST_FRAMES; f++) {
+        int len = encode(&pcm[f * SPEEX_FRAME_SIZE], cbits);
+        ASSERT_EQ(MODE_1_QUALITY_5_FRAME_SIZE, len) << "frame " << f;
+        speex_bits_read_from(&dec_bits, cbits, len);
+        ASSERT_EQ(0, speex_decode_int(dec, &dec_bits, &out[f * SPEEX_FRAME_SIZE]));
+    }
+    speex_bits_destroy(&dec_bits);
+    speex_decoder_destroy(dec);
+
+    /* the first frames are the decoder settling */
+    double in_energy = 0, out_energy = 0;
+    for (size_t n = 10 * SPEEX_FRAME_SIZE; n < pcm.size(); n++) {
+        in_energy += (double)pcm[n] * pcm[n];
+        out_energy += (double)out[n] * out[n];
+    }
+    double ratio = out_energy / in_energy;
+    printf("%s: decoded energy %.2f of the input\n", SPEEX_BUILD, ratio);
+    EXPECT_GT(ratio, 0.5);
+    EXPECT_LT(ratio, 2.0);
+}
+
+TEST_F(SpeexEncodeTest, EncodeBenchmark)
+{
+    std::vector<short> pcm = voice(SPEEX_TEST_FRAMES);
+    char cbits[SPEEX_MAX_FRAME_BYTES];
+    size_t bytes = 0;
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int loop = 0; loop < SPEEX_BENCH_LOOP; loop++) {
+        for (int f = 0; f < SPEEX_TEST_FRAMES; f++) {
+            bytes += encode(&pcm[f * SPEEX_FRAME_SIZE], cbits);
+        }
+    }
+    double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+
+    int frames = SPEEX_BENCH_LOOP * SPEEX_TEST_FRAMES;
+    printf("%s: %.1f us per 20 ms frame, %.1f bytes per frame, %.1f%% of real time\n", SPEEX_BUILD, us / frames,
+           (double)bytes / frames, us / frames / 20000 * 100);
+    EXPECT_EQ((size_t)frames * MODE_1_QUALITY_5_FRAME_SIZE, bytes);
+}
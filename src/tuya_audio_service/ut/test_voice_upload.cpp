@@ -0,0 +1,302 @@
+/**
+ * @file test_voice_upload.cpp
+ * @brief UT and benchmark of the ASR upload framing of tuya_voice_protocol_ws.
+ *
+ * The speaker websocket sends through the real frame layer into a fake socket,
+ * so every chunk is read back from the masked frame. A chunk has to be the
+ * same bytes as the Speech__Request protobuf-c packs for it. The chunks per
+ * second and the heap allocations per chunk are printed next to packing the
+ * request for every chunk, as the upload did before.
+ *
+ * @copyright Copyright (c) 2021-2025 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tuya_iot.h"
+#include "websocket_frame.h"
+#include "websocket_netio.h"
+#include "aispeech.pb-c.h"
+#include "tuya_voice_protocol.h"
+#include "tuya_voice_protocol_ws.h"
+#include "tuya_voice_json_parse.h"
+#include "tuya_speaker_voice_gw.h"
+}
+
+#define UPLOAD_BENCH_CHUNK 20000
+#define UPLOAD_DEVID       "6c6f189feabb27bf1dcrii"
+
+/* heap allocations of the benchmark thread */
+static thread_local bool s_count_alloc;
+static thread_local int s_alloc_cnt;
+
+extern "C" {
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+    if (s_count_alloc) {
+        s_alloc_cnt++;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (s_count_alloc) {
+        s_alloc_cnt++;
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (s_count_alloc) {
+        s_alloc_cnt++;
+    }
+    return __libc_realloc(ptr, size);
+}
+}
+
+/* the speaker websocket over the real frame layer, the socket keeps the last frame only */
+static WEBSOCKET_S s_ws;
+static std::string s_sent;
+static tuya_iot_client_t s_client;
+
+extern "C" {
+OPERATE_RET websocket_netio_send_ext(WEBSOCKET_S *ws, void *data, size_t len)
+{
+    s_sent.assign((const char *)data, len);
+    return OPRT_OK;
+}
+
+OPERATE_RET websocket_netio_recv(WEBSOCKET_S *ws, uint8_t *buf, size_t size, size_t *recv_len)
+{
+    *recv_len = 0;
+    return OPRT_OK;
+}
+
+tuya_iot_client_t *tuya_iot_client_get(void)
+{
+    return &s_client;
+}
+
+OPERATE_RET tuya_speaker_ws_client_init(TUYA_SPEAKER_WS_CB bin_cb, TUYA_SPEAKER_WS_CB text_cb)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_speaker_ws_client_start(void)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_speaker_ws_client_stop(void)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_speaker_ws_send_bin(uint8_t *data, uint32_t len)
+{
+    return websocket_send_frame(&s_ws, WS_FRAME_TYPE_BINARY, data, len, TRUE, TRUE);
+}
+
+OPERATE_RET tuya_speaker_ws_send_bin_ext(uint8_t *head, uint32_t head_len, uint8_t *data, uint32_t len)
+{
+    WEBSOCKET_FRAME_SEG_S seg[2] = {{head, head_len}, {data, len}};
+
+    return websocket_send_frame_seg(&s_ws, WS_FRAME_TYPE_BINARY, seg, 2, TRUE, TRUE);
+}
+
+BOOL_T tuya_speaker_ws_is_online(void)
+{
+    return TRUE;
+}
+
+OPERATE_RET tuya_speaker_del_domain_name(void)
+{
+    return OPRT_OK;
+}
+
+void tuya_speaker_ws_disconnect(void)
+{
+}
+
+void tuya_speaker_ws_set_keepalive(uint32_t sec)
+{
+}
+
+OPERATE_RET tuya_voice_json_parse_tts(cJSON *json, TUYA_VOICE_TTS_S **tts)
+{
+    return OPRT_NOT_SUPPORTED;
+}
+
+void tuya_voice_json_parse_free_tts(TUYA_VOICE_TTS_S *tts)
+{
+}
+
+OPERATE_RET tuya_voice_json_parse_media(cJSON *json, TUYA_VOICE_MEDIA_S **media)
+{
+    return OPRT_NOT_SUPPORTED;
+}
+
+void tuya_voice_json_parse_free_media(TUYA_VOICE_MEDIA_S *p_media)
+{
+}
+}
+
+/* the payload of the last frame sent, unmasked */
+static std::string sent_payload(void)
+{
+    const uint8_t *p = (const uint8_t *)s_sent.data();
+    size_t len = p[1] & 0x7F, off = 2;
+
+    if (126 == len) {
+        len = (p[2] << 8) | p[3];
+        off = 4;
+    } else if (127 == len) {
+        len = 0;
+        for (int i = 0; i < 8; i++) {
+            len = (len << 8) | p[2 + i];
+        }
+        off = 10;
+    }
+    std::string out(len, '\0');
+    for (size_t i = 0; i < len; i++) {
+        out[i] = (char)(p[off + 4 + i] ^ p[off + i % 4]);
+    }
+    return out;
+}
+
+/* the upload before: a request packed into a buffer of its own for every chunk */
+static OPERATE_RET upload_send_packed(const char *request_id, uint8_t *buf, uint32_t len)
+{
+    Speech__Request req;
+    OPERATE_RET rt = OPRT_OK;
+
+    speech__request__init(&req);
+    req.requestid = (char *)request_id;
+    req.type = (char *)"ASR_MID";
+    req.block.len = len;
+    req.block.data = buf;
+
+    size_t enc_len = speech__request__get_packed_size(&req);
+    uint8_t *enc_buf = (uint8_t *)Malloc(enc_len);
+    if (NULL == enc_buf) {
+        return OPRT_MALLOC_FAILED;
+    }
+    enc_len = speech__request__pack(&req, enc_buf);
+    rt = tuya_speaker_ws_send_bin(enc_buf, enc_len);
+    Free(enc_buf);
+    return rt;
+}
+
+class VoiceUploadTest : public testing::Test {
+  protected:
+    TUYA_VOICE_UPLOAD_T uploader = NULL;
+    char request_id[64] = {0};
+
+    static void SetUpTestCase()
+    {
+        TUYA_VOICE_CBS_S cbs;
+
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        strcpy(s_client.activate.devid, UPLOAD_DEVID);
+        memset(&cbs, 0, sizeof(cbs));
+        ASSERT_EQ(OPRT_OK, tuya_voice_proto_ws_init(&cbs));
+    }
+
+    static void TearDownTestCase()
+    {
+        tuya_voice_proto_ws_deinit();
+    }
+
+    void SetUp() override
+    {
+        TUYA_VOICE_WS_START_PARAMS_S head;
+
+        memset(&s_ws, 0, sizeof(s_ws));
+        ASSERT_EQ(OPRT_OK, tal_mutex_create_init(&s_ws.mutex));
+        s_ws.is_connected = TRUE;
+        websocket_frame_reset(&s_ws);
+
+        memset(&head, 0, sizeof(head));
+        strcpy(head.ver_string, "1.2.0");
+        head.rate = 16000;
+        head.channels = 1;
+        ASSERT_EQ(OPRT_OK, tuya_voice_proto_ws_upload_start(&uploader, TUYA_VOICE_AUDIO_FORMAT_SPEEX,
+                                                            TUYA_VOICE_UPLOAD_TARGET_SPEECH, NULL,
+                                                            (uint8_t *)&head, sizeof(head)));
+        ASSERT_EQ(OPRT_OK, tuya_voice_proto_ws_upload_get_message_id(uploader, request_id, sizeof(request_id)));
+    }
+
+    void TearDown() override
+    {
+        tuya_voice_proto_ws_upload_stop(uploader, FALSE);
+        websocket_frame_release(&s_ws);
+        tal_mutex_release(s_ws.mutex);
+    }
+};
+
+TEST_F(VoiceUploadTest, ChunkIsPackedSpeechRequest)
+{
+    for (uint32_t len : {0, 1, 42, 127, 128, 640, 16383, 16384, 20000}) {
+        std::string chunk(len, '\0');
+        for (uint32_t i = 0; i < len; i++) {
+            chunk[i] = (char)(i * 131 + len);
+        }
+
+        ASSERT_EQ(OPRT_OK, upload_send_packed(request_id, (uint8_t *)&chunk[0], len));
+        std::string packed = sent_payload();
+        ASSERT_EQ(OPRT_OK, tuya_voice_proto_ws_upload_send(uploader, (uint8_t *)&chunk[0], len));
+        std::string framed = sent_payload();
+        EXPECT_TRUE(packed == framed) << "chunk " << len;
+
+        Speech__Request *req = speech__request__unpack(NULL, framed.size(), (const uint8_t *)framed.data());
+        ASSERT_NE(nullptr, req) << "chunk " << len;
+        EXPECT_STREQ("ASR_MID", req->type);
+        EXPECT_STREQ(request_id, req->requestid);
+        EXPECT_EQ(chunk, std::string((const char *)req->block.data, req->block.len));
+        speech__request__free_unpacked(req, NULL);
+    }
+}
+
+TEST_F(VoiceUploadTest, UploadBenchmark)
+{
+    for (uint32_t len : {42, 210, 640}) {
+        std::string chunk(len, 'v');
+        double ns[2];
+        int alloc[2];
+
+        for (int framed = 0; framed < 2; framed++) {
+            s_alloc_cnt = 0;
+            s_count_alloc = true;
+            auto begin = std::chrono::steady_clock::now();
+            for (int n = 0; n < UPLOAD_BENCH_CHUNK; n++) {
+                if (framed) {
+                    tuya_voice_proto_ws_upload_send(uploader, (uint8_t *)&chunk[0], len);
+                } else {
+                    upload_send_packed(request_id, (uint8_t *)&chunk[0], len);
+                }
+            }
+            ns[framed] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+            s_count_alloc = false;
+            alloc[framed] = s_alloc_cnt;
+        }
+
+        printf("%u byte chunk: packed %.0f chunks/s %.2f allocs, framed %.0f chunks/s %.2f allocs\n", len,
+               UPLOAD_BENCH_CHUNK / ns[0] * 1e9, (double)alloc[0] / UPLOAD_BENCH_CHUNK,
+               UPLOAD_BENCH_CHUNK / ns[1] * 1e9, (double)alloc[1] / UPLOAD_BENCH_CHUNK);
+        EXPECT_EQ(0, alloc[1]);
+        EXPECT_GE(alloc[0], UPLOAD_BENCH_CHUNK);
+    }
+}
@@ -0,0 +1,237 @@
+/**
+ * @file test_websocket_frame.cpp
+ * @brief UT of the websocket frame encoder and decoder.
+ *
+ * The socket is replaced by two byte queues: the frames sent by the client and
+ * the bytes the server has sent, which a read takes as much of as it asks for.
+ * A buffer grown by large frames has to stay while they go on and be freed
+ * after WS_FRAME_BUF_TRIM_FRAMES small ones.
+ *
+ * @copyright Copyright (c) 2021-2025 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <string.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "websocket_frame.h"
+#include "websocket_netio.h"
+}
+
+static std::string s_sent;   // bytes written by the client
+static std::string s_server; // bytes to be read by the client
+static int s_reads;
+
+extern "C" {
+OPERATE_RET websocket_netio_send_ext(WEBSOCKET_S *ws, void *data, size_t len)
+{
+    s_sent.append((const char *)data, len);
+    return OPRT_OK;
+}
+
+OPERATE_RET websocket_netio_recv(WEBSOCKET_S *ws, uint8_t *buf, size_t size, size_t *recv_len)
+{
+    s_reads++;
+    *recv_len = s_server.size() < size ? s_server.size() : size;
+    memcpy(buf, s_server.data(), *recv_len);
+    s_server.erase(0, *recv_len);
+    return OPRT_OK;
+}
+}
+
+struct frame_t {
+    WEBSOCKET_FRAME_TYPE_E type;
+    BOOL_T final;
+    std::string data;
+};
+
+static std::vector<frame_t> s_frames;
+
+static void on_frame(WEBSOCKET_S *ws, WEBSOCKET_FRAME_TYPE_E type, BOOL_T final, void *data, size_t len)
+{
+    s_frames.push_back({type, final, std::string((const char *)data, data ? len : 0)});
+}
+
+/* an unmasked server frame */
+static std::string server_frame(uint8_t opcode, bool fin, uint64_t len, const std::string &payload)
+{
+    std::string f;
+    f += (char)((fin ? 0x80 : 0) | opcode);
+    if (len <= 125) {
+        f += (char)len;
+    } else if (len <= 0xFFFF) {
+        f += (char)126;
+        f += (char)(len >> 8);
+        f += (char)len;
+    } else {
+        f += (char)127;
+        for (int i = 7; i >= 0; i--) {
+            f += (char)(len >> (8 * i));
+        }
+    }
+    return f + payload;
+}
+
+/* the payload of the first client frame in s_sent, unmasked */
+static std::string sent_payload(uint8_t *opcode)
+{
+    const uint8_t *p = (const uint8_t *)s_sent.data();
+    size_t len = p[1] & 0x7F, off = 2;
+
+    *opcode = p[0] & 0x0F;
+    if (126 == len) {
+        len = (p[2] << 8) | p[3];
+        off = 4;
+    }
+    std::string out;
+    for (size_t i = 0; i < len; i++) {
+        out += (char)(p[off + 4 + i] ^ p[off + i % 4]);
+    }
+    return out;
+}
+
+class WebsocketFrameTest : public testing::Test {
+  protected:
+    WEBSOCKET_S ws;
+
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+    }
+
+    void SetUp() override
+    {
+        memset(&ws, 0, sizeof(ws));
+        ASSERT_EQ(OPRT_OK, tal_mutex_create_init(&ws.mutex));
+        ws.is_connected = TRUE;
+        websocket_frame_reset(&ws);
+        s_sent.clear();
+        s_server.clear();
+        s_frames.clear();
+        s_reads = 0;
+    }
+
+    void TearDown() override
+    {
+        websocket_frame_release(&ws);
+        tal_mutex_release(ws.mutex);
+    }
+};
+
+TEST_F(WebsocketFrameTest, SentFrameIsMasked)
+{
+    std::string data(300, 'x');
+    uint8_t opcode = 0;
+
+    ASSERT_EQ(OPRT_OK, websocket_send_frame(&ws, WS_FRAME_TYPE_BINARY, (void *)data.data(), data.size(), TRUE, TRUE));
+    EXPECT_EQ(0x80, (uint8_t)s_sent[0] & 0x80);
+    EXPECT_EQ(0x80, (uint8_t)s_sent[1] & 0x80);
+    EXPECT_EQ(data, sent_payload(&opcode));
+    EXPECT_EQ(WS_FRAME_TYPE_BINARY, opcode);
+}
+
+TEST_F(WebsocketFrameTest, SegmentsAreSentAsOnePayload)
+{
+    WEBSOCKET_FRAME_SEG_S seg[2] = {{(const uint8_t *)"head", 4}, {(const uint8_t *)"body", 4}};
+    uint8_t opcode = 0;
+
+    ASSERT_EQ(OPRT_OK, websocket_send_frame_seg(&ws, WS_FRAME_TYPE_BINARY, seg, 2, TRUE, TRUE));
+    EXPECT_EQ("headbody", sent_payload(&opcode));
+}
+
+TEST_F(WebsocketFrameTest, FramesReadTogetherAreDecodedWithoutReadingAgain)
+{
+    s_server = server_frame(WS_FRAME_TYPE_TEXT, false, 3, "abc") + server_frame(WS_FRAME_TYPE_CONTINUATION, true, 2, "de") +
+               server_frame(WS_FRAME_TYPE_BINARY, true, 200, std::string(200, 'z'));
+
+    for (int i = 0; i < 3; i++) {
+        ASSERT_EQ(OPRT_OK, websocket_recv_frame(&ws, on_frame));
+    }
+    EXPECT_EQ(1, s_reads);
+    ASSERT_EQ(3u, s_frames.size());
+    EXPECT_EQ("abc", s_frames[0].data);
+    EXPECT_FALSE(s_frames[0].final);
+    // a continuation carries the type of its message
+    EXPECT_EQ(WS_FRAME_TYPE_TEXT, s_frames[1].type);
+    EXPECT_EQ("de", s_frames[1].data);
+    EXPECT_EQ(std::string(200, 'z'), s_frames[2].data);
+}
+
+TEST_F(WebsocketFrameTest, FrameLargerThanTheCapIsClosedWith1009)
+{
+    uint8_t opcode = 0;
+
+    // only the header arrives, nothing is buffered for the claimed length
+    s_server = server_frame(WS_FRAME_TYPE_BINARY, true, (uint64_t)WS_FRAME_MAX_SIZE + 1, "");
+
+    EXPECT_EQ(OPRT_COM_ERROR, websocket_recv_frame(&ws, on_frame));
+    EXPECT_TRUE(s_frames.empty());
+    EXPECT_LE(ws.rx_buf_size, (size_t)WS_FRAME_BUF_KEEP_SIZE);
+
+    std::string code = sent_payload(&opcode);
+    EXPECT_EQ(WS_FRAME_TYPE_CLOSE, opcode);
+    ASSERT_EQ(2u, code.size());
+    EXPECT_EQ(WS_STATUS_CODE_MESSAGE_TOO_BIG, ((uint8_t)code[0] << 8) | (uint8_t)code[1]);
+}
+
+TEST_F(WebsocketFrameTest, FrameAtTheCapIsDelivered)
+{
+    s_server = server_frame(WS_FRAME_TYPE_BINARY, true, WS_FRAME_MAX_SIZE, std::string(WS_FRAME_MAX_SIZE, 'm'));
+
+    ASSERT_EQ(OPRT_OK, websocket_recv_frame(&ws, on_frame));
+    ASSERT_EQ(1u, s_frames.size());
+    EXPECT_EQ((size_t)WS_FRAME_MAX_SIZE, s_frames[0].data.size());
+    EXPECT_TRUE(s_sent.empty());
+}
+
+TEST_F(WebsocketFrameTest, SendBufferIsKeptWhileLargeFramesGoOn)
+{
+    std::string large(WS_FRAME_BUF_KEEP_SIZE * 4, 'l');
+    uint8_t *buf = NULL;
+
+    ASSERT_EQ(OPRT_OK, websocket_send_frame(&ws, WS_FRAME_TYPE_BINARY, (void *)large.data(), large.size(), TRUE, TRUE));
+    buf = ws.tx_buf;
+    ASSERT_GT(ws.tx_buf_size, large.size());
+    for (int i = 0; i < 10; i++) {
+        // a small frame between the large ones does not free it
+        ASSERT_EQ(OPRT_OK, websocket_send_frame(&ws, WS_FRAME_TYPE_PING, NULL, 0, TRUE, TRUE));
+        ASSERT_EQ(OPRT_OK,
+                  websocket_send_frame(&ws, WS_FRAME_TYPE_BINARY, (void *)large.data(), large.size(), TRUE, TRUE));
+    }
+    EXPECT_EQ(buf, ws.tx_buf);
+
+    for (int i = 0; i < WS_FRAME_BUF_TRIM_FRAMES - 1; i++) {
+        ASSERT_EQ(OPRT_OK, websocket_send_frame(&ws, WS_FRAME_TYPE_TEXT, (void *)"small", 5, TRUE, TRUE));
+    }
+    EXPECT_EQ(buf, ws.tx_buf);
+    ASSERT_EQ(OPRT_OK, websocket_send_frame(&ws, WS_FRAME_TYPE_TEXT, (void *)"small", 5, TRUE, TRUE));
+    EXPECT_LE(ws.tx_buf_size, (size_t)WS_FRAME_BUF_KEEP_SIZE);
+}
+
+TEST_F(WebsocketFrameTest, RecvBufferIsKeptWhileLargeFramesGoOn)
+{
+    std::string large(WS_FRAME_BUF_KEEP_SIZE * 4, 'l');
+    size_t size = 0;
+
+    for (int i = 0; i < 10; i++) {
+        s_server = server_frame(WS_FRAME_TYPE_BINARY, true, large.size(), large);
+        ASSERT_EQ(OPRT_OK, websocket_recv_frame(&ws, on_frame));
+        ASSERT_GT(ws.rx_buf_size, large.size());
+        EXPECT_TRUE(0 == size || size == ws.rx_buf_size);
+        size = ws.rx_buf_size;
+    }
+
+    for (int i = 0; i < WS_FRAME_BUF_TRIM_FRAMES - 1; i++) {
+        s_server = server_frame(WS_FRAME_TYPE_TEXT, true, 5, "small");
+        ASSERT_EQ(OPRT_OK, websocket_recv_frame(&ws, on_frame));
+    }
+    EXPECT_EQ(size, ws.rx_buf_size);
+    s_server = server_frame(WS_FRAME_TYPE_TEXT, true, 5, "small");
+    ASSERT_EQ(OPRT_OK, websocket_recv_frame(&ws, on_frame));
+    EXPECT_LE(ws.rx_buf_size, (size_t)WS_FRAME_BUF_KEEP_SIZE);
+    EXPECT_EQ(10u + WS_FRAME_BUF_TRIM_FRAMES, s_frames.size());
+}
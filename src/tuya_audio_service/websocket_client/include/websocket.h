@@ -106,6 +106,15 @@ typedef struct __WEBSOCKET_H__{
     void (*recv_bin_cb)(uint8_t *data, size_t len);
     void (*recv_text_cb)(uint8_t *data, size_t len);
 
+    uint8_t                *tx_buf;     // header and masked payload of the frame being sent, under mutex
+    size_t                  tx_buf_size;
+    uint16_t                tx_small_frames; // frames in a row that fit in WS_FRAME_BUF_KEEP_SIZE
+    uint8_t                *rx_buf;     // received bytes, only used by the work thread
+    size_t                  rx_buf_size;
+    uint16_t                rx_small_frames;
+    size_t                  rx_head;    // first byte not decoded
+    size_t                  rx_tail;    // end of the received bytes
+    uint8_t                 rx_msg_type; // opcode of the fragmented message being received
 
 } WEBSOCKET_S;
 
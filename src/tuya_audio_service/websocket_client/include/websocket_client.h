@@ -146,6 +146,21 @@ OPERATE_RET websocket_client_send_text(WEBSOCKET_HANDLE_T handle, uint8_t *data,
  */
 OPERATE_RET websocket_client_send_bin(WEBSOCKET_HANDLE_T handle, uint8_t *data, uint32_t len);
 
+/**
+ * @brief Send binary data made of a head and a body as one message, without joining them
+ * 
+ * @param[in] handle WebSocket client handle
+ * @param[in] head Head of the data
+ * @param[in] head_len Length of the head
+ * @param[in] data Body of the data, sent right after the head
+ * @param[in] len Length of the body
+ * @return OPERATE_RET
+ *         - OPRT_OK: Success
+ *         - Others: Failure
+ */
+OPERATE_RET websocket_client_send_bin_ext(WEBSOCKET_HANDLE_T handle, uint8_t *head, uint32_t head_len,
+                                          uint8_t *data, uint32_t len);
+
 /**
  * @brief Send a ping frame through the WebSocket connection
  * 
@@ -29,6 +29,19 @@ extern "C" {
 #define WS_FRAME_HEADER_SIZE            (10) // frame header size
 #define WS_MASKING_KEY_SIZE             (4) // masking key size
 
+#ifndef WS_FRAME_BUF_KEEP_SIZE
+#define WS_FRAME_BUF_KEEP_SIZE          (2048) // send/recv buffers are kept between frames up to this size
+#endif
+
+#ifndef WS_FRAME_BUF_TRIM_FRAMES
+#define WS_FRAME_BUF_TRIM_FRAMES        (16) // a larger buffer is freed after so many frames in a row fit in the
+                                             // kept size, 1 frees it after every small frame
+#endif
+
+#ifndef WS_FRAME_MAX_SIZE
+#define WS_FRAME_MAX_SIZE               (64 * 1024) // larger received frames close the connection with 1009
+#endif
+
 /**
  * @brief WebSocket ANBF description
     0                   1                   2                   3
@@ -92,14 +105,26 @@ typedef struct {
     uint8_t ext_payload_len[0];
 } __attribute__((packed)) WEBSOCKET_FRAME_HEADER_S;
 
+/**
+ * @brief a piece of the frame payload
+ **/
+typedef struct {
+    const uint8_t *data;
+    size_t len;
+} WEBSOCKET_FRAME_SEG_S;
+
+/**
+ * @brief called for every received frame, data points into the receive buffer of the connection
+ *        and is valid until the callback returns, continuation frames carry the type of their message
+ **/
 typedef void (*WEBSOCKET_FRAME_RECV_CB)(WEBSOCKET_S *ws, WEBSOCKET_FRAME_TYPE_E type, BOOL_T final, void *data, size_t len);
 
 /**
  * @brief Send a WebSocket frame with specified parameters
  *
  * This function constructs and sends a WebSocket frame with the given data and frame parameters.
- * It handles both masked and unmasked frames, supports fragmentation, and performs the necessary
- * data masking as per WebSocket protocol specifications.
+ * The header and the masked payload are built in the send buffer of the connection, which is
+ * kept between frames, and go out in one write.
  *
  * @param[in] ws Pointer to the WebSocket structure
  * @param[in] type Type of the WebSocket frame (e.g., text, binary, ping, pong)
@@ -111,6 +136,7 @@ typedef void (*WEBSOCKET_FRAME_RECV_CB)(WEBSOCKET_S *ws, WEBSOCKET_FRAME_TYPE_E
  * @return OPERATE_RET
  *         - OPRT_OK: Frame sent successfully
  *         - OPRT_INVALID_PARM: Invalid parameters (NULL pointer)
+ *         - OPRT_MALLOC_FAILED: Memory allocation failure
  *         - OPRT_SEND_ERR: Error occurred during frame sending
  *
  * @note For fragmented messages, set first=TRUE for the first frame, first=FALSE for continuation
@@ -119,21 +145,47 @@ typedef void (*WEBSOCKET_FRAME_RECV_CB)(WEBSOCKET_S *ws, WEBSOCKET_FRAME_TYPE_E
 OPERATE_RET websocket_send_frame(WEBSOCKET_S *ws, WEBSOCKET_FRAME_TYPE_E type,
                                  void *data, size_t len, BOOL_T first, BOOL_T final);
 
+/**
+ * @brief Send a WebSocket frame whose payload is the segments in order
+ *
+ * The header and the segments, masked, are built in the send buffer of the connection,
+ * which is kept between frames, and go out in one write, so a payload in several pieces
+ * is not joined by the caller.
+ *
+ * @param[in] ws Pointer to the WebSocket structure
+ * @param[in] type Type of the WebSocket frame (e.g., text, binary, ping, pong)
+ * @param[in] seg Payload segments, NULL data is allowed for zero length
+ * @param[in] seg_num Number of segments
+ * @param[in] first Boolean indicating if this is the first frame in a fragmented message
+ * @param[in] final Boolean indicating if this is the final frame in a fragmented message
+ *
+ * @return OPERATE_RET
+ *         - OPRT_OK: Frame sent successfully
+ *         - OPRT_INVALID_PARM: Invalid parameters (NULL pointer)
+ *         - OPRT_MALLOC_FAILED: Memory allocation failure
+ *         - OPRT_SEND_ERR: Error occurred during frame sending
+ */
+OPERATE_RET websocket_send_frame_seg(WEBSOCKET_S *ws, WEBSOCKET_FRAME_TYPE_E type,
+                                     const WEBSOCKET_FRAME_SEG_S *seg, uint32_t seg_num, BOOL_T first, BOOL_T final);
+
 /**
  * @brief Receive and process a WebSocket frame
  *
- * This function reads and processes an incoming WebSocket frame, including:
- * 1. Reading the frame header
+ * This function decodes the next frame from the receive buffer of the connection:
+ * 1. Reading until the frame header is buffered
  * 2. Handling extended payload lengths (16-bit and 64-bit)
  * 3. Parsing the frame header
- * 4. Processing the frame payload data
- * 5. Invoking the callback function with the received frame data
+ * 4. Reading until the frame payload is buffered
+ * 5. Invoking the callback function with the payload in place
+ *
+ * Every read takes as many bytes as available, so frames which arrived together are
+ * decoded without reading the socket again.
  *
  * @param[in] ws Pointer to the WebSocket structure
  * @param[in] frame_recv_cb Callback function to handle received frame data
  *                         The callback receives:
  *                         - WebSocket structure pointer
- *                         - Frame opcode
+ *                         - Frame opcode, the message opcode for continuation frames
  *                         - FIN flag indicating if this is the final frame
  *                         - Pointer to payload data (NULL if empty)
  *                         - Length of payload data
@@ -142,14 +194,32 @@ OPERATE_RET websocket_send_frame(WEBSOCKET_S *ws, WEBSOCKET_FRAME_TYPE_E type,
  *         - OPRT_OK: Frame received and processed successfully
  *         - OPRT_INVALID_PARM: Invalid parameters (NULL pointers)
  *         - OPRT_RECV_ERR: Error occurred during frame reception
- *         - OPRT_COM_ERROR: Error parsing frame header
+ *         - OPRT_COM_ERROR: Error parsing frame header, or the payload is larger than
+ *           WS_FRAME_MAX_SIZE, the connection is closed with 1009 then
  *         - OPRT_MALLOC_FAILED: Memory allocation failure
  *
- * @note The callback function is responsible for processing the frame data
- *       before this function returns, as the data buffer will be freed
+ * @note The payload stays in the receive buffer only until the callback returns
  */
 OPERATE_RET websocket_recv_frame(WEBSOCKET_S *ws, WEBSOCKET_FRAME_RECV_CB frame_recv_cb);
 
+/**
+ * @brief Reset the frame decoder, called before a new connection is used
+ *
+ * @param[in] ws Pointer to the WebSocket structure
+ *
+ * @return none
+ */
+void websocket_frame_reset(WEBSOCKET_S *ws);
+
+/**
+ * @brief Free the send and receive buffers of the connection
+ *
+ * @param[in] ws Pointer to the WebSocket structure
+ *
+ * @return none
+ */
+void websocket_frame_release(WEBSOCKET_S *ws);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -133,6 +133,7 @@ static OPERATE_RET __websocket_destory(WEBSOCKET_HANDLE_T handle, char *tag)
 
     WS_ASSERT(OPRT_OK == tal_mutex_release(ws->mutex));
     WS_ASSERT(OPRT_OK == tal_mutex_release(ws->sem_link));
+    websocket_frame_release(ws);
     WS_SAFE_FREE(ws->uri);
     WS_SAFE_FREE(ws->path);
     WS_SAFE_FREE(ws->origin);
@@ -402,6 +403,7 @@ OPERATE_RET websocket_client_connect(WEBSOCKET_HANDLE_T handle)
 
     PR_DEBUG("websocket %p connect", ws);
 
+    websocket_frame_reset(ws);
     WS_CALL_ERR_RET(websocket_handshake_start(ws));
     WS_CALL_ERR_RET(websocket_hb_ping_timer_start(ws));
 
@@ -423,7 +425,7 @@ OPERATE_RET websocket_client_receive(WEBSOCKET_HANDLE_T handle)
 
     WS_DEBUG("websocket %p receive", ws);
 
-    return websocket_recv_frame(ws, __websocket_frame_recv_cb);;
+    return websocket_recv_frame(ws, __websocket_frame_recv_cb);
 }
 
 /**
@@ -458,6 +460,27 @@ OPERATE_RET websocket_client_send_bin(WEBSOCKET_HANDLE_T handle, uint8_t *data,
     return websocket_send_frame(ws, WS_FRAME_TYPE_BINARY, data, len, TRUE, TRUE);
 }
 
+/**
+ * @brief Send binary data made of a head and a body as one message, without joining them
+ * 
+ * @param[in] handle WebSocket client handle
+ * @param[in] head Head of the data
+ * @param[in] head_len Length of the head
+ * @param[in] data Body of the data, sent right after the head
+ * @param[in] len Length of the body
+ * @return OPERATE_RET
+ *         - OPRT_OK: Success
+ *         - Others: Failure
+ */
+OPERATE_RET websocket_client_send_bin_ext(WEBSOCKET_HANDLE_T handle, uint8_t *head, uint32_t head_len,
+                                          uint8_t *data, uint32_t len)
+{
+    WEBSOCKET_S *ws = (WEBSOCKET_S *)handle;
+    WEBSOCKET_FRAME_SEG_S seg[2] = {{head, head_len}, {data, len}};
+
+    return websocket_send_frame_seg(ws, WS_FRAME_TYPE_BINARY, seg, 2, TRUE, TRUE);
+}
+
 /**
  * @brief Send a ping frame through the WebSocket connection
  * 
@@ -26,7 +26,7 @@
 static OPERATE_RET websocket_format_frame_header(BOOL_T fin, WEBSOCKET_FRAME_TYPE_E type, uint64_t len,
                                                  uint8_t *masking_key, uint8_t *headbuf, uint8_t *headlen)
 {
-    uint8_t i = 0, length = 0;
+    uint8_t length = 0;
     WS_CHECK_NULL_RET(masking_key);
     WS_CHECK_NULL_RET(headbuf);
     WS_CHECK_NULL_RET(headlen);
@@ -51,9 +51,7 @@ static OPERATE_RET websocket_format_frame_header(BOOL_T fin, WEBSOCKET_FRAME_TYP
         length += sizeof(uint64_t);
     }
 
-    for (i = 0; i < WS_MASKING_KEY_SIZE; i++) {
-        masking_key[i] = (uint8_t)uni_random_range(0xFF);
-    }
+    uni_random_bytes(masking_key, WS_MASKING_KEY_SIZE);
     memcpy(headbuf + length, masking_key, WS_MASKING_KEY_SIZE);
 
     *headlen = length + WS_MASKING_KEY_SIZE;
@@ -65,72 +63,173 @@ static OPERATE_RET websocket_format_frame_header(BOOL_T fin, WEBSOCKET_FRAME_TYP
     return OPRT_OK;
 }
 
+static OPERATE_RET websocket_buf_reserve(uint8_t **buf, size_t *buf_size, size_t keep, size_t need)
+{
+    uint8_t *new_buf = NULL;
+    size_t new_size = (need > WS_FRAME_BUF_KEEP_SIZE) ? need : WS_FRAME_BUF_KEEP_SIZE;
+
+    if (*buf_size >= need) {
+        return OPRT_OK;
+    }
+
+    WS_MALLOC_ERR_RET(new_buf, new_size);
+    if (*buf) {
+        memcpy(new_buf, *buf, keep);
+        Free(*buf);
+    }
+    *buf = new_buf;
+    *buf_size = new_size;
+
+    return OPRT_OK;
+}
+
+/* a buffer grown by large frames is kept while they go on, so a stream of them is not
+   reallocated every frame, and freed when idle after WS_FRAME_BUF_TRIM_FRAMES small ones */
+static void websocket_buf_trim(uint8_t **buf, size_t *buf_size, uint16_t *small_frames, size_t frame_len,
+                               BOOL_T idle)
+{
+    if (frame_len > WS_FRAME_BUF_KEEP_SIZE) {
+        *small_frames = 0;
+        return;
+    }
+    if (*small_frames < WS_FRAME_BUF_TRIM_FRAMES) {
+        (*small_frames)++;
+    }
+    if (idle && *buf_size > WS_FRAME_BUF_KEEP_SIZE && *small_frames >= WS_FRAME_BUF_TRIM_FRAMES) {
+        Free(*buf);
+        *buf = NULL;
+        *buf_size = 0;
+        *small_frames = 0;
+    }
+}
+
+/* xor 8 bytes a time, the key is repeated to a word so any alignment of src/dst works,
+   offset is the position of src in the payload */
+static void websocket_mask_payload(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t *masking_key,
+                                   size_t offset)
+{
+    uint8_t key_bytes[sizeof(uint64_t)];
+    uint64_t key = 0, word = 0;
+    size_t i = 0;
+
+    for (i = 0; i < sizeof(key_bytes); i++) {
+        key_bytes[i] = masking_key[(offset + i) % WS_MASKING_KEY_SIZE];
+    }
+    memcpy(&key, key_bytes, sizeof(key));
+
+    for (i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        memcpy(&word, src + i, sizeof(word));
+        word ^= key;
+        memcpy(dst + i, &word, sizeof(word));
+    }
+    for (; i < len; i++) {
+        dst[i] = src[i] ^ key_bytes[i % WS_MASKING_KEY_SIZE];
+    }
+}
+
 /**
- * @brief Send a WebSocket frame with specified parameters
+ * @brief Send a WebSocket frame whose payload is the segments in order
  *
- * This function constructs and sends a WebSocket frame with the given data and frame parameters.
- * It handles both masked and unmasked frames, supports fragmentation, and performs the necessary
- * data masking as per WebSocket protocol specifications.
+ * The header and the segments, masked, are built in the send buffer of the connection,
+ * which is kept between frames, and go out in one write, so a payload in several pieces
+ * is not joined by the caller.
  *
  * @param[in] ws Pointer to the WebSocket structure
  * @param[in] type Type of the WebSocket frame (e.g., text, binary, ping, pong)
- * @param[in] data Pointer to the data to be sent in the frame
- * @param[in] len Length of the data in bytes
+ * @param[in] seg Payload segments, NULL data is allowed for zero length
+ * @param[in] seg_num Number of segments
  * @param[in] first Boolean indicating if this is the first frame in a fragmented message
  * @param[in] final Boolean indicating if this is the final frame in a fragmented message
  *
  * @return OPERATE_RET
  *         - OPRT_OK: Frame sent successfully
  *         - OPRT_INVALID_PARM: Invalid parameters (NULL pointer)
+ *         - OPRT_MALLOC_FAILED: Memory allocation failure
  *         - OPRT_SEND_ERR: Error occurred during frame sending
- *
- * @note For fragmented messages, set first=TRUE for the first frame, first=FALSE for continuation
- *       frames, and final=TRUE for the last frame in the sequence.
  */
-OPERATE_RET websocket_send_frame(WEBSOCKET_S *ws, WEBSOCKET_FRAME_TYPE_E type,
-                                 void *data, size_t len, BOOL_T first, BOOL_T final)
+OPERATE_RET websocket_send_frame_seg(WEBSOCKET_S *ws, WEBSOCKET_FRAME_TYPE_E type,
+                                     const WEBSOCKET_FRAME_SEG_S *seg, uint32_t seg_num, BOOL_T first, BOOL_T final)
 {
     WEBSOCKET_FRAME_TYPE_E frame_type;
-    uint8_t headbuf[WS_FRAME_HEADER_SIZE] = {0}, headlen = 0;
+    uint8_t headlen = 0;
     uint8_t masking_key[WS_MASKING_KEY_SIZE] = {0};
+    size_t len = 0, offset = 0;
+    uint32_t i = 0;
     OPERATE_RET rt = OPRT_OK;
     WS_CHECK_NULL_RET(ws);
+    WS_CHECK_NULL_RET(ws->mutex);
 
+    for (i = 0; i < seg_num; i++) {
+        if (NULL == seg[i].data && seg[i].len) {
+            return OPRT_INVALID_PARM;
+        }
+        len += seg[i].len;
+    }
     frame_type = (!first) ? WS_FRAME_TYPE_CONTINUATION : type;
-    rt = websocket_format_frame_header(final, frame_type, (uint64_t)len, masking_key, headbuf, &headlen);
-    if (OPRT_OK != rt) {
-        PR_ERR("websocket %p format header error, rt:%d", ws, rt);
+
+    WS_ASSERT(OPRT_OK == tal_mutex_lock(ws->mutex));
+    if (!ws->is_connected) {
+        WS_ASSERT(OPRT_OK == tal_mutex_unlock(ws->mutex));
+        PR_ERR("websocket %p is disconnected, send frame failed", ws);
         return OPRT_SEND_ERR;
     }
 
-    if ((0 != len) && (NULL != (char *)data)) {
-        size_t i = 0;
-        char *buffer = NULL;
-        size_t buffer_size = len + headlen;
-        WS_MALLOC_ERR_RET(buffer, buffer_size);
-        memcpy(buffer, headbuf, headlen);
-        memcpy(buffer + headlen, (uint8_t*)data, len);
-        for (i = 0; i < len; i++) {
-            buffer[headlen + i] ^= masking_key[i % 4]; //convert unmasked data into masked data
-        }
-        rt = websocket_netio_send_lock(ws, buffer, buffer_size);
-        if (OPRT_OK != rt) {
-            WS_SAFE_FREE(buffer);
-            PR_ERR("websocket %p websocket_send_frame error, rt:%d", ws, rt);
-            return OPRT_SEND_ERR;
-        }
-        WS_SAFE_FREE(buffer);
-    } else {
-        rt = websocket_netio_send_lock(ws, headbuf, headlen);
-        if (OPRT_OK != rt) {
-            PR_ERR("websocket %p websocket send header error, rt:%d", ws, rt);
-            return OPRT_SEND_ERR;
+    rt = websocket_buf_reserve(&ws->tx_buf, &ws->tx_buf_size, 0, WS_FRAME_HEADER_SIZE + WS_MASKING_KEY_SIZE + len);
+    if (OPRT_OK != rt) {
+        WS_ASSERT(OPRT_OK == tal_mutex_unlock(ws->mutex));
+        return rt;
+    }
+
+    rt = websocket_format_frame_header(final, frame_type, (uint64_t)len, masking_key, ws->tx_buf, &headlen);
+    if (OPRT_OK == rt) {
+        for (i = 0; i < seg_num; i++) {
+            websocket_mask_payload(ws->tx_buf + headlen + offset, seg[i].data, seg[i].len, masking_key, offset);
+            offset += seg[i].len;
         }
+        rt = websocket_netio_send_ext(ws, ws->tx_buf, headlen + len);
+    }
+    websocket_buf_trim(&ws->tx_buf, &ws->tx_buf_size, &ws->tx_small_frames, headlen + len, TRUE);
+    WS_ASSERT(OPRT_OK == tal_mutex_unlock(ws->mutex));
+
+    if (OPRT_OK != rt) {
+        PR_ERR("websocket %p websocket_send_frame error, rt:%d", ws, rt);
+        return OPRT_SEND_ERR;
     }
 
     return OPRT_OK;
 }
 
+/**
+ * @brief Send a WebSocket frame with specified parameters
+ *
+ * This function constructs and sends a WebSocket frame with the given data and frame parameters.
+ * The header and the masked payload are built in the send buffer of the connection, which is
+ * kept between frames, and go out in one write.
+ *
+ * @param[in] ws Pointer to the WebSocket structure
+ * @param[in] type Type of the WebSocket frame (e.g., text, binary, ping, pong)
+ * @param[in] data Pointer to the data to be sent in the frame
+ * @param[in] len Length of the data in bytes
+ * @param[in] first Boolean indicating if this is the first frame in a fragmented message
+ * @param[in] final Boolean indicating if this is the final frame in a fragmented message
+ *
+ * @return OPERATE_RET
+ *         - OPRT_OK: Frame sent successfully
+ *         - OPRT_INVALID_PARM: Invalid parameters (NULL pointer)
+ *         - OPRT_MALLOC_FAILED: Memory allocation failure
+ *         - OPRT_SEND_ERR: Error occurred during frame sending
+ *
+ * @note For fragmented messages, set first=TRUE for the first frame, first=FALSE for continuation
+ *       frames, and final=TRUE for the last frame in the sequence.
+ */
+OPERATE_RET websocket_send_frame(WEBSOCKET_S *ws, WEBSOCKET_FRAME_TYPE_E type,
+                                 void *data, size_t len, BOOL_T first, BOOL_T final)
+{
+    WEBSOCKET_FRAME_SEG_S seg = {(const uint8_t *)data, data ? len : 0};
+
+    return websocket_send_frame_seg(ws, type, &seg, 1, first, final);
+}
+
 static BOOL_T websocket_check_opcode_valid(uint8_t opcode)
 {
     if (opcode != WS_FRAME_TYPE_CONTINUATION && opcode != WS_FRAME_TYPE_TEXT &&
@@ -171,21 +270,104 @@ static OPERATE_RET websocket_parse_frame_header(WEBSOCKET_FRAME_HEADER_S *frame_
     return OPRT_OK;
 }
 
+/* tell the server why the connection is closed, the payload is the status code */
+static void websocket_send_close_code(WEBSOCKET_S *ws, WEBSOCKET_STATUS_CODE_E code)
+{
+    uint8_t payload[2] = {(uint8_t)(code >> 8), (uint8_t)code};
+
+    websocket_send_frame(ws, WS_FRAME_TYPE_CLOSE, payload, sizeof(payload), TRUE, TRUE);
+}
+
+/* read until len bytes are buffered from rx_head, the buffer may move */
+static OPERATE_RET websocket_rx_fill(WEBSOCKET_S *ws, size_t len)
+{
+    size_t recv_len = 0;
+    OPERATE_RET rt = OPRT_OK;
+
+    while (ws->rx_tail - ws->rx_head < len) {
+        if (ws->rx_head && ws->rx_buf_size - ws->rx_head < len) {
+            memmove(ws->rx_buf, ws->rx_buf + ws->rx_head, ws->rx_tail - ws->rx_head);
+            ws->rx_tail -= ws->rx_head;
+            ws->rx_head = 0;
+        }
+        WS_CALL_ERR_RET(websocket_buf_reserve(&ws->rx_buf, &ws->rx_buf_size, ws->rx_tail, ws->rx_head + len));
+
+        // take whatever is available, the following frames are decoded without reading again
+        rt = websocket_netio_recv(ws, ws->rx_buf + ws->rx_tail, ws->rx_buf_size - ws->rx_tail, &recv_len);
+        if (OPRT_OK != rt || 0 == recv_len) {
+            PR_ERR("websocket %p websocket_netio_recv error, rt:%d, recv_len:%d", ws, rt, recv_len);
+            return OPRT_RECV_ERR;
+        }
+        ws->rx_tail += recv_len;
+    }
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief Reset the frame decoder, called before a new connection is used
+ *
+ * @param[in] ws Pointer to the WebSocket structure
+ *
+ * @return none
+ */
+void websocket_frame_reset(WEBSOCKET_S *ws)
+{
+    if (NULL == ws) {
+        return;
+    }
+
+    ws->rx_head = 0;
+    ws->rx_tail = 0;
+    ws->rx_msg_type = WS_FRAME_TYPE_CONTINUATION;
+}
+
+/**
+ * @brief Free the send and receive buffers of the connection
+ *
+ * @param[in] ws Pointer to the WebSocket structure
+ *
+ * @return none
+ */
+void websocket_frame_release(WEBSOCKET_S *ws)
+{
+    if (NULL == ws) {
+        return;
+    }
+
+    if (ws->tx_buf) {
+        Free(ws->tx_buf);
+        ws->tx_buf = NULL;
+    }
+    ws->tx_buf_size = 0;
+    ws->tx_small_frames = 0;
+    if (ws->rx_buf) {
+        Free(ws->rx_buf);
+        ws->rx_buf = NULL;
+    }
+    ws->rx_buf_size = 0;
+    ws->rx_small_frames = 0;
+    websocket_frame_reset(ws);
+}
+
 /**
  * @brief Receive and process a WebSocket frame
  *
- * This function reads and processes an incoming WebSocket frame, including:
- * 1. Reading the frame header
+ * This function decodes the next frame from the receive buffer of the connection:
+ * 1. Reading until the frame header is buffered
  * 2. Handling extended payload lengths (16-bit and 64-bit)
  * 3. Parsing the frame header
- * 4. Processing the frame payload data
- * 5. Invoking the callback function with the received frame data
+ * 4. Reading until the frame payload is buffered
+ * 5. Invoking the callback function with the payload in place
+ *
+ * Every read takes as many bytes as available, so frames which arrived together are
+ * decoded without reading the socket again.
  *
  * @param[in] ws Pointer to the WebSocket structure
  * @param[in] frame_recv_cb Callback function to handle received frame data
  *                         The callback receives:
  *                         - WebSocket structure pointer
- *                         - Frame opcode
+ *                         - Frame opcode, the message opcode for continuation frames
  *                         - FIN flag indicating if this is the final frame
  *                         - Pointer to payload data (NULL if empty)
  *                         - Length of payload data
@@ -194,68 +376,75 @@ static OPERATE_RET websocket_parse_frame_header(WEBSOCKET_FRAME_HEADER_S *frame_
  *         - OPRT_OK: Frame received and processed successfully
  *         - OPRT_INVALID_PARM: Invalid parameters (NULL pointers)
  *         - OPRT_RECV_ERR: Error occurred during frame reception
- *         - OPRT_COM_ERROR: Error parsing frame header
+ *         - OPRT_COM_ERROR: Error parsing frame header, or the payload is larger than
+ *           WS_FRAME_MAX_SIZE, the connection is closed with 1009 then
  *         - OPRT_MALLOC_FAILED: Memory allocation failure
  *
- * @note The callback function is responsible for processing the frame data
- *       before this function returns, as the data buffer will be freed
+ * @note The payload stays in the receive buffer only until the callback returns
  */
 OPERATE_RET websocket_recv_frame(WEBSOCKET_S *ws, WEBSOCKET_FRAME_RECV_CB frame_recv_cb)
 {
     size_t headlen = sizeof(WEBSOCKET_FRAME_HEADER_S);
-    uint8_t headbuf[WS_FRAME_HEADER_SIZE] = {0};
-    WEBSOCKET_FRAME_HEADER_S *frame_head = (WEBSOCKET_FRAME_HEADER_S *)headbuf;
+    WEBSOCKET_FRAME_HEADER_S *frame_head = NULL;
+    WEBSOCKET_FRAME_TYPE_E type;
+    uint64_t data_len = 0;
     OPERATE_RET rt = OPRT_OK;
     WS_CHECK_NULL_RET(ws);
     WS_CHECK_NULL_RET(frame_recv_cb);
 
-    rt = websocket_netio_recv_ext(ws, headbuf, headlen);
+    rt = websocket_rx_fill(ws, headlen);
     if (OPRT_OK != rt) {
-        PR_ERR("websocket %p websocket_netio_recv_ext error, rt:%d", ws, rt);
-        return OPRT_RECV_ERR;
+        return rt;
     }
 
-    size_t ext_payload_len = 0;
+    frame_head = (WEBSOCKET_FRAME_HEADER_S *)(ws->rx_buf + ws->rx_head);
     switch (frame_head->payload_len) {
-        case 126: ext_payload_len = sizeof(uint16_t); break;
-        case 127: ext_payload_len = sizeof(uint64_t); break;
-        default : ext_payload_len = 0; break;
+        case 126: headlen += sizeof(uint16_t); break;
+        case 127: headlen += sizeof(uint64_t); break;
+        default : break;
     }
-    if (ext_payload_len > 0) {
-        rt = websocket_netio_recv_ext(ws, headbuf+headlen, ext_payload_len);
+    if (headlen > sizeof(WEBSOCKET_FRAME_HEADER_S)) {
+        rt = websocket_rx_fill(ws, headlen);
         if (OPRT_OK != rt) {
-            PR_ERR("websocket %p websocket_netio_recv_ext error, rt:%d", ws, rt);
-            return OPRT_RECV_ERR;
+            return rt;
         }
-        headlen += ext_payload_len;
+        frame_head = (WEBSOCKET_FRAME_HEADER_S *)(ws->rx_buf + ws->rx_head);
     }
 
-    uint64_t data_len = 0;
     rt = websocket_parse_frame_header(frame_head, &data_len);
     if (OPRT_OK != rt) {
         PR_ERR("websocket %p websocket_parse_frame_header error, rt:%d", ws, rt);
         return OPRT_COM_ERROR;
     }
+    if (data_len > WS_FRAME_MAX_SIZE) {
+        PR_ERR("websocket %p frame too large, datalen:%llu", ws, (unsigned long long)data_len);
+        websocket_send_close_code(ws, WS_STATUS_CODE_MESSAGE_TOO_BIG);
+        return OPRT_COM_ERROR;
+    }
 
-    if (data_len == 0) {
-        if (frame_recv_cb) {
-            frame_recv_cb(ws, frame_head->opcode, (BOOL_T)frame_head->fin, NULL, 0);
-        }
-    } else {
-        uint8_t *data = NULL;
-        WS_MALLOC_ERR_RET(data, data_len);
-        rt = websocket_netio_recv_ext(ws, data, data_len);
-        if (OPRT_OK != rt) {
-            WS_SAFE_FREE(data);
-            PR_ERR("websocket %p websocket_netio_recv_ext error, rt:%d", ws, rt);
-            return OPRT_RECV_ERR;
-        }
-        if (frame_recv_cb) {
-            frame_recv_cb(ws, frame_head->opcode, (BOOL_T)frame_head->fin, data, data_len);
-        }
-        WS_SAFE_FREE(data);
+    rt = websocket_rx_fill(ws, headlen + (size_t)data_len);
+    if (OPRT_OK != rt) {
+        return rt;
+    }
+    frame_head = (WEBSOCKET_FRAME_HEADER_S *)(ws->rx_buf + ws->rx_head);
+
+    type = (WEBSOCKET_FRAME_TYPE_E)frame_head->opcode;
+    if (WS_FRAME_TYPE_CONTINUATION == type) {
+        type = (WEBSOCKET_FRAME_TYPE_E)ws->rx_msg_type;
+    } else if (WS_FRAME_TYPE_TEXT == type || WS_FRAME_TYPE_BINARY == type) {
+        ws->rx_msg_type = type;
     }
 
+    frame_recv_cb(ws, type, (BOOL_T)frame_head->fin, data_len ? (ws->rx_buf + ws->rx_head + headlen) : NULL,
+                  (size_t)data_len);
+
+    ws->rx_head += headlen + (size_t)data_len;
+    if (ws->rx_head == ws->rx_tail) {
+        ws->rx_head = 0;
+        ws->rx_tail = 0;
+    }
+    websocket_buf_trim(&ws->rx_buf, &ws->rx_buf_size, &ws->rx_small_frames, headlen + (size_t)data_len,
+                       (BOOL_T)(0 == ws->rx_tail));
+
     return OPRT_OK;
 }
-
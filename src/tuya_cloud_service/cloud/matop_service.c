@@ -246,6 +246,32 @@ int matop_serice_yield(matop_context_t *context)
     return OPRT_OK;
 }
 
+/**
+ * @brief Gets the time until the first pending request times out.
+ *
+ * @param context Pointer to the matop context.
+ * @param timeout_ms The value returned if no request would time out earlier.
+ * @return The milliseconds until matop_serice_yield has a timeout to handle.
+ */
+uint32_t matop_service_next_timeout(matop_context_t *context, uint32_t timeout_ms)
+{
+    if (context == NULL) {
+        return timeout_ms;
+    }
+
+    uint32_t now = tal_system_get_millisecond();
+    mqtt_atop_message_t *entry;
+    for (entry = context->message_list; entry; entry = entry->next) {
+        if (now > entry->timeout) {
+            return 0;
+        }
+        if (entry->timeout - now + 1 < timeout_ms) {
+            timeout_ms = entry->timeout - now + 1;
+        }
+    }
+    return timeout_ms;
+}
+
 /**
  * @brief Destroys the matop service context.
  *
@@ -80,6 +80,15 @@ int matop_serice_init(matop_context_t *context, const matop_config_t *config);
  */
 int matop_serice_yield(matop_context_t *context);
 
+/**
+ * @brief Gets the time until the first pending request times out.
+ *
+ * @param context Pointer to the matop context.
+ * @param timeout_ms The value returned if no request would time out earlier.
+ * @return The milliseconds until matop_serice_yield has a timeout to handle.
+ */
+uint32_t matop_service_next_timeout(matop_context_t *context, uint32_t timeout_ms);
+
 /**
  * @brief Destroys the matop service context.
  *
@@ -44,6 +44,33 @@ typedef struct {
     uint8_t data[0];
 } pv22_packet_object_t;
 
+#define MQTT_PUBLISH_SLOT_NONE 0xFF
+#define MQTT_PUBLISH_HASH_NUM  32 // msgid hash bucket number, must be power of 2
+
+#define MQTT_PUBLISH_FREE    0
+#define MQTT_PUBLISH_PENDING 1 // waiting to be sent by tuya_mqtt_loop_wait
+#define MQTT_PUBLISH_SENT    2 // waiting for PUBACK
+
+#if MQTT_PUBLISH_QUEUE_SIZE >= MQTT_PUBLISH_SLOT_NONE
+#error "MQTT_PUBLISH_QUEUE_SIZE must be less than 255"
+#endif
+
+/* QoS1 publish slots with timeout min-heap and msgid hash, allocated once in tuya_mqtt_init */
+struct mqtt_publish_queue {
+    MUTEX_HANDLE mutex;
+    uint8_t free_head;
+    uint8_t pending_head;
+    uint8_t pending_tail;
+    uint8_t heap_cnt;
+    bool dispatching; // in a callback of the process loop, async publishes are left to tuya_mqtt_loop_wait
+    uint8_t hash[MQTT_PUBLISH_HASH_NUM];
+    uint8_t heap[MQTT_PUBLISH_QUEUE_SIZE];
+    mqtt_publish_handle_t slot[MQTT_PUBLISH_QUEUE_SIZE];
+};
+
+/* a expired before b, wrap around safe */
+#define MQTT_PUBLISH_BEFORE(a, b) ((int32_t)((a) - (b)) < 0)
+
 static int tuya_mqtt_signature_tool(const tuya_meta_info_t *input, tuya_mqtt_access_t *signout)
 {
     if (NULL == input || signout == NULL) {
@@ -92,6 +119,34 @@ static int tuya_mqtt_signature_tool(const tuya_meta_info_t *input, tuya_mqtt_acc
     return OPRT_OK;
 }
 
+static void mqtt_subscribe_handle_free(mqtt_topic_node_t *node, void *arg)
+{
+    mqtt_subscribe_handle_t *entry = (mqtt_subscribe_handle_t *)node->entry;
+
+    while (entry) {
+        mqtt_subscribe_handle_t *next = entry->next;
+        tal_free(entry);
+        entry = next;
+    }
+    node->entry = NULL;
+}
+
+/* free the handles unregistered while dispatching */
+static void mqtt_subscribe_handle_sweep(mqtt_topic_node_t *node, void *arg)
+{
+    mqtt_subscribe_handle_t **link = (mqtt_subscribe_handle_t **)&node->entry;
+
+    while (*link) {
+        mqtt_subscribe_handle_t *entry = *link;
+        if (NULL == entry->cb) {
+            *link = entry->next;
+            tal_free(entry);
+        } else {
+            link = &entry->next;
+        }
+    }
+}
+
 /**
  * @brief Registers a callback function for handling MQTT subscribe messages.
  *
@@ -99,7 +154,8 @@ static int tuya_mqtt_signature_tool(const tuya_meta_info_t *input, tuya_mqtt_acc
  * when an MQTT subscribe message is received.
  *
  * @param context The MQTT context.
- * @param topic The topic to subscribe to.
+ * @param topic The topic to subscribe to, MQTT wildcards '+' and '#' are
+ * supported.
  * @param cb The callback function to be called when a subscribe message is
  * received.
  * @param userdata User-defined data that will be passed to the callback
@@ -110,7 +166,7 @@ static int tuya_mqtt_signature_tool(const tuya_meta_info_t *input, tuya_mqtt_acc
 int tuya_mqtt_subscribe_message_callback_register(tuya_mqtt_context_t *context, const char *topic,
                                                   mqtt_subscribe_message_cb_t cb, void *userdata)
 {
-    if (!context || !topic) {
+    if (!context || !topic || !mqtt_topic_filter_valid(topic)) {
         return OPRT_INVALID_PARM;
     }
 
@@ -119,10 +175,23 @@ int tuya_mqtt_subscribe_message_callback_register(tuya_mqtt_context_t *context,
         return OPRT_COM_ERROR;
     }
 
+    if (NULL == cb) {
+        cb = on_subscribe_message_default;
+    }
+
+    tal_mutex_lock(context->subscribe_mutex);
+    mqtt_topic_node_t *node = mqtt_topic_trie_node_get(&context->subscribe_trie, topic, true);
+    if (NULL == node) {
+        tal_mutex_unlock(context->subscribe_mutex);
+        PR_ERR("malloc error");
+        return OPRT_MALLOC_FAILED;
+    }
+
     /* Repetition filter */
-    mqtt_subscribe_handle_t *target = context->subscribe_list;
+    mqtt_subscribe_handle_t *target = (mqtt_subscribe_handle_t *)node->entry;
     while (target) {
-        if (!memcmp(target->topic, topic, target->topic_length) && target->cb == cb) {
+        if (target->cb == cb) {
+            tal_mutex_unlock(context->subscribe_mutex);
             PR_WARN("Repetition:%s", topic);
             return OPRT_OK;
         }
@@ -132,24 +201,17 @@ int tuya_mqtt_subscribe_message_callback_register(tuya_mqtt_context_t *context,
     /* Intser new handle */
     mqtt_subscribe_handle_t *newtarget = tal_calloc(1, sizeof(mqtt_subscribe_handle_t));
     if (!newtarget) {
+        mqtt_topic_trie_node_put(&context->subscribe_trie, node);
+        tal_mutex_unlock(context->subscribe_mutex);
         PR_ERR("malloc error");
         return OPRT_MALLOC_FAILED;
     }
 
-    newtarget->topic_length = strlen(topic);
-    newtarget->topic = tal_calloc(1, newtarget->topic_length + 1); // strdup
-    strcpy(newtarget->topic, topic);
-
-    if (cb) {
-        newtarget->cb = cb;
-    } else {
-        newtarget->cb = on_subscribe_message_default;
-    }
+    newtarget->cb = cb;
     newtarget->userdata = userdata;
-    /* LOCK */
-    newtarget->next = context->subscribe_list;
-    context->subscribe_list = newtarget;
-    /* UNLOCK */
+    newtarget->next = (mqtt_subscribe_handle_t *)node->entry;
+    node->entry = newtarget;
+    tal_mutex_unlock(context->subscribe_mutex);
     return OPRT_OK;
 }
 
@@ -172,22 +234,20 @@ int tuya_mqtt_subscribe_message_callback_unregister(tuya_mqtt_context_t *context
         return OPRT_INVALID_PARM;
     }
 
-    size_t topic_length = strlen(topic);
-
-    /* LOCK */
-    /* Remove object form list */
-    mqtt_subscribe_handle_t **target = &context->subscribe_list;
-    while (*target) {
-        mqtt_subscribe_handle_t *entry = *target;
-        if (entry->topic_length == topic_length && !memcmp(topic, entry->topic, topic_length)) {
-            *target = entry->next;
-            tal_free(entry->topic);
-            tal_free(entry);
-        } else {
-            target = &entry->next;
+    /* Remove all handles of the topic, a callback of the running dispatch only marks them */
+    tal_mutex_lock(context->subscribe_mutex);
+    mqtt_topic_node_t *node = mqtt_topic_trie_node_get(&context->subscribe_trie, topic, false);
+    if (node && context->subscribe_dispatching) {
+        mqtt_subscribe_handle_t *target = (mqtt_subscribe_handle_t *)node->entry;
+        for (; target; target = target->next) {
+            target->cb = NULL;
         }
+        context->subscribe_garbage = true;
+    } else if (node) {
+        mqtt_subscribe_handle_free(node, NULL);
+        mqtt_topic_trie_node_put(&context->subscribe_trie, node);
     }
-    /* UNLOCK */
+    tal_mutex_unlock(context->subscribe_mutex);
 
     uint16_t msgid = mqtt_client_unsubscribe(context->mqtt_client, topic, MQTT_QOS_1);
     if (msgid <= 0) {
@@ -197,20 +257,40 @@ int tuya_mqtt_subscribe_message_callback_unregister(tuya_mqtt_context_t *context
     return OPRT_OK;
 }
 
-static void mqtt_subscribe_message_distribute(tuya_mqtt_context_t *context, uint16_t msgid,
-                                              const mqtt_client_message_t *msg)
+typedef struct {
+    uint16_t msgid;
+    const mqtt_client_message_t *msg;
+} mqtt_subscribe_dispatch_t;
+
+static void mqtt_subscribe_message_dispatch(mqtt_topic_node_t *node, void *arg)
 {
-    const char *topic = msg->topic;
-    size_t topic_length = strlen(msg->topic);
+    mqtt_subscribe_dispatch_t *dispatch = (mqtt_subscribe_dispatch_t *)arg;
+    mqtt_subscribe_handle_t *target = (mqtt_subscribe_handle_t *)node->entry;
 
-    /* LOCK */
-    mqtt_subscribe_handle_t *target = context->subscribe_list;
     for (; target; target = target->next) {
-        if (target->topic_length == topic_length && !memcmp(topic, target->topic, target->topic_length)) {
-            target->cb(msgid, msg, target->userdata);
+        if (target->cb) {
+            target->cb(dispatch->msgid, dispatch->msg, target->userdata);
         }
     }
-    /* UNLOCK */
+}
+
+/* the callbacks run with subscribe_mutex held, an unregister returned on another thread means its callback is
+ * not running. nodes and handles are not freed until the outermost dispatch ends, so a callback can register
+ * or unregister without breaking the match in progress */
+static void mqtt_subscribe_message_distribute(tuya_mqtt_context_t *context, uint16_t msgid,
+                                              const mqtt_client_message_t *msg)
+{
+    mqtt_subscribe_dispatch_t dispatch = {.msgid = msgid, .msg = msg};
+
+    tal_mutex_lock(context->subscribe_mutex);
+    context->subscribe_dispatching++;
+    mqtt_topic_trie_match(&context->subscribe_trie, msg->topic, mqtt_subscribe_message_dispatch, &dispatch);
+    context->subscribe_dispatching--;
+    if (0 == context->subscribe_dispatching && context->subscribe_garbage) {
+        context->subscribe_garbage = false;
+        mqtt_topic_trie_sweep(&context->subscribe_trie, mqtt_subscribe_handle_sweep, NULL);
+    }
+    tal_mutex_unlock(context->subscribe_mutex);
 }
 
 /* -------------------------------------------------------------------------- */
@@ -264,7 +344,7 @@ static int tuya_protocol_message_parse_process(tuya_mqtt_context_t *context, con
     event.data = cJSON_GetObjectItem(root, "data");
 
     /* LOCK */
-    tuya_protocol_handle_t *target = context->protocol_list;
+    tuya_protocol_handle_t *target = context->protocol_table[protocol_id & (TUYA_PROTOCOL_TABLE_SIZE - 1)];
     for (; target; target = target->next) {
         if (target->id == protocol_id) {
             event.user_data = target->user_data, target->cb(&event);
@@ -314,6 +394,15 @@ static void mqtt_client_disconnected_cb(void *client, void *userdata)
     }
 }
 
+static void mqtt_publish_dispatching_set(tuya_mqtt_context_t *context, bool dispatching)
+{
+    if (context->publish_queue) {
+        tal_mutex_lock(context->publish_queue->mutex);
+        context->publish_queue->dispatching = dispatching;
+        tal_mutex_unlock(context->publish_queue->mutex);
+    }
+}
+
 static void mqtt_client_message_cb(void *client, uint16_t msgid, const mqtt_client_message_t *msg, void *userdata)
 {
     client = client;
@@ -321,7 +410,9 @@ static void mqtt_client_message_cb(void *client, uint16_t msgid, const mqtt_clie
 
     /* topic filter */
     PR_DEBUG("recv message TopicName:%s, payload len:%d", msg->topic, msg->length);
+    mqtt_publish_dispatching_set(context, true);
     mqtt_subscribe_message_distribute(context, msgid, msg);
+    mqtt_publish_dispatching_set(context, false);
 }
 
 static void mqtt_client_subscribed_cb(void *client, uint16_t msgid, void *userdata)
@@ -331,26 +422,419 @@ static void mqtt_client_subscribed_cb(void *client, uint16_t msgid, void *userda
     PR_DEBUG("Subscribe successed ID:%d", msgid);
 }
 
+static void mqtt_publish_heap_swap(mqtt_publish_queue_t *queue, uint8_t i, uint8_t j)
+{
+    uint8_t tmp = queue->heap[i];
+
+    queue->heap[i] = queue->heap[j];
+    queue->heap[j] = tmp;
+    queue->slot[queue->heap[i]].heap_pos = i;
+    queue->slot[queue->heap[j]].heap_pos = j;
+}
+
+static void mqtt_publish_heap_up(mqtt_publish_queue_t *queue, uint8_t pos)
+{
+    while (pos > 0) {
+        uint8_t parent = (pos - 1) / 2;
+        if (!MQTT_PUBLISH_BEFORE(queue->slot[queue->heap[pos]].timeout, queue->slot[queue->heap[parent]].timeout)) {
+            break;
+        }
+        mqtt_publish_heap_swap(queue, pos, parent);
+        pos = parent;
+    }
+}
+
+static void mqtt_publish_heap_down(mqtt_publish_queue_t *queue, uint8_t pos)
+{
+    for (;;) {
+        uint8_t min = pos;
+        uint8_t child = 2 * pos + 1;
+
+        if (child < queue->heap_cnt &&
+            MQTT_PUBLISH_BEFORE(queue->slot[queue->heap[child]].timeout, queue->slot[queue->heap[min]].timeout)) {
+            min = child;
+        }
+        child++;
+        if (child < queue->heap_cnt &&
+            MQTT_PUBLISH_BEFORE(queue->slot[queue->heap[child]].timeout, queue->slot[queue->heap[min]].timeout)) {
+            min = child;
+        }
+        if (min == pos) {
+            break;
+        }
+        mqtt_publish_heap_swap(queue, pos, min);
+        pos = min;
+    }
+}
+
+static void mqtt_publish_heap_remove(mqtt_publish_queue_t *queue, uint8_t idx)
+{
+    uint8_t pos = queue->slot[idx].heap_pos;
+
+    queue->heap_cnt--;
+    if (pos == queue->heap_cnt) {
+        return;
+    }
+    queue->heap[pos] = queue->heap[queue->heap_cnt];
+    queue->slot[queue->heap[pos]].heap_pos = pos;
+    mqtt_publish_heap_up(queue, pos);
+    mqtt_publish_heap_down(queue, queue->slot[queue->heap[pos]].heap_pos);
+}
+
+/* the slot is sent, move it from the pending list head to the msgid hash */
+static void mqtt_publish_slot_sent(mqtt_publish_queue_t *queue, uint8_t idx, uint16_t msgid)
+{
+    mqtt_publish_handle_t *handle = &queue->slot[idx];
+    uint8_t *bucket = &queue->hash[msgid & (MQTT_PUBLISH_HASH_NUM - 1)];
+
+    handle->msgid = msgid;
+    handle->state = MQTT_PUBLISH_SENT;
+    handle->next = *bucket;
+    *bucket = idx;
+
+    // MQTT client does not resend, the payload is not needed anymore
+    if (handle->payload) {
+        tal_free(handle->payload);
+        handle->payload = NULL;
+    }
+}
+
+static void mqtt_publish_slot_pending(mqtt_publish_queue_t *queue, uint8_t idx)
+{
+    queue->slot[idx].state = MQTT_PUBLISH_PENDING;
+    queue->slot[idx].next = MQTT_PUBLISH_SLOT_NONE;
+    if (MQTT_PUBLISH_SLOT_NONE == queue->pending_tail) {
+        queue->pending_head = idx;
+    } else {
+        queue->slot[queue->pending_tail].next = idx;
+    }
+    queue->pending_tail = idx;
+}
+
+/* unlink the slot from the msgid hash or the pending list */
+static void mqtt_publish_slot_unlink(mqtt_publish_queue_t *queue, uint8_t idx)
+{
+    mqtt_publish_handle_t *handle = &queue->slot[idx];
+    uint8_t *link = NULL;
+    uint8_t prev = MQTT_PUBLISH_SLOT_NONE;
+
+    if (MQTT_PUBLISH_SENT == handle->state) {
+        link = &queue->hash[handle->msgid & (MQTT_PUBLISH_HASH_NUM - 1)];
+    } else {
+        link = &queue->pending_head;
+    }
+    while (*link != idx) {
+        prev = *link;
+        link = &queue->slot[*link].next;
+    }
+    *link = handle->next;
+    if (MQTT_PUBLISH_PENDING == handle->state && queue->pending_tail == idx) {
+        queue->pending_tail = prev;
+    }
+}
+
+/* the send of a slot put to the msgid hash before failed, back to the pending list head to keep the order */
+static void mqtt_publish_slot_unsent(mqtt_publish_queue_t *queue, uint8_t idx, uint8_t *payload)
+{
+    mqtt_publish_handle_t *handle = &queue->slot[idx];
+
+    mqtt_publish_slot_unlink(queue, idx);
+    handle->state = MQTT_PUBLISH_PENDING;
+    handle->msgid = 0;
+    handle->payload = payload;
+    handle->next = queue->pending_head;
+    queue->pending_head = idx;
+    if (MQTT_PUBLISH_SLOT_NONE == queue->pending_tail) {
+        queue->pending_tail = idx;
+    }
+}
+
+/* unlink the slot from the list it is in and put it back to the free list */
+static void mqtt_publish_slot_release(mqtt_publish_queue_t *queue, uint8_t idx)
+{
+    mqtt_publish_handle_t *handle = &queue->slot[idx];
+
+    mqtt_publish_slot_unlink(queue, idx);
+    mqtt_publish_heap_remove(queue, idx);
+
+    if (handle->payload) {
+        tal_free(handle->payload);
+        handle->payload = NULL;
+    }
+    handle->state = MQTT_PUBLISH_FREE;
+    handle->next = queue->free_head;
+    queue->free_head = idx;
+}
+
+static mqtt_publish_queue_t *mqtt_publish_queue_create(void)
+{
+    int i;
+    mqtt_publish_queue_t *queue = tal_malloc(sizeof(mqtt_publish_queue_t));
+    if (NULL == queue) {
+        return NULL;
+    }
+    memset(queue, 0, sizeof(mqtt_publish_queue_t));
+
+    if (OPRT_OK != tal_mutex_create_init(&queue->mutex)) {
+        tal_free(queue);
+        return NULL;
+    }
+
+    for (i = 0; i < MQTT_PUBLISH_QUEUE_SIZE; i++) {
+        queue->slot[i].next = (i + 1 < MQTT_PUBLISH_QUEUE_SIZE) ? i + 1 : MQTT_PUBLISH_SLOT_NONE;
+    }
+    queue->free_head = 0;
+    queue->pending_head = MQTT_PUBLISH_SLOT_NONE;
+    queue->pending_tail = MQTT_PUBLISH_SLOT_NONE;
+    memset(queue->hash, MQTT_PUBLISH_SLOT_NONE, sizeof(queue->hash));
+
+    return queue;
+}
+
+/* the publishes not done are dropped without notify */
+static void mqtt_publish_queue_release(mqtt_publish_queue_t *queue)
+{
+    int i;
+
+    for (i = 0; i < MQTT_PUBLISH_QUEUE_SIZE; i++) {
+        if (queue->slot[i].payload) {
+            tal_free(queue->slot[i].payload);
+        }
+    }
+    tal_mutex_release(queue->mutex);
+    tal_free(queue);
+}
+
+/**
+ * @brief add a QoS1 publish to the queue, sent at once unless async in a callback of the process loop
+ *
+ * The slot and the msgid are taken under the queue mutex, the packet is sent without it, so a PUBACK
+ * racing the send finds the slot and a slow socket does not block the other publishers.
+ *
+ * @param[in] take: payload is allocated by tal_malloc and owned by the queue now
+ *
+ * @return OPRT_EXCEED_UPPER_LIMIT if the queue is full, the cb is only called if OPRT_OK returned
+ */
+static int mqtt_publish_enqueue(tuya_mqtt_context_t *context, const char *topic, uint8_t *payload,
+                                size_t payload_length, bool take, mqtt_publish_notify_cb_t cb, void *user_data,
+                                int timeout_ms, bool async)
+{
+    mqtt_publish_queue_t *queue = context->publish_queue;
+    mqtt_publish_handle_t *handle = NULL;
+    uint8_t *copy = NULL;
+    uint16_t msgid = 0;
+    bool defer = false;
+    uint8_t idx;
+
+    if (NULL == queue) {
+        if (take) {
+            tal_free(payload);
+        }
+        return OPRT_RESOURCE_NOT_READY;
+    }
+
+    tal_mutex_lock(queue->mutex);
+    idx = queue->free_head;
+    if (MQTT_PUBLISH_SLOT_NONE == idx) {
+        tal_mutex_unlock(queue->mutex);
+        PR_WARN("mqtt publish queue full");
+        if (take) {
+            tal_free(payload);
+        }
+        return OPRT_EXCEED_UPPER_LIMIT;
+    }
+
+    // the loop thread may be blocked on the socket for long, only defer the publishes made while it dispatches
+    // and keep a copy to send in tuya_mqtt_loop_wait
+    defer = async && queue->dispatching;
+    if (defer && !take) {
+        copy = tal_malloc(payload_length);
+        if (NULL == copy) {
+            tal_mutex_unlock(queue->mutex);
+            return OPRT_MALLOC_FAILED;
+        }
+        memcpy(copy, payload, payload_length);
+    }
+
+    handle = &queue->slot[idx];
+    queue->free_head = handle->next;
+    handle->topic = (char *)topic;
+    handle->timeout = (uint32_t)tal_system_get_millisecond() + (uint32_t)timeout_ms;
+    handle->cb = cb;
+    handle->user_data = user_data;
+    handle->payload_length = payload_length;
+    handle->payload = NULL;
+    handle->msgid = 0;
+    handle->heap_pos = queue->heap_cnt;
+    queue->heap[queue->heap_cnt++] = idx;
+    mqtt_publish_heap_up(queue, handle->heap_pos);
+
+    if (!defer) {
+        msgid = mqtt_client_msgid_new(context->mqtt_client);
+        mqtt_publish_slot_sent(queue, idx, msgid);
+    } else {
+        handle->payload = take ? payload : copy;
+        take = false;
+        mqtt_publish_slot_pending(queue, idx);
+    }
+    tal_mutex_unlock(queue->mutex);
+
+    if (msgid && msgid != mqtt_client_publish_msgid(context->mqtt_client, msgid, topic, payload, payload_length,
+                                                    MQTT_QOS_1)) {
+        // resend in tuya_mqtt_loop_wait, unless the slot timed out meanwhile
+        if (!take) {
+            copy = tal_malloc(payload_length);
+            if (copy) {
+                memcpy(copy, payload, payload_length);
+            }
+        } else {
+            copy = payload;
+            take = false;
+        }
+        tal_mutex_lock(queue->mutex);
+        if (MQTT_PUBLISH_SENT == handle->state && msgid == handle->msgid && copy) {
+            mqtt_publish_slot_unsent(queue, idx, copy);
+            copy = NULL;
+        }
+        tal_mutex_unlock(queue->mutex);
+        if (copy) {
+            tal_free(copy);
+        }
+    }
+
+    if (take) {
+        tal_free(payload);
+    }
+
+    return OPRT_OK;
+}
+
+/* notify the expired publishes, send the pending ones */
+static void mqtt_publish_queue_process(tuya_mqtt_context_t *context)
+{
+    mqtt_publish_queue_t *queue = context->publish_queue;
+    mqtt_publish_notify_cb_t cb = NULL;
+    void *user_data = NULL;
+
+    if (NULL == queue) {
+        return;
+    }
+
+    for (;;) {
+        tal_mutex_lock(queue->mutex);
+        if (0 == queue->heap_cnt ||
+            MQTT_PUBLISH_BEFORE((uint32_t)tal_system_get_millisecond(), queue->slot[queue->heap[0]].timeout)) {
+            tal_mutex_unlock(queue->mutex);
+            break;
+        }
+        cb = queue->slot[queue->heap[0]].cb;
+        user_data = queue->slot[queue->heap[0]].user_data;
+        mqtt_publish_slot_release(queue, queue->heap[0]);
+        tal_mutex_unlock(queue->mutex);
+
+        cb(OPRT_TIMEOUT, user_data);
+    }
+
+    for (;;) {
+        uint8_t idx;
+        uint8_t *payload = NULL;
+        const char *topic = NULL;
+        size_t payload_length = 0;
+        mqtt_publish_handle_t *handle = NULL;
+        uint16_t msgid = 0;
+
+        // the payload is detached from the slot while sent, a timeout of the slot does not free it
+        tal_mutex_lock(queue->mutex);
+        idx = queue->pending_head;
+        if (MQTT_PUBLISH_SLOT_NONE == idx) {
+            tal_mutex_unlock(queue->mutex);
+            break;
+        }
+        handle = &queue->slot[idx];
+        payload = handle->payload;
+        topic = handle->topic;
+        payload_length = handle->payload_length;
+        handle->payload = NULL;
+        mqtt_publish_slot_unlink(queue, idx);
+        msgid = mqtt_client_msgid_new(context->mqtt_client);
+        mqtt_publish_slot_sent(queue, idx, msgid);
+        tal_mutex_unlock(queue->mutex);
+
+        if (msgid == mqtt_client_publish_msgid(context->mqtt_client, msgid, topic, payload, payload_length,
+                                               MQTT_QOS_1)) {
+            tal_free(payload);
+            continue;
+        }
+
+        tal_mutex_lock(queue->mutex);
+        if (MQTT_PUBLISH_SENT == handle->state && msgid == handle->msgid) {
+            mqtt_publish_slot_unsent(queue, idx, payload);
+            payload = NULL;
+        }
+        tal_mutex_unlock(queue->mutex);
+        if (payload) {
+            tal_free(payload);
+        }
+        break;
+    }
+}
+
+/* the time to wait before the first publish expires, no more than timeout_ms */
+static uint32_t mqtt_publish_queue_wait(tuya_mqtt_context_t *context, uint32_t timeout_ms)
+{
+    mqtt_publish_queue_t *queue = context->publish_queue;
+    uint32_t now = (uint32_t)tal_system_get_millisecond();
+
+    if (NULL == queue) {
+        return timeout_ms;
+    }
+
+    tal_mutex_lock(queue->mutex);
+    if (queue->heap_cnt) {
+        uint32_t timeout = queue->slot[queue->heap[0]].timeout;
+        if (!MQTT_PUBLISH_BEFORE(now, timeout)) {
+            timeout_ms = 0;
+        } else if (timeout - now < timeout_ms) {
+            timeout_ms = timeout - now;
+        }
+    }
+    tal_mutex_unlock(queue->mutex);
+
+    return timeout_ms;
+}
+
 static void mqtt_client_puback_cb(void *client, uint16_t msgid, void *userdata)
 {
     client = client;
     tuya_mqtt_context_t *context = (tuya_mqtt_context_t *)userdata;
     PR_DEBUG("PUBACK ID:%d", msgid);
 
-    /* LOCK */
-    /* publish async process */
-    mqtt_publish_handle_t **next_handle = &context->publish_list;
-    for (; *next_handle; next_handle = &(*next_handle)->next) {
-        mqtt_publish_handle_t *entry = *next_handle;
-        if (msgid == entry->msgid) {
-            entry->cb(OPRT_OK, entry->user_data);
-            *next_handle = entry->next;
-            tal_free(entry->payload);
-            tal_free(entry);
-            break;
-        }
+    mqtt_publish_queue_t *queue = context->publish_queue;
+    mqtt_publish_notify_cb_t cb = NULL;
+    void *user_data = NULL;
+    uint8_t idx;
+
+    if (NULL == queue) {
+        return;
+    }
+
+    tal_mutex_lock(queue->mutex);
+    idx = queue->hash[msgid & (MQTT_PUBLISH_HASH_NUM - 1)];
+    while (MQTT_PUBLISH_SLOT_NONE != idx && msgid != queue->slot[idx].msgid) {
+        idx = queue->slot[idx].next;
+    }
+    if (MQTT_PUBLISH_SLOT_NONE != idx) {
+        cb = queue->slot[idx].cb;
+        user_data = queue->slot[idx].user_data;
+        mqtt_publish_slot_release(queue, idx);
+    }
+    tal_mutex_unlock(queue->mutex);
+
+    if (cb) {
+        mqtt_publish_dispatching_set(context, true);
+        cb(OPRT_OK, user_data);
+        mqtt_publish_dispatching_set(context, false);
     }
-    /* UNLOCK */
 }
 
 /**
@@ -421,6 +905,18 @@ int tuya_mqtt_init(tuya_mqtt_context_t *context, const tuya_mqtt_config_t *confi
         return OPRT_COM_ERROR;
     }
 
+    rt = tal_mutex_create_init(&context->subscribe_mutex);
+    if (OPRT_OK != rt) {
+        PR_ERR("mqtt subscribe mutex create fault.");
+        return rt;
+    }
+
+    context->publish_queue = mqtt_publish_queue_create();
+    if (NULL == context->publish_queue) {
+        PR_ERR("mqtt publish queue create fault.");
+        return OPRT_MALLOC_FAILED;
+    }
+
     BackoffAlgorithm_InitializeParams(&context->backoff_algorithm, MQTT_CONNECT_RETRY_MIN_DELAY_MS,
                                       MQTT_CONNECT_RETRY_MAX_DELAY_MS, MQTT_CONNECT_RETRY_MAX_ATTEMPTS);
 
@@ -535,7 +1031,8 @@ int tuya_mqtt_protocol_register(tuya_mqtt_context_t *context, uint16_t protocol_
 
     /* LOCK */
     /* Repetition filter */
-    tuya_protocol_handle_t *target = context->protocol_list;
+    tuya_protocol_handle_t **head = &context->protocol_table[protocol_id & (TUYA_PROTOCOL_TABLE_SIZE - 1)];
+    tuya_protocol_handle_t *target = *head;
     while (target) {
         if (target->id == protocol_id && target->cb == cb) {
             return OPRT_COM_ERROR;
@@ -550,8 +1047,8 @@ int tuya_mqtt_protocol_register(tuya_mqtt_context_t *context, uint16_t protocol_
     new_handle->id = protocol_id;
     new_handle->cb = cb;
     new_handle->user_data = user_data;
-    new_handle->next = context->protocol_list;
-    context->protocol_list = new_handle;
+    new_handle->next = *head;
+    *head = new_handle;
     /* UNLOCK */
 
     return OPRT_OK;
@@ -577,7 +1074,7 @@ int tuya_mqtt_protocol_unregister(tuya_mqtt_context_t *context, uint16_t protoco
 
     /* LOCK */
     /* Remove object form list */
-    tuya_protocol_handle_t **target = &context->protocol_list;
+    tuya_protocol_handle_t **target = &context->protocol_table[protocol_id & (TUYA_PROTOCOL_TABLE_SIZE - 1)];
     while (*target) {
         tuya_protocol_handle_t *entry = *target;
         if (entry->id == protocol_id && entry->cb == cb) {
@@ -608,18 +1105,20 @@ int tuya_mqtt_protocol_unregister_all(tuya_mqtt_context_t *context)
 
     PR_DEBUG("Unregister all MQTT Protocol");
     /* LOCK */
-    /* Remove object form list */
-    tuya_protocol_handle_t *entry = NULL;
-    tuya_protocol_handle_t *target = context->protocol_list;
-    while (target) {
-        entry = target;
-        target = entry->next;
-        tal_free(entry);
+    /* Remove object form table */
+    int i;
+    for (i = 0; i < TUYA_PROTOCOL_TABLE_SIZE; i++) {
+        tuya_protocol_handle_t *entry = NULL;
+        tuya_protocol_handle_t *target = context->protocol_table[i];
+        while (target) {
+            entry = target;
+            target = entry->next;
+            tal_free(entry);
+        }
+        context->protocol_table[i] = NULL;
     }
     /* UNLOCK */
 
-    context->protocol_list = NULL;
-
     return OPRT_OK;
 }
 
@@ -637,6 +1136,8 @@ int tuya_mqtt_protocol_unregister_all(tuya_mqtt_context_t *context)
  * @param async Whether to perform the publish operation asynchronously or not.
  *
  * @return 0 on success, or a negative error code on failure.
+ * OPRT_EXCEED_UPPER_LIMIT if MQTT_PUBLISH_QUEUE_SIZE publishes are in flight,
+ * cb is not called if failed.
  */
 int tuya_mqtt_client_publish_common(tuya_mqtt_context_t *context, const char *topic, const uint8_t *payload,
                                     size_t payload_length, mqtt_publish_notify_cb_t cb, void *user_data, int timeout_ms,
@@ -654,38 +1155,32 @@ int tuya_mqtt_client_publish_common(tuya_mqtt_context_t *context, const char *to
         return OPRT_OK;
     }
 
-    mqtt_publish_handle_t *handle = tal_malloc(sizeof(mqtt_publish_handle_t));
-    TUYA_CHECK_NULL_RETURN(handle, OPRT_MALLOC_FAILED);
-    handle->next = NULL;
-    handle->msgid = 0;
-    handle->topic = (char *)topic;
-    handle->timeout = tal_time_get_posix() + timeout_ms;
-    handle->cb = cb;
-    handle->user_data = user_data;
-    handle->payload_length = payload_length;
-    handle->payload = tal_malloc(payload_length);
-    if (handle->payload == NULL) {
-        return OPRT_MALLOC_FAILED;
-    }
-    memcpy(handle->payload, payload, payload_length);
+    return mqtt_publish_enqueue(context, topic, (uint8_t *)payload, payload_length, false, cb, user_data, timeout_ms,
+                                async);
+}
 
-    if (async == false) {
-        handle->msgid = mqtt_client_publish(context->mqtt_client, handle->topic, handle->payload,
-                                            handle->payload_length, MQTT_QOS_1);
-    }
+/**
+ * @brief Gets the number of QoS1 publishes can be queued now.
+ *
+ * Publishers with a callback can use it to hold back before the queue is full.
+ *
+ * @param context The MQTT context.
+ * @return The number of free publish slots.
+ */
+int tuya_mqtt_publish_queue_free(tuya_mqtt_context_t *context)
+{
+    mqtt_publish_queue_t *queue = NULL;
 
-    if (context->publish_list == NULL) {
-        context->publish_list = handle;
-        return OPRT_OK;
+    if (context == NULL || context->publish_queue == NULL) {
+        return 0;
     }
 
-    mqtt_publish_handle_t *last = context->publish_list;
-    while (last->next != NULL) {
-        last = last->next;
-    }
-    last->next = handle;
+    queue = context->publish_queue;
+    tal_mutex_lock(queue->mutex);
+    int cnt = MQTT_PUBLISH_QUEUE_SIZE - queue->heap_cnt;
+    tal_mutex_unlock(queue->mutex);
 
-    return OPRT_OK;
+    return cnt;
 }
 
 /**
@@ -731,10 +1226,15 @@ int tuya_mqtt_protocol_data_publish_with_topic_common(tuya_mqtt_context_t *conte
     }
 
     /* mqtt client publish */
-    ret = tuya_mqtt_client_publish_common(context, (const char *)topic, (const uint8_t *)buffer, buffer_len, cb,
-                                          user_data, timeout_ms, async);
-    tal_free(buffer);
-    return ret;
+    if (NULL == cb) {
+        ret = tuya_mqtt_client_publish_common(context, (const char *)topic, (const uint8_t *)buffer, buffer_len, cb,
+                                              user_data, timeout_ms, async);
+        tal_free(buffer);
+        return ret;
+    }
+
+    // the packed buffer is handed over to the queue, no copy
+    return mqtt_publish_enqueue(context, topic, (uint8_t *)buffer, buffer_len, true, cb, user_data, timeout_ms, async);
 }
 
 /**
@@ -816,6 +1316,22 @@ int tuya_mqtt_protocol_data_publish(tuya_mqtt_context_t *context, uint16_t proto
  * @return Returns 0 on success, or a negative error code on failure.
  */
 int tuya_mqtt_loop(tuya_mqtt_context_t *context)
+{
+    return tuya_mqtt_loop_wait(context, MQTT_YIELD_BLOCK_MAX_MS);
+}
+
+/**
+ * @brief Executes the MQTT event loop, blocking until something happens.
+ *
+ * The calling thread blocks on the MQTT socket and returns once a received
+ * packet has been dispatched, the first queued publish expires, the keep
+ * alive is due or timeout_ms passed, whichever comes first.
+ *
+ * @param context Pointer to the Tuya MQTT context structure.
+ * @param timeout_ms The longest time to block, for the caller's own timers.
+ * @return Returns 0 on success, or a negative error code on failure.
+ */
+int tuya_mqtt_loop_wait(tuya_mqtt_context_t *context, uint32_t timeout_ms)
 {
     if (context == NULL) {
         return OPRT_COM_ERROR;
@@ -851,29 +1367,11 @@ int tuya_mqtt_loop(tuya_mqtt_context_t *context)
         return rt;
     }
 
-    /* LOCK */
     /* publish async process */
-    mqtt_publish_handle_t **next_handle = &context->publish_list;
-    for (; *next_handle; next_handle = &(*next_handle)->next) {
-        mqtt_publish_handle_t *entry = *next_handle;
-
-        if (entry->timeout <= tal_time_get_posix()) {
-            entry->cb(OPRT_TIMEOUT, entry->user_data);
-            *next_handle = entry->next;
-            tal_free(entry->payload);
-            tal_free(entry);
-            continue;
-        }
-
-        if (entry->msgid <= 0) {
-            entry->msgid =
-                mqtt_client_publish(context->mqtt_client, entry->topic, entry->payload, entry->payload_length, 1);
-        }
-    }
-    /* UNLOCK */
+    mqtt_publish_queue_process(context);
 
     /* yield */
-    mqtt_client_yield(context->mqtt_client);
+    mqtt_client_yield_wait(context->mqtt_client, mqtt_publish_queue_wait(context, timeout_ms));
 
     return rt;
 }
@@ -894,6 +1392,17 @@ int tuya_mqtt_destory(tuya_mqtt_context_t *context)
     }
 
     tuya_mqtt_protocol_unregister_all(context);
+    if (context->subscribe_mutex) {
+        tal_mutex_lock(context->subscribe_mutex);
+        mqtt_topic_trie_clear(&context->subscribe_trie, mqtt_subscribe_handle_free, NULL);
+        tal_mutex_unlock(context->subscribe_mutex);
+        tal_mutex_release(context->subscribe_mutex);
+        context->subscribe_mutex = NULL;
+    }
+    if (context->publish_queue) {
+        mqtt_publish_queue_release(context->publish_queue);
+        context->publish_queue = NULL;
+    }
     if (context->mqtt_client) {
         mqtt_client_status_t mqtt_status = mqtt_client_deinit(context->mqtt_client);
         mqtt_client_free(context->mqtt_client);
@@ -30,6 +30,8 @@ extern "C" {
 #include "cJSON.h"
 #include "mqtt_client_interface.h"
 #include "backoff_algorithm.h"
+#include "tal_mutex.h"
+#include "mqtt_topic_trie.h"
 
 // data max len
 #define TUYA_MQTT_CLIENTID_MAXLEN   (32U)
@@ -134,6 +136,9 @@ typedef tuya_protocol_event_t tuya_mqtt_event_t; // compat TODO:remove
 
 typedef void (*tuya_protocol_callback_t)(tuya_protocol_event_t *event);
 
+/* protocol handle table size, must be power of 2 */
+#define TUYA_PROTOCOL_TABLE_SIZE 32
+
 typedef struct tuya_protocol_handle {
     struct tuya_protocol_handle *next;
     uint16_t id;
@@ -143,33 +148,40 @@ typedef struct tuya_protocol_handle {
 
 typedef void (*mqtt_subscribe_message_cb_t)(uint16_t msgid, const mqtt_client_message_t *msg, void *userdata);
 
+/* handles subscribed to the same topic filter, linked at the trie node */
 typedef struct mqtt_subscribe_handle {
     struct mqtt_subscribe_handle *next;
-    char *topic;
-    size_t topic_length;
-    mqtt_subscribe_message_cb_t cb;
+    mqtt_subscribe_message_cb_t cb; // NULL if unregistered while dispatching, freed after the dispatch
     void *userdata;
 } mqtt_subscribe_handle_t;
 
 typedef void (*mqtt_publish_notify_cb_t)(int result, void *user_data);
 
 typedef struct mqtt_publish_handle {
-    struct mqtt_publish_handle *next;
-    uint16_t msgid;
-    int timeout;
-    char *topic;
-    uint8_t *payload;
+    uint8_t next;          // next slot in the free/pending/msgid hash list
+    uint8_t state;         // free, pending to send, or waiting for PUBACK
+    uint8_t heap_pos;      // position in the timeout heap
+    uint16_t msgid;        // 0 if not sent
+    uint32_t timeout;      // deadline, millisecond
+    char *topic;           // must be valid until the publish is done
+    uint8_t *payload;      // only kept until sent
     size_t payload_length;
     mqtt_publish_notify_cb_t cb;
     void *user_data;
 } mqtt_publish_handle_t;
 
+/* preallocated publish slots, see mqtt_service.c */
+typedef struct mqtt_publish_queue mqtt_publish_queue_t;
+
 typedef struct {
     void *mqtt_client;
     tuya_mqtt_access_t signature;
-    tuya_protocol_handle_t *protocol_list;
-    mqtt_subscribe_handle_t *subscribe_list;
-    mqtt_publish_handle_t *publish_list;
+    tuya_protocol_handle_t *protocol_table[TUYA_PROTOCOL_TABLE_SIZE]; // indexed by protocol id
+    mqtt_topic_trie_t subscribe_trie;                                  // entry is mqtt_subscribe_handle_t list
+    MUTEX_HANDLE subscribe_mutex;                                      // guards subscribe_trie, held while dispatching
+    uint8_t subscribe_dispatching;                                     // dispatch depth, callbacks may unregister
+    bool subscribe_garbage;                                            // handles to free after the dispatch
+    mqtt_publish_queue_t *publish_queue;
     BackoffAlgorithmContext_t backoff_algorithm;
     uint32_t sequence_in;
     uint32_t sequence_out;
@@ -228,6 +240,21 @@ int tuya_mqtt_stop(tuya_mqtt_context_t *context);
  */
 int tuya_mqtt_loop(tuya_mqtt_context_t *context);
 
+/**
+ * @brief Executes the MQTT event loop, blocking until something happens.
+ *
+ * The calling thread blocks on the MQTT socket and returns once a received
+ * packet has been dispatched, the first queued publish expires, the keep
+ * alive is due or timeout_ms passed, whichever comes first.
+ *
+ * @param context A pointer to the MQTT context structure.
+ * @param timeout_ms The longest time to block, for the caller's own timers.
+ * @return An integer value indicating the result of the operation.
+ *         - 0: Success.
+ *         - Negative values: Error codes indicating failure.
+ */
+int tuya_mqtt_loop_wait(tuya_mqtt_context_t *context, uint32_t timeout_ms);
+
 /**
  * @brief Destroys the MQTT context and releases any resources associated with
  * it.
@@ -373,11 +400,23 @@ int tuya_mqtt_protocol_data_publish_with_topic_common(tuya_mqtt_context_t *conte
  * @param timeout_ms The timeout for the publish operation in milliseconds.
  * @param async Whether to perform the publish operation asynchronously or not.
  * @return 0 on success, or a negative error code on failure.
+ * OPRT_EXCEED_UPPER_LIMIT if MQTT_PUBLISH_QUEUE_SIZE publishes are in flight,
+ * cb is not called if failed.
  */
 int tuya_mqtt_client_publish_common(tuya_mqtt_context_t *context, const char *topic, const uint8_t *payload,
                                     size_t payload_length, mqtt_publish_notify_cb_t cb, void *user_data, int timeout_ms,
                                     bool async);
 
+/**
+ * @brief Gets the number of QoS1 publishes can be queued now.
+ *
+ * Publishers with a callback can use it to hold back before the queue is full.
+ *
+ * @param context The MQTT context.
+ * @return The number of free publish slots.
+ */
+int tuya_mqtt_publish_queue_free(tuya_mqtt_context_t *context);
+
 /**
  * @brief Registers a callback function for handling MQTT subscribe messages.
  *
@@ -385,7 +424,8 @@ int tuya_mqtt_client_publish_common(tuya_mqtt_context_t *context, const char *to
  * when an MQTT subscribe message is received.
  *
  * @param context The MQTT context.
- * @param topic The topic to subscribe to.
+ * @param topic The topic to subscribe to, MQTT wildcards '+' and '#' are
+ * supported.
  * @param cb The callback function to be called when a subscribe message is
  * received.
  * @param userdata User-defined data that will be passed to the callback
@@ -0,0 +1,358 @@
+/**
+ * @file mqtt_topic_trie.c
+ * @brief Implementation of the MQTT topic filter trie.
+ *
+ * The nodes are not linked to their children, a child is found by looking up
+ * the hash of (parent, level) in one hash table shared by the whole trie. The
+ * table doubles when the nodes are twice the buckets.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <string.h>
+#include "tal_api.h"
+#include "mqtt_topic_trie.h"
+
+#define MQTT_TOPIC_BUCKET_MIN 16
+#define MQTT_TOPIC_BUCKET_MAX 0x8000
+
+static uint32_t mqtt_topic_hash(const mqtt_topic_node_t *parent, const char *level, uint16_t len)
+{
+    uint32_t hash = 0x811C9DC5 ^ (uint32_t)(uintptr_t)parent;
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (uint8_t)level[i];
+        hash *= 0x01000193;
+    }
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+static mqtt_topic_node_t *mqtt_topic_trie_find(mqtt_topic_trie_t *trie, const mqtt_topic_node_t *parent,
+                                               const char *level, uint16_t len, uint32_t hash)
+{
+    mqtt_topic_node_t *node = NULL;
+
+    if (NULL == trie->bucket) {
+        return NULL;
+    }
+
+    for (node = trie->bucket[hash & (trie->bucket_num - 1)]; node; node = node->hash_next) {
+        if (node->hash == hash && node->parent == parent && node->level_len == len && !memcmp(node->level, level, len)) {
+            return node;
+        }
+    }
+
+    return NULL;
+}
+
+static mqtt_topic_node_t *mqtt_topic_trie_child(mqtt_topic_trie_t *trie, const mqtt_topic_node_t *parent,
+                                                const char *level, uint16_t len)
+{
+    return mqtt_topic_trie_find(trie, parent, level, len, mqtt_topic_hash(parent, level, len));
+}
+
+static int mqtt_topic_trie_grow(mqtt_topic_trie_t *trie)
+{
+    uint16_t num = trie->bucket_num ? trie->bucket_num * 2 : MQTT_TOPIC_BUCKET_MIN;
+    mqtt_topic_node_t **bucket = NULL;
+    uint16_t i;
+
+    bucket = tal_malloc(num * sizeof(mqtt_topic_node_t *));
+    if (NULL == bucket) {
+        return OPRT_MALLOC_FAILED;
+    }
+    memset(bucket, 0, num * sizeof(mqtt_topic_node_t *));
+
+    for (i = 0; i < trie->bucket_num; i++) {
+        mqtt_topic_node_t *node = trie->bucket[i];
+        while (node) {
+            mqtt_topic_node_t *next = node->hash_next;
+            node->hash_next = bucket[node->hash & (num - 1)];
+            bucket[node->hash & (num - 1)] = node;
+            node = next;
+        }
+    }
+
+    if (trie->bucket) {
+        tal_free(trie->bucket);
+    }
+    trie->bucket = bucket;
+    trie->bucket_num = num;
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief check the topic filter, wildcards must occupy a whole level and '#' must be the last level
+ *
+ * @param[in] filter: topic filter
+ *
+ * @return true if valid
+ */
+bool mqtt_topic_filter_valid(const char *filter)
+{
+    const char *p = filter;
+
+    if (NULL == filter || '\0' == filter[0]) {
+        return false;
+    }
+
+    for (p = filter; *p; p++) {
+        if ('+' != *p && '#' != *p) {
+            continue;
+        }
+        if (p != filter && '/' != p[-1]) {
+            return false;
+        }
+        if ('#' == *p && '\0' != p[1]) {
+            return false;
+        }
+        if ('+' == *p && '\0' != p[1] && '/' != p[1]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * @brief get the node of the topic filter
+ *
+ * @param[in] trie: topic trie
+ * @param[in] filter: topic filter, wildcards are compared as they are
+ * @param[in] create: create the missing levels
+ *
+ * @return the node, NULL if not found or malloc failed
+ */
+mqtt_topic_node_t *mqtt_topic_trie_node_get(mqtt_topic_trie_t *trie, const char *filter, bool create)
+{
+    mqtt_topic_node_t *parent = NULL;
+    mqtt_topic_node_t *node = NULL;
+    const char *level = filter;
+
+    if (NULL == trie || NULL == filter) {
+        return NULL;
+    }
+
+    for (;;) {
+        const char *end = strchr(level, '/');
+        uint16_t len = end ? (uint16_t)(end - level) : (uint16_t)strlen(level);
+        uint32_t hash = mqtt_topic_hash(parent, level, len);
+
+        node = mqtt_topic_trie_find(trie, parent, level, len, hash);
+        if (NULL == node) {
+            if (!create) {
+                return NULL;
+            }
+            if (NULL == trie->bucket ||
+                (trie->node_cnt >= trie->bucket_num * 2 && trie->bucket_num < MQTT_TOPIC_BUCKET_MAX)) {
+                // go on with the old table if failed to grow
+                if (OPRT_OK != mqtt_topic_trie_grow(trie) && NULL == trie->bucket) {
+                    return NULL;
+                }
+            }
+            node = tal_malloc(sizeof(mqtt_topic_node_t) + len);
+            if (NULL == node) {
+                // drop the levels created for this filter
+                mqtt_topic_trie_node_put(trie, parent);
+                return NULL;
+            }
+            memset(node, 0, sizeof(mqtt_topic_node_t));
+            memcpy(node->level, level, len);
+            node->level_len = len;
+            node->hash = hash;
+            node->parent = parent;
+            node->hash_next = trie->bucket[hash & (trie->bucket_num - 1)];
+            trie->bucket[hash & (trie->bucket_num - 1)] = node;
+            trie->node_cnt++;
+            if (parent) {
+                parent->child_cnt++;
+            }
+        }
+
+        if (NULL == end) {
+            return node;
+        }
+        parent = node;
+        level = end + 1;
+    }
+}
+
+/**
+ * @brief free the node and its ancestors which have no child and no entry
+ *
+ * @param[in] trie: topic trie
+ * @param[in] node: node got by mqtt_topic_trie_node_get, entry must be NULL to be freed
+ *
+ * @return none
+ */
+void mqtt_topic_trie_node_put(mqtt_topic_trie_t *trie, mqtt_topic_node_t *node)
+{
+    while (node && NULL == node->entry && 0 == node->child_cnt) {
+        mqtt_topic_node_t *parent = node->parent;
+        mqtt_topic_node_t **link = &trie->bucket[node->hash & (trie->bucket_num - 1)];
+
+        while (*link != node) {
+            link = &(*link)->hash_next;
+        }
+        *link = node->hash_next;
+        tal_free(node);
+        trie->node_cnt--;
+
+        if (parent) {
+            parent->child_cnt--;
+        }
+        node = parent;
+    }
+}
+
+/* the topic ends at node, or goes on after the '/' at end */
+static int mqtt_topic_trie_match_level(mqtt_topic_trie_t *trie, mqtt_topic_node_t *parent, const char *level,
+                                       mqtt_topic_match_cb_t cb, void *arg);
+
+static int mqtt_topic_trie_match_node(mqtt_topic_trie_t *trie, mqtt_topic_node_t *node, const char *end,
+                                      mqtt_topic_match_cb_t cb, void *arg)
+{
+    mqtt_topic_node_t *multi = NULL;
+    int cnt = 0;
+
+    if (end) {
+        return mqtt_topic_trie_match_level(trie, node, end + 1, cb, arg);
+    }
+
+    if (node->entry) {
+        cb(node, arg);
+        cnt++;
+    }
+
+    // "a/#" matches "a" too
+    multi = mqtt_topic_trie_child(trie, node, "#", 1);
+    if (multi && multi->entry) {
+        cb(multi, arg);
+        cnt++;
+    }
+
+    return cnt;
+}
+
+static int mqtt_topic_trie_match_level(mqtt_topic_trie_t *trie, mqtt_topic_node_t *parent, const char *level,
+                                       mqtt_topic_match_cb_t cb, void *arg)
+{
+    const char *end = strchr(level, '/');
+    uint16_t len = end ? (uint16_t)(end - level) : (uint16_t)strlen(level);
+    mqtt_topic_node_t *node = NULL;
+    int cnt = 0;
+
+    // wildcards at the first level do not match the topics start with '$'
+    if (parent || '$' != level[0]) {
+        node = mqtt_topic_trie_child(trie, parent, "#", 1);
+        if (node && node->entry) {
+            cb(node, arg);
+            cnt++;
+        }
+
+        node = mqtt_topic_trie_child(trie, parent, "+", 1);
+        if (node) {
+            cnt += mqtt_topic_trie_match_node(trie, node, end, cb, arg);
+        }
+    }
+
+    node = mqtt_topic_trie_child(trie, parent, level, len);
+    if (node) {
+        cnt += mqtt_topic_trie_match_node(trie, node, end, cb, arg);
+    }
+
+    return cnt;
+}
+
+/**
+ * @brief call cb for every node whose filter matches the topic
+ *
+ * @param[in] trie: topic trie
+ * @param[in] topic: message topic, no wildcard
+ * @param[in] cb: match callback, may add nodes but must not free any
+ * @param[in] arg: callback argument
+ *
+ * @return the number of matched nodes
+ */
+int mqtt_topic_trie_match(mqtt_topic_trie_t *trie, const char *topic, mqtt_topic_match_cb_t cb, void *arg)
+{
+    if (NULL == trie || NULL == topic || NULL == cb || 0 == trie->node_cnt) {
+        return 0;
+    }
+
+    return mqtt_topic_trie_match_level(trie, NULL, topic, cb, arg);
+}
+
+/**
+ * @brief call cb for every node with entry, then free the nodes left without entry and child
+ *
+ * Used to drop the entries removed while the trie was being matched.
+ *
+ * @param[in] trie: topic trie
+ * @param[in] cb: called to drop the removed entries of the node, set node->entry NULL if none left
+ * @param[in] arg: callback argument
+ *
+ * @return none
+ */
+void mqtt_topic_trie_sweep(mqtt_topic_trie_t *trie, mqtt_topic_match_cb_t cb, void *arg)
+{
+    uint16_t i;
+
+    if (NULL == trie || NULL == trie->bucket || NULL == cb) {
+        return;
+    }
+
+    for (i = 0; i < trie->bucket_num; i++) {
+        mqtt_topic_node_t *node = trie->bucket[i];
+        while (node) {
+            if (node->entry) {
+                cb(node, arg);
+            }
+            if (NULL == node->entry && 0 == node->child_cnt) {
+                // the ancestors freed with it may be in this bucket too, start it over
+                mqtt_topic_trie_node_put(trie, node);
+                node = trie->bucket[i];
+                continue;
+            }
+            node = node->hash_next;
+        }
+    }
+}
+
+/**
+ * @brief free all nodes, cb is called for every node with entry before it is freed
+ *
+ * @param[in] trie: topic trie
+ * @param[in] cb: entry release callback, can be NULL
+ * @param[in] arg: callback argument
+ *
+ * @return none
+ */
+void mqtt_topic_trie_clear(mqtt_topic_trie_t *trie, mqtt_topic_match_cb_t cb, void *arg)
+{
+    uint16_t i;
+
+    if (NULL == trie || NULL == trie->bucket) {
+        return;
+    }
+
+    for (i = 0; i < trie->bucket_num; i++) {
+        mqtt_topic_node_t *node = trie->bucket[i];
+        while (node) {
+            mqtt_topic_node_t *next = node->hash_next;
+            if (node->entry && cb) {
+                cb(node, arg);
+            }
+            tal_free(node);
+            node = next;
+        }
+    }
+
+    tal_free(trie->bucket);
+    memset(trie, 0, sizeof(mqtt_topic_trie_t));
+}
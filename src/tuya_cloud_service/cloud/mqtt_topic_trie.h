@@ -0,0 +1,124 @@
+/**
+ * @file mqtt_topic_trie.h
+ * @brief Topic filter trie used to dispatch MQTT messages to subscribers.
+ *
+ * Every level of a topic filter is a node, the nodes are indexed by a hash of
+ * (parent node, level name), so finding the child of a node is O(1) no matter
+ * how many siblings it has. The MQTT wildcards '+' (one level) and '#' (the
+ * remaining levels) are stored as ordinary levels and followed while matching,
+ * a message topic is matched in O(levels).
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef __MQTT_TOPIC_TRIE_H__
+#define __MQTT_TOPIC_TRIE_H__
+
+#include "tuya_cloud_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief the topic level node
+ *
+ */
+typedef struct mqtt_topic_node {
+    struct mqtt_topic_node *parent;    // NULL for the first level
+    struct mqtt_topic_node *hash_next; // next node in the same hash bucket
+    void *entry;                       // subscriptions end at this level, owned by the user of the trie
+    uint32_t hash;                     // hash of parent and level
+    uint16_t child_cnt;                // the node is freed when no child and no entry
+    uint16_t level_len;
+    char level[0];
+} mqtt_topic_node_t;
+
+/**
+ * @brief the topic trie, all zero is an empty trie
+ *
+ */
+typedef struct {
+    mqtt_topic_node_t **bucket;
+    uint16_t bucket_num; // power of 2, grows with the node number
+    uint16_t node_cnt;
+} mqtt_topic_trie_t;
+
+/**
+ * @brief called for every node matching the topic
+ *
+ */
+typedef void (*mqtt_topic_match_cb_t)(mqtt_topic_node_t *node, void *arg);
+
+/**
+ * @brief check the topic filter, wildcards must occupy a whole level and '#' must be the last level
+ *
+ * @param[in] filter: topic filter
+ *
+ * @return true if valid
+ */
+bool mqtt_topic_filter_valid(const char *filter);
+
+/**
+ * @brief get the node of the topic filter
+ *
+ * @param[in] trie: topic trie
+ * @param[in] filter: topic filter, wildcards are compared as they are
+ * @param[in] create: create the missing levels
+ *
+ * @return the node, NULL if not found or malloc failed
+ */
+mqtt_topic_node_t *mqtt_topic_trie_node_get(mqtt_topic_trie_t *trie, const char *filter, bool create);
+
+/**
+ * @brief free the node and its ancestors which have no child and no entry
+ *
+ * @param[in] trie: topic trie
+ * @param[in] node: node got by mqtt_topic_trie_node_get, entry must be NULL to be freed
+ *
+ * @return none
+ */
+void mqtt_topic_trie_node_put(mqtt_topic_trie_t *trie, mqtt_topic_node_t *node);
+
+/**
+ * @brief call cb for every node whose filter matches the topic
+ *
+ * @param[in] trie: topic trie
+ * @param[in] topic: message topic, no wildcard
+ * @param[in] cb: match callback, may add nodes but must not free any
+ * @param[in] arg: callback argument
+ *
+ * @return the number of matched nodes
+ */
+int mqtt_topic_trie_match(mqtt_topic_trie_t *trie, const char *topic, mqtt_topic_match_cb_t cb, void *arg);
+
+/**
+ * @brief call cb for every node with entry, then free the nodes left without entry and child
+ *
+ * Used to drop the entries removed while the trie was being matched.
+ *
+ * @param[in] trie: topic trie
+ * @param[in] cb: called to drop the removed entries of the node, set node->entry NULL if none left
+ * @param[in] arg: callback argument
+ *
+ * @return none
+ */
+void mqtt_topic_trie_sweep(mqtt_topic_trie_t *trie, mqtt_topic_match_cb_t cb, void *arg);
+
+/**
+ * @brief free all nodes, cb is called for every node with entry before it is freed
+ *
+ * @param[in] trie: topic trie
+ * @param[in] cb: entry release callback, can be NULL
+ * @param[in] arg: callback argument
+ *
+ * @return none
+ */
+void mqtt_topic_trie_clear(mqtt_topic_trie_t *trie, mqtt_topic_match_cb_t cb, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MQTT_TOPIC_TRIE_H__ */
@@ -37,6 +37,26 @@
 #define MQTT_RECV_BLOCK_TIME_MS (2000U)
 #endif
 
+/**
+ * @brief The longest time the MQTT loop blocks on the socket when nothing
+ * happens. Timeouts added by other threads and tuya_iot_stop/reset/reconnect
+ * are seen this late, a larger value saves wakeups at the cost of latency.
+ *
+ */
+#ifndef MQTT_YIELD_BLOCK_MAX_MS
+#define MQTT_YIELD_BLOCK_MAX_MS (1000U)
+#endif
+
+/**
+ * @brief Network check interval when no link event comes, in case the
+ * network_check callback is not backed by netmgr. Raise it only when the
+ * link status is published with EVENT_LINK_STATUS_CHG.
+ *
+ */
+#ifndef IOT_NETWORK_CHECK_INTERVAL_MS
+#define IOT_NETWORK_CHECK_INTERVAL_MS (1000U)
+#endif
+
 /**
  * @brief MQTT keep alive period.
  *
@@ -97,4 +117,11 @@
 #define MATOP_TIMEOUT_MS_DEFAULT (8000U)
 #endif
 
+/**
+ * @brief MQTT QoS1 publish waiting for PUBACK at the same time, max 254.
+ */
+#ifndef MQTT_PUBLISH_QUEUE_SIZE
+#define MQTT_PUBLISH_QUEUE_SIZE (64U)
+#endif
+
 #endif /* ifndef TUYA_CONFIG_DEFAULTS_H_ */
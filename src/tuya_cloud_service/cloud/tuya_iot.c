@@ -29,6 +29,7 @@
 #include "tuya_tls.h"
 #include "netmgr.h"
 #include "tuya_health.h"
+#include "dp_journal.h"
 typedef enum {
     STATE_IDLE,
     STATE_START,
@@ -382,6 +383,11 @@ static void mqtt_client_connected_on(void *context, void *user_data)
     matop_serice_init(&client->matop,
                       &(const matop_config_t){.mqctx = &client->mqctx, .devid = client->activate.devid});
 
+#if defined(ENABLE_DP_JOURNAL) && (ENABLE_DP_JOURNAL == 1)
+    /* Report the dps kept while offline */
+    dp_journal_replay_start(client);
+#endif
+
     /* Auto check upgrade timer start */
     if (tal_sw_timer_is_running(client->check_upgrade_timer) == false) {
         tal_sw_timer_start(client->check_upgrade_timer, 1000 * 1, TAL_TIMER_ONCE);
@@ -517,6 +523,26 @@ static int run_state_reset(tuya_iot_client_t *client)
     return tuya_iot_activated_data_remove(client);
 }
 
+/* wake up the state machine blocked in tuya_iot_yield */
+static void tuya_iot_wakeup(tuya_iot_client_t *client)
+{
+    if (client && client->wakeup) {
+        tal_semaphore_post(client->wakeup);
+    }
+}
+
+static int tuya_iot_link_status_evt(void *data)
+{
+    tuya_iot_wakeup(tuya_iot_client_get());
+    return OPRT_OK;
+}
+
+/* wait for a wakeup or timeout_ms, instead of sleeping unconditionally */
+static void tuya_iot_wait(tuya_iot_client_t *client, uint32_t timeout_ms)
+{
+    tal_semaphore_wait(client->wakeup, timeout_ms);
+}
+
 /* -------------------------------------------------------------------------- */
 /*                                Tuya IoT API                                */
 /* -------------------------------------------------------------------------- */
@@ -558,6 +584,7 @@ int tuya_iot_init(tuya_iot_client_t *client, const tuya_iot_config_t *config)
     PR_DEBUG("authkey:%s", client->config.authkey);
 
     tal_semaphore_create_init(&client->token_get.sem, 0, 1);
+    tal_semaphore_create_init(&client->wakeup, 0, 1);
 
     /* Default storage namespace */
     if (client->config.storage_namespace == NULL) {
@@ -586,6 +613,14 @@ int tuya_iot_init(tuya_iot_client_t *client, const tuya_iot_config_t *config)
 
     tuya_health_monitor_init();
 
+#if defined(ENABLE_DP_JOURNAL) && (ENABLE_DP_JOURNAL == 1)
+    dp_journal_init();
+#endif
+
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+    tuya_iot_dp_report_init(client);
+#endif
+
     /* Auto check upgrade timer init */
     ret = tal_sw_timer_create(check_auto_upgrade_timeout_on, client, &client->check_upgrade_timer);
     if (OPRT_OK != ret) {
@@ -593,6 +628,9 @@ int tuya_iot_init(tuya_iot_client_t *client, const tuya_iot_config_t *config)
     }
     s_iot_client_solo = client;
 
+    /* The network states wait for the link to change */
+    tal_event_subscribe(EVENT_LINK_STATUS_CHG, "iot", tuya_iot_link_status_evt, SUBSCRIBE_TYPE_NORMAL);
+
     client->state = STATE_IDLE;
     client->nextstate = STATE_IDLE;
     return ret;
@@ -615,6 +653,7 @@ int tuya_iot_start(tuya_iot_client_t *client)
         return OPRT_COM_ERROR;
     }
     client->nextstate = STATE_START;
+    tuya_iot_wakeup(client);
     return OPRT_OK;
 }
 
@@ -629,6 +668,7 @@ int tuya_iot_start(tuya_iot_client_t *client)
 int tuya_iot_stop(tuya_iot_client_t *client)
 {
     client->nextstate = STATE_STOP;
+    tuya_iot_wakeup(client);
     return OPRT_OK;
 }
 
@@ -649,6 +689,7 @@ int tuya_iot_reconnect(tuya_iot_client_t *client)
         return OPRT_COM_ERROR;
     }
     client->nextstate = STATE_MQTT_RECONNECT;
+    tuya_iot_wakeup(client);
     return OPRT_OK;
 }
 
@@ -683,6 +724,7 @@ int tuya_iot_reset(tuya_iot_client_t *client)
     client->event.value.asInteger = TUYA_RESET_TYPE_FACTORY;
     iot_dispatch_event(client);
     client->nextstate = STATE_RESET;
+    tuya_iot_wakeup(client);
 
     if (client->state == STATE_TOKEN_PENDING) {
         client->token_get.result = OPRT_COM_ERROR;
@@ -743,9 +785,10 @@ int tuya_iot_token_get_pending(tuya_iot_client_t *client)
  * @brief Yields control to the Tuya IoT client for processing incoming messages
  * and events.
  *
- * This function allows the Tuya IoT client to process any pending messages or
- * events in a non-blocking manner. It should be called periodically to ensure
- * timely processing of incoming data.
+ * This function runs one step of the Tuya IoT client state machine. A state
+ * waiting for something blocks until it happens: a link status event, a call
+ * of the start/stop/reset API, data on the MQTT socket or the next timeout.
+ * It should be called in a loop by the thread running the client.
  *
  * @param client Pointer to the Tuya IoT client structure.
  * @return Returns 0 on success, or a negative error code on failure.
@@ -762,12 +805,12 @@ int tuya_iot_yield(tuya_iot_client_t *client)
     switch (client->state) {
 
     case STATE_MQTT_YIELD:
-        tuya_mqtt_loop(&client->mqctx);
+        tuya_mqtt_loop_wait(&client->mqctx, matop_service_next_timeout(&client->matop, MQTT_YIELD_BLOCK_MAX_MS));
         matop_serice_yield(&client->matop);
         break;
 
     case STATE_IDLE:
-        tal_system_sleep(500);
+        tuya_iot_wait(client, SEM_WAIT_FOREVER);
         break;
 
     case STATE_START:
@@ -834,7 +877,7 @@ int tuya_iot_yield(tuya_iot_client_t *client)
             client->status = TUYA_STATUS_WIFI_CONNECTED;
             client->nextstate = client->is_activated ? STATE_ENDPOINT_GET : STATE_ENDPOINT_UPDATE;
         } else {
-            tal_system_sleep(1000);
+            tuya_iot_wait(client, IOT_NETWORK_CHECK_INTERVAL_MS);
         }
         break;
 
@@ -852,7 +895,7 @@ int tuya_iot_yield(tuya_iot_client_t *client)
     case STATE_ENDPOINT_UPDATE:
         ret = tuya_endpoint_update();
         if (ret != OPRT_OK) {
-            tal_system_sleep(1000);
+            tuya_iot_wait(client, 1000);
             break;
         }
         if (client->is_activated) {
@@ -870,7 +913,7 @@ int tuya_iot_yield(tuya_iot_client_t *client)
     case STATE_ACTIVATING:
         ret = client_activate_process(client, client->binding->token);
         if (ret != OPRT_OK) {
-            tal_system_sleep(1000);
+            tuya_iot_wait(client, 1000);
             break;
         }
 
@@ -942,7 +985,7 @@ int tuya_iot_yield(tuya_iot_client_t *client)
             client->status = TUYA_STATUS_WIFI_CONNECTED;
             client->nextstate = STATE_MQTT_CONNECT_START;
         } else {
-            tal_system_sleep(1000);
+            tuya_iot_wait(client, IOT_NETWORK_CHECK_INTERVAL_MS);
         }
         break;
 
@@ -1003,7 +1046,11 @@ int tuya_iot_activated_data_remove(tuya_iot_client_t *client)
     }
 
     /* Clean client local data */
+    tuya_iot_dp_report_clear();
     dp_schema_delete(client->activate.devid);
+#if defined(ENABLE_DP_JOURNAL) && (ENABLE_DP_JOURNAL == 1)
+    dp_journal_clear();
+#endif
     tal_kv_del((const char *)(client->activate.schemaId));
     tal_kv_del((const char *)(client->config.storage_namespace));
     tuya_endpoint_remove();
@@ -1029,6 +1076,16 @@ static int tuya_iot_dp_report_json_common(tuya_iot_client_t *client, const char
     int printlen = 0;
     char *buffer = NULL;
 
+#if defined(ENABLE_DP_JOURNAL) && (ENABLE_DP_JOURNAL == 1)
+    if (tuya_mqtt_connected(&client->mqctx)) {
+        /* The older values kept offline must not be replayed after these */
+        dp_journal_drop(dps);
+    } else if (NULL == cb) {
+        /* Kept and reported after connected, the reports with notify still fail */
+        return dp_journal_add(dps, time);
+    }
+#endif
+
     /* Package JSON format */
     if (time) {
         buffer = tal_malloc(strlen(dps) + strlen(time) + 64);
@@ -223,6 +223,7 @@ struct tuya_iot_client_handle {
     matop_context_t matop;
     tuya_event_msg_t event;
     tuya_token_get_t token_get;
+    SEM_HANDLE wakeup; // posted when the state machine has something to do
     tuya_binding_info_t *binding;
     TIMER_ID check_upgrade_timer;
     uint8_t status;
@@ -300,6 +301,7 @@ int tuya_iot_yield(tuya_iot_client_t *client);
 
 /**
  * @brief Report Tuya data point(DP) services to the cloud.
+ * Kept in the dp journal and reported after connected when MQTT is offline.
  *
  * @param client - The Tuya client context.
  * @param dps - DP JSON format e.g: "{"101":true}"
@@ -309,6 +311,7 @@ int tuya_iot_dp_report_json(tuya_iot_client_t *client, const char *dps);
 
 /**
  * @brief Report Tuya data point(DP) services to the cloud,with time.
+ * Kept in the dp journal with the time and reported after connected when MQTT is offline.
  *
  * @param client - The Tuya client context.
  * @param dps - DP JSON format e.g: "{"101":true}"
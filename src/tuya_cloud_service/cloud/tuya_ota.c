@@ -21,6 +21,46 @@
 #include "iotdns.h"
 #include "mix_method.h"
 
+#ifndef HTTP_DOWNLOAD_CONN_NUM
+#define HTTP_DOWNLOAD_CONN_NUM 1
+#endif
+
+#if defined(ENABLE_OTA_PIPELINE) && (ENABLE_OTA_PIPELINE == 1)
+#ifndef OTA_PIPELINE_BUF_NUM
+#define OTA_PIPELINE_BUF_NUM 2
+#endif
+
+#define OTA_PIPE_WAIT_FOREVER 0xFFFFFFFF
+#define OTA_PIPE_BLOCK_SIZE   4096
+
+/* data of the image, a block of len 0 ends the writer */
+typedef struct {
+    size_t offset;
+    size_t len;
+    uint8_t data[0];
+} ota_pipe_block_t;
+
+/**
+ * @brief The download thread copies the data into a free block and hands it to
+ * the writer thread, which hashes it and writes it to the flash. The download
+ * goes on while the flash is written, and waits for a free block when the
+ * writer is OTA_PIPELINE_BUF_NUM blocks behind.
+ */
+typedef struct {
+    QUEUE_HANDLE free_q; // ota_pipe_block_t *
+    QUEUE_HANDLE full_q;
+    ota_pipe_block_t *block[OTA_PIPELINE_BUF_NUM];
+    size_t block_size;
+    size_t file_size;
+    uint8_t *work; // the bytes left by tal_ota_data_process and the next block
+    size_t work_size;
+    size_t remain_len;
+    volatile int result; // set by the writer
+    THREAD_HANDLE thread;
+    SEM_HANDLE exit_sem;
+} ota_pipe_t;
+#endif
+
 typedef struct {
     tuya_ota_config_t config;
     tuya_ota_msg_t msg;
@@ -29,6 +69,9 @@ typedef struct {
     uint8_t progress_percent;
     THREAD_HANDLE upgrade_thrd;
     TKL_HASH_HANDLE sha256;
+#if defined(ENABLE_OTA_PIPELINE) && (ENABLE_OTA_PIPELINE == 1)
+    ota_pipe_t *pipe;
+#endif
 } tuya_ota_t;
 
 int tuya_ota_upgrade_status_report(tuya_ota_t *handle, int status);
@@ -36,6 +79,199 @@ int tuya_ota_upgrade_progress_report(tuya_ota_t *handle, int percent);
 
 static tuya_ota_t *s_ota_ctx;
 
+#if defined(ENABLE_OTA_PIPELINE) && (ENABLE_OTA_PIPELINE == 1)
+static void ota_pipe_write(tuya_ota_t *ota, ota_pipe_block_t *block)
+{
+    ota_pipe_t *pipe = ota->pipe;
+    TUYA_OTA_DATA_T ota_pack;
+    uint32_t remain_len = 0;
+    uint8_t *data = block->data;
+    size_t len = block->len;
+    int rt = OPRT_OK;
+
+    if (pipe->remain_len) {
+        // the bytes not processed last time are given again with this block
+        if (pipe->remain_len + block->len > pipe->work_size) {
+            uint8_t *work = tal_realloc(pipe->work, pipe->remain_len + block->len);
+            if (NULL == work) {
+                pipe->result = OPRT_MALLOC_FAILED;
+                return;
+            }
+            pipe->work = work;
+            pipe->work_size = pipe->remain_len + block->len;
+        }
+        memcpy(pipe->work + pipe->remain_len, block->data, block->len);
+        data = pipe->work;
+        len += pipe->remain_len;
+    }
+
+    memset(&ota_pack, 0, sizeof(TUYA_OTA_DATA_T));
+    ota_pack.total_len = pipe->file_size;
+    ota_pack.offset = block->offset - pipe->remain_len;
+    ota_pack.data = data;
+    ota_pack.len = len;
+    rt = tal_ota_data_process(&ota_pack, &remain_len);
+    if (OPRT_OK != rt) {
+        PR_ERR("ota data process at %d err:%d", ota_pack.offset, rt);
+        pipe->result = rt;
+        return;
+    }
+    if (remain_len > len) {
+        remain_len = len;
+    }
+    tal_sha256_update_ret(ota->sha256, data, len - remain_len);
+
+    if (remain_len && NULL == pipe->work) {
+        pipe->work_size = pipe->block_size * 2;
+        pipe->work = tal_malloc(pipe->work_size);
+        if (NULL == pipe->work) {
+            pipe->result = OPRT_MALLOC_FAILED;
+            return;
+        }
+    }
+    if (remain_len) {
+        memmove(pipe->work, data + len - remain_len, remain_len);
+    }
+    pipe->remain_len = remain_len;
+}
+
+static void ota_pipe_writer_thread(void *arg)
+{
+    tuya_ota_t *ota = (tuya_ota_t *)arg;
+    ota_pipe_t *pipe = ota->pipe;
+    ota_pipe_block_t *block = NULL;
+
+    for (;;) {
+        if (OPRT_OK != tal_queue_fetch(pipe->full_q, &block, OTA_PIPE_WAIT_FOREVER)) {
+            continue;
+        }
+        if (0 == block->len) {
+            break;
+        }
+        // the blocks after an error are dropped, the download is failed at the end
+        if (OPRT_OK == pipe->result) {
+            ota_pipe_write(ota, block);
+        }
+        tal_queue_post(pipe->free_q, &block, OTA_PIPE_WAIT_FOREVER);
+    }
+
+    tal_semaphore_post(pipe->exit_sem);
+}
+
+static void ota_pipe_destroy(tuya_ota_t *ota)
+{
+    ota_pipe_t *pipe = ota->pipe;
+    int i;
+
+    if (NULL == pipe) {
+        return;
+    }
+    if (pipe->full_q) {
+        tal_queue_free(pipe->full_q);
+    }
+    if (pipe->free_q) {
+        tal_queue_free(pipe->free_q);
+    }
+    if (pipe->exit_sem) {
+        tal_semaphore_release(pipe->exit_sem);
+    }
+    for (i = 0; i < OTA_PIPELINE_BUF_NUM; i++) {
+        if (pipe->block[i]) {
+            tal_free(pipe->block[i]);
+        }
+    }
+    if (pipe->work) {
+        tal_free(pipe->work);
+    }
+    tal_free(pipe);
+    ota->pipe = NULL;
+}
+
+static int ota_pipe_create(tuya_ota_t *ota)
+{
+    ota_pipe_t *pipe = NULL;
+    int rt = OPRT_OK;
+    int i;
+
+    pipe = tal_malloc(sizeof(ota_pipe_t));
+    TUYA_CHECK_NULL_RETURN(pipe, OPRT_MALLOC_FAILED);
+    memset(pipe, 0, sizeof(ota_pipe_t));
+    ota->pipe = pipe;
+    pipe->block_size = ota->config.range_size ? ota->config.range_size : OTA_PIPE_BLOCK_SIZE;
+
+    TUYA_CALL_ERR_GOTO(tal_queue_create_init(&pipe->free_q, sizeof(ota_pipe_block_t *), OTA_PIPELINE_BUF_NUM), __err);
+    TUYA_CALL_ERR_GOTO(tal_queue_create_init(&pipe->full_q, sizeof(ota_pipe_block_t *), OTA_PIPELINE_BUF_NUM), __err);
+    TUYA_CALL_ERR_GOTO(tal_semaphore_create_init(&pipe->exit_sem, 0, 1), __err);
+    for (i = 0; i < OTA_PIPELINE_BUF_NUM; i++) {
+        pipe->block[i] = tal_malloc(sizeof(ota_pipe_block_t) + pipe->block_size);
+        if (NULL == pipe->block[i]) {
+            rt = OPRT_MALLOC_FAILED;
+            goto __err;
+        }
+        tal_queue_post(pipe->free_q, &pipe->block[i], OTA_PIPE_WAIT_FOREVER);
+    }
+
+    THREAD_CFG_T thrd_param;
+    thrd_param.priority = THREAD_PRIO_3;
+    thrd_param.stackDepth = 4096;
+    thrd_param.thrdname = "ota_writer";
+    TUYA_CALL_ERR_GOTO(
+        tal_thread_create_and_start(&pipe->thread, NULL, NULL, ota_pipe_writer_thread, ota, &thrd_param), __err);
+
+    return OPRT_OK;
+
+__err:
+    ota_pipe_destroy(ota);
+    return rt;
+}
+
+/* copy the data to the writer, blocks while the writer is busy with all blocks */
+static int ota_pipe_push(ota_pipe_t *pipe, uint8_t *data, size_t offset, size_t len)
+{
+    ota_pipe_block_t *block = NULL;
+
+    while (len) {
+        // the writer failed, the rest of the image is not needed
+        if (OPRT_OK != pipe->result) {
+            return pipe->result;
+        }
+        tal_queue_fetch(pipe->free_q, &block, OTA_PIPE_WAIT_FOREVER);
+        block->offset = offset;
+        block->len = len > pipe->block_size ? pipe->block_size : len;
+        memcpy(block->data, data, block->len);
+        tal_queue_post(pipe->full_q, &block, OTA_PIPE_WAIT_FOREVER);
+        data += block->len;
+        offset += block->len;
+        len -= block->len;
+    }
+
+    return pipe->result;
+}
+
+/* wait for the writer to finish the blocks in queue, return its result */
+static int ota_pipe_flush(tuya_ota_t *ota)
+{
+    ota_pipe_t *pipe = ota->pipe;
+    ota_pipe_block_t *block = NULL;
+    int rt = OPRT_OK;
+
+    if (NULL == pipe) {
+        return OPRT_OK;
+    }
+    tal_queue_fetch(pipe->free_q, &block, OTA_PIPE_WAIT_FOREVER);
+    block->len = 0;
+    tal_queue_post(pipe->full_q, &block, OTA_PIPE_WAIT_FOREVER);
+    tal_semaphore_wait_forever(pipe->exit_sem);
+    // the returned thread is freed only when deleted
+    tal_thread_delete(pipe->thread);
+    pipe->thread = NULL;
+    rt = pipe->result;
+    ota_pipe_destroy(ota);
+
+    return rt;
+}
+#endif
+
 static void file_download_event_cb(http_download_event_id_t id, http_download_event_t *event)
 {
     tuya_ota_t *ota = (tuya_ota_t *)event->user_data;
@@ -51,12 +287,23 @@ static void file_download_event_cb(http_download_event_id_t id, http_download_ev
         tuya_ota_upgrade_status_report(ota, TUS_UPGRDING);
         tal_sha256_create_init(&ota->sha256);
         tal_sha256_starts_ret(ota->sha256, 0);
+#if defined(ENABLE_OTA_PIPELINE) && (ENABLE_OTA_PIPELINE == 1)
+        // write the data in the download thread if failed
+        if (0 == ota->channel && OPRT_OK != ota_pipe_create(ota)) {
+            PR_WARN("ota pipeline create fail");
+        }
+#endif
         break;
 
     case DL_EVENT_ON_FILESIZE:
         PR_DEBUG("DL_EVENT_ON_FILESIZE");
         if (0 == ota->channel) {
             tal_ota_start_notify(event->file_size, TUYA_OTA_FULL, TUYA_OTA_PATH_AIR);
+#if defined(ENABLE_OTA_PIPELINE) && (ENABLE_OTA_PIPELINE == 1)
+            if (ota->pipe) {
+                ota->pipe->file_size = event->file_size;
+            }
+#endif
         } else if (event_cb) {
             ota->event.id = TUYA_OTA_EVENT_START;
             ota->event.file_size = event->file_size;
@@ -68,6 +315,15 @@ static void file_download_event_cb(http_download_event_id_t id, http_download_ev
     case DL_EVENT_ON_DATA: {
         PR_DEBUG("DL_EVENT_ON_DATA:%d", event->data_len);
         PR_DEBUG("event->file_size %d, offset:%d, last remain %d", event->file_size, event->offset, event->remain_len);
+#if defined(ENABLE_OTA_PIPELINE) && (ENABLE_OTA_PIPELINE == 1)
+        if (ota->pipe) {
+            // the writer keeps the bytes not processed, so all data is consumed here
+            if (OPRT_OK != ota_pipe_push(ota->pipe, event->data, event->offset, event->data_len)) {
+                event->abort = true;
+            }
+            event->remain_len = 0;
+        } else
+#endif
         if (0 == ota->channel) {
             TUYA_OTA_DATA_T ota_pack;
 
@@ -101,6 +357,13 @@ static void file_download_event_cb(http_download_event_id_t id, http_download_ev
     case DL_EVENT_FINISH:
         PR_DEBUG("DL_EVENT_FINISH");
         PR_DEBUG("File Download Percent: %d%%", 100);
+#if defined(ENABLE_OTA_PIPELINE) && (ENABLE_OTA_PIPELINE == 1)
+        if (OPRT_OK != ota_pipe_flush(ota)) {
+            tal_sha256_free(ota->sha256);
+            tuya_ota_upgrade_status_report(ota, TUS_UPGRD_EXEC);
+            break;
+        }
+#endif
         tal_sha256_finish_ret(ota->sha256, file_hmac);
         tal_sha256_free(ota->sha256);
         hex2str((uint8_t *)file_sha256, file_hmac, 32);
@@ -122,6 +385,9 @@ static void file_download_event_cb(http_download_event_id_t id, http_download_ev
 
     case DL_EVENT_FAULT:
         PR_DEBUG("DL_EVENT_FAULT");
+#if defined(ENABLE_OTA_PIPELINE) && (ENABLE_OTA_PIPELINE == 1)
+        ota_pipe_flush(ota);
+#endif
         tuya_ota_upgrade_status_report(ota, TUS_UPGRD_EXEC);
         if (event_cb) {
             ota->event.id = TUYA_OTA_EVENT_FAULT;
@@ -170,6 +436,7 @@ static void ota_process_thread_func(void *arg)
     tuya_iotdns_query_domain_certs(ota->msg.fw_url, &cert, &cert_len);
 
     http_download_config_t download_cfg;
+    memset(&download_cfg, 0, sizeof(http_download_config_t));
     download_cfg.file_size = ota->msg.file_size;
     download_cfg.range_length = ota->config.range_size;
     download_cfg.timeout_ms = ota->config.timeout_ms;
@@ -178,6 +445,7 @@ static void ota_process_thread_func(void *arg)
     download_cfg.url = ota->msg.fw_url;
     download_cfg.event_handler = file_download_event_cb;
     download_cfg.user_data = ota;
+    download_cfg.conn_num = HTTP_DOWNLOAD_CONN_NUM;
 
     http_file_download(&download_cfg);
     tal_free(cert);
@@ -7,7 +7,12 @@
  * events efficiently, and provide a clean shutdown process.
  *
  * The implementation utilizes a select-based approach to monitor and react to
- * socket events across multiple sockets. It supports operations such as adding
+ * socket events across multiple sockets, or epoll on Linux when
+ * ENABLE_LAN_EPOLL is set. A loopback UDP socket is watched with the readers,
+ * registering or unregistering a socket sends a datagram to it so the change
+ * takes effect at once instead of on the next poll timeout. The socket is
+ * tested with a datagram at startup, if it does not come back the loop polls
+ * every second as without it. It supports operations such as adding
  * a new socket reader, updating existing readers, and removing readers. Error
  * handling and socket event detection are integral parts of the loop to ensure
  * robust operation.
@@ -25,11 +30,21 @@
  *
  */
 
+#include "tuya_iot_config.h"
 #include "lan_sock.h"
 #include "tal_api.h"
 #include "tal_network.h"
 #include "tuya_lan.h"
 
+#if defined(ENABLE_LAN_EPOLL) && (ENABLE_LAN_EPOLL == 1) && (100 == OPERATING_SYSTEM)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#define LAN_SLOOP_EPOLL 1
+#else
+#define LAN_SLOOP_EPOLL 0
+#endif
+
 #pragma pack(1)
 
 #define LAN_UDP_READER_CNT 5
@@ -40,6 +55,14 @@ typedef struct LAN_SLOOP_S {
     sloop_sock_t *readers;
     BOOL_T terminate;
     QUEUE_HANDLE queue;
+    int wakeup_fd; // loopback udp socket, a datagram to it wakes up the loop
+    uint16_t wakeup_port;
+#if LAN_SLOOP_EPOLL
+    int epfd;
+#else
+    TUYA_FD_SET_T *rfds;
+    TUYA_FD_SET_T *efds;
+#endif
 } LAN_SLOOP_S, *P_LAN_SLOOP_S;
 #pragma pack()
 
@@ -50,22 +73,18 @@ static P_LAN_SLOOP_S g_sloop = NULL;
 #define STACK_SIZE_LAN (4 * 1024)
 #endif
 
+// the loop wakes up for the pre_select callbacks at least once a tick
+#define LAN_SLOOP_TICK_MS      5000
+#define LAN_SLOOP_POLL_MS      1000 // tick when the wakeup socket is not available
+#define LAN_SLOOP_WAKEUP_TEST_MS 200  // a test datagram must come back this soon at startup
+#define LAN_SLOOP_EVENT_NUM    8
+#define LAN_SLOOP_WAKEUP_INDEX 0xFFFFFFFF
+
 static uint32_t __ty_sock_get_reader_num(void)
 {
     return (LAN_UDP_READER_CNT + tuya_lan_get_client_num());
 }
 
-static void __sock_table_set_fds(TUYA_FD_SET_T *rfds, TUYA_FD_SET_T *efds)
-{
-    int idx;
-    for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
-        if (g_sloop->readers[idx].sock >= 0) {
-            tal_net_fd_set(g_sloop->readers[idx].sock, rfds);
-            tal_net_fd_set(g_sloop->readers[idx].sock, efds);
-        }
-    }
-}
-
 static void __sock_select_err_handle()
 {
     int idx;
@@ -79,6 +98,129 @@ static void __sock_select_err_handle()
     return;
 }
 
+static OPERATE_RET __sock_poll_init(void)
+{
+#if LAN_SLOOP_EPOLL
+    g_sloop->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (g_sloop->epfd < 0) {
+        PR_ERR("epoll create err %d", errno);
+        return OPRT_COM_ERROR;
+    }
+#else
+    g_sloop->rfds = tal_malloc(sizeof(TUYA_FD_SET_T));
+    g_sloop->efds = tal_malloc(sizeof(TUYA_FD_SET_T));
+    if (g_sloop->rfds == NULL || g_sloop->efds == NULL) {
+        PR_ERR("malloc err");
+        return OPRT_MALLOC_FAILED;
+    }
+#endif
+    return OPRT_OK;
+}
+
+static void __sock_poll_deinit(void)
+{
+#if LAN_SLOOP_EPOLL
+    if (g_sloop->epfd >= 0) {
+        close(g_sloop->epfd);
+        g_sloop->epfd = -1;
+    }
+#else
+    if (g_sloop->rfds) {
+        tal_free(g_sloop->rfds);
+        g_sloop->rfds = NULL;
+    }
+    if (g_sloop->efds) {
+        tal_free(g_sloop->efds);
+        g_sloop->efds = NULL;
+    }
+#endif
+}
+
+static void __sock_poll_add(int sock, uint32_t idx)
+{
+    if (sock > g_sloop->max_sock) {
+        g_sloop->max_sock = sock;
+    }
+#if LAN_SLOOP_EPOLL
+    struct epoll_event event = {.events = EPOLLIN, .data.u32 = idx};
+    if (0 != epoll_ctl(g_sloop->epfd, EPOLL_CTL_ADD, sock, &event)) {
+        PR_ERR("epoll add %d err %d", sock, errno);
+    }
+#endif
+}
+
+static void __sock_poll_del(int sock)
+{
+#if LAN_SLOOP_EPOLL
+    epoll_ctl(g_sloop->epfd, EPOLL_CTL_DEL, sock, NULL);
+#endif
+}
+
+/* some stacks drop loopback datagrams, then the loop would only see the tick */
+static BOOL_T __sock_wakeup_test(int fd, uint16_t port)
+{
+    TUYA_FD_SET_T rfds;
+    TUYA_IP_ADDR_T from_addr = 0;
+    uint16_t from_port = 0;
+    uint8_t byte = 0;
+
+    if (1 != tal_net_send_to(fd, &byte, 1, TY_IPADDR_LOOPBACK, port)) {
+        return FALSE;
+    }
+
+    tal_net_fd_zero(&rfds);
+    tal_net_fd_set(fd, &rfds);
+    if (tal_net_select(fd + 1, &rfds, NULL, NULL, LAN_SLOOP_WAKEUP_TEST_MS) <= 0) {
+        return FALSE;
+    }
+
+    return (1 == tal_net_recvfrom(fd, &byte, 1, &from_addr, &from_port)) ? TRUE : FALSE;
+}
+
+static void __sock_wakeup_create(void)
+{
+    TUYA_IP_ADDR_T addr = 0;
+    int fd = tal_net_socket_create(PROTOCOL_UDP);
+    if (fd < 0) {
+        PR_WARN("wakeup sock create err %d", tal_net_get_errno());
+        return;
+    }
+
+    if (OPRT_OK != tal_net_bind(fd, TY_IPADDR_LOOPBACK, 0) ||
+        OPRT_OK != tal_net_getsockname(fd, &addr, &g_sloop->wakeup_port)) {
+        PR_WARN("wakeup sock bind err %d, poll every %dms", tal_net_get_errno(), LAN_SLOOP_POLL_MS);
+        tal_net_close(fd);
+        return;
+    }
+    if (!__sock_wakeup_test(fd, g_sloop->wakeup_port)) {
+        PR_WARN("wakeup sock test err %d, poll every %dms", tal_net_get_errno(), LAN_SLOOP_POLL_MS);
+        tal_net_close(fd);
+        return;
+    }
+    tal_net_set_block(fd, FALSE);
+    g_sloop->wakeup_fd = fd;
+    __sock_poll_add(fd, LAN_SLOOP_WAKEUP_INDEX);
+}
+
+static void __sock_wakeup(void)
+{
+    uint8_t byte = 0;
+
+    if (g_sloop->wakeup_fd >= 0) {
+        tal_net_send_to(g_sloop->wakeup_fd, &byte, 1, TY_IPADDR_LOOPBACK, g_sloop->wakeup_port);
+    }
+}
+
+static void __sock_wakeup_drain(void)
+{
+    uint8_t buf[16];
+    TUYA_IP_ADDR_T addr = 0;
+    uint16_t port = 0;
+
+    while (tal_net_recvfrom(g_sloop->wakeup_fd, buf, sizeof(buf), &addr, &port) > 0) {
+    }
+}
+
 void __ty_sock_loop_deinit(void)
 {
     if (NULL == g_sloop) {
@@ -102,6 +244,11 @@ void __ty_sock_loop_deinit(void)
         tal_free(g_sloop->readers);
         g_sloop->readers = NULL;
     }
+    if (g_sloop->wakeup_fd >= 0) {
+        tal_net_close(g_sloop->wakeup_fd);
+        g_sloop->wakeup_fd = -1;
+    }
+    __sock_poll_deinit();
     if (g_sloop->queue) {
         tal_queue_free(g_sloop->queue);
     }
@@ -116,10 +263,6 @@ void __ty_sock_loop_deinit(void)
 
 void __ty_add_sock_reader(sloop_sock_t sock_info)
 {
-    if (sock_info.sock > g_sloop->max_sock) {
-        g_sloop->max_sock = sock_info.sock;
-    }
-
     uint8_t idx = 0;
     for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
         if ((sock_info.sock == g_sloop->readers[idx].sock) && (g_sloop->readers[idx].read == sock_info.read)) {
@@ -136,6 +279,7 @@ void __ty_add_sock_reader(sloop_sock_t sock_info)
                 PR_DEBUG("reg lan sock %d,read:%p", sock_info.sock, sock_info.read);
                 memset(&g_sloop->readers[idx], 0, sizeof(sloop_sock_t));
                 memcpy(&g_sloop->readers[idx], &sock_info, sizeof(sloop_sock_t));
+                __sock_poll_add(sock_info.sock, idx);
                 g_sloop->cnt++;
                 break;
             }
@@ -156,6 +300,7 @@ void __ty_del_sock_reader(int sock)
     for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
         if (g_sloop->readers[idx].sock == sock) {
             PR_DEBUG("unreg lan sock %d and close it", sock);
+            __sock_poll_del(sock);
             tal_net_close(g_sloop->readers[idx].sock);
             g_sloop->readers[idx].sock = -1;
             // g_sloop->readers[idx].pre_select = NULL;
@@ -175,89 +320,137 @@ void __ty_del_sock_reader(int sock)
     return;
 }
 
-void tuya_sock_loop_run(void *data)
+static void __sock_queue_process(void)
 {
-    int actv_cnt = 0;
-    int idx = 0;
-    TUYA_FD_SET_T *rfds, *efds;
     sloop_sock_t queue_data = {0};
 
-    rfds = tal_malloc(sizeof(TUYA_FD_SET_T));
-    efds = tal_malloc(sizeof(TUYA_FD_SET_T));
-    if (rfds == NULL || efds == NULL) {
-        PR_ERR("malloc err");
-        goto Err;
+    while (tal_queue_fetch(g_sloop->queue, &queue_data, 0) == 0) {
+        if (queue_data.read) {
+            __ty_add_sock_reader(queue_data);
+        } else {
+            __ty_del_sock_reader(queue_data.sock);
+        }
+        memset(&queue_data, 0, sizeof(sloop_sock_t));
     }
-    memset(rfds, 0, sizeof(TUYA_FD_SET_T));
-    memset(efds, 0, sizeof(TUYA_FD_SET_T));
+}
 
-    // while (tuya_get_sock_loop_terminate() &&
-    // tal_thread_get_state(g_sloop->thread) == THREAD_STATE_RUNNING) {
-    while (tuya_get_sock_loop_terminate()) {
-        memset(&queue_data, 0, sizeof(sloop_sock_t));
-        if (tal_queue_fetch(g_sloop->queue, &queue_data, 0) == 0) {
-            if (queue_data.read) {
-                __ty_add_sock_reader(queue_data);
-            } else {
-                __ty_del_sock_reader(queue_data.sock);
-            }
-        }
-        for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
-            if (g_sloop->readers[idx].pre_select) {
-                g_sloop->readers[idx].pre_select();
-            }
-        }
-        if (g_sloop->cnt == 0) {
-            tal_system_sleep(2000);
-            continue;
-        }
+#if LAN_SLOOP_EPOLL
+static void __sock_poll_dispatch(int timeout_ms)
+{
+    struct epoll_event events[LAN_SLOOP_EVENT_NUM];
+    int i;
 
-        tal_net_fd_zero(rfds);
-        tal_net_fd_zero(efds);
-        __sock_table_set_fds(rfds, efds);
-        actv_cnt = tal_net_select(g_sloop->max_sock + 1, rfds, NULL, efds, 1 * 1000);
-        if (actv_cnt < 0) {
-            PR_ERR("errno:%d", tal_net_get_errno());
+    int actv_cnt = epoll_wait(g_sloop->epfd, events, LAN_SLOOP_EVENT_NUM, timeout_ms);
+    if (actv_cnt < 0) {
+        if (EINTR != errno) {
+            PR_ERR("errno:%d", errno);
             __sock_select_err_handle();
             tal_system_sleep(1000);
+        }
+        return;
+    }
+
+    // only the ready sockets are visited
+    for (i = 0; i < actv_cnt; i++) {
+        uint32_t idx = events[i].data.u32;
+        if (LAN_SLOOP_WAKEUP_INDEX == idx) {
+            __sock_wakeup_drain();
             continue;
-        } else if (actv_cnt == 0) {
+        }
+
+        sloop_sock_t *reader = &g_sloop->readers[idx];
+        if (reader->sock < 0) {
             continue;
-        } else {
-            for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
-                if (g_sloop->readers[idx].sock >= 0) {
-                    if (0 == tal_net_fd_isset(g_sloop->readers[idx].sock, efds)) {
-                        continue;
-                    }
-                    if (g_sloop->readers[idx].err) {
-                        PR_ERR("socket err:%d, sock:%d, idx:%d", tal_net_get_errno(), g_sloop->readers[idx].sock, idx);
-                        g_sloop->readers[idx].err(g_sloop->readers[idx].sock);
-                    }
-                    actv_cnt--;
-                    if (0 == actv_cnt) {
-                        break;
-                    }
-                }
+        }
+        if (events[i].events & EPOLLERR) {
+            if (reader->err) {
+                PR_ERR("socket err:%d, sock:%d, idx:%d", tal_net_get_errno(), reader->sock, idx);
+                reader->err(reader->sock);
             }
+        } else if ((events[i].events & (EPOLLIN | EPOLLHUP)) && reader->read) {
+            reader->read(reader->sock);
         }
+    }
+}
+#else
+static void __sock_poll_dispatch(int timeout_ms)
+{
+    TUYA_FD_SET_T *rfds = g_sloop->rfds;
+    TUYA_FD_SET_T *efds = g_sloop->efds;
+    int idx;
 
-        if (0 == actv_cnt) {
+    tal_net_fd_zero(rfds);
+    tal_net_fd_zero(efds);
+    for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
+        if (g_sloop->readers[idx].sock >= 0) {
+            tal_net_fd_set(g_sloop->readers[idx].sock, rfds);
+            tal_net_fd_set(g_sloop->readers[idx].sock, efds);
+        }
+    }
+    if (g_sloop->wakeup_fd >= 0) {
+        tal_net_fd_set(g_sloop->wakeup_fd, rfds);
+    }
+
+    int actv_cnt = tal_net_select(g_sloop->max_sock + 1, rfds, NULL, efds, timeout_ms);
+    if (actv_cnt < 0) {
+        PR_ERR("errno:%d", tal_net_get_errno());
+        __sock_select_err_handle();
+        tal_system_sleep(1000);
+        return;
+    }
+
+    if (actv_cnt > 0 && g_sloop->wakeup_fd >= 0 && tal_net_fd_isset(g_sloop->wakeup_fd, rfds)) {
+        __sock_wakeup_drain();
+        actv_cnt--;
+    }
+
+    // one pass, stop once every ready socket is handled
+    for (idx = 0; actv_cnt > 0 && idx < __ty_sock_get_reader_num(); idx++) {
+        sloop_sock_t *reader = &g_sloop->readers[idx];
+        if (reader->sock < 0) {
             continue;
         }
+        if (tal_net_fd_isset(reader->sock, efds)) {
+            if (reader->err) {
+                PR_ERR("socket err:%d, sock:%d, idx:%d", tal_net_get_errno(), reader->sock, idx);
+                reader->err(reader->sock);
+            }
+            actv_cnt--;
+        }
+        if (tal_net_fd_isset(reader->sock, rfds)) {
+            if (reader->read) {
+                reader->read(reader->sock);
+            }
+            actv_cnt--;
+        }
+    }
+}
+#endif
 
+void tuya_sock_loop_run(void *data)
+{
+    int idx = 0;
+
+    // while (tuya_get_sock_loop_terminate() &&
+    // tal_thread_get_state(g_sloop->thread) == THREAD_STATE_RUNNING) {
+    while (tuya_get_sock_loop_terminate()) {
+        __sock_queue_process();
         for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
-            if (g_sloop->readers[idx].sock >= 0) {
-                if (tal_net_fd_isset(g_sloop->readers[idx].sock, rfds)) {
-                    if (g_sloop->readers[idx].read) {
-                        g_sloop->readers[idx].read(g_sloop->readers[idx].sock);
-                        actv_cnt--;
-                        if (0 == actv_cnt) {
-                            break;
-                        }
-                    }
-                }
+            if (g_sloop->readers[idx].pre_select) {
+                g_sloop->readers[idx].pre_select();
             }
         }
+
+        if (g_sloop->wakeup_fd < 0) {
+            if (g_sloop->cnt == 0) {
+                tal_system_sleep(2000);
+                continue;
+            }
+            __sock_poll_dispatch(LAN_SLOOP_POLL_MS);
+        } else {
+            // the registration wakes up the loop, so wait even if no socket
+            __sock_poll_dispatch(LAN_SLOOP_TICK_MS);
+        }
     }
 
     for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
@@ -266,14 +459,6 @@ void tuya_sock_loop_run(void *data)
         }
     }
 
-Err:
-    if (rfds) {
-        tal_free(rfds);
-    }
-    if (efds) {
-        tal_free(efds);
-    }
-
     tuya_lan_exit();
     __ty_sock_loop_deinit();
 
@@ -306,6 +491,10 @@ OPERATE_RET tuya_sock_loop_init(void)
     }
     memset(g_sloop, 0, sizeof(LAN_SLOOP_S));
     g_sloop->terminate = TRUE;
+    g_sloop->wakeup_fd = -1;
+#if LAN_SLOOP_EPOLL
+    g_sloop->epfd = -1;
+#endif
 
     op_ret = tal_queue_create_init(&g_sloop->queue, sizeof(sloop_sock_t), LAN_QUEUE_NUM);
     if (OPRT_OK != op_ret) {
@@ -323,6 +512,13 @@ OPERATE_RET tuya_sock_loop_init(void)
     for (idx = 0; idx < __ty_sock_get_reader_num(); idx++) {
         g_sloop->readers[idx].sock = -1;
     }
+
+    op_ret = __sock_poll_init();
+    if (OPRT_OK != op_ret) {
+        goto Err;
+    }
+    __sock_wakeup_create();
+
     THREAD_CFG_T thread_cfg = {.priority = THREAD_PRIO_2, .stackDepth = STACK_SIZE_LAN, .thrdname = "lan_sock_loop"};
 
     op_ret = tal_thread_create_and_start(&g_sloop->thread, NULL, NULL, tuya_sock_loop_run, NULL, &thread_cfg);
@@ -360,6 +556,7 @@ OPERATE_RET tuya_reg_lan_sock(sloop_sock_t sock_info)
         PR_ERR("queue post err");
         return op_ret;
     }
+    __sock_wakeup();
     PR_DEBUG("reg post queue %d", sock_info.sock);
     return OPRT_OK;
 }
@@ -385,6 +582,7 @@ OPERATE_RET tuya_unreg_lan_sock(int sock)
         PR_ERR("queue post err");
         return op_ret;
     }
+    __sock_wakeup();
     PR_DEBUG("unreg post queue %d", sock);
     return OPRT_OK;
 }
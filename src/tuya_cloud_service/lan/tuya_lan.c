@@ -39,6 +39,7 @@
 #define CLIENT_LMT         3
 #define RECV_BUF_LMT       512
 #define LAN_FRAME_MAX_LEN  (4 * 1024)
+#define LAN_FRAME_TIMEOUT  5 // s, a partial frame has to be completed within
 #define HEART_BEAT_TIMEOUT 30
 #define ALLOW_NO_KEY_NUM   3
 
@@ -57,6 +58,11 @@ typedef struct {
     uint8_t randB[RAND_LEN];
     uint8_t hmac[HMAC_LEN];
     uint8_t secret_key[SESSIONKEY_LEN];
+    // frame reassembly, keeps the partial frame between read events
+    uint8_t *recv_buf;
+    uint32_t recv_len;
+    uint32_t recv_size;
+    TIME_T recv_time; // when the partial frame started
 } lan_session_t;
 
 typedef struct {
@@ -93,8 +99,7 @@ typedef struct {
     tuya_iot_client_t *iot_client;
     lan_cfg_t *cfg;
     // extension
-    uint32_t recv_offset;
-    uint8_t recv_buf[0]; // keep it last !!!
+    uint8_t recv_buf[0]; // udp datagram, keep it last !!!
 } lan_mgr_t;
 
 static uint8_t app_key2[APP_KEY_LEN] = {0};
@@ -113,6 +118,11 @@ static lan_mgr_t *lan_mgr_get(void)
 
 static void lan_session_free(lan_session_t *session)
 {
+    if (session->recv_buf) {
+        tal_free(session->recv_buf);
+    }
+    // the cipher context of the session key goes with the session
+    tuya_protocol_key_evict(session->secret_key, SESSIONKEY_LEN);
     memset(session, 0, sizeof(lan_session_t));
     session->fd = -1;
 }
@@ -246,6 +256,10 @@ static void lan_session_time_check(const TIME_T time)
             } else if ((time - lan->session[i].time >= lan->cfg->heart_timeout) || (lan->session[i].fault == true)) {
                 PR_DEBUG("i:%d,time:%d,time:%d,fault:%d", i, time, lan->session[i].time, lan->session[i].fault);
                 lan_session_close(&lan->session[i]);
+            } else if (lan->session[i].recv_len && (time - lan->session[i].recv_time >= LAN_FRAME_TIMEOUT)) {
+                // a client trickling a frame must not hold the session
+                PR_DEBUG("i:%d,partial frame timeout,len:%d", i, lan->session[i].recv_len);
+                lan_session_close(&lan->session[i]);
             }
         }
     }
@@ -776,25 +790,23 @@ static void lan_protocol_process(lan_mgr_t *lan, lan_session_t *session, lpv35_f
         for (i = 0; i < SESSIONKEY_LEN; i++) {
             session->secret_key[i] = session->randA[i] ^ session->randB[i];
         }
-        size_t encrypt_olen = 0;
-        uint8_t tag_tmp[LPV35_FRAME_TAG_SIZE];
-        // encrytp data, make session key
-        op_ret = mbedtls_cipher_auth_encrypt_wrapper(
-            &(const cipher_params_t){.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
-                                     .key = (unsigned char *)(lan->iot_client->activate.localkey),
-                                     .key_len = 16,
-                                     .nonce = session->randA,
-                                     .nonce_len = LPV35_FRAME_NONCE_SIZE,
-                                     .ad = NULL,
-                                     .ad_len = 0,
-                                     .data = session->secret_key,
-                                     .data_len = SESSIONKEY_LEN},
-            session->secret_key, &encrypt_olen, tag_tmp, LPV35_FRAME_TAG_SIZE);
+        uint8_t key_tmp[SESSIONKEY_LEN + LPV35_FRAME_TAG_SIZE];
+        tal_cipher_aead_ctx_t aead;
+        // encrytp data, make session key, the tag is dropped
+        tal_cipher_aead_init(&aead);
+        op_ret = tal_cipher_aead_setkey(&aead, MBEDTLS_CIPHER_AES_128_GCM,
+                                        (unsigned char *)(lan->iot_client->activate.localkey), 16);
+        if (op_ret == OPRT_OK) {
+            op_ret = tal_cipher_aead_encrypt(&aead, session->randA, LPV35_FRAME_NONCE_SIZE, NULL, 0,
+                                             session->secret_key, SESSIONKEY_LEN, key_tmp, LPV35_FRAME_TAG_SIZE);
+        }
+        tal_cipher_aead_free(&aead);
         if (op_ret != OPRT_OK) {
             PR_ERR("aes128_gcm_encode error:%d", op_ret);
             lan_session_fault_set(session);
             break;
         }
+        memcpy(session->secret_key, key_tmp, SESSIONKEY_LEN);
         break;
 
     case FRM_QUERY_STAT:
@@ -845,51 +857,57 @@ static void lan_tcp_client_sock_err(int fd)
     return;
 }
 
-static void lan_tcp_client_sock_read(int32_t fd)
+static int lan_session_recv_buf_reserve(lan_session_t *session, uint32_t size)
 {
-    int ret = 0;
-    uint8_t *frame_buffer = NULL;
-    uint8_t *tmp_recv_buf = NULL;
-
-    lan_mgr_t *lan = lan_mgr_get();
-    lan_session_t *session = lan_session_get_by_fd(fd);
-
-    if (NULL == lan || NULL == session || !session->active) {
-        return;
+    if (session->recv_size >= size) {
+        return OPRT_OK;
     }
 
-    uint32_t offset = 0;
-    int recv_datalen = 0;
+    uint8_t *buf = tal_realloc(session->recv_buf, size);
+    if (NULL == buf) {
+        PR_ERR("recv buf realloc fail %d", size);
+        return OPRT_MALLOC_FAILED;
+    }
+    session->recv_buf = buf;
+    session->recv_size = size;
 
-    lan->recv_offset = 0;
+    return OPRT_OK;
+}
 
-recv_again:
-    recv_datalen = tal_net_recv(fd, lan->recv_buf + lan->recv_offset, lan->cfg->bufsize - lan->recv_offset);
-    if (recv_datalen <= 0) {
-        PR_ERR("net recv err fd:%d,errno:%d", fd, tal_net_get_errno());
-        lan_session_fault_set(session);
-        return;
-    }
-    // recv data process
-    recv_datalen += lan->recv_offset;
-    if (recv_datalen < LPV35_FRAME_MINI_SIZE) {
-        PR_ERR("not enough data len:%d", recv_datalen);
-        return;
-    }
+/**
+ * @brief handle the complete frames in the session buffer, a partial frame is
+ * kept in the buffer till the rest is received
+ *
+ * @return the length of the partial frame to wait for, 0 if none, or -1 if the
+ * session was closed
+ */
+static int lan_session_frame_process(lan_mgr_t *lan, lan_session_t *session)
+{
+    int ret = 0;
+    int fd = session->fd;
+    uint32_t offset = 0;
+    uint32_t pending_len = 0;
 
-    offset = 0;
-    frame_buffer = NULL;
-    tmp_recv_buf = NULL;
-    while (recv_datalen >= LPV35_FRAME_MINI_SIZE + offset) {
-        if (tmp_recv_buf) {
-            break;
-        }
-        if (memcmp(lan->recv_buf + offset, LPV35_FRAME_HEAD, LPV35_FRAME_HEAD_SIZE) != 0) {
+    while (session->recv_len - offset >= LPV35_FRAME_MINI_SIZE) {
+        uint8_t *frame_buffer = session->recv_buf + offset;
+        if (memcmp(frame_buffer, LPV35_FRAME_HEAD, LPV35_FRAME_HEAD_SIZE) != 0) {
             offset++;
             continue;
         }
-        frame_buffer = lan->recv_buf + offset;
         lpv35_fixed_head_t *fixed_head = (lpv35_fixed_head_t *)(frame_buffer + LPV35_FRAME_HEAD_SIZE);
+        // frame_len verify
+        uint32_t data_len = UNI_NTOHL(fixed_head->length);
+        uint32_t frame_len = LPV35_FRAME_HEAD_SIZE + sizeof(lpv35_fixed_head_t) + data_len + LPV35_FRAME_TAIL_SIZE;
+        if (data_len >= LAN_FRAME_MAX_LEN || frame_len >= LAN_FRAME_MAX_LEN) {
+            PR_ERR("lan data len is out of limit");
+            offset++;
+            continue;
+        }
+        if (frame_len > (session->recv_len - offset)) { // wait for the rest on the next read event
+            pending_len = frame_len;
+            break;
+        }
+
         // verify sequence
         uint32_t fr_sequence = UNI_NTOHL(fixed_head->sequence);
         if (fr_sequence <= session->sequence_in) {
@@ -897,36 +915,13 @@ recv_again:
             PR_ERR("threshold:%d", lan->cfg->sequence_err_threshold);
             if ((session->sequence_in - fr_sequence) >= lan->cfg->sequence_err_threshold) {
                 lan_session_close(session);
+                return -1;
             }
-            break;
+            offset += frame_len;
+            continue;
         }
         PR_TRACE("fr_num in:%u, pre:%u", fr_sequence, session->sequence_in);
         session->sequence_in = fr_sequence;
-        // frame_len verify
-        uint32_t frame_len =
-            LPV35_FRAME_HEAD_SIZE + sizeof(lpv35_fixed_head_t) + UNI_NTOHL(fixed_head->length) + LPV35_FRAME_TAIL_SIZE;
-        if (frame_len > (recv_datalen - offset)) { // recv data not enough buf
-            if (frame_len >= LAN_FRAME_MAX_LEN) {
-                PR_ERR("lan data len is out of limit");
-                break;
-            }
-            tmp_recv_buf = tal_malloc(frame_len + 1);
-            if (NULL == tmp_recv_buf) {
-                PR_ERR("malloc error");
-                break;
-            }
-            memset(tmp_recv_buf, 0, frame_len + 1);
-            memcpy(tmp_recv_buf, lan->recv_buf + offset, recv_datalen - offset);
-            recv_datalen = recv_datalen - offset;
-            offset = 0;
-            ret = tal_net_recv_nd_size(session->fd, tmp_recv_buf + recv_datalen, frame_len + 1 - recv_datalen,
-                                       frame_len - recv_datalen);
-            if (ret < 0) {
-                PR_ERR("tuya_hal_net_recv_nd_size error ret:%d", ret);
-                break;
-            }
-            frame_buffer = tmp_recv_buf;
-        }
 
         uint32_t fr_type = UNI_NTOHL(fixed_head->type);
         uint8_t *key = NULL;
@@ -938,7 +933,7 @@ recv_again:
                 if (session->secret_key[0]) {
                     PR_WARN("already have the session_key, reset session..");
                     lan_session_close(session);
-                    break;
+                    return -1;
                 }
                 key = (uint8_t *)lan->iot_client->activate.localkey;
             } else {
@@ -948,12 +943,13 @@ recv_again:
                     if (lan->cfg->allow_no_session_key_num > 0) {
                         PR_ERR("allow no seesion key %d", lan->cfg->allow_no_session_key_num);
                         lan->cfg->allow_no_session_key_num--;
-                    } else {
-                        PR_ERR("ERROR, no session_key");
-                        lan_session_close(session);
-                        lan->cfg->allow_no_session_key_num = ALLOW_NO_KEY_NUM;
+                        offset += frame_len;
+                        continue;
                     }
-                    break;
+                    PR_ERR("ERROR, no session_key");
+                    lan_session_close(session);
+                    lan->cfg->allow_no_session_key_num = ALLOW_NO_KEY_NUM;
+                    return -1;
                 }
                 // PR_DEBUG("use session_key");
                 key = (uint8_t *)session->secret_key;
@@ -961,14 +957,14 @@ recv_again:
         } else {
             //! TODO:
             lan_session_close(session);
-            break;
+            return -1;
         }
 
+        offset += frame_len;
         // Heartbeat packet has no data content and responds directly
         if (FRM_TP_HB == fr_type) {
             ret = lan_send(session, 0, FRM_TP_HB, 0, NULL, 0, false);
             PR_TRACE("lan heart beat:%d", ret);
-            offset += frame_len;
             lan_session_time_update(session, tal_time_get_posix());
             continue;
         }
@@ -977,24 +973,84 @@ recv_again:
         ret = lpv35_frame_parse(key, SESSIONKEY_LEN, frame_buffer, frame_len, &frame_out);
         if (ret != OPRT_OK) {
             PR_ERR("lpv35_frame_parse fail:%d", ret);
-            break;
+            continue;
         }
-        offset += frame_len;
         // update time
         lan_session_time_update(session, tal_time_get_posix());
         lan_protocol_process(lan, session, &frame_out);
         if (frame_out.data) {
             tal_free(frame_out.data);
         }
+        // the handler may close the session
+        if (!session->active || session->fd != fd) {
+            return -1;
+        }
+    }
+
+    if (offset) {
+        memmove(session->recv_buf, session->recv_buf + offset, session->recv_len - offset);
+        session->recv_len -= offset;
+        session->recv_time = tal_time_get_posix();
+    }
+
+    return pending_len;
+}
+
+static void lan_tcp_client_sock_read(int32_t fd)
+{
+    int recv_datalen = 0;
+
+    lan_mgr_t *lan = lan_mgr_get();
+    lan_session_t *session = lan_session_get_by_fd(fd);
+
+    if (NULL == lan || NULL == session || !session->active) {
+        return;
+    }
+
+    // one recv per read event, a slow client never blocks the loop
+    if (OPRT_OK != lan_session_recv_buf_reserve(session, lan->cfg->bufsize)) {
+        lan_session_fault_set(session);
+        return;
+    }
+    if (0 == session->recv_len) {
+        session->recv_time = tal_time_get_posix();
+    }
+    recv_datalen = tal_net_recv(fd, session->recv_buf + session->recv_len, session->recv_size - session->recv_len);
+    if (recv_datalen < 0) {
+        TUYA_ERRNO err_no = tal_net_get_errno();
+        if (UNW_EAGAIN == err_no || UNW_EWOULDBLOCK == err_no || UNW_EINTR == err_no) {
+            return;
+        }
+    }
+    if (recv_datalen <= 0) {
+        PR_ERR("net recv err fd:%d,errno:%d", fd, tal_net_get_errno());
+        lan_session_fault_set(session);
+        return;
+    }
+    session->recv_len += recv_datalen;
+
+    int pending_len = lan_session_frame_process(lan, session);
+    if (pending_len < 0) {
+        return;
+    }
+
+    // only the handshake is accepted before the session key, its frames are small
+    uint32_t pending_max = session->secret_key[0] ? LAN_FRAME_MAX_LEN : lan->cfg->bufsize;
+    if (pending_len > pending_max) {
+        PR_ERR("fd:%d, pending frame %d out of limit %d", fd, pending_len, pending_max);
+        lan_session_close(session);
+        return;
+    }
+    if (pending_len > 0 && OPRT_OK != lan_session_recv_buf_reserve(session, pending_len)) {
+        lan_session_fault_set(session);
+        return;
     }
 
-    if (tmp_recv_buf) {
-        tal_free(tmp_recv_buf);
-    } else if (recv_datalen != offset) {
-        PR_DEBUG("recv_datalen:%d, offset:%d", recv_datalen, offset);
-        memmove(lan->recv_buf, lan->recv_buf + offset, recv_datalen - offset);
-        lan->recv_offset = recv_datalen - offset;
-        goto recv_again;
+    // give back the room of a large frame once it is handled
+    if (0 == session->recv_len && session->recv_size > lan->cfg->bufsize) {
+        tal_free(session->recv_buf);
+        session->recv_buf = NULL;
+        session->recv_size = 0;
     }
 
     return;
@@ -51,6 +51,120 @@
 #define PV23_AD_DATA_LEN     (12)
 #define PV23_EXCEPT_DATA_LEN (PV23_AD_DATA_LEN + PV23_NONCE_LEN + PV23_TAG_LEN)
 
+// keyed AES-GCM contexts kept for the MQTT and LAN session keys
+#define PROTOCOL_AEAD_CTX_NUM (4)
+
+typedef struct {
+    tal_cipher_aead_ctx_t aead;
+    uint32_t used; // the least recently used is rekeyed
+} protocol_aead_ctx_t;
+
+static protocol_aead_ctx_t s_aead_ctx[PROTOCOL_AEAD_CTX_NUM];
+static uint32_t s_aead_tick;
+static MUTEX_HANDLE s_aead_mutex;
+static volatile uint8_t s_aead_state; // 0: not inited, 1: initing, 2: ready
+
+static bool __aead_cache_ready(void)
+{
+    uint8_t state = 0;
+    int i;
+
+    TAL_ENTER_CRITICAL();
+    state = s_aead_state;
+    if (0 == state) {
+        s_aead_state = 1;
+    }
+    TAL_EXIT_CRITICAL();
+
+    if (0 != state) {
+        // the frames go with a temporary context while it is being inited
+        return (2 == state);
+    }
+
+    if (OPRT_OK != tal_mutex_create_init(&s_aead_mutex)) {
+        s_aead_state = 0;
+        return false;
+    }
+    for (i = 0; i < PROTOCOL_AEAD_CTX_NUM; i++) {
+        tal_cipher_aead_init(&s_aead_ctx[i].aead);
+    }
+    s_aead_state = 2;
+
+    return true;
+}
+
+static tal_cipher_aead_ctx_t *__aead_cache_get(const uint8_t *key, size_t key_len)
+{
+    protocol_aead_ctx_t *ctx = &s_aead_ctx[0];
+    int i;
+
+    for (i = 0; i < PROTOCOL_AEAD_CTX_NUM; i++) {
+        if (s_aead_ctx[i].aead.key_len == key_len && 0 == memcmp(s_aead_ctx[i].aead.key, key, key_len)) {
+            ctx = &s_aead_ctx[i];
+            break;
+        }
+        if (s_aead_ctx[i].used < ctx->used) {
+            ctx = &s_aead_ctx[i];
+        }
+    }
+    ctx->used = ++s_aead_tick;
+
+    return &ctx->aead;
+}
+
+void tuya_protocol_key_evict(const uint8_t *key, int key_len)
+{
+    int i;
+
+    if (NULL == key || 2 != s_aead_state) {
+        return;
+    }
+
+    tal_mutex_lock(s_aead_mutex);
+    for (i = 0; i < PROTOCOL_AEAD_CTX_NUM; i++) {
+        if (s_aead_ctx[i].aead.key_len == (size_t)key_len && 0 == memcmp(s_aead_ctx[i].aead.key, key, key_len)) {
+            tal_cipher_aead_free(&s_aead_ctx[i].aead);
+            s_aead_ctx[i].used = 0;
+        }
+    }
+    tal_mutex_unlock(s_aead_mutex);
+}
+
+/* AES-GCM with the tag after the data, input and output can be the same buffer */
+static OPERATE_RET __aead_crypt(bool encrypt, const uint8_t *key, size_t key_len, const uint8_t *nonce,
+                                size_t nonce_len, const uint8_t *ad, size_t ad_len, const uint8_t *input, size_t ilen,
+                                uint8_t *output, size_t tag_len)
+{
+    OPERATE_RET op_ret = OPRT_OK;
+    tal_cipher_aead_ctx_t tmp_ctx;
+    tal_cipher_aead_ctx_t *ctx = &tmp_ctx;
+    bool cached = __aead_cache_ready();
+
+    if (cached) {
+        tal_mutex_lock(s_aead_mutex);
+        ctx = __aead_cache_get(key, key_len);
+    } else {
+        tal_cipher_aead_init(ctx);
+    }
+
+    op_ret = tal_cipher_aead_setkey(ctx, MBEDTLS_CIPHER_AES_128_GCM, key, key_len);
+    if (OPRT_OK == op_ret) {
+        if (encrypt) {
+            op_ret = tal_cipher_aead_encrypt(ctx, nonce, nonce_len, ad, ad_len, input, ilen, output, tag_len);
+        } else {
+            op_ret = tal_cipher_aead_decrypt(ctx, nonce, nonce_len, ad, ad_len, input, ilen, output, tag_len);
+        }
+    }
+
+    if (cached) {
+        tal_mutex_unlock(s_aead_mutex);
+    } else {
+        tal_cipher_aead_free(ctx);
+    }
+
+    return op_ret;
+}
+
 /**
  * @brief Generates a serial number for the Tuya protocol packet.
  *
@@ -97,30 +211,20 @@ static OPERATE_RET __parse_data_with_pv23(const DP_CMD_TYPE_E cmd, const uint8_t
 
     uint8_t *ad_data = (uint8_t *)(data + 0);
     uint32_t data_len = len - PV23_EXCEPT_DATA_LEN;
-    size_t ec_len = 0;
     uint8_t *ec_data = tal_malloc(data_len + 1);
     TUYA_CHECK_NULL_RETURN(ec_data, OPRT_MALLOC_FAILED);
 
-    // decrypt data
-    op_ret = mbedtls_cipher_auth_decrypt_wrapper(
-        &(const cipher_params_t){.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
-                                 .key = (unsigned char *)key,
-                                 .key_len = 16,
-                                 .nonce = (unsigned char *)(data + PV23_NONCE_OFFSET),
-                                 .nonce_len = PV23_NONCE_LEN,
-                                 .ad = ad_data,
-                                 .ad_len = PV23_AD_DATA_LEN,
-                                 .data = (unsigned char *)(data + PV23_DATA_OFFSET),
-                                 .data_len = data_len},
-        ec_data, &ec_len, (unsigned char *)(data + (len - PV23_TAG_LEN)), PV23_TAG_LEN);
+    // decrypt data, the tag is after the data
+    op_ret = __aead_crypt(false, key, 16, data + PV23_NONCE_OFFSET, PV23_NONCE_LEN, ad_data, PV23_AD_DATA_LEN,
+                          data + PV23_DATA_OFFSET, data_len, ec_data, PV23_TAG_LEN);
     if (op_ret != OPRT_OK) {
-        PR_ERR("mbedtls_cipher_auth_decrypt_wrapper:0x%x", -op_ret);
+        PR_ERR("tal_cipher_aead_decrypt:0x%x", -op_ret);
         *out_data = NULL;
         tal_free(ec_data);
         return op_ret;
     }
 
-    ec_data[ec_len] = 0;
+    ec_data[data_len] = 0;
 
     *out_data = (char *)ec_data;
 
@@ -226,13 +330,15 @@ static OPERATE_RET __pack_data_with_cmd_pv23(const DP_CMD_TYPE_E cmd, const char
     int offset = 0;
 
     PR_TRACE("To:%d src:%s pro:%d num:%d", cmd, src, pro, num);
-    // make json data
+    // make pack data, the json is made at the data offset and encrypted in place
     int len = strlen(src) + 60;
-    out = tal_malloc(len);
-    if (NULL == out) {
+    uint8_t *buf = tal_malloc(len + PV23_EXCEPT_DATA_LEN);
+    if (NULL == buf) {
         PR_ERR("tal_malloc Fails %d", len);
         return OPRT_MALLOC_FAILED;
     }
+    memset(buf, 0, PV23_DATA_OFFSET);
+    out = (char *)(buf + PV23_DATA_OFFSET);
 
     offset += sprintf(out + offset, "{\"protocol\":%d,\"t\":%d,\"data\":%s", pro, (uint32_t)tal_time_get_posix(), src);
     out[offset++] = '}';
@@ -240,14 +346,6 @@ static OPERATE_RET __pack_data_with_cmd_pv23(const DP_CMD_TYPE_E cmd, const char
 
     PR_TRACE("After Pack:%s offset:%d", out, offset);
 
-    // make pack data
-    uint8_t *buf = tal_malloc(offset + PV23_EXCEPT_DATA_LEN);
-    if (buf == NULL) {
-        tal_free(out);
-        return OPRT_MALLOC_FAILED;
-    }
-    memset(buf, 0, offset + PV23_EXCEPT_DATA_LEN);
-
     // make head data
     // version
     memcpy(buf + PV23_VERSION_OFFSET, pv, PV_LEN_22_32);
@@ -266,28 +364,17 @@ static OPERATE_RET __pack_data_with_cmd_pv23(const DP_CMD_TYPE_E cmd, const char
     // nonce
     uni_random_string((char *)(buf + PV23_NONCE_OFFSET), PV23_NONCE_LEN);
 
-    // AES GCM encrypt
-    size_t encrypt_olen = 0;
-    op_ret = mbedtls_cipher_auth_encrypt_wrapper(&(const cipher_params_t){.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
-                                                                          .key = (unsigned char *)key,
-                                                                          .key_len = 16,
-                                                                          .nonce = buf + PV23_NONCE_OFFSET,
-                                                                          .nonce_len = PV23_NONCE_LEN,
-                                                                          .ad = buf,
-                                                                          .ad_len = PV23_AD_DATA_LEN,
-                                                                          .data = (unsigned char *)out,
-                                                                          .data_len = strlen(out)},
-                                                 buf + PV23_DATA_OFFSET, &encrypt_olen, buf + PV23_DATA_OFFSET + offset,
-                                                 PV23_TAG_LEN);
-    tal_free(out);
+    // AES GCM encrypt, the tag is written after the data
+    op_ret = __aead_crypt(true, key, 16, buf + PV23_NONCE_OFFSET, PV23_NONCE_LEN, buf, PV23_AD_DATA_LEN,
+                          (uint8_t *)out, offset, (uint8_t *)out, PV23_TAG_LEN);
     if (op_ret != OPRT_OK) {
-        PR_ERR("mbedtls_cipher_auth_encrypt_wrapper:0x%x", -op_ret);
+        PR_ERR("tal_cipher_aead_encrypt:0x%x", -op_ret);
         tal_free(buf);
         return op_ret;
     }
 
     *pack_out = buf;
-    *out_len = PV23_EXCEPT_DATA_LEN + encrypt_olen;
+    *out_len = PV23_EXCEPT_DATA_LEN + offset;
 
     return OPRT_OK;
 }
@@ -468,29 +555,15 @@ OPERATE_RET lpv35_frame_serialize(const uint8_t *key, int key_len, const lpv35_f
     memcpy(output + offset, &(nonce[0]), LPV35_FRAME_NONCE_SIZE);
     offset += LPV35_FRAME_NONCE_SIZE;
 
-    // TAG buffer
-    uint8_t tag[LPV35_FRAME_TAG_SIZE] = {0};
-
-    // AES GCM encrypt
-    size_t encrypt_olen = 0;
-    op_ret = mbedtls_cipher_auth_encrypt_wrapper(&(const cipher_params_t){.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
-                                                                          .key = (unsigned char *)key,
-                                                                          .key_len = key_len,
-                                                                          .nonce = nonce,
-                                                                          .nonce_len = LPV35_FRAME_NONCE_SIZE,
-                                                                          .ad = (uint8_t *)(&ad),
-                                                                          .ad_len = sizeof(lpv35_additional_data_t),
-                                                                          .data = input->data,
-                                                                          .data_len = input->data_len},
-                                                 output + offset, &encrypt_olen, tag, LPV35_FRAME_TAG_SIZE);
+    // AES GCM encrypt, TAG is written after the data
+    op_ret = __aead_crypt(true, key, key_len, nonce, LPV35_FRAME_NONCE_SIZE, (uint8_t *)(&ad),
+                          sizeof(lpv35_additional_data_t), input->data, input->data_len, output + offset,
+                          LPV35_FRAME_TAG_SIZE);
     if (op_ret != OPRT_OK) {
-        PR_ERR("mbedtls_cipher_auth_encrypt_wrapper:0x%x", -op_ret);
+        PR_ERR("tal_cipher_aead_encrypt:0x%x", -op_ret);
         return op_ret;
     }
-    offset += encrypt_olen;
-
-    // TAG
-    memcpy(output + offset, tag, LPV35_FRAME_TAG_SIZE);
+    offset += input->data_len;
     offset += LPV35_FRAME_TAG_SIZE;
 
     // TAIL
@@ -586,10 +659,6 @@ OPERATE_RET lpv35_frame_parse(const uint8_t *key, int key_len, const uint8_t *in
     output->data_len = length - LPV35_FRAME_NONCE_SIZE - LPV35_FRAME_TAG_SIZE;
     offset += output->data_len;
 
-    // tag
-    uint8_t tag[LPV35_FRAME_TAG_SIZE];
-    memcpy(tag, input + offset, LPV35_FRAME_TAG_SIZE);
-
     // AD
     lpv35_additional_data_t ad;
     memcpy(&ad, input + LPV35_FRAME_HEAD_SIZE, sizeof(lpv35_additional_data_t));
@@ -597,26 +666,16 @@ OPERATE_RET lpv35_frame_parse(const uint8_t *key, int key_len, const uint8_t *in
     // decrypt data
     output->data = tal_malloc(output->data_len + 1);
     TUYA_CHECK_NULL_RETURN(output->data, OPRT_MALLOC_FAILED);
-    memset(output->data, 0, output->data_len + 1);
-    size_t decrypt_olen = 0;
-    op_ret = mbedtls_cipher_auth_decrypt_wrapper(&(const cipher_params_t){.cipher_type = MBEDTLS_CIPHER_AES_128_GCM,
-                                                                          .key = (unsigned char *)key,
-                                                                          .key_len = key_len,
-                                                                          .nonce = nonce,
-                                                                          .nonce_len = LPV35_FRAME_NONCE_SIZE,
-                                                                          .ad = (uint8_t *)(&ad),
-                                                                          .ad_len = sizeof(lpv35_additional_data_t),
-                                                                          .data = data,
-                                                                          .data_len = output->data_len},
-                                                 output->data, &decrypt_olen, tag, LPV35_FRAME_TAG_SIZE);
+    output->data[output->data_len] = 0;
+    // the tag is after the encryption data
+    op_ret = __aead_crypt(false, key, key_len, nonce, LPV35_FRAME_NONCE_SIZE, (uint8_t *)(&ad),
+                          sizeof(lpv35_additional_data_t), data, output->data_len, output->data, LPV35_FRAME_TAG_SIZE);
     if (op_ret != OPRT_OK) {
-        PR_ERR("mbedtls_cipher_auth_decrypt_wrapper:0x%x", -op_ret);
+        PR_ERR("tal_cipher_aead_decrypt:0x%x", -op_ret);
         tal_free(output->data);
         output->data = NULL;
         return op_ret;
     }
-    output->data_len = (uint32_t)decrypt_olen;
-    offset += output->data_len;
 
     return op_ret;
 }
@@ -168,6 +168,15 @@ OPERATE_RET lpv35_frame_parse(const uint8_t *key, int key_len, const uint8_t *in
  */
 int lpv35_frame_buffer_size_get(lpv35_frame_object_t *frame_obj);
 
+/**
+ * @brief drop the cipher context kept for a key no longer used, like the key
+ * of a closed lan session, its key schedule is zeroized
+ *
+ * @param[in] key the key
+ * @param[in] key_len key len
+ */
+void tuya_protocol_key_evict(const uint8_t *key, int key_len);
+
 #ifdef __cplusplus
 }
 #endif
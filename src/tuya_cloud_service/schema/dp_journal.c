@@ -0,0 +1,611 @@
+/**
+ * @file dp_journal.c
+ * @brief Implementation of the offline DP report journal.
+ *
+ * The entries are kept in an array indexed by dpid, a report of a dpid already
+ * kept replaces its value in place, so the journal never holds more than
+ * DP_JOURNAL_MAX_NUM entries however long the outage is. When it is full the
+ * entry updated the longest time ago is dropped.
+ *
+ * The entries of one replay message share the same "t", the entry is removed
+ * when the message is acked, and sent again later if not.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "tal_api.h"
+#include "tal_kv.h"
+#include "cJSON.h"
+#include "mqtt_service.h"
+#include "dp_journal.h"
+
+#if defined(ENABLE_DP_JOURNAL) && (ENABLE_DP_JOURNAL == 1)
+
+#ifndef DP_JOURNAL_MAX_NUM
+#define DP_JOURNAL_MAX_NUM 32
+#endif
+
+#ifndef DP_JOURNAL_REPLAY_INTERVAL
+#define DP_JOURNAL_REPLAY_INTERVAL 100
+#endif
+
+// longer values are not kept
+#ifndef DP_JOURNAL_VALUE_MAX_LEN
+#define DP_JOURNAL_VALUE_MAX_LEN 512
+#endif
+
+// dps of one replay message, at least one entry is sent
+#define DP_JOURNAL_BATCH_LEN    1024
+#define DP_JOURNAL_SAVE_DELAY   2000
+#define DP_JOURNAL_RETRY_DELAY  5000
+#define DP_JOURNAL_ACK_TIMEOUT  5000
+#define DP_JOURNAL_KV_KEY       "dp_journal"
+#define DP_JOURNAL_KV_VERSION   1
+#define DP_JOURNAL_RECORD_HEAD  11 // dpid 1, seq 4, t 4, len 2
+
+typedef struct {
+    char *value;    // json text of the last value
+    uint32_t seq;   // order of the updates
+    TIME_T t;       // posix time of the report, 0 if unknown
+    uint16_t len;
+    uint16_t size;  // size of the value buffer
+    uint16_t batch; // replay message waiting for the ack, 0 if not sent
+    uint8_t dpid;
+} dp_journal_entry_t;
+
+typedef struct {
+    MUTEX_HANDLE mutex;
+    DELAYED_WORK_HANDLE replay_work;
+    DELAYED_WORK_HANDLE save_work;
+    tuya_iot_client_t *client;
+    uint32_t seq;
+    uint16_t batch;
+    uint16_t num;
+    bool save_pending;
+    uint8_t index[256]; // dpid -> entry + 1, 0 if not kept
+    dp_journal_entry_t entry[DP_JOURNAL_MAX_NUM];
+} dp_journal_t;
+
+static dp_journal_t *s_journal = NULL;
+
+static void dp_journal_entry_remove(dp_journal_t *journal, dp_journal_entry_t *entry)
+{
+    dp_journal_entry_t *last = &journal->entry[journal->num - 1];
+
+    journal->index[entry->dpid] = 0;
+    if (entry->value) {
+        tal_free(entry->value);
+    }
+    if (entry != last) {
+        *entry = *last;
+        journal->index[entry->dpid] = (uint8_t)(entry - journal->entry + 1);
+    }
+    memset(last, 0, sizeof(dp_journal_entry_t));
+    journal->num--;
+}
+
+static dp_journal_entry_t *dp_journal_entry_set(dp_journal_t *journal, uint8_t dpid, const char *value, uint16_t len,
+                                                TIME_T t)
+{
+    dp_journal_entry_t *entry = NULL;
+    uint16_t i;
+
+    if (journal->index[dpid]) {
+        entry = &journal->entry[journal->index[dpid] - 1];
+    } else {
+        if (journal->num >= DP_JOURNAL_MAX_NUM) {
+            dp_journal_entry_t *oldest = &journal->entry[0];
+            for (i = 1; i < journal->num; i++) {
+                if ((int32_t)(journal->entry[i].seq - oldest->seq) < 0) {
+                    oldest = &journal->entry[i];
+                }
+            }
+            PR_WARN("dp journal full, dp %d dropped", oldest->dpid);
+            dp_journal_entry_remove(journal, oldest);
+        }
+        entry = &journal->entry[journal->num++];
+        entry->dpid = dpid;
+        journal->index[dpid] = (uint8_t)journal->num;
+    }
+
+    if (entry->size < len + 1) {
+        char *buf = tal_malloc(len + 1);
+        if (NULL == buf) {
+            if (NULL == entry->value) {
+                dp_journal_entry_remove(journal, entry);
+            }
+            return NULL;
+        }
+        if (entry->value) {
+            tal_free(entry->value);
+        }
+        entry->value = buf;
+        entry->size = len + 1;
+    }
+    memcpy(entry->value, value, len);
+    entry->value[len] = '\0';
+    entry->len = len;
+    entry->t = t;
+    entry->seq = ++journal->seq;
+    entry->batch = 0;
+
+    return entry;
+}
+
+static void dp_journal_changed(dp_journal_t *journal)
+{
+    if (!journal->save_pending) {
+        journal->save_pending = true;
+        tal_workq_start_delayed(journal->save_work, DP_JOURNAL_SAVE_DELAY, LOOP_ONCE);
+    }
+}
+
+static void dp_journal_save_process(void *data)
+{
+    dp_journal_t *journal = (dp_journal_t *)data;
+    uint8_t *buf = NULL;
+    uint32_t size = 1;
+    uint32_t offset = 1;
+    uint16_t i;
+
+    tal_mutex_lock(journal->mutex);
+    journal->save_pending = false;
+    if (0 == journal->num) {
+        tal_mutex_unlock(journal->mutex);
+        tal_kv_del(DP_JOURNAL_KV_KEY);
+        return;
+    }
+
+    for (i = 0; i < journal->num; i++) {
+        size += DP_JOURNAL_RECORD_HEAD + journal->entry[i].len;
+    }
+    buf = tal_malloc(size);
+    if (NULL == buf) {
+        // try again later
+        dp_journal_changed(journal);
+        tal_mutex_unlock(journal->mutex);
+        return;
+    }
+
+    buf[0] = DP_JOURNAL_KV_VERSION;
+    for (i = 0; i < journal->num; i++) {
+        dp_journal_entry_t *entry = &journal->entry[i];
+        uint32_t t = (uint32_t)entry->t;
+
+        buf[offset++] = entry->dpid;
+        buf[offset++] = (uint8_t)(entry->seq >> 24);
+        buf[offset++] = (uint8_t)(entry->seq >> 16);
+        buf[offset++] = (uint8_t)(entry->seq >> 8);
+        buf[offset++] = (uint8_t)(entry->seq);
+        buf[offset++] = (uint8_t)(t >> 24);
+        buf[offset++] = (uint8_t)(t >> 16);
+        buf[offset++] = (uint8_t)(t >> 8);
+        buf[offset++] = (uint8_t)(t);
+        buf[offset++] = (uint8_t)(entry->len >> 8);
+        buf[offset++] = (uint8_t)(entry->len);
+        memcpy(buf + offset, entry->value, entry->len);
+        offset += entry->len;
+    }
+    tal_mutex_unlock(journal->mutex);
+
+    if (OPRT_OK != tal_kv_set(DP_JOURNAL_KV_KEY, buf, size)) {
+        PR_ERR("dp journal save failed");
+    }
+    tal_free(buf);
+}
+
+static void dp_journal_load(dp_journal_t *journal)
+{
+    uint8_t *buf = NULL;
+    size_t length = 0;
+    size_t offset = 1;
+    uint16_t i;
+
+    if (OPRT_OK != tal_kv_get(DP_JOURNAL_KV_KEY, &buf, &length)) {
+        return;
+    }
+
+    if (length < 1 || DP_JOURNAL_KV_VERSION != buf[0]) {
+        PR_WARN("dp journal version unknown");
+        tal_kv_free(buf);
+        return;
+    }
+
+    while (offset + DP_JOURNAL_RECORD_HEAD <= length) {
+        const uint8_t *p = buf + offset;
+        uint32_t seq = ((uint32_t)p[1] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 8) | p[4];
+        uint32_t t = ((uint32_t)p[5] << 24) | ((uint32_t)p[6] << 16) | ((uint32_t)p[7] << 8) | p[8];
+        uint16_t len = ((uint16_t)p[9] << 8) | p[10];
+        dp_journal_entry_t *entry = NULL;
+
+        if (offset + DP_JOURNAL_RECORD_HEAD + len > length) {
+            break;
+        }
+        if (p[0]) {
+            entry = dp_journal_entry_set(journal, p[0], (const char *)p + DP_JOURNAL_RECORD_HEAD, len, (TIME_T)t);
+        }
+        if (entry) {
+            entry->seq = seq;
+        }
+        offset += DP_JOURNAL_RECORD_HEAD + len;
+    }
+    tal_kv_free(buf);
+
+    // go on with the update order saved
+    for (i = 0; i < journal->num; i++) {
+        if (0 == i || (int32_t)(journal->entry[i].seq - journal->seq) > 0) {
+            journal->seq = journal->entry[i].seq;
+        }
+    }
+
+    PR_DEBUG("dp journal loaded %d", journal->num);
+}
+
+static void dp_journal_replay_cb(int result, void *user_data)
+{
+    dp_journal_t *journal = s_journal;
+    uint16_t batch = (uint16_t)(uintptr_t)user_data;
+    uint16_t i = 0;
+    bool removed = false;
+
+    tal_mutex_lock(journal->mutex);
+    while (i < journal->num) {
+        dp_journal_entry_t *entry = &journal->entry[i];
+        if (entry->batch != batch) {
+            i++;
+            continue;
+        }
+        if (OPRT_OK == result) {
+            // the last entry is moved here
+            dp_journal_entry_remove(journal, entry);
+            removed = true;
+        } else {
+            entry->batch = 0;
+            i++;
+        }
+    }
+    if (removed) {
+        dp_journal_changed(journal);
+    }
+    tal_mutex_unlock(journal->mutex);
+
+    if (OPRT_OK != result) {
+        PR_WARN("dp journal replay failed %d", result);
+        tal_workq_start_delayed(journal->replay_work, DP_JOURNAL_RETRY_DELAY, LOOP_ONCE);
+    }
+}
+
+static void dp_journal_replay_process(void *data)
+{
+    dp_journal_t *journal = (dp_journal_t *)data;
+    tuya_iot_client_t *client = NULL;
+    dp_journal_entry_t *first = NULL;
+    char *buf = NULL;
+    uint32_t size = 0;
+    int offset = 0;
+    uint16_t batch = 0;
+    uint16_t cnt = 0;
+    TIME_T t = 0;
+    uint16_t i;
+    int ret;
+
+    if (!tuya_iot_is_connected()) {
+        // replayed again when connected
+        return;
+    }
+
+    tal_mutex_lock(journal->mutex);
+    client = journal->client;
+
+    // the oldest reports first
+    for (i = 0; i < journal->num; i++) {
+        dp_journal_entry_t *entry = &journal->entry[i];
+        if (0 == entry->batch && (NULL == first || entry->t < first->t)) {
+            first = entry;
+        }
+    }
+    if (NULL == first) {
+        tal_mutex_unlock(journal->mutex);
+        return;
+    }
+
+    // the entries of the same time go in one message
+    t = first->t;
+    size = 64 + strlen(client->activate.devid);
+    for (i = 0; i < journal->num; i++) {
+        dp_journal_entry_t *entry = &journal->entry[i];
+        if (0 == entry->batch && entry->t == t) {
+            size += entry->len + 8;
+        }
+    }
+    buf = tal_malloc(size);
+    if (NULL == buf) {
+        tal_mutex_unlock(journal->mutex);
+        tal_workq_start_delayed(journal->replay_work, DP_JOURNAL_RETRY_DELAY, LOOP_ONCE);
+        return;
+    }
+
+    if (0 == ++journal->batch) {
+        journal->batch = 1;
+    }
+    batch = journal->batch;
+
+    offset = sprintf(buf, "{\"devId\":\"%s\",\"dps\":{", client->activate.devid);
+    for (i = 0; i < journal->num; i++) {
+        dp_journal_entry_t *entry = &journal->entry[i];
+        if (0 != entry->batch || entry->t != t) {
+            continue;
+        }
+        if (entry != first && offset + entry->len > DP_JOURNAL_BATCH_LEN) {
+            continue;
+        }
+        offset += sprintf(buf + offset, "%s\"%d\":%s", cnt++ ? "," : "", entry->dpid, entry->value);
+        entry->batch = batch;
+    }
+    tal_mutex_unlock(journal->mutex);
+
+    if (t) {
+        offset += sprintf(buf + offset, "},\"t\":%u}", (uint32_t)t);
+    } else {
+        offset += sprintf(buf + offset, "}}");
+    }
+
+    ret = tuya_mqtt_protocol_data_publish_common(&client->mqctx, PRO_DATA_PUSH, (const uint8_t *)buf, (uint16_t)offset,
+                                                 dp_journal_replay_cb, (void *)(uintptr_t)batch,
+                                                 DP_JOURNAL_ACK_TIMEOUT, true);
+    tal_free(buf);
+    if (OPRT_OK != ret) {
+        // dp_journal_replay_cb is not called
+        dp_journal_replay_cb(ret, (void *)(uintptr_t)batch);
+        return;
+    }
+
+    tal_workq_start_delayed(journal->replay_work, DP_JOURNAL_REPLAY_INTERVAL, LOOP_ONCE);
+}
+
+/**
+ * @brief create the journal and load the entries saved in kv
+ *
+ * @return OPRT_OK on success, others on failed
+ */
+int dp_journal_init(void)
+{
+    dp_journal_t *journal = NULL;
+    int ret = OPRT_OK;
+
+    if (s_journal) {
+        return OPRT_OK;
+    }
+
+    journal = tal_malloc(sizeof(dp_journal_t));
+    if (NULL == journal) {
+        return OPRT_MALLOC_FAILED;
+    }
+    memset(journal, 0, sizeof(dp_journal_t));
+
+    ret = tal_mutex_create_init(&journal->mutex);
+    if (OPRT_OK != ret) {
+        tal_free(journal);
+        return ret;
+    }
+
+    ret = tal_workq_init_delayed(WORKQ_SYSTEM, dp_journal_replay_process, journal, &journal->replay_work);
+    if (OPRT_OK == ret) {
+        ret = tal_workq_init_delayed(WORKQ_SYSTEM, dp_journal_save_process, journal, &journal->save_work);
+    }
+    if (OPRT_OK != ret) {
+        if (journal->replay_work) {
+            tal_workq_cancel_delayed(journal->replay_work);
+        }
+        tal_mutex_release(journal->mutex);
+        tal_free(journal);
+        return ret;
+    }
+
+    dp_journal_load(journal);
+    s_journal = journal;
+
+    return OPRT_OK;
+}
+
+/**
+ * @brief keep the dps in the journal, the value of a dpid already kept is replaced
+ *
+ * @param[in] dps: dps json object, {"dpid":value,...}
+ * @param[in] time: time of the report, posix seconds or {"dpid":seconds,...}, NULL for now
+ *
+ * @return OPRT_OK on success, others on failed
+ */
+int dp_journal_add(const char *dps, const char *time)
+{
+    dp_journal_t *journal = s_journal;
+    cJSON *root = NULL;
+    cJSON *time_js = NULL;
+    cJSON *item = NULL;
+    TIME_T now = 0;
+    int ret = OPRT_OK;
+
+    if (NULL == journal) {
+        return OPRT_RESOURCE_NOT_READY;
+    }
+    if (NULL == dps) {
+        return OPRT_INVALID_PARM;
+    }
+
+    root = cJSON_Parse(dps);
+    if (NULL == root) {
+        return OPRT_CJSON_PARSE_ERR;
+    }
+
+    // replayed without "t" if the time is never synced
+    if (OPRT_OK == tal_time_check_time_sync()) {
+        now = tal_time_get_posix();
+    }
+    if (time && '{' == time[0]) {
+        time_js = cJSON_Parse(time);
+    } else if (time) {
+        now = (TIME_T)strtoul(time, NULL, 10);
+    }
+
+    tal_mutex_lock(journal->mutex);
+    for (item = root->child; item != NULL; item = item->next) {
+        int dpid = item->string ? atoi(item->string) : 0;
+        cJSON *dp_time = NULL;
+        char *value = NULL;
+        uint16_t len = 0;
+        TIME_T t = now;
+
+        if (dpid <= 0 || dpid > 255) {
+            continue;
+        }
+        dp_time = time_js ? cJSON_GetObjectItem(time_js, item->string) : NULL;
+        if (dp_time && cJSON_IsNumber(dp_time)) {
+            t = (TIME_T)dp_time->valuedouble;
+        }
+        value = cJSON_PrintUnformatted(item);
+        if (NULL == value) {
+            ret = OPRT_MALLOC_FAILED;
+            break;
+        }
+        len = (uint16_t)strlen(value);
+        if (len > DP_JOURNAL_VALUE_MAX_LEN) {
+            PR_WARN("dp %d too long to keep %d", dpid, len);
+            ret = OPRT_EXCEED_UPPER_LIMIT;
+        } else if (NULL == dp_journal_entry_set(journal, (uint8_t)dpid, value, len, t)) {
+            ret = OPRT_MALLOC_FAILED;
+        }
+        tal_free(value);
+    }
+    dp_journal_changed(journal);
+    tal_mutex_unlock(journal->mutex);
+
+    cJSON_Delete(root);
+    if (time_js) {
+        cJSON_Delete(time_js);
+    }
+
+    return ret;
+}
+
+/**
+ * @brief drop the entries of the dps reported by another way, the newer value is not overwritten by the replay
+ *
+ * @param[in] dps: dps json object, {"dpid":value,...}
+ *
+ * @return none
+ */
+void dp_journal_drop(const char *dps)
+{
+    dp_journal_t *journal = s_journal;
+    cJSON *root = NULL;
+    cJSON *item = NULL;
+
+    // not parsed when nothing is kept
+    if (NULL == journal || NULL == dps || 0 == journal->num) {
+        return;
+    }
+
+    root = cJSON_Parse(dps);
+    if (NULL == root) {
+        return;
+    }
+    for (item = root->child; item != NULL; item = item->next) {
+        int dpid = item->string ? atoi(item->string) : 0;
+        if (dpid > 0 && dpid <= 255) {
+            dp_journal_drop_id((uint8_t)dpid);
+        }
+    }
+    cJSON_Delete(root);
+}
+
+/**
+ * @brief drop the entry of the dpid
+ *
+ * @param[in] dpid: dp id
+ *
+ * @return none
+ */
+void dp_journal_drop_id(uint8_t dpid)
+{
+    dp_journal_t *journal = s_journal;
+
+    if (NULL == journal || 0 == journal->num) {
+        return;
+    }
+
+    tal_mutex_lock(journal->mutex);
+    if (journal->index[dpid]) {
+        dp_journal_entry_remove(journal, &journal->entry[journal->index[dpid] - 1]);
+        dp_journal_changed(journal);
+    }
+    tal_mutex_unlock(journal->mutex);
+}
+
+/**
+ * @brief start reporting the journal to the cloud, called when MQTT is connected
+ *
+ * @param[in] client: tuya iot client
+ *
+ * @return OPRT_OK on success, others on failed
+ */
+int dp_journal_replay_start(tuya_iot_client_t *client)
+{
+    dp_journal_t *journal = s_journal;
+    uint16_t i;
+
+    if (NULL == journal) {
+        return OPRT_RESOURCE_NOT_READY;
+    }
+
+    tal_mutex_lock(journal->mutex);
+    journal->client = client;
+    // the messages sent before the disconnection are not acked any more
+    for (i = 0; i < journal->num; i++) {
+        journal->entry[i].batch = 0;
+    }
+    tal_mutex_unlock(journal->mutex);
+
+    if (0 == journal->num) {
+        return OPRT_OK;
+    }
+
+    PR_INFO("dp journal replay %d", journal->num);
+    return tal_workq_start_delayed(journal->replay_work, DP_JOURNAL_REPLAY_INTERVAL, LOOP_ONCE);
+}
+
+/**
+ * @brief drop all entries and the saved journal
+ *
+ * @return none
+ */
+void dp_journal_clear(void)
+{
+    dp_journal_t *journal = s_journal;
+
+    if (NULL == journal) {
+        return;
+    }
+
+    tal_mutex_lock(journal->mutex);
+    while (journal->num) {
+        dp_journal_entry_remove(journal, &journal->entry[journal->num - 1]);
+    }
+    tal_mutex_unlock(journal->mutex);
+
+    tal_kv_del(DP_JOURNAL_KV_KEY);
+}
+
+/**
+ * @brief get the number of entries in the journal
+ *
+ * @return the number of entries
+ */
+uint16_t dp_journal_count(void)
+{
+    return s_journal ? s_journal->num : 0;
+}
+
+#endif
@@ -0,0 +1,86 @@
+/**
+ * @file dp_journal.h
+ * @brief Journal of the DP reports made while the cloud is not reachable.
+ *
+ * A report that finds no channel is kept in the journal instead of being
+ * dropped, one entry per dpid holding the last value and the time it was
+ * reported. The journal is saved to kv a moment after it changes so it
+ * survives a reboot, and is reported to the cloud after MQTT is connected,
+ * one message per interval, every message carries the "t" of its entries.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#ifndef __DP_JOURNAL_H__
+#define __DP_JOURNAL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "tuya_iot.h"
+
+/**
+ * @brief create the journal and load the entries saved in kv
+ *
+ * @return OPRT_OK on success, others on failed
+ */
+int dp_journal_init(void);
+
+/**
+ * @brief keep the dps in the journal, the value of a dpid already kept is replaced
+ *
+ * @param[in] dps: dps json object, {"dpid":value,...}
+ * @param[in] time: time of the report, posix seconds or {"dpid":seconds,...}, NULL for now
+ *
+ * @return OPRT_OK on success, others on failed
+ */
+int dp_journal_add(const char *dps, const char *time);
+
+/**
+ * @brief drop the entries of the dps reported by another way, the newer value is not overwritten by the replay
+ *
+ * @param[in] dps: dps json object, {"dpid":value,...}
+ *
+ * @return none
+ */
+void dp_journal_drop(const char *dps);
+
+/**
+ * @brief drop the entry of the dpid
+ *
+ * @param[in] dpid: dp id
+ *
+ * @return none
+ */
+void dp_journal_drop_id(uint8_t dpid);
+
+/**
+ * @brief start reporting the journal to the cloud, called when MQTT is connected
+ *
+ * @param[in] client: tuya iot client
+ *
+ * @return OPRT_OK on success, others on failed
+ */
+int dp_journal_replay_start(tuya_iot_client_t *client);
+
+/**
+ * @brief drop all entries and the saved journal
+ *
+ * @return none
+ */
+void dp_journal_clear(void);
+
+/**
+ * @brief get the number of entries in the journal
+ *
+ * @return the number of entries
+ */
+uint16_t dp_journal_count(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __DP_JOURNAL_H__ */
@@ -30,10 +30,144 @@ typedef struct {
     MUTEX_HANDLE mutex;
     uint8_t schema_num;
     dp_schema_t *schema_list[DP_SCHEMA_NUM_MAX];
+    dp_schema_t *last_found; // last schema found by devid
 } dp_schema_mgr_t;
 
 static dp_schema_mgr_t s_dsmgr = {0};
 
+/* streaming json writer, count the length only when buf is NULL or full */
+typedef struct {
+    char *buf;
+    uint32_t size;
+    uint32_t len;
+} dp_json_writer_t;
+
+static void dp_jw_putc(dp_json_writer_t *jw, char c)
+{
+    if (jw->buf && jw->len < jw->size) {
+        jw->buf[jw->len] = c;
+    }
+    jw->len++;
+}
+
+static void dp_jw_puts(dp_json_writer_t *jw, const char *str)
+{
+    while (*str) {
+        dp_jw_putc(jw, *str++);
+    }
+}
+
+static void dp_jw_put_uint(dp_json_writer_t *jw, uint32_t value)
+{
+    char tmp[10];
+    int i = 0;
+
+    do {
+        tmp[i++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    while (i) {
+        dp_jw_putc(jw, tmp[--i]);
+    }
+}
+
+static void dp_jw_put_int(dp_json_writer_t *jw, int value)
+{
+    if (value < 0) {
+        dp_jw_putc(jw, '-');
+        dp_jw_put_uint(jw, 0U - (uint32_t)value);
+    } else {
+        dp_jw_put_uint(jw, (uint32_t)value);
+    }
+}
+
+/* quoted and escaped the same way as cJSON_PrintUnformatted */
+static void dp_jw_put_str(dp_json_writer_t *jw, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+    uint8_t c = 0;
+
+    dp_jw_putc(jw, '"');
+    while ((c = (uint8_t)*str++)) {
+        switch (c) {
+        case '"':
+        case '\\':
+            dp_jw_putc(jw, '\\');
+            dp_jw_putc(jw, c);
+            break;
+        case '\b':
+            dp_jw_puts(jw, "\\b");
+            break;
+        case '\f':
+            dp_jw_puts(jw, "\\f");
+            break;
+        case '\n':
+            dp_jw_puts(jw, "\\n");
+            break;
+        case '\r':
+            dp_jw_puts(jw, "\\r");
+            break;
+        case '\t':
+            dp_jw_puts(jw, "\\t");
+            break;
+        default:
+            if (c < 32) {
+                dp_jw_puts(jw, "\\u00");
+                dp_jw_putc(jw, hex[c >> 4]);
+                dp_jw_putc(jw, hex[c & 0x0F]);
+            } else {
+                dp_jw_putc(jw, c);
+            }
+            break;
+        }
+    }
+    dp_jw_putc(jw, '"');
+}
+
+/* "id": */
+static void dp_jw_put_key(dp_json_writer_t *jw, uint8_t id)
+{
+    dp_jw_putc(jw, '"');
+    dp_jw_put_uint(jw, id);
+    dp_jw_putc(jw, '"');
+    dp_jw_putc(jw, ':');
+}
+
+static void dp_jw_put_head(dp_json_writer_t *jw, uint8_t head, const char *devid)
+{
+    if (DP_JSON_HEAD_CLOUD == head) {
+        dp_jw_puts(jw, "{\"devId\":\"");
+        dp_jw_puts(jw, devid);
+        dp_jw_puts(jw, "\",\"dps\":");
+    } else if (DP_JSON_HEAD_LAN == head) {
+        dp_jw_puts(jw, "{\"dps\":");
+    }
+}
+
+static void dp_jw_put_tail(dp_json_writer_t *jw, uint8_t head, const char *devid)
+{
+    if (DP_JSON_HEAD_CLOUD == head) {
+        dp_jw_putc(jw, '}');
+    } else if (DP_JSON_HEAD_LAN == head) {
+        dp_jw_puts(jw, ",\"devId\":\"");
+        dp_jw_puts(jw, devid);
+        dp_jw_puts(jw, "\"}");
+    }
+}
+
+/* terminate the string, return the length, or the size needed if buf is too small */
+static uint32_t dp_jw_finish(dp_json_writer_t *jw)
+{
+    if (jw->buf && jw->len < jw->size) {
+        jw->buf[jw->len] = '\0';
+    } else if (jw->buf && jw->size) {
+        jw->buf[jw->size - 1] = '\0';
+    }
+
+    return jw->len;
+}
+
 /**
  * @brief Appends a JSON string to the given data with the specified time, type,
  * and repetition sequence.
@@ -117,16 +251,18 @@ __err_exit:
  */
 dp_node_t *dp_node_find(dp_schema_t *schema, int id)
 {
-    int i;
-    dp_node_t *dpnode = NULL;
+    uint8_t pos = 0;
 
-    for (i = 0; i < schema->num; i++) {
-        if (schema->node[i].desc.id == id) {
-            dpnode = &schema->node[i];
-            break;
-        }
+    if (id < 0 || id >= DP_NODE_INDEX_NUM) {
+        return NULL;
     }
-    return dpnode;
+
+    pos = schema->node_index[id];
+    if (0 == pos) {
+        return NULL;
+    }
+
+    return &schema->node[pos - 1];
 }
 
 /**
@@ -141,11 +277,19 @@ dp_schema_t *dp_schema_find(const char *devid)
 
     PR_TRACE("try to find schema devid %s", devid);
     dp_schema_mgr_t *dsmgr = &s_dsmgr;
+    dp_schema_t *last = dsmgr->last_found;
+
+    // callers mostly pass schema->devid back, or ask the same device again
+    if (last && (devid == last->devid || 0 == strcmp(devid, last->devid))) {
+        return last;
+    }
+
     for (i = 0; i < DP_SCHEMA_NUM_MAX; i++) {
         if (NULL == dsmgr->schema_list[i]) {
             continue;
         }
         if (0 == strcmp(devid, dsmgr->schema_list[i]->devid)) {
+            dsmgr->last_found = dsmgr->schema_list[i];
             return dsmgr->schema_list[i];
         }
 
@@ -167,20 +311,12 @@ dp_schema_t *dp_schema_find(const char *devid)
  */
 dp_node_t *dp_node_find_by_devid(char *devid, int id)
 {
-    int i;
-    dp_node_t *dpnode = NULL;
-
     dp_schema_t *schema = dp_schema_find(devid);
     if (NULL == schema) {
         return NULL;
     }
-    for (i = 0; i < schema->num; i++) {
-        if (schema->node[i].desc.id == id) {
-            dpnode = &schema->node[i];
-            break;
-        }
-    }
-    return dpnode;
+
+    return dp_node_find(schema, id);
 }
 
 static OPERATE_RET dp_obj_equal_resp(dp_schema_t *schema, uint8_t *dpid, uint8_t num, dp_cmd_type_t cmd_tp)
@@ -818,141 +954,188 @@ int dp_rept_valid_check(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t
     return OPRT_OK;
 }
 
-/**
- * @brief Outputs the JSON representation of a device property (DP) schema.
- *
- * This function takes a DP schema, input data, validation information, and
- * output data as parameters. It generates the JSON representation of the DP
- * schema based on the provided input data and validation information, and
- * stores the result in the output data structure.
- *
- * @param schema Pointer to the DP schema structure.
- * @param dpin Pointer to the input data structure.
- * @param dpvalid Pointer to the validation information structure.
- * @param dpout Pointer to the output data structure.
- * @return Integer value indicating the success or failure of the operation.
- */
-int dp_rept_json_output(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t *dpvalid, dp_rept_out_t *dpout)
+/* the dp object of the valid dpid, the first one if dpid is duplicated */
+static dp_obj_t *dp_rept_obj_get(dp_rept_in_t *dpin, uint8_t id)
 {
-    uint16_t i, j;
-    uint16_t offset = 0;
-    uint16_t time_offset = 0;
-    OPERATE_RET op_ret = OPRT_OK;
-    char *dpstr = NULL;
-    char *dptimestr = NULL;
-    bool is_need_time = false;
+    uint16_t i;
 
-    dpstr = (char *)tal_malloc(dpvalid->len);
-    if (NULL == dpstr) {
-        PR_ERR("malloc err:%d", dpvalid->len);
-        return OPRT_MALLOC_FAILED;
-    }
-    // STAT type DP needs to assemble a timestamp
-    if ((T_STAT_REPT == dpin->rept_type) && dpvalid->timelen && dpout->timejson) {
-        dptimestr = (char *)tal_malloc(dpvalid->timelen);
-        if (NULL == dptimestr) {
-            PR_ERR("malloc err:%d", dpvalid->timelen);
-            op_ret = OPRT_MALLOC_FAILED;
-            goto __err_exit;
+    for (i = 0; i < dpin->dpscnt; i++) {
+        if (id == dpin->dps[i].id) {
+            return &dpin->dps[i];
         }
-        is_need_time = true;
     }
-    dpstr[offset++] = '{';
-    if (is_need_time) {
-        dptimestr[time_offset++] = '{';
+
+    return NULL;
+}
+
+/* write {"id":value,...} of the valid dps, and {"id":time,...} into tw if it is not NULL */
+static int dp_rept_json_write(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t *dpvalid,
+                              dp_json_writer_t *jw, dp_json_writer_t *tw)
+{
+    uint16_t i;
+    bool time_first = true;
+
+    dp_jw_putc(jw, '{');
+    if (tw) {
+        dp_jw_putc(tw, '{');
     }
 
     for (i = 0; i < dpvalid->num; i++) {
-        dp_obj_t *dp = NULL;
-        for (j = 0; j < dpin->dpscnt; j++) {
-            if (dpvalid->dpid[i] == dpin->dps[j].id) {
-                dp = &dpin->dps[j];
-                break;
-            }
-        }
+        dp_obj_t *dp = dp_rept_obj_get(dpin, dpvalid->dpid[i]);
         if (NULL == dp) {
             PR_DEBUG("dp not found");
-            op_ret = OPRT_SVC_DP_ID_NOT_FOUND;
-            goto __err_exit;
+            return OPRT_SVC_DP_ID_NOT_FOUND;
         }
-        // dp_obj_t  *dp     = &dpin->dps[dpvalid->dpid[i]];
         dp_node_t *dpnode = dp_node_find(schema, dp->id);
         if (NULL == dpnode) {
             PR_DEBUG("dp->id = %d not found", dp->id);
-            op_ret = OPRT_SVC_DP_ID_NOT_FOUND;
-            goto __err_exit;
+            return OPRT_SVC_DP_ID_NOT_FOUND;
         }
 
         if (dp->type != dpnode->desc.prop_tp) {
-            op_ret = OPRT_SVC_DP_TP_NOT_MATCH;
-            goto __err_exit;
+            return OPRT_SVC_DP_TP_NOT_MATCH;
+        }
+
+        if (i) {
+            dp_jw_putc(jw, ',');
         }
+        dp_jw_put_key(jw, dp->id);
 
         switch (dp->type) {
         case PROP_BOOL: {
-            if (TRUE == dp->value.dp_bool) {
-                offset += sprintf(dpstr + offset, "\"%d\":true,", dp->id);
-            } else {
-                offset += sprintf(dpstr + offset, "\"%d\":false,", dp->id);
-            }
+            dp_jw_puts(jw, (TRUE == dp->value.dp_bool) ? "true" : "false");
             break;
         }
 
         case PROP_VALUE: {
-            offset += sprintf(dpstr + offset, "\"%d\":%d,", dp->id, dp->value.dp_value);
+            dp_jw_put_int(jw, dp->value.dp_value);
             break;
         }
 
         case PROP_BITMAP: {
-            offset += sprintf(dpstr + offset, "\"%d\":%d,", dp->id, dp->value.dp_bitmap);
+            dp_jw_put_uint(jw, dp->value.dp_bitmap);
             break;
         }
 
         case PROP_STR: {
-            cJSON *temp_str = cJSON_CreateString(dp->value.dp_str);
-            char *tmp_data = cJSON_PrintUnformatted(temp_str);
-            if (tmp_data) {
-                offset += sprintf(dpstr + offset, "\"%d\":%s,", dp->id, tmp_data);
-            }
-            tal_free(tmp_data);
-            cJSON_Delete(temp_str);
+            dp_jw_put_str(jw, dp->value.dp_str);
             break;
         }
 
         case PROP_ENUM: {
-            offset +=
-                sprintf(dpstr + offset, "\"%d\":\"%s\",", dp->id, dpnode->prop.prop_enum.pp_enum[dp->value.dp_enum]);
+            dp_jw_put_str(jw, dpnode->prop.prop_enum.pp_enum[dp->value.dp_enum]);
         } break;
         }
 
-        if (is_need_time && dp->time_stamp) {
-            time_offset += sprintf(dptimestr + time_offset, "\"%d\":%u,", dp->id, dp->time_stamp);
+        if (tw && dp->time_stamp) {
+            if (!time_first) {
+                dp_jw_putc(tw, ',');
+            }
+            dp_jw_put_key(tw, dp->id);
+            dp_jw_put_uint(tw, (uint32_t)dp->time_stamp);
+            time_first = false;
         }
     }
 
-    dpstr[offset - 1] = '}';
-    dpstr[offset] = 0;
+    dp_jw_putc(jw, '}');
+    if (tw) {
+        dp_jw_putc(tw, '}');
+    }
 
-    dpout->dpsjson = dpstr;
+    return OPRT_OK;
+}
 
-    PR_DEBUG("dp rept out: %s", dpstr);
+/**
+ * @brief Outputs the JSON representation of a device property (DP) schema.
+ *
+ * This function takes a DP schema, input data, validation information, and
+ * output data as parameters. It generates the JSON representation of the DP
+ * schema based on the provided input data and validation information, and
+ * stores the result in the output data structure.
+ *
+ * @param schema Pointer to the DP schema structure.
+ * @param dpin Pointer to the input data structure.
+ * @param dpvalid Pointer to the validation information structure.
+ * @param dpout Pointer to the output data structure.
+ * @return Integer value indicating the success or failure of the operation.
+ */
+int dp_rept_json_output(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t *dpvalid, dp_rept_out_t *dpout)
+{
+    OPERATE_RET op_ret = OPRT_OK;
+    dp_json_writer_t jw = {NULL, 0, 0};
+    dp_json_writer_t tw = {NULL, 0, 0};
+    // STAT type DP needs to assemble a timestamp
+    bool is_need_time = (T_STAT_REPT == dpin->rept_type) && dpvalid->timelen && dpout->timejson;
 
+    // size precompute pass, then output into buffers of the exact size
+    op_ret = dp_rept_json_write(schema, dpin, dpvalid, &jw, is_need_time ? &tw : NULL);
+    if (OPRT_OK != op_ret) {
+        return op_ret;
+    }
+
+    jw.size = jw.len + 1;
+    jw.len = 0;
+    jw.buf = (char *)tal_malloc(jw.size);
+    if (NULL == jw.buf) {
+        PR_ERR("malloc err:%d", jw.size);
+        return OPRT_MALLOC_FAILED;
+    }
     if (is_need_time) {
-        dptimestr[time_offset - 1] = '}';
-        dptimestr[time_offset] = 0;
-        PR_DEBUG("dptimestr:%s", dptimestr);
-        dpout->timejson = dptimestr;
+        tw.size = tw.len + 1;
+        tw.len = 0;
+        tw.buf = (char *)tal_malloc(tw.size);
+        if (NULL == tw.buf) {
+            PR_ERR("malloc err:%d", tw.size);
+            tal_free(jw.buf);
+            return OPRT_MALLOC_FAILED;
+        }
     }
 
-    return OPRT_OK;
+    dp_rept_json_write(schema, dpin, dpvalid, &jw, is_need_time ? &tw : NULL);
+    dp_jw_finish(&jw);
+    dpout->dpsjson = jw.buf;
+    PR_DEBUG("dp rept out: %s", jw.buf);
 
-__err_exit:
-    tal_free(dpstr);
     if (is_need_time) {
-        tal_free(dptimestr);
+        dp_jw_finish(&tw);
+        PR_DEBUG("dptimestr:%s", tw.buf);
+        dpout->timejson = tw.buf;
     }
 
-    return op_ret;
+    return OPRT_OK;
+}
+
+/**
+ * @brief Serializes the valid DPs of a report into a caller provided buffer.
+ *
+ * @param schema Pointer to the DP schema structure.
+ * @param dpin Pointer to the input data structure.
+ * @param dpvalid Pointer to the validation information structure.
+ * @param head DP_JSON_HEAD_NONE, DP_JSON_HEAD_LAN or DP_JSON_HEAD_CLOUD.
+ * @param devid Device ID written in the head.
+ * @param buf Output buffer, NULL to get the length only.
+ * @param size Size of the output buffer.
+ * @return The length of the JSON string without '\0', the output is truncated
+ * if it is not less than size. Negative error code on failure.
+ */
+int dp_rept_json_serialize(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t *dpvalid, uint8_t head,
+                           const char *devid, char *buf, uint32_t size)
+{
+    OPERATE_RET op_ret = OPRT_OK;
+    dp_json_writer_t jw = {buf, size, 0};
+
+    if (NULL == schema || NULL == dpin || NULL == dpvalid || (DP_JSON_HEAD_NONE != head && NULL == devid)) {
+        return OPRT_INVALID_PARM;
+    }
+
+    dp_jw_put_head(&jw, head, devid);
+    op_ret = dp_rept_json_write(schema, dpin, dpvalid, &jw, NULL);
+    if (OPRT_OK != op_ret) {
+        return op_ret;
+    }
+    dp_jw_put_tail(&jw, head, devid);
+
+    return (int)dp_jw_finish(&jw);
 }
 
 // int dp_rept_json_output(dp_schema_t *schema, dp_rept_in_t *dpin,
@@ -991,56 +1174,198 @@ __err_exit:
 //     return op_ret;
 // }
 
-static int dp_obj_json_create(cJSON *root, dp_node_t *dpnode)
+/* write "id":value of the dp node, return false if the node has no value */
+static bool dp_obj_json_write_node(dp_json_writer_t *jw, dp_node_t *dpnode, bool first)
 {
-    int length = 0;
+    bool written = true;
+
+    if (PROP_STR == dpnode->desc.prop_tp) {
+        tal_mutex_lock(dpnode->prop.prop_str.dp_str_mutex);
+        if (dpnode->prop.prop_str.value) {
+            if (!first) {
+                dp_jw_putc(jw, ',');
+            }
+            dp_jw_put_key(jw, dpnode->desc.id);
+            dp_jw_put_str(jw, dpnode->prop.prop_str.value);
+        } else {
+            written = false;
+        }
+        tal_mutex_unlock(dpnode->prop.prop_str.dp_str_mutex);
+        return written;
+    }
+
+    if (PROP_BOOL != dpnode->desc.prop_tp && PROP_VALUE != dpnode->desc.prop_tp &&
+        PROP_ENUM != dpnode->desc.prop_tp && PROP_BITMAP != dpnode->desc.prop_tp) {
+        PR_ERR("dp type err:%d", dpnode->desc.prop_tp);
+        return false;
+    }
 
-    char dpid[10] = {0};
-    snprintf(dpid, 10, "%d", dpnode->desc.id);
+    if (!first) {
+        dp_jw_putc(jw, ',');
+    }
+    dp_jw_put_key(jw, dpnode->desc.id);
 
     switch (dpnode->desc.prop_tp) {
     case PROP_BOOL: {
-        length += 10;
-        cJSON_AddBoolToObject(root, dpid, dpnode->prop.prop_bool.value);
+        dp_jw_puts(jw, dpnode->prop.prop_bool.value ? "true" : "false");
         break;
     }
 
     case PROP_VALUE: {
-        length += 10;
-        cJSON_AddNumberToObject(root, dpid, dpnode->prop.prop_int.value);
-        break;
-    }
-
-    case PROP_STR: {
-        tal_mutex_lock(dpnode->prop.prop_str.dp_str_mutex);
-        if (dpnode->prop.prop_str.value) {
-            length += (10 + strlen(dpnode->prop.prop_str.value));
-            cJSON_AddStringToObject(root, dpid, dpnode->prop.prop_str.value);
-        }
-        tal_mutex_unlock(dpnode->prop.prop_str.dp_str_mutex);
+        dp_jw_put_int(jw, dpnode->prop.prop_int.value);
         break;
     }
 
     case PROP_ENUM: {
-        int value = dpnode->prop.prop_enum.value;
-        length += (10 + strlen(dpnode->prop.prop_enum.pp_enum[value]));
-        cJSON_AddStringToObject(root, dpid, dpnode->prop.prop_enum.pp_enum[value]);
+        dp_jw_put_str(jw, dpnode->prop.prop_enum.pp_enum[dpnode->prop.prop_enum.value]);
         break;
     }
 
     case PROP_BITMAP: {
-        length += 10;
-        cJSON_AddNumberToObject(root, dpid, dpnode->prop.prop_bitmap.value);
+        dp_jw_put_uint(jw, dpnode->prop.prop_bitmap.value);
         break;
     }
 
-    default: {
-        PR_ERR("dp type err:%d", dpnode->desc.prop_tp);
+    default:
         break;
     }
+
+    return true;
+}
+
+/* write the dp nodes as {"id":value,...}, the local stat ones only if DP_DUMP_STAT_LOCAL_FLAG set,
+ * at most valid_max dpid are recorded into dpvalid if it is not NULL. return the number of written dp */
+static int dp_obj_json_write(dp_schema_t *schema, int flags, dp_rept_valid_t *dpvalid, uint8_t valid_max,
+                             dp_json_writer_t *jw)
+{
+    int i, cnt = 0;
+
+    if (flags & DP_APPEND_HEADER_FLAG) {
+        dp_jw_put_head(jw, DP_JSON_HEAD_LAN, schema->devid);
+    }
+    dp_jw_putc(jw, '{');
+
+    if (dpvalid) {
+        dpvalid->num = 0;
+    }
+
+    for (i = 0; i < schema->num; i++) {
+        dp_node_t *dpnode = &(schema->node[i]);
+        if (DP_DUMP_STAT_LOCAL_FLAG & flags) {
+            if (T_OBJ == dpnode->desc.type && PV_STAT_CLOUD == dpnode->pv_stat) {
+                continue;
+            }
+        }
+        if (dpvalid) {
+            if (dpvalid->num >= valid_max) {
+                continue;
+            }
+            dpvalid->dpid[dpvalid->num++] = dpnode->desc.id;
+        }
+        if (dp_obj_json_write_node(jw, dpnode, 0 == cnt)) {
+            cnt++;
+        }
+    }
+
+    dp_jw_putc(jw, '}');
+    if (flags & DP_APPEND_HEADER_FLAG) {
+        dp_jw_put_tail(jw, DP_JSON_HEAD_LAN, schema->devid);
+    }
+
+    return cnt;
+}
+
+/* dump the dp nodes into a string of the exact size, the string dp may be changed
+ * between the length precompute pass and the output pass, retry with the new length */
+static int dp_obj_json_dump(dp_schema_t *schema, int flags, dp_rept_valid_t *dpvalid, uint8_t valid_max, char **out)
+{
+    dp_json_writer_t jw = {NULL, 0, 0};
+
+    if (0 == dp_obj_json_write(schema, flags, dpvalid, valid_max, &jw)) {
+        PR_DEBUG("Nothing To Pack");
+        return OPRT_SVC_DP_ID_NOT_FOUND;
+    }
+
+    for (;;) {
+        jw.size = jw.len + 1;
+        jw.len = 0;
+        jw.buf = (char *)tal_malloc(jw.size);
+        if (NULL == jw.buf) {
+            PR_ERR("malloc err:%d", jw.size);
+            return OPRT_MALLOC_FAILED;
+        }
+        dp_obj_json_write(schema, flags, dpvalid, valid_max, &jw);
+        if (jw.len < jw.size) {
+            break;
+        }
+        tal_free(jw.buf);
+    }
+    dp_jw_finish(&jw);
+    *out = jw.buf;
+
+    return OPRT_OK;
+}
+
+/* write the current values of the dp nodes listed in dpvalid, return the number of written dp */
+static int dp_node_json_write(dp_schema_t *schema, dp_rept_valid_t *dpvalid, uint8_t head, const char *devid,
+                              dp_json_writer_t *jw)
+{
+    int i, cnt = 0;
+
+    dp_jw_put_head(jw, head, devid);
+    dp_jw_putc(jw, '{');
+    for (i = 0; i < dpvalid->num; i++) {
+        dp_node_t *dpnode = dp_node_find(schema, dpvalid->dpid[i]);
+        if (dpnode && dp_obj_json_write_node(jw, dpnode, 0 == cnt)) {
+            cnt++;
+        }
+    }
+    dp_jw_putc(jw, '}');
+    dp_jw_put_tail(jw, head, devid);
+
+    return cnt;
+}
+
+/**
+ * @brief Dumps the current values of the DP nodes listed in dpvalid.
+ *
+ * @param schema Pointer to the DP schema structure.
+ * @param dpvalid The dpid to dump.
+ * @param head DP_JSON_HEAD_NONE, DP_JSON_HEAD_LAN or DP_JSON_HEAD_CLOUD.
+ * @param devid Device ID written in the head.
+ * @param out Output JSON string, freed by the caller.
+ * @return The length of the JSON string on success, negative error code on failure.
+ */
+int dp_node_json_dump(dp_schema_t *schema, dp_rept_valid_t *dpvalid, uint8_t head, const char *devid, char **out)
+{
+    dp_json_writer_t jw = {NULL, 0, 0};
+
+    if (NULL == schema || NULL == dpvalid || NULL == out || (DP_JSON_HEAD_NONE != head && NULL == devid)) {
+        return OPRT_INVALID_PARM;
+    }
+
+    if (0 == dp_node_json_write(schema, dpvalid, head, devid, &jw)) {
+        return OPRT_SVC_DP_ID_NOT_FOUND;
+    }
+
+    // the string dp may be changed between the passes, retry with the new length
+    for (;;) {
+        jw.size = jw.len + 1;
+        jw.len = 0;
+        jw.buf = (char *)tal_malloc(jw.size);
+        if (NULL == jw.buf) {
+            PR_ERR("malloc err:%d", jw.size);
+            return OPRT_MALLOC_FAILED;
+        }
+        dp_node_json_write(schema, dpvalid, head, devid, &jw);
+        if (jw.len < jw.size) {
+            break;
+        }
+        tal_free(jw.buf);
     }
+    *out = jw.buf;
 
-    return length;
+    return (int)dp_jw_finish(&jw);
 }
 
 /**
@@ -1065,16 +1390,18 @@ static int dp_obj_json_create(cJSON *root, dp_node_t *dpnode)
 int dp_obj_dump_stat_local_json(char *devid, dp_rept_valid_t **outdpvalid, char **outjson, int flags)
 {
     int i;
-    size_t length = 0;
+    OPERATE_RET op_ret = OPRT_OK;
+    char *jsonstr = NULL;
     dp_schema_t *schema = dp_schema_find(devid);
     uint8_t dp_stat_local_num = 0;
 
+    if (NULL == schema) {
+        PR_ERR("schema err");
+        return OPRT_INVALID_PARM;
+    }
+
     for (i = 0; i < schema->num; i++) {
         dp_node_t *dpnode = &(schema->node[i]);
-        if (dpnode == NULL) {
-            PR_DEBUG("dpnode NULL");
-            break;
-        }
         if (T_OBJ == dpnode->desc.type && PV_STAT_CLOUD != dpnode->pv_stat) {
             dp_stat_local_num++;
             continue;
@@ -1085,53 +1412,17 @@ int dp_obj_dump_stat_local_json(char *devid, dp_rept_valid_t **outdpvalid, char
         return OPRT_OK;
     }
 
-    cJSON *cjson = cJSON_CreateObject();
-    if (NULL == cjson) {
-        PR_ERR("json err");
-        return OPRT_MALLOC_FAILED;
-    }
-
     dp_rept_valid_t *dpvaild = tal_malloc(sizeof(dp_rept_valid_t) + sizeof(uint8_t) * dp_stat_local_num);
     if (NULL == dpvaild) {
-        cJSON_Delete(cjson);
         return OPRT_MALLOC_FAILED;
     }
     memset(dpvaild, 0, sizeof(dp_rept_valid_t) + sizeof(uint8_t) * dp_stat_local_num);
     dpvaild->schema = schema;
 
-    for (i = 0; i < schema->num; i++) {
-        dp_node_t *dpnode = &(schema->node[i]);
-        if (dpnode == NULL) {
-            PR_DEBUG("dpnode NULL");
-            break;
-        }
-        if (T_OBJ == dpnode->desc.type && PV_STAT_CLOUD == dpnode->pv_stat) {
-            continue;
-        }
-        if (dpvaild->num < dp_stat_local_num) {
-            dpvaild->dpid[dpvaild->num++] = dpnode->desc.id;
-            length += dp_obj_json_create(cjson, dpnode);
-        }
-    }
-
-    if (length == 0) {
-        PR_DEBUG("Nothing To Pack");
-        cJSON_Delete(cjson);
-        return OPRT_SVC_DP_ID_NOT_FOUND;
-    }
-    char *jsonstr = cJSON_PrintUnformatted(cjson);
-    cJSON_Delete(cjson);
-    if (NULL == jsonstr) {
+    op_ret = dp_obj_json_dump(schema, flags | DP_DUMP_STAT_LOCAL_FLAG, dpvaild, dp_stat_local_num, &jsonstr);
+    if (OPRT_OK != op_ret) {
         tal_free(dpvaild);
-        PR_ERR("Json err");
-        return OPRT_CR_CJSON_ERR;
-    }
-
-    if (flags & DP_APPEND_HEADER_FLAG) {
-        char *out = NULL;
-        dp_rept_json_append(schema, jsonstr, NULL, NULL, 0, &out);
-        tal_free(jsonstr);
-        jsonstr = out;
+        return op_ret;
     }
 
     if (outjson) {
@@ -1164,55 +1455,17 @@ int dp_obj_dump_stat_local_json(char *devid, dp_rept_valid_t **outdpvalid, char
  */
 char *dp_obj_dump_all_json(char *devid, int flags)
 {
-    cJSON *cjson = cJSON_CreateObject();
-    if (NULL == cjson) {
-        PR_ERR("json err");
-        return NULL;
-    }
-
-    size_t length = 0;
+    char *out = NULL;
     dp_schema_t *schema = dp_schema_find(devid);
     if (NULL == schema) {
-        cJSON_Delete(cjson);
         PR_ERR("schema err");
         return NULL;
     }
 
-    int i;
-
-    for (i = 0; i < schema->num; i++) {
-        dp_node_t *dpnode = &(schema->node[i]);
-        if (dpnode == NULL) {
-            PR_DEBUG("dpnode NULL");
-            break;
-        }
-        if (DP_DUMP_STAT_LOCAL_FLAG & flags) {
-            if (T_OBJ == dpnode->desc.type && PV_STAT_CLOUD == dpnode->pv_stat) {
-                continue;
-            }
-        }
-        length += dp_obj_json_create(cjson, dpnode);
-    } /* end of for */
-
-    if (length == 0) {
-        PR_DEBUG("Nothing To Pack");
-        cJSON_Delete(cjson);
+    if (OPRT_OK != dp_obj_json_dump(schema, flags, NULL, 0, &out)) {
         return NULL;
     }
 
-    char *tmp = cJSON_PrintUnformatted(cjson);
-    cJSON_Delete(cjson);
-    if (NULL == tmp) {
-        PR_ERR("Json err");
-        return NULL;
-    }
-
-    char *out = tmp;
-
-    if (flags & DP_APPEND_HEADER_FLAG) {
-        dp_rept_json_append(schema, out, NULL, NULL, 0, &out);
-    }
-
     return out;
 }
 
@@ -1523,6 +1776,7 @@ int dp_schema_create(char *devid, char *schema_json, dp_schema_t **dp_schema_out
     OPERATE_RET op_ret = OPRT_OK;
     dp_node_pos_t *nodepos = NULL;
     int nodenum;
+    int i = 0;
 
     nodepos = tal_malloc(sizeof(dp_node_pos_t) * 255);
     if (NULL == nodepos) {
@@ -1560,6 +1814,10 @@ int dp_schema_create(char *devid, char *schema_json, dp_schema_t **dp_schema_out
         PR_ERR("dp_node_parse fail:%d", op_ret);
         goto __exit;
     }
+    // nodenum < 255, position + 1 fits in uint8_t. keep the first one of duplicated dpid
+    for (i = nodenum - 1; i >= 0; i--) {
+        dp_schema->node_index[dp_schema->node[i].desc.id] = i + 1;
+    }
     dp_schema->actv.preprocess = other_attr.preprocess;
     dp_schema->actv.attach_dp_if = TRUE;
     strncpy(dp_schema->devid, devid, DEV_ID_LEN);
@@ -1604,6 +1862,9 @@ int dp_schema_delete(char *devid)
         }
 
         if (0 == strcmp(devid, dsmgr->schema_list[i]->devid)) {
+            if (dsmgr->last_found == dsmgr->schema_list[i]) {
+                dsmgr->last_found = NULL;
+            }
             tal_mutex_release(dsmgr->schema_list[i]->mutex);
             tal_free(dsmgr->schema_list[i]);
             dsmgr->schema_list[i] = NULL;
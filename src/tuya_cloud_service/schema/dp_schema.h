@@ -321,6 +321,9 @@ typedef struct {
 
 // typedef struct dev_cntl_n_s {
 
+/** dpid is uint8_t, index all of them */
+#define DP_NODE_INDEX_NUM 256
+
 typedef struct {
     /** virtual id */
     char devid[DEV_ID_LEN + 1];
@@ -330,6 +333,8 @@ typedef struct {
     MUTEX_HANDLE mutex;
     /** count of dp */
     uint8_t num;
+    /** dpid to node position + 1, 0 means dpid not exist */
+    uint8_t node_index[DP_NODE_INDEX_NUM];
     /** dp info */
     dp_node_t node[0];
 } dp_schema_t;
@@ -348,6 +353,11 @@ typedef struct {
 #define DP_DUMP_STAT_LOCAL_FLAG (1 << 1)
 #define DP_APPEND_HEADER_FLAG   (1 << 2)
 
+/* head wrapped around the dps object by dp_rept_json_serialize */
+#define DP_JSON_HEAD_NONE  0 // {"id":value}
+#define DP_JSON_HEAD_LAN   1 // {"dps":{"id":value},"devId":"xxx"}
+#define DP_JSON_HEAD_CLOUD 2 // {"devId":"xxx","dps":{"id":value}}
+
 typedef struct {
     char *devid;
     dp_cmd_type_t cmd;
@@ -484,6 +494,38 @@ int dp_rept_valid_check(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t
  */
 int dp_rept_json_output(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t *dpvalid, dp_rept_out_t *dpout);
 
+/**
+ * @brief Serializes the valid DPs of a report into a caller provided buffer,
+ * no intermediate JSON tree is built.
+ *
+ * Call it with buf NULL to get the length, then with a buffer of length + 1.
+ *
+ * @param schema Pointer to the DP schema structure.
+ * @param dpin Pointer to the input data structure.
+ * @param dpvalid Pointer to the validation information structure.
+ * @param head DP_JSON_HEAD_NONE, DP_JSON_HEAD_LAN or DP_JSON_HEAD_CLOUD.
+ * @param devid Device ID written in the head.
+ * @param buf Output buffer, NULL to get the length only.
+ * @param size Size of the output buffer.
+ * @return The length of the JSON string without '\0', the output is truncated
+ * if it is not less than size. Negative error code on failure.
+ */
+int dp_rept_json_serialize(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t *dpvalid, uint8_t head,
+                           const char *devid, char *buf, uint32_t size);
+
+/**
+ * @brief Dumps the current values of the DP nodes listed in dpvalid, the
+ * values stored by the reports instead of the ones in a report input.
+ *
+ * @param schema Pointer to the DP schema structure.
+ * @param dpvalid The dpid to dump.
+ * @param head DP_JSON_HEAD_NONE, DP_JSON_HEAD_LAN or DP_JSON_HEAD_CLOUD.
+ * @param devid Device ID written in the head.
+ * @param out Output JSON string, freed by the caller.
+ * @return The length of the JSON string on success, negative error code on failure.
+ */
+int dp_node_json_dump(dp_schema_t *schema, dp_rept_valid_t *dpvalid, uint8_t head, const char *devid, char **out);
+
 /**
  * Appends a JSON string to the given data point schema.
  *
@@ -24,12 +24,47 @@
 #include "tuya_lan.h"
 #include "tal_api.h"
 #include "mix_method.h"
+#include "dp_journal.h"
 
 #ifdef ENABLE_BLUETOOTH
 #include "ble_mgr.h"
 #include "ble_dp.h"
 #endif
 
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+// default minimum interval between two MQTT reports of a dp, ms
+#ifndef DP_REPORT_MIN_INTERVAL
+#define DP_REPORT_MIN_INTERVAL 500
+#endif
+
+// how long an update waits for the others to share its report, ms
+#ifndef DP_REPORT_COALESCE_WINDOW
+#define DP_REPORT_COALESCE_WINDOW 50
+#endif
+
+typedef struct {
+    uint32_t due;       // time to send the held value, ms
+    uint32_t last_sent; // time of the last report, ms
+    uint32_t interval;  // minimum interval between two reports, ms
+    bool pending;       // the value in the node is not sent yet
+    bool sent;          // last_sent is valid
+} dp_report_slot_t;
+
+typedef struct {
+    MUTEX_HANDLE mutex;
+    DELAYED_WORK_HANDLE flush_work;
+    tuya_iot_client_t *client;
+    dp_schema_t *schema;    // schema of the main device the slots belong to
+    dp_report_slot_t *slot; // one per schema node
+    uint16_t slot_num;
+    uint16_t pending_num;
+    uint8_t flushing; // flushes using the schema out of the mutex, waited for by tuya_iot_dp_report_clear
+    tuya_iot_dp_report_stat_t stat;
+} dp_report_coalesce_t;
+
+static dp_report_coalesce_t *s_dp_coalesce = NULL;
+#endif
+
 static DELAYED_WORK_HANDLE s_tmm_dp_sync = NULL;
 
 int tuya_iot_dp_sync_start(tuya_iot_client_t *client, uint32_t timeout_s);
@@ -78,8 +113,18 @@ void tuya_iot_dp_sync_process(void *data)
         return;
     }
 
-    tuya_iot_dp_report_json_async(client, dpsjson, NULL, dp_sync_cb, dpvalid, 5000);
+    if (NULL == dpsjson) {
+        // all dp synced
+        return;
+    }
+
+    ret = tuya_iot_dp_report_json_async(client, dpsjson, NULL, dp_sync_cb, dpvalid, 5000);
     tal_free(dpsjson);
+    if (OPRT_OK != ret) {
+        // publish queue full or disconnected, dp_sync_cb is not called
+        tal_free(dpvalid);
+        tal_workq_start_delayed(s_tmm_dp_sync, 5000, LOOP_ONCE);
+    }
 }
 
 /**
@@ -109,6 +154,344 @@ int tuya_iot_dp_sync_start(tuya_iot_client_t *client, uint32_t timeout_s)
     return tal_workq_start_delayed(s_tmm_dp_sync, timeout_s * 1000, LOOP_ONCE);
 }
 
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+/* the slots of the schema, created again if the schema is changed. called with ctx->mutex locked */
+static int dp_coalesce_slot_prepare(dp_report_coalesce_t *ctx, dp_schema_t *schema)
+{
+    dp_report_slot_t *slot = NULL;
+    int i;
+
+    if (ctx->schema == schema && ctx->slot_num == schema->num) {
+        return OPRT_OK;
+    }
+
+    slot = tal_malloc(sizeof(dp_report_slot_t) * schema->num);
+    if (NULL == slot) {
+        return OPRT_MALLOC_FAILED;
+    }
+    memset(slot, 0, sizeof(dp_report_slot_t) * schema->num);
+    for (i = 0; i < schema->num; i++) {
+        slot[i].interval = DP_REPORT_MIN_INTERVAL;
+    }
+
+    if (ctx->slot) {
+        tal_free(ctx->slot);
+    }
+    ctx->slot = slot;
+    ctx->slot_num = schema->num;
+    ctx->schema = schema;
+    ctx->pending_num = 0;
+
+    return OPRT_OK;
+}
+
+/* start the flush work at the earliest due time of the held dps. called with ctx->mutex locked, so
+ * that a later due time computed by another thread can not restart the work after this one */
+static void dp_coalesce_arm(dp_report_coalesce_t *ctx)
+{
+    uint32_t now = (uint32_t)tal_system_get_millisecond();
+    int32_t wait = INT32_MAX;
+    int i;
+
+    for (i = 0; i < ctx->slot_num && ctx->pending_num; i++) {
+        if (ctx->slot[i].pending && (int32_t)(ctx->slot[i].due - now) < wait) {
+            wait = (int32_t)(ctx->slot[i].due - now);
+        }
+    }
+
+    if (INT32_MAX != wait) {
+        tal_workq_start_delayed(ctx->flush_work, wait > 0 ? wait : 1, LOOP_ONCE);
+    }
+}
+
+/* send the held dps due within the window in one report, with their latest values in the nodes */
+static void dp_coalesce_flush(dp_report_coalesce_t *ctx)
+{
+    dp_rept_valid_t *dpvalid = NULL;
+    char *out = NULL;
+    uint32_t now;
+    uint8_t num;
+    int i, len, ret;
+
+    tal_mutex_lock(ctx->mutex);
+    if (0 == ctx->pending_num) {
+        tal_mutex_unlock(ctx->mutex);
+        return;
+    }
+
+    dpvalid = tal_malloc(sizeof(dp_rept_valid_t) + sizeof(uint8_t) * ctx->pending_num);
+    if (NULL == dpvalid) {
+        tal_workq_start_delayed(ctx->flush_work, DP_REPORT_COALESCE_WINDOW + 1, LOOP_ONCE);
+        tal_mutex_unlock(ctx->mutex);
+        return;
+    }
+    memset(dpvalid, 0, sizeof(dp_rept_valid_t) + sizeof(uint8_t) * ctx->pending_num);
+    dpvalid->schema = ctx->schema;
+
+    now = (uint32_t)tal_system_get_millisecond();
+    for (i = 0; i < ctx->slot_num; i++) {
+        dp_report_slot_t *slot = &ctx->slot[i];
+        if (!slot->pending || (int32_t)(slot->due - now) > DP_REPORT_COALESCE_WINDOW) {
+            continue;
+        }
+        slot->pending = false;
+        slot->sent = true;
+        slot->last_sent = now;
+        ctx->pending_num--;
+        dpvalid->dpid[dpvalid->num++] = ctx->schema->node[i].desc.id;
+    }
+    num = dpvalid->num;
+    if (0 == num) {
+        dp_coalesce_arm(ctx);
+        tal_mutex_unlock(ctx->mutex);
+        tal_free(dpvalid);
+        return;
+    }
+    ctx->flushing++;
+    dp_coalesce_arm(ctx);
+    tal_mutex_unlock(ctx->mutex);
+
+    len = dp_node_json_dump(dpvalid->schema, dpvalid, DP_JSON_HEAD_CLOUD, ctx->client->activate.devid, &out);
+    if (len < 0) {
+        PR_ERR("dp coalesce dump failed %d", len);
+        tal_free(dpvalid);
+        tuya_iot_dp_sync_start(ctx->client, 5);
+        num = 0;
+        goto __exit;
+    }
+    PR_DEBUG("dp rept out: %s", out);
+
+    ret = tuya_mqtt_protocol_data_publish_common(&ctx->client->mqctx, PRO_DATA_PUSH, (const uint8_t *)out,
+                                                 (uint16_t)len, (mqtt_publish_notify_cb_t)dp_sync_cb, dpvalid, 5000,
+                                                 false);
+    tal_free(out);
+    if (OPRT_OK != ret) {
+        // dp_sync_cb is not called, the values are still local, sync them later
+        tal_free(dpvalid);
+        tuya_iot_dp_sync_start(ctx->client, 5);
+        num = 0;
+    }
+
+__exit:
+    tal_mutex_lock(ctx->mutex);
+    if (num) {
+        ctx->stat.msg_sent++;
+        ctx->stat.dp_sent += num;
+    }
+    ctx->flushing--;
+    tal_mutex_unlock(ctx->mutex);
+}
+
+static void dp_coalesce_flush_process(void *data)
+{
+    dp_coalesce_flush((dp_report_coalesce_t *)data);
+}
+
+/* hold the valid dps of a report in their slots, the values are already stored in the nodes by
+ * dp_rept_valid_check. bool, enum and unfiltered dps are due at once, the others after the window
+ * and not before the minimum interval since their last report */
+static int dp_coalesce_hold(dp_schema_t *schema, dp_rept_valid_t *dpvalid, int flags)
+{
+    dp_report_coalesce_t *ctx = s_dp_coalesce;
+    uint32_t now = (uint32_t)tal_system_get_millisecond();
+    bool prompt = false;
+    int i;
+
+    if (NULL == ctx) {
+        return OPRT_COM_ERROR;
+    }
+
+    tal_mutex_lock(ctx->mutex);
+    if (OPRT_OK != dp_coalesce_slot_prepare(ctx, schema)) {
+        tal_mutex_unlock(ctx->mutex);
+        return OPRT_MALLOC_FAILED;
+    }
+    for (i = 0; i < dpvalid->num; i++) {
+        dp_node_t *dpnode = dp_node_find(schema, dpvalid->dpid[i]);
+        if (NULL == dpnode || dpnode - schema->node >= ctx->slot_num) {
+            continue;
+        }
+        dp_report_slot_t *slot = &ctx->slot[dpnode - schema->node];
+
+        ctx->stat.dp_update++;
+        if (slot->pending) {
+            ctx->stat.dp_coalesced++;
+        } else {
+            slot->pending = true;
+            slot->due = now + DP_REPORT_COALESCE_WINDOW;
+            if (slot->sent && (int32_t)(slot->last_sent + slot->interval - slot->due) > 0) {
+                slot->due = slot->last_sent + slot->interval;
+            }
+            ctx->pending_num++;
+        }
+
+        if ((flags & DP_REPT_NO_FILTER_FLAG) || PROP_BOOL == dpnode->desc.prop_tp ||
+            PROP_ENUM == dpnode->desc.prop_tp) {
+            slot->due = now;
+            prompt = true;
+        }
+    }
+    if (!prompt) {
+        dp_coalesce_arm(ctx);
+    }
+    tal_mutex_unlock(ctx->mutex);
+
+    if (prompt) {
+        dp_coalesce_flush(ctx);
+    }
+
+    return OPRT_OK;
+}
+#endif
+
+/**
+ * @brief Initializes the coalescing of the DP reports of the main device,
+ * called once by tuya_iot_init before any report.
+ *
+ * @param client The Tuya IoT client.
+ *
+ * @return OPRT_OK on success, or a negative error code on failure.
+ */
+int tuya_iot_dp_report_init(tuya_iot_client_t *client)
+{
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+    dp_report_coalesce_t *ctx = NULL;
+    int ret;
+
+    if (NULL != s_dp_coalesce) {
+        return OPRT_OK;
+    }
+
+    ctx = tal_malloc(sizeof(dp_report_coalesce_t));
+    if (NULL == ctx) {
+        return OPRT_MALLOC_FAILED;
+    }
+    memset(ctx, 0, sizeof(dp_report_coalesce_t));
+    ctx->client = client;
+
+    ret = tal_mutex_create_init(&ctx->mutex);
+    if (OPRT_OK != ret) {
+        tal_free(ctx);
+        return ret;
+    }
+    ret = tal_workq_init_delayed(WORKQ_HIGHTPRI, dp_coalesce_flush_process, ctx, &ctx->flush_work);
+    if (OPRT_OK != ret) {
+        tal_mutex_release(ctx->mutex);
+        tal_free(ctx);
+        return ret;
+    }
+    s_dp_coalesce = ctx;
+
+    return OPRT_OK;
+#else
+    return OPRT_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * @brief Sets the minimum interval between two MQTT reports of a DP of the
+ * main device.
+ *
+ * @param client The Tuya IoT client.
+ * @param dpid The DP ID.
+ * @param interval_ms The minimum interval in milliseconds, 0 to report every
+ * update.
+ *
+ * @return OPRT_OK on success, or a negative error code on failure.
+ */
+int tuya_iot_dp_report_interval_set(tuya_iot_client_t *client, uint8_t dpid, uint32_t interval_ms)
+{
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+    if (!client->is_activated) {
+        return OPRT_COM_ERROR;
+    }
+
+    dp_schema_t *schema = dp_schema_find(client->activate.devid);
+    if (NULL == schema) {
+        return OPRT_INVALID_PARM;
+    }
+
+    dp_node_t *dpnode = dp_node_find(schema, dpid);
+    if (NULL == dpnode) {
+        return OPRT_SVC_DP_ID_NOT_FOUND;
+    }
+
+    dp_report_coalesce_t *ctx = s_dp_coalesce;
+    if (NULL == ctx) {
+        return OPRT_COM_ERROR;
+    }
+
+    tal_mutex_lock(ctx->mutex);
+    int ret = dp_coalesce_slot_prepare(ctx, schema);
+    if (OPRT_OK == ret) {
+        ctx->slot[dpnode - schema->node].interval = interval_ms;
+    }
+    tal_mutex_unlock(ctx->mutex);
+
+    return ret;
+#else
+    return OPRT_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * @brief Gets the counters of the object DP reports sent by MQTT.
+ *
+ * @param stat The counters since power on.
+ *
+ * @return OPRT_OK on success, or a negative error code on failure.
+ */
+int tuya_iot_dp_report_stat_get(tuya_iot_dp_report_stat_t *stat)
+{
+    if (NULL == stat) {
+        return OPRT_INVALID_PARM;
+    }
+    memset(stat, 0, sizeof(tuya_iot_dp_report_stat_t));
+
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+    if (s_dp_coalesce) {
+        tal_mutex_lock(s_dp_coalesce->mutex);
+        *stat = s_dp_coalesce->stat;
+        tal_mutex_unlock(s_dp_coalesce->mutex);
+    }
+
+    return OPRT_OK;
+#else
+    return OPRT_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * @brief Drops the reports held for coalescing, called before the schema is
+ * deleted.
+ */
+void tuya_iot_dp_report_clear(void)
+{
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+    if (NULL == s_dp_coalesce) {
+        return;
+    }
+
+    // the work is kept for the next reports, a flush already queued finds nothing pending
+    tal_workq_stop_delayed(s_dp_coalesce->flush_work);
+    tal_mutex_lock(s_dp_coalesce->mutex);
+    while (s_dp_coalesce->flushing) {
+        // a flush is dumping the nodes of the schema about to be deleted
+        tal_mutex_unlock(s_dp_coalesce->mutex);
+        tal_system_sleep(10);
+        tal_mutex_lock(s_dp_coalesce->mutex);
+    }
+    if (s_dp_coalesce->slot) {
+        tal_free(s_dp_coalesce->slot);
+    }
+    s_dp_coalesce->slot = NULL;
+    s_dp_coalesce->slot_num = 0;
+    s_dp_coalesce->schema = NULL;
+    s_dp_coalesce->pending_num = 0;
+    tal_mutex_unlock(s_dp_coalesce->mutex);
+#endif
+}
+
 /**
  * @brief Dispatches an event for the Tuya IoT data point (DP).
  *
@@ -234,7 +617,7 @@ int tuya_iot_dp_obj_report(tuya_iot_client_t *client, const char *devid, dp_obj_
     if (NULL == dpvalid) {
         return OPRT_MALLOC_FAILED;
     }
-    memset(dpvalid, 0, sizeof(sizeof(dp_rept_valid_t) + sizeof(uint8_t) * dpscnt));
+    memset(dpvalid, 0, sizeof(dp_rept_valid_t) + sizeof(uint8_t) * dpscnt);
 
     PR_DEBUG("dp report: devid %s, dps 0x%08x, dpscnt %d, flags %d", devid ? devid : "null", dps, dpscnt, flags);
 
@@ -285,37 +668,83 @@ int tuya_iot_dp_obj_report(tuya_iot_client_t *client, const char *devid, dp_obj_
     }
 #endif
 
-    dp_rept_out_t dpout;
-
-    memset(&dpout, 0, sizeof(dpout));
-
-    ret = dp_rept_json_output(schema, &dpin, dpvalid, &dpout);
-    if (OPRT_OK != ret) {
-        PR_DEBUG("dp rept json output error %d", ret);
-        return ret;
-    }
+    uint8_t head = DP_JSON_HEAD_NONE;
+    const char *head_devid = NULL;
 
     if (tuya_lan_is_connected()) {
-        char *out = NULL;
         PR_DEBUG("lan channel report");
-        dp_rept_json_append(schema, dpout.dpsjson, NULL, NULL, 0, &out);
-        ret = tuya_lan_dp_report(out);
-        tal_free(out);
-        tal_free(dpvalid);
-        tuya_iot_dp_sync_start(client, 5);
+        head = DP_JSON_HEAD_LAN;
+        head_devid = schema->devid;
     } else if (tuya_iot_is_connected()) {
         PR_DEBUG("mqtt channel report");
-        ret = tuya_iot_dp_report_json_with_notify(client, dpout.dpsjson, NULL, dp_sync_cb, dpvalid, 5000);
+        head = DP_JSON_HEAD_CLOUD;
+        head_devid = client->activate.devid;
     } else {
+#if defined(ENABLE_DP_JOURNAL) && (ENABLE_DP_JOURNAL == 1)
+        PR_DEBUG("no channel, dp journal keep");
+        head = DP_JSON_HEAD_NONE;
+#else
         PR_ERR("no channel for connect");
+        tal_free(dpvalid);
+        return OPRT_OK;
+#endif
     }
 
-    if (dpout.dpsjson) {
-        tal_free(dpout.dpsjson);
+#if defined(ENABLE_DP_JOURNAL) && (ENABLE_DP_JOURNAL == 1)
+    if (DP_JSON_HEAD_NONE != head) {
+        // the older values kept offline must not be replayed after these
+        for (int i = 0; i < dpvalid->num; i++) {
+            dp_journal_drop_id(dpvalid->dpid[i]);
+        }
     }
-    if (dpout.timejson) {
-        tal_free(dpout.timejson);
+#endif
+
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+    if (DP_JSON_HEAD_CLOUD == head && 0 == strcmp(schema->devid, client->activate.devid)) {
+        // sent by dp_coalesce_flush with the latest values, report at once if it can not be held
+        if (OPRT_OK == dp_coalesce_hold(schema, dpvalid, flags)) {
+            tal_free(dpvalid);
+            return OPRT_OK;
+        }
     }
+#endif
+
+    // serialize with the channel head into one buffer of the exact size
+    int len = dp_rept_json_serialize(schema, &dpin, dpvalid, head, head_devid, NULL, 0);
+    if (len < 0) {
+        PR_DEBUG("dp rept json output error %d", len);
+        tal_free(dpvalid);
+        return len;
+    }
+
+    char *out = tal_malloc(len + 1);
+    if (NULL == out) {
+        tal_free(dpvalid);
+        return OPRT_MALLOC_FAILED;
+    }
+    dp_rept_json_serialize(schema, &dpin, dpvalid, head, head_devid, out, len + 1);
+    PR_DEBUG("dp rept out: %s", out);
+
+    if (DP_JSON_HEAD_LAN == head) {
+        ret = tuya_lan_dp_report(out);
+        tal_free(dpvalid);
+        tuya_iot_dp_sync_start(client, 5);
+#if defined(ENABLE_DP_JOURNAL) && (ENABLE_DP_JOURNAL == 1)
+    } else if (DP_JSON_HEAD_NONE == head) {
+        ret = dp_journal_add(out, NULL);
+        tal_free(dpvalid);
+#endif
+    } else {
+        ret = tuya_mqtt_protocol_data_publish_common(&client->mqctx, PRO_DATA_PUSH, (const uint8_t *)out,
+                                                     (uint16_t)len, (mqtt_publish_notify_cb_t)dp_sync_cb, dpvalid,
+                                                     5000, false);
+        if (OPRT_OK != ret) {
+            // dp_sync_cb is not called, sync the local stat later
+            tal_free(dpvalid);
+            tuya_iot_dp_sync_start(client, 5);
+        }
+    }
+    tal_free(out);
 
     return ret;
 }
@@ -432,13 +861,20 @@ int tuya_iot_dp_raw_report(tuya_iot_client_t *client, const char *devid, dp_raw_
 
     if (tuya_lan_is_connected()) {
         char *out = NULL;
+#if defined(ENABLE_DP_JOURNAL) && (ENABLE_DP_JOURNAL == 1)
+        dp_journal_drop_id(dp->id);
+#endif
         dp_rept_json_append(schema, dpout.dpsjson, NULL, NULL, 0, &out);
         ret = tuya_lan_dp_report(out);
         tal_free(out);
     } else if (tuya_iot_is_connected()) {
         ret = tuya_iot_dp_report_json_async(client, dpout.dpsjson, NULL, dp_raw_async_cb, NULL, timeout);
     } else {
+#if defined(ENABLE_DP_JOURNAL) && (ENABLE_DP_JOURNAL == 1)
+        ret = dp_journal_add(dpout.dpsjson, NULL);
+#else
         PR_ERR("no channel for connect");
+#endif
     }
 
     if (dpout.dpsjson) {
@@ -23,6 +23,16 @@ extern "C" {
 
 #include "tuya_iot.h"
 
+/**
+ * @brief counters of the obj reports sent to the cloud by MQTT
+ */
+typedef struct {
+    uint32_t dp_update;    // dp values accepted by tuya_iot_dp_obj_report
+    uint32_t dp_coalesced; // dp values replaced by a newer one before they were sent
+    uint32_t dp_sent;      // dp values published
+    uint32_t msg_sent;     // report messages published
+} tuya_iot_dp_report_stat_t;
+
 /**
  * @brief
  *
@@ -76,6 +86,46 @@ int tuya_iot_dp_raw_report(tuya_iot_client_t *client, const char *devid, dp_raw_
  */
 char *tuya_iot_dp_obj_dump(tuya_iot_client_t *client, char *devid, int flags);
 
+/**
+ * @brief init the coalescing of the MQTT reports of the main device, called by
+ * tuya_iot_init
+ *
+ * @param[in] client: tuya iot client
+ *
+ * @return OPRT_OK on success, OPRT_NOT_SUPPORTED if ENABLE_DP_REPORT_COALESCE is off
+ */
+int tuya_iot_dp_report_init(tuya_iot_client_t *client);
+
+/**
+ * @brief set the minimum interval between two MQTT reports of the dp, the
+ * updates in between are merged into one report of the last value. bool and
+ * enum dps are always reported at once. reset to DP_REPORT_MIN_INTERVAL when
+ * the schema is changed
+ *
+ * @param[in] client: tuya iot client
+ * @param[in] dpid: dp id of the main device
+ * @param[in] interval_ms: minimum interval, 0 to report every update
+ *
+ * @return OPRT_OK on success, OPRT_NOT_SUPPORTED if ENABLE_DP_REPORT_COALESCE is off
+ */
+int tuya_iot_dp_report_interval_set(tuya_iot_client_t *client, uint8_t dpid, uint32_t interval_ms);
+
+/**
+ * @brief get the counters of the obj reports sent by MQTT
+ *
+ * @param[out] stat: counters since power on
+ *
+ * @return OPRT_OK on success, OPRT_NOT_SUPPORTED if ENABLE_DP_REPORT_COALESCE is off
+ */
+int tuya_iot_dp_report_stat_get(tuya_iot_dp_report_stat_t *stat);
+
+/**
+ * @brief drop the reports held for coalescing, called before the schema is deleted
+ *
+ * @return none
+ */
+void tuya_iot_dp_report_clear(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -38,9 +38,45 @@
 #include "mbedtls/ctr_drbg.h"
 #include "mbedtls/hkdf.h"
 #include "mbedtls/aes.h"
+#include "crc32i.h"
 
 #define TLS_URL_LEN (128 + 16)
 
+#if defined(ENABLE_TLS_SESSION_RESUME) && (ENABLE_TLS_SESSION_RESUME == 1)
+#ifndef TLS_SESSION_CACHE_NUM
+#define TLS_SESSION_CACHE_NUM (4)
+#endif
+#define TLS_SESSION_KV_KEY "tls_ss_%08x"
+
+/* the serialized session of the last connection to one host */
+typedef struct {
+    uint32_t key; // hostname, port and ca
+    uint32_t used;
+    uint8_t *data;
+    size_t len;
+} tls_session_cache_t;
+
+static tls_session_cache_t s_session_cache[TLS_SESSION_CACHE_NUM];
+#endif
+
+#if defined(ENABLE_TLS_CA_CACHE) && (ENABLE_TLS_CA_CACHE == 1)
+#ifndef TLS_CA_CACHE_NUM
+#define TLS_CA_CACHE_NUM (2)
+#endif
+
+/* the parsed ca chain shared by the connections with the same ca */
+typedef struct {
+    mbedtls_x509_crt crt;
+    uint32_t crc;
+    int len;
+    uint32_t used;
+    uint16_t ref; // connections in handshake with it
+    bool valid;
+} tls_ca_cache_t;
+
+static tls_ca_cache_t s_ca_cache[TLS_CA_CACHE_NUM];
+#endif
+
 typedef struct {
     tuya_tls_config_t config;
     mbedtls_ssl_context ssl_ctx;
@@ -52,6 +88,10 @@ typedef struct {
     int overtime_s;
     MUTEX_HANDLE mutex;
     MUTEX_HANDLE read_mutex;
+    uint32_t ca_crc;
+#if defined(ENABLE_TLS_CA_CACHE) && (ENABLE_TLS_CA_CACHE == 1)
+    tls_ca_cache_t *ca_cache; // NULL if the ca is parsed into cacert
+#endif
 } tuya_mbedtls_context_t;
 
 #define TLS_HANDSHAKE_TIMEOUT (18) // s
@@ -59,6 +99,8 @@ typedef struct {
 static tuya_tls_pre_conn_cb s_pre_conn_cb = NULL;
 static mbedtls_entropy_context ty_entropy;
 static mbedtls_ctr_drbg_context ty_ctr_drbg;
+static MUTEX_HANDLE s_tls_cache_mutex = NULL;
+static uint32_t s_tls_cache_stamp = 0;
 
 /* -------------------------------------------------------------------------- */
 /*                                  TLS Mutex                                 */
@@ -309,6 +351,226 @@ static int __tuya_tls_socket_recv_cb(void *ctx, unsigned char *buf, size_t len)
     return rv;
 }
 
+/* -------------------------------------------------------------------------- */
+/*                                  TLS Cache                                 */
+/* -------------------------------------------------------------------------- */
+#if defined(ENABLE_TLS_CA_CACHE) && (ENABLE_TLS_CA_CACHE == 1)
+/**
+ * @brief get the parsed ca chain from the cache, parse it if not found
+ *
+ * @param[in] ca: ca cert
+ * @param[in] len: ca cert length
+ * @param[in] crc: crc of the ca cert
+ * @param[out] out: the cached chain, NULL if the cache is full of chains in use
+ *
+ * @return 0 on success, mbedtls error code if parse failed
+ */
+static int __tls_ca_cache_get(const char *ca, int len, uint32_t crc, tls_ca_cache_t **out)
+{
+    tls_ca_cache_t *slot = NULL;
+    int ret = 0;
+    int i;
+
+    *out = NULL;
+    if (NULL == s_tls_cache_mutex) {
+        return 0;
+    }
+
+    tal_mutex_lock(s_tls_cache_mutex);
+    for (i = 0; i < TLS_CA_CACHE_NUM; i++) {
+        tls_ca_cache_t *entry = &s_ca_cache[i];
+        if (entry->valid && entry->crc == crc && entry->len == len) {
+            entry->ref++;
+            entry->used = ++s_tls_cache_stamp;
+            *out = entry;
+            tal_mutex_unlock(s_tls_cache_mutex);
+            return 0;
+        }
+        // an empty slot, or else the least recently used one not in use
+        if (!entry->valid) {
+            if (NULL == slot || slot->valid) {
+                slot = entry;
+            }
+        } else if (0 == entry->ref && (NULL == slot || (slot->valid && entry->used < slot->used))) {
+            slot = entry;
+        }
+    }
+
+    if (slot) {
+        if (slot->valid) {
+            mbedtls_x509_crt_free(&slot->crt);
+            slot->valid = false;
+        }
+        mbedtls_x509_crt_init(&slot->crt);
+        ret = mbedtls_x509_crt_parse(&slot->crt, (const unsigned char *)ca, len);
+        if (0 != ret) {
+            mbedtls_x509_crt_free(&slot->crt);
+        } else {
+            slot->crc = crc;
+            slot->len = len;
+            slot->ref = 1;
+            slot->used = ++s_tls_cache_stamp;
+            slot->valid = true;
+            *out = slot;
+        }
+    }
+    tal_mutex_unlock(s_tls_cache_mutex);
+
+    return ret;
+}
+
+static void __tls_ca_cache_put(tls_ca_cache_t *entry)
+{
+    tal_mutex_lock(s_tls_cache_mutex);
+    entry->ref--;
+    tal_mutex_unlock(s_tls_cache_mutex);
+}
+#endif
+
+#if defined(ENABLE_TLS_SESSION_RESUME) && (ENABLE_TLS_SESSION_RESUME == 1)
+static uint32_t __tls_session_key(tuya_mbedtls_context_t *tls_context)
+{
+    tuya_tls_config_t *config = &tls_context->config;
+
+    return hash_crc32i_total(config->hostname, strlen(config->hostname)) ^ ((uint32_t)config->port << 16) ^
+           tls_context->ca_crc;
+}
+
+/* caller holds s_tls_cache_mutex */
+static tls_session_cache_t *__tls_session_find(uint32_t key)
+{
+    int i;
+
+    for (i = 0; i < TLS_SESSION_CACHE_NUM; i++) {
+        if (s_session_cache[i].data && s_session_cache[i].key == key) {
+            return &s_session_cache[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* caller holds s_tls_cache_mutex, data is taken by the cache */
+static void __tls_session_store(uint32_t key, uint8_t *data, size_t len)
+{
+    tls_session_cache_t *entry = __tls_session_find(key);
+    int i;
+
+    if (NULL == entry) {
+        entry = &s_session_cache[0];
+        for (i = 1; i < TLS_SESSION_CACHE_NUM && entry->data; i++) {
+            if (NULL == s_session_cache[i].data || s_session_cache[i].used < entry->used) {
+                entry = &s_session_cache[i];
+            }
+        }
+    }
+
+    if (entry->data) {
+        tal_free(entry->data);
+    }
+    entry->key = key;
+    entry->data = data;
+    entry->len = len;
+    entry->used = ++s_tls_cache_stamp;
+}
+
+/**
+ * @brief offer the last session to the host, the server decides to resume it
+ * or to do a full handshake
+ *
+ * @param[in] tls_context: tls context, ssl setup done
+ *
+ * @return none
+ */
+static void __tls_session_resume(tuya_mbedtls_context_t *tls_context)
+{
+    uint32_t key = __tls_session_key(tls_context);
+    tls_session_cache_t *entry = NULL;
+    mbedtls_ssl_session session;
+
+    tal_mutex_lock(s_tls_cache_mutex);
+    entry = __tls_session_find(key);
+#if defined(ENABLE_TLS_SESSION_PERSIST) && (ENABLE_TLS_SESSION_PERSIST == 1)
+    if (NULL == entry) {
+        char kv_key[16];
+        uint8_t *data = NULL;
+        size_t len = 0;
+
+        snprintf(kv_key, sizeof(kv_key), TLS_SESSION_KV_KEY, key);
+        if (OPRT_OK == tal_kv_get(kv_key, &data, &len)) {
+            uint8_t *copy = tal_malloc(len);
+            if (copy) {
+                memcpy(copy, data, len);
+                __tls_session_store(key, copy, len);
+                entry = __tls_session_find(key);
+            }
+            tal_kv_free(data);
+        }
+    }
+#endif
+    if (entry) {
+        mbedtls_ssl_session_init(&session);
+        if (0 == mbedtls_ssl_session_load(&session, entry->data, entry->len) &&
+            0 == mbedtls_ssl_set_session(&tls_context->ssl_ctx, &session)) {
+            entry->used = ++s_tls_cache_stamp;
+            PR_DEBUG("tls session of %s offered", tls_context->config.hostname);
+        }
+        mbedtls_ssl_session_free(&session);
+    }
+    tal_mutex_unlock(s_tls_cache_mutex);
+}
+
+/**
+ * @brief keep the session of the handshake done, drop the old one if failed
+ *
+ * @param[in] tls_context: tls context
+ * @param[in] ok: handshake result
+ *
+ * @return none
+ */
+static void __tls_session_update(tuya_mbedtls_context_t *tls_context, bool ok)
+{
+    uint32_t key = __tls_session_key(tls_context);
+    mbedtls_ssl_session session;
+    uint8_t *data = NULL;
+    size_t len = 0;
+
+    if (ok) {
+        mbedtls_ssl_session_init(&session);
+        if (0 == mbedtls_ssl_get_session(&tls_context->ssl_ctx, &session) &&
+            MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL == mbedtls_ssl_session_save(&session, NULL, 0, &len)) {
+            data = tal_malloc(len);
+            if (data && 0 != mbedtls_ssl_session_save(&session, data, len, &len)) {
+                tal_free(data);
+                data = NULL;
+            }
+        }
+        mbedtls_ssl_session_free(&session);
+    }
+
+    tal_mutex_lock(s_tls_cache_mutex);
+#if defined(ENABLE_TLS_SESSION_PERSIST) && (ENABLE_TLS_SESSION_PERSIST == 1)
+    char kv_key[16];
+    snprintf(kv_key, sizeof(kv_key), TLS_SESSION_KV_KEY, key);
+    if (data) {
+        tal_kv_set(kv_key, data, len);
+    } else if (!ok) {
+        tal_kv_del(kv_key);
+    }
+#endif
+    if (data) {
+        __tls_session_store(key, data, len);
+    } else {
+        tls_session_cache_t *entry = __tls_session_find(key);
+        if (entry) {
+            tal_free(entry->data);
+            memset(entry, 0, sizeof(tls_session_cache_t));
+        }
+    }
+    tal_mutex_unlock(s_tls_cache_mutex);
+}
+#endif
+
 static int tuya_tls_ciphersuite_list_PSK[] = {MBEDTLS_TLS_ECDHE_PSK_WITH_AES_128_CBC_SHA256, 0};
 
 static void mbedtls_cert_pkey_free(tuya_tls_hander p_tls_handler)
@@ -319,6 +581,12 @@ static void mbedtls_cert_pkey_free(tuya_tls_hander p_tls_handler)
     PR_DEBUG("mbedtls_cert_pkey_free.");
 
     if (config->ca_cert) {
+#if defined(ENABLE_TLS_CA_CACHE) && (ENABLE_TLS_CA_CACHE == 1)
+        if (tls_context->ca_cache) {
+            __tls_ca_cache_put(tls_context->ca_cache);
+            tls_context->ca_cache = NULL;
+        }
+#endif
         mbedtls_x509_crt_free(&tls_context->cacert);
     } else if (config->client_cert && config->client_pkey) {
         mbedtls_x509_crt_free(&tls_context->cacert);
@@ -348,7 +616,15 @@ static OPERATE_RET mbedtls_cert_pkey_parse(tuya_tls_hander p_tls_handler)
     // parse ca cert
     if (config->ca_cert) {
         PR_DEBUG("load root ca cert.");
-        op_ret = mbedtls_x509_crt_parse(p_cert_ctx, (const unsigned char *)config->ca_cert, config->ca_cert_size);
+#if defined(ENABLE_TLS_CA_CACHE) && (ENABLE_TLS_CA_CACHE == 1)
+        op_ret = __tls_ca_cache_get(config->ca_cert, config->ca_cert_size, tls_context->ca_crc, &tls_context->ca_cache);
+        if (op_ret == OPRT_OK && tls_context->ca_cache) {
+            p_cert_ctx = &tls_context->ca_cache->crt;
+        } else if (op_ret == OPRT_OK)
+#endif
+        {
+            op_ret = mbedtls_x509_crt_parse(p_cert_ctx, (const unsigned char *)config->ca_cert, config->ca_cert_size);
+        }
         if (op_ret != OPRT_OK) {
             PR_ERR("mbedtls_x509_crt_parse Fail. 0x%x %d", -op_ret, op_ret);
             return op_ret;
@@ -425,6 +701,14 @@ OPERATE_RET tuya_tls_init(void)
     }
     mbedtls_ctr_drbg_set_prediction_resistance(&ty_ctr_drbg, MBEDTLS_CTR_DRBG_PR_OFF);
 
+    if (NULL == s_tls_cache_mutex) {
+        op_ret = tal_mutex_create_init(&s_tls_cache_mutex);
+        if (op_ret) {
+            PR_ERR("tls cache mutex create fail. %d", op_ret);
+            goto exit;
+        }
+    }
+
     PR_NOTICE("tuya_tls_init ok!");
 
     return OPRT_OK;
@@ -549,6 +833,7 @@ tuya_tls_config_t *tuya_tls_config_get(tuya_tls_hander p_tls_handler)
 OPERATE_RET tuya_tls_connect(tuya_tls_hander p_tls_handler, char *hostname, int port_num, int socket_fd, int overtime_s)
 {
     OPERATE_RET op_ret;
+    bool resume = false;
     tuya_mbedtls_context_t *tls_context = (tuya_mbedtls_context_t *)p_tls_handler;
 
     if (NULL == p_tls_handler || socket_fd < 0) {
@@ -561,6 +846,10 @@ OPERATE_RET tuya_tls_connect(tuya_tls_hander p_tls_handler, char *hostname, int
     tls_context->config.timeout = overtime_s;
     tls_context->config.exception_cb =
         tls_context->config.exception_cb == NULL ? __tuya_tls_event_cb : tls_context->config.exception_cb;
+    tls_context->ca_crc = 0;
+    if (tls_context->config.ca_cert) {
+        tls_context->ca_crc = hash_crc32i_total(tls_context->config.ca_cert, tls_context->config.ca_cert_size);
+    }
 
 #if defined(TLS_MEM_DEBUG) && (TLS_MEM_DEBUG == 1) && (OPERATING_SYSTEM != SYSTEM_LINUX)
     PR_NOTICE("xPortGetFreeHeapSize=%d,xPortGetMinimumEverFreeHeapSize=%d\n", xPortGetFreeHeapSize(),
@@ -619,6 +908,10 @@ OPERATE_RET tuya_tls_connect(tuya_tls_hander p_tls_handler, char *hostname, int
                 mbedtls_cert_pkey_free(p_tls_handler);
                 return op_ret;
             }
+#if defined(ENABLE_TLS_SESSION_RESUME) && (ENABLE_TLS_SESSION_RESUME == 1)
+            // a session is only kept after the server cert is verified
+            resume = tls_context->config.verify && (NULL != s_tls_cache_mutex);
+#endif
         }
         mbedtls_ssl_conf_ciphersuites(p_conf_ctx, tuya_tls_ciphersuite_list);
     }
@@ -631,6 +924,11 @@ OPERATE_RET tuya_tls_connect(tuya_tls_hander p_tls_handler, char *hostname, int
         }
         goto tuya_tls_connect_EXIT;
     }
+#if defined(ENABLE_TLS_SESSION_RESUME) && (ENABLE_TLS_SESSION_RESUME == 1)
+    if (resume) {
+        __tls_session_resume(tls_context);
+    }
+#endif
 
     /* BIO default config */
     tls_context->socket_fd = socket_fd;
@@ -640,6 +938,7 @@ OPERATE_RET tuya_tls_connect(tuya_tls_hander p_tls_handler, char *hostname, int
     PR_DEBUG("socket fd is set. set to inner send/recv to handshake");
 
     TIME_T cur_time = tal_time_get_posix();
+    SYS_TIME_T start_ms = tal_system_get_millisecond();
 
     while ((op_ret = mbedtls_ssl_handshake(p_ssl_ctx)) != 0) {
         if (op_ret == MBEDTLS_ERR_X509_CERT_VERIFY_FAILED) {
@@ -670,15 +969,28 @@ OPERATE_RET tuya_tls_connect(tuya_tls_hander p_tls_handler, char *hostname, int
         /* In real life, we probably want to bail out when ret != 0 */
         if ((handshake_flags = mbedtls_ssl_get_verify_result(p_ssl_ctx)) != 0) {
             PR_ERR("mbedtls_ssl_get_verify_result failed, flag %d", handshake_flags);
+#if defined(ENABLE_TLS_SESSION_RESUME) && (ENABLE_TLS_SESSION_RESUME == 1)
+            // the server is not trusted any more, its old session must not be resumed next time
+            if (resume) {
+                __tls_session_update(tls_context, false);
+            }
+#endif
             goto tuya_tls_connect_EXIT;
         }
     }
 
+#if defined(ENABLE_TLS_SESSION_RESUME) && (ENABLE_TLS_SESSION_RESUME == 1)
+    if (resume) {
+        __tls_session_update(tls_context, op_ret == OPRT_OK);
+    }
+#endif
+
     if (op_ret != OPRT_OK) {
         goto tuya_tls_connect_EXIT;
     }
 
-    PR_DEBUG("handshake finish for %s. set send/recv to user set", (hostname ? hostname : ""));
+    PR_DEBUG("handshake finish for %s in %dms. set send/recv to user set", (hostname ? hostname : ""),
+             (int)(tal_system_get_millisecond() - start_ms));
     if (tls_context->config.f_send && tls_context->config.f_recv) {
         mbedtls_ssl_set_bio(p_ssl_ctx, tls_context->config.user_data, tls_context->config.f_send,
                             tls_context->config.f_recv, NULL);
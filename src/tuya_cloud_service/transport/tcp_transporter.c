@@ -336,6 +336,54 @@ OPERATE_RET tuya_tcp_transporter_write(tuya_transporter_t t, uint8_t *buf, int l
     return ret;
 }
 
+/**
+ * @brief Writes several buffers to the TCP transporter as one send.
+ *
+ * The buffers go to the socket in one sendmsg, a header and its payload leave
+ * in one segment with Nagle disabled and nothing is copied. Only the first
+ * TAL_NET_SENDV_MAX buffers are sent, the caller goes on from the returned
+ * length like after a short write.
+ *
+ * @param t The TCP transporter.
+ * @param iov The buffers to be written.
+ * @param iovcnt The number of buffers.
+ * @param timeout_ms The timeout value in milliseconds.
+ * @return The number of bytes written, or a negative error code on failure.
+ */
+OPERATE_RET tuya_tcp_transporter_writev(tuya_transporter_t t, const tuya_transporter_iovec_t *iov, int iovcnt,
+                                        int timeout_ms)
+{
+    int i = 0, ret = OPRT_COM_ERROR;
+    TUYA_NET_IOVEC_T vec[TAL_NET_SENDV_MAX];
+    tuya_tcp_transporter_t tcp_transporter = (tuya_tcp_transporter_t)t;
+    if (tcp_transporter->socket_fd < 0) {
+        PR_ERR("socket fd:%d", tcp_transporter->socket_fd);
+        return OPRT_INVALID_PARM;
+    }
+
+    if (timeout_ms > 0 && tuya_tcp_transporter_poll_write(t, timeout_ms) <= 0) {
+        return OPRT_RESOURCE_NOT_READY;
+    }
+
+    if (iovcnt > TAL_NET_SENDV_MAX) {
+        iovcnt = TAL_NET_SENDV_MAX;
+    }
+    for (i = 0; i < iovcnt; i++) {
+        vec[i].buf = iov[i].buf;
+        vec[i].len = iov[i].len;
+    }
+
+    ret = tal_net_sendv(tcp_transporter->socket_fd, vec, iovcnt);
+    if (ret < 0) {
+        if ((tal_net_get_errno() == UNW_EINTR) || (tal_net_get_errno() == UNW_EAGAIN)) {
+            tal_system_sleep(30);
+            ret = tal_net_sendv(tcp_transporter->socket_fd, vec, iovcnt);
+        }
+    }
+
+    return ret;
+}
+
 /**
  * @brief Destroys a TCP transporter.
  *
@@ -377,6 +425,7 @@ tuya_transporter_t tuya_tcp_transporter_create(void)
     tuya_transporter_set_func((tuya_transporter_t)&t->base, tuya_tcp_transporter_connect, tuya_tcp_transporter_close,
                               tuya_tcp_transporter_read, tuya_tcp_transporter_write, tuya_tcp_transporter_poll_read,
                               tuya_tcp_transporter_poll_write, tuya_tcp_transporter_destroy, tuya_tcp_transporter_ctrl);
+    tuya_transporter_set_writev((tuya_transporter_t)&t->base, tuya_tcp_transporter_writev);
 
     return &t->base;
 }
@@ -28,6 +28,11 @@
 #include "tal_memory.h"
 #include "tuya_tls.h"
 
+/* the buffers of a vectored write are gathered up to it and sent as one record */
+#ifndef TLS_TRANSPORTER_WRITEV_GATHER_LEN
+#define TLS_TRANSPORTER_WRITEV_GATHER_LEN (1024)
+#endif
+
 typedef struct tls_transporter_inter_t {
     struct tuya_transporter_inter_t base;
     tuya_transporter_t tcp_transporter;
@@ -36,6 +41,7 @@ typedef struct tls_transporter_inter_t {
     int socket_fd;
     int write_timeout;
     int read_timeout;
+    uint8_t *gather; // allocated by the first vectored write, kept for the next
 } * tuya_tls_transporter_t;
 
 static int __tls_transporter_send_cb(void *ctx, const unsigned char *buf, size_t len)
@@ -182,6 +188,36 @@ OPERATE_RET tuya_tls_transporter_write(tuya_transporter_t t, uint8_t *buf, int l
     return tuya_tls_write(tls_transporter->tls_handler, buf, len);
 }
 
+/**
+ * @brief Writes several buffers to the TLS transporter as one record.
+ *
+ * Every write is encrypted into a record of its own, so the buffers are
+ * gathered and a header and a payload of up to
+ * TLS_TRANSPORTER_WRITEV_GATHER_LEN bytes together cost one record header and
+ * tag. The record is built in a copy anyway, the gather adds one copy of the
+ * plaintext. Without memory for the gather buffer, the buffers are written
+ * one by one.
+ *
+ * @param t The TLS transporter object.
+ * @param iov The buffers to be written.
+ * @param iovcnt The number of buffers.
+ * @param timeout_ms The timeout value in milliseconds for the write operation.
+ *
+ * @return The number of bytes written, or a negative error code on failure.
+ */
+OPERATE_RET tuya_tls_transporter_writev(tuya_transporter_t t, const tuya_transporter_iovec_t *iov, int iovcnt,
+                                        int timeout_ms)
+{
+    tuya_tls_transporter_t tls_transporter = (tuya_tls_transporter_t)t;
+
+    if (NULL == tls_transporter->gather) {
+        tls_transporter->gather = tal_malloc(TLS_TRANSPORTER_WRITEV_GATHER_LEN);
+    }
+
+    return tuya_transporter_writev_gather(t, iov, iovcnt, timeout_ms, tls_transporter->gather,
+                                          TLS_TRANSPORTER_WRITEV_GATHER_LEN);
+}
+
 /**
  * @brief Reads data from the TLS transporter.
  *
@@ -270,6 +306,7 @@ tuya_transporter_t tuya_tls_transporter_create(void)
     tuya_transporter_set_func((tuya_transporter_t)&t->base, tuya_tls_transporter_connect, tuya_tls_transporter_close,
                               tuya_tls_transporter_read, tuya_tls_transporter_write, tuya_tls_transporter_poll_read,
                               NULL, tuya_tls_transporter_destroy, tuya_tls_transporter_ctrl);
+    tuya_transporter_set_writev((tuya_transporter_t)&t->base, tuya_tls_transporter_writev);
     t->tcp_transporter = tuya_tcp_transporter_create();
     t->tls_handler = tuya_tls_connect_create();
     if (t->tls_handler == NULL) {
@@ -304,6 +341,9 @@ OPERATE_RET tuya_tls_transporter_destroy(tuya_transporter_t transporter)
     t->tls_handler = NULL;
 
     tuya_tcp_transporter_destroy(t->tcp_transporter);
+    if (t->gather) {
+        tal_free(t->gather);
+    }
     if (t) {
         tal_free(t);
     }
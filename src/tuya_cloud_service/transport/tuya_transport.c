@@ -30,6 +30,11 @@
 
 #define MAX_TRANSPORTER_NUM (2)
 
+/* small buffers of a vectored write are gathered on stack and written together */
+#ifndef TRANSPORTER_WRITEV_GATHER_LEN
+#define TRANSPORTER_WRITEV_GATHER_LEN (256)
+#endif
+
 struct tuya_transport_array_handle {
     tuya_transporter_t array[MAX_TRANSPORTER_NUM];
     uint8_t index;
@@ -215,6 +220,116 @@ OPERATE_RET tuya_transporter_write(tuya_transporter_t t, uint8_t *buf, int len,
     return OPRT_INVALID_PARM;
 }
 
+static int __transporter_write_part(tuya_transporter_t t, uint8_t *buf, int len, int timeout_ms, int *written)
+{
+    int ret = t->f_write(t, buf, len, timeout_ms);
+    if (ret < 0) {
+        return (*written > 0) ? *written : ret;
+    }
+
+    *written += ret;
+    return (ret < len) ? *written : OPRT_OK;
+}
+
+/**
+ * @brief Writes several buffers through the write function of the transporter.
+ *
+ * The buffers are gathered in the given buffer, a buffer too large for it is
+ * written from the caller memory after its start topped up the gathered bytes.
+ * A header and a short payload go out in one write, one segment or one TLS
+ * record, and nothing is allocated. The write stops at the first short write,
+ * like tuya_transporter_write does.
+ *
+ * @param t The Tuya transporter to write data to.
+ * @param iov The buffers to be written.
+ * @param iovcnt The number of buffers.
+ * @param timeout_ms The timeout value in milliseconds for the write operation.
+ * @param gather The gather buffer, NULL to write buffer by buffer.
+ * @param gather_size The size of the gather buffer.
+ *
+ * @return The number of bytes written, or a negative error code on failure.
+ */
+OPERATE_RET tuya_transporter_writev_gather(tuya_transporter_t t, const tuya_transporter_iovec_t *iov, int iovcnt,
+                                           int timeout_ms, uint8_t *gather, int gather_size)
+{
+    int i = 0, offset = 0, copy_len = 0, gather_len = 0, written = 0, ret = OPRT_OK;
+
+    if (NULL == t || NULL == t->f_write || NULL == iov || iovcnt <= 0) {
+        return OPRT_INVALID_PARM;
+    }
+    if (NULL == gather) {
+        gather_size = 0;
+    }
+
+    for (i = 0; i < iovcnt; i++) {
+        offset = 0;
+        while (offset < iov[i].len) {
+            if (0 == gather_len && iov[i].len - offset > gather_size) {
+                ret = __transporter_write_part(t, iov[i].buf + offset, iov[i].len - offset, timeout_ms, &written);
+                if (OPRT_OK != ret) {
+                    return ret;
+                }
+                break;
+            }
+
+            copy_len = iov[i].len - offset;
+            if (copy_len > gather_size - gather_len) {
+                copy_len = gather_size - gather_len;
+            }
+            memcpy(gather + gather_len, iov[i].buf + offset, copy_len);
+            gather_len += copy_len;
+            offset += copy_len;
+
+            if (gather_len == gather_size) {
+                ret = __transporter_write_part(t, gather, gather_len, timeout_ms, &written);
+                if (OPRT_OK != ret) {
+                    return ret;
+                }
+                gather_len = 0;
+            }
+        }
+    }
+
+    if (gather_len > 0) {
+        ret = __transporter_write_part(t, gather, gather_len, timeout_ms, &written);
+        if (OPRT_OK != ret) {
+            return ret;
+        }
+    }
+
+    return written;
+}
+
+/**
+ * @brief Writes several buffers to the Tuya transporter as one write.
+ *
+ * The transporter without a vectored write function gets the buffers gathered
+ * on stack by tuya_transporter_writev_gather. TCP sends them in one sendmsg,
+ * TLS gathers them in a buffer of a record, websocket joins them in a message.
+ *
+ * @param t The Tuya transporter to write data to.
+ * @param iov The buffers to be written.
+ * @param iovcnt The number of buffers.
+ * @param timeout_ms The timeout value in milliseconds for the write operation.
+ *
+ * @return The number of bytes written, or a negative error code on failure.
+ */
+OPERATE_RET tuya_transporter_writev(tuya_transporter_t t, const tuya_transporter_iovec_t *iov, int iovcnt,
+                                    int timeout_ms)
+{
+    uint8_t gather[TRANSPORTER_WRITEV_GATHER_LEN];
+
+    if (NULL == t || NULL == iov || iovcnt <= 0) {
+        return OPRT_INVALID_PARM;
+    }
+
+    if (t->f_writev) {
+        return t->f_writev(t, iov, iovcnt, timeout_ms);
+    }
+
+    return tuya_transporter_writev_gather(t, iov, iovcnt, timeout_ms, gather, sizeof(gather));
+}
+
 /**
  * @brief Reads data from the transport layer using polling.
  *
@@ -357,3 +472,22 @@ tuya_transporter_set_func(tuya_transporter_t t, transporter_connect_fn connect,
 
     return OPRT_OK;
 }
+
+/**
+ * @brief Sets the vectored write function of the transporter.
+ *
+ * @param t The Tuya transporter object.
+ * @param writev The function pointer to the vectored write operation, NULL to
+ * gather the buffers and call the write operation.
+ * @return The operation result status.
+ */
+OPERATE_RET tuya_transporter_set_writev(tuya_transporter_t t, transporter_writev_fn writev)
+{
+    if (NULL == t) {
+        return OPRT_INVALID_PARM;
+    }
+
+    t->f_writev = writev;
+
+    return OPRT_OK;
+}
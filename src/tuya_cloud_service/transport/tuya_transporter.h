@@ -74,6 +74,18 @@ typedef OPERATE_RET (*transporter_read_fn)(tuya_transporter_t transporter, uint8
 
 typedef OPERATE_RET (*transporter_write_fn)(tuya_transporter_t transporter, uint8_t *buf, int len, int timeout_ms);
 
+/**
+ * @brief one buffer of a vectored write
+ *
+ */
+typedef struct {
+    uint8_t *buf;
+    int len;
+} tuya_transporter_iovec_t;
+
+typedef OPERATE_RET (*transporter_writev_fn)(tuya_transporter_t transporter, const tuya_transporter_iovec_t *iov,
+                                             int iovcnt, int timeout_ms);
+
 typedef OPERATE_RET (*transporter_poll_read_fn)(tuya_transporter_t transporter, int timeout_ms);
 
 typedef OPERATE_RET (*transporter_poll_write_fn)(tuya_transporter_t transporter, int timeout_ms);
@@ -92,6 +104,7 @@ struct tuya_transporter_inter_t {
     transporter_close_fn f_close;
     transporter_destroy_fn f_destroy;
     transporter_ctrl f_ctrl;
+    transporter_writev_fn f_writev; // optional, NULL to gather and call f_write
 };
 
 /**
@@ -233,6 +246,43 @@ OPERATE_RET tuya_transporter_read(tuya_transporter_t transporter, uint8_t *buf,
  */
 OPERATE_RET tuya_transporter_write(tuya_transporter_t transporter, uint8_t *buf, int len, int timeout_ms);
 
+/**
+ * @brief Writes several buffers to the specified transporter as one write.
+ *
+ * The buffers are sent in order, as if they were concatenated and passed to
+ * tuya_transporter_write, so a header, a payload and a trailer can be sent
+ * without being copied into one buffer first. A message oriented transporter
+ * sends them as one message. Like a write, it may write less than asked.
+ *
+ * @param transporter The transporter to write data to.
+ * @param iov The buffers to be written, a buffer with len 0 is skipped.
+ * @param iovcnt The number of buffers.
+ * @param timeout_ms The timeout value in milliseconds for the write operation.
+ * @return The number of bytes written on success, or a negative error code on
+ * failure.
+ */
+OPERATE_RET tuya_transporter_writev(tuya_transporter_t transporter, const tuya_transporter_iovec_t *iov, int iovcnt,
+                                    int timeout_ms);
+
+/**
+ * @brief Writes several buffers through the write function of the transporter,
+ * gathered in the given buffer so that short buffers go out in one write.
+ *
+ * It is the vectored write of a transporter without its own, and a helper for
+ * a transporter that keeps a gather buffer of its own size.
+ *
+ * @param transporter The transporter to write data to.
+ * @param iov The buffers to be written, a buffer with len 0 is skipped.
+ * @param iovcnt The number of buffers.
+ * @param timeout_ms The timeout value in milliseconds for the write operation.
+ * @param gather The gather buffer, NULL to write buffer by buffer.
+ * @param gather_size The size of the gather buffer.
+ * @return The number of bytes written on success, or a negative error code on
+ * failure.
+ */
+OPERATE_RET tuya_transporter_writev_gather(tuya_transporter_t transporter, const tuya_transporter_iovec_t *iov,
+                                           int iovcnt, int timeout_ms, uint8_t *gather, int gather_size);
+
 /**
  * @brief Reads data from the transporter using polling mechanism.
  *
@@ -313,6 +363,16 @@ OPERATE_RET tuya_transporter_set_func(tuya_transporter_t transporter, transporte
                                       transporter_poll_read_fn poll_read, transporter_poll_read_fn poll_write,
                                       transporter_destroy_fn destroy, transporter_ctrl ctrl);
 
+/**
+ * @brief Set the vectored write function of the transporter
+ *
+ * @param transporter: the transporter
+ * @param writev: vectored write function, NULL to gather the buffers and call the write function
+ *
+ * @return OPERATE_RET: 0: Success; <0: Please refer to the Tuya error code documentation for description
+ */
+OPERATE_RET tuya_transporter_set_writev(tuya_transporter_t transporter, transporter_writev_fn writev);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -156,6 +156,53 @@ OPERATE_RET websocket_transporter_write(tuya_transporter_t t, uint8_t *buf, int
     return websocket_client_send_bin(wst->ws_client, buf, len);
 }
 
+/**
+ * @brief Writes several buffers to the WebSocket transporter as one message.
+ *
+ * The frame is masked while it is copied into the send buffer of the client,
+ * so the buffers are joined first, the peer still gets one message.
+ *
+ * @param t The WebSocket transporter.
+ * @param iov The buffers to be written.
+ * @param iovcnt The number of buffers.
+ * @param timeout_ms The timeout value in milliseconds.
+ * @return The number of bytes written, or a negative error code.
+ */
+OPERATE_RET websocket_transporter_writev(tuya_transporter_t t, const tuya_transporter_iovec_t *iov, int iovcnt,
+                                         int timeout_ms)
+{
+    int i = 0, len = 0, offset = 0;
+    uint8_t *buf = NULL;
+    OPERATE_RET rt = OPRT_OK;
+    tuya_websocket_transporter_t wst = (tuya_websocket_transporter_t)t;
+
+    for (i = 0; i < iovcnt; i++) {
+        len += (iov[i].len > 0) ? iov[i].len : 0;
+    }
+
+    if (1 == iovcnt) {
+        buf = iov[0].buf;
+    } else {
+        buf = Malloc(len);
+        if (NULL == buf) {
+            return OPRT_MALLOC_FAILED;
+        }
+        for (i = 0; i < iovcnt; i++) {
+            if (iov[i].len > 0) {
+                memcpy(buf + offset, iov[i].buf, iov[i].len);
+                offset += iov[i].len;
+            }
+        }
+    }
+
+    rt = websocket_client_send_bin(wst->ws_client, buf, len);
+    if (buf != iov[0].buf) {
+        Free(buf);
+    }
+
+    return (OPRT_OK == rt) ? len : rt;
+}
+
 /**
  * @brief Polls the WebSocket transporter for incoming data to read.
  *
@@ -261,6 +308,7 @@ tuya_transporter_t tuya_websocket_transporter_create()
                               websocket_transporter_close, websocket_transporter_read, websocket_transporter_write,
                               websocket_transporter_poll_read, NULL, tuya_websocket_transporter_destroy,
                               websocket_transporter_ctrl);
+    tuya_transporter_set_writev((tuya_transporter_t)t, websocket_transporter_writev);
 
     tal_mutex_create_init(&t->mutex);
 
@@ -0,0 +1,428 @@
+/**
+ * @file test_dp_coalesce.cpp
+ * @brief UT and benchmark of the dp report coalescing of tuya_iot_dp.
+ *
+ * The clock is simulated: the delayed works are faked and run by the test and
+ * the millisecond time is offset to it, so 10 s of reports take no time. The publish is the broker stand-in, it keeps
+ * every message and acks it on the next step of the clock. A dimmer reports at
+ * 50 Hz, a sensor at 10 Hz and a switch toggles every second. The messages,
+ * the bytes and the delay of the values are printed for the minimum intervals
+ * under test, the build without ENABLE_DP_REPORT_COALESCE prints the one
+ * message per report it replaces. The last value of every dp has to be the
+ * last published one and the switch has to go out at once.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "cJSON.h"
+#include "tuya_iot.h"
+#include "tuya_iot_dp.h"
+#include "tuya_lan.h"
+#include "mqtt_service.h"
+#include "dp_schema.h"
+}
+
+#ifndef DP_REPORT_COALESCE_WINDOW
+#define DP_REPORT_COALESCE_WINDOW 50
+#endif
+
+#define COALESCE_RUN_MS 10000
+#define DP_SWITCH       1
+#define DP_DIMMER       2
+#define DP_SENSOR       3
+
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+#define COALESCE_BUILD "coalesce"
+#else
+#define COALESCE_BUILD "no coalesce"
+#endif
+
+static const char *s_schema_json =
+    "[{\"id\":1,\"mode\":\"rw\",\"trigger\":\"direct\",\"type\":\"obj\",\"property\":{\"type\":\"bool\"}},"
+    "{\"id\":2,\"mode\":\"rw\",\"trigger\":\"direct\",\"type\":\"obj\","
+    "\"property\":{\"type\":\"value\",\"min\":0,\"max\":1000000}},"
+    "{\"id\":3,\"mode\":\"ro\",\"trigger\":\"direct\",\"type\":\"obj\","
+    "\"property\":{\"type\":\"value\",\"min\":0,\"max\":1000000}}]";
+
+/* simulated clock, the delayed works run on it */
+struct delayed_work_t {
+    WORKQUEUE_CB cb;
+    void *data;
+    uint64_t due;
+    bool active;
+};
+
+static uint64_t s_now_ms;
+static std::vector<delayed_work_t *> s_works;
+
+/* broker stand-in */
+struct report_msg_t {
+    std::string payload;
+    mqtt_publish_notify_cb_t cb;
+    void *user_data;
+};
+
+static std::vector<report_msg_t> s_inflight;
+static std::vector<report_msg_t> s_received;
+static std::map<int, std::string> s_cloud; // dpid -> value
+static int s_sync_msg;
+static std::function<void(void)> s_on_publish; // runs in the publish, while the flush is in progress
+
+/* delay of the values, from the first update not published to the message */
+static std::map<int, uint64_t> s_pending_since;
+static std::map<int, std::vector<uint64_t>> s_delay;
+
+static tuya_iot_client_t s_client;
+
+extern "C" {
+extern SYS_TIME_T g_sys_time_offset;
+
+OPERATE_RET tal_workq_init_delayed(WORKQ_SERVICE_E service, WORKQUEUE_CB cb, void *data,
+                                   DELAYED_WORK_HANDLE *delayed_work)
+{
+    delayed_work_t *work = new delayed_work_t{cb, data, 0, false};
+    s_works.push_back(work);
+    *delayed_work = work;
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_workq_start_delayed(DELAYED_WORK_HANDLE delayed_work, TIME_MS interval, LOOP_TYPE type)
+{
+    delayed_work_t *work = (delayed_work_t *)delayed_work;
+    work->due = s_now_ms + interval;
+    work->active = true;
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_workq_stop_delayed(DELAYED_WORK_HANDLE delayed_work)
+{
+    ((delayed_work_t *)delayed_work)->active = false;
+    return OPRT_OK;
+}
+
+/* frees the work as the real one does, a handle used after it never runs again */
+OPERATE_RET tal_workq_cancel_delayed(DELAYED_WORK_HANDLE delayed_work)
+{
+    delayed_work_t *work = (delayed_work_t *)delayed_work;
+    s_works.erase(std::remove(s_works.begin(), s_works.end(), work), s_works.end());
+    delete work;
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_workq_schedule(WORKQ_SERVICE_E service, WORKQUEUE_CB cb, void *data)
+{
+    cb(data);
+    return OPRT_OK;
+}
+
+bool tuya_iot_is_connected(void)
+{
+    return true;
+}
+
+tuya_iot_client_t *tuya_iot_client_get(void)
+{
+    return &s_client;
+}
+
+int tuya_lan_get_connect_client_num(void)
+{
+    return 0;
+}
+
+int tuya_lan_dp_report(char *dpstr)
+{
+    return OPRT_OK;
+}
+
+int tuya_iot_dp_report_json_async(tuya_iot_client_t *client, const char *dps, const char *time, tuya_dp_notify_cb_t cb,
+                                  void *user_data, int timeout_ms)
+{
+    s_sync_msg++;
+    s_inflight.push_back({std::string("{\"dps\":") + dps + "}", (mqtt_publish_notify_cb_t)cb, user_data});
+    return OPRT_OK;
+}
+
+int tuya_mqtt_protocol_data_publish_common(tuya_mqtt_context_t *context, uint16_t protocol_id, const uint8_t *data,
+                                           uint16_t length, mqtt_publish_notify_cb_t cb, void *user_data,
+                                           int timeout_ms, bool async)
+{
+    report_msg_t msg = {std::string((const char *)data, length), cb, user_data};
+    cJSON *root = cJSON_Parse(msg.payload.c_str());
+    cJSON *dps = cJSON_GetObjectItem(root, "dps");
+
+    for (cJSON *dp = dps ? dps->child : NULL; dp; dp = dp->next) {
+        int dpid = atoi(dp->string);
+        if (s_pending_since.count(dpid)) {
+            s_delay[dpid].push_back(s_now_ms - s_pending_since[dpid]);
+            s_pending_since.erase(dpid);
+        }
+    }
+    cJSON_Delete(root);
+    s_inflight.push_back(msg);
+    if (s_on_publish) {
+        s_on_publish();
+    }
+    return OPRT_OK;
+}
+}
+
+/* tal_system_get_millisecond follows the simulated clock */
+static void clock_set(uint64_t now_ms)
+{
+    s_now_ms = now_ms;
+    g_sys_time_offset += (SYS_TIME_T)s_now_ms - tal_system_get_millisecond();
+}
+
+/* the broker acks the messages sent so far, the dps are applied to the cloud state */
+static void broker_answer(void)
+{
+    std::vector<report_msg_t> inflight;
+    inflight.swap(s_inflight);
+
+    for (auto &msg : inflight) {
+        cJSON *root = cJSON_Parse(msg.payload.c_str());
+        ASSERT_NE(nullptr, root);
+        cJSON *dps = cJSON_GetObjectItem(root, "dps");
+        ASSERT_NE(nullptr, dps);
+        for (cJSON *dp = dps->child; dp; dp = dp->next) {
+            char *value = cJSON_PrintUnformatted(dp);
+            s_cloud[atoi(dp->string)] = value;
+            cJSON_free(value);
+        }
+        cJSON_Delete(root);
+        s_received.push_back(msg);
+        msg.cb(OPRT_OK, msg.user_data);
+    }
+}
+
+/* run the works due until the time, in the order they are due, the broker answers on every step */
+static void run_until(uint64_t until_ms)
+{
+    while (true) {
+        delayed_work_t *next = NULL;
+        broker_answer();
+        for (auto work : s_works) {
+            if (work->active && work->due <= until_ms && (NULL == next || work->due < next->due)) {
+                next = work;
+            }
+        }
+        if (NULL == next) {
+            break;
+        }
+        clock_set(std::max(s_now_ms, next->due));
+        next->active = false;
+        next->cb(next->data);
+    }
+    clock_set(std::max(s_now_ms, until_ms));
+}
+
+class DpCoalesceTest : public testing::Test {
+  protected:
+    std::map<int, std::string> last;
+
+    static void SetUpTestCase()
+    {
+        dp_schema_t *schema = NULL;
+
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        strcpy(s_client.activate.devid, "6c0ad0b3f29e8a1d5fqwer");
+        s_client.is_activated = true;
+        ASSERT_EQ(OPRT_OK, dp_schema_create(s_client.activate.devid, (char *)s_schema_json, &schema));
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+        ASSERT_EQ(OPRT_OK, tuya_iot_dp_report_init(&s_client));
+#endif
+    }
+
+    void SetUp() override
+    {
+        run_until(s_now_ms + 1000);
+        tuya_iot_dp_report_clear();
+        s_received.clear();
+        s_cloud.clear();
+        s_sync_msg = 0;
+        s_on_publish = nullptr;
+        s_pending_since.clear();
+        s_delay.clear();
+    }
+
+    int report(int dpid, int value)
+    {
+        dp_obj_t dp;
+
+        memset(&dp, 0, sizeof(dp));
+        dp.id = dpid;
+        if (DP_SWITCH == dpid) {
+            dp.type = PROP_BOOL;
+            dp.value.dp_bool = value;
+            last[dpid] = value ? "true" : "false";
+        } else {
+            dp.type = PROP_VALUE;
+            dp.value.dp_value = value;
+            last[dpid] = std::to_string(value);
+        }
+        if (!s_pending_since.count(dpid)) {
+            s_pending_since[dpid] = s_now_ms;
+        }
+        clock_set(s_now_ms);
+        return tuya_iot_dp_obj_report(&s_client, s_client.activate.devid, &dp, 1, 0);
+    }
+
+    /* the dimmer at 50 Hz, the sensor at 10 Hz and the switch every second, for the run time */
+    int run_reports(void)
+    {
+        uint64_t begin = s_now_ms;
+        int failed = 0, n = 0;
+
+        for (uint64_t t = 0; t < COALESCE_RUN_MS; t += 20, n++) {
+            run_until(begin + t);
+            failed += OPRT_OK != report(DP_DIMMER, 1 + n);
+            if (0 == t % 100) {
+                failed += OPRT_OK != report(DP_SENSOR, 1000 + n);
+            }
+            if (0 == t % 1000) {
+                failed += OPRT_OK != report(DP_SWITCH, (int)(t / 1000) % 2);
+            }
+        }
+        run_until(begin + COALESCE_RUN_MS + 1000);
+        return failed;
+    }
+
+    static size_t received_bytes(void)
+    {
+        size_t bytes = 0;
+        for (auto &msg : s_received) {
+            bytes += msg.payload.size();
+        }
+        return bytes;
+    }
+
+    static void delay_stat(std::initializer_list<int> dpids, double *avg, uint64_t *max)
+    {
+        uint64_t sum = 0, num = 0;
+
+        *max = 0;
+        for (int dpid : dpids) {
+            for (uint64_t ms : s_delay[dpid]) {
+                sum += ms;
+                num++;
+                *max = std::max(*max, ms);
+            }
+        }
+        *avg = num ? (double)sum / num : 0;
+    }
+};
+
+TEST_F(DpCoalesceTest, ReportBenchmark)
+{
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+    std::vector<uint32_t> intervals = {500, 200, 0};
+#else
+    std::vector<uint32_t> intervals = {0};
+#endif
+    int reports = COALESCE_RUN_MS / 20 + COALESCE_RUN_MS / 100 + COALESCE_RUN_MS / 1000;
+
+    for (uint32_t interval : intervals) {
+        tuya_iot_dp_report_stat_t before, after;
+        double avg;
+        uint64_t max, switch_max;
+
+        SetUp();
+        tuya_iot_dp_report_stat_get(&before);
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+        ASSERT_EQ(OPRT_OK, tuya_iot_dp_report_interval_set(&s_client, DP_DIMMER, interval));
+        ASSERT_EQ(OPRT_OK, tuya_iot_dp_report_interval_set(&s_client, DP_SENSOR, interval));
+#endif
+        EXPECT_EQ(0, run_reports());
+        tuya_iot_dp_report_stat_get(&after);
+
+        delay_stat({DP_SWITCH}, &avg, &switch_max);
+        delay_stat({DP_DIMMER, DP_SENSOR}, &avg, &max);
+        printf("%s, interval %u ms: %d reports in %d s, %zu messages %zu bytes %.1f msg/s, value delay avg %.0f max "
+               "%llu ms, switch delay max %llu ms\n",
+               COALESCE_BUILD, interval, reports, COALESCE_RUN_MS / 1000, s_received.size(), received_bytes(),
+               s_received.size() * 1000.0 / COALESCE_RUN_MS, avg, (unsigned long long)max,
+               (unsigned long long)switch_max);
+
+        EXPECT_EQ(last, s_cloud);
+        EXPECT_EQ(0, s_sync_msg);
+        EXPECT_EQ(0u, switch_max);
+        EXPECT_EQ((size_t)COALESCE_RUN_MS / 1000, s_delay[DP_SWITCH].size());
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+        EXPECT_EQ((uint32_t)reports, after.dp_update - before.dp_update);
+        EXPECT_EQ(s_received.size(), after.msg_sent - before.msg_sent);
+        // the real clock under the offset may tick while a work runs
+        EXPECT_LE(max, interval + DP_REPORT_COALESCE_WINDOW + 1);
+        EXPECT_LT(s_received.size(), (size_t)reports);
+#else
+        EXPECT_EQ((size_t)reports, s_received.size());
+#endif
+    }
+}
+
+#if defined(ENABLE_DP_REPORT_COALESCE) && (ENABLE_DP_REPORT_COALESCE == 1)
+TEST_F(DpCoalesceTest, HeldValueGoesWithSwitch)
+{
+    ASSERT_EQ(OPRT_OK, report(DP_DIMMER, 7));
+    run_until(s_now_ms + 10);
+    EXPECT_TRUE(s_received.empty());
+
+    /* the dimmer is due within the window of the switch and shares its message */
+    ASSERT_EQ(OPRT_OK, report(DP_SWITCH, 1));
+    run_until(s_now_ms + 1);
+    ASSERT_EQ(1u, s_received.size());
+    EXPECT_EQ("7", s_cloud[DP_DIMMER]);
+    EXPECT_EQ("true", s_cloud[DP_SWITCH]);
+}
+
+TEST_F(DpCoalesceTest, ClearDropsHeldValue)
+{
+    ASSERT_EQ(OPRT_OK, report(DP_DIMMER, 8));
+    tuya_iot_dp_report_clear();
+    run_until(s_now_ms + 1000);
+    EXPECT_TRUE(s_received.empty());
+
+    /* the slots are made again for the next report */
+    ASSERT_EQ(OPRT_OK, report(DP_DIMMER, 9));
+    run_until(s_now_ms + 1000);
+    ASSERT_EQ(1u, s_received.size());
+    EXPECT_EQ("9", s_cloud[DP_DIMMER]);
+}
+
+TEST_F(DpCoalesceTest, ClearWaitsForFlushInProgress)
+{
+    std::atomic<bool> cleared(false);
+    std::thread clearer;
+
+    // the schema is deleted by another thread while the switch is published
+    s_on_publish = [&]() {
+        s_on_publish = nullptr;
+        clearer = std::thread([&]() {
+            tuya_iot_dp_report_clear();
+            cleared = true;
+        });
+        tal_system_sleep(50);
+        EXPECT_FALSE(cleared);
+    };
+    ASSERT_EQ(OPRT_OK, report(DP_SWITCH, 1));
+    ASSERT_TRUE(clearer.joinable());
+    clearer.join();
+    EXPECT_TRUE(cleared);
+    run_until(s_now_ms + 1);
+    EXPECT_EQ("true", s_cloud[DP_SWITCH]);
+}
+#endif
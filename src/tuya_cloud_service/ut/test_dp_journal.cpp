@@ -0,0 +1,344 @@
+/**
+ * @file test_dp_journal.cpp
+ * @brief UT of the offline dp report journal of dp_journal.
+ *
+ * The clock is simulated: the delayed works of the journal are faked and run
+ * by the test and the posix time is set from it, so a 10 minute outage takes
+ * no time. The kv is a map that counts the writes, the broker stand-in takes
+ * the replay messages and acks them. 10k reports made during the outage have to end as
+ * the last value and time of every dp in the cloud after the connection is
+ * back, with the kv writes bounded by the save delay.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tal_kv.h"
+#include "cJSON.h"
+#include "tuya_iot.h"
+#include "mqtt_service.h"
+#include "dp_journal.h"
+}
+
+#ifndef DP_JOURNAL_MAX_NUM
+#define DP_JOURNAL_MAX_NUM 32
+#endif
+
+#define JOURNAL_POSIX_BASE  1700000000
+#define JOURNAL_OUTAGE_MS   (10 * 60 * 1000)
+#define JOURNAL_REPORT_NUM  10000
+#define JOURNAL_DP_NUM      20
+#define JOURNAL_SAVE_DELAY  2000 // DP_JOURNAL_SAVE_DELAY
+
+/* simulated clock, the delayed works run on it */
+struct delayed_work_t {
+    WORKQUEUE_CB cb;
+    void *data;
+    uint64_t due;
+    bool active;
+};
+
+static uint64_t s_now_ms;
+static std::vector<delayed_work_t *> s_works;
+
+/* kv stand-in */
+static std::map<std::string, std::string> s_kv;
+static int s_kv_writes;
+static size_t s_kv_bytes;
+
+/* broker stand-in */
+struct replay_msg_t {
+    std::string payload;
+    mqtt_publish_notify_cb_t cb;
+    void *user_data;
+};
+
+static bool s_online;
+static std::vector<replay_msg_t> s_inflight;
+static std::vector<replay_msg_t> s_received;
+static std::map<int, std::pair<std::string, uint32_t>> s_cloud; // dpid -> value, t
+
+extern "C" {
+OPERATE_RET tal_workq_init_delayed(WORKQ_SERVICE_E service, WORKQUEUE_CB cb, void *data,
+                                   DELAYED_WORK_HANDLE *delayed_work)
+{
+    delayed_work_t *work = new delayed_work_t{cb, data, 0, false};
+    s_works.push_back(work);
+    *delayed_work = work;
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_workq_start_delayed(DELAYED_WORK_HANDLE delayed_work, TIME_MS interval, LOOP_TYPE type)
+{
+    delayed_work_t *work = (delayed_work_t *)delayed_work;
+    work->due = s_now_ms + interval;
+    work->active = true;
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_workq_stop_delayed(DELAYED_WORK_HANDLE delayed_work)
+{
+    ((delayed_work_t *)delayed_work)->active = false;
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_workq_cancel_delayed(DELAYED_WORK_HANDLE delayed_work)
+{
+    ((delayed_work_t *)delayed_work)->active = false;
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_kv_set(const char *key, const uint8_t *value, size_t length)
+{
+    s_kv[key] = std::string((const char *)value, length);
+    s_kv_writes++;
+    s_kv_bytes += length;
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_kv_get(const char *key, uint8_t **value, size_t *length)
+{
+    auto it = s_kv.find(key);
+    if (it == s_kv.end()) {
+        return OPRT_NOT_FOUND;
+    }
+    *value = (uint8_t *)tal_malloc(it->second.size());
+    memcpy(*value, it->second.data(), it->second.size());
+    *length = it->second.size();
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_kv_free(uint8_t *value)
+{
+    tal_free(value);
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_kv_del(const char *key)
+{
+    s_kv.erase(key);
+    return OPRT_OK;
+}
+
+bool tuya_iot_is_connected(void)
+{
+    return s_online;
+}
+
+int tuya_mqtt_protocol_data_publish_common(tuya_mqtt_context_t *context, uint16_t protocol_id, const uint8_t *data,
+                                           uint16_t length, mqtt_publish_notify_cb_t cb, void *user_data,
+                                           int timeout_ms, bool async)
+{
+    if (!s_online) {
+        return OPRT_COM_ERROR;
+    }
+    s_inflight.push_back({std::string((const char *)data, length), cb, user_data});
+    return OPRT_OK;
+}
+}
+
+/* the posix time follows the simulated clock */
+static void clock_set(uint64_t now_ms)
+{
+    s_now_ms = now_ms;
+    tal_time_set_posix((TIME_T)(JOURNAL_POSIX_BASE + s_now_ms / 1000), 1);
+}
+
+/* run the works due until the time, in the order they are due */
+static void run_until(uint64_t until_ms)
+{
+    while (true) {
+        delayed_work_t *next = NULL;
+        for (auto work : s_works) {
+            if (work->active && work->due <= until_ms && (NULL == next || work->due < next->due)) {
+                next = work;
+            }
+        }
+        if (NULL == next) {
+            break;
+        }
+        clock_set(std::max(s_now_ms, next->due));
+        next->active = false;
+        next->cb(next->data);
+    }
+    clock_set(std::max(s_now_ms, until_ms));
+}
+
+/* the broker answers the messages sent so far, the dps are applied to the cloud state on PUBACK */
+static void broker_answer(int result)
+{
+    std::vector<replay_msg_t> inflight;
+    inflight.swap(s_inflight);
+
+    for (auto &msg : inflight) {
+        if (OPRT_OK == result) {
+            cJSON *root = cJSON_Parse(msg.payload.c_str());
+            ASSERT_NE(nullptr, root);
+            cJSON *t = cJSON_GetObjectItem(root, "t");
+            cJSON *dps = cJSON_GetObjectItem(root, "dps");
+            ASSERT_NE(nullptr, dps);
+            for (cJSON *dp = dps->child; dp; dp = dp->next) {
+                char *value = cJSON_PrintUnformatted(dp);
+                s_cloud[atoi(dp->string)] = {value, t ? (uint32_t)t->valuedouble : 0};
+                cJSON_free(value);
+            }
+            cJSON_Delete(root);
+            s_received.push_back(msg);
+        }
+        msg.cb(result, msg.user_data);
+    }
+}
+
+static tuya_iot_client_t s_client;
+
+class DpJournalTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        tal_time_service_init();
+        clock_set(0);
+        strcpy(s_client.activate.devid, "6c0ad0b3f29e8a1d5fqwer");
+        ASSERT_EQ(OPRT_OK, dp_journal_init());
+    }
+
+    void SetUp() override
+    {
+        s_online = false;
+        dp_journal_clear();
+        run_until(s_now_ms + JOURNAL_SAVE_DELAY);
+        s_kv.clear();
+        s_kv_writes = 0;
+        s_kv_bytes = 0;
+        s_inflight.clear();
+        s_received.clear();
+        s_cloud.clear();
+    }
+
+    static int report(int dpid, const std::string &value)
+    {
+        char dps[64];
+        snprintf(dps, sizeof(dps), "{\"%d\":%s}", dpid, value.c_str());
+        return dp_journal_add(dps, NULL);
+    }
+
+    /* connected again, the broker acks every message until the journal is empty */
+    static uint64_t replay(void)
+    {
+        uint64_t begin = s_now_ms;
+
+        s_online = true;
+        EXPECT_EQ(OPRT_OK, dp_journal_replay_start(&s_client));
+        for (int i = 0; i < 1000 && dp_journal_count(); i++) {
+            run_until(s_now_ms + 10);
+            broker_answer(OPRT_OK);
+        }
+        return s_now_ms - begin;
+    }
+};
+
+TEST_F(DpJournalTest, OutageOf10MinutesWith10kReports)
+{
+    std::map<int, std::pair<std::string, uint32_t>> last;
+    std::mt19937 rng(JOURNAL_REPORT_NUM);
+    int failed = 0;
+
+    for (int n = 0; n < JOURNAL_REPORT_NUM; n++) {
+        int dpid = 1 + rng() % JOURNAL_DP_NUM;
+        std::string value;
+        switch (dpid % 3) {
+        case 0:
+            value = (rng() & 1) ? "true" : "false";
+            break;
+        case 1:
+            value = std::to_string((int)(rng() % 2000) - 1000);
+            break;
+        default:
+            value = "\"mode_" + std::to_string(rng() % 100) + "\"";
+            break;
+        }
+        run_until((uint64_t)n * JOURNAL_OUTAGE_MS / JOURNAL_REPORT_NUM);
+        failed += OPRT_OK != report(dpid, value);
+        last[dpid] = {value, (uint32_t)tal_time_get_posix()};
+    }
+    run_until(JOURNAL_OUTAGE_MS);
+    run_until(s_now_ms + JOURNAL_SAVE_DELAY);
+
+    EXPECT_EQ(0, failed);
+    EXPECT_EQ(JOURNAL_DP_NUM, dp_journal_count());
+    EXPECT_LE(s_kv_writes, JOURNAL_OUTAGE_MS / JOURNAL_SAVE_DELAY + 1);
+    EXPECT_EQ(1u, s_kv.count("dp_journal"));
+    int writes = s_kv_writes;
+    size_t bytes = s_kv_bytes;
+
+    uint64_t ms = replay();
+    EXPECT_EQ(0, dp_journal_count());
+    EXPECT_EQ(last, s_cloud);
+    run_until(s_now_ms + JOURNAL_SAVE_DELAY);
+    EXPECT_EQ(0u, s_kv.count("dp_journal"));
+
+    printf("%d reports over %d dps in %d s offline: %d kv writes %zu bytes, replay %zu messages in %llu ms\n",
+           JOURNAL_REPORT_NUM, JOURNAL_DP_NUM, JOURNAL_OUTAGE_MS / 1000, writes, bytes, s_received.size(),
+           (unsigned long long)ms);
+}
+
+TEST_F(DpJournalTest, UnackedMessageIsSentAgain)
+{
+    ASSERT_EQ(OPRT_OK, report(1, "true"));
+    s_online = true;
+    ASSERT_EQ(OPRT_OK, dp_journal_replay_start(&s_client));
+    run_until(s_now_ms + 200);
+    ASSERT_EQ(1u, s_inflight.size());
+
+    broker_answer(OPRT_TIMEOUT);
+    EXPECT_EQ(1, dp_journal_count());
+    EXPECT_TRUE(s_cloud.empty());
+
+    /* the retry goes out later and is acked */
+    run_until(s_now_ms + 10 * 1000);
+    ASSERT_EQ(1u, s_inflight.size());
+    broker_answer(OPRT_OK);
+    EXPECT_EQ(0, dp_journal_count());
+    EXPECT_EQ("true", s_cloud[1].first);
+}
+
+TEST_F(DpJournalTest, LiveReportDropsKeptValue)
+{
+    ASSERT_EQ(OPRT_OK, report(1, "true"));
+    ASSERT_EQ(OPRT_OK, report(2, "7"));
+
+    /* a live report of dp 1 is newer than the kept value */
+    dp_journal_drop("{\"1\":false}");
+    EXPECT_EQ(1, dp_journal_count());
+
+    replay();
+    EXPECT_EQ(0u, s_cloud.count(1));
+    EXPECT_EQ("7", s_cloud[2].first);
+}
+
+TEST_F(DpJournalTest, FullJournalDropsOldest)
+{
+    int dps = DP_JOURNAL_MAX_NUM + 8;
+
+    for (int dpid = 1; dpid <= dps; dpid++) {
+        run_until(s_now_ms + 1000);
+        ASSERT_EQ(OPRT_OK, report(dpid, std::to_string(dpid)));
+    }
+    EXPECT_EQ(DP_JOURNAL_MAX_NUM, dp_journal_count());
+
+    replay();
+    EXPECT_EQ((size_t)DP_JOURNAL_MAX_NUM, s_cloud.size());
+    for (int dpid = 1; dpid <= dps - DP_JOURNAL_MAX_NUM; dpid++) {
+        EXPECT_EQ(0u, s_cloud.count(dpid)) << "dp " << dpid;
+    }
+}
@@ -0,0 +1,300 @@
+/**
+ * @file test_dp_json.cpp
+ * @brief UT of the dp report json writer of dp_schema.
+ *
+ * Every report is also built the way it was before the writer, the dps object
+ * printed with sprintf and cJSON strings and then copied into the LAN or cloud
+ * head. The two outputs have to be byte-identical. The heap of both ways is
+ * counted and the peak is reported.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "cJSON.h"
+#include "dp_schema.h"
+}
+
+#define DEVID "6c0ad0b3f29e8a1d5fqwer"
+
+static const char *s_schema_json =
+    "[{\"id\":1,\"mode\":\"rw\",\"trigger\":\"direct\",\"type\":\"obj\",\"property\":{\"type\":\"bool\"}},"
+    "{\"id\":2,\"mode\":\"rw\",\"trigger\":\"direct\",\"type\":\"obj\","
+    "\"property\":{\"type\":\"value\",\"min\":-2147483648,\"max\":2147483647}},"
+    "{\"id\":3,\"mode\":\"rw\",\"trigger\":\"direct\",\"type\":\"obj\",\"property\":{\"type\":\"string\",\"maxlen\":255}},"
+    "{\"id\":4,\"mode\":\"rw\",\"trigger\":\"direct\",\"type\":\"obj\","
+    "\"property\":{\"type\":\"enum\",\"range\":[\"low\",\"middle\",\"high\"]}},"
+    "{\"id\":5,\"mode\":\"rw\",\"trigger\":\"direct\",\"type\":\"obj\",\"property\":{\"type\":\"bitmap\",\"maxlen\":31}},"
+    "{\"id\":101,\"mode\":\"ro\",\"trigger\":\"direct\",\"type\":\"obj\",\"property\":{\"type\":\"string\",\"maxlen\":255}}]";
+
+/* heap of the two ways, every block carries its size */
+static size_t s_heap;
+static size_t s_heap_peak;
+
+static void *heap_malloc(size_t size)
+{
+    size_t *p = (size_t *)malloc(sizeof(size_t) + size);
+    p[0] = size;
+    s_heap += size;
+    if (s_heap > s_heap_peak) {
+        s_heap_peak = s_heap;
+    }
+    return p + 1;
+}
+
+static void heap_free(void *ptr)
+{
+    if (ptr) {
+        size_t *p = (size_t *)ptr - 1;
+        s_heap -= p[0];
+        free(p);
+    }
+}
+
+static void heap_reset(void)
+{
+    s_heap = 0;
+    s_heap_peak = 0;
+}
+
+/* the dps object printed as dp_rept_json_output did before the writer */
+static char *old_dps_json(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t *dpvalid)
+{
+    char *dpstr = (char *)heap_malloc(dpvalid->len);
+    uint16_t offset = 0;
+
+    dpstr[offset++] = '{';
+    for (uint16_t i = 0; i < dpvalid->num; i++) {
+        dp_obj_t *dp = NULL;
+        for (uint16_t j = 0; j < dpin->dpscnt; j++) {
+            if (dpvalid->dpid[i] == dpin->dps[j].id) {
+                dp = &dpin->dps[j];
+                break;
+            }
+        }
+        dp_node_t *dpnode = dp_node_find(schema, dp->id);
+
+        switch (dp->type) {
+        case PROP_BOOL:
+            offset += sprintf(dpstr + offset, "\"%d\":%s,", dp->id, (TRUE == dp->value.dp_bool) ? "true" : "false");
+            break;
+        case PROP_VALUE:
+            offset += sprintf(dpstr + offset, "\"%d\":%d,", dp->id, dp->value.dp_value);
+            break;
+        case PROP_BITMAP:
+            offset += sprintf(dpstr + offset, "\"%d\":%d,", dp->id, dp->value.dp_bitmap);
+            break;
+        case PROP_STR: {
+            cJSON *temp_str = cJSON_CreateString(dp->value.dp_str);
+            char *tmp_data = cJSON_PrintUnformatted(temp_str);
+            offset += sprintf(dpstr + offset, "\"%d\":%s,", dp->id, tmp_data);
+            cJSON_free(tmp_data);
+            cJSON_Delete(temp_str);
+            break;
+        }
+        case PROP_ENUM:
+            offset +=
+                sprintf(dpstr + offset, "\"%d\":\"%s\",", dp->id, dpnode->prop.prop_enum.pp_enum[dp->value.dp_enum]);
+            break;
+        }
+    }
+    dpstr[offset - 1] = '}';
+    dpstr[offset] = 0;
+
+    return dpstr;
+}
+
+/* the report as it was handed to the LAN or the cloud channel before the writer */
+static std::string old_report_json(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t *dpvalid, uint8_t head)
+{
+    char *dps = old_dps_json(schema, dpin, dpvalid);
+    char *buffer = NULL;
+
+    if (DP_JSON_HEAD_NONE == head) {
+        std::string out(dps);
+        heap_free(dps);
+        return out;
+    }
+    if (DP_JSON_HEAD_LAN == head) {
+        buffer = (char *)heap_malloc(strlen(dps) + 128);
+        sprintf(buffer, "{\"dps\":%s,\"devId\":\"%s\"}", dps, schema->devid);
+    } else {
+        buffer = (char *)heap_malloc(strlen(dps) + 64);
+        sprintf(buffer, "{\"devId\":\"%s\",\"dps\":%s}", DEVID, dps);
+    }
+    heap_free(dps);
+
+    std::string out(buffer);
+    heap_free(buffer);
+    return out;
+}
+
+/* the report written by dp_rept_json_serialize into a buffer of the exact size */
+static std::string new_report_json(dp_schema_t *schema, dp_rept_in_t *dpin, dp_rept_valid_t *dpvalid, uint8_t head)
+{
+    int len = dp_rept_json_serialize(schema, dpin, dpvalid, head, DEVID, NULL, 0);
+    EXPECT_GT(len, 0);
+
+    char *buf = (char *)heap_malloc(len + 1);
+    EXPECT_EQ(len, dp_rept_json_serialize(schema, dpin, dpvalid, head, DEVID, buf, len + 1));
+
+    std::string out(buf);
+    heap_free(buf);
+    return out;
+}
+
+class DpJsonTest : public testing::Test {
+  protected:
+    dp_schema_t *schema;
+    dp_rept_valid_t *dpvalid;
+
+    static void SetUpTestCase()
+    {
+        cJSON_Hooks hooks = {heap_malloc, heap_free};
+
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        cJSON_InitHooks(&hooks);
+    }
+
+    static void TearDownTestCase()
+    {
+        cJSON_InitHooks(NULL);
+    }
+
+    void SetUp() override
+    {
+        ASSERT_EQ(OPRT_OK, dp_schema_create((char *)DEVID, (char *)s_schema_json, &schema));
+        dpvalid = (dp_rept_valid_t *)tal_malloc(sizeof(dp_rept_valid_t) + 255);
+    }
+
+    void TearDown() override
+    {
+        tal_free(dpvalid);
+        dp_schema_delete((char *)DEVID);
+    }
+
+    /* every dp of the report is valid, the lengths are the ones dp_rept_valid_check adds */
+    void valid_all(dp_rept_in_t *dpin)
+    {
+        memset(dpvalid, 0, sizeof(dp_rept_valid_t));
+        dpvalid->schema = schema;
+        for (uint8_t i = 0; i < dpin->dpscnt; i++) {
+            dp_obj_t *dp = &dpin->dps[i];
+            if (PROP_STR == dp->type) {
+                dpvalid->len += 2 * strlen(dp->value.dp_str) + 15;
+            } else if (PROP_ENUM == dp->type) {
+                dpvalid->len += strlen(dp_node_find(schema, dp->id)->prop.prop_enum.pp_enum[dp->value.dp_enum]) + 15;
+            } else {
+                dpvalid->len += 20;
+            }
+            dpvalid->dpid[dpvalid->num++] = dp->id;
+        }
+    }
+
+    void expect_identical(std::vector<dp_obj_t> dps)
+    {
+        dp_rept_in_t dpin = {T_OBJ_REPT, 0, NULL, (uint8_t)dps.size(), dps.data()};
+        const uint8_t heads[] = {DP_JSON_HEAD_NONE, DP_JSON_HEAD_LAN, DP_JSON_HEAD_CLOUD};
+
+        valid_all(&dpin);
+        for (uint8_t head : heads) {
+            heap_reset();
+            std::string old_json = old_report_json(schema, &dpin, dpvalid, head);
+            size_t old_peak = s_heap_peak;
+
+            heap_reset();
+            std::string new_json = new_report_json(schema, &dpin, dpvalid, head);
+            size_t new_peak = s_heap_peak;
+
+            EXPECT_EQ(old_json, new_json);
+            EXPECT_LE(new_peak, old_peak);
+            printf("head %d, %zu bytes: peak heap %zu bytes before, %zu bytes with the writer\n", head,
+                   new_json.size(), old_peak, new_peak);
+        }
+    }
+};
+
+static dp_obj_t dp_bool(uint8_t id, bool value)
+{
+    dp_obj_t dp = {id, PROP_BOOL, {0}, 0};
+    dp.value.dp_bool = value;
+    return dp;
+}
+
+static dp_obj_t dp_value(uint8_t id, int value)
+{
+    dp_obj_t dp = {id, PROP_VALUE, {0}, 0};
+    dp.value.dp_value = value;
+    return dp;
+}
+
+static dp_obj_t dp_str(uint8_t id, const char *value)
+{
+    dp_obj_t dp = {id, PROP_STR, {0}, 0};
+    dp.value.dp_str = (char *)value;
+    return dp;
+}
+
+static dp_obj_t dp_enum(uint8_t id, uint32_t value)
+{
+    dp_obj_t dp = {id, PROP_ENUM, {0}, 0};
+    dp.value.dp_enum = value;
+    return dp;
+}
+
+static dp_obj_t dp_bitmap(uint8_t id, uint32_t value)
+{
+    dp_obj_t dp = {id, PROP_BITMAP, {0}, 0};
+    dp.value.dp_bitmap = value;
+    return dp;
+}
+
+TEST_F(DpJsonTest, EveryTypeIsIdentical)
+{
+    expect_identical({dp_bool(1, true), dp_value(2, 25), dp_str(3, "hello"), dp_enum(4, 1), dp_bitmap(5, 0x5A)});
+    expect_identical({dp_bool(1, false)});
+}
+
+TEST_F(DpJsonTest, ValueLimitsAreIdentical)
+{
+    expect_identical({dp_value(2, -2147483647 - 1)});
+    expect_identical({dp_value(2, 2147483647)});
+    expect_identical({dp_value(2, 0), dp_bitmap(5, 0x7FFFFFFF)});
+}
+
+TEST_F(DpJsonTest, StringEscapesAreIdentical)
+{
+    expect_identical({dp_str(3, "")});
+    expect_identical({dp_str(3, "quote\" backslash\\ slash/")});
+    expect_identical({dp_str(3, "\b\f\n\r\t\x01\x1f end")});
+    expect_identical({dp_str(3, "utf-8 \xe4\xbd\xa0\xe5\xa5\xbd")});
+}
+
+TEST_F(DpJsonTest, LongReportIsIdentical)
+{
+    std::string longstr(200, 'x');
+
+    expect_identical({dp_str(101, longstr.c_str()), dp_bool(1, true), dp_value(2, -1), dp_str(3, "\"\"\"\"\"\"\"\""),
+                      dp_enum(4, 2), dp_bitmap(5, 1)});
+}
+
+TEST_F(DpJsonTest, SmallBufferIsTruncatedAndTerminated)
+{
+    std::vector<dp_obj_t> dps = {dp_str(3, "truncated")};
+    dp_rept_in_t dpin = {T_OBJ_REPT, 0, NULL, (uint8_t)dps.size(), dps.data()};
+    char buf[8];
+
+    valid_all(&dpin);
+    int len = dp_rept_json_serialize(schema, &dpin, dpvalid, DP_JSON_HEAD_NONE, NULL, buf, sizeof(buf));
+    EXPECT_EQ((int)strlen("{\"3\":\"truncated\"}"), len);
+    EXPECT_STREQ("{\"3\":\"t", buf);
+}
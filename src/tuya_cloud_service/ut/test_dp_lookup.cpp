@@ -0,0 +1,137 @@
+/**
+ * @file test_dp_lookup.cpp
+ * @brief UT and benchmark of the dpid index of dp_schema.
+ *
+ * A schema with many dps is created and every dpid, present or not, is looked
+ * up by dp_node_find and dp_node_find_by_devid. The result has to be the one
+ * of the scan over schema->node[] that the index replaced, and the cost per
+ * lookup of both ways is printed.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include <stdio.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "dp_schema.h"
+}
+
+#define DEVID             "6c0ad0b3f29e8a1d5fqwer"
+#define LOOKUP_DP_NUM     120 // dpid 1..100 and 201..220, the ids of a large panel device
+#define LOOKUP_BENCH_LOOP 2000
+
+static volatile uintptr_t s_sink;
+
+/* the scan dp_node_find did before the index */
+static dp_node_t *scan_node_find(dp_schema_t *schema, int id)
+{
+    for (int i = 0; i < schema->num; i++) {
+        if (schema->node[i].desc.id == id) {
+            return &schema->node[i];
+        }
+    }
+    return NULL;
+}
+
+static int lookup_dpid(int i)
+{
+    return (i < 100) ? (i + 1) : (i - 100 + 201);
+}
+
+static double ns_per_op(std::chrono::steady_clock::time_point begin, int ops)
+{
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+    return (double)ns.count() / ops;
+}
+
+class DpLookupTest : public testing::Test {
+  protected:
+    dp_schema_t *schema = NULL;
+
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+    }
+
+    void SetUp() override
+    {
+        std::string json = "[";
+
+        for (int i = 0; i < LOOKUP_DP_NUM; i++) {
+            char node[160];
+            snprintf(node, sizeof(node),
+                     "%s{\"id\":%d,\"mode\":\"rw\",\"trigger\":\"direct\",\"type\":\"obj\","
+                     "\"property\":{\"type\":\"value\",\"min\":0,\"max\":1000}}",
+                     i ? "," : "", lookup_dpid(i));
+            json += node;
+        }
+        json += "]";
+        ASSERT_EQ(OPRT_OK, dp_schema_create((char *)DEVID, (char *)json.c_str(), &schema));
+        ASSERT_EQ(LOOKUP_DP_NUM, schema->num);
+    }
+
+    void TearDown() override
+    {
+        dp_schema_delete((char *)DEVID);
+    }
+};
+
+TEST_F(DpLookupTest, IndexMatchesScan)
+{
+    for (int id = -1; id <= 256; id++) {
+        EXPECT_EQ(scan_node_find(schema, id), dp_node_find(schema, id)) << "dpid " << id;
+        EXPECT_EQ(scan_node_find(schema, id), dp_node_find_by_devid((char *)DEVID, id)) << "dpid " << id;
+    }
+    EXPECT_EQ(NULL, dp_node_find_by_devid((char *)"unknown_devid", 1));
+    EXPECT_EQ(schema, dp_schema_find(DEVID));
+}
+
+TEST_F(DpLookupTest, DuplicatedDpidKeepsFirstNode)
+{
+    const char *json = "[{\"id\":7,\"mode\":\"rw\",\"trigger\":\"direct\",\"type\":\"obj\",\"property\":{\"type\":\"bool\"}},"
+                       "{\"id\":7,\"mode\":\"ro\",\"trigger\":\"direct\",\"type\":\"obj\",\"property\":{\"type\":\"bool\"}}]";
+    dp_schema_t *dup = NULL;
+
+    dp_schema_delete((char *)DEVID);
+    ASSERT_EQ(OPRT_OK, dp_schema_create((char *)DEVID, (char *)json, &dup));
+    EXPECT_EQ(&dup->node[0], dp_node_find(dup, 7));
+    EXPECT_EQ(scan_node_find(dup, 7), dp_node_find(dup, 7));
+}
+
+TEST_F(DpLookupTest, LookupBenchmark)
+{
+    auto begin = std::chrono::steady_clock::now();
+    for (int l = 0; l < LOOKUP_BENCH_LOOP; l++) {
+        for (int i = 0; i < LOOKUP_DP_NUM; i++) {
+            s_sink = (uintptr_t)scan_node_find(schema, lookup_dpid(i));
+        }
+    }
+    double scan_ns = ns_per_op(begin, LOOKUP_BENCH_LOOP * LOOKUP_DP_NUM);
+
+    begin = std::chrono::steady_clock::now();
+    for (int l = 0; l < LOOKUP_BENCH_LOOP; l++) {
+        for (int i = 0; i < LOOKUP_DP_NUM; i++) {
+            s_sink = (uintptr_t)dp_node_find(schema, lookup_dpid(i));
+        }
+    }
+    double index_ns = ns_per_op(begin, LOOKUP_BENCH_LOOP * LOOKUP_DP_NUM);
+
+    /* a copy of the devid, the cache has to compare the string */
+    char devid[] = DEVID;
+    begin = std::chrono::steady_clock::now();
+    for (int l = 0; l < LOOKUP_BENCH_LOOP; l++) {
+        for (int i = 0; i < LOOKUP_DP_NUM; i++) {
+            s_sink = (uintptr_t)dp_node_find_by_devid(devid, lookup_dpid(i));
+        }
+    }
+    double devid_ns = ns_per_op(begin, LOOKUP_BENCH_LOOP * LOOKUP_DP_NUM);
+
+    printf("%d dps: scan %.1f ns, index %.1f ns, by devid %.1f ns per lookup\n", LOOKUP_DP_NUM, scan_ns, index_ns,
+           devid_ns);
+    EXPECT_LT(index_ns, scan_ns);
+}
@@ -0,0 +1,393 @@
+/**
+ * @file test_lan_frame.cpp
+ * @brief UT and stress test of the LAN TCP frame reassembly of tuya_lan.
+ *
+ * The sockets and the socket loop are faked, a client is a queue of bytes the
+ * loop reads from. Clients trickle handshake frames in random pieces, across
+ * frame boundaries and interleaved with each other, and every frame has to be
+ * answered. A frame announced larger than allowed closes the session at once,
+ * and a frame left partial closes it after LAN_FRAME_TIMEOUT. The frames per
+ * second handled with one byte per read are printed.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tal_network.h"
+#include "tuya_iot.h"
+#include "tuya_lan.h"
+#include "lan_sock.h"
+#include "tuya_protocol.h"
+#include "netmgr.h"
+#include "tuya_iot_dp.h"
+}
+
+#define LAN_TEST_LOCALKEY     "0123456789abcdef"
+#define LAN_TEST_CLIENT_NUM   3 // CLIENT_LMT
+#define LAN_TEST_FRAME_NUM    200
+#define LAN_TEST_FRAME_TIMEOUT 5 // LAN_FRAME_TIMEOUT
+#define LAN_TEST_TCP_SERV_FD  100
+#define LAN_TEST_CLIENT_FD    200
+
+/* fake sockets: what a client sent waits in its queue, what the device sent is kept */
+struct fake_sock_t {
+    std::string in;
+    std::string out;
+    size_t read_max; // bytes per recv, 0 for no limit
+};
+
+static std::map<int, fake_sock_t> s_socks;
+static std::map<int, sloop_sock_t> s_loop;
+static std::vector<int> s_accept;
+static int s_next_fd = LAN_TEST_CLIENT_FD;
+static TUYA_ERRNO s_errno;
+
+extern "C" {
+int tal_net_socket_create(const TUYA_PROTOCOL_TYPE_E type)
+{
+    return (PROTOCOL_TCP == type) ? LAN_TEST_TCP_SERV_FD : LAN_TEST_TCP_SERV_FD + 1;
+}
+
+TUYA_ERRNO tal_net_bind(const int fd, const TUYA_IP_ADDR_T addr, const uint16_t port)
+{
+    return 0;
+}
+
+TUYA_ERRNO tal_net_listen(const int fd, const int backlog)
+{
+    return 0;
+}
+
+OPERATE_RET tal_net_set_reuse(const int fd)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_net_set_block(const int fd, const BOOL_T block)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tal_net_set_broadcast(const int fd)
+{
+    return OPRT_OK;
+}
+
+TUYA_ERRNO tal_net_close(const int fd)
+{
+    s_socks.erase(fd);
+    return 0;
+}
+
+TUYA_ERRNO tal_net_get_errno(void)
+{
+    return s_errno;
+}
+
+int tal_net_accept(const int fd, TUYA_IP_ADDR_T *addr, uint16_t *port)
+{
+    if (s_accept.empty()) {
+        return -1;
+    }
+    int cfd = s_accept.back();
+    s_accept.pop_back();
+    return cfd;
+}
+
+TUYA_ERRNO tal_net_recv(const int fd, void *buf, const uint32_t nbytes)
+{
+    fake_sock_t &sock = s_socks[fd];
+    if (sock.in.empty()) {
+        s_errno = UNW_EAGAIN;
+        return -1;
+    }
+    size_t n = std::min(sock.in.size(), (size_t)nbytes);
+    if (sock.read_max) {
+        n = std::min(n, sock.read_max);
+    }
+    memcpy(buf, sock.in.data(), n);
+    sock.in.erase(0, n);
+    return (TUYA_ERRNO)n;
+}
+
+TUYA_ERRNO tal_net_send(const int fd, const void *buf, const uint32_t nbytes)
+{
+    s_socks[fd].out.append((const char *)buf, nbytes);
+    return nbytes;
+}
+
+TUYA_ERRNO tal_net_recvfrom(const int fd, void *buf, const uint32_t nbytes, TUYA_IP_ADDR_T *addr, uint16_t *port)
+{
+    s_errno = UNW_EAGAIN;
+    return -1;
+}
+
+TUYA_ERRNO tal_net_send_to(const int fd, const void *buf, const uint32_t nbytes, const TUYA_IP_ADDR_T addr,
+                           const uint16_t port)
+{
+    return nbytes;
+}
+
+TUYA_IP_ADDR_T tal_net_str2addr(const char *ip_str)
+{
+    return 0;
+}
+
+OPERATE_RET tuya_sock_loop_init(void)
+{
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_reg_lan_sock(sloop_sock_t sock_info)
+{
+    s_loop[sock_info.sock] = sock_info;
+    return OPRT_OK;
+}
+
+OPERATE_RET tuya_unreg_lan_sock(int sock)
+{
+    s_loop.erase(sock);
+    tal_net_close(sock);
+    return OPRT_OK;
+}
+
+OPERATE_RET netmgr_conn_get(netmgr_type_e type, netmgr_conn_config_type_e cmd, void *param)
+{
+    return OPRT_NOT_SUPPORTED;
+}
+
+int tuya_iot_dp_parse(tuya_iot_client_t *client, dp_cmd_type_t tp, cJSON *cmd_js)
+{
+    return OPRT_OK;
+}
+
+char *tuya_iot_dp_obj_dump(tuya_iot_client_t *client, char *devid, int flags)
+{
+    return NULL;
+}
+}
+
+static tuya_iot_client_t s_client;
+
+/* a handshake frame of the app, randA is the sequence in text */
+static std::string handshake_frame(uint32_t sequence)
+{
+    uint8_t rand_a[16] = {0};
+    snprintf((char *)rand_a, sizeof(rand_a), "%u", sequence);
+
+    lpv35_frame_object_t frame = {.sequence = sequence, .type = FRM_SECURITY_TYPE3, .data = rand_a, .data_len = 16};
+    std::string out(lpv35_frame_buffer_size_get(&frame), '\0');
+    int out_len = 0;
+    EXPECT_EQ(OPRT_OK, lpv35_frame_serialize((const uint8_t *)LAN_TEST_LOCALKEY, 16, &frame, (uint8_t *)&out[0],
+                                             &out_len));
+    out.resize(out_len);
+    return out;
+}
+
+/* the frames the device sent to a client, parsed and counted */
+static int answers(int fd)
+{
+    std::string &out = s_socks[fd].out;
+    int num = 0;
+
+    while (out.size() >= LPV35_FRAME_MINI_SIZE) {
+        uint32_t length = 0;
+        memcpy(&length, out.data() + LPV35_FRAME_HEAD_SIZE + offsetof(lpv35_fixed_head_t, length), sizeof(length));
+        size_t frame_len = LPV35_FRAME_HEAD_SIZE + sizeof(lpv35_fixed_head_t) + UNI_NTOHL(length) +
+                           LPV35_FRAME_TAIL_SIZE;
+        if (frame_len > out.size()) {
+            break;
+        }
+        lpv35_frame_object_t frame = {0};
+        EXPECT_EQ(OPRT_OK, lpv35_frame_parse((const uint8_t *)LAN_TEST_LOCALKEY, 16, (const uint8_t *)out.data(),
+                                             frame_len, &frame));
+        EXPECT_EQ(FRM_SECURITY_TYPE4, frame.type);
+        tal_free(frame.data);
+        out.erase(0, frame_len);
+        num++;
+    }
+    return num;
+}
+
+class LanFrameTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        s_client.is_activated = true;
+        strcpy(s_client.activate.localkey, LAN_TEST_LOCALKEY);
+    }
+
+    void SetUp() override
+    {
+        s_socks.clear();
+        s_loop.clear();
+        s_accept.clear();
+        ASSERT_EQ(OPRT_OK, tuya_lan_init(&s_client));
+        ASSERT_EQ(1u, s_loop.count(LAN_TEST_TCP_SERV_FD));
+    }
+
+    void TearDown() override
+    {
+        tuya_lan_exit();
+    }
+
+    int connect(size_t read_max)
+    {
+        int fd = s_next_fd++;
+        s_socks[fd].read_max = read_max;
+        s_accept.push_back(fd);
+        s_loop[LAN_TEST_TCP_SERV_FD].read(LAN_TEST_TCP_SERV_FD);
+        EXPECT_EQ(1u, s_loop.count(fd));
+        return fd;
+    }
+
+    /* one round of the socket loop, every client with data is read once */
+    void loop_once()
+    {
+        s_loop[LAN_TEST_TCP_SERV_FD].pre_select();
+        std::vector<int> ready;
+        for (auto &it : s_loop) {
+            if (it.first >= LAN_TEST_CLIENT_FD && !s_socks[it.first].in.empty()) {
+                ready.push_back(it.first);
+            }
+        }
+        for (int fd : ready) {
+            if (s_loop.count(fd)) {
+                s_loop[fd].read(fd);
+            }
+        }
+    }
+
+    bool opened(int fd)
+    {
+        return s_loop.count(fd) > 0;
+    }
+};
+
+TEST_F(LanFrameTest, TricklingClientsAreAllAnswered)
+{
+    std::mt19937 rng(1);
+    std::vector<int> fds;
+    std::vector<std::string> streams(LAN_TEST_CLIENT_NUM);
+    std::vector<size_t> sent(LAN_TEST_CLIENT_NUM, 0);
+
+    for (int c = 0; c < LAN_TEST_CLIENT_NUM; c++) {
+        fds.push_back(connect(0));
+        for (uint32_t seq = 1; seq <= LAN_TEST_FRAME_NUM; seq++) {
+            streams[c] += handshake_frame(seq);
+        }
+    }
+
+    /* random pieces from 1 byte to 2 frames, the loop reads whatever has arrived */
+    bool more = true;
+    while (more) {
+        more = false;
+        for (int c = 0; c < LAN_TEST_CLIENT_NUM; c++) {
+            size_t piece = std::min(streams[c].size() - sent[c], (size_t)(1 + rng() % 150));
+            s_socks[fds[c]].in.append(streams[c], sent[c], piece);
+            sent[c] += piece;
+            more |= sent[c] < streams[c].size();
+        }
+        loop_once();
+    }
+    loop_once();
+
+    for (int c = 0; c < LAN_TEST_CLIENT_NUM; c++) {
+        EXPECT_TRUE(opened(fds[c]));
+        EXPECT_EQ(LAN_TEST_FRAME_NUM, answers(fds[c])) << "client " << c;
+    }
+}
+
+TEST_F(LanFrameTest, GarbageBeforeFrameIsSkipped)
+{
+    std::mt19937 rng(2);
+    int fd = connect(64);
+
+    /* 16k of noise without a frame head, read 64 bytes at a time */
+    std::string noise;
+    for (int i = 0; i < 16 * 1024; i++) {
+        noise += (i % 97) ? (char)(rng() % 0x60 + 0x20) : '\0';
+    }
+    s_socks[fd].in = noise + handshake_frame(1);
+    while (!s_socks[fd].in.empty() && opened(fd)) {
+        loop_once();
+    }
+    EXPECT_TRUE(opened(fd));
+    EXPECT_EQ(1, answers(fd));
+}
+
+TEST_F(LanFrameTest, OversizedFrameBeforeSessionKeyClosesSession)
+{
+    int fd = connect(0);
+    int other = connect(0);
+
+    /* the head of a 3000 byte frame, far more than a handshake */
+    std::string frame = handshake_frame(1);
+    uint32_t length = UNI_HTONL(3000);
+    memcpy(&frame[LPV35_FRAME_HEAD_SIZE + offsetof(lpv35_fixed_head_t, length)], &length, sizeof(length));
+    s_socks[fd].in = frame.substr(0, 100);
+    loop_once();
+    EXPECT_FALSE(opened(fd));
+
+    s_socks[other].in = handshake_frame(1);
+    loop_once();
+    EXPECT_TRUE(opened(other));
+    EXPECT_EQ(1, answers(other));
+}
+
+TEST_F(LanFrameTest, PartialFrameTimesOut)
+{
+    int stalled = connect(0);
+    int idle = connect(0);
+    int done = connect(0);
+
+    std::string frame = handshake_frame(1);
+    s_socks[stalled].in = frame.substr(0, frame.size() - 1);
+    s_socks[done].in = frame;
+    loop_once();
+    EXPECT_EQ(1, answers(done));
+
+    tal_system_sleep((LAN_TEST_FRAME_TIMEOUT - 2) * 1000);
+    loop_once();
+    EXPECT_TRUE(opened(stalled));
+
+    tal_system_sleep(3 * 1000);
+    loop_once();
+    EXPECT_FALSE(opened(stalled));
+    EXPECT_TRUE(opened(idle));
+    EXPECT_TRUE(opened(done));
+}
+
+TEST_F(LanFrameTest, ByteByByteBenchmark)
+{
+    std::string frame = handshake_frame(1);
+    std::string stream;
+    int fd = connect(1);
+
+    for (uint32_t seq = 1; seq <= LAN_TEST_FRAME_NUM * 5; seq++) {
+        stream += handshake_frame(seq);
+    }
+    s_socks[fd].in = stream;
+
+    auto begin = std::chrono::steady_clock::now();
+    while (!s_socks[fd].in.empty()) {
+        s_loop[fd].read(fd);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+    EXPECT_EQ(LAN_TEST_FRAME_NUM * 5, answers(fd));
+    printf("%d byte frames read one byte at a time: %.0f frames/s, %zu reads\n", (int)frame.size(),
+           LAN_TEST_FRAME_NUM * 5 / seconds, stream.size());
+}
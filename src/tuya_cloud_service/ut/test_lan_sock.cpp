@@ -0,0 +1,146 @@
+/**
+ * @file test_lan_sock.cpp
+ * @brief UT of the lan socket loop.
+ *
+ * The loop runs on host sockets. The sockets are registered while the loop is
+ * blocked, the wakeup socket has to make them served long before the tick.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+
+extern "C" {
+#include "tal_api.h"
+#include "tal_network.h"
+#include "lan_sock.h"
+}
+
+#define LAN_SOCK_TEST_NUM 3
+#define LAN_SOCK_SERVE_MS 100 // far below the tick, the wakeup did it
+
+static std::atomic<int> s_reads;
+static std::atomic<uint32_t> s_last_read_ms;
+
+extern "C" {
+uint32_t tuya_lan_get_client_num(void)
+{
+    return LAN_SOCK_TEST_NUM;
+}
+
+int tuya_lan_exit(void)
+{
+    return OPRT_OK;
+}
+}
+
+static void on_read(int32_t sock)
+{
+    uint8_t buf[64];
+    TUYA_IP_ADDR_T addr = 0;
+    uint16_t port = 0;
+
+    while (tal_net_recvfrom(sock, buf, sizeof(buf), &addr, &port) > 0) {
+        s_reads++;
+    }
+    s_last_read_ms = tal_system_get_millisecond();
+}
+
+/* a loopback udp socket with a datagram waiting */
+static int udp_with_data(void)
+{
+    TUYA_IP_ADDR_T addr = 0;
+    uint16_t port = 0;
+    uint8_t byte = 1;
+
+    int fd = tal_net_socket_create(PROTOCOL_UDP);
+    EXPECT_GE(fd, 0);
+    EXPECT_EQ(OPRT_OK, tal_net_bind(fd, TY_IPADDR_LOOPBACK, 0));
+    EXPECT_EQ(OPRT_OK, tal_net_getsockname(fd, &addr, &port));
+    tal_net_set_block(fd, FALSE);
+    tal_net_send_to(fd, &byte, 1, TY_IPADDR_LOOPBACK, port);
+    return fd;
+}
+
+static bool wait_reads(int n, uint32_t timeout_ms)
+{
+    uint32_t start = tal_system_get_millisecond();
+
+    while (s_reads < n) {
+        if (tal_system_get_millisecond() - start > timeout_ms) {
+            return false;
+        }
+        tal_system_sleep(1);
+    }
+    return true;
+}
+
+class LanSockTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        ASSERT_EQ(OPRT_OK, tuya_sock_loop_init());
+        // the loop is blocked with no socket
+        tal_system_sleep(50);
+    }
+
+    void SetUp() override
+    {
+        s_reads = 0;
+    }
+};
+
+TEST_F(LanSockTest, RegisteredSocketIsServedAtOnce)
+{
+    int fd = udp_with_data();
+    sloop_sock_t info = {.sock = fd, .pre_select = NULL, .read = on_read, .err = NULL, .quit = NULL};
+    uint32_t start = tal_system_get_millisecond();
+
+    ASSERT_EQ(OPRT_OK, tuya_reg_lan_sock(info));
+    ASSERT_TRUE(wait_reads(1, LAN_SOCK_SERVE_MS));
+    EXPECT_LT(s_last_read_ms - start, (uint32_t)LAN_SOCK_SERVE_MS);
+
+    ASSERT_EQ(OPRT_OK, tuya_unreg_lan_sock(fd));
+}
+
+TEST_F(LanSockTest, SocketsRegisteredTogetherAreAllServed)
+{
+    int fd[LAN_SOCK_TEST_NUM];
+    int i;
+
+    for (i = 0; i < LAN_SOCK_TEST_NUM; i++) {
+        fd[i] = udp_with_data();
+        sloop_sock_t info = {.sock = fd[i], .pre_select = NULL, .read = on_read, .err = NULL, .quit = NULL};
+        ASSERT_EQ(OPRT_OK, tuya_reg_lan_sock(info));
+    }
+    EXPECT_TRUE(wait_reads(LAN_SOCK_TEST_NUM, LAN_SOCK_SERVE_MS));
+
+    for (i = 0; i < LAN_SOCK_TEST_NUM; i++) {
+        ASSERT_EQ(OPRT_OK, tuya_unreg_lan_sock(fd[i]));
+    }
+}
+
+TEST_F(LanSockTest, UnregisteredSocketIsNotServed)
+{
+    int fd = udp_with_data();
+    sloop_sock_t info = {.sock = fd, .pre_select = NULL, .read = on_read, .err = NULL, .quit = NULL};
+    TUYA_IP_ADDR_T addr = 0;
+    uint16_t port = 0;
+    uint8_t byte = 2;
+
+    ASSERT_EQ(OPRT_OK, tuya_reg_lan_sock(info));
+    ASSERT_TRUE(wait_reads(1, LAN_SOCK_SERVE_MS));
+
+    // the loop closes the socket, a datagram to its port is not read any more
+    tal_net_getsockname(fd, &addr, &port);
+    ASSERT_EQ(OPRT_OK, tuya_unreg_lan_sock(fd));
+    tal_system_sleep(LAN_SOCK_SERVE_MS);
+
+    int sender = tal_net_socket_create(PROTOCOL_UDP);
+    tal_net_send_to(sender, &byte, 1, TY_IPADDR_LOOPBACK, port);
+    tal_net_close(sender);
+    EXPECT_FALSE(wait_reads(2, LAN_SOCK_SERVE_MS));
+}
@@ -0,0 +1,321 @@
+/**
+ * @file test_mqtt_publish.cpp
+ * @brief UT and benchmark of the QoS1 publish queue of mqtt_service.
+ *
+ * The mqtt client is faked, a send costs a configurable time and is serialized
+ * like in the real client, a PUBACK is injected by the test. A slow send must
+ * not hold the queue, a PUBACK racing the send must find its slot, a failed
+ * send is resent by the loop and an unacked publish times out. 4 producers
+ * publish at the same time and the publishes per second and the call latency
+ * are printed.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+
+extern "C" {
+#include "tuya_config_defaults.h"
+#include "tal_api.h"
+#include "mqtt_client_interface.h"
+#include "mqtt_service.h"
+}
+
+#define PUBLISH_PRODUCER_NUM 4
+#define PUBLISH_PER_PRODUCER 2000
+#define PUBLISH_SEND_US      50 // a few hundred bytes into the TLS socket
+#define PUBLISH_TIMEOUT_MS   5000
+
+/* fake mqtt client */
+static mqtt_client_config_t s_config;
+static int s_client;
+static std::atomic<uint16_t> s_msgid;
+static std::atomic<int> s_send_us;
+static std::atomic<int> s_fail_sends;
+static std::atomic<bool> s_ack_in_send;
+static std::atomic<int> s_in_send;
+static std::mutex s_send_mutex; // the client builds one packet at a time
+static std::mutex s_sent_mutex;
+static std::vector<uint16_t> s_sent;
+
+extern "C" {
+void *mqtt_client_new(void)
+{
+    return &s_client;
+}
+
+void mqtt_client_free(void *client)
+{
+}
+
+mqtt_client_status_t mqtt_client_init(void *client, const mqtt_client_config_t *config)
+{
+    s_config = *config;
+    return MQTT_STATUS_SUCCESS;
+}
+
+mqtt_client_status_t mqtt_client_deinit(void *client)
+{
+    return MQTT_STATUS_SUCCESS;
+}
+
+mqtt_client_status_t mqtt_client_connect(void *client)
+{
+    s_config.on_connected(client, s_config.userdata);
+    return MQTT_STATUS_SUCCESS;
+}
+
+mqtt_client_status_t mqtt_client_disconnect(void *client)
+{
+    return MQTT_STATUS_SUCCESS;
+}
+
+mqtt_client_status_t mqtt_client_yield_wait(void *client, uint32_t timeout_ms)
+{
+    return MQTT_STATUS_SUCCESS;
+}
+
+uint16_t mqtt_client_subscribe(void *client, const char *topic, uint8_t qos)
+{
+    return 1;
+}
+
+uint16_t mqtt_client_unsubscribe(void *client, const char *topic, uint8_t qos)
+{
+    return 1;
+}
+
+uint16_t mqtt_client_msgid_new(void *client)
+{
+    uint16_t msgid = ++s_msgid;
+    return msgid ? msgid : ++s_msgid;
+}
+
+uint16_t mqtt_client_publish_msgid(void *client, uint16_t msgid, const char *topic, const uint8_t *payload,
+                                   size_t length, uint8_t qos)
+{
+    int fail = s_fail_sends.load();
+    while (fail > 0 && !s_fail_sends.compare_exchange_weak(fail, fail - 1)) {
+    }
+    if (fail > 0) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> send_lock(s_send_mutex);
+    s_in_send++;
+    if (s_send_us) {
+        std::this_thread::sleep_for(std::chrono::microseconds(s_send_us.load()));
+    }
+    if (s_ack_in_send) {
+        s_config.on_published(client, msgid, s_config.userdata);
+    } else {
+        std::lock_guard<std::mutex> lock(s_sent_mutex);
+        s_sent.push_back(msgid);
+    }
+    s_in_send--;
+    return msgid;
+}
+
+uint16_t mqtt_client_publish(void *client, const char *topic, const uint8_t *payload, size_t length, uint8_t qos)
+{
+    return mqtt_client_publish_msgid(client, mqtt_client_msgid_new(client), topic, payload, length, qos);
+}
+}
+
+/* PUBACK of every packet sent so far */
+static int puback_all(void)
+{
+    std::vector<uint16_t> sent;
+    {
+        std::lock_guard<std::mutex> lock(s_sent_mutex);
+        sent.swap(s_sent);
+    }
+    for (uint16_t msgid : sent) {
+        s_config.on_published(&s_client, msgid, s_config.userdata);
+    }
+    return (int)sent.size();
+}
+
+static std::atomic<int> s_acked;
+static std::atomic<int> s_timeout;
+
+static void publish_notify_cb(int result, void *user_data)
+{
+    if (OPRT_OK == result) {
+        s_acked++;
+    } else if (OPRT_TIMEOUT == result) {
+        s_timeout++;
+    }
+}
+
+static const uint8_t s_payload[] = "{\"protocol\":4,\"t\":1700000000,\"data\":{\"dps\":{\"1\":true}}}";
+
+class MqttPublishTest : public testing::Test {
+  protected:
+    tuya_mqtt_context_t context;
+    const char *topic = "smart/device/out/6c0ad0b3f29e8a1d5fqwer";
+
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+    }
+
+    void SetUp() override
+    {
+        tuya_mqtt_config_t config = {0};
+
+        s_send_us = 0;
+        s_fail_sends = 0;
+        s_ack_in_send = false;
+        s_acked = 0;
+        s_timeout = 0;
+        s_sent.clear();
+
+        config.host = "m1.tuyacn.com";
+        config.port = 8883;
+        config.timeout = 1000;
+        config.devid = "6c0ad0b3f29e8a1d5fqwer";
+        config.seckey = "0123456789abcdef";
+        config.localkey = "fedcba9876543210";
+        ASSERT_EQ(OPRT_OK, tuya_mqtt_init(&context, &config));
+        ASSERT_EQ(OPRT_OK, tuya_mqtt_start(&context));
+        ASSERT_TRUE(tuya_mqtt_connected(&context));
+    }
+
+    void TearDown() override
+    {
+        tuya_mqtt_destory(&context);
+    }
+
+    int publish(int timeout_ms)
+    {
+        return tuya_mqtt_client_publish_common(&context, topic, s_payload, sizeof(s_payload) - 1, publish_notify_cb,
+                                               NULL, timeout_ms, false);
+    }
+};
+
+TEST_F(MqttPublishTest, SlowSendDoesNotHoldQueue)
+{
+    s_send_us = 200 * 1000;
+    std::thread publisher([this] { EXPECT_EQ(OPRT_OK, publish(PUBLISH_TIMEOUT_MS)); });
+    while (0 == s_in_send) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    EXPECT_EQ((int)MQTT_PUBLISH_QUEUE_SIZE - 1, tuya_mqtt_publish_queue_free(&context));
+    EXPECT_LT(std::chrono::steady_clock::now() - begin, std::chrono::milliseconds(50));
+    EXPECT_EQ(1, s_in_send.load());
+
+    publisher.join();
+    EXPECT_EQ(1, puback_all());
+    EXPECT_EQ(1, s_acked.load());
+    EXPECT_EQ((int)MQTT_PUBLISH_QUEUE_SIZE, tuya_mqtt_publish_queue_free(&context));
+}
+
+TEST_F(MqttPublishTest, PubackBeforeSendReturns)
+{
+    s_ack_in_send = true;
+    for (int i = 0; i < 3 * (int)MQTT_PUBLISH_QUEUE_SIZE; i++) {
+        ASSERT_EQ(OPRT_OK, publish(PUBLISH_TIMEOUT_MS));
+    }
+    EXPECT_EQ(3 * (int)MQTT_PUBLISH_QUEUE_SIZE, s_acked.load());
+    EXPECT_EQ((int)MQTT_PUBLISH_QUEUE_SIZE, tuya_mqtt_publish_queue_free(&context));
+}
+
+TEST_F(MqttPublishTest, FailedSendIsResentByLoop)
+{
+    s_fail_sends = 1;
+    ASSERT_EQ(OPRT_OK, publish(PUBLISH_TIMEOUT_MS));
+    EXPECT_EQ(0, puback_all());
+    EXPECT_EQ((int)MQTT_PUBLISH_QUEUE_SIZE - 1, tuya_mqtt_publish_queue_free(&context));
+
+    tuya_mqtt_loop_wait(&context, 0);
+    EXPECT_EQ(1, puback_all());
+    EXPECT_EQ(1, s_acked.load());
+    EXPECT_EQ(0, s_timeout.load());
+    EXPECT_EQ((int)MQTT_PUBLISH_QUEUE_SIZE, tuya_mqtt_publish_queue_free(&context));
+}
+
+TEST_F(MqttPublishTest, UnackedPublishTimesOut)
+{
+    ASSERT_EQ(OPRT_OK, publish(20));
+    tuya_mqtt_loop_wait(&context, 0);
+    EXPECT_EQ(0, s_timeout.load());
+
+    tal_system_sleep(30);
+    tuya_mqtt_loop_wait(&context, 0);
+    EXPECT_EQ(1, s_timeout.load());
+    EXPECT_EQ((int)MQTT_PUBLISH_QUEUE_SIZE, tuya_mqtt_publish_queue_free(&context));
+
+    /* a late PUBACK is ignored */
+    EXPECT_EQ(1, puback_all());
+    EXPECT_EQ(0, s_acked.load());
+}
+
+TEST_F(MqttPublishTest, Publish4Producers)
+{
+    std::vector<std::thread> producers;
+    std::vector<uint32_t> latency[PUBLISH_PRODUCER_NUM];
+    std::atomic<bool> done(false);
+    std::atomic<int> full(0);
+    int total = PUBLISH_PRODUCER_NUM * PUBLISH_PER_PRODUCER;
+
+    s_send_us = PUBLISH_SEND_US;
+    std::thread acker([&done] {
+        while (!done) {
+            puback_all();
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        puback_all();
+    });
+
+    auto begin = std::chrono::steady_clock::now();
+    for (int p = 0; p < PUBLISH_PRODUCER_NUM; p++) {
+        producers.emplace_back([this, p, &latency, &full] {
+            latency[p].reserve(PUBLISH_PER_PRODUCER);
+            for (int i = 0; i < PUBLISH_PER_PRODUCER; i++) {
+                auto start = std::chrono::steady_clock::now();
+                int rt = publish(PUBLISH_TIMEOUT_MS);
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+                if (OPRT_EXCEED_UPPER_LIMIT == rt) {
+                    /* hold back like the dp report does */
+                    full++;
+                    i--;
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+                    continue;
+                }
+                EXPECT_EQ(OPRT_OK, rt);
+                latency[p].push_back((uint32_t)ns.count());
+            }
+        });
+    }
+    for (auto &t : producers) {
+        t.join();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - begin;
+    done = true;
+    acker.join();
+
+    EXPECT_EQ(total, s_acked.load());
+    EXPECT_EQ(0, s_timeout.load());
+    EXPECT_EQ((int)MQTT_PUBLISH_QUEUE_SIZE, tuya_mqtt_publish_queue_free(&context));
+
+    std::vector<uint32_t> all;
+    for (int p = 0; p < PUBLISH_PRODUCER_NUM; p++) {
+        all.insert(all.end(), latency[p].begin(), latency[p].end());
+    }
+    std::sort(all.begin(), all.end());
+    double seconds = std::chrono::duration<double>(elapsed).count();
+    printf("%d producers, %d us per send: %.0f publishes/s, p50 %u ns, p99 %u ns, %d times queue full\n",
+           PUBLISH_PRODUCER_NUM, PUBLISH_SEND_US, total / seconds, all[all.size() / 2], all[all.size() * 99 / 100],
+           full.load());
+}
@@ -0,0 +1,438 @@
+/**
+ * @file test_mqtt_subscribe.cpp
+ * @brief UT and benchmark of the MQTT subscription trie of mqtt_service.
+ *
+ * The trie is checked against a plain MQTT filter matcher with random filters
+ * and topics. 500 sub-device topics plus one wildcard filter are dispatched
+ * through the trie and through the list scan it replaced, and the cost per
+ * message is printed. Over a fake mqtt client, subscriptions are registered
+ * and unregistered while the loop thread dispatches, including from the
+ * callbacks themselves.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "mqtt_client_interface.h"
+#include "mqtt_service.h"
+#include "mqtt_topic_trie.h"
+}
+
+#define SUBSCRIBE_DEV_NUM    500
+#define SUBSCRIBE_BENCH_LOOP 200
+#define RANDOM_FILTER_NUM    300
+#define RANDOM_TOPIC_NUM     3000
+
+/* fake mqtt client */
+static mqtt_client_config_t s_config;
+static int s_client;
+
+extern "C" {
+void *mqtt_client_new(void)
+{
+    return &s_client;
+}
+
+void mqtt_client_free(void *client)
+{
+}
+
+mqtt_client_status_t mqtt_client_init(void *client, const mqtt_client_config_t *config)
+{
+    s_config = *config;
+    return MQTT_STATUS_SUCCESS;
+}
+
+mqtt_client_status_t mqtt_client_deinit(void *client)
+{
+    return MQTT_STATUS_SUCCESS;
+}
+
+mqtt_client_status_t mqtt_client_connect(void *client)
+{
+    return MQTT_STATUS_SUCCESS;
+}
+
+mqtt_client_status_t mqtt_client_disconnect(void *client)
+{
+    return MQTT_STATUS_SUCCESS;
+}
+
+mqtt_client_status_t mqtt_client_yield_wait(void *client, uint32_t timeout_ms)
+{
+    return MQTT_STATUS_SUCCESS;
+}
+
+uint16_t mqtt_client_subscribe(void *client, const char *topic, uint8_t qos)
+{
+    return 1;
+}
+
+uint16_t mqtt_client_unsubscribe(void *client, const char *topic, uint8_t qos)
+{
+    return 1;
+}
+
+uint16_t mqtt_client_msgid_new(void *client)
+{
+    return 1;
+}
+
+uint16_t mqtt_client_publish_msgid(void *client, uint16_t msgid, const char *topic, const uint8_t *payload,
+                                   size_t length, uint8_t qos)
+{
+    return msgid;
+}
+
+uint16_t mqtt_client_publish(void *client, const char *topic, const uint8_t *payload, size_t length, uint8_t qos)
+{
+    return 1;
+}
+}
+
+/* a message arrives on the loop thread */
+static void deliver(const char *topic)
+{
+    mqtt_client_message_t msg = {.topic = topic, .payload = (const uint8_t *)"{}", .length = 2, .qos = MQTT_QOS_1};
+    s_config.on_message(&s_client, 1, &msg, s_config.userdata);
+}
+
+/* MQTT filter matching by the spec, level by level */
+static std::vector<std::string> split_levels(const std::string &s)
+{
+    std::vector<std::string> levels;
+    size_t start = 0;
+    for (;;) {
+        size_t end = s.find('/', start);
+        levels.push_back(s.substr(start, end == std::string::npos ? std::string::npos : end - start));
+        if (end == std::string::npos) {
+            return levels;
+        }
+        start = end + 1;
+    }
+}
+
+static bool reference_match(const std::string &filter, const std::string &topic)
+{
+    std::vector<std::string> f = split_levels(filter);
+    std::vector<std::string> t = split_levels(topic);
+
+    if (!topic.empty() && '$' == topic[0] && ("+" == f[0] || "#" == f[0])) {
+        return false;
+    }
+    for (size_t i = 0; i < f.size(); i++) {
+        if ("#" == f[i]) {
+            return true;
+        }
+        if (i >= t.size()) {
+            return false;
+        }
+        if ("+" != f[i] && f[i] != t[i]) {
+            return false;
+        }
+    }
+    return f.size() == t.size();
+}
+
+static void collect_cb(mqtt_topic_node_t *node, void *arg)
+{
+    ((std::set<void *> *)arg)->insert(node->entry);
+}
+
+static void count_cb(mqtt_topic_node_t *node, void *arg)
+{
+    (*(int *)arg)++;
+}
+
+static std::string random_topic(bool wildcard)
+{
+    static const char *words[] = {"a", "b", "c", "$sys", "dev", ""};
+    std::string s;
+    int levels = 1 + rand() % 4;
+
+    for (int i = 0; i < levels; i++) {
+        if (i) {
+            s += "/";
+        }
+        int r = rand() % 8;
+        if (wildcard && 6 == r) {
+            s += "+";
+        } else if (wildcard && 7 == r && i == levels - 1) {
+            s += "#";
+        } else {
+            s += words[rand() % 6];
+        }
+    }
+    return s;
+}
+
+TEST(MqttTopicTrieTest, MatchesReferenceMatcher)
+{
+    mqtt_topic_trie_t trie = {0};
+    std::vector<std::string> filters;
+
+    srand(20241016);
+    for (int i = 0; i < RANDOM_FILTER_NUM; i++) {
+        std::string filter = random_topic(true);
+        if (filter.empty()) {
+            continue; // not a filter
+        }
+        ASSERT_TRUE(mqtt_topic_filter_valid(filter.c_str())) << filter;
+        mqtt_topic_node_t *node = mqtt_topic_trie_node_get(&trie, filter.c_str(), true);
+        ASSERT_TRUE(node != NULL);
+        node->entry = node; // any non NULL
+        filters.push_back(filter);
+    }
+
+    for (int i = 0; i < RANDOM_TOPIC_NUM; i++) {
+        std::string topic = random_topic(false);
+        std::set<void *> expect;
+        std::set<void *> got;
+
+        for (auto &filter : filters) {
+            if (reference_match(filter, topic)) {
+                expect.insert(mqtt_topic_trie_node_get(&trie, filter.c_str(), false));
+            }
+        }
+        mqtt_topic_trie_match(&trie, topic.c_str(), collect_cb, &got);
+        ASSERT_EQ(expect, got) << topic;
+    }
+
+    /* removing every filter frees every node */
+    for (auto &filter : filters) {
+        mqtt_topic_node_t *node = mqtt_topic_trie_node_get(&trie, filter.c_str(), false);
+        if (node) {
+            node->entry = NULL;
+            mqtt_topic_trie_node_put(&trie, node);
+        }
+    }
+    EXPECT_EQ(0, trie.node_cnt);
+    mqtt_topic_trie_clear(&trie, NULL, NULL);
+}
+
+TEST(MqttTopicTrieTest, SweepFreesEmptiedNodes)
+{
+    mqtt_topic_trie_t trie = {0};
+    const char *filters[] = {"a/b/c", "a/b/d", "a/+/c", "x/#"};
+
+    for (const char *filter : filters) {
+        mqtt_topic_trie_node_get(&trie, filter, true)->entry = &trie;
+    }
+    uint16_t all = trie.node_cnt;
+
+    /* the entries of a/b/c and x/# are dropped by the sweep callback */
+    mqtt_topic_trie_node_get(&trie, "a/b/c", false)->entry = NULL;
+    mqtt_topic_trie_node_get(&trie, "x/#", false)->entry = (void *)1;
+    mqtt_topic_trie_sweep(
+        &trie, [](mqtt_topic_node_t *node, void *arg) { node->entry = ((void *)1 == node->entry) ? NULL : node->entry; },
+        NULL);
+
+    EXPECT_EQ(all - 3, trie.node_cnt); // a/b/c, x/# and x
+    EXPECT_TRUE(NULL == mqtt_topic_trie_node_get(&trie, "x", false));
+    EXPECT_TRUE(NULL != mqtt_topic_trie_node_get(&trie, "a/b/d", false));
+    mqtt_topic_trie_clear(&trie, NULL, NULL);
+}
+
+static std::atomic<int> s_dispatched;
+
+static void sub_cb(uint16_t msgid, const mqtt_client_message_t *msg, void *userdata)
+{
+    s_dispatched++;
+}
+
+class MqttSubscribeTest : public testing::Test {
+  protected:
+    tuya_mqtt_context_t context;
+
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+    }
+
+    void SetUp() override
+    {
+        tuya_mqtt_config_t config = {0};
+
+        s_dispatched = 0;
+        config.host = "m1.tuyacn.com";
+        config.port = 8883;
+        config.timeout = 1000;
+        config.devid = "6c0ad0b3f29e8a1d5fqwer";
+        config.seckey = "0123456789abcdef";
+        config.localkey = "fedcba9876543210";
+        ASSERT_EQ(OPRT_OK, tuya_mqtt_init(&context, &config));
+    }
+
+    void TearDown() override
+    {
+        tuya_mqtt_destory(&context);
+    }
+};
+
+static std::string dev_topic(int i)
+{
+    char topic[64];
+    snprintf(topic, sizeof(topic), "smart/device/in/6c0ad0b3f29e8a%08d", i);
+    return topic;
+}
+
+TEST_F(MqttSubscribeTest, Dispatch500Subscriptions)
+{
+    std::vector<std::string> topics;
+
+    for (int i = 0; i < SUBSCRIBE_DEV_NUM; i++) {
+        topics.push_back(dev_topic(i));
+        ASSERT_EQ(OPRT_OK,
+                  tuya_mqtt_subscribe_message_callback_register(&context, topics.back().c_str(), sub_cb, NULL));
+    }
+    ASSERT_EQ(OPRT_OK, tuya_mqtt_subscribe_message_callback_register(&context, "smart/device/+/ota", sub_cb, NULL));
+
+    /* every message matches its own sub-device topic */
+    auto begin = std::chrono::steady_clock::now();
+    for (int l = 0; l < SUBSCRIBE_BENCH_LOOP; l++) {
+        for (auto &topic : topics) {
+            deliver(topic.c_str());
+        }
+    }
+    double dispatch_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() /
+                         (SUBSCRIBE_BENCH_LOOP * SUBSCRIBE_DEV_NUM);
+    EXPECT_EQ(SUBSCRIBE_BENCH_LOOP * SUBSCRIBE_DEV_NUM, s_dispatched.load());
+
+    /* the match alone */
+    int matched = 0;
+    begin = std::chrono::steady_clock::now();
+    for (int l = 0; l < SUBSCRIBE_BENCH_LOOP; l++) {
+        for (auto &topic : topics) {
+            mqtt_topic_trie_match(&context.subscribe_trie, topic.c_str(), count_cb, &matched);
+        }
+    }
+    double trie_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() /
+                     (SUBSCRIBE_BENCH_LOOP * SUBSCRIBE_DEV_NUM);
+    EXPECT_EQ(SUBSCRIBE_BENCH_LOOP * SUBSCRIBE_DEV_NUM, matched);
+
+    /* the list the trie replaced compared the topic with every entry */
+    matched = 0;
+    begin = std::chrono::steady_clock::now();
+    for (int l = 0; l < SUBSCRIBE_BENCH_LOOP; l++) {
+        for (auto &topic : topics) {
+            for (auto &entry : topics) {
+                if (entry.size() == topic.size() && 0 == memcmp(entry.c_str(), topic.c_str(), topic.size())) {
+                    matched++;
+                }
+            }
+        }
+    }
+    double list_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() /
+                     (SUBSCRIBE_BENCH_LOOP * SUBSCRIBE_DEV_NUM);
+    EXPECT_EQ(SUBSCRIBE_BENCH_LOOP * SUBSCRIBE_DEV_NUM, matched);
+
+    s_dispatched = 0;
+    deliver("smart/device/sub/ota");
+    EXPECT_EQ(1, s_dispatched.load());
+
+    printf("%d subscriptions: trie match %.0f ns, list scan %.0f ns, whole dispatch %.0f ns per message\n",
+           SUBSCRIBE_DEV_NUM + 1, trie_ns, list_ns, dispatch_ns);
+    EXPECT_LT(trie_ns, list_ns);
+}
+
+TEST_F(MqttSubscribeTest, RegisterWhileDispatching)
+{
+    std::atomic<bool> done(false);
+
+    ASSERT_EQ(OPRT_OK, tuya_mqtt_subscribe_message_callback_register(&context, "smart/device/+/#", sub_cb, NULL));
+
+    /* the loop thread dispatches while another thread changes the subscriptions, the trie grows and shrinks */
+    std::thread loop([&done] {
+        int i = 0;
+        while (!done) {
+            deliver(dev_topic(i++ % SUBSCRIBE_DEV_NUM).c_str());
+        }
+    });
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < SUBSCRIBE_DEV_NUM; i++) {
+            ASSERT_EQ(OPRT_OK, tuya_mqtt_subscribe_message_callback_register(&context, dev_topic(i).c_str(), sub_cb,
+                                                                             NULL));
+        }
+        for (int i = 0; i < SUBSCRIBE_DEV_NUM; i++) {
+            ASSERT_EQ(OPRT_OK, tuya_mqtt_subscribe_message_callback_unregister(&context, dev_topic(i).c_str()));
+        }
+    }
+    done = true;
+    loop.join();
+
+    /* only the wildcard is left */
+    s_dispatched = 0;
+    deliver(dev_topic(7).c_str());
+    EXPECT_EQ(1, s_dispatched.load());
+}
+
+static tuya_mqtt_context_t *s_context;
+
+static void self_unregister_cb(uint16_t msgid, const mqtt_client_message_t *msg, void *userdata)
+{
+    s_dispatched++;
+    /* drop every sub-device while the match is still walking them */
+    for (int i = 0; i < SUBSCRIBE_DEV_NUM; i++) {
+        tuya_mqtt_subscribe_message_callback_unregister(s_context, dev_topic(i).c_str());
+    }
+    tuya_mqtt_subscribe_message_callback_register(s_context, "smart/device/in/new", sub_cb, NULL);
+}
+
+TEST_F(MqttSubscribeTest, CallbackUnregistersSubscriptions)
+{
+    s_context = &context;
+    ASSERT_EQ(OPRT_OK, tuya_mqtt_subscribe_message_callback_register(&context, "smart/device/in/+",
+                                                                     self_unregister_cb, NULL));
+    for (int i = 0; i < SUBSCRIBE_DEV_NUM; i++) {
+        ASSERT_EQ(OPRT_OK,
+                  tuya_mqtt_subscribe_message_callback_register(&context, dev_topic(i).c_str(), sub_cb, NULL));
+    }
+    uint16_t nodes = context.subscribe_trie.node_cnt;
+
+    /* the '+' callback runs first and unregisters the exact match, which is not called anymore */
+    deliver(dev_topic(3).c_str());
+    EXPECT_EQ(1, s_dispatched.load());
+    EXPECT_EQ(nodes - SUBSCRIBE_DEV_NUM + 1, context.subscribe_trie.node_cnt);
+
+    s_dispatched = 0;
+    deliver("smart/device/in/new");
+    EXPECT_EQ(2, s_dispatched.load());
+}
+
+static std::atomic<bool> s_slow_running;
+static std::atomic<bool> s_slow_done;
+
+static void slow_cb(uint16_t msgid, const mqtt_client_message_t *msg, void *userdata)
+{
+    s_slow_running = true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    s_slow_done = true;
+}
+
+TEST_F(MqttSubscribeTest, UnregisterWaitsForRunningCallback)
+{
+    s_slow_running = false;
+    s_slow_done = false;
+    ASSERT_EQ(OPRT_OK, tuya_mqtt_subscribe_message_callback_register(&context, "smart/slow", slow_cb, NULL));
+
+    std::thread loop([] { deliver("smart/slow"); });
+    while (!s_slow_running) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ASSERT_EQ(OPRT_OK, tuya_mqtt_subscribe_message_callback_unregister(&context, "smart/slow"));
+    EXPECT_TRUE(s_slow_done.load());
+    loop.join();
+}
@@ -0,0 +1,313 @@
+/**
+ * @file test_ota_pipeline.cpp
+ * @brief UT and benchmark of the OTA flash writer pipeline of tuya_ota.
+ *
+ * The flash is a file, programmed page by page with a cost per 4 KB, and can
+ * fail at a given offset. The download is faked, it gives the image in range
+ * sized chunks with a receive cost per chunk like the real http download, and
+ * keeps the bytes the handler leaves. The image in the file and the hmac check
+ * have to be exact, a flash error has to stop the download. The time of the
+ * pipelined upgrade is printed against the receive and program time.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tuya_iot.h"
+#include "tuya_ota.h"
+#include "http_download.h"
+#include "mix_method.h"
+}
+
+#define OTA_FLASH_FILE  "./ut_ota_flash.bin"
+#define OTA_IMAGE_SIZE  (200 * 1024 + 123)
+#define OTA_RANGE_SIZE  4096
+#define OTA_SECKEY      "0123456789abcdef"
+#define OTA_BENCH_US    3000 // receive and program time of 4 KB
+
+#ifndef OTA_PIPELINE_BUF_NUM
+#define OTA_PIPELINE_BUF_NUM 2
+#endif
+
+/* flash stand-in */
+static int s_flash_fd = -1;
+static size_t s_flash_page;      // only whole pages are programmed but the last, 0: any length
+static size_t s_flash_fail_at;   // the write covering it fails, 0: never
+static int s_flash_program_us;   // per 4 KB
+static size_t s_flash_written;
+static bool s_flash_end;
+
+/* download stand-in */
+static std::string s_image;
+static int s_recv_us; // per chunk
+static size_t s_delivered;
+static bool s_aborted;
+static std::vector<int> s_status;
+static std::mutex s_done_mutex;
+static std::condition_variable s_done_cond;
+static bool s_done;
+
+extern "C" {
+OPERATE_RET tkl_ota_get_ability(uint32_t *image_size, TUYA_OTA_TYPE_E *type)
+{
+    *image_size = -1;
+    *type = TUYA_OTA_FULL;
+    return OPRT_OK;
+}
+
+OPERATE_RET tkl_ota_start_notify(uint32_t image_size, TUYA_OTA_TYPE_E type, TUYA_OTA_PATH_E path)
+{
+    if (s_flash_fd >= 0) {
+        close(s_flash_fd);
+    }
+    s_flash_fd = open(OTA_FLASH_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    return s_flash_fd < 0 ? OPRT_FILE_OPEN_FAILED : OPRT_OK;
+}
+
+OPERATE_RET tkl_ota_data_process(TUYA_OTA_DATA_T *pack, uint32_t *remain_len)
+{
+    uint32_t len = pack->len;
+
+    if (s_flash_page && pack->offset + pack->len < pack->total_len) {
+        len -= len % s_flash_page;
+    }
+    if (s_flash_fail_at && s_flash_fail_at >= pack->offset && s_flash_fail_at < pack->offset + pack->len) {
+        return OPRT_FILE_WRITE_FAILED;
+    }
+    if (s_flash_program_us) {
+        std::this_thread::sleep_for(std::chrono::microseconds((uint64_t)s_flash_program_us * len / 4096));
+    }
+    if (len != pwrite(s_flash_fd, pack->data, len, pack->offset)) {
+        return OPRT_FILE_WRITE_FAILED;
+    }
+    s_flash_written += len;
+    *remain_len = pack->len - len;
+    return OPRT_OK;
+}
+
+OPERATE_RET tkl_ota_end_notify(BOOL_T reset)
+{
+    s_flash_end = true;
+    return OPRT_OK;
+}
+
+OPERATE_RET tkl_ota_get_old_firmware_info(TUYA_OTA_FIRMWARE_INFO_T **info)
+{
+    return OPRT_NOT_SUPPORTED;
+}
+
+int matop_service_upgrade_status_update(matop_context_t *context, int channel, int status)
+{
+    s_status.push_back(status);
+    return OPRT_OK;
+}
+
+int tuya_mqtt_upgrade_progress_report(tuya_mqtt_context_t *context, int channel, int percent)
+{
+    return OPRT_OK;
+}
+
+int tuya_iotdns_query_domain_certs(char *url, uint8_t **cacert, uint16_t *cacert_len)
+{
+    *cacert = NULL;
+    *cacert_len = 0;
+    return OPRT_OK;
+}
+
+/* the events of http_download, in range sized chunks, the bytes left by the handler come again */
+int http_file_download(http_download_config_t *config)
+{
+    http_download_event_t event;
+    std::string remain;
+    size_t offset = 0;
+    int rt = OPRT_OK;
+
+    memset(&event, 0, sizeof(event));
+    event.user_data = config->user_data;
+    config->event_handler(DL_EVENT_START, &event);
+    event.file_size = s_image.size();
+    config->event_handler(DL_EVENT_ON_FILESIZE, &event);
+
+    while (offset < s_image.size()) {
+        size_t len = std::min((size_t)config->range_length, s_image.size() - offset);
+        if (s_recv_us) {
+            std::this_thread::sleep_for(std::chrono::microseconds(s_recv_us));
+        }
+        std::string data = remain + s_image.substr(offset, len);
+        event.data = &data[0];
+        event.data_len = data.size();
+        event.offset = offset - remain.size();
+        event.remain_len = remain.size();
+        config->event_handler(DL_EVENT_ON_DATA, &event);
+        if (event.abort) {
+            s_aborted = true;
+            rt = OPRT_COM_ERROR;
+            break;
+        }
+        offset += len;
+        s_delivered = offset;
+        remain = data.substr(data.size() - event.remain_len);
+    }
+    config->event_handler(OPRT_OK == rt ? DL_EVENT_FINISH : DL_EVENT_FAULT, &event);
+
+    std::lock_guard<std::mutex> lock(s_done_mutex);
+    s_done = true;
+    s_done_cond.notify_all();
+    return rt;
+}
+}
+
+static tuya_iot_client_t s_client;
+
+class OtaPipelineTest : public testing::Test {
+  protected:
+    static void SetUpTestCase()
+    {
+        tuya_ota_config_t config;
+
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        strcpy(s_client.activate.seckey, OTA_SECKEY);
+        memset(&config, 0, sizeof(config));
+        config.client = &s_client;
+        config.range_size = OTA_RANGE_SIZE;
+        ASSERT_EQ(OPRT_OK, tuya_ota_init(&config));
+    }
+
+    static void TearDownTestCase()
+    {
+        if (s_flash_fd >= 0) {
+            close(s_flash_fd);
+            s_flash_fd = -1;
+        }
+        unlink(OTA_FLASH_FILE);
+    }
+
+    void SetUp() override
+    {
+        std::mt19937 rng(OTA_IMAGE_SIZE);
+
+        s_image.resize(OTA_IMAGE_SIZE);
+        for (auto &c : s_image) {
+            c = (char)rng();
+        }
+        s_flash_page = 0;
+        s_flash_fail_at = 0;
+        s_flash_program_us = 0;
+        s_flash_written = 0;
+        s_flash_end = false;
+        s_recv_us = 0;
+        s_delivered = 0;
+        s_aborted = false;
+        s_status.clear();
+        s_done = false;
+    }
+
+    /* the hmac of the image the cloud sends with the upgrade */
+    static std::string image_hmac(void)
+    {
+        TKL_HASH_HANDLE sha256 = NULL;
+        uint8_t hash[32], hmac[32];
+        char hex[32 * 2 + 1] = {0};
+
+        tal_sha256_create_init(&sha256);
+        tal_sha256_starts_ret(sha256, 0);
+        tal_sha256_update_ret(sha256, (const uint8_t *)s_image.data(), s_image.size());
+        tal_sha256_finish_ret(sha256, hash);
+        tal_sha256_free(sha256);
+        hex2str((uint8_t *)hex, hash, 32);
+        tal_sha256_mac((const uint8_t *)OTA_SECKEY, strlen(OTA_SECKEY), (const uint8_t *)hex, 32 * 2, hmac);
+        hex2str((uint8_t *)hex, hmac, 32);
+        return hex;
+    }
+
+    void upgrade(void)
+    {
+        char json[512];
+
+        snprintf(json, sizeof(json),
+                 "{\"type\":0,\"size\":\"%zu\",\"httpsUrl\":\"https://fw.example.com/fw.bin\",\"hmac\":\"%s\","
+                 "\"md5\":\"\"}",
+                 s_image.size(), image_hmac().c_str());
+        cJSON *upgrade = cJSON_Parse(json);
+        ASSERT_NE(nullptr, upgrade);
+        ASSERT_EQ(OPRT_OK, tuya_ota_start(upgrade));
+        cJSON_Delete(upgrade);
+
+        std::unique_lock<std::mutex> lock(s_done_mutex);
+        ASSERT_TRUE(s_done_cond.wait_for(lock, std::chrono::seconds(10), [] { return s_done; }));
+    }
+
+    static std::string flash_read(void)
+    {
+        std::string flash(s_image.size() + 1, '\0');
+        ssize_t n = pread(s_flash_fd, &flash[0], flash.size(), 0);
+        flash.resize(n < 0 ? 0 : n);
+        return flash;
+    }
+};
+
+TEST_F(OtaPipelineTest, ImageIsExactInFlash)
+{
+    for (size_t page : {0, 256, 1000}) {
+        SetUp();
+        s_flash_page = page;
+        upgrade();
+        EXPECT_TRUE(s_image == flash_read()) << "page " << page;
+        EXPECT_EQ(s_image.size(), s_flash_written);
+        ASSERT_FALSE(s_status.empty());
+        EXPECT_EQ(TUS_UPGRD_FINI, s_status.back()) << "page " << page;
+        EXPECT_TRUE(s_flash_end);
+    }
+}
+
+TEST_F(OtaPipelineTest, FlashErrorStopsDownload)
+{
+    s_flash_fail_at = 64 * 1024;
+    s_flash_program_us = 500;
+    upgrade();
+    EXPECT_TRUE(s_aborted);
+    // the download goes on for the blocks in the pipe at most
+    EXPECT_LE(s_delivered, s_flash_fail_at + (OTA_PIPELINE_BUF_NUM + 1) * OTA_RANGE_SIZE);
+    ASSERT_FALSE(s_status.empty());
+    EXPECT_EQ(TUS_UPGRD_EXEC, s_status.back());
+    EXPECT_FALSE(s_flash_end);
+
+    /* the next upgrade starts with a new writer */
+    SetUp();
+    upgrade();
+    EXPECT_TRUE(s_image == flash_read());
+    EXPECT_EQ(TUS_UPGRD_FINI, s_status.back());
+}
+
+TEST_F(OtaPipelineTest, PipelineBenchmark)
+{
+    s_recv_us = OTA_BENCH_US;
+    s_flash_program_us = OTA_BENCH_US;
+
+    auto begin = std::chrono::steady_clock::now();
+    upgrade();
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+    int chunks = (OTA_IMAGE_SIZE + OTA_RANGE_SIZE - 1) / OTA_RANGE_SIZE;
+    double serial_ms = 2.0 * chunks * OTA_BENCH_US / 1000;
+    printf("%d KB image, %d us receive and program per 4 KB: %.0f ms pipelined, %.0f ms receive plus program\n",
+           OTA_IMAGE_SIZE / 1024, OTA_BENCH_US, ms, serial_ms);
+    EXPECT_TRUE(s_image == flash_read());
+    EXPECT_EQ(TUS_UPGRD_FINI, s_status.back());
+    EXPECT_LT(ms, serial_ms * 3 / 4);
+}
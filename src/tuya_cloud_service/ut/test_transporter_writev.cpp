@@ -0,0 +1,376 @@
+/**
+ * @file test_transporter_writev.cpp
+ * @brief UT and benchmark of tuya_transporter_writev and the vectored PUBLISH
+ * send of coreMQTT.
+ *
+ * A fake transporter writes at most a given length per call and can fail a
+ * given call, like a socket under pressure. Random buffers are written and
+ * what reaches the fake has to be their concatenation. PUBLISH packets are
+ * sent by coreMQTT once buffer by buffer and once through writev, the bytes
+ * must be the same, and the writes per packet, each one TLS record on the
+ * TLS transporter, and the cost are printed. The gather helper is run with
+ * the gather buffer of the TLS transporter and without one, and the TCP
+ * transporter sends buffers over a loopback connection in one sendmsg.
+ *
+ * @copyright Copyright (c) 2021-2024 Tuya Inc. All Rights Reserved.
+ *
+ */
+
+#include <gtest/gtest.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include "tal_api.h"
+#include "tal_network.h"
+#include "tuya_transporter.h"
+#include "tcp_transporter.h"
+#include "core_mqtt.h"
+}
+
+#define WRITEV_RANDOM_LOOP   2000
+#define PUBLISH_TOPIC        "smart/device/out/6c0ad0b3f29e8a1d5fqwer"
+#define PUBLISH_DP_LEN       120 // an encrypted report of a few dps
+#define PUBLISH_BENCH_LOOP   20000
+#define TLS_RECORD_OVERHEAD  29 // header, explicit nonce and tag of an AES-GCM record
+
+struct fake_transporter_t {
+    struct tuya_transporter_inter_t base;
+    std::string wire;
+    int max_write; // 0 for no limit
+    int fail_write; // the write that fails, counted from 1, 0 for none
+    int writes;
+};
+
+static fake_transporter_t s_fake;
+
+static OPERATE_RET fake_write(tuya_transporter_t t, uint8_t *buf, int len, int timeout_ms)
+{
+    fake_transporter_t *fake = (fake_transporter_t *)t;
+
+    fake->writes++;
+    if (fake->writes == fake->fail_write) {
+        return OPRT_SEND_ERR;
+    }
+    if (fake->max_write > 0 && len > fake->max_write) {
+        len = fake->max_write;
+    }
+    fake->wire.append((const char *)buf, len);
+    return len;
+}
+
+/* the transport functions of the mqtt client wrapper */
+static int32_t network_send(NetworkContext_t *pNetwork, const void *pBuffer, size_t bytesToSend)
+{
+    return tuya_transporter_write(*pNetwork, (uint8_t *)pBuffer, (int)bytesToSend, 0);
+}
+
+static int32_t network_writev(NetworkContext_t *pNetwork, TransportOutVector_t *pIoVec, size_t ioVecCount)
+{
+    tuya_transporter_iovec_t iov[2];
+
+    for (size_t i = 0; i < ioVecCount; i++) {
+        iov[i].buf = (uint8_t *)pIoVec[i].iov_base;
+        iov[i].len = (int)pIoVec[i].iov_len;
+    }
+    return tuya_transporter_writev(*pNetwork, iov, (int)ioVecCount, 0);
+}
+
+static int32_t network_recv(NetworkContext_t *pNetwork, void *pBuffer, size_t bytesToRecv)
+{
+    return 0;
+}
+
+static uint32_t fake_time(void)
+{
+    return 0;
+}
+
+static void fake_event_cb(MQTTContext_t *pContext, MQTTPacketInfo_t *pPacketInfo,
+                          MQTTDeserializedInfo_t *pDeserializedInfo)
+{
+}
+
+class TransporterWritevTest : public testing::Test {
+  protected:
+    NetworkContext_t network = (tuya_transporter_t)&s_fake;
+    uint8_t mqtt_buffer[512];
+    MQTTContext_t mqtt;
+
+    static void SetUpTestCase()
+    {
+        tal_log_init(TAL_LOG_LEVEL_ERR, 1024, NULL);
+        tuya_transporter_set_func((tuya_transporter_t)&s_fake, NULL, NULL, NULL, fake_write, NULL, NULL, NULL, NULL);
+    }
+
+    void SetUp() override
+    {
+        s_fake.wire.clear();
+        s_fake.max_write = 0;
+        s_fake.fail_write = 0;
+        s_fake.writes = 0;
+    }
+
+    void mqtt_init(bool writev)
+    {
+        TransportInterface_t transport = {0};
+        MQTTFixedBuffer_t network_buffer = {mqtt_buffer, sizeof(mqtt_buffer)};
+
+        transport.pNetworkContext = &network;
+        transport.send = network_send;
+        transport.recv = network_recv;
+        transport.writev = writev ? network_writev : NULL;
+        ASSERT_EQ(MQTTSuccess, MQTT_Init(&mqtt, &transport, fake_time, fake_event_cb, &network_buffer, NULL));
+        mqtt.connectStatus = MQTTConnected;
+    }
+
+    std::string publish(bool writev, const std::string &payload)
+    {
+        MQTTPublishInfo_t info = {};
+
+        mqtt_init(writev);
+        s_fake.wire.clear();
+        info.qos = MQTTQoS0;
+        info.pTopicName = PUBLISH_TOPIC;
+        info.topicNameLength = sizeof(PUBLISH_TOPIC) - 1;
+        info.pPayload = payload.data();
+        info.payloadLength = payload.size();
+        EXPECT_EQ(MQTTSuccess, MQTT_Publish(&mqtt, &info, 0));
+        return s_fake.wire;
+    }
+};
+
+static std::string random_bytes(std::mt19937 &rng, int len)
+{
+    std::string data(len, '\0');
+    for (int i = 0; i < len; i++) {
+        data[i] = (char)rng();
+    }
+    return data;
+}
+
+TEST_F(TransporterWritevTest, RandomBuffersWithShortWrites)
+{
+    std::mt19937 rng(1);
+
+    for (int loop = 0; loop < WRITEV_RANDOM_LOOP; loop++) {
+        std::vector<std::string> data(1 + rng() % 6);
+        std::vector<tuya_transporter_iovec_t> iov;
+        std::string all;
+
+        for (auto &d : data) {
+            d = random_bytes(rng, (rng() % 4) ? rng() % 64 : rng() % 1500);
+            iov.push_back({(uint8_t *)d.data(), (int)d.size()});
+            all += d;
+        }
+
+        /* the caller resumes a short write from where it stopped, like coreMQTT does */
+        SetUp();
+        s_fake.max_write = (loop % 2) ? 0 : 1 + rng() % 700;
+        size_t sent = 0;
+        while (sent < all.size()) {
+            std::vector<tuya_transporter_iovec_t> rest;
+            size_t skip = sent;
+            for (auto &v : iov) {
+                if (skip >= (size_t)v.len) {
+                    skip -= v.len;
+                    continue;
+                }
+                rest.push_back({v.buf + skip, v.len - (int)skip});
+                skip = 0;
+            }
+            int ret = tuya_transporter_writev((tuya_transporter_t)&s_fake, rest.data(), (int)rest.size(), 0);
+            ASSERT_GT(ret, 0);
+            ASSERT_EQ(sent + ret, s_fake.wire.size());
+            sent += ret;
+        }
+        ASSERT_EQ(all, s_fake.wire) << "loop " << loop;
+        if (0 == s_fake.max_write) {
+            ASSERT_LE(s_fake.writes, (int)data.size());
+        }
+    }
+}
+
+TEST_F(TransporterWritevTest, SmallBuffersGoOutInOneWrite)
+{
+    std::string head = "\x30\x2d", topic = PUBLISH_TOPIC, payload(100, 'p');
+    tuya_transporter_iovec_t iov[] = {
+        {(uint8_t *)head.data(), (int)head.size()},
+        {(uint8_t *)topic.data(), (int)topic.size()},
+        {NULL, 0},
+        {(uint8_t *)payload.data(), (int)payload.size()},
+    };
+
+    EXPECT_EQ((int)(head.size() + topic.size() + payload.size()),
+              tuya_transporter_writev((tuya_transporter_t)&s_fake, iov, 4, 0));
+    EXPECT_EQ(1, s_fake.writes);
+    EXPECT_EQ(head + topic + payload, s_fake.wire);
+}
+
+TEST_F(TransporterWritevTest, FailedWriteReturnsWrittenBytes)
+{
+    std::string head(40, 'h'), payload(2000, 'p');
+    tuya_transporter_iovec_t iov[] = {
+        {(uint8_t *)head.data(), (int)head.size()},
+        {(uint8_t *)payload.data(), (int)payload.size()},
+    };
+
+    /* the head goes out topped up with the start of the payload, the rest fails */
+    s_fake.fail_write = 2;
+    int ret = tuya_transporter_writev((tuya_transporter_t)&s_fake, iov, 2, 0);
+    EXPECT_GT(ret, (int)head.size());
+    EXPECT_EQ((size_t)ret, s_fake.wire.size());
+    EXPECT_EQ(head + payload.substr(0, ret - head.size()), s_fake.wire);
+
+    SetUp();
+    s_fake.fail_write = 1;
+    EXPECT_EQ(OPRT_SEND_ERR, tuya_transporter_writev((tuya_transporter_t)&s_fake, iov, 2, 0));
+}
+
+TEST_F(TransporterWritevTest, PublishSameBytesWithWritev)
+{
+    std::mt19937 rng(2);
+
+    for (int len : {0, 1, PUBLISH_DP_LEN, 300, 2000}) {
+        std::string payload = random_bytes(rng, len);
+        std::string expect = publish(false, payload);
+
+        for (int max_write : {0, 1, 7, 100}) {
+            SetUp();
+            s_fake.max_write = max_write;
+            EXPECT_EQ(expect, publish(true, payload)) << "len " << len << " max_write " << max_write;
+        }
+    }
+}
+
+TEST_F(TransporterWritevTest, PublishBenchmark)
+{
+    std::mt19937 rng(3);
+    std::string payload = random_bytes(rng, PUBLISH_DP_LEN);
+    MQTTPublishInfo_t info = {};
+    double ns[2] = {0};
+    double writes[2] = {0};
+
+    info.qos = MQTTQoS0;
+    info.pTopicName = PUBLISH_TOPIC;
+    info.topicNameLength = sizeof(PUBLISH_TOPIC) - 1;
+    info.pPayload = payload.data();
+    info.payloadLength = payload.size();
+
+    for (int writev = 0; writev < 2; writev++) {
+        mqtt_init(writev);
+        SetUp();
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < PUBLISH_BENCH_LOOP; i++) {
+            MQTT_Publish(&mqtt, &info, 0);
+            if (s_fake.wire.size() > (1 << 20)) {
+                s_fake.wire.clear();
+            }
+        }
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        ns[writev] = std::chrono::duration<double, std::nano>(elapsed).count() / PUBLISH_BENCH_LOOP;
+        writes[writev] = (double)s_fake.writes / PUBLISH_BENCH_LOOP;
+    }
+
+    printf("%d byte PUBLISH: send %.1f writes %.0f ns, writev %.1f writes %.0f ns, %.0f bytes of TLS record "
+           "overhead saved per packet\n",
+           PUBLISH_DP_LEN, writes[0], ns[0], writes[1], ns[1], (writes[0] - writes[1]) * TLS_RECORD_OVERHEAD);
+    EXPECT_EQ(2, writes[0]);
+    EXPECT_EQ(1, writes[1]);
+}
+
+TEST_F(TransporterWritevTest, GatherBufferOfTheTransporter)
+{
+    std::string head(5, 'h'), payload(600, 'p'), tail(16, 't');
+    tuya_transporter_iovec_t iov[] = {
+        {(uint8_t *)head.data(), (int)head.size()},
+        {(uint8_t *)payload.data(), (int)payload.size()},
+        {(uint8_t *)tail.data(), (int)tail.size()},
+    };
+    uint8_t gather[1024];
+
+    /* the 1024 bytes of the TLS transporter take the whole packet, one record */
+    EXPECT_EQ((int)(head.size() + payload.size() + tail.size()),
+              tuya_transporter_writev_gather((tuya_transporter_t)&s_fake, iov, 3, 0, gather, sizeof(gather)));
+    EXPECT_EQ(1, s_fake.writes);
+    EXPECT_EQ(head + payload + tail, s_fake.wire);
+
+    /* no gather buffer, like the TLS transporter out of memory */
+    SetUp();
+    EXPECT_EQ((int)(head.size() + payload.size() + tail.size()),
+              tuya_transporter_writev_gather((tuya_transporter_t)&s_fake, iov, 3, 0, NULL, 0));
+    EXPECT_EQ(3, s_fake.writes);
+    EXPECT_EQ(head + payload + tail, s_fake.wire);
+}
+
+TEST_F(TransporterWritevTest, TcpSendsBuffersInOneSendmsg)
+{
+    struct sockaddr_in addr = {};
+    socklen_t addr_len = sizeof(addr);
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+
+    ASSERT_GE(server, 0);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(0, bind(server, (struct sockaddr *)&addr, sizeof(addr)));
+    ASSERT_EQ(0, listen(server, 1));
+    ASSERT_EQ(0, getsockname(server, (struct sockaddr *)&addr, &addr_len));
+
+    tuya_transporter_t tcp = tuya_tcp_transporter_create();
+    ASSERT_NE(nullptr, tcp);
+    ASSERT_EQ(OPRT_OK, tuya_transporter_connect(tcp, "127.0.0.1", ntohs(addr.sin_port), 1000));
+    int peer = accept(server, NULL, NULL);
+    ASSERT_GE(peer, 0);
+
+    /* more buffers than one sendmsg takes, the caller goes on from the sent length */
+    std::mt19937 rng(4);
+    std::vector<std::string> data(TAL_NET_SENDV_MAX + 4);
+    std::vector<tuya_transporter_iovec_t> iov;
+    std::string all;
+    for (auto &d : data) {
+        d = random_bytes(rng, 1 + rng() % 200);
+        iov.push_back({(uint8_t *)d.data(), (int)d.size()});
+        all += d;
+    }
+
+    size_t sent = 0;
+    int calls = 0;
+    while (sent < all.size()) {
+        std::vector<tuya_transporter_iovec_t> rest;
+        size_t skip = sent;
+        for (auto &v : iov) {
+            if (skip >= (size_t)v.len) {
+                skip -= v.len;
+                continue;
+            }
+            rest.push_back({v.buf + skip, v.len - (int)skip});
+            skip = 0;
+        }
+        int ret = tuya_transporter_writev(tcp, rest.data(), (int)rest.size(), 1000);
+        ASSERT_GT(ret, 0);
+        sent += ret;
+        calls++;
+    }
+    EXPECT_EQ(2, calls);
+
+    std::string wire;
+    char buf[512];
+    while (wire.size() < all.size()) {
+        ssize_t len = recv(peer, buf, sizeof(buf), 0);
+        ASSERT_GT(len, 0);
+        wire.append(buf, len);
+    }
+    EXPECT_EQ(all, wire);
+
+    close(peer);
+    close(server);
+    tuya_transporter_close(tcp);
+    tuya_transporter_destroy(tcp);
+}
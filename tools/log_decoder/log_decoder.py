@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+##
+# @file log_decoder.py
+# @brief rebuild the text of binary log written by tal_log_add_binary_term
+# @author Tuya
+# @version 1.0.0
+# @date 2026-10-16
+#
+# frame: magic(0xA5) len(1) payload(len) xor checksum of payload(1)
+# payload: level|flags(1) fmt_id(4, LE) file_id(2, LE) line(varint) time(varint) args...
+#
+# usage: log_decoder.py -t tal_log_fmt.json [-i uart.bin] [--ms]
+# bytes out of the frames (raw prints, boot logs) are passed through.
+#
+
+
+import re
+import sys
+import json
+import time
+import struct
+import argparse
+
+
+MAGIC = 0xA5
+FLAG_TIME_ABS = 0x08
+FLAG_TRUNC = 0x10
+LEVEL_STR = ["E", "W", "N", "I", "D", "T", "?", "?"]
+
+# flags width precision length conversion
+CONV_PATTERN = re.compile(r'%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|z|j|t|L)?([a-zA-Z%])')
+
+
+class ArgReader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def varint(self):
+        value = 0
+        shift = 0
+        while True:
+            if self.pos >= len(self.data):
+                raise IndexError
+            b = self.data[self.pos]
+            self.pos += 1
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return value
+
+    def sint(self):
+        v = self.varint()
+        return (v >> 1) ^ -(v & 1)
+
+    def double(self):
+        if self.pos + 8 > len(self.data):
+            raise IndexError
+        v = struct.unpack_from("<d", self.data, self.pos)[0]
+        self.pos += 8
+        return v
+
+    def string(self):
+        n = self.varint()
+        s = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return s.decode("utf-8", "replace")
+
+
+##
+# @brief format the C format string with the packed arguments
+#
+# @return text, missing arguments of truncated record are shown as "?"
+def c_format(fmt, reader):
+    out = []
+    last = 0
+    for m in CONV_PATTERN.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, width, prec, _, conv = m.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        try:
+            if width == "*":
+                width = str(reader.sint())
+            if prec == "*":
+                prec = str(reader.sint())
+            spec = "%" + flags + (width or "") + ("." + prec if prec is not None else "")
+            if conv in "di":
+                out.append((spec + "d") % reader.sint())
+            elif conv in "uxXo":
+                out.append((spec + ("d" if conv == "u" else conv)) % reader.varint())
+            elif conv == "c":
+                out.append((spec + "c") % (reader.varint() & 0xFF))
+            elif conv == "p":
+                out.append((spec + "s") % ("0x%x" % reader.varint()))
+            elif conv == "s":
+                out.append((spec + "s") % reader.string())
+            elif conv in "fFeEgG":
+                out.append((spec + conv) % reader.double())
+            elif conv in "aA":
+                out.append(reader.double().hex())
+            elif conv == "n":
+                pass
+            else:
+                out.append(m.group(0))
+        except IndexError:
+            out.append("?")
+    out.append(fmt[last:])
+    return "".join(out)
+
+
+class Decoder:
+    def __init__(self, table, show_ms):
+        self.table = table
+        self.show_ms = show_ms
+        self.time_ms = None
+
+    ##
+    # @brief find the entry of the record, the file id and the line pick one
+    # of the call sites sharing the format
+    def lookup(self, fid, file_id, line):
+        entries = self.table.get("%08x" % fid)
+        if not entries:
+            return None
+        in_file = [e for e in entries if e["file_id"] == file_id] or entries
+        for e in in_file:
+            if e["line"] == line:
+                return e
+        return in_file[0]
+
+    def record(self, payload):
+        head = payload[0]
+        fid, file_id = struct.unpack_from("<IH", payload, 1)
+        reader = ArgReader(payload[7:])
+        line = reader.varint()
+        t = reader.varint()
+        if head & FLAG_TIME_ABS:
+            self.time_ms = t
+        elif self.time_ms is not None:
+            self.time_ms += t
+
+        if self.time_ms is None:
+            stamp = "--"
+        else:
+            tm = time.localtime(self.time_ms // 1000)
+            stamp = "%02d-%02d %02d:%02d:%02d" % (tm.tm_mon, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec)
+            if self.show_ms:
+                stamp += ":%d" % (self.time_ms % 1000)
+
+        entry = self.lookup(fid, file_id, line)
+        if entry is None:
+            file = "?"
+            msg = "<unknown format %08x, %d bytes args>" % (fid, len(payload) - reader.pos - 7)
+        else:
+            file = entry["file"]
+            msg = c_format(entry["fmt"], reader)
+        if head & FLAG_TRUNC:
+            msg += " ..."
+        return "[%s ty %s][%s:%d] %s\n" % (stamp, LEVEL_STR[head & 0x07], file, line, msg)
+
+    ##
+    # @brief decode the stream, bytes out of the frames are passed through
+    #
+    # @return bytes not consumed, wait for more data
+    def feed(self, data, out):
+        pos = 0
+        while pos < len(data):
+            start = data.find(bytes([MAGIC]), pos)
+            if start < 0:
+                out.write(data[pos:].decode("utf-8", "replace"))
+                return b""
+            out.write(data[pos:start].decode("utf-8", "replace"))
+            if start + 2 > len(data) or start + data[start + 1] + 3 > len(data):
+                return data[start:]
+            n = data[start + 1]
+            payload = data[start + 2:start + 2 + n]
+            checksum = 0
+            for b in payload:
+                checksum ^= b
+            if n < 9 or checksum != data[start + 2 + n]:
+                # not a frame, the byte belongs to the text
+                out.write(data[start:start + 1].decode("latin-1"))
+                pos = start + 1
+                continue
+            try:
+                out.write(self.record(payload))
+            except (IndexError, struct.error):
+                out.write("<bad record>\n")
+            pos = start + n + 3
+        return b""
+
+
+def main():
+    parser = argparse.ArgumentParser(description="decode binary log of tal_log")
+    parser.add_argument("-t", "--table", required=True, help="format table generated by log_fmt_table.py")
+    parser.add_argument("-i", "--input", help="binary log file, default stdin")
+    parser.add_argument("--ms", action="store_true", help="show millisecond")
+    args = parser.parse_args()
+
+    with open(args.table, "r", encoding="utf-8") as f:
+        table = json.load(f)["formats"]
+
+    decoder = Decoder(table, args.ms)
+    fin = open(args.input, "rb") if args.input else sys.stdin.buffer
+    pending = b""
+    while True:
+        chunk = fin.read(4096)
+        if not chunk:
+            break
+        pending = decoder.feed(pending + chunk, sys.stdout)
+        sys.stdout.flush()
+    if pending:
+        sys.stdout.write(pending.decode("utf-8", "replace"))
+    if args.input:
+        fin.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,134 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+##
+# @file log_fmt_table.py
+# @brief scan sources and generate the format string table of binary log
+# @author Tuya
+# @version 1.0.0
+# @date 2026-10-16
+#
+# The id of a format string is FNV-1a of the string after the C escape
+# sequences are processed, same as __log_fmt_id in tal_log.c. A record also
+# carries the file id, FNV-1a of the file base name folded to 16 bits, so the
+# same format used in several files is decoded with the right file.
+#
+
+
+import os
+import re
+import sys
+import json
+import argparse
+
+
+SRC_SUFFIX = (".c", ".h", ".cpp", ".cc")
+
+# PR_XXX("fmt" "fmt", ...) and tal_log_print(level, file, line, "fmt", ...)
+C_STR = r'"(?:[^"\\\n]|\\.)*"'
+PR_PATTERN = re.compile(
+    r'\bPR_(?:ERR|WARN|NOTICE|INFO|DEBUG|TRACE)\s*\(\s*((?:' + C_STR + r'\s*)+)([,)]?)')
+PRINT_PATTERN = re.compile(
+    r'\btal_log_print\s*\([^,;"]*,[^,;"]*,[^,;"]*,\s*((?:' + C_STR + r'\s*)+)([,)]?)')
+
+ESCAPES = {
+    'n': '\n', 't': '\t', 'r': '\r', 'a': '\a', 'b': '\b', 'f': '\f', 'v': '\v',
+    '\\': '\\', '"': '"', "'": "'", '?': '?',
+}
+
+
+def fmt_id(fmt):
+    h = 0x811C9DC5
+    for c in fmt.encode("latin-1"):
+        h ^= c
+        h = (h * 0x01000193) & 0xFFFFFFFF
+    return h
+
+
+def file_id(name):
+    h = fmt_id(name)
+    return ((h >> 16) ^ h) & 0xFFFF
+
+
+##
+# @brief concatenate adjacent literals and process the escape sequences
+#
+# @param literals: source text of the literals, quotes included
+#
+# @return the C string, one char per byte
+def c_unescape(literals):
+    out = []
+    for lit in re.findall(C_STR, literals):
+        body = lit[1:-1]
+        i = 0
+        while i < len(body):
+            c = body[i]
+            i += 1
+            if c != '\\':
+                out.append(c)
+                continue
+            e = body[i]
+            i += 1
+            if e in ESCAPES:
+                out.append(ESCAPES[e])
+            elif e == 'x':
+                m = re.match(r'[0-9a-fA-F]+', body[i:])
+                out.append(chr(int(m.group(0), 16) & 0xFF))
+                i += len(m.group(0))
+            elif e in '01234567':
+                m = re.match(r'[0-7]{0,2}', body[i:])
+                out.append(chr(int(e + m.group(0), 8) & 0xFF))
+                i += len(m.group(0))
+            else:
+                out.append(e)
+    return "".join(out)
+
+
+def scan_file(path, table, stats):
+    with open(path, "rb") as f:
+        text = f.read().decode("latin-1")
+    name = os.path.basename(path)
+    fid = file_id(name)
+    for pattern in (PR_PATTERN, PRINT_PATTERN):
+        for m in pattern.finditer(text):
+            if not m.group(2):
+                # literal joined with a macro, e.g. "%" PRIu32, can not be resolved here
+                stats["skipped"] += 1
+                continue
+            fmt = c_unescape(m.group(1))
+            line = text.count("\n", 0, m.start()) + 1
+            key = "%08x" % fmt_id(fmt)
+            entries = table.setdefault(key, [])
+            if any(e["fmt"] != fmt and e["file_id"] == fid for e in entries):
+                print("[log_fmt_table] id collision %s: %s:%d" % (key, name, line), file=sys.stderr)
+            entries.append({"fmt": fmt, "file": name, "file_id": fid, "line": line})
+            stats["found"] += 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description="generate format string table of binary log")
+    parser.add_argument("-s", "--src", action="append", required=True, help="source directory or file")
+    parser.add_argument("-o", "--output", required=True, help="output json file")
+    args = parser.parse_args()
+
+    table = {}
+    stats = {"found": 0, "skipped": 0}
+    for src in args.src:
+        if os.path.isfile(src):
+            scan_file(src, table, stats)
+            continue
+        for root, _, files in os.walk(src):
+            for f in files:
+                if f.endswith(SRC_SUFFIX):
+                    scan_file(os.path.join(root, f), table, stats)
+
+    out_dir = os.path.dirname(os.path.abspath(args.output))
+    if not os.path.exists(out_dir):
+        os.makedirs(out_dir)
+    with open(args.output, "w", encoding="utf-8") as f:
+        json.dump({"version": 2, "formats": table}, f, ensure_ascii=False, indent=1)
+
+    print("[log_fmt_table] %d formats, %d skipped -> %s" % (stats["found"], stats["skipped"], args.output))
+
+
+if __name__ == "__main__":
+    main()
@@ -10,8 +10,15 @@
  */
 
 // --- BEGIN: user defines and implements ---
+#include <stdio.h>
 #include "tkl_ota.h"
+#include "tkl_fs.h"
 #include "tuya_error_code.h"
+
+// the image is written to a file instead of the flash
+#define OTA_FILE_NAME "./tuya_ota.bin"
+
+static TUYA_FILE s_ota_file = NULL;
 // --- END: user defines and implements ---
 
 /**
@@ -48,6 +55,14 @@ OPERATE_RET tkl_ota_get_ability(uint32_t *image_size, TUYA_OTA_TYPE_E *type)
 OPERATE_RET tkl_ota_start_notify(uint32_t image_size, TUYA_OTA_TYPE_E type, TUYA_OTA_PATH_E path)
 {
     // --- BEGIN: user implements ---
+    if (s_ota_file) {
+        tkl_fclose(s_ota_file);
+    }
+    s_ota_file = tkl_fopen(OTA_FILE_NAME, "wb+");
+    if (NULL == s_ota_file) {
+        return OPRT_FILE_OPEN_FAILED;
+    }
+
     return OPRT_OK;
     // --- END: user implements ---
 }
@@ -65,6 +80,19 @@ OPERATE_RET tkl_ota_start_notify(uint32_t image_size, TUYA_OTA_TYPE_E type, TUYA
 OPERATE_RET tkl_ota_data_process(TUYA_OTA_DATA_T *pack, uint32_t *remain_len)
 {
     // --- BEGIN: user implements ---
+    if (!s_ota_file) {
+        return OPRT_RESOURCE_NOT_READY;
+    }
+
+    if (0 != tkl_fseek(s_ota_file, pack->offset, SEEK_SET)) {
+        return OPRT_FILE_OPEN_FAILED;
+    }
+
+    if (pack->len != tkl_fwrite(pack->data, pack->len, s_ota_file)) {
+        return OPRT_FILE_WRITE_FAILED;
+    }
+    *remain_len = 0;
+
     return OPRT_OK;
     // --- END: user implements ---
 }
@@ -81,6 +109,13 @@ OPERATE_RET tkl_ota_data_process(TUYA_OTA_DATA_T *pack, uint32_t *remain_len)
 OPERATE_RET tkl_ota_end_notify(BOOL_T reset)
 {
     // --- BEGIN: user implements ---
+    if (s_ota_file) {
+        tkl_fflush(s_ota_file);
+        tkl_fsync(tkl_fileno(s_ota_file));
+        tkl_fclose(s_ota_file);
+        s_ota_file = NULL;
+    }
+
     return OPRT_OK;
     // --- END: user implements ---
 }